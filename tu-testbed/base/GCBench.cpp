@@ -1,6 +1,12 @@
 // modified by Thatcher Ulrich for testing tu_gc::
 //
-// cl -Ox -DNDEBUG=1 -Zi -GX GCBench.cpp tu_gc_singlethreaded_marksweep.cpp -I.. -D_HAS_EXCEPTIONS=1 -DGC winmm.lib
+// Runs the benchmark with explicit new/delete and with each tu_gc
+// collector, and prints a summary: allocation throughput, pause
+// times and peak memory.  "GCBench -q" runs smaller trees; "GCBench
+// marksweep refcount" runs only the named collectors.
+//
+// g++ -O2 -DNDEBUG=1 -DTU_CONFIG_LINK_TO_THREAD=2 GCBench.cpp tu_gc_incremental_marksweep.cpp tu_gc_singlethreaded_marksweep.cpp tu_arena.cpp tu_profile.cpp tu_file.cpp tu_thread.cpp tu_timer.cpp container.cpp membuf.cpp utf8.cpp utility.cpp -I.. -lpthread -o GCBench
+// cl -Ox -DNDEBUG=1 -Zi -GX GCBench.cpp tu_gc_incremental_marksweep.cpp tu_gc_singlethreaded_marksweep.cpp tu_arena.cpp tu_profile.cpp tu_file.cpp tu_thread.cpp tu_timer.cpp container.cpp membuf.cpp utf8.cpp utility.cpp -I.. -D_HAS_EXCEPTIONS=1 psapi.lib
 
 
 // This is adapted from a benchmark written by John Ellis and Pete Kovac
@@ -41,239 +47,285 @@
 //      current benchmark suites.  As far as we know, none of the current
 //      commercial Java implementations seriously attempt to minimize GC pause
 //      times.
+//
+//      [tu: the collectors now report their own pause times, so we
+//      print those.  For explicit deletion and ref-counting, the
+//      "pauses" are the times taken to free each tree.]
 
-#include <new.h>
+#include <new>
 #include <stdio.h>
-//#include <sys/time.h>
-#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
 
-#ifdef GC
-#  include "base/tu_gc_singlethreaded_marksweep.h"
-#  include "base/tu_gc_singlethreaded_refcount.h"
+#include "base/tu_gc_incremental_marksweep.h"
+#include "base/tu_gc_singlethreaded_marksweep.h"
+#include "base/tu_gc_singlethreaded_refcount.h"
+#include "base/tu_timer.h"
+#include "base/tu_types.h"
+
+#ifdef _WIN32
+#  include <windows.h>
+#  include <psapi.h>
+#  ifdef _MSC_VER
+#    pragma comment(lib, "psapi.lib")
+#  endif
+#else
+#  include <sys/resource.h>
+#  include <sys/wait.h>
+#  include <unistd.h>
 #endif
 
-//  These macros were a quick hack for the Macintosh.
-//
-//  #define currentTime() clock()
-//  #define elapsedTime(x) ((1000*(x))/CLOCKS_PER_SEC)
-
-#define currentTime() stats_rtclock()
-#define elapsedTime(x) (x)
-
-/* Get the current time in milliseconds */
-
-// unsigned
-// stats_rtclock( void )
-// {
-//   struct timeval t;
-//   struct timezone tz;
-
-//   if (gettimeofday( &t, &tz ) == -1)
-//     return 0;
-//   return (t.tv_sec * 1000 + t.tv_usec / 1000);
-// }
-unsigned stats_rtclock() {
-	return timeGetTime();
-}
 
-static const int kStretchTreeDepth    = 18;      // about 16Mb
-static const int kLongLivedTreeDepth  = 16;  // about 4Mb
-static const int kArraySize  = 500000;  // about 4Mb
+static int kStretchTreeDepth    = 18;      // about 16Mb
+static int kLongLivedTreeDepth  = 16;  // about 4Mb
+static int kArraySize  = 500000;  // about 4Mb
 static const int kMinTreeDepth = 4;
-static const int kMaxTreeDepth = 16;
-
-#ifdef GC
-DECLARE_GC_TYPES(tu_gc::singlethreaded_marksweep);
-//DECLARE_GC_TYPES(tu_gc::singlethreaded_refcount);
-#define GC_NEW(x)
-struct Node0;
-typedef gc_ptr<Node0> Node;
+static int kMaxTreeDepth = 16;
+
+
+struct bench_result {
+	double seconds;
+	int allocations;
+	int node_bytes;
+
+	// Freeing trees (explicit delete, or ref-counting).
+	int frees;
+	uint64 total_free_ticks;
+	uint64 max_free_ticks;
+
+	// Collections, as reported by the collector.
+	int collections;
+	uint64 total_collection_ticks;
+	uint64 max_collection_ticks;
+
+	size_t peak_memory_bytes;
+
+	bench_result() {
+		memset(this, 0, sizeof(*this));
+	}
+
+	void record_free(uint64 ticks) {
+		frees++;
+		total_free_ticks += ticks;
+		if (ticks > max_free_ticks) {
+			max_free_ticks = ticks;
+		}
+	}
+
+	void record_collections(int count, uint64 total_ticks, uint64 max_ticks) {
+		collections = count;
+		total_collection_ticks = total_ticks;
+		max_collection_ticks = max_ticks;
+	}
+};
+
+
+namespace bench_explicit {
+#include "base/GCBench_impl.h"
+}  // bench_explicit
+
+namespace bench_ms {
+#define GC_COLLECTOR tu_gc::singlethreaded_marksweep
+#include "base/GCBench_impl.h"
+#undef GC_COLLECTOR
+}  // bench_ms
+
+namespace bench_rc {
+#define GC_COLLECTOR tu_gc::singlethreaded_refcount
+#include "base/GCBench_impl.h"
+#undef GC_COLLECTOR
+}  // bench_rc
+
+namespace bench_im {
+#define GC_COLLECTOR tu_gc::incremental_marksweep
+#include "base/GCBench_impl.h"
+#undef GC_COLLECTOR
+}  // bench_im
+
+
+struct collector_entry {
+	const char* name;
+	void (*run)(bench_result* result);
+};
+
+// Add new collectors here.
+static const collector_entry s_collectors[] = {
+	{ "explicit", bench_explicit::run },
+	{ "marksweep", bench_ms::run },
+	{ "refcount", bench_rc::run },
+	{ "incremental", bench_im::run },
+};
+static const int s_collector_count = sizeof(s_collectors) / sizeof(s_collectors[0]);
+
+
+static int name_column_width()
+// Wide enough for the header and the longest collector name.
+{
+	int width = (int) strlen("collector");
+	for (int i = 0; i < s_collector_count; i++) {
+		int len = (int) strlen(s_collectors[i].name);
+		if (len > width) {
+			width = len;
+		}
+	}
+	return width;
+}
+
+
+static size_t peak_memory_bytes()
+// Peak resident memory of this process so far.
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+		return pmc.PeakWorkingSetSize;
+	}
+	return 0;
 #else
-typedef struct Node0 *Node;
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+#  ifdef __APPLE__
+	return usage.ru_maxrss;	// bytes
+#  else
+	return size_t(usage.ru_maxrss) * 1024;	// kilobytes
+#  endif
 #endif
+}
 
-struct Node0
-#ifdef GC
-	: public gc_object
-#endif
+
+static bool run_collector(const collector_entry& c, bench_result* result)
+// Run the benchmark for one collector.  Where we can, do it in a
+// child process, so each collector's peak memory is its own.
 {
-        Node left;
-        Node right;
-        int i, j;
-        Node0(const Node& l, const Node& r) { left = l; right = r; }
-        Node0() { left = 0; right = 0; }
-#       ifndef GC
-          ~Node0() { if (left) delete left; if (right) delete right; }
-#	endif
-};
+	printf("\n%s:\n", c.name);
+	fflush(stdout);
+
+#ifdef _WIN32
+	c.run(result);
+	result->peak_memory_bytes = peak_memory_bytes();
+	return true;
+#else
+	int fds[2];
+	if (pipe(fds) != 0) {
+		return false;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (pid == 0) {
+		// Child.
+		close(fds[0]);
+		c.run(result);
+		result->peak_memory_bytes = peak_memory_bytes();
+		fflush(stdout);
+		bool ok = write(fds[1], result, sizeof(*result)) == sizeof(*result);
+		_exit(ok ? 0 : 1);
+	}
 
-struct GCBench {
-
-        // Nodes used by a tree of a given size
-        static int TreeSize(int i) {
-                return ((1 << (i + 1)) - 1);
-        }
-
-        // Number of iterations to use for a given tree depth
-        static int NumIters(int i) {
-                return 2 * TreeSize(kStretchTreeDepth) / TreeSize(i);
-        }
-
-        // Build tree top down, assigning to older objects.
-        static void Populate(int iDepth, const Node& thisNode) {
-                if (iDepth<=0) {
-                        return;
-                } else {
-                        iDepth--;
-#			ifndef GC
-                          thisNode->left  = new Node0();
-                          thisNode->right = new Node0();
-#			else
-                          thisNode->left  = new GC_NEW(Node0) Node0();
-                          thisNode->right = new GC_NEW(Node0) Node0();
-#			endif
-                        Populate (iDepth, thisNode->left);
-                        Populate (iDepth, thisNode->right);
-                }
-        }
-
-        // Build tree bottom-up
-        static Node MakeTree(int iDepth) {
-                if (iDepth<=0) {
-#		     ifndef GC
-                        return new Node0();
-#		     else
-                        return new GC_NEW(Node0) Node0();
-#		     endif
-                } else {
-#		     ifndef GC
-                        return new Node0(MakeTree(iDepth-1),
-                                         MakeTree(iDepth-1));
-#		     else
-                        return new GC_NEW(Node0) Node0(MakeTree(iDepth-1),
-                                         		 MakeTree(iDepth-1));
-#		     endif
-                }
-        }
-
-        static void PrintDiagnostics() {
-#if 0
-                long lFreeMemory = Runtime.getRuntime().freeMemory();
-                long lTotalMemory = Runtime.getRuntime().totalMemory();
-
-                System.out.print(" Total memory available="
-                                 + lTotalMemory + " bytes");
-                System.out.println("  Free memory=" + lFreeMemory + " bytes");
+	close(fds[1]);
+	bool ok = read(fds[0], result, sizeof(*result)) == sizeof(*result);
+	close(fds[0]);
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
 #endif
-        }
-
-        static void TimeConstruction(int depth) {
-                long    tStart, tFinish;
-                int     iNumIters = NumIters(depth);
-                Node    tempTree;
-
-                printf("Creating %d trees of depth %d\n", iNumIters, depth);
-                
-                tStart = currentTime();
-                for (int i = 0; i < iNumIters; ++i) {
-#			ifndef GC
-                          tempTree = new Node0();
-#			else
-                          tempTree = new GC_NEW(Node0) Node0();
-#			endif
-                        Populate(depth, tempTree);
-#		        ifndef GC
-                          delete tempTree;
-#			endif
-                        tempTree = 0;
-                }
-                tFinish = currentTime();
-		printf("\tTop down construction took %d msec\n", elapsedTime(tFinish - tStart));
-                     
-                tStart = currentTime();
-                for (int i = 0; i < iNumIters; ++i) {
-                        tempTree = MakeTree(depth);
-#			ifndef GC
-                          delete tempTree;
-#			endif
-                        tempTree = 0;
-                }
-                tFinish = currentTime();
-                printf("\tBottom up construction took %d msec\n", elapsedTime(tFinish - tStart));
-        }
-
-        void main() {
-                Node    root;
-                Node    longLivedTree;
-                Node    tempTree;
-                long    tStart, tFinish;
-                long    tElapsed;
-
-#ifdef GC
-		// GC_full_freq = 30;
-		//GC_enable_incremental();
+}
+
+
+static void print_summary(const char* name, const bench_result& r)
+{
+	// Pauses: the collector's, if it collects, else the frees.
+	int pauses = r.frees;
+	uint64 total = r.total_free_ticks;
+	uint64 max = r.max_free_ticks;
+	if (r.collections > 0) {
+		pauses = r.collections;
+		total = r.total_collection_ticks;
+		max = r.max_collection_ticks;
+	}
+
+	printf("%-*s %8.2f %10.2f %8.1f %8d %8.2f %8.3f %9.1f\n",
+	       name_column_width(), name,
+	       r.seconds,
+	       r.allocations / r.seconds / 1e6,
+	       double(r.allocations) * r.node_bytes / r.seconds / (1 << 20),
+	       pauses,
+	       tu_timer::profile_ticks_to_milliseconds(max),
+	       pauses ? tu_timer::profile_ticks_to_milliseconds(total) / pauses : 0.0,
+	       r.peak_memory_bytes / double(1 << 20));
+}
+
+
+int main(int argc, const char** argv) {
+	tu_timer::init_timer();
+
+	bool selected[sizeof(s_collectors) / sizeof(s_collectors[0])];
+	bool any_selected = false;
+	memset(selected, 0, sizeof(selected));
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-q") == 0) {
+			// Quick run, for continuous builds: a quarter of
+			// the work.
+			kStretchTreeDepth -= 2;
+			kLongLivedTreeDepth -= 2;
+			kMaxTreeDepth -= 2;
+			kArraySize /= 4;
+			continue;
+		}
+
+		int j = 0;
+		for (; j < s_collector_count; j++) {
+			if (strcmp(argv[i], s_collectors[j].name) == 0) {
+				selected[j] = true;
+				any_selected = true;
+				break;
+			}
+		}
+		if (j == s_collector_count) {
+			fprintf(stderr, "usage: GCBench [-q] [collector ...]\ncollectors:");
+			for (j = 0; j < s_collector_count; j++) {
+				fprintf(stderr, " %s", s_collectors[j].name);
+			}
+			fprintf(stderr, "\n");
+			return 1;
+		}
+	}
+
+	printf("Garbage Collector Test\n");
+
+	bench_result results[sizeof(s_collectors) / sizeof(s_collectors[0])];
+	bool ok[sizeof(s_collectors) / sizeof(s_collectors[0])];
+	int failures = 0;
+	for (int i = 0; i < s_collector_count; i++) {
+		ok[i] = false;
+		if (any_selected == false || selected[i]) {
+			ok[i] = run_collector(s_collectors[i], &results[i]);
+			if (ok[i] == false) {
+				failures++;
+			}
+		}
+	}
+
+	printf("\n%-*s %8s %10s %8s %8s %8s %8s %9s\n",
+	       name_column_width(), "collector", "time s", "Mnodes/s", "MB/s", "pauses", "max ms", "avg ms", "peak MB");
+	for (int i = 0; i < s_collector_count; i++) {
+		if (ok[i]) {
+			print_summary(s_collectors[i].name, results[i]);
+		} else if (any_selected == false || selected[i]) {
+			printf("%-*s failed\n", name_column_width(), s_collectors[i].name);
+		}
+	}
+#ifdef _WIN32
+	printf("(peak memory is for the whole process, so far)\n");
 #endif
-		printf("Garbage Collector Test\n");
-                printf(" Live storage will peak at %d bytes.\n\n",
-		       2 * sizeof(Node0) * TreeSize(kLongLivedTreeDepth) +
-		       sizeof(double) * kArraySize);
-                printf(" Stretching memory with a binary tree of depth %d\n", kStretchTreeDepth);
-                PrintDiagnostics();
-               
-                tStart = currentTime();
-                
-                // Stretch the memory space quickly
-                tempTree = MakeTree(kStretchTreeDepth);
-#		ifndef GC
-                  delete tempTree;
-#		endif
-                tempTree = 0;
-
-                // Create a long lived object
-                printf(" Creating a long-lived binary tree of depth %d\n", kLongLivedTreeDepth);
-#		ifndef GC
-                  longLivedTree = new Node0();
-#		else 
-                  longLivedTree = new GC_NEW(Node0) Node0();
-#		endif
-                Populate(kLongLivedTreeDepth, longLivedTree);
-
-                // Create long-lived array, filling half of it
-                printf(" Creating a long-lived array of %d double\n", kArraySize);
-#		ifndef GC
-                  double *array = new double[kArraySize];
-#		else
-                  double *array = new double[kArraySize];
-		  //                  double *array = (double *)
-		  //				GC_MALLOC_ATOMIC(sizeof(double) * kArraySize);
-#		endif
-                for (int i = 0; i < kArraySize/2; ++i) {
-                        array[i] = 1.0/i;
-                }
-                PrintDiagnostics();
-
-                for (int d = kMinTreeDepth; d <= kMaxTreeDepth; d += 2) {
-                        TimeConstruction(d);
-                }
-
-                if (longLivedTree == 0 || array[1000] != 1.0/1000)
-                        printf("Failed\n");
-                                        // fake reference to LongLivedTree
-                                        // and array
-                                        // to keep them from being optimized away
-
-                tFinish = currentTime();
-                tElapsed = elapsedTime(tFinish-tStart);
-                PrintDiagnostics();
-                printf("Completed in %d msec\n", tElapsed);
-#		ifdef GC
-		//printf("Completed " << GC_gc_no << " collections" <<endl;
-		//printf("Heap size is %d\n", GC_get_heap_size());
-#		endif
-        }
-};
 
-main () {
-    GCBench x;
-    x.main();
+	return failures ? 1 : 0;
 }
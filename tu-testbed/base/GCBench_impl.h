@@ -0,0 +1,189 @@
+// GCBench_impl.h  -- Thatcher Ulrich <http://tulrich.com> 2007
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// The body of GCBench.cpp.  This is designed to be a nested include,
+// parameterized by the macro GC_COLLECTOR; with GC_COLLECTOR
+// undefined, it uses explicit new/delete.  Defines run().
+
+
+#ifdef GC_COLLECTOR
+DECLARE_GC_TYPES(GC_COLLECTOR);
+struct Node0;
+typedef gc_ptr<Node0> Node;
+#else
+typedef struct Node0 *Node;
+#endif
+
+struct Node0
+#ifdef GC_COLLECTOR
+	: public gc_object
+#endif
+{
+        Node left;
+        Node right;
+        int i, j;
+        Node0(const Node& l, const Node& r) { left = l; right = r; }
+        Node0() { left = 0; right = 0; }
+#       ifndef GC_COLLECTOR
+          ~Node0() { if (left) delete left; if (right) delete right; }
+#	endif
+};
+
+static bench_result* s_result = NULL;
+
+struct GCBench {
+
+        static Node0* NewNode() {
+                s_result->allocations++;
+                return new Node0();
+        }
+
+        static Node0* NewNode(const Node& l, const Node& r) {
+                s_result->allocations++;
+                return new Node0(l, r);
+        }
+
+        // Let go of a tree, timing how long it takes to free it.
+        static void Drop(Node& n) {
+                uint64 start = tu_timer::get_profile_ticks();
+#		ifndef GC_COLLECTOR
+                  delete n;
+#		endif
+                n = 0;
+                s_result->record_free(tu_timer::get_profile_ticks() - start);
+        }
+
+        // Nodes used by a tree of a given size
+        static int TreeSize(int i) {
+                return ((1 << (i + 1)) - 1);
+        }
+
+        // Number of iterations to use for a given tree depth
+        static int NumIters(int i) {
+                return 2 * TreeSize(kStretchTreeDepth) / TreeSize(i);
+        }
+
+        // Build tree top down, assigning to older objects.
+        static void Populate(int iDepth, const Node& thisNode) {
+                if (iDepth<=0) {
+                        return;
+                } else {
+                        iDepth--;
+                        thisNode->left  = NewNode();
+                        thisNode->right = NewNode();
+                        Populate (iDepth, thisNode->left);
+                        Populate (iDepth, thisNode->right);
+                }
+        }
+
+        // Build tree bottom-up
+        static Node MakeTree(int iDepth) {
+                if (iDepth<=0) {
+                        return NewNode();
+                } else {
+                        return NewNode(MakeTree(iDepth-1), MakeTree(iDepth-1));
+                }
+        }
+
+        static void TimeConstruction(int depth) {
+                uint64  tStart, tFinish;
+                int     iNumIters = NumIters(depth);
+                Node    tempTree;
+
+                printf("Creating %d trees of depth %d\n", iNumIters, depth);
+
+                tStart = tu_timer::get_profile_ticks();
+                for (int i = 0; i < iNumIters; ++i) {
+                        tempTree = NewNode();
+                        Populate(depth, tempTree);
+                        Drop(tempTree);
+                }
+                tFinish = tu_timer::get_profile_ticks();
+		printf("\tTop down construction took %.0f msec\n", tu_timer::profile_ticks_to_milliseconds(tFinish - tStart));
+
+                tStart = tu_timer::get_profile_ticks();
+                for (int i = 0; i < iNumIters; ++i) {
+                        tempTree = MakeTree(depth);
+                        Drop(tempTree);
+                }
+                tFinish = tu_timer::get_profile_ticks();
+                printf("\tBottom up construction took %.0f msec\n", tu_timer::profile_ticks_to_milliseconds(tFinish - tStart));
+        }
+
+        void main() {
+                Node    longLivedTree;
+                Node    tempTree;
+                uint64  tStart, tFinish;
+
+                printf(" Live storage will peak at %d bytes.\n\n",
+		       int(2 * sizeof(Node0) * TreeSize(kLongLivedTreeDepth) +
+			   sizeof(double) * kArraySize));
+                printf(" Stretching memory with a binary tree of depth %d\n", kStretchTreeDepth);
+
+                tStart = tu_timer::get_profile_ticks();
+
+                // Stretch the memory space quickly
+                tempTree = MakeTree(kStretchTreeDepth);
+                Drop(tempTree);
+
+                // Create a long lived object
+                printf(" Creating a long-lived binary tree of depth %d\n", kLongLivedTreeDepth);
+                longLivedTree = NewNode();
+                Populate(kLongLivedTreeDepth, longLivedTree);
+
+                // Create long-lived array, filling half of it
+                printf(" Creating a long-lived array of %d double\n", kArraySize);
+                double *array = new double[kArraySize];
+                for (int i = 0; i < kArraySize/2; ++i) {
+                        array[i] = 1.0/i;
+                }
+
+                for (int d = kMinTreeDepth; d <= kMaxTreeDepth; d += 2) {
+                        TimeConstruction(d);
+                }
+
+                if (longLivedTree == 0 || array[1000] != 1.0/1000)
+                        printf("Failed\n");
+                                        // fake reference to LongLivedTree
+                                        // and array
+                                        // to keep them from being optimized away
+
+                tFinish = tu_timer::get_profile_ticks();
+                s_result->seconds = tu_timer::profile_ticks_to_seconds(tFinish - tStart);
+                printf("Completed in %.0f msec\n", s_result->seconds * 1000);
+
+                delete [] array;
+                Drop(longLivedTree);
+        }
+};
+
+void run(bench_result* result) {
+	s_result = result;
+	result->node_bytes = sizeof(Node0);
+
+#ifdef GC_COLLECTOR
+	gc_collector::stats before;
+	gc_collector::get_stats(&before);
+#endif
+
+	GCBench x;
+	x.main();
+
+#ifdef GC_COLLECTOR
+	// Count only the collections made by the benchmark, not the
+	// one that cleans up after it.
+	gc_collector::stats after;
+	gc_collector::get_stats(&after);
+	result->record_collections(
+		after.collections - before.collections,
+		after.total_pause_ticks - before.total_pause_ticks,
+		after.max_pause_ticks);
+
+	gc_collector::collect_garbage(NULL);
+#endif
+
+	s_result = NULL;
+}
+
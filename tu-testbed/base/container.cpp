@@ -9,9 +9,13 @@
 #include "base/container.h"
 #include "base/utf8.h"
 #include "base/tu_random.h"
+#include "base/tu_atomic.h"
 #include <stdarg.h>
 
 
+container_allocator*	g_container_allocator = NULL;
+
+
 void tu_string::append_wide_char(uint16 c)
 {
 	char buf[8];
@@ -38,6 +42,12 @@ void	tu_string::resize(int new_size)
 {
 	assert(new_size >= 0);
 
+	// Resizing means the contents are about to change.
+	if (using_heap() && get_heap_header()->m_utf8_index)
+	{
+		drop_utf8_index();
+	}
+
 	if (new_size == size()) {
 		return;
 	}
@@ -59,7 +69,9 @@ void	tu_string::resize(int new_size)
 			// round up.
 			// TODO: test to see if this rounding-up is actually a performance win.
 			capacity = (capacity + 15) & ~15;
-			char*	buf = (char*) tu_malloc(capacity);
+			heap_header*	h = (heap_header*) container_malloc(sizeof(heap_header) + capacity);
+			h->m_utf8_index = NULL;
+			char*	buf = (char*) (h + 1);
 			memset(buf, 0, capacity);
 
 			// Copy existing data.
@@ -80,6 +92,7 @@ void	tu_string::resize(int new_size)
 			// Switch to local storage.
 
 			// Be sure to get stack copies of m_heap info, before we overwrite it.
+			heap_header*	old_header = get_heap_header();
 			char*	old_buffer = m_union.m_heap.m_buffer;
 			int	old_capacity = m_union.m_heap.m_capacity;
 			UNUSED(old_capacity);
@@ -90,7 +103,7 @@ void	tu_string::resize(int new_size)
 			memcpy(m_union.m_local.m_buffer, old_buffer, new_size);
 			m_union.m_local.m_buffer[new_size] = 0;	// ensure termination.
 
-			tu_free(old_buffer, old_capacity);
+			container_free(old_header, sizeof(heap_header) + old_capacity);
 		}
 		else
 		{
@@ -100,7 +113,11 @@ void	tu_string::resize(int new_size)
 			capacity = (capacity + 15) & ~15;
 			if (capacity != m_union.m_heap.m_capacity)	// @@ TODO should use hysteresis when resizing
 			{
-				m_union.m_heap.m_buffer = (char*) tu_realloc(m_union.m_heap.m_buffer, capacity, m_heap.m_capacity);
+				heap_header*	h = (heap_header*) container_realloc(
+					get_heap_header(),
+					sizeof(heap_header) + capacity,
+					sizeof(heap_header) + m_union.m_heap.m_capacity);
+				m_union.m_heap.m_buffer = (char*) (h + 1);
 				m_union.m_heap.m_capacity = capacity;
 			}
 			// else we're OK with existing buffer.
@@ -200,26 +217,293 @@ void tu_string::encode_utf8_from_wchar(tu_string* result, const wchar_t* wstr)
 }
 
 
-uint32	tu_string::utf8_char_at(int index) const
+//
+// UTF-8 index.
+//
+// Getting at a character by index means decoding the string from the
+// start, which makes loops over charAt() & co. quadratic.  So a long
+// string can carry a table of the byte offset of every
+// UTF8_INDEX_STRIDE'th character (or just a flag, if it's all
+// ASCII), built the first time it's needed.
+//
+// ActionScript copies a string value every time a method is called
+// on it, so copies share one index: copying a long string attaches
+// the copy and the original to the same utf8_index, and whichever
+// of them first needs the table fills it in for all.  Modifying a
+// string detaches it.  Strings can be copied on different threads,
+// so the sharing is done with atomics.
+//
+
+
+static const int	UTF8_INDEX_MIN_BYTES = 256;	// don't bother for shorter strings
+static const int	UTF8_INDEX_STRIDE = 32;
+
+
+struct tu_string_utf8_table
+{
+	int	m_char_count;	// same as utf8_char_count(buffer, length())
+	bool	m_ascii;	// one byte per char; no checkpoints needed
+	int	m_checkpoint_count;
+	int	m_checkpoints[1];	// actually m_checkpoint_count long
+};
+
+
+struct tu_string_utf8_index
+{
+	volatile int	m_ref_count;
+	tu_string_utf8_table* volatile	m_table;	// NULL until built
+};
+
+
+static int	utf8_table_bytes(int checkpoint_count)
+{
+	return sizeof(tu_string_utf8_table) + sizeof(int) * (imax(checkpoint_count, 1) - 1);
+}
+
+
+static tu_string_utf8_table*	build_utf8_table(const char* buf, int buflen)
+{
+	bool	ascii = true;
+	for (int i = 0; i < buflen; i++)
+	{
+		// utf8_char_count() stops at an embedded \0.
+		if ((unsigned) ((Uint8) buf[i] - 1) >= 0x7F)
+		{
+			ascii = false;
+			break;
+		}
+	}
+
+	if (ascii)
+	{
+		tu_string_utf8_table*	t = (tu_string_utf8_table*) tu_malloc(utf8_table_bytes(0));
+		t->m_char_count = buflen;
+		t->m_ascii = true;
+		t->m_checkpoint_count = 0;
+		return t;
+	}
+
+	// There are at most buflen chars; trim the table when we know.
+	int	max_checkpoints = buflen / UTF8_INDEX_STRIDE + 1;
+	tu_string_utf8_table*	t = (tu_string_utf8_table*) tu_malloc(utf8_table_bytes(max_checkpoints));
+
+	const char*	p = buf;
+	int	count = 0;
+	int	checkpoints = 0;
+	while (p - buf < buflen)
+	{
+		if ((count % UTF8_INDEX_STRIDE) == 0)
+		{
+			t->m_checkpoints[checkpoints++] = (int) (p - buf);
+		}
+
+		const char*	next = p;
+		if (utf8::decode_next_unicode_character(&next) == 0)
+		{
+			break;
+		}
+		p = next;
+		count++;
+	}
+	if (checkpoints < count / UTF8_INDEX_STRIDE + 1)
+	{
+		// Checkpoint for the end position.
+		t->m_checkpoints[checkpoints++] = (int) (p - buf);
+	}
+	assert(checkpoints == count / UTF8_INDEX_STRIDE + 1);
+
+	t = (tu_string_utf8_table*) tu_realloc(t, utf8_table_bytes(checkpoints), utf8_table_bytes(max_checkpoints));
+	t->m_char_count = count;
+	t->m_ascii = false;
+	t->m_checkpoint_count = checkpoints;
+	return t;
+}
+
+
+static tu_string_utf8_index*	get_or_create_utf8_index(tu_string_utf8_index* volatile* slot)
+// Returns the index in *slot, creating an empty one if necessary.
+// The string may be const and being copied on another thread, so the
+// new index is published atomically.
+{
+	tu_string_utf8_index*	index = tu_atomic_load_ptr(slot);
+	if (index == NULL)
+	{
+		tu_string_utf8_index*	new_index = (tu_string_utf8_index*) tu_malloc(sizeof(tu_string_utf8_index));
+		new_index->m_ref_count = 1;
+		new_index->m_table = NULL;
+		if (tu_atomic_compare_and_swap_ptr(slot, (tu_string_utf8_index*) NULL, new_index))
+		{
+			index = new_index;
+		}
+		else
+		{
+			tu_free(new_index, sizeof(tu_string_utf8_index));
+			index = tu_atomic_load_ptr(slot);
+		}
+	}
+	return index;
+}
+
+
+const tu_string_utf8_table*	tu_string::get_utf8_table() const
+{
+	if (length() < UTF8_INDEX_MIN_BYTES)
+	{
+		return NULL;
+	}
+	assert(using_heap());
+
+	tu_string_utf8_index*	index = get_or_create_utf8_index(&get_heap_header()->m_utf8_index);
+
+	tu_string_utf8_table*	table = tu_atomic_load_ptr(&index->m_table);
+	if (table == NULL)
+	{
+		tu_string_utf8_table*	new_table = build_utf8_table(get_buffer(), length());
+		if (tu_atomic_compare_and_swap_ptr(&index->m_table, (tu_string_utf8_table*) NULL, new_table))
+		{
+			table = new_table;
+		}
+		else
+		{
+			tu_free(new_table, utf8_table_bytes(new_table->m_checkpoint_count));
+			table = tu_atomic_load_ptr(&index->m_table);
+		}
+	}
+
+	return table;
+}
+
+
+void	tu_string::share_utf8_index(const tu_string& str)
+{
+	assert(size() == str.size());
+
+	if (length() < UTF8_INDEX_MIN_BYTES)
+	{
+		return;
+	}
+	assert(using_heap() && str.using_heap());
+	assert(get_heap_header()->m_utf8_index == NULL);
+
+	// The table itself is left until someone needs it.
+	tu_string_utf8_index*	index = get_or_create_utf8_index(&str.get_heap_header()->m_utf8_index);
+
+	tu_atomic_increment(&index->m_ref_count);
+	get_heap_header()->m_utf8_index = index;
+}
+
+
+void	tu_string::drop_utf8_index()
+{
+	heap_header*	h = get_heap_header();
+	tu_string_utf8_index*	index = h->m_utf8_index;
+	h->m_utf8_index = NULL;
+
+	if (index && tu_atomic_decrement(&index->m_ref_count) == 0)
+	{
+		if (index->m_table)
+		{
+			tu_free(index->m_table, utf8_table_bytes(index->m_table->m_checkpoint_count));
+		}
+		tu_free(index, sizeof(tu_string_utf8_index));
+	}
+}
+
+
+int	tu_string::utf8_length() const
+{
+	const tu_string_utf8_table*	t = get_utf8_table();
+	if (t)
+	{
+		return t->m_char_count;
+	}
+	return utf8_char_count(get_buffer(), length());
+}
+
+
+int	tu_string::utf8_byte_offset(int char_index) const
 {
 	const char*	buf = get_buffer();
-	uint32	c;
+	const char*	p = buf;
+	int	remaining = char_index;
 
-	do
+	if (char_index <= 0)
 	{
-		c = utf8::decode_next_unicode_character(&buf);
-		index--;
+		return 0;
+	}
 
-		if (c == 0)
+	const tu_string_utf8_table*	t = get_utf8_table();
+	if (t)
+	{
+		if (char_index >= t->m_char_count)
 		{
-			// We've hit the end of the string; don't go further.
-			assert(index == 0);
-			return c;
+			char_index = t->m_char_count;
+		}
+		if (t->m_ascii)
+		{
+			return char_index;
 		}
+
+		int	k = char_index / UTF8_INDEX_STRIDE;
+		p = buf + t->m_checkpoints[k];
+		remaining = char_index - k * UTF8_INDEX_STRIDE;
 	}
-	while (index >= 0);
 
-	return c;
+	for (; remaining > 0 && p - buf < length(); remaining--)
+	{
+		const char*	next = p;
+		if (utf8::decode_next_unicode_character(&next) == 0)
+		{
+			break;
+		}
+		p = next;
+	}
+
+	return (int) (p - buf);
+}
+
+
+int	tu_string::utf8_char_index(int byte_offset) const
+{
+	byte_offset = iclamp(byte_offset, 0, length());
+
+	const char*	buf = get_buffer();
+	const tu_string_utf8_table*	t = get_utf8_table();
+	if (t == NULL)
+	{
+		return utf8_char_count(buf, byte_offset);
+	}
+	if (t->m_ascii)
+	{
+		return byte_offset;
+	}
+
+	// Find the last checkpoint at or before byte_offset.
+	int	lo = 0;
+	int	hi = t->m_checkpoint_count - 1;
+	while (lo < hi)
+	{
+		int	mid = (lo + hi + 1) >> 1;
+		if (t->m_checkpoints[mid] <= byte_offset)
+		{
+			lo = mid;
+		}
+		else
+		{
+			hi = mid - 1;
+		}
+	}
+
+	int	start = t->m_checkpoints[lo];
+	return lo * UTF8_INDEX_STRIDE + utf8_char_count(buf + start, byte_offset - start);
+}
+
+
+uint32	tu_string::utf8_char_at(int index) const
+{
+	// Past the end, this lands on the terminator and returns 0.
+	const char*	p = get_buffer() + utf8_byte_offset(index);
+	return utf8::decode_next_unicode_character(&p);
 }
 
 
@@ -292,44 +576,10 @@ tu_string	tu_string::utf8_substring(int start, int end) const
 		return tu_string();
 	}
 
-	const char*	p = get_buffer();
-	int	index = 0;
-	const char*	start_pointer = p;
-	const char*	end_pointer = p;
-
-	for (;;)
-	{
-		if (index == start)
-		{
-			start_pointer = p;
-		}
-
-		uint32	c = utf8::decode_next_unicode_character(&p);
-		index++;
-
-		if (index == end)
-		{
-			end_pointer = p;
-			break;
-		}
-
-		if (c == 0)
-		{
-			if (index < end)
-			{
-				assert(0);
-				end_pointer = p;
-			}
-			break;
-		}
-	}
-
-	if (end_pointer < start_pointer)
-	{
-		end_pointer = start_pointer;
-	}
+	int	start_offset = utf8_byte_offset(start);
+	int	end_offset = utf8_byte_offset(end);
 
-	return tu_string(start_pointer, int(end_pointer - start_pointer));
+	return tu_string(get_buffer() + start_offset, end_offset - start_offset);
 }
 
 
@@ -673,6 +923,57 @@ void test_unicode()
 	assert(a.length() == 19);
 
 	// TODO add some more tests; should test actual UTF-8 conversions.
+
+	// Long strings use the character index; check it against
+	// plain decoding.  1, 2 and 3-byte chars.
+	static const uint32	chars[] = { 'x', 0xE9, 0x4E2D, 'y', 0x3B1 };
+	for (int ascii = 0; ascii < 2; ascii++)
+	{
+		for (int n = 0; n < 1000; n += 37)
+		{
+			array<uint32>	wide;
+			for (int i = 0; i < n; i++)
+			{
+				wide.push_back(ascii ? 'a' + (i % 26) : chars[i % 5]);
+			}
+			wide.push_back(0);
+
+			tu_string	s;
+			tu_string::encode_utf8_from_uint32(&s, &wide[0]);
+			assert(s.utf8_length() == n);
+			assert(s.utf8_length() == tu_string::utf8_char_count(s.c_str(), s.length()));
+
+			tu_string	copy(s);
+			assert(copy.utf8_length() == n);
+
+			const char*	p = s.c_str();
+			for (int i = 0; i <= n; i++)
+			{
+				assert(s.utf8_byte_offset(i) == p - s.c_str());
+				assert(s.utf8_char_index((int) (p - s.c_str())) == i);
+				assert(copy.utf8_char_at(i) == wide[i]);
+				utf8::decode_next_unicode_character(&p);
+			}
+			assert(s.utf8_byte_offset(n + 10) == s.length());
+
+			if (n > 10)
+			{
+				tu_string	sub = s.utf8_substring(3, n - 5);
+				assert(sub.utf8_length() == n - 8);
+				assert(sub.utf8_char_at(0) == wide[3]);
+
+				// Modifying a copy leaves the original's index
+				// alone, and vice versa.
+				copy[0] = 'Z';
+				assert(copy.utf8_char_at(0) == 'Z');
+				assert(s.utf8_char_at(0) == wide[0]);
+				copy += "!";
+				assert(copy.utf8_length() == n + 1);
+				assert(copy.utf8_char_at(n) == '!');
+				assert(s.utf8_length() == n);
+			}
+		}
+	}
 }
 
 
@@ -26,6 +26,42 @@
 //#define _TU_USE_STL 1
 
 
+// array<>, tu_string and hash<> get their storage through these.
+// They're tu_malloc() & co., unless an allocator has been installed
+// (tu_arena does this).
+struct container_allocator
+{
+	void*	(*m_malloc)(size_t size);
+	void*	(*m_realloc)(void* old_ptr, size_t new_size, size_t old_size);
+	void	(*m_free)(void* old_ptr, size_t old_size);
+};
+extern exported_module container_allocator*	g_container_allocator;
+
+inline void*	container_malloc(size_t size)
+{
+	return g_container_allocator ? g_container_allocator->m_malloc(size) : tu_malloc(size);
+}
+
+inline void*	container_realloc(void* old_ptr, size_t new_size, size_t old_size)
+{
+	return g_container_allocator
+		? g_container_allocator->m_realloc(old_ptr, new_size, old_size)
+		: tu_realloc(old_ptr, new_size, old_size);
+}
+
+inline void	container_free(void* old_ptr, size_t old_size)
+{
+	if (g_container_allocator)
+	{
+		g_container_allocator->m_free(old_ptr, old_size);
+	}
+	else
+	{
+		tu_free(old_ptr, old_size);
+	}
+}
+
+
 
 template<class T>
 class fixed_size_hash
@@ -376,14 +412,14 @@ public:
 		// Resize the buffer.
 		if (m_buffer_size == 0) {
 			if (m_buffer) {
-				tu_free(m_buffer, sizeof(T) * old_size);
+				container_free(m_buffer, sizeof(T) * old_size);
 			}
 			m_buffer = 0;
 		} else {
 			if (m_buffer) {
-				m_buffer = (T*) tu_realloc(m_buffer, sizeof(T) * m_buffer_size, sizeof(T) * old_size);
+				m_buffer = (T*) container_realloc(m_buffer, sizeof(T) * m_buffer_size, sizeof(T) * old_size);
 			} else {
-				m_buffer = (T*) tu_malloc(sizeof(T) * m_buffer_size);
+				m_buffer = (T*) container_malloc(sizeof(T) * m_buffer_size);
 				memset(m_buffer, 0, (sizeof(T) * m_buffer_size));
 			}
 			assert(m_buffer);	// need to throw (or something) on malloc failure!
@@ -594,14 +630,14 @@ public:
 		// Resize the buffer.
 		if (m_buffer_size == 0) {
 			if (m_buffer) {
-				tu_free(get_buffer(), sizeof(T) * old_size + sizeof(int));
+				container_free(get_buffer(), sizeof(T) * old_size + sizeof(int));
 			}
 			m_buffer = 0;
 		} else {
 			if (m_buffer) {
-				set_buffer( tu_realloc( get_buffer(), sizeof(T) * m_buffer_size + sizeof(int), sizeof(T) * old_size  + sizeof(int) ) );
+				set_buffer( container_realloc( get_buffer(), sizeof(T) * m_buffer_size + sizeof(int), sizeof(T) * old_size  + sizeof(int) ) );
 			} else {
-				set_buffer( tu_malloc(sizeof(T) * m_buffer_size + sizeof(int)) );
+				set_buffer( container_malloc(sizeof(T) * m_buffer_size + sizeof(int)) );
 				memset(m_buffer, 0, (sizeof(T) * m_buffer_size));
 			}
 			assert(m_buffer);	// need to throw (or something) on malloc failure!
@@ -805,8 +841,8 @@ public:
 		assert(m_table);
 		m_table->m_entry_count++;
 
-		unsigned int	hash_value = (unsigned int) compute_hash(key);
-		int	index = hash_value & m_table->m_size_mask;
+		size_t	hash_value = compute_hash(key);
+		int	index = (int) (hash_value & m_table->m_size_mask);
 
 		entry*	natural_entry = &(E(index));
 		
@@ -893,7 +929,7 @@ public:
 					e->clear();
 				}
 			}
-			tu_free(m_table, sizeof(table) + sizeof(entry) * (m_table->m_size_mask + 1));
+			container_free(m_table, sizeof(table) + sizeof(entry) * (m_table->m_size_mask + 1));
 			m_table = NULL;
 		}
 	}
@@ -998,7 +1034,7 @@ public:
 			: m_next_in_chain(e.m_next_in_chain), m_hash_value(e.m_hash_value), first(e.first), second(e.second)
 		{
 		}
-		entry(const T& key, const U& value, int next_in_chain, int hash_value)
+		entry(const T& key, const U& value, int next_in_chain, size_t hash_value)
 			: m_next_in_chain(next_in_chain), m_hash_value(hash_value), first(key), second(value)
 		{
 		}
@@ -1322,7 +1358,7 @@ private:
 		}
 
 		hash<T, U, hash_functor>	new_hash;
-		new_hash.m_table = (table*) tu_malloc(sizeof(table) + sizeof(entry) * new_size);
+		new_hash.m_table = (table*) container_malloc(sizeof(table) + sizeof(entry) * new_size);
 		assert(new_hash.m_table);	// @@ need to throw (or something) on malloc failure!
 
 		new_hash.m_table->m_entry_count = 0;
@@ -1347,7 +1383,7 @@ private:
 			}
 
 			// Delete our old data buffer.
-			tu_free(m_table, sizeof(table) + sizeof(entry) * (m_table->m_size_mask + 1));
+			container_free(m_table, sizeof(table) + sizeof(entry) * (m_table->m_size_mask + 1));
 		}
 
 		// Steal new_hash's data.
@@ -1369,6 +1405,10 @@ private:
 
 class tu_stringi;
 
+// Character index for long strings; see container.cpp.
+struct tu_string_utf8_table;
+struct tu_string_utf8_index;
+
 // String-like type.  Attempt to be memory-efficient with small strings.
 class tu_string
 {
@@ -1432,6 +1472,10 @@ public:
 
 		resize(str.size());
 		memcpy(get_buffer(), str.get_buffer(), size() + 1);
+		if (str.using_heap())
+		{
+			share_utf8_index(str);
+		}
 	}
 	tu_string(const uint32* wide_char_str)
 	{
@@ -1452,7 +1496,12 @@ public:
 	{
 		if (using_heap())
 		{
-			tu_free(m_union.m_heap.m_buffer, m_heap.m_capacity);
+			heap_header*	h = get_heap_header();
+			if (h->m_utf8_index)
+			{
+				drop_utf8_index();
+			}
+			container_free(h, sizeof(heap_header) + m_union.m_heap.m_capacity);
 		}
 	}
 
@@ -1488,6 +1537,10 @@ public:
 			resize(str.size());
 			memcpy(get_buffer(), str.get_buffer(), size() + 1);
 			assert(get_buffer()[size()] == 0);
+			if (str.using_heap())
+			{
+				share_utf8_index(str);
+			}
 		}
 	}
 
@@ -1555,12 +1608,18 @@ public:
 	exported_module char&	operator[](int index)
 	{
 		assert(index >= 0 && index <= size());
+		// The caller may write through the reference.
+		if (using_heap() && get_heap_header()->m_utf8_index)
+		{
+			drop_utf8_index();
+		}
 		return get_buffer()[index];
 	}
 
 	exported_module const char&	operator[](int index) const
 	{
-		return (*(const_cast<tu_string*>(this)))[index];
+		assert(index >= 0 && index <= size());
+		return get_buffer()[index];
 	}
 
 	exported_module void	operator+=(const char* str)
@@ -1670,6 +1729,17 @@ public:
 	// position.  index is in UTF-8 chars, NOT bytes.
 	exported_module uint32	utf8_char_at(int index) const;
 
+	// Converts between character positions and byte offsets.
+	// Positions are clamped to [0, utf8_length()]; byte_offset
+	// should be on a character boundary.
+	//
+	// These and the other utf8_ methods are O(1)-ish on long
+	// strings: the first call builds an index of checkpoints
+	// into the string, which is kept until the string is
+	// modified, and shared with copies of the string.
+	exported_module int	utf8_byte_offset(int char_index) const;
+	exported_module int	utf8_char_index(int byte_offset) const;
+
 	// Return the string in this container as all upper case letters
 	exported_module tu_string utf8_to_upper() const;
 
@@ -1681,7 +1751,7 @@ public:
 	// this routine does not look for a terminating \0.
 	exported_module static int	utf8_char_count(const char* buf, int buflen);
 
-	exported_module int	utf8_length() const { return utf8_char_count(get_buffer(), length()); }
+	exported_module int	utf8_length() const;
 
 	// Returns a tu_string that's a substring of this.  start and
 	// end are in UTF-8 character positions (NOT bytes).
@@ -1716,6 +1786,31 @@ private:
 		return heap;
 	}
 
+	// Heap buffers are allocated with this in front of the
+	// chars.
+	struct heap_header
+	{
+		tu_string_utf8_index* volatile	m_utf8_index;	// NULL until someone wants it
+	};
+
+	heap_header*	get_heap_header() const
+	{
+		assert(using_heap());
+		return ((heap_header*) m_union.m_heap.m_buffer) - 1;
+	}
+
+	// Returns NULL if the string is too short to be worth
+	// indexing.
+	const tu_string_utf8_table*	get_utf8_table() const;
+
+	// Refer to str's index, creating it if necessary.  str must
+	// have the same contents as this.
+	void	share_utf8_index(const tu_string& str);
+
+	// Release our reference to the index.  Must be called before
+	// the contents change.
+	void	drop_utf8_index();
+
 	// The idea here is that tu_string is an N-byte structure,
 	// which uses internal storage for strings of N-1 characters
 	// or less.  For longer strings, it allocates a heap buffer,
@@ -10,6 +10,13 @@
 #include "base/utility.h"
 #include <string.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <dirent.h>
+#endif
+
 
 static const char* reverse_scan(const char* begin, const char* end, char c)
 // Scans in reverse, from *(end-1) through *begin, until it finds a
@@ -45,6 +52,47 @@ const char* file_util::get_extension(const char* path)
 }
 
 
+bool file_util::list_files(const char* dir, const char* extension, array<tu_string>* files)
+{
+	assert(files);
+
+	tu_string prefix(dir);
+	if (prefix.length() > 0 && prefix[prefix.length() - 1] != '/') {
+		prefix += "/";
+	}
+
+#ifdef _WIN32
+	tu_string pattern = prefix + "*";
+	WIN32_FIND_DATA find_data;
+	HANDLE h = FindFirstFile(pattern.c_str(), &find_data);
+	if (h == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	do {
+		if ((find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0
+		    && tu_string::stricmp(get_extension(find_data.cFileName), extension) == 0) {
+			files->push_back(prefix + find_data.cFileName);
+		}
+	} while (FindNextFile(h, &find_data));
+	FindClose(h);
+#else
+	DIR* dp = opendir(prefix.c_str());
+	if (dp == NULL) {
+		return false;
+	}
+	while (struct dirent* ent = readdir(dp)) {
+		if (ent->d_name[0] != '.'
+		    && tu_string::stricmp(get_extension(ent->d_name), extension) == 0) {
+			files->push_back(prefix + ent->d_name);
+		}
+	}
+	closedir(dp);
+#endif
+
+	return true;
+}
+
+
 
 // Local Variables:
 // mode: C++
@@ -11,6 +11,7 @@
 
 
 #include "base/tu_config.h"
+#include "base/container.h"
 
 
 namespace file_util {
@@ -22,6 +23,13 @@ namespace file_util {
 	// Does not point to the '.' itself;
 	// i.e. get_extension("test.txt") will return "txt".
 	const char* get_extension(const char* path);
+
+	// Append the paths of the files in the given directory whose
+	// extension matches (case-insensitively) the given one to
+	// *files, e.g. list_files("movies", "swf", &f) might add
+	// "movies/intro.swf".  Doesn't recurse.  Returns false if the
+	// directory can't be read.
+	bool list_files(const char* dir, const char* extension, array<tu_string>* files);
 }
 
 
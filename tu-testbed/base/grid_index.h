@@ -64,6 +64,11 @@ struct index_box
 	{
 	}
 
+	bool	operator==(const index_box<coord_t>& b) const
+	{
+		return min == b.min && max == b.max;
+	}
+
 	const index_point<coord_t>& get_min() const { return min; }
 	const index_point<coord_t>& get_max() const { return max; }
 	
@@ -534,16 +539,29 @@ struct grid_index_box
 	{
 		// Need to delete all entries (be careful to only
 		// delete each entry once, even though entries may be
-		// repeated many times).
-		array<grid_entry_t*>&	cell_array = m_grid[0];
-		for (int i = 0, n = cell_array.size(); i < n; i++)
+		// repeated many times).  Each entry is collected from
+		// the first cell it's in.
+		array<grid_entry_t*>	entries;
+		for (int iy = 0; iy < m_y_cells; iy++)
 		{
-			grid_entry_t*	e = cell_array[i];
-			if (e)
+			for (int ix = 0; ix < m_x_cells; ix++)
 			{
-				delete e;
+				array<grid_entry_t*>*	cell_array = get_cell(ix, iy);
+				for (int i = 0, n = cell_array->size(); i < n; i++)
+				{
+					grid_entry_t*	e = (*cell_array)[i];
+					index_box<int>	ib = get_containing_cells_clamped(e->bound);
+					if (ib.min.x == ix && ib.min.y == iy)
+					{
+						entries.push_back(e);
+					}
+				}
 			}
 		}
+		for (int i = 0; i < entries.size(); i++)
+		{
+			delete entries[i];
+		}
 		delete [] m_grid;
 	}
 
@@ -742,10 +760,12 @@ struct grid_index_box
 		new_entry->value = p;
 
 		// Add it to all cells it overlaps with.
-		for (int i = 0, n = m_x_cells * m_y_cells; i < n; i++)
+		for (int iy = ib.min.y; iy <= ib.max.y; iy++)
 		{
-			array<grid_entry_t*>&	cell_array = m_grid[i];
-			cell_array.push_back(new_entry);
+			for (int ix = ib.min.x; ix <= ib.max.x; ix++)
+			{
+				get_cell(ix, iy)->push_back(new_entry);
+			}
 		}
 	}
 
@@ -864,6 +884,323 @@ private:
 };
 
 
+//
+// grid_index_box_packed
+//
+
+
+// A read-only version of grid_index_box, for querying from any
+// number of threads at once.
+//
+// The cells are packed into one array (a start offset per cell, into
+// a single list of the entries in each cell), so a query walks
+// contiguous memory instead of an array per cell.  Queries don't
+// write to the index: instead of stamping each entry with a query id
+// to skip repeats, an entry is only returned from the first of its
+// cells that the query touches.
+//
+// Changes are batched: add() and remove() take effect at the next
+// rebuild().  Those three must not run at the same time as queries;
+// begin() and iteration can run on as many threads as you like.
+
+
+template<class coord_t, class payload>
+struct grid_entry_box_packed
+{
+	index_box<coord_t>	bound;
+	payload	value;
+};
+
+
+template<class coord_t, class payload>
+struct grid_index_box_packed
+// Grid-based container for boxes, read-optimized.
+{
+	typedef index_point<coord_t>	point_t;
+	typedef index_box<coord_t>	box_t;
+	typedef grid_entry_box_packed<coord_t, payload>	grid_entry_t;
+
+	grid_index_box_packed(const box_t& bound, int x_cells, int y_cells)
+		:
+		m_bound(bound),
+		m_x_cells(x_cells),
+		m_y_cells(y_cells)
+	{
+		assert(x_cells > 0 && y_cells > 0);
+		assert(bound.min.x <= bound.max.x);
+		assert(bound.min.y <= bound.max.y);
+		init_cells();
+	}
+
+	// See grid_index_box.
+	grid_index_box_packed(grid_index_autosize p, const box_t& bound, int item_count_estimate, float grid_scale = 0.707f)
+		:
+		m_bound(bound)
+	{
+		grid_index_pick_good_grid_size(&m_x_cells, &m_y_cells, bound, item_count_estimate, grid_scale);
+
+		assert(m_x_cells > 0 && m_y_cells > 0);
+		assert(bound.min.x <= bound.max.x);
+		assert(bound.min.y <= bound.max.y);
+		init_cells();
+	}
+
+	const box_t&	get_bound() const { return m_bound; }
+
+	struct iterator
+	{
+		const grid_index_box_packed*	m_index;
+		index_box<int>	m_query_cells;
+		int	m_current_cell_x, m_current_cell_y;
+		int	m_current, m_cell_end;	// range in m_index->m_cell_items
+
+		iterator()
+			:
+			m_index(NULL),
+			m_query_cells(index_point<int>(0, 0), index_point<int>(0, 0)),
+			m_current_cell_x(0),
+			m_current_cell_y(0),
+			m_current(0),
+			m_cell_end(0)
+		{
+		}
+
+		bool	at_end() const { return m_current >= m_cell_end; }
+
+		void	operator++()
+		{
+			if (at_end() == false)
+			{
+				m_current++;
+				advance();
+			}
+		}
+
+		void	advance()
+		// Skip ahead to a valid element, starting at m_current.
+		{
+			for (;;)
+			{
+				// Rest of this cell.
+				for (; m_current < m_cell_end; m_current++)
+				{
+					const cell_item&	ci = m_index->m_cell_items[m_current];
+
+					// The first cell of this entry's that's
+					// in the query is the one to return it
+					// from.
+					if (imax(ci.m_first_x, m_query_cells.min.x) == m_current_cell_x
+					    && imax(ci.m_first_y, m_query_cells.min.y) == m_current_cell_y)
+					{
+						return;
+					}
+				}
+
+				// Next cell.
+				m_current_cell_x++;
+				if (m_current_cell_x > m_query_cells.max.x)
+				{
+					m_current_cell_x = m_query_cells.min.x;
+					m_current_cell_y++;
+					if (m_current_cell_y > m_query_cells.max.y)
+					{
+						// Done.
+						assert(at_end());
+						return;
+					}
+				}
+				int	cell = m_current_cell_x + m_current_cell_y * m_index->m_x_cells;
+				m_current = m_index->m_cell_start[cell];
+				m_cell_end = m_index->m_cell_start[cell + 1];
+			}
+		}
+
+		const grid_entry_t&	operator*() const
+		{
+			assert(at_end() == false);
+			return m_index->m_entries[m_index->m_cell_items[m_current].m_entry];
+		}
+		const grid_entry_t*	operator->() const { return &(operator*()); }
+
+		// Id of the current entry, as returned by add().
+		int	get_id() const
+		{
+			assert(at_end() == false);
+			return m_index->m_cell_items[m_current].m_entry;
+		}
+	};
+
+	iterator	begin(const box_t& q) const
+	// Iterate over the entries in the cells touched by q.
+	{
+		iterator	it;
+		it.m_index = this;
+		it.m_query_cells = get_containing_cells_clamped(q);
+
+		assert(it.m_query_cells.min.x <= it.m_query_cells.max.x);
+		assert(it.m_query_cells.min.y <= it.m_query_cells.max.y);
+
+		it.m_current_cell_x = it.m_query_cells.min.x;
+		it.m_current_cell_y = it.m_query_cells.min.y;
+		int	cell = it.m_current_cell_x + it.m_current_cell_y * m_x_cells;
+		it.m_current = m_cell_start[cell];
+		it.m_cell_end = m_cell_start[cell + 1];
+
+		it.advance();	// find first valid entry.
+
+		return it;
+	}
+
+	iterator	begin_all() const
+	// For convenience.
+	{
+		return begin(get_bound());
+	}
+
+	int	add(const box_t& bound, payload p)
+	// Queue a box, with the given payload, to go in at the next
+	// rebuild().  Returns the entry's id.
+	{
+		grid_entry_t	e;
+		e.bound = bound;
+		e.value = p;
+		m_entries.push_back(e);
+		m_removed.push_back(false);
+		return m_entries.size() - 1;
+	}
+
+	void	remove(int id)
+	// Take an entry out at the next rebuild().  Ids of the other
+	// entries don't change.
+	{
+		assert(id >= 0 && id < m_entries.size());
+		m_removed[id] = true;
+	}
+
+	const grid_entry_t&	get_entry(int id) const { return m_entries[id]; }
+
+	void	clear()
+	// Remove everything, right away.
+	{
+		m_entries.clear();
+		m_removed.clear();
+		init_cells();
+	}
+
+	void	rebuild()
+	// Rebuild the cells from the current set of entries: count the
+	// items per cell, then fill them in.
+	{
+		int	cell_count = m_x_cells * m_y_cells;
+		array<index_box<int> >	entry_cells;
+		entry_cells.resize(m_entries.size());
+
+		// Count.
+		for (int i = 0; i < cell_count + 1; i++)
+		{
+			m_cell_start[i] = 0;
+		}
+		for (int i = 0, n = m_entries.size(); i < n; i++)
+		{
+			if (m_removed[i]) continue;
+
+			index_box<int>	ib = get_containing_cells_clamped(m_entries[i].bound);
+			entry_cells[i] = ib;
+			for (int iy = ib.min.y; iy <= ib.max.y; iy++)
+			{
+				for (int ix = ib.min.x; ix <= ib.max.x; ix++)
+				{
+					m_cell_start[ix + iy * m_x_cells + 1]++;
+				}
+			}
+		}
+
+		// Counts to start offsets.
+		for (int i = 0; i < cell_count; i++)
+		{
+			m_cell_start[i + 1] += m_cell_start[i];
+		}
+		m_cell_items.resize(m_cell_start[cell_count]);
+
+		// Fill, using m_cell_start[c] as the fill point of cell
+		// c; afterwards each has moved up to where the next
+		// cell starts, so shift them back down.
+		for (int i = 0, n = m_entries.size(); i < n; i++)
+		{
+			if (m_removed[i]) continue;
+
+			const index_box<int>&	ib = entry_cells[i];
+			cell_item	ci;
+			ci.m_entry = i;
+			ci.m_first_x = ib.min.x;
+			ci.m_first_y = ib.min.y;
+			for (int iy = ib.min.y; iy <= ib.max.y; iy++)
+			{
+				for (int ix = ib.min.x; ix <= ib.max.x; ix++)
+				{
+					m_cell_items[m_cell_start[ix + iy * m_x_cells]++] = ci;
+				}
+			}
+		}
+		for (int i = cell_count; i > 0; i--)
+		{
+			m_cell_start[i] = m_cell_start[i - 1];
+		}
+		m_cell_start[0] = 0;
+	}
+
+private:
+	struct cell_item
+	{
+		int	m_entry;
+		int	m_first_x, m_first_y;	// entry's lowest cell
+	};
+
+	void	init_cells()
+	{
+		m_cell_start.resize(m_x_cells * m_y_cells + 1);
+		for (int i = 0; i < m_cell_start.size(); i++)
+		{
+			m_cell_start[i] = 0;
+		}
+		m_cell_items.resize(0);
+	}
+
+	index_point<int>	get_containing_cell_clamped(const point_t& p) const
+	// Get the indices of the cell that contains the given point.
+	{
+		index_point<int>	ip;
+		ip.x = int(((p.x - m_bound.min.x) * coord_t(m_x_cells)) / (m_bound.max.x - m_bound.min.x));
+		ip.y = int(((p.y - m_bound.min.y) * coord_t(m_y_cells)) / (m_bound.max.y - m_bound.min.y));
+
+		// Clamp.
+		if (ip.x < 0) ip.x = 0;
+		if (ip.x >= m_x_cells) ip.x = m_x_cells - 1;
+		if (ip.y < 0) ip.y = 0;
+		if (ip.y >= m_y_cells) ip.y = m_y_cells - 1;
+
+		return ip;
+	}
+
+	index_box<int>	get_containing_cells_clamped(const box_t& p) const
+	{
+		index_box<int>	ib(get_containing_cell_clamped(p.min), get_containing_cell_clamped(p.max));
+		return ib;
+	}
+
+//data:
+	box_t	m_bound;
+	int	m_x_cells;
+	int	m_y_cells;
+
+	array<grid_entry_t>	m_entries;
+	array<bool>	m_removed;
+
+	array<int>	m_cell_start;	// m_x_cells * m_y_cells + 1
+	array<cell_item>	m_cell_items;
+};
+
+
 #endif // GRID_INDEX_H
 
 
@@ -0,0 +1,319 @@
+// grid_index_test.cpp	-- test & benchmark for grid_index.h
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Checks grid_index_box and grid_index_box_packed against brute
+// force, and compares their query throughput on 1, 4 and 16 threads.
+// grid_index_box can't be queried by two threads at once, so it's
+// timed two ways: one index behind a mutex, and a copy per thread.
+//
+// g++ grid_index_test.cpp container.cpp utf8.cpp tu_random.cpp tu_timer.cpp tu_thread.cpp -O2 -I.. -DTEST_GRID_INDEX -DTU_CONFIG_LINK_TO_THREAD=2 -lpthread -o grid_index_test
+
+
+#ifdef TEST_GRID_INDEX
+
+#include "base/grid_index.h"
+#include "base/tu_random.h"
+#include "base/tu_thread.h"
+#include "base/tu_timer.h"
+#include <stdio.h>
+
+
+typedef index_box<float>	box_t;
+typedef grid_index_box<float, int>	dynamic_index_t;
+typedef grid_index_box_packed<float, int>	packed_index_t;
+
+
+static const float	WORLD_SIZE = 1000;
+static const int	BOX_COUNT = 50000;
+static const float	BOX_SIZE = 8;
+static const int	QUERY_COUNT = 200000;
+static const float	QUERY_SIZE = 10;
+
+
+static float	random_float(float max)
+{
+	return (tu_random::next_random() & 0xFFFFFF) / float(0xFFFFFF) * max;
+}
+
+
+static box_t	random_box(float size)
+{
+	float	x = random_float(WORLD_SIZE - size);
+	float	y = random_float(WORLD_SIZE - size);
+	return box_t(index_point<float>(x, y), index_point<float>(x + random_float(size), y + random_float(size)));
+}
+
+
+static bool	overlap(const box_t& a, const box_t& b)
+{
+	return a.min.x <= b.max.x && b.min.x <= a.max.x
+		&& a.min.y <= b.max.y && b.min.y <= a.max.y;
+}
+
+
+// Sum of the payloads of the boxes that overlap the query; the
+// indexes return candidates from the query's cells, so we still
+// test each one.
+static int	query_dynamic(dynamic_index_t* index, const box_t& q)
+{
+	int	sum = 0;
+	for (dynamic_index_t::iterator it = index->begin(q); ! it.at_end(); ++it)
+	{
+		if (overlap(it->bound, q)) sum += it->value;
+	}
+	return sum;
+}
+
+
+static int	query_packed(const packed_index_t* index, const box_t& q)
+{
+	int	sum = 0;
+	for (packed_index_t::iterator it = index->begin(q); ! it.at_end(); ++it)
+	{
+		if (overlap(it->bound, q)) sum += it->value;
+	}
+	return sum;
+}
+
+
+static int	query_brute_force(const array<box_t>& boxes, const array<bool>& removed, const box_t& q)
+{
+	int	sum = 0;
+	for (int i = 0; i < boxes.size(); i++)
+	{
+		if (removed[i] == false && overlap(boxes[i], q)) sum += i + 1;
+	}
+	return sum;
+}
+
+
+enum method
+{
+	DYNAMIC_LOCKED,
+	DYNAMIC_PER_THREAD,
+	PACKED,
+};
+
+
+struct worker
+{
+	method	m_method;
+	dynamic_index_t*	m_dynamic;
+	tu_thread::mutex*	m_mutex;
+	const packed_index_t*	m_packed;
+	const array<box_t>*	m_queries;
+	int	m_first, m_end;
+	int	m_result;
+
+	static void	run(void* arg)
+	{
+		worker*	w = (worker*) arg;
+		const array<box_t>&	queries = *w->m_queries;
+		int	sum = 0;
+		for (int i = w->m_first; i < w->m_end; i++)
+		{
+			switch (w->m_method)
+			{
+			case DYNAMIC_LOCKED:
+			{
+				tu_thread::autolock	lock(w->m_mutex);
+				sum += query_dynamic(w->m_dynamic, queries[i]);
+				break;
+			}
+			case DYNAMIC_PER_THREAD:
+				sum += query_dynamic(w->m_dynamic, queries[i]);
+				break;
+			case PACKED:
+				sum += query_packed(w->m_packed, queries[i]);
+				break;
+			}
+		}
+		w->m_result = sum;
+	}
+};
+
+
+static dynamic_index_t*	make_dynamic_index(const array<box_t>& boxes)
+{
+	dynamic_index_t*	index = new dynamic_index_t(GRID_INDEX_AUTOSIZE, box_t(index_point<float>(0, 0), index_point<float>(WORLD_SIZE, WORLD_SIZE)), boxes.size());
+	for (int i = 0; i < boxes.size(); i++)
+	{
+		index->add(boxes[i], i + 1);
+	}
+	return index;
+}
+
+
+static int	run_threads(int thread_count, method m, const array<box_t>& queries,
+			    dynamic_index_t** dynamic, const packed_index_t* packed, double* seconds)
+// Run all the queries, split over the threads; returns the total sum.
+{
+	tu_thread::mutex	mutex;
+	array<worker>	workers;
+	workers.resize(thread_count);
+	for (int i = 0; i < thread_count; i++)
+	{
+		worker&	w = workers[i];
+		w.m_method = m;
+		w.m_dynamic = dynamic ? dynamic[m == DYNAMIC_PER_THREAD ? i : 0] : NULL;
+		w.m_mutex = &mutex;
+		w.m_packed = packed;
+		w.m_queries = &queries;
+		w.m_first = queries.size() * i / thread_count;
+		w.m_end = queries.size() * (i + 1) / thread_count;
+		w.m_result = 0;
+	}
+
+	uint64	start_ticks = tu_timer::get_profile_ticks();
+	{
+		array<tu_thread::thread*>	threads;
+		for (int i = 0; i < thread_count; i++)
+		{
+			threads.push_back(new tu_thread::thread(worker::run, &workers[i]));
+		}
+		for (int i = 0; i < thread_count; i++)
+		{
+			delete threads[i];	// waits
+		}
+	}
+	*seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+
+	int	sum = 0;
+	for (int i = 0; i < thread_count; i++)
+	{
+		sum += workers[i].m_result;
+	}
+	return sum;
+}
+
+
+int	main()
+{
+	tu_random::seed_random(1234);
+
+	array<box_t>	boxes;
+	array<bool>	removed;
+	for (int i = 0; i < BOX_COUNT; i++)
+	{
+		boxes.push_back(random_box(BOX_SIZE));
+		removed.push_back(false);
+	}
+	array<box_t>	queries;
+	for (int i = 0; i < QUERY_COUNT; i++)
+	{
+		queries.push_back(random_box(QUERY_SIZE));
+	}
+
+	// Build.
+	uint64	start_ticks = tu_timer::get_profile_ticks();
+	dynamic_index_t*	dynamic = make_dynamic_index(boxes);
+	double	dynamic_build_seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+
+	start_ticks = tu_timer::get_profile_ticks();
+	packed_index_t	packed(GRID_INDEX_AUTOSIZE, dynamic->get_bound(), boxes.size());
+	for (int i = 0; i < boxes.size(); i++)
+	{
+		packed.add(boxes[i], i + 1);
+	}
+	packed.rebuild();
+	double	packed_build_seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+
+	printf("%d boxes, %d queries\n", BOX_COUNT, QUERY_COUNT);
+	printf("build: grid_index_box %3.3f s, grid_index_box_packed %3.3f s\n\n", dynamic_build_seconds, packed_build_seconds);
+
+	// Check against brute force.
+	int	error_count = 0;
+	for (int i = 0; i < 2000; i++)
+	{
+		int	expected = query_brute_force(boxes, removed, queries[i]);
+		if (query_dynamic(dynamic, queries[i]) != expected) error_count++;
+		if (query_packed(&packed, queries[i]) != expected) error_count++;
+	}
+
+	// Remove a third of the boxes, and check again.
+	for (int i = 0; i < BOX_COUNT; i += 3)
+	{
+		removed[i] = true;
+		packed.remove(i);
+	}
+	packed.rebuild();
+	{
+		dynamic_index_t*	d = make_dynamic_index(boxes);
+		for (int i = 0; i < BOX_COUNT; i += 3)
+		{
+			dynamic_index_t::iterator	it = d->find(boxes[i], i + 1);
+			assert(it.at_end() == false);
+			d->remove(&*it);
+		}
+		for (int i = 0; i < 2000; i++)
+		{
+			int	expected = query_brute_force(boxes, removed, queries[i]);
+			if (query_dynamic(d, queries[i]) != expected) error_count++;
+			if (query_packed(&packed, queries[i]) != expected) error_count++;
+		}
+		delete d;
+	}
+	printf("%d results differ from brute force\n\n", error_count);
+
+	// Put them back for the timings.
+	packed.clear();
+	for (int i = 0; i < boxes.size(); i++)
+	{
+		packed.add(boxes[i], i + 1);
+	}
+	packed.rebuild();
+
+	// Timings.
+	static const int	MAX_THREADS = 16;
+	dynamic_index_t*	copies[MAX_THREADS];
+	copies[0] = dynamic;
+	for (int i = 1; i < MAX_THREADS; i++)
+	{
+		copies[i] = make_dynamic_index(boxes);
+	}
+
+	printf("Kqueries/s      grid_index_box+mutex  grid_index_box/thread  grid_index_box_packed\n");
+	int	thread_counts[] = { 1, 4, 16 };
+	int	expected_sum = 0;
+	for (int ti = 0; ti < 3; ti++)
+	{
+		int	n = thread_counts[ti];
+		double	locked_seconds, copies_seconds, packed_seconds;
+		int	locked_sum = run_threads(n, DYNAMIC_LOCKED, queries, copies, NULL, &locked_seconds);
+		int	copies_sum = run_threads(n, DYNAMIC_PER_THREAD, queries, copies, NULL, &copies_seconds);
+		int	packed_sum = run_threads(n, PACKED, queries, NULL, &packed, &packed_seconds);
+
+		if (ti == 0) expected_sum = locked_sum;
+		if (locked_sum != expected_sum || copies_sum != expected_sum || packed_sum != expected_sum)
+		{
+			printf("error: results differ with %d threads\n", n);
+			error_count++;
+		}
+
+		printf("%2d threads      %20.1f  %21.1f  %21.1f\n",
+		       n,
+		       QUERY_COUNT / locked_seconds / 1000,
+		       QUERY_COUNT / copies_seconds / 1000,
+		       QUERY_COUNT / packed_seconds / 1000);
+	}
+
+	for (int i = 0; i < MAX_THREADS; i++)
+	{
+		delete copies[i];
+	}
+
+	return error_count ? 1 : 0;
+}
+
+
+#endif // TEST_GRID_INDEX
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
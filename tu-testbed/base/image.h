@@ -15,6 +15,7 @@
 
 class tu_file;
 namespace jpeg { struct input; };
+namespace tu_thread { struct pool; }
 
 // misc, get power-of-two dimension
 int p2(int n);
@@ -28,7 +29,9 @@ namespace image
 			INVALID,
 			RGB,
 			RGBA,
-			ALPHA
+			ALPHA,
+			BC1,	// see compressed
+			BC3
 		};
 
 		id_image m_type;
@@ -73,6 +76,27 @@ namespace image
 	};
 
 
+	// Block-compressed image, in the S3TC/DXTn formats GPUs sample
+	// directly.  The pixels are coded in 4x4 blocks, row by row;
+	// m_pitch is the byte offset from one row of blocks to the
+	// next.  BC1 (DXT1) blocks are 8 bytes: two RGB565 colors and a
+	// 2-bit index per pixel.  BC3 (DXT5) blocks are 16 bytes: two
+	// alpha values and a 3-bit index per pixel, then a BC1 color
+	// block.  Where the image size isn't a multiple of 4, the
+	// partial blocks repeat the edge pixels.
+	struct compressed : public image_base
+	{
+		compressed(id_image type, int width, int height);
+		~compressed();
+
+		int	get_block_columns() const { return (m_width + 3) >> 2; }
+		int	get_block_rows() const { return (m_height + 3) >> 2; }
+		int	get_size() const { return m_pitch * get_block_rows(); }	// of m_data, in bytes
+
+		static int	get_block_bytes(id_image type) { return type == BC1 ? 8 : 16; }
+	};
+
+
 	// Make a system-memory 24-bit bitmap surface.  24-bit packed
 	// data, red byte first.
 	rgb*	create_rgb(int width, int height);
@@ -86,19 +110,67 @@ namespace image
 	// Make a system-memory 8-bit bitmap surface.
 	alpha*	create_alpha(int width, int height);
 
+
+	// Make an empty block-compressed image; type is BC1 or BC3.
+	compressed*	create_compressed(image_base::id_image type, int width, int height);
+
 	
 	Uint8*	scanline(image_base* surf, int y);
 	const Uint8*	scanline(const image_base* surf, int y);
 
 
+	// Filters for resample(), roughly from sharpest to smoothest.
+	enum filter_type
+	{
+		FILTER0 = 0,
+		BOX = FILTER0,
+		TRIANGLE,
+		BELL,
+		B_SPLINE,
+		SOME_CUBIC,	// Cubic approximation of Sinc's hump (but no tails).
+		LANCZOS3,
+		MITCHELL,	// This one is alleged to be pretty nice.
+
+		FILTER_COUNT
+	};
+
+	// Rescale the specified portion of the input image into the
+	// specified portion of the output image.  Coordinates are
+	// *inclusive*.  Past the edges of the input image, the edge
+	// pixels repeat.
+	//
+	// If pool is non-NULL, bands of rows are spread over its
+	// threads.  The result is the same either way.
 	void	resample(rgb* out, int out_x0, int out_y0, int out_x1, int out_y1,
-			 rgb* in, float in_x0, float in_y0, float in_x1, float in_y1);
+			 rgb* in, float in_x0, float in_y0, float in_x1, float in_y1,
+			 filter_type filter = TRIANGLE, tu_thread::pool* pool = NULL);
 
 	void	resample(rgba* out, int out_x0, int out_y0, int out_x1, int out_y1,
-			 rgba* in, float in_x0, float in_y0, float in_x1, float in_y1);
+			 rgba* in, float in_x0, float in_y0, float in_x1, float in_y1,
+			 filter_type filter = TRIANGLE, tu_thread::pool* pool = NULL);
+
+	void	resample(alpha* out, int out_x0, int out_y0, int out_x1, int out_y1,
+			 alpha* in, float in_x0, float in_y0, float in_x1, float in_y1,
+			 filter_type filter = TRIANGLE, tu_thread::pool* pool = NULL);
 
 	void	zoom(image_base* src, image_base* dst);
 
+	// Block compression.  BC1 is for opaque images, at 4 bits per
+	// pixel; BC3 keeps the alpha channel, at 8 bits per pixel.  If
+	// pool is non-NULL, rows of blocks are spread over its
+	// threads.  The result is the same either way.
+	compressed*	compress_bc1(const rgb* im, tu_thread::pool* pool = NULL);
+	compressed*	compress_bc3(const rgba* im, tu_thread::pool* pool = NULL);
+
+	// Decode a block-compressed image, the way the hardware does;
+	// for renderers that can't take the blocks directly.
+	rgba*	decompress(const compressed* im);
+
+	// Serialize a block-compressed image.  read_compressed()
+	// returns NULL if the data doesn't look right.
+	void	write_compressed(tu_file* out, const compressed* im);
+	compressed*	read_compressed(tu_file* in);
+
 	void	write_jpeg(tu_file* out, rgb* image, int quality);
 	void	write_tga(tu_file* out, rgba* image);
 
@@ -0,0 +1,933 @@
+// image_bc.cpp	-- BC1/BC3 (DXT1/DXT5) block compression
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Block compression (BC1/BC3, a.k.a. DXT1/DXT5) for image::rgb and
+// image::rgba, and decompression.
+//
+// Each color block is fit along its principal axis: the endpoints
+// start at the pixels with the extreme projections onto the axis,
+// then a least-squares fit over the chosen indices gets a try, and
+// whichever pair has less error wins.  Alpha gets its own min/max
+// ramp of 8 values.  The projections and error sums are the inner
+// loops, and use SSE2 where we have it; the results are the same
+// without it.
+
+
+#include "base/image.h"
+#include "base/utility.h"
+#include "base/tu_file.h"
+#include "base/tu_thread.h"
+#include <math.h>
+#include <string.h>
+
+#if TU_CONFIG_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+
+namespace {
+// anonymous namespace to hold local stuff.
+
+
+// The order of the 4 colors of a block along the line from color 1 to
+// color 0, as block indices.
+const int	s_rank_to_index[4] = { 1, 3, 2, 0 };
+
+
+int	quantize(int c, int max)
+// Nearest of max + 1 levels, for a byte.
+{
+	return (c * max + 127) / 255;
+}
+
+
+Uint16	pack_565(int r, int g, int b)
+{
+	return Uint16((quantize(r, 31) << 11) | (quantize(g, 63) << 5) | quantize(b, 31));
+}
+
+
+void	unpack_565(int rgb[3], Uint16 c)
+// Expand to bytes, the way the hardware does.
+{
+	int	r = (c >> 11) & 31;
+	int	g = (c >> 5) & 63;
+	int	b = c & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+
+void	make_palette(int palette[4][3], Uint16 c0, Uint16 c1, bool four_colors)
+// The colors of a block, by index.  In three-color mode, index 3 is
+// transparent black.
+{
+	unpack_565(palette[0], c0);
+	unpack_565(palette[1], c1);
+	for (int i = 0; i < 3; i++)
+	{
+		if (four_colors)
+		{
+			palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+			palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+		}
+		else
+		{
+			palette[2][i] = (palette[0][i] + palette[1][i]) / 2;
+			palette[3][i] = 0;
+		}
+	}
+}
+
+
+void	load_block(Uint8 px[64], const image::image_base* im, int bpp, int bx, int by)
+// Copy the pixels of the block at (bx, by) into px, as RGBA.
+// Pixels past the edges repeat the edge pixels.
+{
+	for (int y = 0; y < 4; y++)
+	{
+		const Uint8*	row = image::scanline(im, imin(by * 4 + y, im->m_height - 1));
+		for (int x = 0; x < 4; x++)
+		{
+			const Uint8*	p = row + imin(bx * 4 + x, im->m_width - 1) * bpp;
+			Uint8*	q = px + (y * 4 + x) * 4;
+			q[0] = p[0];
+			q[1] = p[1];
+			q[2] = p[2];
+			q[3] = bpp == 4 ? p[3] : 255;
+		}
+	}
+}
+
+
+void	project(int dots[16], const Uint8 px[64], const int dir[3])
+// dots[i] = the dot product of pixel i's color with dir.
+{
+#if TU_CONFIG_USE_SSE2
+	__m128i	d = _mm_setr_epi16(Sint16(dir[0]), Sint16(dir[1]), Sint16(dir[2]), 0,
+				   Sint16(dir[0]), Sint16(dir[1]), Sint16(dir[2]), 0);
+	__m128i	zero = _mm_setzero_si128();
+	for (int i = 0; i < 4; i++)
+	{
+		__m128i	p = _mm_loadu_si128((const __m128i*) (px + i * 16));
+		// (r*dr + g*dg, b*db) for each pixel.
+		__m128	lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(p, zero), d));
+		__m128	hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(p, zero), d));
+		__m128i	rg = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i	b = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+		_mm_storeu_si128((__m128i*) (dots + i * 4), _mm_add_epi32(rg, b));
+	}
+#else
+	for (int i = 0; i < 16; i++)
+	{
+		const Uint8*	p = px + i * 4;
+		dots[i] = p[0] * dir[0] + p[1] * dir[1] + p[2] * dir[2];
+	}
+#endif
+}
+
+
+Uint32	select_indices(int ranks[16], const Uint8 px[64], const int palette[4][3])
+// Pick the nearest of the 4 colors for each pixel, by projecting onto
+// the line through them.  Return the packed indices; also return
+// each pixel's position along the line, 0 (color 1) to 3 (color 0),
+// in ranks.
+{
+	int	dir[3], stops[4], dots[16];
+	for (int i = 0; i < 3; i++)
+	{
+		dir[i] = palette[0][i] - palette[1][i];
+	}
+	for (int r = 0; r < 4; r++)
+	{
+		const int*	c = palette[s_rank_to_index[r]];
+		stops[r] = c[0] * dir[0] + c[1] * dir[1] + c[2] * dir[2];
+	}
+	project(dots, px, dir);
+
+	// Compare twice the dot with the sums of neighboring stops,
+	// i.e. with the midpoints.
+	int	t0 = stops[0] + stops[1];
+	int	t1 = stops[1] + stops[2];
+	int	t2 = stops[2] + stops[3];
+
+	Uint32	bits = 0;
+#if TU_CONFIG_USE_SSE2
+	__m128i	vt0 = _mm_set1_epi32(t0);
+	__m128i	vt1 = _mm_set1_epi32(t1);
+	__m128i	vt2 = _mm_set1_epi32(t2);
+	for (int i = 0; i < 16; i += 4)
+	{
+		__m128i	d = _mm_loadu_si128((const __m128i*) (dots + i));
+		d = _mm_add_epi32(d, d);
+		// Each compare is 0 or -1.
+		__m128i	r = _mm_add_epi32(_mm_add_epi32(_mm_cmpgt_epi32(d, vt0), _mm_cmpgt_epi32(d, vt1)), _mm_cmpgt_epi32(d, vt2));
+		_mm_storeu_si128((__m128i*) (ranks + i), _mm_sub_epi32(_mm_setzero_si128(), r));
+	}
+	for (int i = 0; i < 16; i++)
+	{
+		bits |= Uint32(s_rank_to_index[ranks[i]]) << (i * 2);
+	}
+#else
+	for (int i = 0; i < 16; i++)
+	{
+		int	d = dots[i] * 2;
+		ranks[i] = (d > t0) + (d > t1) + (d > t2);
+		bits |= Uint32(s_rank_to_index[ranks[i]]) << (i * 2);
+	}
+#endif
+	return bits;
+}
+
+
+int	block_error(const Uint8 px[64], const int palette[4][3], Uint32 bits)
+// Sum of squared differences between the pixels and their colors.
+{
+#if TU_CONFIG_USE_SSE2
+	// Lay out the chosen colors like the pixels, then difference
+	// and square them 8 channels at a time.
+	Uint32	colors[4];
+	for (int i = 0; i < 4; i++)
+	{
+		colors[i] = palette[i][0] | (palette[i][1] << 8) | (palette[i][2] << 16);
+	}
+	Uint32	chosen[16];
+	for (int i = 0; i < 16; i++)
+	{
+		chosen[i] = colors[(bits >> (i * 2)) & 3];
+	}
+
+	__m128i	zero = _mm_setzero_si128();
+	__m128i	rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+	__m128i	sum = zero;
+	for (int i = 0; i < 4; i++)
+	{
+		__m128i	p = _mm_and_si128(_mm_loadu_si128((const __m128i*) (px + i * 16)), rgb_mask);
+		__m128i	c = _mm_loadu_si128((const __m128i*) (chosen + i * 4));
+		__m128i	lo = _mm_sub_epi16(_mm_unpacklo_epi8(p, zero), _mm_unpacklo_epi8(c, zero));
+		__m128i	hi = _mm_sub_epi16(_mm_unpackhi_epi8(p, zero), _mm_unpackhi_epi8(c, zero));
+		sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+	}
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(sum);
+#else
+	int	error = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		const int*	c = palette[(bits >> (i * 2)) & 3];
+		const Uint8*	p = px + i * 4;
+		int	dr = p[0] - c[0], dg = p[1] - c[1], db = p[2] - c[2];
+		error += dr * dr + dg * dg + db * db;
+	}
+	return error;
+#endif
+}
+
+
+struct color_fit
+{
+	Uint16	m_c0, m_c1;
+	Uint32	m_bits;
+	int	m_error;
+	int	m_ranks[16];
+};
+
+
+void	fit_colors(color_fit* fit, const Uint8 px[64], Uint16 c0, Uint16 c1)
+// Choose indices for the given endpoints; always four-color mode.
+{
+	if (c0 < c1)
+	{
+		tu_swap(&c0, &c1);
+	}
+	fit->m_c0 = c0;
+	fit->m_c1 = c1;
+
+	int	palette[4][3];
+	make_palette(palette, c0, c1, true);
+	if (c0 == c1)
+	{
+		// Only one color; it's index 0 in either mode.
+		fit->m_bits = 0;
+		for (int i = 0; i < 16; i++) { fit->m_ranks[i] = 3; }
+	}
+	else
+	{
+		fit->m_bits = select_indices(fit->m_ranks, px, palette);
+	}
+	fit->m_error = block_error(px, palette, fit->m_bits);
+}
+
+
+bool	least_squares_endpoints(Uint16* c0, Uint16* c1, const Uint8 px[64], const int sum[3], const int ranks[16])
+// Given where the pixels fall along the line, find the endpoints
+// that minimize the squared error.  sum is the sum of the pixels.
+// Return false if the pixels all fall on one color, so there's
+// nothing to solve.
+{
+	// Pixel i is (a * color0 + b * color1) / 3, a + b = 3.
+	int	count[4] = { 0, 0, 0, 0 };
+	int	ap[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++)
+	{
+		int	a = ranks[i];
+		count[a]++;
+		ap[0] += a * px[i * 4 + 0];
+		ap[1] += a * px[i * 4 + 1];
+		ap[2] += a * px[i * 4 + 2];
+	}
+	int	aa = count[1] + count[2] * 4 + count[3] * 9;
+	int	ab = (count[1] + count[2]) * 2;
+	int	bb = count[0] * 9 + count[1] * 4 + count[2];
+
+	int	det = aa * bb - ab * ab;
+	if (det == 0)
+	{
+		return false;
+	}
+
+	// Solve the 2x2 normal equations for each channel; the 3
+	// scales the pixels to match a and b.
+	int	e0[3], e1[3];
+	float	scale = 3.0f / det;
+	for (int c = 0; c < 3; c++)
+	{
+		int	bp = sum[c] * 3 - ap[c];
+		// (Negative values round the wrong way, but get
+		// clamped to 0 anyway.)
+		e0[c] = iclamp(int((ap[c] * bb - bp * ab) * scale + 0.5f), 0, 255);
+		e1[c] = iclamp(int((bp * aa - ap[c] * ab) * scale + 0.5f), 0, 255);
+	}
+	*c0 = pack_565(e0[0], e0[1], e0[2]);
+	*c1 = pack_565(e1[0], e1[1], e1[2]);
+	return true;
+}
+
+
+void	encode_color_block(Uint8* out, const Uint8 px[64])
+// Write the 8-byte color part of a block for the pixels; four-color
+// mode, so it's good for BC3 too.
+{
+	// Sums of the channels and their products.
+	int	sum[3] = { 0, 0, 0 };
+	int	products[6] = { 0, 0, 0, 0, 0, 0 };	// rr rg rb gg gb bb
+	for (int i = 0; i < 16; i++)
+	{
+		int	r = px[i * 4 + 0], g = px[i * 4 + 1], b = px[i * 4 + 2];
+		sum[0] += r;
+		sum[1] += g;
+		sum[2] += b;
+		products[0] += r * r;
+		products[1] += r * g;
+		products[2] += r * b;
+		products[3] += g * g;
+		products[4] += g * b;
+		products[5] += b * b;
+	}
+
+	// Covariance, times 256.
+	float	cov[6];
+	cov[0] = float(products[0] * 16 - sum[0] * sum[0]);
+	cov[1] = float(products[1] * 16 - sum[0] * sum[1]);
+	cov[2] = float(products[2] * 16 - sum[0] * sum[2]);
+	cov[3] = float(products[3] * 16 - sum[1] * sum[1]);
+	cov[4] = float(products[4] * 16 - sum[1] * sum[2]);
+	cov[5] = float(products[5] * 16 - sum[2] * sum[2]);
+
+	// Principal axis, by a few rounds of power iteration.
+	float	v[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 4; iteration++)
+	{
+		float	r = cov[0] * v[0] + cov[1] * v[1] + cov[2] * v[2];
+		float	g = cov[1] * v[0] + cov[3] * v[1] + cov[4] * v[2];
+		float	b = cov[2] * v[0] + cov[4] * v[1] + cov[5] * v[2];
+		float	m = fmax(fabsf(r), fmax(fabsf(g), fabsf(b)));
+		if (m == 0)
+		{
+			// Flat, or v is perpendicular to the spread; fall
+			// back to luminance.
+			v[0] = 0.299f; v[1] = 0.587f; v[2] = 0.114f;
+			break;
+		}
+		m = 1.0f / m;
+		v[0] = r * m;
+		v[1] = g * m;
+		v[2] = b * m;
+	}
+	int	axis[3];
+	for (int c = 0; c < 3; c++)
+	{
+		axis[c] = int(floorf(v[c] * 255 + 0.5f));
+	}
+
+	// Endpoints at the extremes along the axis.
+	int	dots[16];
+	project(dots, px, axis);
+	int	lo = 0, hi = 0;
+	for (int i = 1; i < 16; i++)
+	{
+		if (dots[i] < dots[lo]) lo = i;
+		if (dots[i] > dots[hi]) hi = i;
+	}
+
+	color_fit	best;
+	fit_colors(&best, px,
+		   pack_565(px[hi * 4], px[hi * 4 + 1], px[hi * 4 + 2]),
+		   pack_565(px[lo * 4], px[lo * 4 + 1], px[lo * 4 + 2]));
+
+	// Try a least-squares fit over those indices.
+	Uint16	c0, c1;
+	if (best.m_error > 0 && least_squares_endpoints(&c0, &c1, px, sum, best.m_ranks))
+	{
+		color_fit	refined;
+		fit_colors(&refined, px, c0, c1);
+		if (refined.m_error < best.m_error)
+		{
+			best = refined;
+		}
+	}
+
+	out[0] = Uint8(best.m_c0);
+	out[1] = Uint8(best.m_c0 >> 8);
+	out[2] = Uint8(best.m_c1);
+	out[3] = Uint8(best.m_c1 >> 8);
+	out[4] = Uint8(best.m_bits);
+	out[5] = Uint8(best.m_bits >> 8);
+	out[6] = Uint8(best.m_bits >> 16);
+	out[7] = Uint8(best.m_bits >> 24);
+}
+
+
+void	encode_alpha_block(Uint8* out, const Uint8 px[64])
+// Write the 8-byte alpha part of a BC3 block: the max and min alpha,
+// then a 3-bit index per pixel into the 8-step ramp between them.
+{
+	int	lo = 255, hi = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		lo = imin(lo, px[i * 4 + 3]);
+		hi = imax(hi, px[i * 4 + 3]);
+	}
+	out[0] = Uint8(hi);
+	out[1] = Uint8(lo);
+
+	Uint64	bits = 0;
+	int	range = hi - lo;
+	if (range > 0)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			// Steps up from the min.  Code 0 is the max,
+			// 1 the min, 2..7 the steps down from the max.
+			int	t = ((px[i * 4 + 3] - lo) * 7 + range / 2) / range;
+			int	code = t == 7 ? 0 : (t == 0 ? 1 : 8 - t);
+			bits |= Uint64(code) << (i * 3);
+		}
+	}
+	for (int i = 0; i < 6; i++)
+	{
+		out[2 + i] = Uint8(bits >> (i * 8));
+	}
+}
+
+
+void	decode_color_block(Uint8 px[64], const Uint8* in, bool bc1)
+// Decode a color block into RGBA.  BC1 blocks with c0 <= c1 are in
+// three-color mode; BC3 color blocks are always four-color.
+{
+	Uint16	c0 = Uint16(in[0] | (in[1] << 8));
+	Uint16	c1 = Uint16(in[2] | (in[3] << 8));
+	Uint32	bits = in[4] | (in[5] << 8) | (in[6] << 16) | (Uint32(in[7]) << 24);
+	bool	four_colors = bc1 == false || c0 > c1;
+
+	int	palette[4][3];
+	make_palette(palette, c0, c1, four_colors);
+	for (int i = 0; i < 16; i++)
+	{
+		int	index = (bits >> (i * 2)) & 3;
+		Uint8*	p = px + i * 4;
+		p[0] = Uint8(palette[index][0]);
+		p[1] = Uint8(palette[index][1]);
+		p[2] = Uint8(palette[index][2]);
+		p[3] = (four_colors == false && index == 3) ? 0 : 255;
+	}
+}
+
+
+void	decode_alpha_block(Uint8 px[64], const Uint8* in)
+{
+	int	ramp[8];
+	ramp[0] = in[0];
+	ramp[1] = in[1];
+	if (ramp[0] > ramp[1])
+	{
+		for (int i = 2; i < 8; i++)
+		{
+			ramp[i] = ((8 - i) * ramp[0] + (i - 1) * ramp[1]) / 7;
+		}
+	}
+	else
+	{
+		for (int i = 2; i < 6; i++)
+		{
+			ramp[i] = ((6 - i) * ramp[0] + (i - 1) * ramp[1]) / 5;
+		}
+		ramp[6] = 0;
+		ramp[7] = 255;
+	}
+
+	Uint64	bits = 0;
+	for (int i = 0; i < 6; i++)
+	{
+		bits |= Uint64(in[2 + i]) << (i * 8);
+	}
+	for (int i = 0; i < 16; i++)
+	{
+		px[i * 4 + 3] = Uint8(ramp[(bits >> (i * 3)) & 7]);
+	}
+}
+
+
+struct compress_job
+// What the row tasks need to know.
+{
+	const image::image_base*	m_in;
+	int	m_bpp;
+	image::compressed*	m_out;
+	int	m_band_count;
+};
+
+
+void	compress_band(void* arg, int band)
+// Compress a band of block rows.
+{
+	const compress_job*	j = (const compress_job*) arg;
+	image::compressed*	out = j->m_out;
+	int	rows = out->get_block_rows();
+	int	row0 = rows * band / j->m_band_count;
+	int	row1 = rows * (band + 1) / j->m_band_count;
+
+	Uint8	px[64];
+	for (int by = row0; by < row1; by++)
+	{
+		Uint8*	block = out->m_data + by * out->m_pitch;
+		for (int bx = 0; bx < out->get_block_columns(); bx++)
+		{
+			load_block(px, j->m_in, j->m_bpp, bx, by);
+			if (out->m_type == image::image_base::BC3)
+			{
+				encode_alpha_block(block, px);
+				block += 8;
+			}
+			encode_color_block(block, px);
+			block += 8;
+		}
+	}
+}
+
+
+image::compressed*	compress_image(const image::image_base* in, int bpp, image::image_base::id_image type, tu_thread::pool* pool)
+{
+	assert(in);
+	image::compressed*	out = image::create_compressed(type, in->m_width, in->m_height);
+
+	compress_job	j;
+	j.m_in = in;
+	j.m_bpp = bpp;
+	j.m_out = out;
+	if (pool)
+	{
+		// A few bands per thread, to even out the load.
+		j.m_band_count = imin(pool->get_thread_count() * 4, out->get_block_rows());
+		pool->run(compress_band, &j, j.m_band_count);
+	}
+	else
+	{
+		j.m_band_count = 1;
+		compress_band(&j, 0);
+	}
+	return out;
+}
+
+
+}	// end anonymous namespace
+
+
+namespace image
+{
+	compressed::compressed(id_image type, int width, int height)
+		:
+		image_base(0, width, height, 0, type)
+	{
+		assert(type == BC1 || type == BC3);
+		assert(width > 0);
+		assert(height > 0);
+
+		m_pitch = get_block_columns() * get_block_bytes(type);
+		m_data = new Uint8[get_size()];
+	}
+
+	compressed::~compressed()
+	{
+	}
+
+
+	compressed*	create_compressed(image_base::id_image type, int width, int height)
+	{
+		return new compressed(type, width, height);
+	}
+
+
+	compressed*	compress_bc1(const rgb* im, tu_thread::pool* pool)
+	{
+		return compress_image(im, 3, image_base::BC1, pool);
+	}
+
+
+	compressed*	compress_bc3(const rgba* im, tu_thread::pool* pool)
+	{
+		return compress_image(im, 4, image_base::BC3, pool);
+	}
+
+
+	rgba*	decompress(const compressed* im)
+	{
+		assert(im);
+		rgba*	out = create_rgba(im->m_width, im->m_height);
+		bool	bc1 = im->m_type == image_base::BC1;
+
+		Uint8	px[64];
+		for (int by = 0; by < im->get_block_rows(); by++)
+		{
+			const Uint8*	block = im->m_data + by * im->m_pitch;
+			for (int bx = 0; bx < im->get_block_columns(); bx++)
+			{
+				if (bc1)
+				{
+					decode_color_block(px, block, true);
+					block += 8;
+				}
+				else
+				{
+					decode_color_block(px, block + 8, false);
+					decode_alpha_block(px, block);
+					block += 16;
+				}
+
+				// Keep the pixels inside the image.
+				int	w = imin(4, im->m_width - bx * 4);
+				int	h = imin(4, im->m_height - by * 4);
+				for (int y = 0; y < h; y++)
+				{
+					memcpy(scanline(out, by * 4 + y) + bx * 16, px + y * 16, w * 4);
+				}
+			}
+		}
+		return out;
+	}
+
+
+	void	write_compressed(tu_file* out, const compressed* im)
+	// Header: type, width and height, as little-endian 32-bit
+	// ints; then the blocks.
+	{
+		assert(im);
+		out->write_le32(im->m_type == image_base::BC1 ? 1 : 3);
+		out->write_le32(im->m_width);
+		out->write_le32(im->m_height);
+		out->write_bytes(im->m_data, im->get_size());
+	}
+
+
+	compressed*	read_compressed(tu_file* in)
+	{
+		int	format = in->read_le32();
+		int	width = in->read_le32();
+		int	height = in->read_le32();
+		if ((format != 1 && format != 3)
+		    || width <= 0 || width > 65536
+		    || height <= 0 || height > 65536
+		    || in->get_error())
+		{
+			return NULL;
+		}
+
+		compressed*	im = create_compressed(format == 1 ? image_base::BC1 : image_base::BC3, width, height);
+		if (in->read_bytes(im->m_data, im->get_size()) != im->get_size())
+		{
+			delete im;
+			return NULL;
+		}
+		return im;
+	}
+};
+
+
+#ifdef IMAGE_BC_TEST
+
+
+// Checks the encoder and decoder on some simple cases, checks that
+// the thread count and SSE2/plain C don't change the output, and
+// measures quality (PSNR) and speed on a synthetic picture and on any
+// JPEG files given on the command line.
+//
+// g++ image_bc.cpp image.cpp image_filters.cpp container.cpp jpeg.cpp membuf.cpp tu_file.cpp tu_random.cpp tu_thread.cpp tu_timer.cpp utf8.cpp utility.cpp -O2 -I.. -DIMAGE_BC_TEST -DTU_CONFIG_LINK_TO_THREAD=2 -ljpeg -lpthread -o image_bc_test
+
+
+#include "base/membuf.h"
+#include "base/tu_random.h"
+#include "base/tu_timer.h"
+#include <stdio.h>
+
+
+static void	fill_picture(image::rgba* im)
+// Smooth gradients, some edges and some noise; alpha gets a soft
+// circle.
+{
+	for (int y = 0; y < im->m_height; y++)
+	{
+		Uint8*	p = image::scanline(im, y);
+		for (int x = 0; x < im->m_width; x++, p += 4)
+		{
+			int	noise = int(tu_random::next_random() & 15) - 8;
+			p[0] = Uint8(iclamp(int(128 + 100 * sinf(x * 0.02f)) + noise, 0, 255));
+			p[1] = Uint8(iclamp(int(128 + 100 * cosf(y * 0.03f + x * 0.01f)) + noise, 0, 255));
+			p[2] = Uint8(((x / 37) ^ (y / 23)) & 1 ? 220 : 40);
+			float	dx = x - im->m_width * 0.5f, dy = y - im->m_height * 0.5f;
+			p[3] = Uint8(iclamp(int(255 - sqrtf(dx * dx + dy * dy) * 2), 0, 255));
+		}
+	}
+}
+
+
+static image::rgb*	to_rgb(const image::rgba* im)
+{
+	image::rgb*	out = image::create_rgb(im->m_width, im->m_height);
+	for (int y = 0; y < im->m_height; y++)
+	{
+		for (int x = 0; x < im->m_width; x++)
+		{
+			memcpy(image::scanline(out, y) + x * 3, image::scanline(im, y) + x * 4, 3);
+		}
+	}
+	return out;
+}
+
+
+static image::rgba*	to_rgba(const image::rgb* im)
+{
+	image::rgba*	out = image::create_rgba(im->m_width, im->m_height);
+	for (int y = 0; y < im->m_height; y++)
+	{
+		for (int x = 0; x < im->m_width; x++)
+		{
+			memcpy(image::scanline(out, y) + x * 4, image::scanline(im, y) + x * 3, 3);
+			image::scanline(out, y)[x * 4 + 3] = 255;
+		}
+	}
+	return out;
+}
+
+
+static float	psnr(const image::rgba* a, const image::rgba* b, int first_channel, int channel_count)
+// Peak signal-to-noise ratio over the given channels, in dB.
+{
+	double	sum = 0;
+	for (int y = 0; y < a->m_height; y++)
+	{
+		const Uint8*	pa = image::scanline(a, y);
+		const Uint8*	pb = image::scanline(b, y);
+		for (int x = 0; x < a->m_width; x++)
+		{
+			for (int c = first_channel; c < first_channel + channel_count; c++)
+			{
+				int	d = pa[x * 4 + c] - pb[x * 4 + c];
+				sum += d * d;
+			}
+		}
+	}
+	double	mse = sum / (double(a->m_width) * a->m_height * channel_count);
+	return mse == 0 ? 99.0f : float(10 * log10(255.0 * 255.0 / mse));
+}
+
+
+static bool	same_blocks(const image::compressed* a, const image::compressed* b)
+{
+	return a->m_type == b->m_type && a->get_size() == b->get_size() && memcmp(a->m_data, b->m_data, a->get_size()) == 0;
+}
+
+
+static void	measure(const char* name, const image::rgba* picture, tu_thread::pool* pool)
+// Print PSNR and speed of each format for the picture.
+{
+	image::rgb*	picture_rgb = to_rgb(picture);
+	float	mpixels = picture->m_width * picture->m_height / 1000000.0f;
+
+	for (int k = 0; k < 2; k++)
+	{
+		bool	bc1 = k == 0;
+		double	seconds[2];
+		image::compressed*	c = NULL;
+		for (int threaded = 0; threaded < 2; threaded++)
+		{
+			delete c;
+			uint64	start_ticks = tu_timer::get_profile_ticks();
+			c = bc1 ? image::compress_bc1(picture_rgb, threaded ? pool : NULL)
+				: image::compress_bc3(picture, threaded ? pool : NULL);
+			seconds[threaded] = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+		}
+		image::rgba*	d = image::decompress(c);
+		if (bc1)
+		{
+			printf("%-20s BC1 %5dx%-5d rgb %5.2f dB            %7.1f Mpixel/s, %d threads %7.1f\n",
+			       name, picture->m_width, picture->m_height, psnr(picture, d, 0, 3),
+			       mpixels / seconds[0], pool->get_thread_count(), mpixels / seconds[1]);
+		}
+		else
+		{
+			printf("%-20s BC3 %5dx%-5d rgb %5.2f dB  a %5.2f dB %7.1f Mpixel/s, %d threads %7.1f\n",
+			       name, picture->m_width, picture->m_height, psnr(picture, d, 0, 3), psnr(picture, d, 3, 1),
+			       mpixels / seconds[0], pool->get_thread_count(), mpixels / seconds[1]);
+		}
+		delete d;
+		delete c;
+	}
+	delete picture_rgb;
+}
+
+
+int	main(int argc, const char** argv)
+{
+	int	errors = 0;
+	tu_thread::pool	pool(4);
+
+	// Colors that 565 can represent come back exactly, and so do
+	// alpha values 0 and 255.
+	{
+		image::rgba*	im = image::create_rgba(13, 7);
+		for (int y = 0; y < im->m_height; y++)
+		{
+			for (int x = 0; x < im->m_width; x++)
+			{
+				bool	a = ((x / 4) + (y / 4)) & 1;
+				im->set_pixel(x, y, a ? 255 : 8, a ? 4 : 251, a ? 66 : 0, a ? 255 : 0);
+			}
+		}
+		image::compressed*	c = image::compress_bc3(im);
+		image::rgba*	d = image::decompress(c);
+		if (memcmp(d->m_data, im->m_data, im->m_pitch * im->m_height))
+		{
+			printf("exact colors didn't survive\n");
+			errors++;
+		}
+		delete c;
+		delete d;
+		delete im;
+	}
+
+	// Thread count doesn't matter, and the files round-trip.
+	image::rgba*	picture = image::create_rgba(509, 383);
+	fill_picture(picture);
+	image::rgb*	picture_rgb = to_rgb(picture);
+	{
+		image::compressed*	a = image::compress_bc1(picture_rgb);
+		image::compressed*	b = image::compress_bc1(picture_rgb, &pool);
+		image::compressed*	c = image::compress_bc3(picture);
+		image::compressed*	d = image::compress_bc3(picture, &pool);
+		if (same_blocks(a, b) == false || same_blocks(c, d) == false)
+		{
+			printf("threaded result differs\n");
+			errors++;
+		}
+
+		// Blocks' color parts are the same in BC1 and BC3.
+		if (memcmp(a->m_data, c->m_data + 8, 8) != 0)
+		{
+			printf("BC1 and BC3 colors differ\n");
+			errors++;
+		}
+
+		tu_file	f(tu_file::memory_buffer);
+		image::write_compressed(&f, a);
+		image::write_compressed(&f, c);
+		f.set_position(0);
+		image::compressed*	ra = image::read_compressed(&f);
+		image::compressed*	rc = image::read_compressed(&f);
+		if (ra == NULL || rc == NULL || same_blocks(a, ra) == false || same_blocks(c, rc) == false)
+		{
+			printf("read_compressed() didn't get back what write_compressed() wrote\n");
+			errors++;
+		}
+		if (image::read_compressed(&f) != NULL)
+		{
+			printf("read_compressed() read past the end\n");
+			errors++;
+		}
+
+		// Print a checksum, to compare builds with and without
+		// SSE2.
+		Uint32	hash = 0;
+		for (int i = 0; i < c->get_size(); i++) { hash = hash * 33 + c->m_data[i]; }
+		printf("BC3 checksum %08x\n", hash);
+
+		// Sanity check the quality.
+		image::rgba*	da = image::decompress(a);
+		image::rgba*	dc = image::decompress(c);
+		if (psnr(picture, da, 0, 3) < 30 || psnr(picture, dc, 3, 1) < 35)
+		{
+			printf("poor quality: rgb %.2f dB, alpha %.2f dB\n", psnr(picture, da, 0, 3), psnr(picture, dc, 3, 1));
+			errors++;
+		}
+
+		delete da;
+		delete dc;
+		delete a;
+		delete b;
+		delete c;
+		delete d;
+		delete ra;
+		delete rc;
+	}
+	delete picture_rgb;
+
+	printf("%s\n\n", errors ? "FAILED" : "OK");
+
+	measure("synthetic", picture, &pool);
+	delete picture;
+
+	image::rgba*	big = image::create_rgba(2048, 2048);
+	fill_picture(big);
+	measure("synthetic", big, &pool);
+	delete big;
+
+	for (int i = 1; i < argc; i++)
+	{
+		image::rgb*	im = image::read_jpeg(argv[i]);
+		if (im == NULL)
+		{
+			printf("can't read %s\n", argv[i]);
+			continue;
+		}
+		image::rgba*	im_rgba = to_rgba(im);
+		measure(argv[i], im_rgba, &pool);
+		delete im_rgba;
+		delete im;
+	}
+
+	return errors ? 1 : 0;
+}
+
+
+#endif // IMAGE_BC_TEST
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
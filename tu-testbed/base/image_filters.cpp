@@ -16,173 +16,20 @@
 #include "base/utility.h"
 #include "base/container.h"
 #include "base/tu_math.h"
+#include "base/tu_thread.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#if TU_CONFIG_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 
 namespace {
 // anonymous namespace to hold local stuff.
 
 
-inline void* my_calloc(int count, int size)
-{
-	void*	mem = (void*) new char[count * size];
-	memset(mem, 0, count * size);
-	return mem;
-}
-
-
-inline void	my_cfree(void* mem)
-{
-	delete [] (char*) mem;
-}
-
-
-void	get_row(Uint8* row, image::rgb* image, int x0, int xsize, int y)
-// Copy RGB data from the specified row into the given buffer.
-{
-	y = iclamp(y, 0, image->m_height - 1);
-	int	x1 = x0 + xsize - 1;
-	if (x1 >= image->m_width) {
-		// clip, then extend.
-		int	extra_pixels = x1 - image->m_width + 1;
-		Uint8*	p = ((Uint8*) image->m_data) + (y * image->m_pitch);
-		memcpy(row, p + x0 * 3, (3 * (image->m_width - x0)));
-		// repeat last pixel
-		p = p + (image->m_width - 1) * 3;
-		Uint8*	q = row + (image->m_width - x0) * 3;
-		while (extra_pixels > 0) {
-			*(q + 0) = *(p + 0);
-			*(q + 1) = *(p + 1);
-			*(q + 2) = *(p + 2);
-			q += 3;
-			extra_pixels--;
-		}
-	}
-	else
-	{
-		memcpy(row, ((Uint8*) image->m_data) + (y * image->m_pitch) + x0 * 3, (3 * xsize));
-	}
-}
-
-
-void	get_row(Uint8* row, image::rgba* image, int x0, int xsize, int y)
-// Copy RGBA data from the specified row into the given buffer.
-{
-	y = iclamp(y, 0, image->m_height - 1);
-	int	x1 = x0 + xsize - 1;
-	if (x1 >= image->m_width) {
-		// clip, then extend.
-		int	extra_pixels = x1 - image->m_width + 1;
-		Uint8*	p = ((Uint8*) image->m_data) + (y * image->m_pitch);
-		memcpy(row, p + x0 * 4, (4 * (image->m_width - x0)));
-		// repeat last pixel
-		p = p + (image->m_width - 1) * 4;
-		Uint8*	q = row + (image->m_width - x0) * 4;
-		while (extra_pixels > 0) {
-			*(q + 0) = *(p + 0);
-			*(q + 1) = *(p + 1);
-			*(q + 2) = *(p + 2);
-			*(q + 3) = *(p + 3);
-			q += 4;
-			extra_pixels--;
-		}
-	}
-	else
-	{
-		memcpy(row, ((Uint8*) image->m_data) + (y * image->m_pitch) + x0 * 4, (4 * xsize));
-	}
-}
-
-
-void	get_column(Uint8* column, image::rgb* image, int x)
-// Copy RGB data from the specified column into the given buffer.
-{
-	int	i, d;
-	Uint8*	p;
-
-	if ((x < 0) || (x >= image->m_width)) {
-		assert(0);
-		x = iclamp(x, 0, image->m_width - 1);
-	}
-
-	d = image->m_pitch;
-	for (i = image->m_height, p = ((Uint8*) image->m_data) + x * 3; i-- > 0; p += d) {
-		*column++ = *p;
-		*column++ = *(p + 1);
-		*column++ = *(p + 2);
-	}
-}
-
-
-void	get_column(Uint8* column, image::rgba* image, int x)
-// Copy RGBA data from the specified column into the given buffer.
-{
-	int	i, d;
-	Uint8*	p;
-
-	if ((x < 0) || (x >= image->m_width)) {
-		assert(0);
-		x = iclamp(x, 0, image->m_width - 1);
-	}
-
-	d = image->m_pitch;
-	for (i = image->m_height, p = ((Uint8*) image->m_data) + x * 4; i-- > 0; p += d) {
-		*column++ = *p;
-		*column++ = *(p + 1);
-		*column++ = *(p + 2);
-		*column++ = *(p + 3);
-	}
-}
-
-
-void	put_pixel(image::rgb* image, int x, int y, float r, float g, float b)
-// Clamp {r, g, b} to [0,255], and write pixel data to the given image
-// at (x, y).
-{
-	static image::rgb*	im = NULL;
-	static int	yy = -1;
-	static Uint8*	p = NULL;
-
-	if ((x < 0) || (x >= image->m_width) || (y < 0) || (y >= image->m_height)) {
-		assert(0);
-		return;
-	}
-	if ((im != image) || (yy != y)) {
-		im = image;
-		yy = y;
-		p = ((Uint8*) image->m_data) + (y * image->m_pitch);
-	}
-	p[x * 3 + 0] = iclamp(frnd(r), 0, 255);
-	p[x * 3 + 1] = iclamp(frnd(g), 0, 255);
-	p[x * 3 + 2] = iclamp(frnd(b), 0, 255);
-}
-
-
-void	put_pixel(image::rgba* image, int x, int y, float r, float g, float b, float a)
-// Clamp {r, g, b, a} to [0,255], and write pixel data to the given image
-// at (x, y).
-{
-	static image::rgba*	im = NULL;
-	static int	yy = -1;
-	static Uint8*	p = NULL;
-
-	if ((x < 0) || (x >= image->m_width) || (y < 0) || (y >= image->m_height)) {
-		assert(0);
-		return;
-	}
-	if ((im != image) || (yy != y)) {
-		im = image;
-		yy = y;
-		p = ((Uint8*) image->m_data) + (y * image->m_pitch);
-	}
-	p[x * 4	+ 0] = iclamp(frnd(r), 0, 255);
-	p[x * 4	+ 1] = iclamp(frnd(g), 0, 255);
-	p[x * 4	+ 2] = iclamp(frnd(b), 0, 255);
-	p[x * 4	+ 3] = iclamp(frnd(a), 0, 255);
-}
-
-
 /*
  *	filter function definitions
  */
@@ -311,45 +158,13 @@ float	Mitchell_filter(float t)
 }
 
 
-struct CONTRIB {
-	int	pixel;
-	float	weight;
-
-	CONTRIB()
-		: pixel(0), weight(0.f)
-	{
-	}
-
-	CONTRIB(int p, float w)
-		: pixel(p), weight(w)
-	{
-	}
-};
-
-
-};	// end anonymous namespace
-
-
-namespace image {
-
-
-enum filter_type {
-	FILTER0 = 0,
-	BOX = FILTER0,
-	TRIANGLE,
-	BELL,
-	B_SPLINE,
-	SOME_CUBIC,	// Cubic approximation of Sinc's hump (but no tails).
-	LANCZOS3,
-	MITCHELL,	// This one is alleged to be pretty nice.
-
-	FILTER_COUNT
-};
-
-struct filter_table_t {
+struct filter_info
+{
 	float	(*filter_function)(float);
 	float	support;
-} filter_table[] = {
+};
+
+const filter_info	s_filters[image::FILTER_COUNT] = {
 	{ box_filter, box_support },
 	{ triangle_filter, triangle_support },
 	{ bell_filter, bell_support },
@@ -360,180 +175,453 @@ struct filter_table_t {
 };
 
 
-// TODO: experiment with different filter functions.
-filter_type	default_type = TRIANGLE;
+// The resampler works in fixed point: weights are Sint16, with
+// 1.0 == WEIGHT_ONE, and the sums are done in 32 bits.  That lets
+// SSE2 do eight multiply-adds per instruction (_mm_madd_epi16), and
+// gives the same result with or without SSE2.
+enum {
+	WEIGHT_BITS = 14,
+	WEIGHT_ONE = 1 << WEIGHT_BITS,
+	WEIGHT_ROUND = 1 << (WEIGHT_BITS - 1),
+};
 
 
-void	resample(image::rgb* out, int out_x0, int out_y0, int out_x1, int out_y1,
-		 image::rgb* in, float in_x0, float in_y0, float in_x1, float in_y1)
-// Rescale the specified portion of the input image into the specified
-// portion of the output image.  Coordinates are *inclusive*.
+struct weight_table
+// Fixed-point filter weights for resampling a line of in_count
+// source pixels to out_count pixels.  Output pixel i is the sum of
+// m_taps source pixels starting at m_start[i], times the weights at
+// m_weights[i * m_taps].
+//
+// Source pixels off the ends of the line have their weights folded
+// onto the end pixels, which is the same as repeating the edges.
+// The weights for each output pixel sum to exactly WEIGHT_ONE.
+// m_taps is padded with zero weights to a multiple of m_pad, and
+// the padding can run up to m_pad - 1 pixels past the end of the
+// line.
 {
-	assert(out_x0 <= out_x1);
-	assert(out_y0 <= out_y1);
-	assert(out_x0 >= 0 && out_x0 < out->m_width);
-	assert(out_x1 >= 0 && out_x1 < out->m_width);
-	assert(out_y0 >= 0 && out_y0 < out->m_height);
-	assert(out_y1 >= 0 && out_y1 < out->m_height);
+	weight_table(image::filter_type filter, int in_count, int out_count, float scale, int pad);
 
-	float	(*filter_function)(float);
-	float	support;
+	image::filter_type	m_filter;
+	int	m_in_count;
+	int	m_out_count;
+	float	m_scale;
+	int	m_pad;
 
-	// Pick a filter function & support.
-	assert(default_type >= FILTER0 && default_type < FILTER_COUNT);
-	filter_function = filter_table[default_type].filter_function;
-	support = filter_table[default_type].support;
+	int	m_taps;
+	array<int>	m_start;
+	array<Sint16>	m_weights;
+
+	// For the cache.
+	int	m_users;	// resample() calls using the table right now
+	int	m_last_use;
+};
 
 
-	image::rgb*	tmp;		/* intermediate image */
-	float	xscale, yscale;		/* zoom scale factors */
-	int i, j, k;			/* loop variables */
-	int n;				/* pixel number */
-	float center; int left, right;	/* filter calculation variables */
-	float width, fscale, weight;	/* filter calculation variables */
-	Uint8*	raster;			/* a row or column of pixels */
+weight_table::weight_table(image::filter_type filter, int in_count, int out_count, float scale, int pad)
+	:
+	m_filter(filter),
+	m_in_count(in_count),
+	m_out_count(out_count),
+	m_scale(scale),
+	m_pad(pad),
+	m_taps(0),
+	m_users(0),
+	m_last_use(0)
+{
+	assert(filter >= 0 && filter < image::FILTER_COUNT);
+	assert(in_count > 0 && out_count > 0);
 
-	array< array<CONTRIB> >	contrib;
+	float	(*filter_function)(float) = s_filters[filter].filter_function;
+	float	support = s_filters[filter].support;
 
-	int	out_width = out_x1 - out_x0 + 1;
-	int	out_height = out_y1 - out_y0 + 1;
-	assert(out_width > 0);
-	assert(out_height > 0);
+	// When shrinking, stretch the filter to cover all the source
+	// pixels under each output pixel.
+	float	fscale = scale < 1.0f ? 1.0f / scale : 1.0f;
+	float	width = support * fscale;
 
-	float	in_width = in_x1 - in_x0;
-	float	in_height = in_y1 - in_y0;
-	assert(in_width > 0);
-	assert(in_height > 0);
+	// Find the widest span of source pixels, after folding.
+	{for (int i = 0; i < out_count; i++)
+	{
+		float	center = (float) i / scale;
+		int	left = iclamp(int(ceilf(center - width)), 0, in_count - 1);
+		int	right = iclamp(int(floorf(center + width)), 0, in_count - 1);
+		m_taps = imax(m_taps, right - left + 1);
+	}}
+	m_taps = (m_taps + pad - 1) / pad * pad;
+
+	m_start.resize(out_count);
+	m_weights.resize(out_count * m_taps);
+	memset(&m_weights[0], 0, m_weights.size() * sizeof(m_weights[0]));
+
+	array<float>	w;
+	w.resize(m_taps);
+	{for (int i = 0; i < out_count; i++)
+	{
+		float	center = (float) i / scale;
+		int	left = int(ceilf(center - width));
+		int	right = int(floorf(center + width));
+		int	lo = iclamp(left, 0, in_count - 1);
+		int	hi = iclamp(right, 0, in_count - 1);
+
+		{for (int j = 0; j <= hi - lo; j++) { w[j] = 0; }}
+		float	sum = 0;
+		for (int j = left; j <= right; j++)
+		{
+			float	weight = (*filter_function)((center - (float) j) / fscale);
+			w[iclamp(j, lo, hi) - lo] += weight;
+			sum += weight;
+		}
 
-	int	in_window_w = int(ceilf(in_x1) - floorf(in_x0) + 1);
-	int	in_window_h = int(ceilf(in_y1) - floorf(in_y0) + 1);
+		// Keep the span within the line if it fits.
+		int	start = lo;
+		if (start + m_taps > in_count)
+		{
+			start = imax(0, in_count - m_taps);
+		}
+		m_start[i] = start;
+		Sint16*	out = &m_weights[i * m_taps + (lo - start)];
 
-	/* create intermediate image to hold horizontal zoom */
-	tmp = image::create_rgb(out_width, in_window_h);
-	xscale = (float) (out_width - 1) / in_width;
-	yscale = (float) (out_height - 1) / in_height;
+		if (fabsf(sum) < 1e-6f)
+		{
+			// Nothing under the filter; use the nearest pixel.
+			out[iclamp(frnd(center), lo, hi) - lo] = WEIGHT_ONE;
+			continue;
+		}
 
-	// xxxx protect against division by 0
-	if (yscale == 0) { yscale = 1.0f; }
-	if (xscale == 0) { xscale = 1.0f; }
+		// Quantize, then put the rounding error on the biggest
+		// weight, so the sum is exact and flat areas stay flat.
+		int	total = 0;
+		int	biggest = 0;
+		{for (int j = 0; j <= hi - lo; j++)
+		{
+			int	q = int(floorf(w[j] / sum * WEIGHT_ONE + 0.5f));
+			out[j] = Sint16(q);
+			total += q;
+			if (abs(q) > abs(out[biggest])) { biggest = j; }
+		}}
+		out[biggest] = Sint16(out[biggest] + WEIGHT_ONE - total);
+	}}
+}
 
-	/* pre-calculate filter contributions for a row */
-	contrib.resize(tmp->m_width);
-	if(xscale < 1.0f) {
-		width = support / xscale;
-		fscale = 1.0f / xscale;
-		for (i = 0; i < tmp->m_width; ++i) {
-			contrib[i].resize(0);
-
-			center = (float) i / xscale;
-			left = int(ceilf(center - width));
-			right = int(floorf(center + width));
-			for (j = left; j <= right; ++j) {
-				weight = center - (float) j;
-				weight = (*filter_function)(weight / fscale) / fscale;
-				n = iclamp(j, 0, in_window_w - 1);
-				contrib[i].push_back(CONTRIB(n, weight));
-			}
+
+struct weight_table_cache
+// resample() gets called over and over with the same sizes (e.g. for
+// every tile of a texture), so the weight tables are kept around
+// for reuse.
+{
+	enum { MAX_TABLES = 16 };
+
+	tu_thread::mutex	m_mutex;
+	array<weight_table*>	m_tables;
+	int	m_use_count;
+
+	weight_table_cache() : m_use_count(0) {}
+	~weight_table_cache()
+	{
+		for (int i = 0; i < m_tables.size(); i++)
+		{
+			delete m_tables[i];
 		}
-	} else {
-		for (i = 0; i < tmp->m_width; ++i) {
-			contrib[i].resize(0);
-			center = (float) i / xscale;
-			left = int(ceilf(center - support));
-			right = int(floorf(center + support));
-			for(j = left; j <= right; ++j) {
-				weight = center - (float) j;
-				weight = (*filter_function)(weight);
-				n = iclamp(j, 0, in_window_w - 1);
-				contrib[i].push_back(CONTRIB(n, weight));
-			}
+	}
+};
+
+weight_table_cache	s_weight_tables;
+
+
+const weight_table*	get_weight_table(image::filter_type filter, int in_count, int out_count, float scale, int pad)
+// Find or make the weight table for the given parameters.  Call
+// release_weight_table() when done with it.
+{
+	weight_table_cache*	c = &s_weight_tables;
+
+	c->m_mutex.lock();
+	for (int i = 0; i < c->m_tables.size(); i++)
+	{
+		weight_table*	t = c->m_tables[i];
+		if (t->m_filter == filter
+		    && t->m_in_count == in_count
+		    && t->m_out_count == out_count
+		    && t->m_scale == scale
+		    && t->m_pad == pad)
+		{
+			t->m_users++;
+			t->m_last_use = ++c->m_use_count;
+			c->m_mutex.unlock();
+			return t;
 		}
 	}
+	c->m_mutex.unlock();
+
+	// Build it without holding the lock.  If another thread builds
+	// the same table meanwhile, we just end up with two.
+	weight_table*	t = new weight_table(filter, in_count, out_count, scale, pad);
 
-	/* apply filter to zoom horizontally from src to tmp */
-	raster = (Uint8*) my_calloc(in_window_w, 3);
-	for (k = 0; k < tmp->m_height; ++k) {
-		get_row(raster, in, int(floorf(in_x0)), in_window_w, k);
-		for (i = 0; i < tmp->m_width; ++i) {
-			float	red = 0.0f;
-			float	green = 0.0f;
-			float	blue = 0.0f;
-			for(j = 0; j < contrib[i].size(); ++j) {
-				int	pixel = contrib[i][j].pixel;
-				red	+= raster[pixel * 3 + 0] * contrib[i][j].weight;
-				green	+= raster[pixel * 3 + 1] * contrib[i][j].weight;
-				blue	+= raster[pixel * 3 + 2] * contrib[i][j].weight;
+	tu_thread::autolock	lock(&c->m_mutex);
+	if (c->m_tables.size() >= weight_table_cache::MAX_TABLES)
+	{
+		// Evict the least recently used table that's not in use.
+		int	oldest = -1;
+		for (int i = 0; i < c->m_tables.size(); i++)
+		{
+			if (c->m_tables[i]->m_users == 0
+			    && (oldest == -1 || c->m_tables[i]->m_last_use < c->m_tables[oldest]->m_last_use))
+			{
+				oldest = i;
 			}
-			put_pixel(tmp, i, k, red, green, blue);
+		}
+		if (oldest != -1)
+		{
+			delete c->m_tables[oldest];
+			c->m_tables[oldest] = c->m_tables.back();
+			c->m_tables.pop_back();
 		}
 	}
-	my_cfree(raster);
-
-	contrib.resize(out_height);
-
-	if (yscale < 1.0f) {
-		width = support / yscale;
-		fscale = 1.0f / yscale;
-		for (i = 0; i < out_height; ++i) {
-			contrib[i].resize(0);
-
-			center = (float) i / yscale;
-			left = int(ceilf(center - width));
-			right = int(floorf(center + width));
-			for (j = left; j <= right; ++j) {
-				weight = center - (float) j;
-				weight = (*filter_function)(weight / fscale) / fscale;
-				n = iclamp(j, 0, tmp->m_height - 1);
-				contrib[i].push_back(CONTRIB(n, weight));
-			}
+	t->m_users = 1;
+	t->m_last_use = ++c->m_use_count;
+	c->m_tables.push_back(t);
+	return t;
+}
+
+
+void	release_weight_table(const weight_table* t)
+{
+	tu_thread::autolock	lock(&s_weight_tables.m_mutex);
+	const_cast<weight_table*>(t)->m_users--;
+	assert(t->m_users >= 0);
+}
+
+
+inline Uint8	clamp_sum(int sum)
+// Fixed-point sum (with WEIGHT_ROUND in it) to a pixel value.
+{
+	return (Uint8) iclamp(sum >> WEIGHT_BITS, 0, 255);
+}
+
+
+void	filter_row_4(Uint8* dst, int channels, const Uint8* src, const weight_table* t)
+// Horizontal pass over one row.  src holds four bytes per pixel, with
+// padding past the end for the weight table's taps.  Writes the
+// first 'channels' bytes of each filtered pixel to dst.
+{
+	int	taps = t->m_taps;
+	assert((taps & 1) == 0);
+
+	for (int i = 0; i < t->m_out_count; i++, dst += channels)
+	{
+		const Uint8*	p = src + t->m_start[i] * 4;
+		const Sint16*	w = &t->m_weights[i * taps];
+#if TU_CONFIG_USE_SSE2
+		// Two pixels per step: interleave their bytes to
+		// r0 r1 g0 g1 b0 b1 a0 a1, widen, and multiply-add with
+		// w0 w1 w0 w1 ... to get r g b a sums.
+		__m128i	zero = _mm_setzero_si128();
+		__m128i	acc = _mm_set1_epi32(WEIGHT_ROUND);
+		for (int k = 0; k < taps; k += 2, p += 8)
+		{
+			__m128i	px = _mm_loadl_epi64((const __m128i*) p);
+			px = _mm_unpacklo_epi8(_mm_unpacklo_epi8(px, _mm_srli_si128(px, 4)), zero);
+			__m128i	ww = _mm_set1_epi32((w[k] & 0xFFFF) | (w[k + 1] << 16));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(px, ww));
 		}
-	} else {
-		for (i = 0; i < out_height; ++i) {
-			contrib[i].resize(0);
-			center = (float) i / yscale;
-			left = int(ceilf(center - support));
-			right = int(floorf(center + support));
-			for(j = left; j <= right; ++j) {
-				weight = center - (float) j;
-				weight = (*filter_function)(weight);
-				n = iclamp(j, 0, tmp->m_height - 1);
-				contrib[i].push_back(CONTRIB(n, weight));
+		acc = _mm_srai_epi32(acc, WEIGHT_BITS);
+		acc = _mm_packs_epi32(acc, acc);
+		int	result = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+		memcpy(dst, &result, channels);
+#else // not TU_CONFIG_USE_SSE2
+		for (int c = 0; c < channels; c++)
+		{
+			int	sum = WEIGHT_ROUND;
+			for (int k = 0; k < taps; k++)
+			{
+				sum += p[k * 4 + c] * w[k];
 			}
+			dst[c] = clamp_sum(sum);
 		}
+#endif // not TU_CONFIG_USE_SSE2
 	}
+}
 
-	/* apply filter to zoom vertically from tmp to dst */
-	raster = (Uint8*) my_calloc(tmp->m_height, 3);
-	for (k = 0; k < tmp->m_width; ++k) {
-		get_column(raster, tmp, k);
-		for (i = 0; i < out_height; ++i) {
-			float	red = 0.0f;
-			float	green = 0.0f;
-			float	blue = 0.0f;
-			for (j = 0; j < contrib[i].size(); ++j) {
-				int	pixel = contrib[i][j].pixel;
-				red	+= raster[pixel * 3 + 0] * contrib[i][j].weight;
-				green	+= raster[pixel * 3 + 1] * contrib[i][j].weight;
-				blue	+= raster[pixel * 3 + 2] * contrib[i][j].weight;
+
+void	filter_row_1(Uint8* dst, const Uint8* src, const weight_table* t)
+// Horizontal pass over one row of single-byte pixels.  src is padded
+// past the end for the weight table's taps.
+{
+	int	taps = t->m_taps;
+	assert((taps & 7) == 0);
+
+	for (int i = 0; i < t->m_out_count; i++)
+	{
+		const Uint8*	p = src + t->m_start[i];
+		const Sint16*	w = &t->m_weights[i * taps];
+#if TU_CONFIG_USE_SSE2
+		__m128i	zero = _mm_setzero_si128();
+		__m128i	acc = zero;
+		for (int k = 0; k < taps; k += 8)
+		{
+			__m128i	px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (p + k)), zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_loadu_si128((const __m128i*) (w + k))));
+		}
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+		dst[i] = clamp_sum(_mm_cvtsi128_si32(acc) + WEIGHT_ROUND);
+#else // not TU_CONFIG_USE_SSE2
+		int	sum = WEIGHT_ROUND;
+		for (int k = 0; k < taps; k++)
+		{
+			sum += p[k] * w[k];
+		}
+		dst[i] = clamp_sum(sum);
+#endif // not TU_CONFIG_USE_SSE2
+	}
+}
+
+
+void	filter_column(Uint8* dst, const Uint8* const rows[], const Sint16* weights, int taps, int count)
+// Vertical pass for one output row: dst[i] is the weighted sum of
+// rows[k][i], for i in [0, count).  Works on bytes, so it doesn't
+// care about the pixel format.  taps is even.
+{
+	assert((taps & 1) == 0);
+
+	int	i = 0;
+#if TU_CONFIG_USE_SSE2
+	// Sixteen bytes at a time, two rows per multiply-add.
+	__m128i	zero = _mm_setzero_si128();
+	__m128i	round = _mm_set1_epi32(WEIGHT_ROUND);
+	for ( ; i + 16 <= count; i += 16)
+	{
+		__m128i	a0 = round, a1 = round, a2 = round, a3 = round;
+		for (int k = 0; k < taps; k += 2)
+		{
+			__m128i	ww = _mm_set1_epi32((weights[k] & 0xFFFF) | (weights[k + 1] << 16));
+			__m128i	r0 = _mm_loadu_si128((const __m128i*) (rows[k] + i));
+			__m128i	r1 = _mm_loadu_si128((const __m128i*) (rows[k + 1] + i));
+			__m128i	lo = _mm_unpacklo_epi8(r0, r1);
+			__m128i	hi = _mm_unpackhi_epi8(r0, r1);
+			a0 = _mm_add_epi32(a0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), ww));
+			a1 = _mm_add_epi32(a1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), ww));
+			a2 = _mm_add_epi32(a2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), ww));
+			a3 = _mm_add_epi32(a3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), ww));
+		}
+		__m128i	lo = _mm_packs_epi32(_mm_srai_epi32(a0, WEIGHT_BITS), _mm_srai_epi32(a1, WEIGHT_BITS));
+		__m128i	hi = _mm_packs_epi32(_mm_srai_epi32(a2, WEIGHT_BITS), _mm_srai_epi32(a3, WEIGHT_BITS));
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(lo, hi));
+	}
+#endif // TU_CONFIG_USE_SSE2
+
+	for ( ; i < count; i++)
+	{
+		int	sum = WEIGHT_ROUND;
+		for (int k = 0; k < taps; k++)
+		{
+			sum += rows[k][i] * weights[k];
+		}
+		dst[i] = clamp_sum(sum);
+	}
+}
+
+
+struct resample_job
+// What the band tasks need to know.
+{
+	const Uint8*	m_in;	// top-left pixel of the source window
+	int	m_in_pitch;
+	Uint8*	m_tmp;	// horizontally filtered rows
+	int	m_tmp_pitch;
+	Uint8*	m_out;	// top-left pixel of the output rectangle
+	int	m_out_pitch;
+	int	m_channels;
+	const weight_table*	m_x;
+	const weight_table*	m_y;
+	int	m_band_count;
+};
+
+
+void	horizontal_band(void* arg, int band)
+// Filter a band of source rows into m_tmp.
+{
+	const resample_job*	j = (const resample_job*) arg;
+	const weight_table*	x = j->m_x;
+	int	rows = j->m_y->m_in_count;
+	int	row0 = rows * band / j->m_band_count;
+	int	row1 = rows * (band + 1) / j->m_band_count;
+
+	// The filters read whole pixels (rgb gets a pad byte) and
+	// run past the end of the line, so work on a padded copy.
+	int	src_bpp = j->m_channels == 3 ? 4 : j->m_channels;
+	array<Uint8>	src;
+	src.resize((x->m_in_count + x->m_pad) * src_bpp);
+	memset(&src[0], 0, src.size());
+
+	for (int y = row0; y < row1; y++)
+	{
+		const Uint8*	in = j->m_in + y * j->m_in_pitch;
+		if (j->m_channels == 3)
+		{
+			Uint8*	p = &src[0];
+			for (int i = 0; i < x->m_in_count; i++, p += 4, in += 3)
+			{
+				p[0] = in[0];
+				p[1] = in[1];
+				p[2] = in[2];
 			}
-			put_pixel(out, k + out_x0, i + out_y0, red, green, blue);
+		}
+		else
+		{
+			memcpy(&src[0], in, x->m_in_count * src_bpp);
+		}
+
+		Uint8*	out = j->m_tmp + y * j->m_tmp_pitch;
+		if (j->m_channels == 1)
+		{
+			filter_row_1(out, &src[0], x);
+		}
+		else
+		{
+			filter_row_4(out, j->m_channels, &src[0], x);
 		}
 	}
-	my_cfree(raster);
+}
 
-	contrib.resize(0);
 
-	delete tmp;
+void	vertical_band(void* arg, int band)
+// Filter a band of output rows from m_tmp.
+{
+	const resample_job*	j = (const resample_job*) arg;
+	const weight_table*	y = j->m_y;
+	int	row0 = y->m_out_count * band / j->m_band_count;
+	int	row1 = y->m_out_count * (band + 1) / j->m_band_count;
+	int	count = j->m_x->m_out_count * j->m_channels;
+
+	// Taps past the last row (only for tiny sources) have zero
+	// weight; point them at a row of zeros.
+	array<Uint8>	zero_row;
+	zero_row.resize(count);
+	memset(&zero_row[0], 0, count);
+
+	array<const Uint8*>	rows;
+	rows.resize(y->m_taps);
+	for (int i = row0; i < row1; i++)
+	{
+		{for (int k = 0; k < y->m_taps; k++)
+		{
+			int	r = y->m_start[i] + k;
+			rows[k] = r < y->m_in_count ? j->m_tmp + r * j->m_tmp_pitch : &zero_row[0];
+		}}
+		filter_column(j->m_out + i * j->m_out_pitch, &rows[0], &y->m_weights[i * y->m_taps], y->m_taps, count);
+	}
 }
 
 
-void	resample(image::rgba* out, int out_x0, int out_y0, int out_x1, int out_y1,
-		 image::rgba* in, float in_x0, float in_y0, float in_x1, float in_y1)
-// Rescale the specified portion of the input image into the specified
-// portion of the output image.  Coordinates are *inclusive*.
-//
-// Same as above, but with an alpha channel.
+void	resample_image(
+	image::image_base* out, int out_x0, int out_y0, int out_x1, int out_y1,
+	const image::image_base* in, float in_x0, float in_y0, float in_x1, float in_y1,
+	int channels,
+	image::filter_type filter,
+	tu_thread::pool* pool)
+// Guts of image::resample(), for any of the pixel formats.
 {
+	assert(filter >= image::FILTER0 && filter < image::FILTER_COUNT);
 	assert(out_x0 <= out_x1);
 	assert(out_y0 <= out_y1);
 	assert(out_x0 >= 0 && out_x0 < out->m_width);
@@ -541,161 +629,91 @@ void	resample(image::rgba* out, int out_x0, int out_y0, int out_x1, int out_y1,
 	assert(out_y0 >= 0 && out_y0 < out->m_height);
 	assert(out_y1 >= 0 && out_y1 < out->m_height);
 
-	float	(*filter_function)(float);
-	float	support;
-
-	// Pick a filter function & support.
-	assert(default_type >= FILTER0 && default_type < FILTER_COUNT);
-	filter_function = filter_table[default_type].filter_function;
-	support = filter_table[default_type].support;
-
-
-	image::rgba*	tmp;		/* intermediate image */
-	float	xscale, yscale;		/* zoom scale factors */
-	int i, j, k;			/* loop variables */
-	int n;				/* pixel number */
-	float center; int left, right;	/* filter calculation variables */
-	float width, fscale, weight;	/* filter calculation variables */
-	Uint8*	raster;			/* a row or column of pixels */
-
-	array< array<CONTRIB> >	contrib;
-
 	int	out_width = out_x1 - out_x0 + 1;
 	int	out_height = out_y1 - out_y0 + 1;
-	assert(out_width > 0);
-	assert(out_height > 0);
 
 	float	in_width = in_x1 - in_x0;
 	float	in_height = in_y1 - in_y0;
 	assert(in_width > 0);
 	assert(in_height > 0);
 
-	int	in_window_w = int(ceilf(in_x1) - floorf(in_x0) + 1);
-	int	in_window_h = int(ceilf(in_y1) - floorf(in_y0) + 1);
+	// The source window starts at the pixel containing
+	// (in_x0, in_y0); past the edges of the image, edge pixels
+	// repeat, which the weight tables take care of.
+	int	x0 = int(floorf(in_x0));
+	int	y0 = int(floorf(in_y0));
+	assert(x0 >= 0 && x0 < in->m_width);
+	assert(y0 >= 0 && y0 < in->m_height);
+	int	in_count_x = imin(int(ceilf(in_x1) - floorf(in_x0) + 1), in->m_width - x0);
+	int	in_count_y = imin(int(ceilf(in_y1) - floorf(in_y0) + 1), in->m_height - y0);
 
-	/* create intermediate image to hold horizontal zoom */
-	tmp = image::create_rgba(out_width, in_window_h);
-	xscale = (float) (out_width - 1) / in_width;
-	yscale = (float) (out_height - 1) / in_height;
+	float	xscale = (float) (out_width - 1) / in_width;
+	float	yscale = (float) (out_height - 1) / in_height;
 
 	// xxxx protect against division by 0
 	if (yscale == 0) { yscale = 1.0f; }
 	if (xscale == 0) { xscale = 1.0f; }
 
-	/* pre-calculate filter contributions for a row */
-	contrib.resize(tmp->m_width);
-	if(xscale < 1.0f) {
-		width = support / xscale;
-		fscale = 1.0f / xscale;
-		for (i = 0; i < tmp->m_width; ++i) {
-			contrib[i].resize(0);
-
-			center = (float) i / xscale;
-			left = int(ceilf(center - width));
-			right = int(floorf(center + width));
-			for (j = left; j <= right; ++j) {
-				weight = center - (float) j;
-				weight = (*filter_function)(weight / fscale) / fscale;
-				n = iclamp(j, 0, in_window_w - 1);
-				contrib[i].push_back(CONTRIB(n, weight));
-			}
-		}
-	} else {
-		for (i = 0; i < tmp->m_width; ++i) {
-			contrib[i].resize(0);
-			center = (float) i / xscale;
-			left = int(ceilf(center - support));
-			right = int(floorf(center + support));
-			for(j = left; j <= right; ++j) {
-				weight = center - (float) j;
-				weight = (*filter_function)(weight);
-				n = iclamp(j, 0, in_window_w - 1);
-				contrib[i].push_back(CONTRIB(n, weight));
-			}
-		}
-	}
-
-	/* apply filter to zoom horizontally from src to tmp */
-	raster = (Uint8*) my_calloc(in_window_w, 4);
-	for (k = 0; k < tmp->m_height; ++k) {
-		get_row(raster, in, int(floorf(in_x0)), in_window_w, k);
-		for (i = 0; i < tmp->m_width; ++i) {
-			float	red = 0.0f;
-			float	green = 0.0f;
-			float	blue = 0.0f;
-			float	alpha = 0.0f;
-			for(j = 0; j < contrib[i].size(); ++j) {
-				int	pixel = contrib[i][j].pixel;
-				red	+= raster[pixel * 4 + 0] * contrib[i][j].weight;
-				green	+= raster[pixel * 4 + 1] * contrib[i][j].weight;
-				blue	+= raster[pixel * 4 + 2] * contrib[i][j].weight;
-				alpha	+= raster[pixel * 4 + 3] * contrib[i][j].weight;
-			}
-			put_pixel(tmp, i, k, red, green, blue, alpha);
-		}
+	resample_job	j;
+	j.m_x = get_weight_table(filter, in_count_x, out_width, xscale, channels == 1 ? 8 : 2);
+	j.m_y = get_weight_table(filter, in_count_y, out_height, yscale, 2);
+	j.m_channels = channels;
+	j.m_in = in->m_data + y0 * in->m_pitch + x0 * channels;
+	j.m_in_pitch = in->m_pitch;
+	j.m_out = out->m_data + out_y0 * out->m_pitch + out_x0 * channels;
+	j.m_out_pitch = out->m_pitch;
+	j.m_tmp_pitch = out_width * channels;
+	j.m_tmp = new Uint8[in_count_y * j.m_tmp_pitch];
+
+	if (pool)
+	{
+		// A few bands per thread, to even out the load.
+		j.m_band_count = imin(pool->get_thread_count() * 4, imin(in_count_y, out_height));
+		pool->run(horizontal_band, &j, j.m_band_count);
+		pool->run(vertical_band, &j, j.m_band_count);
 	}
-	my_cfree(raster);
-
-	contrib.resize(out_height);
-
-	if (yscale < 1.0f) {
-		width = support / yscale;
-		fscale = 1.0f / yscale;
-		for (i = 0; i < out_height; ++i) {
-			contrib[i].resize(0);
-
-			center = (float) i / yscale;
-			left = int(ceilf(center - width));
-			right = int(floorf(center + width));
-			for (j = left; j <= right; ++j) {
-				weight = center - (float) j;
-				weight = (*filter_function)(weight / fscale) / fscale;
-				n = iclamp(j, 0, tmp->m_height - 1);
-				contrib[i].push_back(CONTRIB(n, weight));
-			}
-		}
-	} else {
-		for (i = 0; i < out_height; ++i) {
-			contrib[i].resize(0);
-			center = (float) i / yscale;
-			left = int(ceilf(center - support));
-			right = int(floorf(center + support));
-			for(j = left; j <= right; ++j) {
-				weight = center - (float) j;
-				weight = (*filter_function)(weight);
-				n = iclamp(j, 0, tmp->m_height - 1);
-				contrib[i].push_back(CONTRIB(n, weight));
-			}
-		}
+	else
+	{
+		j.m_band_count = 1;
+		horizontal_band(&j, 0);
+		vertical_band(&j, 0);
 	}
 
-	/* apply filter to zoom vertically from tmp to dst */
-	raster = (Uint8*) my_calloc(tmp->m_height, 4);
-	for (k = 0; k < tmp->m_width; ++k) {
-		get_column(raster, tmp, k);
-		for (i = 0; i < out_height; ++i) {
-			float	red = 0.0f;
-			float	green = 0.0f;
-			float	blue = 0.0f;
-			float	alpha = 0.0f;
-			for (j = 0; j < contrib[i].size(); ++j) {
-				int	pixel = contrib[i][j].pixel;
-				red	+= raster[pixel * 4 + 0] * contrib[i][j].weight;
-				green	+= raster[pixel * 4 + 1] * contrib[i][j].weight;
-				blue	+= raster[pixel * 4 + 2] * contrib[i][j].weight;
-				alpha	+= raster[pixel * 4 + 3] * contrib[i][j].weight;
-			}
-			put_pixel(out, k + out_x0, i + out_y0, red, green, blue, alpha);
-		}
-	}
-	my_cfree(raster);
+	delete [] j.m_tmp;
+	release_weight_table(j.m_x);
+	release_weight_table(j.m_y);
+}
+
+
+};	// end anonymous namespace
+
+
+namespace image {
+
+
+void	resample(rgb* out, int out_x0, int out_y0, int out_x1, int out_y1,
+		 rgb* in, float in_x0, float in_y0, float in_x1, float in_y1,
+		 filter_type filter, tu_thread::pool* pool)
+{
+	resample_image(out, out_x0, out_y0, out_x1, out_y1, in, in_x0, in_y0, in_x1, in_y1, 3, filter, pool);
+}
 
-	contrib.resize(0);
 
-	delete tmp;
+void	resample(rgba* out, int out_x0, int out_y0, int out_x1, int out_y1,
+		 rgba* in, float in_x0, float in_y0, float in_x1, float in_y1,
+		 filter_type filter, tu_thread::pool* pool)
+{
+	resample_image(out, out_x0, out_y0, out_x1, out_y1, in, in_x0, in_y0, in_x1, in_y1, 4, filter, pool);
 }
 
 
+void	resample(alpha* out, int out_x0, int out_y0, int out_x1, int out_y1,
+		 alpha* in, float in_x0, float in_y0, float in_x1, float in_y1,
+		 filter_type filter, tu_thread::pool* pool)
+{
+	resample_image(out, out_x0, out_y0, out_x1, out_y1, in, in_x0, in_y0, in_x1, in_y1, 1, filter, pool);
+}
+
 
 // tulrich: some interesting scaling code from Vitaly.  Looks like a
 // fast bilinear scale using fixed point.  I haven't validated this
@@ -812,6 +830,272 @@ void	zoom(image_base* src, image_base* dst)
 } // end namespace image
 
 
+#ifdef IMAGE_FILTERS_TEST
+
+
+// Checks resample() against a straightforward floating-point version
+// of the same filtering, checks that the pixel formats, thread
+// counts and SSE2/plain C agree, and measures the speed of each
+// filter.
+//
+// g++ image_filters.cpp image.cpp container.cpp jpeg.cpp membuf.cpp tu_file.cpp tu_random.cpp tu_thread.cpp tu_timer.cpp utf8.cpp utility.cpp -O2 -I.. -DIMAGE_FILTERS_TEST -DTU_CONFIG_LINK_TO_THREAD=2 -ljpeg -lpthread -o image_filters_test
+
+
+#include "base/tu_random.h"
+#include "base/tu_timer.h"
+
+
+static const char*	s_filter_names[image::FILTER_COUNT] = {
+	"box", "triangle", "bell", "B-spline", "cubic", "Lanczos3", "Mitchell"
+};
+
+
+static void	fill_random(image::image_base* im)
+{
+	for (int y = 0; y < im->m_height; y++)
+	{
+		Uint8*	p = image::scanline(im, y);
+		int	bytes = im->m_pitch;	// includes any padding
+		for (int i = 0; i < bytes; i++)
+		{
+			// Smooth-ish, with some noise on top.
+			p[i] = Uint8(iclamp(int(128 + 100 * sinf(i * 0.05f + y * 0.03f)) + int(tu_random::next_random() & 31) - 16, 0, 255));
+		}
+	}
+}
+
+
+static void	reference_line(float* dst, int out_count, const float* src, int in_count, int stride, float scale, image::filter_type filter)
+// Filter one line in floating point, the way the Graphics Gems code
+// does it, but with normalized weights.
+{
+	float	(*filter_function)(float) = s_filters[filter].filter_function;
+	float	fscale = scale < 1.0f ? 1.0f / scale : 1.0f;
+	float	width = s_filters[filter].support * fscale;
+	for (int i = 0; i < out_count; i++)
+	{
+		float	center = (float) i / scale;
+		float	sum = 0, weight_sum = 0;
+		for (int j = int(ceilf(center - width)); j <= int(floorf(center + width)); j++)
+		{
+			float	w = (*filter_function)((center - (float) j) / fscale);
+			sum += src[iclamp(j, 0, in_count - 1) * stride] * w;
+			weight_sum += w;
+		}
+		dst[i * stride] = weight_sum == 0 ? src[iclamp(frnd(center), 0, in_count - 1) * stride] : sum / weight_sum;
+	}
+}
+
+
+static int	compare_to_reference(const image::rgba* out, const image::rgba* in,
+				     float in_x0, float in_y0, float in_x1, float in_y1, image::filter_type filter)
+// Resample each channel of the given window of 'in' to the size of
+// 'out' in floating point, and return the largest difference from
+// out.
+{
+	int	x0 = int(floorf(in_x0));
+	int	y0 = int(floorf(in_y0));
+	int	in_w = imin(int(ceilf(in_x1) - floorf(in_x0) + 1), in->m_width - x0);
+	int	in_h = imin(int(ceilf(in_y1) - floorf(in_y0) + 1), in->m_height - y0);
+	float	xscale = out->m_width > 1 ? (out->m_width - 1) / (in_x1 - in_x0) : 1.0f;
+	float	yscale = out->m_height > 1 ? (out->m_height - 1) / (in_y1 - in_y0) : 1.0f;
+
+	array<float>	src, tmp, dst;
+	src.resize(in_w * in_h);
+	tmp.resize(out->m_width * in_h);
+	dst.resize(out->m_width * out->m_height);
+
+	int	worst = 0;
+	for (int c = 0; c < 4; c++)
+	{
+		{for (int y = 0; y < in_h; y++)
+		{
+			const Uint8*	p = image::scanline(in, y0 + y) + x0 * 4 + c;
+			for (int x = 0; x < in_w; x++) { src[y * in_w + x] = p[x * 4]; }
+		}}
+		{for (int y = 0; y < in_h; y++)
+		{
+			reference_line(&tmp[y * out->m_width], out->m_width, &src[y * in_w], in_w, 1, xscale, filter);
+			// Like resample(), round the intermediate rows to bytes.
+			for (int x = 0; x < out->m_width; x++)
+			{
+				tmp[y * out->m_width + x] = (float) iclamp(int(floorf(tmp[y * out->m_width + x] + 0.5f)), 0, 255);
+			}
+		}}
+		{for (int x = 0; x < out->m_width; x++)
+		{
+			reference_line(&dst[x], out->m_height, &tmp[x], in_h, out->m_width, yscale, filter);
+		}}
+		{for (int y = 0; y < out->m_height; y++)
+		{
+			const Uint8*	p = image::scanline(out, y) + c;
+			for (int x = 0; x < out->m_width; x++)
+			{
+				int	expected = iclamp(int(floorf(dst[y * out->m_width + x] + 0.5f)), 0, 255);
+				worst = imax(worst, abs(expected - p[x * 4]));
+			}
+		}}
+	}
+	return worst;
+}
+
+
+static bool	same_pixels(const image::image_base* a, const image::image_base* b, int bpp_a, int bpp_b, int channels, int offset_a)
+// True if the first 'channels' bytes of each pixel of b match the
+// bytes starting at offset_a in each pixel of a.
+{
+	for (int y = 0; y < a->m_height; y++)
+	{
+		const Uint8*	pa = image::scanline(a, y);
+		const Uint8*	pb = image::scanline(b, y);
+		for (int x = 0; x < a->m_width; x++)
+		{
+			if (memcmp(pa + x * bpp_a + offset_a, pb + x * bpp_b, channels)) return false;
+		}
+	}
+	return true;
+}
+
+
+int	main(int argc, const char** argv)
+{
+	int	errors = 0;
+	tu_thread::pool	pool(4);
+
+	image::rgba*	in = image::create_rgba(301, 217);
+	fill_random(in);
+
+	// The same picture as rgb, and its alpha channel alone.
+	image::rgb*	in_rgb = image::create_rgb(in->m_width, in->m_height);
+	image::alpha*	in_alpha = image::create_alpha(in->m_width, in->m_height);
+	{for (int y = 0; y < in->m_height; y++)
+	{
+		for (int x = 0; x < in->m_width; x++)
+		{
+			memcpy(image::scanline(in_rgb, y) + x * 3, image::scanline(in, y) + x * 4, 3);
+			image::scanline(in_alpha, y)[x] = image::scanline(in, y)[x * 4 + 3];
+		}
+	}}
+
+	struct test_case
+	{
+		int	out_w, out_h;
+		float	x0, y0, x1, y1;
+	} cases[] = {
+		{ 97, 61, 0, 0, 300, 216 },	// shrink
+		{ 640, 480, 0, 0, 300, 216 },	// enlarge
+		{ 301, 217, 0, 0, 300, 216 },	// same size
+		{ 100, 40, 10.5f, 20.25f, 210.5f, 130.75f },	// window
+		{ 50, 30, 250, 190, 310, 230 },	// window off the edge
+		{ 1, 1, 0, 0, 300, 216 },
+		{ 5, 3, 0, 0, 1, 1 },	// tiny source
+	};
+	const int	case_count = sizeof(cases) / sizeof(cases[0]);
+
+	for (int f = 0; f < image::FILTER_COUNT; f++)
+	{
+		image::filter_type	filter = (image::filter_type) f;
+		for (int i = 0; i < case_count; i++)
+		{
+			const test_case&	t = cases[i];
+			image::rgba*	out = image::create_rgba(t.out_w, t.out_h);
+			image::rgba*	out_pool = image::create_rgba(t.out_w, t.out_h);
+			image::rgb*	out_rgb = image::create_rgb(t.out_w, t.out_h);
+			image::alpha*	out_alpha = image::create_alpha(t.out_w, t.out_h);
+
+			image::resample(out, 0, 0, t.out_w - 1, t.out_h - 1, in, t.x0, t.y0, t.x1, t.y1, filter);
+			image::resample(out_pool, 0, 0, t.out_w - 1, t.out_h - 1, in, t.x0, t.y0, t.x1, t.y1, filter, &pool);
+			image::resample(out_rgb, 0, 0, t.out_w - 1, t.out_h - 1, in_rgb, t.x0, t.y0, t.x1, t.y1, filter);
+			image::resample(out_alpha, 0, 0, t.out_w - 1, t.out_h - 1, in_alpha, t.x0, t.y0, t.x1, t.y1, filter);
+
+			// The fixed-point weights and the rounding of the
+			// intermediate rows can each cost a bit.
+			int	diff = compare_to_reference(out, in, t.x0, t.y0, t.x1, t.y1, filter);
+			if (diff > 2)
+			{
+				printf("%s, case %d: off from reference by %d\n", s_filter_names[f], i, diff);
+				errors++;
+			}
+			if (same_pixels(out, out_pool, 4, 4, 4, 0) == false)
+			{
+				printf("%s, case %d: threaded result differs\n", s_filter_names[f], i);
+				errors++;
+			}
+			if (same_pixels(out, out_rgb, 4, 3, 3, 0) == false
+			    || same_pixels(out, out_alpha, 4, 1, 1, 3) == false)
+			{
+				printf("%s, case %d: rgb or alpha result differs from rgba\n", s_filter_names[f], i);
+				errors++;
+			}
+
+			delete out;
+			delete out_pool;
+			delete out_rgb;
+			delete out_alpha;
+		}
+	}
+
+	// Interpolating filters leave a same-size image alone.
+	{
+		image::filter_type	exact[] = { image::BOX, image::TRIANGLE, image::SOME_CUBIC, image::LANCZOS3 };
+		image::rgba*	out = image::create_rgba(in->m_width, in->m_height);
+		for (int i = 0; i < 4; i++)
+		{
+			image::resample(out, 0, 0, in->m_width - 1, in->m_height - 1,
+					in, 0, 0, float(in->m_width - 1), float(in->m_height - 1), exact[i]);
+			if (same_pixels(out, in, 4, 4, 4, 0) == false)
+			{
+				printf("%s: same-size resample changed the image\n", s_filter_names[exact[i]]);
+				errors++;
+			}
+		}
+		delete out;
+	}
+
+	printf("%s\n", errors ? "FAILED" : "OK");
+
+	delete in;
+	delete in_rgb;
+	delete in_alpha;
+
+	// Benchmark: megapixels of the bigger image per second.
+	const int	BIG = 2048, SMALL = 512;
+	image::rgba*	big = image::create_rgba(BIG, BIG);
+	image::rgba*	small = image::create_rgba(SMALL, SMALL);
+	fill_random(big);
+	fill_random(small);
+	float	mpixels = BIG * BIG / 1000000.0f;
+
+	printf("\nMpixel/s     shrink 4x  enlarge 4x  shrink, %d threads\n", pool.get_thread_count());
+	for (int f = 0; f < image::FILTER_COUNT; f++)
+	{
+		image::filter_type	filter = (image::filter_type) f;
+		double	seconds[3];
+		for (int k = 0; k < 3; k++)
+		{
+			uint64	start_ticks = tu_timer::get_profile_ticks();
+			if (k == 1)
+			{
+				image::resample(big, 0, 0, BIG - 1, BIG - 1, small, 0, 0, SMALL - 1, SMALL - 1, filter);
+			}
+			else
+			{
+				image::resample(small, 0, 0, SMALL - 1, SMALL - 1, big, 0, 0, BIG - 1, BIG - 1, filter, k == 2 ? &pool : NULL);
+			}
+			seconds[k] = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+		}
+		printf("%-10s %10.1f %11.1f %19.1f\n", s_filter_names[f], mpixels / seconds[0], mpixels / seconds[1], mpixels / seconds[2]);
+	}
+
+	delete big;
+	delete small;
+
+	return errors ? 1 : 0;
+}
+
+
+#endif // IMAGE_FILTERS_TEST
+
 
 // Local Variables:
 // mode: C++
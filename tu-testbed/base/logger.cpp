@@ -7,6 +7,7 @@
 
 
 #include "base/logger.h"
+#include "base/tu_async_log.h"
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -53,17 +54,20 @@ namespace logger
 	bool FLAG_verbose_log = false;
 
 
-#ifdef _WIN32
-#define vsnprintf	_vsnprintf
-#endif // _WIN32
+	static void	write_message(int type, const char* message)
+	// tu_async_log hands finished messages to this.
+	{
+		if (s_log_callback)
+		{
+			s_log_callback((log_type) type, message);
+		}
+	}
 
-	static const int	BUFFER_SIZE = 500;
 
-#define FORMAT_INTO_BUFFER(fmt)				\
-		char	buffer[BUFFER_SIZE];		\
+#define POST_MESSAGE(post_func, type, fmt)		\
 		va_list ap;				\
 		va_start(ap, fmt);			\
-		vsnprintf(buffer, BUFFER_SIZE, fmt, ap);\
+		post_func(write_message, type, fmt, ap);\
 		va_end(ap);
 
 
@@ -72,8 +76,17 @@ namespace logger
 	{
 		if (FLAG_verbose_log && s_log_callback)
 		{
-			FORMAT_INTO_BUFFER(fmt);
-			s_log_callback(VERBOSE, buffer);
+			POST_MESSAGE(tu_async_log::vpost, VERBOSE, fmt);
+		}
+	}
+
+
+	void	vmsg_deferred(const char* fmt, ...)
+	// Like vmsg(), but lets the log writer thread do the formatting.
+	{
+		if (FLAG_verbose_log && s_log_callback)
+		{
+			POST_MESSAGE(tu_async_log::vpost_deferred, VERBOSE, fmt);
 		}
 	}
 
@@ -83,8 +96,7 @@ namespace logger
 	{
 		if (s_log_callback)
 		{
-			FORMAT_INTO_BUFFER(fmt);
-			s_log_callback(NORMAL, buffer);
+			POST_MESSAGE(tu_async_log::vpost, NORMAL, fmt);
 		}
 	}
 
@@ -94,8 +106,7 @@ namespace logger
 	{
 		if (s_log_callback)
 		{
-			FORMAT_INTO_BUFFER(fmt);
-			s_log_callback(ERROR, buffer);
+			POST_MESSAGE(tu_async_log::vpost, ERROR, fmt);
 		}
 	}
 }
@@ -22,6 +22,9 @@ namespace logger
 
 	// Use this to register your own log handler.  If you don't
 	// register a log handler, the logs don't go anywhere.
+	//
+	// After tu_async_log::start(), the handler is called on the
+	// log writer thread.
 	enum log_type {
 		VERBOSE,
 		NORMAL,
@@ -41,6 +44,10 @@ namespace logger
 
 	// Verbose log.
 	void	vmsg(const char* fmt, ...) ATTRCHECK;
+	// Verbose log for hot spots.  Once tu_async_log is started,
+	// the formatting happens on the writer thread, so fmt must be
+	// a string literal.
+	void	vmsg_deferred(const char* fmt, ...) ATTRCHECK;
 	// Normal log.
 	void	msg(const char* fmt, ...) ATTRCHECK;
 	// Error log.
@@ -50,6 +57,7 @@ namespace logger
 // Shorter aliases for the logging functions.  TODO add __FILE__, __LINE__ etc.
 #define LOG logger::msg
 #define VLOG logger::vmsg
+#define VLOG_DEFERRED logger::vmsg_deferred
 #define LOGERROR logger::error
 
 
@@ -7,7 +7,7 @@
 // Windows.
 
 
-#include "mmap_util.h"
+#include "base/mmap_util.h"
 
 
 #ifdef WIN32
@@ -125,6 +125,50 @@ namespace mmap_util {
 			// @@ need to remove (data, filename) from s_temp_filenames!
 		}
 	}
+
+
+	const void*	map_file(const char* filename, Uint64* size)
+	{
+		assert(size);
+		*size = 0;
+
+		HANDLE	filehandle = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+						FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (filehandle == INVALID_HANDLE_VALUE) {
+			return NULL;
+		}
+
+		LARGE_INTEGER	file_size;
+		if (GetFileSizeEx(filehandle, &file_size) == 0
+		    || file_size.QuadPart <= 0
+		    || (Uint64) file_size.QuadPart != (Uint64) (SIZE_T) file_size.QuadPart)
+		{
+			// Empty, or too big for our address space.
+			CloseHandle(filehandle);
+			return NULL;
+		}
+
+		HANDLE	file_mapping = CreateFileMapping(filehandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(filehandle);
+		if (file_mapping == NULL) {
+			return NULL;
+		}
+
+		const void*	data = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(file_mapping);
+		if (data) {
+			*size = file_size.QuadPart;
+		}
+		return data;
+	}
+
+
+	void	unmap_file(const void* data, Uint64 size)
+	{
+		if (data) {
+			UnmapViewOfFile(data);
+		}
+	}
 };
 
 
@@ -188,11 +232,16 @@ namespace mmap_util {
 			if (lseek(fildes,size,SEEK_SET) == -1) {
 				goto UNWIND;
 			}
-			write(fildes,'\0',1)/* == -1 */;
+			char	zero = 0;
+			if (write(fildes, &zero, 1) != 1) {
+				goto UNWIND;
+			}
 		}
 		// else if size == 0 then size = filesize(filename);
 		else {
-			fildes = open(filename, (writeable ? O_RDWR : O_RDONLY) | O_CREAT);
+			fildes = writeable
+				? open(filename, O_RDWR | O_CREAT, 0644)
+				: open(filename, O_RDONLY);
 			if (fildes == -1) {
 				// Failure.
 				return NULL;
@@ -220,7 +269,7 @@ namespace mmap_util {
 		close(fildes);
 		if (created) {
 			unlink(tmpname);
-			delete tmpname;
+			delete [] tmpname;
 		}
 		return NULL;
 	}
@@ -234,16 +283,71 @@ namespace mmap_util {
 		if (s_temp_filenames.get(data, &filename)) {
 			// Need to delete this temporary file.
 			unlink(filename);
-			delete filename;
+			delete [] filename;
 
 			// @@ need to remove (data, filename) from s_temp_filenames!
 		}			
 	}
+
+
+	// Map a whole existing file, read-only.
+	const void*	map_file(const char* filename, Uint64* size)
+	{
+		assert(size);
+		*size = 0;
+
+		int	fildes = open(filename, O_RDONLY);
+		if (fildes == -1) {
+			return NULL;
+		}
+
+		struct stat	info;
+		if (fstat(fildes, &info) == -1
+		    || info.st_size <= 0
+		    || (Uint64) info.st_size != (Uint64) (size_t) info.st_size)
+		{
+			// Empty, or too big for our address space.
+			close(fildes);
+			return NULL;
+		}
+
+		void*	data = mmap(0, (size_t) info.st_size, PROT_READ, MAP_SHARED, fildes, 0);
+		close(fildes);	// the mapping keeps the file open
+		if (data == MAP_FAILED) {
+			return NULL;
+		}
+
+		*size = info.st_size;
+		return data;
+	}
+
+
+	void	unmap_file(const void* data, Uint64 size)
+	{
+		if (data) {
+			munmap((void*) data, (size_t) size);
+		}
+	}
 };
 
 
 #endif // not WIN32
 
+
+int	mmap_util::file_size(const char* filename)
+// Return the size in bytes of the named file, or -1 if it can't be
+// opened.
+{
+	FILE*	fp = fopen(filename, "rb");
+	if (fp == NULL) {
+		return -1;
+	}
+	fseek(fp, 0, SEEK_END);
+	int	size = (int) ftell(fp);
+	fclose(fp);
+	return size;
+}
+
 // Local Variables:
 // mode: C++
 // c-basic-offset: 8 
@@ -0,0 +1,35 @@
+// mmap_util.h	-- Thatcher Ulrich <tu@tulrich.com> 2002
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Some utility functions for dealing with memory mapping using mmap
+// (Posix) or MapViewOfFile (Win32).
+
+
+#ifndef MMAP_UTIL_H
+#define MMAP_UTIL_H
+
+
+#include "base/tu_types.h"
+
+
+// These functions wrap platform-specific code.
+namespace mmap_util {
+	void*	map(int size, bool writable, const char* filename);
+	void	unmap(void* buffer, int size);
+
+	// Size of an existing file, so callers can map it read-only
+	// and later unmap() it; -1 if the file can't be opened.
+	int	file_size(const char* filename);
+
+	// Map a whole existing file, read-only.  Unlike map(), this
+	// works on files of 2GB and up, given the address space.  Sets
+	// *size to the file size.  Returns NULL on failure.  Release
+	// the mapping with unmap_file().
+	const void*	map_file(const char* filename, Uint64* size);
+	void	unmap_file(const void* data, Uint64 size);
+};
+
+
+#endif // MMAP_UTIL_H
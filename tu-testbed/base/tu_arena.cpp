@@ -0,0 +1,954 @@
+// tu_arena.cpp	-- size-class slab allocator for per-player heaps
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Size-class slab allocator; see tu_arena.h.
+//
+// A heap carves slabs of SLAB_SIZE bytes out of its chunks, which are
+// aligned to SLAB_SIZE, so a block's slab header is found by masking
+// the block's address.  Each slab holds blocks of one size class;
+// the slabs of a class that have free blocks are on a list, and
+// slabs that empty out go on a list of their own, for any class to
+// reuse.
+//
+// To tell our blocks from tu_malloc()'s, a page map, shared by all
+// heaps, has a bit for every slab we own.  Its tables are only ever
+// added, so it can be read without locking; a heap's bits are
+// cleared when the heap is released, and the tables get reused.
+//
+// Each heap has a spin lock, held while blocks are taken from or
+// given back to it, so any thread can free a heap's blocks.
+
+
+#include "base/tu_arena.h"
+#include "base/tu_atomic.h"
+#include "base/container.h"
+#include "base/utility.h"
+#include <string.h>
+
+
+namespace {
+// anonymous namespace to hold local stuff.
+
+
+const int	SLAB_SHIFT = 14;
+const size_t	SLAB_SIZE = 1 << SLAB_SHIFT;
+const size_t	SLAB_MASK = SLAB_SIZE - 1;
+const size_t	SLAB_HEADER_SIZE = 64;
+
+const size_t	FIRST_CHUNK_SIZE = 256 << 10;
+const size_t	MAX_CHUNK_SIZE = 16 << 20;
+const int	MAX_HEAP_CHUNKS = 64;
+
+
+// Block sizes.  All are multiples of 16, so blocks are 16-byte
+// aligned.
+const int	s_class_size[] =
+{
+	16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256,
+	320, 384, 448, 512,
+	640, 768, 896, 1024,
+};
+const int	CLASS_COUNT = sizeof(s_class_size) / sizeof(s_class_size[0]);
+
+// Size class for each multiple of 16 bytes, up to MAX_SMALL_SIZE.
+unsigned char	s_class_of[tu_arena::MAX_SMALL_SIZE / 16 + 1];
+
+
+void	init_class_table()
+{
+	int	c = 0;
+	for (int i = 0; i <= tu_arena::MAX_SMALL_SIZE / 16; i++)
+	{
+		while (s_class_size[c] < i * 16)
+		{
+			c++;
+		}
+		s_class_of[i] = (unsigned char) c;
+	}
+}
+
+
+inline int	class_of(size_t size)
+{
+	assert(size <= tu_arena::MAX_SMALL_SIZE);
+	return s_class_of[(size + 15) >> 4];
+}
+
+
+struct slab
+{
+	tu_arena::heap*	m_heap;
+	slab*	m_next;		// in the class's list of slabs with room
+	slab*	m_prev;
+	void*	m_free;		// freed blocks
+	char*	m_bump;		// blocks from here on have never been used
+	int	m_class;
+	int	m_used;
+	bool	m_listed;
+};
+
+
+inline slab*	slab_of(const void* p)
+{
+	return (slab*) ((size_t) p & ~SLAB_MASK);
+}
+
+
+struct chunk
+{
+	void*	m_raw;
+	size_t	m_raw_size;
+	char*	m_begin;
+	char*	m_end;
+};
+
+
+inline void	spin_lock(volatile int* lock)
+{
+	while (tu_atomic_compare_and_swap(lock, 0, 1) == false)
+	{
+	}
+}
+
+
+inline void	spin_unlock(volatile int* lock)
+{
+	tu_atomic_store(lock, 0);
+}
+
+
+//
+// The page map: a bit per slab, in three levels of tables, which
+// cover 48 bits of address space.
+//
+
+
+const int	LEAF_BITS = 10;		// 1024 slabs, 16MB
+const int	MID_BITS = 12;
+const int	TOP_BITS = 12;
+const int	MAPPED_ADDRESS_BITS = SLAB_SHIFT + LEAF_BITS + MID_BITS + TOP_BITS;
+
+struct page_map_leaf
+{
+	volatile int	m_bits[(1 << LEAF_BITS) / 32];
+};
+
+struct page_map_mid
+{
+	page_map_leaf* volatile	m_leaf[1 << MID_BITS];
+};
+
+page_map_mid* volatile	s_page_map[1 << TOP_BITS];
+volatile int	s_page_map_lock = 0;
+
+// Bounds of every chunk there's been, for a quick rejection.
+char* volatile	s_lowest = (char*) ~(size_t) 0;
+char* volatile	s_highest = NULL;
+
+
+inline uint64	slab_index(const void* p)
+{
+	return (uint64) (size_t) p >> SLAB_SHIFT;
+}
+
+
+page_map_leaf*	find_leaf(uint64 slab)
+// Returns NULL if no table covers this slab yet.
+{
+	page_map_mid*	mid = tu_atomic_load_ptr(&s_page_map[slab >> (LEAF_BITS + MID_BITS)]);
+	if (mid == NULL)
+	{
+		return NULL;
+	}
+	return tu_atomic_load_ptr(&mid->m_leaf[(slab >> LEAF_BITS) & ((1 << MID_BITS) - 1)]);
+}
+
+
+page_map_leaf*	make_leaf(uint64 slab)
+// Call with s_page_map_lock held.  Returns NULL if we're out of
+// memory.
+{
+	page_map_mid* volatile*	top = &s_page_map[slab >> (LEAF_BITS + MID_BITS)];
+	page_map_mid*	mid = *top;
+	if (mid == NULL)
+	{
+		mid = (page_map_mid*) tu_malloc(sizeof(page_map_mid));
+		if (mid == NULL)
+		{
+			return NULL;
+		}
+		memset(mid, 0, sizeof(*mid));
+		tu_atomic_store_ptr(top, mid);
+	}
+
+	page_map_leaf* volatile*	slot = &mid->m_leaf[(slab >> LEAF_BITS) & ((1 << MID_BITS) - 1)];
+	page_map_leaf*	leaf = *slot;
+	if (leaf == NULL)
+	{
+		leaf = (page_map_leaf*) tu_malloc(sizeof(page_map_leaf));
+		if (leaf == NULL)
+		{
+			return NULL;
+		}
+		memset(leaf, 0, sizeof(*leaf));
+		tu_atomic_store_ptr(slot, leaf);
+	}
+	return leaf;
+}
+
+
+bool	map_chunk(char* begin, char* end, bool ours)
+// Set or clear the bits for the slabs in [begin, end).  Returns false
+// if the chunk can't be mapped.
+{
+	uint64	first = slab_index(begin);
+	uint64	last = slab_index(end - 1);
+	if ((last << SLAB_SHIFT) >> MAPPED_ADDRESS_BITS)
+	{
+		return false;
+	}
+
+	spin_lock(&s_page_map_lock);
+
+	// Make all the tables first, so there's nothing to undo.
+	for (uint64 slab = first; slab <= last; slab = (slab | ((1 << LEAF_BITS) - 1)) + 1)
+	{
+		if (make_leaf(slab) == NULL)
+		{
+			spin_unlock(&s_page_map_lock);
+			return false;
+		}
+	}
+
+	for (uint64 slab = first; slab <= last; slab++)
+	{
+		page_map_leaf*	leaf = find_leaf(slab);
+		volatile int*	word = &leaf->m_bits[(slab & ((1 << LEAF_BITS) - 1)) >> 5];
+		int	bit = 1 << (slab & 31);
+		tu_atomic_store(word, ours ? (*word | bit) : (*word & ~bit));
+	}
+
+	if (ours)
+	{
+		if (begin < s_lowest)
+		{
+			tu_atomic_store_ptr(&s_lowest, begin);
+		}
+		if (end > s_highest)
+		{
+			tu_atomic_store_ptr(&s_highest, end);
+		}
+	}
+
+	spin_unlock(&s_page_map_lock);
+	return true;
+}
+
+
+bool	is_arena_block(const void* p)
+{
+	const char*	c = (const char*) p;
+	if (c < tu_atomic_load_ptr(&s_lowest) || c >= tu_atomic_load_ptr(&s_highest))
+	{
+		return false;
+	}
+
+	uint64	slab = slab_index(p);
+	page_map_leaf*	leaf = find_leaf(slab);
+	if (leaf == NULL)
+	{
+		return false;
+	}
+	int	word = tu_atomic_load(&leaf->m_bits[(slab & ((1 << LEAF_BITS) - 1)) >> 5]);
+	return (word & (1 << (slab & 31))) != 0;
+}
+
+
+void*	malloc_chunk(void* user, size_t size)
+{
+	return tu_malloc(size);
+}
+
+
+void	free_chunk(void* user, void* p, size_t size)
+{
+	tu_free(p, size);
+}
+
+
+void	free_outside(void* p)
+// For blocks that aren't ours.  (Inside namespace tu_arena, tu_free()
+// might name our own free().)
+{
+	tu_free(p, 0);
+}
+
+
+TU_THREAD_LOCAL tu_arena::heap*	s_current_heap = NULL;
+
+
+}	// end anonymous namespace
+
+
+namespace tu_arena
+{
+	struct heap
+	{
+		chunk_source	m_source;
+		slab*	m_partial[CLASS_COUNT];	// slabs with room
+		slab*	m_empty;		// slabs with nothing in them
+		char*	m_unused;		// rest of the newest chunk
+		char*	m_unused_end;
+		size_t	m_next_chunk_size;
+		chunk	m_chunks[MAX_HEAP_CHUNKS];
+		int	m_chunk_count;
+		stats	m_stats;
+		bool	m_destroyed;
+		volatile int	m_lock;
+	};
+}
+
+
+namespace {
+
+
+using tu_arena::heap;
+
+
+bool	add_chunk(heap* h)
+// Get more memory from the chunk source.
+{
+	if (h->m_chunk_count == MAX_HEAP_CHUNKS)
+	{
+		return false;
+	}
+
+	size_t	size = h->m_next_chunk_size;
+	size_t	raw_size = size + SLAB_SIZE;	// room to align
+	void*	raw = h->m_source.m_alloc(h->m_source.m_user, raw_size);
+	if (raw == NULL)
+	{
+		return false;
+	}
+
+	char*	begin = (char*) (((size_t) raw + SLAB_MASK) & ~SLAB_MASK);
+	if (map_chunk(begin, begin + size, true) == false)
+	{
+		h->m_source.m_free(h->m_source.m_user, raw, raw_size);
+		return false;
+	}
+
+	chunk*	c = &h->m_chunks[h->m_chunk_count++];
+	c->m_raw = raw;
+	c->m_raw_size = raw_size;
+	c->m_begin = begin;
+	c->m_end = begin + size;
+
+	h->m_unused = begin;
+	h->m_unused_end = begin + size;
+	h->m_next_chunk_size = imin(int(size * 2), int(MAX_CHUNK_SIZE));
+	h->m_stats.m_chunk_bytes += raw_size;
+	return true;
+}
+
+
+inline void	link_slab(heap* h, slab* s)
+// Put s at the head of its class's list.
+{
+	assert(s->m_listed == false);
+	slab**	head = &h->m_partial[s->m_class];
+	s->m_prev = NULL;
+	s->m_next = *head;
+	if (*head)
+	{
+		(*head)->m_prev = s;
+	}
+	*head = s;
+	s->m_listed = true;
+}
+
+
+inline void	unlink_slab(heap* h, slab* s)
+{
+	assert(s->m_listed);
+	if (s->m_prev)
+	{
+		s->m_prev->m_next = s->m_next;
+	}
+	else
+	{
+		h->m_partial[s->m_class] = s->m_next;
+	}
+	if (s->m_next)
+	{
+		s->m_next->m_prev = s->m_prev;
+	}
+	s->m_listed = false;
+}
+
+
+slab*	new_slab(heap* h, int size_class)
+// Returns NULL if we're out of memory.
+{
+	slab*	s = h->m_empty;
+	if (s)
+	{
+		h->m_empty = s->m_next;
+	}
+	else
+	{
+		if (h->m_unused_end - h->m_unused < (ptrdiff_t) SLAB_SIZE && add_chunk(h) == false)
+		{
+			return NULL;
+		}
+		s = (slab*) h->m_unused;
+		h->m_unused += SLAB_SIZE;
+	}
+
+	s->m_heap = h;
+	s->m_free = NULL;
+	s->m_bump = (char*) s + SLAB_HEADER_SIZE;
+	s->m_class = size_class;
+	s->m_used = 0;
+	s->m_listed = false;
+	link_slab(h, s);
+	return s;
+}
+
+
+void	release_heap(heap* h)
+// Give everything back to the chunk source.  Call without h's lock
+// held; nobody else may be using h by now.
+{
+	assert(h->m_stats.m_live_blocks == 0);
+	if (s_current_heap == h)
+	{
+		s_current_heap = NULL;
+	}
+	for (int i = 0; i < h->m_chunk_count; i++)
+	{
+		chunk*	c = &h->m_chunks[i];
+		map_chunk(c->m_begin, c->m_end, false);
+		h->m_source.m_free(h->m_source.m_user, c->m_raw, c->m_raw_size);
+	}
+	delete h;
+}
+
+
+void*	container_alloc(size_t size)
+{
+	return tu_arena::allocate(size);
+}
+
+
+void*	container_realloc(void* old_ptr, size_t new_size, size_t old_size)
+{
+	return tu_arena::reallocate(old_ptr, new_size, old_size);
+}
+
+
+void	container_free(void* old_ptr, size_t old_size)
+{
+	tu_arena::free(old_ptr);
+}
+
+
+container_allocator	s_container_allocator =
+{
+	container_alloc,
+	container_realloc,
+	container_free,
+};
+
+
+}	// end anonymous namespace
+
+
+namespace tu_arena
+{
+	heap*	create_heap(const chunk_source* source)
+	{
+		compiler_assert(sizeof(slab) <= SLAB_HEADER_SIZE);
+		if (s_class_of[tu_arena::MAX_SMALL_SIZE / 16] == 0)
+		{
+			init_class_table();
+		}
+		install_container_allocator();
+
+		heap*	h = new heap;
+		if (source)
+		{
+			h->m_source = *source;
+		}
+		else
+		{
+			h->m_source.m_alloc = malloc_chunk;
+			h->m_source.m_free = free_chunk;
+			h->m_source.m_user = NULL;
+		}
+		for (int i = 0; i < CLASS_COUNT; i++)
+		{
+			h->m_partial[i] = NULL;
+		}
+		h->m_empty = NULL;
+		h->m_unused = NULL;
+		h->m_unused_end = NULL;
+		h->m_next_chunk_size = FIRST_CHUNK_SIZE;
+		h->m_chunk_count = 0;
+		h->m_stats.m_live_blocks = 0;
+		h->m_stats.m_live_bytes = 0;
+		h->m_stats.m_chunk_bytes = 0;
+		h->m_destroyed = false;
+		h->m_lock = 0;
+		return h;
+	}
+
+
+	void	destroy_heap(heap* h)
+	{
+		if (h == NULL)
+		{
+			return;
+		}
+		if (s_current_heap == h)
+		{
+			s_current_heap = NULL;
+		}
+
+		spin_lock(&h->m_lock);
+		h->m_destroyed = true;
+		bool	release = h->m_stats.m_live_blocks == 0;
+		spin_unlock(&h->m_lock);
+
+		if (release)
+		{
+			release_heap(h);
+		}
+		// else free() releases it when the last block goes.
+	}
+
+
+	void	set_current_heap(heap* h)
+	{
+		assert(h == NULL || h->m_destroyed == false);
+		s_current_heap = h;
+	}
+
+
+	heap*	get_current_heap()
+	{
+		return s_current_heap;
+	}
+
+
+	void*	allocate(size_t size)
+	{
+		heap*	h = s_current_heap;
+		if (h == NULL || size > MAX_SMALL_SIZE)
+		{
+			return tu_malloc(size);
+		}
+
+		int	c = class_of(size);
+		spin_lock(&h->m_lock);
+		slab*	s = h->m_partial[c];
+		if (s == NULL)
+		{
+			s = new_slab(h, c);
+			if (s == NULL)
+			{
+				spin_unlock(&h->m_lock);
+				return tu_malloc(size);
+			}
+		}
+
+		int	block_size = s_class_size[c];
+		void*	p = s->m_free;
+		if (p)
+		{
+			s->m_free = *(void**) p;
+		}
+		else
+		{
+			p = s->m_bump;
+			s->m_bump += block_size;
+		}
+		s->m_used++;
+
+		if (s->m_free == NULL && s->m_bump + block_size > (char*) s + SLAB_SIZE)
+		{
+			// Full.
+			unlink_slab(h, s);
+		}
+
+		h->m_stats.m_live_blocks++;
+		h->m_stats.m_live_bytes += block_size;
+		spin_unlock(&h->m_lock);
+		return p;
+	}
+
+
+	void	free(void* p)
+	{
+		if (p == NULL)
+		{
+			return;
+		}
+		if (is_arena_block(p) == false)
+		{
+			free_outside(p);
+			return;
+		}
+
+		slab*	s = slab_of(p);
+		heap*	h = s->m_heap;
+		bool	release = false;
+		spin_lock(&h->m_lock);
+		assert(s->m_used > 0);
+
+		*(void**) p = s->m_free;
+		s->m_free = p;
+		s->m_used--;
+		h->m_stats.m_live_blocks--;
+		h->m_stats.m_live_bytes -= s_class_size[s->m_class];
+
+		if (s->m_used == 0)
+		{
+			// Empty; any class can have it.
+			if (s->m_listed)
+			{
+				unlink_slab(h, s);
+			}
+			s->m_next = h->m_empty;
+			h->m_empty = s;
+			release = h->m_destroyed && h->m_stats.m_live_blocks == 0;
+		}
+		else if (s->m_listed == false)
+		{
+			link_slab(h, s);
+		}
+		spin_unlock(&h->m_lock);
+
+		if (release)
+		{
+			release_heap(h);
+		}
+	}
+
+
+	void*	reallocate(void* p, size_t new_size, size_t old_size)
+	{
+		if (p == NULL)
+		{
+			return allocate(new_size);
+		}
+
+		bool	ours = is_arena_block(p);
+		if (ours == false && (s_current_heap == NULL || new_size > MAX_SMALL_SIZE))
+		{
+			return tu_realloc(p, new_size, old_size);
+		}
+		if (ours && new_size <= MAX_SMALL_SIZE && class_of(new_size) == slab_of(p)->m_class)
+		{
+			return p;
+		}
+
+		void*	q = allocate(new_size);
+		memcpy(q, p, imin(int(old_size), int(new_size)));
+		free(p);
+		return q;
+	}
+
+
+	void	get_stats(const heap* h, stats* s)
+	{
+		heap*	locked = const_cast<heap*>(h);
+		spin_lock(&locked->m_lock);
+		*s = h->m_stats;
+		spin_unlock(&locked->m_lock);
+	}
+
+
+	void	install_container_allocator()
+	{
+		g_container_allocator = &s_container_allocator;
+	}
+}
+
+
+#ifdef TU_ARENA_TEST
+
+// g++ tu_arena.cpp container.cpp utf8.cpp tu_thread.cpp tu_timer.cpp utility.cpp -O2 -I.. -DTU_ARENA_TEST -DTU_CONFIG_LINK_TO_THREAD=2 -lpthread -o tu_arena_test
+
+
+#include "base/tu_thread.h"
+#include "base/tu_timer.h"
+#include "base/tu_random.h"
+#include <stdio.h>
+
+
+static int	s_failures = 0;
+
+static void	check(bool ok, const char* what)
+{
+	if (!ok)
+	{
+		printf("FAILED: %s\n", what);
+		s_failures++;
+	}
+}
+
+
+static int	s_chunks_out = 0;
+
+static void*	counting_alloc(void* user, size_t size)
+{
+	s_chunks_out++;
+	return malloc(size);
+}
+
+static void	counting_free(void* user, void* p, size_t size)
+{
+	s_chunks_out--;
+	::free(p);
+}
+
+
+struct sharing_test
+{
+	tu_arena::heap*	m_heap;
+	void**	m_blocks;	// freed by the other thread
+	int	m_count;
+};
+
+
+static void	share_heap(void* arg)
+// Frees the blocks we're handed while allocating & freeing blocks of
+// our own from the same heap.
+{
+	sharing_test*	t = (sharing_test*) arg;
+	tu_arena::scoped_heap	scope(t->m_heap);
+
+	void*	mine[64];
+	memset(mine, 0, sizeof(mine));
+	for (int i = 0; i < t->m_count; i++)
+	{
+		tu_arena::free(t->m_blocks[i]);
+		tu_arena::free(mine[i & 63]);
+		mine[i & 63] = tu_arena::allocate(16 + (i % 200));
+	}
+	for (int i = 0; i < 64; i++)
+	{
+		tu_arena::free(mine[i]);
+	}
+}
+
+
+static double	churn(int count, size_t max_size)
+// Allocate & free blocks in a random pattern, with whatever heap is
+// current.  Returns nanoseconds per allocate/free pair.
+{
+	const int	LIVE = 4096;
+	void*	live[LIVE];
+	memset(live, 0, sizeof(live));
+
+	uint32	seed = 12345;
+	uint64	start = tu_timer::get_profile_ticks();
+	for (int i = 0; i < count; i++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		int	slot = (seed >> 8) % LIVE;
+		tu_arena::free(live[slot]);
+		size_t	size = 8 + (seed >> 20) % max_size;
+		live[slot] = tu_arena::allocate(size);
+		*(char*) live[slot] = 1;
+	}
+	for (int i = 0; i < LIVE; i++)
+	{
+		tu_arena::free(live[i]);
+	}
+	uint64	end = tu_timer::get_profile_ticks();
+	return tu_timer::profile_ticks_to_seconds(end - start) * 1e9 / count;
+}
+
+
+static double	batch(int count, size_t max_size)
+// Allocate a lot of blocks, then free them all, the way a frame's
+// worth of garbage comes and goes.  Returns nanoseconds per
+// allocate/free pair.
+{
+	const int	BATCH = 100000;
+	static void*	blocks[BATCH];
+
+	uint64	start = tu_timer::get_profile_ticks();
+	for (int done = 0; done < count; done += BATCH)
+	{
+		for (int i = 0; i < BATCH; i++)
+		{
+			blocks[i] = tu_arena::allocate(16 + (i * 16) % max_size);
+		}
+		for (int i = 0; i < BATCH; i++)
+		{
+			tu_arena::free(blocks[i]);
+		}
+	}
+	uint64	end = tu_timer::get_profile_ticks();
+	return tu_timer::profile_ticks_to_seconds(end - start) * 1e9 / count;
+}
+
+
+int	main()
+{
+	tu_arena::chunk_source	source = { counting_alloc, counting_free, NULL };
+	tu_arena::heap*	h = tu_arena::create_heap(&source);
+	tu_arena::stats	st;
+
+	// No current heap: plain malloc.
+	void*	outside = tu_arena::allocate(40);
+	check(s_chunks_out == 0, "no current heap");
+
+	{
+		tu_arena::scoped_heap	scope(h);
+
+		// Sizes round up to the classes, and are aligned.
+		void*	a = tu_arena::allocate(1);
+		void*	b = tu_arena::allocate(100);
+		void*	c = tu_arena::allocate(1024);
+		void*	big = tu_arena::allocate(5000);
+		check((((size_t) a | (size_t) b | (size_t) c) & 15) == 0, "alignment");
+		tu_arena::get_stats(h, &st);
+		check(st.m_live_blocks == 3 && st.m_live_bytes == 16 + 112 + 1024, "live counts");
+		check(s_chunks_out == 1, "one chunk");
+
+		// Freed blocks get reused.
+		tu_arena::free(b);
+		void*	b2 = tu_arena::allocate(97);
+		check(b2 == b, "reuse");
+
+		// Growing moves to a bigger class; shrinking within a
+		// class stays put.
+		strcpy((char*) b2, "hello");
+		void*	b3 = tu_arena::reallocate(b2, 300, 97);
+		check(b3 != b2 && strcmp((char*) b3, "hello") == 0, "grow");
+		check(tu_arena::reallocate(b3, 290, 300) == b3, "shrink in place");
+
+		// Blocks from outside can be freed & grown in here.
+		void*	outside2 = tu_arena::reallocate(outside, 64, 40);
+		tu_arena::free(outside2);
+		outside = NULL;
+
+		tu_arena::free(a);
+		tu_arena::free(b3);
+		tu_arena::free(c);
+		tu_arena::free(big);
+		tu_arena::get_stats(h, &st);
+		check(st.m_live_blocks == 0 && st.m_live_bytes == 0, "all freed");
+
+		// Containers use the current heap.
+		array<tu_string>	strings;
+		for (int i = 0; i < 100; i++)
+		{
+			strings.push_back("a string long enough to be on the heap");
+		}
+		tu_arena::get_stats(h, &st);
+		check(st.m_live_blocks >= 100, "container storage");
+	}
+
+	// Destroying a heap with blocks in use keeps it until they're
+	// gone.
+	void*	survivor;
+	{
+		tu_arena::scoped_heap	scope(h);
+		survivor = tu_arena::allocate(200);
+	}
+	tu_arena::destroy_heap(h);
+	check(s_chunks_out == 1, "heap lingers");
+	tu_arena::free(survivor);
+	check(s_chunks_out == 0, "heap released");
+
+	// Released heaps' pages get reused, so there's no limit on
+	// how many heaps come and go.
+	for (int i = 0; i < 10000; i++)
+	{
+		h = tu_arena::create_heap(&source);
+		{
+			tu_arena::scoped_heap	scope(h);
+			tu_arena::free(tu_arena::allocate(100));
+		}
+		tu_arena::destroy_heap(h);
+	}
+	check(s_chunks_out == 0, "many heaps released");
+	h = tu_arena::create_heap(&source);
+	{
+		tu_arena::scoped_heap	scope(h);
+		void*	p = tu_arena::allocate(100);
+		check(s_chunks_out == 1, "heap after many heaps");
+		tu_arena::free(p);
+	}
+	tu_arena::destroy_heap(h);
+
+	// Two threads sharing a heap, each freeing the other's
+	// blocks.
+	{
+		const int	SHARED_COUNT = 200000;
+		h = tu_arena::create_heap(&source);
+		sharing_test	t = { h, new void*[SHARED_COUNT], SHARED_COUNT };
+		void**	blocks = new void*[SHARED_COUNT];
+		{
+			tu_arena::scoped_heap	scope(h);
+			for (int i = 0; i < SHARED_COUNT; i++)
+			{
+				t.m_blocks[i] = tu_arena::allocate(16 + (i % 300));
+			}
+
+			tu_thread::thread	other(share_heap, &t);
+			for (int i = 0; i < SHARED_COUNT; i++)
+			{
+				blocks[i] = tu_arena::allocate(16 + (i % 100));
+			}
+			other.wait();
+		}
+		for (int i = 0; i < SHARED_COUNT; i++)
+		{
+			tu_arena::free(blocks[i]);
+		}
+		tu_arena::get_stats(h, &st);
+		check(st.m_live_blocks == 0 && st.m_live_bytes == 0, "shared heap all freed");
+		tu_arena::destroy_heap(h);
+		check(s_chunks_out == 0, "shared heap released");
+		delete [] blocks;
+		delete [] t.m_blocks;
+	}
+
+	// Speed.
+	const int	COUNT = 2000000;
+	double	malloc_churn_ns = churn(COUNT, 256);
+	double	malloc_batch_ns = batch(COUNT, 128);
+	double	arena_churn_ns, arena_batch_ns;
+	h = tu_arena::create_heap();
+	{
+		tu_arena::scoped_heap	scope(h);
+		arena_churn_ns = churn(COUNT, 256);
+		arena_batch_ns = batch(COUNT, 128);
+	}
+	tu_arena::destroy_heap(h);
+	printf("alloc+free, random, 8..264 bytes: malloc %.1f ns, arena %.1f ns\n", malloc_churn_ns, arena_churn_ns);
+	printf("alloc+free, batches, 16..128 bytes: malloc %.1f ns, arena %.1f ns\n", malloc_batch_ns, arena_batch_ns);
+
+	printf(s_failures ? "FAILED\n" : "OK\n");
+	return s_failures ? 1 : 0;
+}
+
+
+#endif // TU_ARENA_TEST
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
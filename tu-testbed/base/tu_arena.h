@@ -0,0 +1,106 @@
+// tu_arena.h	-- size-class slab allocator for per-player heaps
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Size-class slab allocator for lots of small objects that come and
+// go together -- e.g. the ActionScript objects, strings and
+// containers belonging to one gameswf::player.
+//
+// A heap hands out blocks of up to MAX_SMALL_SIZE bytes from slabs
+// of equal-sized blocks; bigger requests go to tu_malloc().  Each
+// thread has a current heap (none, to begin with); allocate() uses
+// it, and with no current heap is just tu_malloc().  free() and
+// reallocate() take blocks from any heap, or from tu_malloc().
+//
+// Each heap has a lock, so any thread may free or reallocate a
+// heap's blocks, and several threads may have the same heap current.
+//
+// destroy_heap() gives all the heap's memory back at once.  If some
+// of its blocks are still in use, the heap lingers until they've
+// been freed.
+//
+// The heap gets its memory in big chunks from a chunk_source, which
+// is tu_malloc() by default.  To run a heap on a dlmalloc 2.8
+// mspace, pass a chunk_source whose functions call mspace_malloc()
+// and mspace_free() on the mspace in m_user.
+
+
+#ifndef TU_ARENA_H
+#define TU_ARENA_H
+
+
+#include "base/tu_config.h"
+#include <stddef.h>
+
+
+namespace tu_arena
+{
+	enum
+	{
+		MAX_SMALL_SIZE = 1024,
+	};
+
+	struct chunk_source
+	{
+		void*	(*m_alloc)(void* user, size_t size);
+		void	(*m_free)(void* user, void* p, size_t size);
+		void*	m_user;
+	};
+
+	struct heap;
+
+	// source is copied; NULL means tu_malloc().
+	exported_module heap*	create_heap(const chunk_source* source = NULL);
+	exported_module void	destroy_heap(heap* h);
+
+	exported_module void	set_current_heap(heap* h);
+	exported_module heap*	get_current_heap();
+
+	struct scoped_heap
+	// Makes h current for the life of this object.
+	{
+		scoped_heap(heap* h)
+			:
+			m_previous(get_current_heap())
+		{
+			set_current_heap(h);
+		}
+
+		~scoped_heap()
+		{
+			set_current_heap(m_previous);
+		}
+
+	private:
+		heap*	m_previous;
+	};
+
+	exported_module void*	allocate(size_t size);
+	exported_module void	free(void* p);
+	exported_module void*	reallocate(void* p, size_t new_size, size_t old_size);
+
+	struct stats
+	{
+		int	m_live_blocks;
+		size_t	m_live_bytes;	// rounded up to the size classes
+		size_t	m_chunk_bytes;	// taken from the chunk_source
+	};
+	exported_module void	get_stats(const heap* h, stats* s);
+
+	// Makes array<>, tu_string and hash<> get their storage from
+	// here (and so from the current heap).  create_heap() calls
+	// it.
+	exported_module void	install_container_allocator();
+}
+
+
+#endif // TU_ARENA_H
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
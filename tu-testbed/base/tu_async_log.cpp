@@ -0,0 +1,1170 @@
+// tu_async_log.cpp	-- asynchronous log back end
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Asynchronous log back end; see tu_async_log.h.
+//
+// Each posting thread gets a thread_ring the first time it posts
+// while the writer is running.  The rings go on a list that's only
+// ever pushed onto (with compare-and-swap) and live until exit, so
+// the writer walks the list without locks.  A ring is a
+// single-producer, single-consumer queue of fixed-size slots; a
+// message is a header slot plus as many more slots as its text
+// needs, and is published by storing the ring's new head.
+//
+// Every message takes a number from a global counter when it's
+// posted, and the writer always writes the lowest-numbered message
+// at the front of any ring, so messages come out in the order they
+// were posted.  Whoever is writing holds s_write_lock, which is a
+// plain int so a crash handler can take it (or steal it) without
+// calling into the thread library.
+
+
+#include "base/tu_async_log.h"
+#include "base/tu_atomic.h"
+#include "base/tu_thread.h"
+#include "base/tu_timer.h"
+#include "base/utility.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define vsnprintf	_vsnprintf
+#define snprintf	_snprintf
+#else
+#include <signal.h>
+#endif
+
+
+namespace {
+// anonymous namespace to hold local stuff.
+
+
+using tu_async_log::write_func;
+
+
+// Messages (and deferred argument lists) longer than this are
+// truncated.
+const int	FORMAT_BUFFER_SIZE = 4096;
+
+const int	SLOT_SIZE = 128;
+
+enum message_flags
+{
+	DEFERRED = 1,	// payload is a format pointer + arguments
+};
+
+
+struct message_header
+{
+	write_func	m_write;
+	int	m_seq;
+	int	m_type;
+	int	m_size;		// payload bytes
+	short	m_slots;	// slots taken, including this one
+	short	m_flags;
+	int	m_drops;	// messages this thread dropped just before this one
+};
+
+
+union slot
+{
+	message_header	m_header;
+	char	m_bytes[SLOT_SIZE];
+	double	m_align;
+};
+
+// Payload bytes that fit in the header slot.
+const int	HEADER_PAYLOAD = SLOT_SIZE - (int) sizeof(message_header);
+
+
+struct thread_ring
+{
+	slot*	m_slots;
+	int	m_mask;			// slot count - 1
+	volatile int	m_head;		// slots produced; only the owner writes it
+	volatile int	m_tail;		// slots consumed; only the writer writes it
+	int	m_pending_drops;	// owner only
+	thread_ring*	m_next;
+};
+
+
+thread_ring* volatile	s_rings = NULL;
+int	s_ring_size = 4096;
+tu_async_log::full_policy	s_policy = tu_async_log::DROP;
+
+volatile int	s_next_seq = 0;
+volatile int	s_dropped_count = 0;
+
+volatile bool	s_running = false;
+volatile int	s_quit = 0;
+tu_thread::thread*	s_writer_thread = NULL;
+bool	s_registered_atexit = false;
+
+// 1 while some thread is writing messages out.
+volatile int	s_write_lock = 0;
+
+TU_THREAD_LOCAL thread_ring*	s_thread_ring = NULL;
+TU_THREAD_LOCAL bool	s_is_writer = false;
+TU_THREAD_LOCAL char	s_format_buffer[FORMAT_BUFFER_SIZE];
+
+
+// Ring indices count up forever and wrap around; do the arithmetic
+// unsigned, so the wrap is well defined.
+inline int	index_add(int a, int b) { return (int) ((unsigned) a + (unsigned) b); }
+inline int	index_diff(int a, int b) { return (int) ((unsigned) a - (unsigned) b); }
+
+
+thread_ring*	get_thread_ring()
+// The calling thread's ring; makes it, and puts it on the list, the
+// first time.
+{
+	thread_ring*	r = s_thread_ring;
+	if (r)
+	{
+		return r;
+	}
+
+	int	size = 2;
+	while (size < s_ring_size)
+	{
+		size <<= 1;
+	}
+
+	r = new thread_ring;
+	r->m_slots = new slot[size];
+	r->m_mask = size - 1;
+	r->m_head = 0;
+	r->m_tail = 0;
+	r->m_pending_drops = 0;
+	do
+	{
+		r->m_next = tu_atomic_load_ptr(&s_rings);
+	}
+	while (tu_atomic_compare_and_swap_ptr(&s_rings, r->m_next, r) == false);
+
+	s_thread_ring = r;
+	return r;
+}
+
+
+int	slots_needed(int payload_size)
+{
+	int	extra = payload_size - HEADER_PAYLOAD;
+	if (extra <= 0)
+	{
+		return 1;
+	}
+	return 1 + (extra + SLOT_SIZE - 1) / SLOT_SIZE;
+}
+
+
+bool	push_message(write_func w, int type, int flags, const void* payload, int size)
+// Copy a message into the calling thread's ring.  Returns false if
+// the message was dropped.
+{
+	thread_ring*	r = get_thread_ring();
+	int	capacity = r->m_mask + 1;
+
+	// Anything bigger than the whole ring gets cut short.
+	int	max_size = HEADER_PAYLOAD + (capacity - 1) * SLOT_SIZE;
+	if (size > max_size)
+	{
+		assert((flags & DEFERRED) == 0);
+		size = max_size;
+	}
+	int	slots = slots_needed(size);
+
+	int	head = r->m_head;
+	while (capacity - index_diff(head, tu_atomic_load(&r->m_tail)) < slots)
+	{
+		if (s_policy == tu_async_log::DROP || s_is_writer || s_running == false)
+		{
+			r->m_pending_drops++;
+			tu_atomic_increment(&s_dropped_count);
+			return false;
+		}
+		tu_timer::sleep(1);
+	}
+
+	slot*	first = &r->m_slots[head & r->m_mask];
+	first->m_header.m_write = w;
+	first->m_header.m_seq = tu_atomic_increment(&s_next_seq);
+	first->m_header.m_type = type;
+	first->m_header.m_size = size;
+	first->m_header.m_slots = (short) slots;
+	first->m_header.m_flags = (short) flags;
+	first->m_header.m_drops = r->m_pending_drops;
+	r->m_pending_drops = 0;
+
+	const char*	p = (const char*) payload;
+	int	n = imin(size, HEADER_PAYLOAD);
+	memcpy(first->m_bytes + sizeof(message_header), p, n);
+	p += n;
+	size -= n;
+	for (int i = 1; i < slots; i++)
+	{
+		n = imin(size, SLOT_SIZE);
+		memcpy(r->m_slots[index_add(head, i) & r->m_mask].m_bytes, p, n);
+		p += n;
+		size -= n;
+	}
+
+	tu_atomic_store(&r->m_head, index_add(head, slots));
+	return true;
+}
+
+
+//
+// Deferred formatting.
+//
+
+
+enum arg_class
+{
+	ARG_NONE,	// %%
+	ARG_INT,
+	ARG_LONG,
+	ARG_LLONG,
+	ARG_SIZE,
+	ARG_DOUBLE,
+	ARG_LDOUBLE,
+	ARG_STRING,
+	ARG_POINTER,
+};
+
+
+const int	MAX_SPEC_LENGTH = 32;
+
+
+struct conversion
+{
+	int	m_length;	// of the spec, starting at the '%'
+	int	m_stars;	// '*' width/precision arguments
+	arg_class	m_class;
+};
+
+
+bool	parse_conversion(const char* p, conversion* c)
+// p points at a '%'.  Returns false for conversions we don't know how
+// to defer.
+{
+	assert(*p == '%');
+	const char*	start = p;
+	p++;
+	c->m_stars = 0;
+
+	while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+	{
+		p++;
+	}
+	if (*p == '*')
+	{
+		c->m_stars++;
+		p++;
+	}
+	while (*p >= '0' && *p <= '9')
+	{
+		p++;
+	}
+	if (*p == '.')
+	{
+		p++;
+		if (*p == '*')
+		{
+			c->m_stars++;
+			p++;
+		}
+		while (*p >= '0' && *p <= '9')
+		{
+			p++;
+		}
+	}
+
+	arg_class	int_class = ARG_INT;
+	bool	long_double = false;
+	bool	sized = false;
+	if (*p == 'h')
+	{
+		p++;
+		sized = true;
+		if (*p == 'h')
+		{
+			p++;
+		}
+	}
+	else if (*p == 'l')
+	{
+		p++;
+		sized = true;
+		int_class = ARG_LONG;
+		if (*p == 'l')
+		{
+			p++;
+			int_class = ARG_LLONG;
+		}
+	}
+	else if (*p == 'q' || *p == 'j')
+	{
+		p++;
+		sized = true;
+		int_class = ARG_LLONG;
+	}
+	else if (*p == 'z' || *p == 't')
+	{
+		p++;
+		sized = true;
+		int_class = ARG_SIZE;
+	}
+	else if (*p == 'L')
+	{
+		p++;
+		long_double = true;
+	}
+
+	switch (*p)
+	{
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+		c->m_class = int_class;
+		break;
+	case 'c':
+		if (int_class != ARG_INT)
+		{
+			return false;	// wide char
+		}
+		c->m_class = ARG_INT;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		c->m_class = long_double ? ARG_LDOUBLE : ARG_DOUBLE;
+		break;
+	case 's':
+		if (sized)
+		{
+			return false;	// wide string
+		}
+		c->m_class = ARG_STRING;
+		break;
+	case 'p':
+		c->m_class = ARG_POINTER;
+		break;
+	case '%':
+		if (p != start + 1)
+		{
+			return false;
+		}
+		c->m_class = ARG_NONE;
+		break;
+	default:
+		// %n, or something nonstandard.
+		return false;
+	}
+
+	c->m_length = int(p + 1 - start);
+	return c->m_length < MAX_SPEC_LENGTH;
+}
+
+
+const int	MAX_CONVERSIONS = 32;
+
+
+int	parse_format(const char* fmt, conversion* conversions)
+// Fill conversions[] with fmt's conversions.  Returns how many there
+// are, or -1 if fmt can't be deferred.
+{
+	int	count = 0;
+	for (const char* p = fmt; *p; p++)
+	{
+		if (*p == '%')
+		{
+			if (count == MAX_CONVERSIONS
+			    || parse_conversion(p, &conversions[count]) == false)
+			{
+				return -1;
+			}
+			p += conversions[count].m_length - 1;
+			count++;
+		}
+	}
+	return count;
+}
+
+
+struct arg_writer
+{
+	char*	m_p;
+	char*	m_end;
+
+	template<class T>
+	bool	write(T value)
+	{
+		if (m_end - m_p < (int) sizeof(T))
+		{
+			return false;
+		}
+		memcpy(m_p, &value, sizeof(T));
+		m_p += sizeof(T);
+		return true;
+	}
+
+	bool	write_string(const char* s)
+	{
+		if (s == NULL)
+		{
+			s = "(null)";
+		}
+		int	len = (int) strlen(s) + 1;
+		if (m_end - m_p < len)
+		{
+			return false;
+		}
+		memcpy(m_p, s, len);
+		m_p += len;
+		return true;
+	}
+};
+
+
+int	capture_args(char* buffer, int buffer_size, const char* fmt,
+		     const conversion* conversions, int count, va_list ap)
+// Store fmt and the arguments its conversions call for in buffer.
+// Returns the number of bytes used, or -1 if they don't fit.
+{
+	arg_writer	w = { buffer, buffer + buffer_size };
+	bool	ok = w.write(fmt);
+	for (int ci = 0; ok && ci < count; ci++)
+	{
+		const conversion&	c = conversions[ci];
+		for (int i = 0; i < c.m_stars; i++)
+		{
+			ok = ok && w.write(va_arg(ap, int));
+		}
+		switch (c.m_class)
+		{
+		case ARG_NONE:
+			break;
+		case ARG_INT:
+			ok = ok && w.write(va_arg(ap, int));
+			break;
+		case ARG_LONG:
+			ok = ok && w.write(va_arg(ap, long));
+			break;
+		case ARG_LLONG:
+			ok = ok && w.write(va_arg(ap, long long));
+			break;
+		case ARG_SIZE:
+			ok = ok && w.write(va_arg(ap, size_t));
+			break;
+		case ARG_DOUBLE:
+			ok = ok && w.write(va_arg(ap, double));
+			break;
+		case ARG_LDOUBLE:
+			ok = ok && w.write(va_arg(ap, long double));
+			break;
+		case ARG_STRING:
+			ok = ok && w.write_string(va_arg(ap, const char*));
+			break;
+		case ARG_POINTER:
+			ok = ok && w.write(va_arg(ap, void*));
+			break;
+		}
+	}
+	return ok ? int(w.m_p - buffer) : -1;
+}
+
+
+struct text_writer
+// Appends to a fixed buffer, truncating.
+{
+	char*	m_p;
+	char*	m_end;	// leaves room for the terminator
+
+	void	advance(int n)
+	{
+		if (n < 0 || n > m_end - m_p)
+		{
+			// _snprintf returns -1 on overflow.
+			n = int(m_end - m_p);
+		}
+		m_p += n;
+		*m_p = 0;
+	}
+
+	template<class T>
+	void	format(const char* spec, int stars, const int* star_values, T value)
+	{
+		int	room = int(m_end - m_p) + 1;
+		int	n;
+		if (stars == 0)
+		{
+			n = snprintf(m_p, room, spec, value);
+		}
+		else if (stars == 1)
+		{
+			n = snprintf(m_p, room, spec, star_values[0], value);
+		}
+		else
+		{
+			n = snprintf(m_p, room, spec, star_values[0], star_values[1], value);
+		}
+		advance(n);
+	}
+};
+
+
+struct arg_reader
+{
+	const char*	m_p;
+
+	template<class T>
+	T	read()
+	{
+		T	value;
+		memcpy(&value, m_p, sizeof(T));
+		m_p += sizeof(T);
+		return value;
+	}
+
+	const char*	read_string()
+	{
+		const char*	s = m_p;
+		m_p += strlen(s) + 1;
+		return s;
+	}
+};
+
+
+void	format_deferred(char* out, int out_size, const char* payload)
+// Turn a payload made by capture_args() into text.
+{
+	arg_reader	r = { payload };
+	const char*	fmt = r.read<const char*>();
+	text_writer	w = { out, out + out_size - 1 };
+	*out = 0;
+
+	for (const char* p = fmt; *p && w.m_p < w.m_end; )
+	{
+		if (*p != '%')
+		{
+			const char*	run = p;
+			while (*p && *p != '%')
+			{
+				p++;
+			}
+			int	n = imin(int(p - run), int(w.m_end - w.m_p));
+			memcpy(w.m_p, run, n);
+			w.advance(n);
+			continue;
+		}
+
+		conversion	c;
+		parse_conversion(p, &c);
+		char	spec[MAX_SPEC_LENGTH];
+		memcpy(spec, p, c.m_length);
+		spec[c.m_length] = 0;
+		p += c.m_length;
+
+		int	stars[2] = { 0, 0 };
+		for (int i = 0; i < c.m_stars; i++)
+		{
+			stars[i] = r.read<int>();
+		}
+		switch (c.m_class)
+		{
+		case ARG_NONE:
+			w.m_p[0] = '%';
+			w.advance(1);
+			break;
+		case ARG_INT:
+			w.format(spec, c.m_stars, stars, r.read<int>());
+			break;
+		case ARG_LONG:
+			w.format(spec, c.m_stars, stars, r.read<long>());
+			break;
+		case ARG_LLONG:
+			w.format(spec, c.m_stars, stars, r.read<long long>());
+			break;
+		case ARG_SIZE:
+			w.format(spec, c.m_stars, stars, r.read<size_t>());
+			break;
+		case ARG_DOUBLE:
+			w.format(spec, c.m_stars, stars, r.read<double>());
+			break;
+		case ARG_LDOUBLE:
+			w.format(spec, c.m_stars, stars, r.read<long double>());
+			break;
+		case ARG_STRING:
+			w.format(spec, c.m_stars, stars, r.read_string());
+			break;
+		case ARG_POINTER:
+			w.format(spec, c.m_stars, stars, r.read<void*>());
+			break;
+		}
+	}
+}
+
+
+//
+// Writing.
+//
+
+
+// The write lock's holder's buffers.
+char	s_payload_buffer[FORMAT_BUFFER_SIZE];
+char	s_text_buffer[FORMAT_BUFFER_SIZE];
+
+
+void	write_message(thread_ring* r)
+// Write out the message at the front of r, and remove it.
+{
+	int	tail = r->m_tail;
+	const slot*	first = &r->m_slots[tail & r->m_mask];
+	message_header	h = first->m_header;
+
+	// Gather the payload.
+	int	size = imin(h.m_size, FORMAT_BUFFER_SIZE - 1);
+	char*	p = s_payload_buffer;
+	int	n = imin(size, HEADER_PAYLOAD);
+	memcpy(p, first->m_bytes + sizeof(message_header), n);
+	p += n;
+	size -= n;
+	for (int i = 1; size > 0; i++)
+	{
+		n = imin(size, SLOT_SIZE);
+		memcpy(p, r->m_slots[index_add(tail, i) & r->m_mask].m_bytes, n);
+		p += n;
+		size -= n;
+	}
+	*p = 0;
+
+	if (h.m_drops)
+	{
+		char	note[80];
+		snprintf(note, sizeof(note), "[log: %d messages dropped]\n", h.m_drops);
+		note[sizeof(note) - 1] = 0;
+		h.m_write(h.m_type, note);
+	}
+
+	if (h.m_flags & DEFERRED)
+	{
+		format_deferred(s_text_buffer, FORMAT_BUFFER_SIZE, s_payload_buffer);
+		h.m_write(h.m_type, s_text_buffer);
+	}
+	else
+	{
+		h.m_write(h.m_type, s_payload_buffer);
+	}
+
+	// Done; flush() waits for this.
+	tu_atomic_store(&r->m_tail, index_add(tail, h.m_slots));
+}
+
+
+bool	write_pending()
+// Write out everything that's been posted, oldest first.  Caller
+// must hold s_write_lock.  Returns true if there was anything.
+{
+	bool	wrote = false;
+	for (;;)
+	{
+		// Find the oldest message.
+		thread_ring*	oldest = NULL;
+		int	oldest_seq = 0;
+		for (thread_ring* r = tu_atomic_load_ptr(&s_rings); r; r = r->m_next)
+		{
+			if (r->m_tail == tu_atomic_load(&r->m_head))
+			{
+				continue;
+			}
+			int	seq = r->m_slots[r->m_tail & r->m_mask].m_header.m_seq;
+			if (oldest == NULL || index_diff(seq, oldest_seq) < 0)
+			{
+				oldest = r;
+				oldest_seq = seq;
+			}
+		}
+		if (oldest == NULL)
+		{
+			return wrote;
+		}
+
+		write_message(oldest);
+		wrote = true;
+	}
+}
+
+
+void	writer_main(void* arg)
+{
+	s_is_writer = true;
+	while (tu_atomic_load(&s_quit) == 0)
+	{
+		bool	wrote = false;
+		if (tu_atomic_compare_and_swap(&s_write_lock, 0, 1))
+		{
+			wrote = write_pending();
+			tu_atomic_store(&s_write_lock, 0);
+		}
+		if (wrote == false)
+		{
+			tu_timer::sleep(1);
+		}
+	}
+	s_is_writer = false;
+}
+
+
+void	write_pending_locked()
+// Take the write lock (waiting for the writer if necessary) and write
+// everything out on this thread.
+{
+	while (tu_atomic_compare_and_swap(&s_write_lock, 0, 1) == false)
+	{
+		tu_timer::sleep(1);
+	}
+	bool	was_writer = s_is_writer;
+	s_is_writer = true;
+	write_pending();
+	s_is_writer = was_writer;
+	tu_atomic_store(&s_write_lock, 0);
+}
+
+
+#ifdef _WIN32
+
+LPTOP_LEVEL_EXCEPTION_FILTER	s_previous_filter = NULL;
+
+LONG WINAPI	crash_filter(EXCEPTION_POINTERS* info)
+{
+	tu_async_log::flush_on_crash();
+	if (s_previous_filter)
+	{
+		return s_previous_filter(info);
+	}
+	return EXCEPTION_CONTINUE_SEARCH;
+}
+
+#else // not _WIN32
+
+void	crash_signal_handler(int sig)
+{
+	tu_async_log::flush_on_crash();
+
+	// SA_RESETHAND put the default handler back; let it crash.
+	raise(sig);
+}
+
+#endif // not _WIN32
+
+
+void	stop_at_exit()
+{
+	tu_async_log::stop();
+}
+
+
+}	// end anonymous namespace
+
+
+namespace tu_async_log
+{
+	void	start(int records_per_thread, full_policy policy)
+	{
+#if TU_CONFIG_LINK_TO_THREAD != 0
+		if (s_running)
+		{
+			return;
+		}
+
+		assert(records_per_thread > 1);
+		s_ring_size = records_per_thread;
+		s_policy = policy;
+		s_quit = 0;
+		s_writer_thread = new tu_thread::thread(writer_main, NULL);
+		s_running = true;
+
+		if (s_registered_atexit == false)
+		{
+			s_registered_atexit = true;
+			atexit(stop_at_exit);
+		}
+#endif // TU_CONFIG_LINK_TO_THREAD != 0
+	}
+
+
+	void	stop()
+	{
+		if (s_running == false)
+		{
+			return;
+		}
+
+		s_running = false;
+		tu_atomic_store(&s_quit, 1);
+		delete s_writer_thread;	// waits
+		s_writer_thread = NULL;
+
+		write_pending_locked();
+	}
+
+
+	bool	is_running()
+	{
+		return s_running;
+	}
+
+
+	void	post(write_func w, int type, const char* message)
+	{
+		assert(w);
+		if (s_running == false)
+		{
+			w(type, message);
+			return;
+		}
+		push_message(w, type, 0, message, (int) strlen(message) + 1);
+	}
+
+
+	void	vpost(write_func w, int type, const char* fmt, va_list ap)
+	{
+		assert(w);
+		char*	buffer = s_format_buffer;
+		vsnprintf(buffer, FORMAT_BUFFER_SIZE, fmt, ap);
+		buffer[FORMAT_BUFFER_SIZE - 1] = 0;
+
+		if (s_running == false)
+		{
+			w(type, buffer);
+			return;
+		}
+		push_message(w, type, 0, buffer, (int) strlen(buffer) + 1);
+	}
+
+
+	void	vpost_deferred(write_func w, int type, const char* fmt, va_list ap)
+	{
+		conversion	conversions[MAX_CONVERSIONS];
+		int	count = s_running ? parse_format(fmt, conversions) : -1;
+		if (count < 0)
+		{
+			vpost(w, type, fmt, ap);
+			return;
+		}
+
+		// Deferred formatting would come out truncated, if
+		// the arguments don't all fit; format it now.
+		char*	buffer = s_format_buffer;
+		int	size = capture_args(buffer, FORMAT_BUFFER_SIZE, fmt, conversions, count, ap);
+		if (size < 0
+		    || size > HEADER_PAYLOAD + (get_thread_ring()->m_mask) * SLOT_SIZE)
+		{
+			// ap has been used up; the best we can do is
+			// the bare format string.
+			post(w, type, fmt);
+			return;
+		}
+		push_message(w, type, DEFERRED, buffer, size);
+	}
+
+
+	void	flush()
+	{
+		if (s_is_writer)
+		{
+			// We'd be waiting on ourself.
+			return;
+		}
+		if (s_running == false)
+		{
+			// Anything left over from before stop().
+			write_pending_locked();
+			return;
+		}
+
+		for (thread_ring* r = tu_atomic_load_ptr(&s_rings); r; r = r->m_next)
+		{
+			int	target = tu_atomic_load(&r->m_head);
+			while (s_running && index_diff(tu_atomic_load(&r->m_tail), target) < 0)
+			{
+				tu_timer::sleep(1);
+			}
+		}
+	}
+
+
+	void	flush_on_crash()
+	{
+		// Give the writer a moment to finish what it's doing,
+		// unless the writer is the one that crashed.
+		if (s_is_writer == false)
+		{
+			for (int i = 0; i < 100; i++)
+			{
+				if (tu_atomic_compare_and_swap(&s_write_lock, 0, 1))
+				{
+					break;
+				}
+				tu_timer::sleep(1);
+			}
+		}
+		tu_atomic_store(&s_write_lock, 1);
+
+		s_is_writer = true;
+		write_pending();
+		fflush(stdout);
+		fflush(stderr);
+
+		// Leave the lock held, so nobody else writes
+		// anything twice.
+	}
+
+
+	void	install_crash_handler()
+	{
+#ifdef _WIN32
+		s_previous_filter = SetUnhandledExceptionFilter(crash_filter);
+#else // not _WIN32
+		static const int	signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+		for (int i = 0; i < int(sizeof(signals) / sizeof(signals[0])); i++)
+		{
+			struct sigaction	sa;
+			memset(&sa, 0, sizeof(sa));
+			sa.sa_handler = crash_signal_handler;
+			sa.sa_flags = SA_RESETHAND;
+			sigemptyset(&sa.sa_mask);
+			sigaction(signals[i], &sa, NULL);
+		}
+#endif // not _WIN32
+	}
+
+
+	int	get_dropped_count()
+	{
+		return tu_atomic_load(&s_dropped_count);
+	}
+}
+
+
+#ifdef TU_ASYNC_LOG_TEST
+
+// g++ tu_async_log.cpp tu_thread.cpp tu_timer.cpp container.cpp utf8.cpp -O2 -I.. -DTU_ASYNC_LOG_TEST -DTU_CONFIG_LINK_TO_THREAD=2 -lpthread -o tu_async_log_test
+
+
+#include "base/container.h"
+
+
+static array<tu_string>	s_lines;
+
+static void	collect(int type, const char* message)
+{
+	s_lines.push_back(message);
+}
+
+
+static void	post_deferred(const char* fmt, ...)
+{
+	va_list	ap;
+	va_start(ap, fmt);
+	tu_async_log::vpost_deferred(collect, 0, fmt, ap);
+	va_end(ap);
+}
+
+
+static void	post_formatted(const char* fmt, ...)
+{
+	va_list	ap;
+	va_start(ap, fmt);
+	tu_async_log::vpost(collect, 0, fmt, ap);
+	va_end(ap);
+}
+
+
+static void	null_write(int type, const char* message)
+{
+}
+
+
+static void	post_null_deferred(const char* fmt, ...)
+{
+	va_list	ap;
+	va_start(ap, fmt);
+	tu_async_log::vpost_deferred(null_write, 0, fmt, ap);
+	va_end(ap);
+}
+
+
+static const int	THREAD_COUNT = 4;
+static const int	MESSAGES_PER_THREAD = 5000;
+
+
+static void	poster(void* arg)
+{
+	int	id = int((size_t) arg);
+	for (int i = 0; i < MESSAGES_PER_THREAD; i++)
+	{
+		post_deferred("thread %d message %d\n", id, i);
+	}
+}
+
+
+static const int	COST_COUNT = 100000;
+
+
+static void	measure_cost(void* arg)
+{
+	uint64	start = tu_timer::get_profile_ticks();
+	for (int i = 0; i < COST_COUNT; i++)
+	{
+		post_null_deferred("%4d\t%-15s 0x%02X\n", i, "ActionPush", i & 255);
+	}
+	uint64	end = tu_timer::get_profile_ticks();
+	tu_async_log::flush();
+	printf("deferred post: %.1f ns per message\n",
+	       tu_timer::profile_ticks_to_seconds(end - start) * 1e9 / COST_COUNT);
+
+	// Compare: formatting in place.
+	start = tu_timer::get_profile_ticks();
+	for (int i = 0; i < COST_COUNT; i++)
+	{
+		char	buffer[200];
+		snprintf(buffer, sizeof(buffer), "%4d\t%-15s 0x%02X\n", i, "ActionPush", i & 255);
+		null_write(0, buffer);
+	}
+	end = tu_timer::get_profile_ticks();
+	printf("snprintf: %.1f ns per message\n",
+	       tu_timer::profile_ticks_to_seconds(end - start) * 1e9 / COST_COUNT);
+}
+
+
+static int	s_failures = 0;
+
+static void	check(bool ok, const char* what)
+{
+	if (!ok)
+	{
+		printf("FAILED: %s\n", what);
+		s_failures++;
+	}
+}
+
+
+int	main()
+{
+	// Synchronous until started.
+	post_formatted("sync %d\n", 1);
+	check(s_lines.size() == 1 && s_lines[0] == "sync 1\n", "synchronous");
+	s_lines.resize(0);
+
+	tu_async_log::start(64, tu_async_log::WAIT);
+
+	// Deferred formatting matches printf.
+	const char*	s = "temporary";
+	char	expected[200];
+	snprintf(expected, sizeof(expected), "%d %5.2f %s %-4s| %x %lld %c %% %*d %.*s %zu\n",
+		 -7, 3.14159, s, "ab", 255, 1234567890123LL, 'q', 6, 42, 3, "abcdef", (size_t) 99);
+	post_deferred("%d %5.2f %s %-4s| %x %lld %c %% %*d %.*s %zu\n",
+		      -7, 3.14159, s, "ab", 255, 1234567890123LL, 'q', 6, 42, 3, "abcdef", (size_t) 99);
+
+	// Long messages span several records.
+	tu_string	long_message;
+	for (int i = 0; i < 100; i++)
+	{
+		long_message += "0123456789";
+	}
+	tu_async_log::post(collect, 0, long_message.c_str());
+	tu_async_log::flush();
+	check(s_lines.size() == 2, "message count");
+	check(s_lines.size() >= 1 && s_lines[0] == expected, "deferred formatting");
+	check(s_lines.size() >= 2 && s_lines[1] == long_message, "long message");
+	if (s_lines.size() >= 1)
+	{
+		printf("deferred: %s", s_lines[0].c_str());
+	}
+	s_lines.resize(0);
+
+	// Several threads, small rings; each thread's messages come
+	// out in order, and none are lost.
+	{
+		tu_thread::thread*	threads[THREAD_COUNT];
+		for (int i = 0; i < THREAD_COUNT; i++)
+		{
+			threads[i] = new tu_thread::thread(poster, (void*) (size_t) i);
+		}
+		for (int i = 0; i < THREAD_COUNT; i++)
+		{
+			delete threads[i];
+		}
+		tu_async_log::flush();
+
+		int	next[THREAD_COUNT] = { 0 };
+		bool	in_order = true;
+		for (int i = 0; i < s_lines.size(); i++)
+		{
+			int	id, n;
+			if (sscanf(s_lines[i].c_str(), "thread %d message %d", &id, &n) != 2
+			    || id < 0 || id >= THREAD_COUNT || n != next[id])
+			{
+				in_order = false;
+				break;
+			}
+			next[id]++;
+		}
+		check(s_lines.size() == THREAD_COUNT * MESSAGES_PER_THREAD, "threaded message count");
+		check(in_order, "threaded message order");
+		printf("threads: %d messages\n", s_lines.size());
+	}
+	s_lines.resize(0);
+	tu_async_log::stop();
+
+	// With the DROP policy, a burst bigger than the ring loses
+	// messages, and says so.
+	tu_async_log::start(16, tu_async_log::DROP);
+	int	dropped_before = tu_async_log::get_dropped_count();
+	for (int i = 0; i < 1000; i++)
+	{
+		post_deferred("burst %d\n", i);
+	}
+	tu_async_log::flush();
+	post_deferred("after\n");
+	tu_async_log::stop();
+	int	dropped = tu_async_log::get_dropped_count() - dropped_before;
+	int	notes = 0;
+	for (int i = 0; i < s_lines.size(); i++)
+	{
+		int	n;
+		if (sscanf(s_lines[i].c_str(), "[log: %d messages dropped]", &n) == 1)
+		{
+			notes += n;
+		}
+	}
+	check(dropped == 0 || notes == dropped, "drop notes");
+	check(s_lines.size() > 0 && s_lines.back() == "after\n", "after burst");
+	printf("drop: %d of 1000 dropped\n", dropped);
+	s_lines.resize(0);
+
+	// Cost of posting, on a new thread so it gets a ring with
+	// room for everything.
+	tu_async_log::start(COST_COUNT, tu_async_log::WAIT);
+	{
+		tu_thread::thread	t(measure_cost, NULL);
+	}
+	tu_async_log::stop();
+
+	printf(s_failures ? "FAILED\n" : "OK\n");
+	return s_failures ? 1 : 0;
+}
+
+
+#endif // TU_ASYNC_LOG_TEST
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
@@ -0,0 +1,97 @@
+// tu_async_log.h	-- asynchronous log back end
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Asynchronous back end for logger:: and gameswf::log_msg().
+//
+// Until start() is called, posting a message formats it and hands it
+// to the write function right away, on the calling thread, like the
+// loggers always did.  After start(), a message is formatted into a
+// ring buffer owned by the posting thread, and a background thread
+// merges the rings (in posting order) and calls the write functions,
+// so the poster never waits on stdio.  Nothing on the posting side
+// takes a lock.
+//
+// vpost_deferred() goes further for hot call sites: it only copies
+// the arguments, and the background thread does the printf work.
+// The format string must be a string literal (only the pointer is
+// kept); %s arguments are copied.
+//
+// When a thread's ring is full, the message is dropped (and the
+// next message that gets through says how many were lost), or with
+// the WAIT policy, the poster waits for room.
+//
+// After start(), write functions are called on the background
+// thread, or on whichever thread calls flush_on_crash() / stop().
+
+
+#ifndef TU_ASYNC_LOG_H
+#define TU_ASYNC_LOG_H
+
+
+#include "base/tu_config.h"
+#include <stdarg.h>
+
+
+namespace tu_async_log
+{
+	// Receives finished messages.  type is whatever the poster
+	// passed in.
+	typedef void	(*write_func)(int type, const char* message);
+
+	enum full_policy
+	{
+		DROP,	// drop messages that don't fit
+		WAIT,	// wait for the writer to make room
+	};
+
+	// Start the background writer.  Each posting thread gets a
+	// ring of records_per_thread records (rounded up to a power of
+	// two) of about 100 characters each; longer messages take
+	// several records.  A thread's ring is made the first time it
+	// posts, and keeps its size.  Does nothing if already running,
+	// or if there are no threads (TU_CONFIG_LINK_TO_THREAD == 0).
+	exported_module void	start(int records_per_thread = 4096, full_policy policy = DROP);
+
+	// Write everything that's pending, and go back to writing
+	// synchronously.  Called automatically at exit.
+	exported_module void	stop();
+
+	exported_module bool	is_running();
+
+	// Post a message.
+	exported_module void	post(write_func w, int type, const char* message);
+	exported_module void	vpost(write_func w, int type, const char* fmt, va_list ap);
+	exported_module void	vpost_deferred(write_func w, int type, const char* fmt, va_list ap);
+
+	// Wait until everything posted so far has been written.
+	// Does nothing when called from a write function.
+	exported_module void	flush();
+
+	// Write out whatever is pending from all threads, on the
+	// calling thread, without waiting on the writer for long.
+	// For crash handlers, so the last messages before a crash
+	// aren't lost.
+	exported_module void	flush_on_crash();
+
+	// Install handlers that call flush_on_crash() when the
+	// process crashes (fatal signals on POSIX, unhandled
+	// exceptions on Win32) before letting the crash proceed.
+	exported_module void	install_crash_handler();
+
+	// Number of messages dropped because a ring was full, since
+	// the process started.
+	exported_module int	get_dropped_count();
+}
+
+
+#endif // TU_ASYNC_LOG_H
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
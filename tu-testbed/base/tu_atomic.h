@@ -0,0 +1,205 @@
+// tu_atomic.h	-- atomic integer & pointer operations
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Minimal atomic operations for sharing data between threads without
+// a mutex.  GCC uses the __sync builtins, MSVC the Interlocked
+// intrinsics.
+//
+// The load/store functions have acquire/release semantics: writes
+// made before a tu_atomic_store() are visible to a thread that sees
+// the stored value via tu_atomic_load().
+
+
+#ifndef TU_ATOMIC_H
+#define TU_ATOMIC_H
+
+
+#include "base/tu_config.h"
+
+
+#if defined(_MSC_VER)
+
+extern "C" long __cdecl _InterlockedExchangeAdd(long volatile* p, long value);
+extern "C" long __cdecl _InterlockedCompareExchange(long volatile* p, long exchange, long comparand);
+extern "C" void _ReadWriteBarrier();
+#pragma intrinsic(_InterlockedExchangeAdd)
+#pragma intrinsic(_InterlockedCompareExchange)
+#pragma intrinsic(_ReadWriteBarrier)
+#ifdef _WIN64
+extern "C" void* __cdecl _InterlockedCompareExchangePointer(void* volatile* p, void* exchange, void* comparand);
+#pragma intrinsic(_InterlockedCompareExchangePointer)
+#endif
+
+// MSVC treats volatile accesses as acquire/release on x86, so a
+// compiler barrier is all we need around plain loads & stores.
+#define TU_ATOMIC_COMPILER_BARRIER() _ReadWriteBarrier()
+#define TU_ATOMIC_ACQUIRE_BARRIER() _ReadWriteBarrier()
+#define TU_ATOMIC_RELEASE_BARRIER() _ReadWriteBarrier()
+
+inline int	tu_atomic_add(volatile int* p, int delta)
+// Returns the new value.
+{
+	return (int) _InterlockedExchangeAdd((long volatile*) p, (long) delta) + delta;
+}
+
+inline bool	tu_atomic_compare_and_swap(volatile int* p, int old_value, int new_value)
+// Sets *p to new_value iff it equals old_value.  Returns true if it
+// did.
+{
+	return _InterlockedCompareExchange((long volatile*) p, (long) new_value, (long) old_value) == (long) old_value;
+}
+
+template<class T>
+inline bool	tu_atomic_compare_and_swap_ptr(T* volatile* p, T* old_value, T* new_value)
+// Sets *p to new_value iff it equals old_value.  Returns true if it
+// did.
+{
+#ifdef _WIN64
+	return _InterlockedCompareExchangePointer((void* volatile*) p, new_value, old_value) == old_value;
+#else
+	return _InterlockedCompareExchange((long volatile*) p, (long) new_value, (long) old_value) == (long) old_value;
+#endif
+}
+
+#elif defined(__GNUC__)
+
+#define TU_ATOMIC_COMPILER_BARRIER() __asm__ __volatile__("" : : : "memory")
+#if defined(__i386__) || defined(__x86_64__)
+	// x86 doesn't reorder loads with loads or stores with stores.
+#	define TU_ATOMIC_ACQUIRE_BARRIER() TU_ATOMIC_COMPILER_BARRIER()
+#	define TU_ATOMIC_RELEASE_BARRIER() TU_ATOMIC_COMPILER_BARRIER()
+#else
+#	define TU_ATOMIC_ACQUIRE_BARRIER() __sync_synchronize()
+#	define TU_ATOMIC_RELEASE_BARRIER() __sync_synchronize()
+#endif
+
+inline int	tu_atomic_add(volatile int* p, int delta)
+// Returns the new value.
+{
+	return __sync_add_and_fetch(p, delta);
+}
+
+inline bool	tu_atomic_compare_and_swap(volatile int* p, int old_value, int new_value)
+// Sets *p to new_value iff it equals old_value.  Returns true if it
+// did.
+{
+	return __sync_bool_compare_and_swap(p, old_value, new_value);
+}
+
+template<class T>
+inline bool	tu_atomic_compare_and_swap_ptr(T* volatile* p, T* old_value, T* new_value)
+{
+	return __sync_bool_compare_and_swap(p, old_value, new_value);
+}
+
+#else
+
+// Unknown compiler: no atomicity.  Fine for single-threaded builds
+// (TU_CONFIG_LINK_TO_THREAD == 0), wrong otherwise.
+#if TU_CONFIG_LINK_TO_THREAD != 0
+#error tu_atomic.h needs porting to this compiler
+#endif
+
+#define TU_ATOMIC_COMPILER_BARRIER()
+#define TU_ATOMIC_ACQUIRE_BARRIER()
+#define TU_ATOMIC_RELEASE_BARRIER()
+
+inline int	tu_atomic_add(volatile int* p, int delta)
+{
+	*p += delta;
+	return *p;
+}
+
+inline bool	tu_atomic_compare_and_swap(volatile int* p, int old_value, int new_value)
+{
+	if (*p == old_value)
+	{
+		*p = new_value;
+		return true;
+	}
+	return false;
+}
+
+template<class T>
+inline bool	tu_atomic_compare_and_swap_ptr(T* volatile* p, T* old_value, T* new_value)
+{
+	if (*p == old_value)
+	{
+		*p = new_value;
+		return true;
+	}
+	return false;
+}
+
+#endif
+
+
+inline int	tu_atomic_increment(volatile int* p) { return tu_atomic_add(p, 1); }
+inline int	tu_atomic_decrement(volatile int* p) { return tu_atomic_add(p, -1); }
+
+
+#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE)
+
+// GCC 4.7+ and clang have explicit acquire/release builtins, which
+// also keep ThreadSanitizer informed.
+
+inline int	tu_atomic_load(const volatile int* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+inline void	tu_atomic_store(volatile int* p, int value) { __atomic_store_n(p, value, __ATOMIC_RELEASE); }
+
+template<class T>
+inline T*	tu_atomic_load_ptr(T* const volatile* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+
+template<class T>
+inline void	tu_atomic_store_ptr(T* volatile* p, T* value) { __atomic_store_n(p, value, __ATOMIC_RELEASE); }
+
+#else
+
+inline int	tu_atomic_load(const volatile int* p)
+// Load with acquire semantics.
+{
+	int	value = *p;
+	TU_ATOMIC_ACQUIRE_BARRIER();
+	return value;
+}
+
+
+inline void	tu_atomic_store(volatile int* p, int value)
+// Store with release semantics.
+{
+	TU_ATOMIC_RELEASE_BARRIER();
+	*p = value;
+}
+
+
+template<class T>
+inline T*	tu_atomic_load_ptr(T* const volatile* p)
+// Load a pointer with acquire semantics.
+{
+	T*	value = *p;
+	TU_ATOMIC_ACQUIRE_BARRIER();
+	return value;
+}
+
+
+template<class T>
+inline void	tu_atomic_store_ptr(T* volatile* p, T* value)
+// Store a pointer with release semantics.
+{
+	TU_ATOMIC_RELEASE_BARRIER();
+	*p = value;
+}
+
+#endif
+
+
+#endif // TU_ATOMIC_H
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
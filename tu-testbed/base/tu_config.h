@@ -77,7 +77,7 @@
 
 // define TU_CONFIG_LINK_TO_THREAD to 0 to switch in gameswf to single thread mode
 // define TU_CONFIG_LINK_TO_THREAD to 1 to include SDL thread & mutex support in gameswf
-// define TU_CONFIG_LINK_TO_THREAD to 2 to include ... (TODO: pthread support)
+// define TU_CONFIG_LINK_TO_THREAD to 2 to use pthreads (base/tu_thread only so far; TODO: gameswf)
 #ifndef TU_CONFIG_LINK_TO_THREAD
 #	define TU_CONFIG_LINK_TO_THREAD 1
 #endif
@@ -135,4 +135,36 @@
 #	define TU_USE_OGLES 0
 #endif
 
+// TU_CONFIG_USE_SSE2 is 1 when the compiler is targeting SSE2.  Code
+// with SSE2 inner loops falls back to plain C when it's 0.
+#ifndef TU_CONFIG_USE_SSE2
+#	if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#		define TU_CONFIG_USE_SSE2 1
+#	else
+#		define TU_CONFIG_USE_SSE2 0
+#	endif
+#endif
+
+// define TU_CONFIG_PROFILE to 0 to compile out the TU_PROFILE_ZONE()
+// instrumentation (see base/tu_profile.h).  When it's compiled in,
+// it's still off until tu_profile::set_enabled(true).
+#ifndef TU_CONFIG_PROFILE
+#	define TU_CONFIG_PROFILE 1
+#endif
+
+// TU_THREAD_LOCAL declares a static variable with one instance per
+// thread.  Only for plain old data.
+#ifndef TU_THREAD_LOCAL
+#	if defined(_MSC_VER)
+#		define TU_THREAD_LOCAL __declspec(thread)
+#	elif defined(__GNUC__)
+#		define TU_THREAD_LOCAL __thread
+#	else
+#		if TU_CONFIG_LINK_TO_THREAD != 0
+#			error TU_THREAD_LOCAL needs porting to this compiler
+#		endif
+#		define TU_THREAD_LOCAL
+#	endif
+#endif
+
 #endif // TU_CONFIG_H
@@ -11,6 +11,10 @@
 #include "base/container.h"
 #include "base/membuf.h"
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif // not _WIN32
+
 //
 // tu_file functions using FILE
 //
@@ -80,6 +84,30 @@ static bool std_get_eof_func(void *appdata)
 	}
 }
 
+#ifndef _WIN32
+static int std_read_at_func(void* dst, int bytes, int position, const void* appdata)
+// Read from the given position with pread(), which leaves the FILE*
+// (and its buffer) alone.  Only for files that nobody writes to.
+// Return the number of bytes actually read.
+{
+	assert(appdata);
+	assert(dst);
+	int	fd = fileno((FILE*) appdata);
+	int	total = 0;
+	while (total < bytes)
+	{
+		ssize_t	result = pread(fd, (char*) dst + total, bytes - total, position + total);
+		if (result <= 0)
+		{
+			// EOF or error.
+			break;
+		}
+		total += (int) result;
+	}
+	return total;
+}
+#endif // not _WIN32
+
 static int std_close_func(void *appdata)
 // Return 0 on success, or TU_FILE_CLOSE_ERROR on failure.
 {
@@ -149,6 +177,7 @@ struct filebuf
 	}
 
 	unsigned char*	get_cursor() { return ((unsigned char*) m_.data()) + m_position; }
+	const unsigned char*	get_read_cursor() const { return ((const unsigned char*) m_.data()) + m_position; }
 };
 
 
@@ -165,7 +194,7 @@ static int mem_read_func(void* dst, int bytes, void* appdata)
 	int	bytes_to_read = imin(bytes, buf->m_.size() - buf->m_position);
 	if (bytes_to_read)
 	{
-		memcpy(dst, buf->get_cursor(), bytes_to_read);
+		memcpy(dst, buf->get_read_cursor(), bytes_to_read);
 	}
 	buf->m_position += bytes_to_read;
 
@@ -182,6 +211,11 @@ static int mem_write_func(const void* src, int bytes, void* appdata)
 	filebuf* buf = (filebuf*) appdata;
 	assert(buf->is_valid());
 
+	if (buf->m_read_only)
+	{
+		return 0;
+	}
+
 	// Expand buffer if necessary.
 	int	bytes_to_expand = imax(0, buf->m_position + bytes - buf->m_.size());
 	if (bytes_to_expand)
@@ -258,6 +292,23 @@ static bool	mem_get_eof_func(void* appdata)
 	return buf->m_position >= buf->m_.size();
 }
 
+static int mem_read_at_func(void* dst, int bytes, int position, const void* appdata)
+// Return the number of bytes actually read.
+{
+	assert(appdata);
+	assert(dst);
+
+	const filebuf* buf = (const filebuf*) appdata;
+	int	bytes_to_read = imin(bytes, buf->m_.size() - position);
+	if (position < 0 || bytes_to_read <= 0)
+	{
+		return 0;
+	}
+	memcpy(dst, ((const unsigned char*) buf->m_.data()) + position, bytes_to_read);
+
+	return bytes_to_read;
+}
+
 static int mem_close_func(void* appdata)
 // Return 0 on success, or TU_FILE_CLOSE_ERROR on failure.
 {
@@ -272,6 +323,140 @@ static int mem_close_func(void* appdata)
 }
 
 
+//
+// tu_file functions for a read-only view of another tu_file
+//
+
+
+struct viewbuf
+{
+	enum { BUFFER_SIZE = 16384 };
+
+	tu_file*	m_base;
+	int	m_start;	// view position 0 is here in m_base
+	int	m_position;
+	int	m_buffer_position;	// view position of m_buffer[0]
+	int	m_buffer_size;
+	bool	m_eof;
+	unsigned char	m_buffer[BUFFER_SIZE];
+
+	viewbuf(tu_file* base, int start)
+		:
+		m_base(base),
+		m_start(start),
+		m_position(0),
+		m_buffer_position(0),
+		m_buffer_size(0),
+		m_eof(false)
+	{
+	}
+};
+
+
+static int view_read_func(void* dst, int bytes, void* appdata)
+// Return the number of bytes actually read.  EOF or an error would
+// cause that to not be equal to "bytes".
+{
+	assert(appdata);
+	assert(dst);
+
+	viewbuf* buf = (viewbuf*) appdata;
+	unsigned char*	out = (unsigned char*) dst;
+	int	total = 0;
+	while (total < bytes)
+	{
+		int	offset = buf->m_position - buf->m_buffer_position;
+		if (offset >= 0 && offset < buf->m_buffer_size)
+		{
+			// Copy what we have buffered.
+			int	n = imin(bytes - total, buf->m_buffer_size - offset);
+			memcpy(out + total, buf->m_buffer + offset, n);
+			buf->m_position += n;
+			total += n;
+			continue;
+		}
+
+		int	n;
+		if (bytes - total >= viewbuf::BUFFER_SIZE)
+		{
+			// Big read; skip the buffer.
+			n = buf->m_base->read_at(out + total, bytes - total, buf->m_start + buf->m_position);
+			buf->m_position += n;
+			total += n;
+		}
+		else
+		{
+			n = buf->m_base->read_at(buf->m_buffer, viewbuf::BUFFER_SIZE, buf->m_start + buf->m_position);
+			buf->m_buffer_position = buf->m_position;
+			buf->m_buffer_size = n;
+		}
+		if (n <= 0)
+		{
+			buf->m_eof = true;
+			break;
+		}
+	}
+
+	return total;
+}
+
+
+static int view_write_func(const void* src, int bytes, void* appdata)
+// Views are read-only.
+{
+	return 0;
+}
+
+
+static int view_seek_func(int pos, void* appdata)
+// Return 0 on success, or TU_FILE_SEEK_ERROR on failure.
+{
+	assert(appdata);
+
+	viewbuf* buf = (viewbuf*) appdata;
+	if (pos < 0)
+	{
+		buf->m_position = 0;
+		return TU_FILE_SEEK_ERROR;
+	}
+	buf->m_position = pos;
+	buf->m_eof = false;
+	return 0;
+}
+
+
+static int view_seek_to_end_func(void* appdata)
+// We don't know where the end is.
+{
+	return TU_FILE_SEEK_ERROR;
+}
+
+
+static int view_tell_func(const void* appdata)
+// Return the file position.
+{
+	assert(appdata);
+	return ((const viewbuf*) appdata)->m_position;
+}
+
+
+static bool	view_get_eof_func(void* appdata)
+// Return true if a read has run into the end of the base file.
+{
+	assert(appdata);
+	return ((viewbuf*) appdata)->m_eof;
+}
+
+
+static int view_close_func(void* appdata)
+// Return 0 on success.
+{
+	assert(appdata);
+	delete (viewbuf*) appdata;
+	return 0;
+}
+
+
 tu_file::tu_file(
 	void * appdata,
 	read_func rf,
@@ -291,6 +476,7 @@ tu_file::tu_file(
 	m_tell = tf;
 	m_get_eof = gef;
 	m_close = cf;
+	m_read_at = NULL;
 	m_error = TU_FILE_NO_ERROR;
 }
 
@@ -306,6 +492,7 @@ tu_file::tu_file(FILE* fp, bool autoclose=false)
 	m_tell = std_tell_func;
 	m_get_eof = std_get_eof_func;
 	m_close = autoclose ? std_close_func : NULL;
+	m_read_at = NULL;
 	m_error = TU_FILE_NO_ERROR;
 }
 
@@ -319,6 +506,7 @@ tu_file::tu_file(const char * name, const char * mode) :
 	m_tell(NULL),
 	m_get_eof(NULL),
 	m_close(NULL),
+	m_read_at(NULL),
 	m_error(TU_FILE_OPEN_ERROR)
 {
 
@@ -335,6 +523,15 @@ tu_file::tu_file(const char * name, const char * mode) :
 		m_get_eof = std_get_eof_func;
 		m_close = std_close_func;
 		m_error = TU_FILE_NO_ERROR;
+
+#ifndef _WIN32
+		// We can only read the fd directly if nothing is going
+		// to be written through the FILE*'s buffer.
+		if (strchr(mode, 'w') == NULL && strchr(mode, 'a') == NULL && strchr(mode, '+') == NULL)
+		{
+			m_read_at = std_read_at_func;
+		}
+#endif // not _WIN32
 	}
 }
 
@@ -353,6 +550,7 @@ tu_file::tu_file(memory_buffer_enum m)
 	m_tell = mem_tell_func;
 	m_get_eof = mem_get_eof_func;
 	m_close = mem_close_func;
+	m_read_at = mem_read_at_func;
 	m_error = TU_FILE_NO_ERROR;
 }
 
@@ -371,6 +569,27 @@ tu_file::tu_file(memory_buffer_enum m, int size, void* data)
 	m_tell = mem_tell_func;
 	m_get_eof = mem_get_eof_func;
 	m_close = mem_close_func;
+	m_read_at = mem_read_at_func;
+	m_error = TU_FILE_NO_ERROR;
+}
+
+
+tu_file::tu_file(view_enum v, tu_file* base, int position)
+// Create a read-only view of *base, starting at the given position.
+{
+	assert(base);
+	assert(position >= 0);
+
+	m_data = new viewbuf(base, position);
+
+	m_read = view_read_func;
+	m_write = view_write_func;
+	m_seek = view_seek_func;
+	m_seek_to_end = view_seek_to_end_func;
+	m_tell = view_tell_func;
+	m_get_eof = view_get_eof_func;
+	m_close = view_close_func;
+	m_read_at = NULL;
 	m_error = TU_FILE_NO_ERROR;
 }
 
@@ -398,6 +617,23 @@ void tu_file::close()
 }
 
 
+int	tu_file::read_at(void* dst, int bytes, int position)
+// Read from the given position, leaving the file position alone.
+// Return the number of bytes actually read.
+{
+	if (m_read_at)
+	{
+		return m_read_at(dst, bytes, position, m_data);
+	}
+
+	int	old_position = get_position();
+	set_position(position);
+	int	result = read_bytes(dst, bytes);
+	set_position(old_position);
+	return result;
+}
+
+
 void	tu_file::copy_from(tu_file* src)
 // Copy remaining contents of *src into *this.
 {
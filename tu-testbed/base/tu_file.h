@@ -49,6 +49,7 @@ public:
 	typedef int (* tell_func)(const void* appdata);
 	typedef bool (* get_eof_func)(void* appdata);
 	typedef int (* close_func)(void* appdata);
+	typedef int (* read_at_func)(void* dst, int bytes, int position, const void* appdata);
 
 	// The generic constructor; supply functions for the implementation.
 	exported_module tu_file(
@@ -81,6 +82,15 @@ public:
 	// A read-only memory-buffer with predefined data.
 	exported_module tu_file(memory_buffer_enum m, int size, void* data);
 
+	// A read-only file that reads *base, starting at the given
+	// position, through a buffer of its own.  The view has its
+	// own position and only reads *base with read_at(), so if
+	// base->has_read_at(), threads can each read their own view
+	// of one file at once.  go_to_end() isn't supported.  *base
+	// must outlive the view.
+	enum view_enum { view };
+	exported_module tu_file(view_enum v, tu_file* base, int position);
+
 	exported_module ~tu_file();
 
 	// Copy remaining contents of *in into *this.
@@ -139,6 +149,16 @@ public:
 	exported_module float	read_float32();
 	exported_module double	read_double64();
 
+	// Read bytes starting at the given position, without using or
+	// changing the file position.  Returns the number of bytes
+	// read.  If has_read_at(), this touches no state in the
+	// tu_file, so several threads can read_at() the same file at
+	// once; files opened by name for reading, and memory buffers,
+	// can do that.  Otherwise it's a seek, a read, and a seek
+	// back.
+	exported_module int	read_at(void* dst, int bytes, int position);
+	exported_module bool	has_read_at() const { return m_read_at != NULL; }
+
 	// get/set pos
 	exported_module int	get_position() const { return m_tell(m_data); }
 	exported_module void 	set_position(int p) { m_seek(p, m_data); }
@@ -175,6 +195,7 @@ private:
 	tell_func 	m_tell;
 	get_eof_func	m_get_eof;
 	close_func 	m_close;
+	read_at_func	m_read_at;	// optional
 	int	m_error;
 };
 
@@ -109,6 +109,7 @@ tu_file::tu_file(SDL_RWops* sdl_stream, bool autoclose)
 	m_tell = sdl_tell_func;
 	m_get_eof = sdl_get_eof_func;
 	m_close = autoclose ? sdl_close_func : NULL;
+	m_read_at = NULL;
 	m_error = TU_FILE_NO_ERROR;
 }
 
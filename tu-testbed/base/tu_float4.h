@@ -0,0 +1,162 @@
+// tu_float4.h	-- four-wide float vector, SSE or plain C
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// float4 holds four floats and does arithmetic on all four at once.
+// Comparisons give a mask4, one flag per lane, which can be combined
+// and used to select between two float4's.  With TU_CONFIG_USE_SSE2
+// it's a thin wrapper around __m128; otherwise each op is a loop
+// over four floats, so code written against it works everywhere.
+
+
+#ifndef TU_FLOAT4_H
+#define TU_FLOAT4_H
+
+
+#include "base/tu_config.h"
+
+#if TU_CONFIG_USE_SSE2
+#include <xmmintrin.h>
+#endif
+
+
+#if TU_CONFIG_USE_SSE2
+
+
+struct mask4
+{
+	mask4() {}
+	explicit mask4(__m128 m) : m(m) {}
+
+	// Bit i is set if lane i is set.
+	int	bits() const { return _mm_movemask_ps(m); }
+	bool	any() const { return bits() != 0; }
+	bool	all() const { return bits() == 15; }
+
+	static mask4	none() { return mask4(_mm_setzero_ps()); }
+
+	__m128	m;
+};
+
+inline mask4	operator&(mask4 a, mask4 b) { return mask4(_mm_and_ps(a.m, b.m)); }
+inline mask4	operator|(mask4 a, mask4 b) { return mask4(_mm_or_ps(a.m, b.m)); }
+inline mask4	and_not(mask4 a, mask4 b) { return mask4(_mm_andnot_ps(b.m, a.m)); }	// a & ~b
+
+
+struct float4
+{
+	float4() {}
+	explicit float4(__m128 m) : m(m) {}
+	explicit float4(float f) : m(_mm_set1_ps(f)) {}
+	float4(float a, float b, float c, float d) : m(_mm_setr_ps(a, b, c, d)) {}
+
+	static float4	load(const float* p) { return float4(_mm_loadu_ps(p)); }
+	void	store(float* p) const { _mm_storeu_ps(p, m); }
+
+	__m128	m;
+};
+
+inline float4	operator+(float4 a, float4 b) { return float4(_mm_add_ps(a.m, b.m)); }
+inline float4	operator-(float4 a, float4 b) { return float4(_mm_sub_ps(a.m, b.m)); }
+inline float4	operator*(float4 a, float4 b) { return float4(_mm_mul_ps(a.m, b.m)); }
+inline float4	operator/(float4 a, float4 b) { return float4(_mm_div_ps(a.m, b.m)); }
+
+inline mask4	operator<(float4 a, float4 b) { return mask4(_mm_cmplt_ps(a.m, b.m)); }
+inline mask4	operator<=(float4 a, float4 b) { return mask4(_mm_cmple_ps(a.m, b.m)); }
+inline mask4	operator>(float4 a, float4 b) { return mask4(_mm_cmpgt_ps(a.m, b.m)); }
+inline mask4	operator>=(float4 a, float4 b) { return mask4(_mm_cmpge_ps(a.m, b.m)); }
+
+inline float4	fmin(float4 a, float4 b) { return float4(_mm_min_ps(a.m, b.m)); }
+inline float4	fmax(float4 a, float4 b) { return float4(_mm_max_ps(a.m, b.m)); }
+inline float4	fabs(float4 a) { return float4(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.m)); }
+
+inline float4	select(mask4 mask, float4 a, float4 b)
+// Lanes of a where mask is set, b elsewhere.
+{
+	return float4(_mm_or_ps(_mm_and_ps(mask.m, a.m), _mm_andnot_ps(mask.m, b.m)));
+}
+
+
+#else // not TU_CONFIG_USE_SSE2
+
+
+struct mask4
+{
+	int	bits() const { return m[0] | (m[1] << 1) | (m[2] << 2) | (m[3] << 3); }
+	bool	any() const { return bits() != 0; }
+	bool	all() const { return bits() == 15; }
+
+	static mask4	none() { mask4 r; r.m[0] = r.m[1] = r.m[2] = r.m[3] = 0; return r; }
+
+	int	m[4];	// 0 or 1
+};
+
+inline mask4	operator&(mask4 a, mask4 b) { mask4 r; for (int i = 0; i < 4; i++) r.m[i] = a.m[i] & b.m[i]; return r; }
+inline mask4	operator|(mask4 a, mask4 b) { mask4 r; for (int i = 0; i < 4; i++) r.m[i] = a.m[i] | b.m[i]; return r; }
+inline mask4	and_not(mask4 a, mask4 b) { mask4 r; for (int i = 0; i < 4; i++) r.m[i] = a.m[i] & ~b.m[i]; return r; }
+
+
+struct float4
+{
+	float4() {}
+	explicit float4(float f) { m[0] = m[1] = m[2] = m[3] = f; }
+	float4(float a, float b, float c, float d) { m[0] = a; m[1] = b; m[2] = c; m[3] = d; }
+
+	static float4	load(const float* p) { return float4(p[0], p[1], p[2], p[3]); }
+	void	store(float* p) const { p[0] = m[0]; p[1] = m[1]; p[2] = m[2]; p[3] = m[3]; }
+
+	float	m[4];
+};
+
+#define TU_FLOAT4_OP(name, expr)				\
+	inline float4	name(float4 a, float4 b)		\
+	{							\
+		float4	r;					\
+		for (int i = 0; i < 4; i++) r.m[i] = (expr);	\
+		return r;					\
+	}
+TU_FLOAT4_OP(operator+, a.m[i] + b.m[i])
+TU_FLOAT4_OP(operator-, a.m[i] - b.m[i])
+TU_FLOAT4_OP(operator*, a.m[i] * b.m[i])
+TU_FLOAT4_OP(operator/, a.m[i] / b.m[i])
+TU_FLOAT4_OP(fmin, a.m[i] < b.m[i] ? a.m[i] : b.m[i])
+TU_FLOAT4_OP(fmax, a.m[i] > b.m[i] ? a.m[i] : b.m[i])
+#undef TU_FLOAT4_OP
+
+#define TU_FLOAT4_CMP(name, op)					\
+	inline mask4	name(float4 a, float4 b)		\
+	{							\
+		mask4	r;					\
+		for (int i = 0; i < 4; i++) r.m[i] = a.m[i] op b.m[i];	\
+		return r;					\
+	}
+TU_FLOAT4_CMP(operator<, <)
+TU_FLOAT4_CMP(operator<=, <=)
+TU_FLOAT4_CMP(operator>, >)
+TU_FLOAT4_CMP(operator>=, >=)
+#undef TU_FLOAT4_CMP
+
+inline float4	fabs(float4 a) { return float4(a.m[0] < 0 ? -a.m[0] : a.m[0], a.m[1] < 0 ? -a.m[1] : a.m[1], a.m[2] < 0 ? -a.m[2] : a.m[2], a.m[3] < 0 ? -a.m[3] : a.m[3]); }
+
+inline float4	select(mask4 mask, float4 a, float4 b)
+// Lanes of a where mask is set, b elsewhere.
+{
+	float4	r;
+	for (int i = 0; i < 4; i++) r.m[i] = mask.m[i] ? a.m[i] : b.m[i];
+	return r;
+}
+
+
+#endif // not TU_CONFIG_USE_SSE2
+
+
+#endif // TU_FLOAT4_H
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
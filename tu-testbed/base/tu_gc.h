@@ -387,8 +387,6 @@ namespace tu_gc {
 
 
 	
-	// TODO: incremental gc
-
 	// TODO: incremental generational gc
 
 	// TODO: multithreaded variants
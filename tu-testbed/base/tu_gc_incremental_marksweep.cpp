@@ -0,0 +1,789 @@
+// tu_gc_incremental_marksweep.cpp  -- incremental mark/sweep collector
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Incremental mark-sweep collector.
+//
+// The heap, and the bookkeeping for roots, are the same as in
+// tu_gc_singlethreaded_marksweep.cpp.  A block's mark bit is set when
+// it's shaded; shaded blocks that haven't been scanned yet (the grey
+// ones) are on a mark stack.
+//
+// Each mark thread keeps its own stack and takes work from, or gives
+// it back to, the shared stack m_grey in batches.  Outside of a step
+// only the program's thread touches m_grey, so the barriers don't
+// lock anything.
+
+
+#include "base/tu_gc_incremental_marksweep.h"
+#include "base/tu_gc_page_heap.h"
+#include "base/tu_atomic.h"
+#include "base/tu_profile.h"
+#include "base/tu_thread.h"
+#include "base/tu_timer.h"
+#include <vector>
+
+namespace tu_gc {
+
+	using namespace page_heap_detail;
+
+	typedef incremental_marksweep::gc_container_base gc_container_base;
+
+	/*static*/ bool incremental_marksweep::s_marking = false;
+
+	struct incremental_marksweep_state;
+
+	namespace {
+		// How many blocks a mark thread takes from the
+		// shared stack at a time.
+		const int GRAB_COUNT = 64;
+
+		// How many blocks to scan between looks at the
+		// clock.
+		const int CLOCK_INTERVAL = 64;
+
+		// One mark thread's state.
+		struct marker {
+			std::vector<const void*> m_stack;
+		};
+
+		// The marker running on this thread, if any.
+		TU_THREAD_LOCAL marker* s_marker = NULL;
+	}
+
+	struct incremental_marksweep_state : public collector_access {
+		page_heap m_heap;
+
+		// roots
+		block_meta* m_root_blocks;
+		gc_container_base* m_root_containers;
+		int m_root_pointer_count;
+		int m_root_container_count;
+
+		// non-roots
+		int m_heap_pointer_count;
+
+		// Blocks that are not yet under the control of a
+		// gc_ptr; see tu_gc_singlethreaded_marksweep.cpp.
+		// These nest, so it's used as a stack.
+		std::vector<void*> m_floating_blocks;
+
+		// Shaded blocks waiting to be scanned.  While mark
+		// threads are running, m_grey_mutex guards this and
+		// the other mark state.
+		std::vector<const void*> m_grey;
+		tu_thread::mutex m_grey_mutex;
+		tu_thread::condition m_grey_added;
+		// m_waiting_markers only changes with m_grey_mutex
+		// held, but busy markers peek at it without the lock;
+		// m_stop_marking is set without the lock.  Both go
+		// through tu_atomic.
+		int m_active_markers;
+		volatile int m_waiting_markers;
+		volatile int m_stop_marking;	// out of time
+		bool m_marking_done;		// nothing left to mark
+		bool m_parallel;		// mark threads are running
+		uint64 m_deadline;		// 0 for none
+
+		tu_thread::pool* m_pool;
+
+		// Stats & control values.
+		int m_percent_growth;
+		size_t m_current_heap_bytes;
+		size_t m_next_collection_heap_size;
+		size_t m_last_collection_heap_size;
+		size_t m_finish_heap_size;	// where we stop and finish marking
+		size_t m_step_bytes;		// allocation between steps
+		size_t m_bytes_since_step;
+		uint64 m_step_budget_ticks;
+		int m_collections;
+		uint64 m_total_pause_ticks;
+		uint64 m_max_pause_ticks;
+
+		incremental_marksweep_state() :
+			m_root_blocks(NULL),
+			m_root_containers(NULL),
+			m_root_pointer_count(0),
+			m_root_container_count(0),
+			m_heap_pointer_count(0),
+			m_active_markers(0),
+			m_waiting_markers(0),
+			m_stop_marking(0),
+			m_marking_done(false),
+			m_parallel(false),
+			m_deadline(0),
+			m_pool(NULL),
+			m_percent_growth(100),
+			m_current_heap_bytes(0),
+			m_next_collection_heap_size(1 << 16),
+			m_last_collection_heap_size(1 << 16),
+			m_finish_heap_size(1 << 17),
+			m_step_bytes(1 << 14),
+			m_bytes_since_step(0),
+			m_step_budget_ticks(0),
+			m_collections(0),
+			m_total_pause_ticks(0),
+			m_max_pause_ticks(0) {
+			set_step_budget(1000);
+		}
+
+		~incremental_marksweep_state() {
+			delete m_pool;
+		}
+
+		void set_collection_rate(int percent) {
+			m_percent_growth = percent;
+			size_t a = m_last_collection_heap_size;
+			double b = m_percent_growth / 100.0;
+			double c = a * (1 + b);
+			m_next_collection_heap_size = static_cast<size_t>(c);
+
+			// Give marking as much room again to finish in,
+			// over about 16 steps.
+			size_t room = m_next_collection_heap_size - a;
+			if (room < (1 << 16)) {
+				room = 1 << 16;
+			}
+			m_finish_heap_size = m_next_collection_heap_size + room;
+			m_step_bytes = room / 16;
+		}
+
+		void set_step_budget(int microseconds) {
+			// Calibrate against the profile clock.
+			double seconds_per_tick = tu_timer::profile_ticks_to_seconds(1000000) / 1000000;
+			m_step_budget_ticks = uint64(microseconds / 1000000.0 / seconds_per_tick);
+			if (m_step_budget_ticks == 0) {
+				m_step_budget_ticks = 1;
+			}
+		}
+
+		void set_mark_threads(int thread_count) {
+			assert(s_marker == NULL);
+			if (thread_count <= 0) {
+				thread_count = tu_thread::get_processor_count();
+			}
+			delete m_pool;
+			m_pool = NULL;
+			if (thread_count > 1) {
+				m_pool = new tu_thread::pool(thread_count);
+			}
+		}
+
+		//
+		// blocks
+		//
+
+		void* allocate(size_t sz, block_construction_locker_base* lock) {
+			assert(sz > 0);
+			assert(lock);
+
+			if (incremental_marksweep::s_marking == false) {
+				if (m_current_heap_bytes >= m_next_collection_heap_size) {
+					// Time to start a cycle.
+					step(false);
+				}
+			} else if (m_current_heap_bytes >= m_finish_heap_size) {
+				// Marking is falling behind.
+				step(true);
+			} else if (m_bytes_since_step >= m_step_bytes) {
+				step(false);
+			}
+
+			page* pg;
+			char* block = m_heap.allocate_block(sz, &pg);
+			if (incremental_marksweep::s_marking) {
+				// New blocks are black.
+				set_bit(pg->m_marks, pg->block_index(block));
+			}
+			m_current_heap_bytes += pg->m_block_size;
+			m_bytes_since_step += pg->m_block_size;
+
+			// Keep this block from being collected during
+			// construction, before it has a chance to be
+			// assigned to a gc_ptr.
+			m_floating_blocks.push_back(block);
+			block_ref(lock) = block;
+
+			return block;
+		}
+
+		void deallocate(void* p) {
+			page* pg = m_heap.find_page(p);
+			assert(pg);
+			int i = pg->block_index(p);
+			assert(pg->block_address(i) == p);
+			m_current_heap_bytes -= pg->m_block_size;
+			m_heap.free_block(pg, i);
+			// Empty pages are released by the sweep.
+		}
+
+		void block_construction_finished(void* block) {
+			// Usually the newest one.
+			for (int i = int(m_floating_blocks.size()) - 1; i >= 0; i--) {
+				if (m_floating_blocks[i] == block) {
+					m_floating_blocks[i] = m_floating_blocks.back();
+					m_floating_blocks.pop_back();
+					return;
+				}
+			}
+			assert(0);
+		}
+
+		void constructing_gc_object_base(gc_object_generic_base* obj) {
+			page* pg = m_heap.find_page(obj);
+			assert(pg);  // gc_objects must be constructed on the heap
+			int i = pg->block_index(obj);
+			assert(pg->m_meta[i].m_obj_offset == -1);
+			pg->m_meta[i].m_obj_offset = int((char*) obj - pg->block_address(i));
+		}
+
+		//
+		// roots
+		//
+
+		void add_root_ref(const void* obj) {
+			page* pg = m_heap.find_page(obj);
+			assert(pg);
+			block_meta* meta = &pg->m_meta[pg->block_index(obj)];
+			if (meta->m_root_count++ == 0) {
+				meta->m_prev_root = NULL;
+				meta->m_next_root = m_root_blocks;
+				if (m_root_blocks) {
+					m_root_blocks->m_prev_root = meta;
+				}
+				m_root_blocks = meta;
+			}
+		}
+
+		void remove_root_ref(const void* obj) {
+			page* pg = m_heap.find_page(obj);
+			assert(pg);
+			block_meta* meta = &pg->m_meta[pg->block_index(obj)];
+			assert(meta->m_root_count > 0);
+			if (--meta->m_root_count == 0) {
+				if (meta->m_prev_root) {
+					meta->m_prev_root->m_next_root = meta->m_next_root;
+				} else {
+					m_root_blocks = meta->m_next_root;
+				}
+				if (meta->m_next_root) {
+					meta->m_next_root->m_prev_root = meta->m_prev_root;
+				}
+			}
+		}
+
+		// write_barrier() calls these before it stores the new
+		// value, so *address_of_gc_ptr is still the old value.
+
+		void initing_pointer(void* address_of_gc_ptr, gc_object_generic_base* object_pointed_to) {
+			assert(address_of_gc_ptr);
+			assert(object_pointed_to);
+
+			if (incremental_marksweep::s_marking) {
+				shade(object_pointed_to);
+			}
+
+			// Inside a heap block?
+			page* pg = m_heap.find_page(address_of_gc_ptr);
+			if (pg) {
+				int w = pg->word_index(address_of_gc_ptr);
+				assert(get_bit(pg->m_ptrs, w) == false);
+				set_bit(pg->m_ptrs, w);
+				m_heap_pointer_count++;
+			} else {
+				add_root_ref(object_pointed_to);
+				m_root_pointer_count++;
+			}
+		}
+
+		void changing_pointer(void* address_of_gc_ptr, gc_object_generic_base* object_pointed_to) {
+			assert(address_of_gc_ptr);
+			void* old_value = *(void**) address_of_gc_ptr;
+
+			if (incremental_marksweep::s_marking) {
+				shade(old_value);
+				shade(object_pointed_to);
+			}
+
+			if (m_heap.find_page(address_of_gc_ptr)) {
+				// Heap pointers are read when marking.
+				return;
+			}
+			add_root_ref(object_pointed_to);
+			remove_root_ref(old_value);
+		}
+
+		void clearing_pointer(void* address_of_gc_ptr) {
+			assert(address_of_gc_ptr);
+			void* old_value = *(void**) address_of_gc_ptr;
+
+			if (incremental_marksweep::s_marking) {
+				shade(old_value);
+			}
+
+			page* pg = m_heap.find_page(address_of_gc_ptr);
+			if (pg) {
+				int w = pg->word_index(address_of_gc_ptr);
+				assert(get_bit(pg->m_ptrs, w));
+				clear_bit(pg->m_ptrs, w);
+				m_heap_pointer_count--;
+			} else {
+				remove_root_ref(old_value);
+				m_root_pointer_count--;
+			}
+		}
+
+		void contained_pointer_changing(gc_object_generic_base* old_value, gc_object_generic_base* new_value) {
+			assert(incremental_marksweep::s_marking);
+			if (old_value) {
+				shade(old_value);
+			}
+			if (new_value) {
+				shade(new_value);
+			}
+		}
+
+		void construct_container(gc_container_base* c) {
+			page* pg = m_heap.find_page(c);
+			if (pg) {
+				set_bit(pg->m_containers, pg->word_index(c));
+				pg->m_container_count++;
+			} else {
+				c->m_prev_root = NULL;
+				c->m_next_root = m_root_containers;
+				if (m_root_containers) {
+					m_root_containers->m_prev_root = c;
+				}
+				m_root_containers = c;
+				m_root_container_count++;
+			}
+		}
+
+		void destruct_container(gc_container_base* c) {
+			page* pg = m_heap.find_page(c);
+			if (pg) {
+				clear_bit(pg->m_containers, pg->word_index(c));
+				pg->m_container_count--;
+			} else {
+				if (c->m_prev_root) {
+					c->m_prev_root->m_next_root = c->m_next_root;
+				} else {
+					m_root_containers = c->m_next_root;
+				}
+				if (c->m_next_root) {
+					c->m_next_root->m_prev_root = c->m_prev_root;
+				}
+				m_root_container_count--;
+			}
+		}
+
+		void visit_contained_ptr(const gc_object_generic_base* obj) {
+			if (obj == NULL) {
+				return;
+			}
+			if (s_marker) {
+				shade(obj, s_marker);
+			} else {
+				shade(obj);
+			}
+		}
+
+		//
+		// marking
+		//
+
+		// Sets block i's mark bit.  Returns true if it wasn't
+		// set already.
+		bool try_mark(page* pg, int i) {
+			uint32 bit = 1u << (i & 31);
+			if (m_parallel == false) {
+				if (pg->m_marks[i >> 5] & bit) {
+					return false;
+				}
+				pg->m_marks[i >> 5] |= bit;
+				return true;
+			}
+
+			volatile int* word = (volatile int*) &pg->m_marks[i >> 5];
+			for (;;) {
+				int old_word = tu_atomic_load(word);
+				if (old_word & bit) {
+					return false;
+				}
+				if (tu_atomic_compare_and_swap(word, old_word, old_word | bit)) {
+					return true;
+				}
+			}
+		}
+
+		// Shades the block containing p, onto the shared stack
+		// (from the program's thread) or a marker's stack.
+		void shade(const void* p, marker* m = NULL) {
+			page* pg = m_heap.find_page(p);
+			assert(pg);
+			if (try_mark(pg, pg->block_index(p))) {
+				if (m) {
+					m->m_stack.push_back(p);
+				} else {
+					assert(m_parallel == false);
+					m_grey.push_back(p);
+				}
+			}
+		}
+
+		// Shades the roots.
+		void start_marking() {
+			TU_PROFILE_ZONE("gc::start_marking");
+			assert(incremental_marksweep::s_marking == false);
+			assert(m_grey.size() == 0);
+			incremental_marksweep::s_marking = true;
+
+			for (block_meta* meta = m_root_blocks; meta; meta = meta->m_next_root) {
+				page* pg = page_of_meta(meta);
+				int i = int(meta - pg->m_meta);
+				if (try_mark(pg, i)) {
+					m_grey.push_back(pg->block_address(i));
+				}
+			}
+
+			for (gc_container_base* c = m_root_containers; c; c = c->m_next_root) {
+				c->visit_contained_ptrs();
+			}
+
+			for (size_t i = 0; i < m_floating_blocks.size(); i++) {
+				shade(m_floating_blocks[i]);
+			}
+		}
+
+		// Marks until there's nothing left to mark, or the
+		// deadline passes (0 means no deadline).  Returns true
+		// if marking is done.
+		bool mark(uint64 deadline) {
+			TU_PROFILE_ZONE("gc::mark");
+			assert(incremental_marksweep::s_marking);
+
+			m_deadline = deadline;
+			tu_atomic_store(&m_stop_marking, 0);
+			m_marking_done = false;
+			m_active_markers = 0;
+			tu_atomic_store(&m_waiting_markers, 0);
+
+			int thread_count = m_pool ? m_pool->get_thread_count() : 1;
+			if (thread_count > 1 && m_grey.size() > 1) {
+				m_parallel = true;
+				m_pool->run(mark_task, this, thread_count);
+				m_parallel = false;
+			} else {
+				run_marker();
+			}
+
+			assert(m_marking_done == false || m_grey.size() == 0);
+			return m_marking_done;
+		}
+
+		static void mark_task(void* arg, int index) {
+			static_cast<incremental_marksweep_state*>(arg)->run_marker();
+		}
+
+		void run_marker() {
+			marker m;
+			s_marker = &m;
+
+			{
+				tu_thread::autolock lock(&m_grey_mutex);
+				if (m_marking_done || tu_atomic_load(&m_stop_marking)) {
+					// Started late; it's all over.
+					s_marker = NULL;
+					return;
+				}
+				m_active_markers++;
+			}
+
+			int scanned = 0;
+			for (;;) {
+				if (m.m_stack.empty() && get_work(&m) == false) {
+					break;
+				}
+
+				const void* p = m.m_stack.back();
+				m.m_stack.pop_back();
+				scan(p, &m);
+
+				if (++scanned % CLOCK_INTERVAL == 0 && m_deadline
+				    && tu_timer::get_profile_ticks() >= m_deadline) {
+					tu_atomic_store(&m_stop_marking, 1);
+				}
+				if (tu_atomic_load(&m_stop_marking)) {
+					give_back_work(&m);
+					break;
+				}
+				if (tu_atomic_load(&m_waiting_markers) && m.m_stack.size() > 1) {
+					share_work(&m);
+				}
+			}
+
+			s_marker = NULL;
+		}
+
+		// Refills m's empty stack from the shared stack,
+		// waiting for some if other markers are still busy.
+		// Returns false when m should quit, having taken it
+		// out of the active count.
+		bool get_work(marker* m) {
+			tu_thread::autolock lock(&m_grey_mutex);
+			for (;;) {
+				if (tu_atomic_load(&m_stop_marking)) {
+					m_active_markers--;
+					return false;
+				}
+				if (m_grey.size()) {
+					size_t n = m_grey.size() < size_t(GRAB_COUNT) ? m_grey.size() : GRAB_COUNT;
+					m->m_stack.insert(m->m_stack.end(), m_grey.end() - n, m_grey.end());
+					m_grey.resize(m_grey.size() - n);
+					return true;
+				}
+
+				if (--m_active_markers == 0) {
+					// Nobody has anything left.
+					m_marking_done = true;
+					m_grey_added.broadcast();
+					return false;
+				}
+
+				tu_atomic_increment(&m_waiting_markers);
+				while (m_grey.empty() && m_marking_done == false && tu_atomic_load(&m_stop_marking) == 0) {
+					m_grey_added.wait(&m_grey_mutex);
+				}
+				tu_atomic_decrement(&m_waiting_markers);
+				if (m_marking_done || tu_atomic_load(&m_stop_marking)) {
+					return false;
+				}
+				m_active_markers++;
+			}
+		}
+
+		// Moves half of m's stack to the shared stack, for
+		// the markers that are waiting.
+		void share_work(marker* m) {
+			tu_thread::autolock lock(&m_grey_mutex);
+			size_t n = m->m_stack.size() / 2;
+			m_grey.insert(m_grey.end(), m->m_stack.begin(), m->m_stack.begin() + n);
+			m->m_stack.erase(m->m_stack.begin(), m->m_stack.begin() + n);
+			m_grey_added.broadcast();
+		}
+
+		// Puts all of m's stack back for the next step, and
+		// quits.
+		void give_back_work(marker* m) {
+			tu_thread::autolock lock(&m_grey_mutex);
+			m_grey.insert(m_grey.end(), m->m_stack.begin(), m->m_stack.end());
+			m->m_stack.clear();
+			m_active_markers--;
+			m_grey_added.broadcast();
+		}
+
+		// Blackens the block containing p: shades everything it
+		// points at.
+		void scan(const void* p, marker* m) {
+			page* pg = m_heap.find_page(p);
+			assert(pg);
+			int i = pg->block_index(p);
+			if (get_bit(pg->m_allocated, i) == false) {
+				// Freed since it was shaded.
+				return;
+			}
+
+			char* block = pg->block_address(i);
+			int begin = pg->word_index(block);
+			int end = pg->word_index(block + pg->m_block_size);
+			for (int w = next_bit(pg->m_ptrs, begin, end); w < end; w = next_bit(pg->m_ptrs, w + 1, end)) {
+				const void* child = *(void**) pg->word_address(w);
+				assert(child);
+				shade(child, m);
+			}
+
+			if (pg->m_container_count) {
+				for (int w = next_bit(pg->m_containers, begin, end); w < end; w = next_bit(pg->m_containers, w + 1, end)) {
+					static_cast<gc_container_base*>(pg->word_address(w))->visit_contained_ptrs();
+				}
+			}
+		}
+
+		// Anything that is not marked is garbage -- delete
+		// it!  Anything that is marked is live, and should
+		// have its mark cleared.
+		void sweep_dead_objects() {
+			TU_PROFILE_ZONE("gc::sweep");
+			assert(incremental_marksweep::s_marking == false);
+
+			page* next = NULL;
+			for (page* pg = m_heap.m_used_pages; pg; pg = next) {
+				next = pg->m_next_used;
+
+				for (int w = 0, n = (pg->m_block_count + 31) / 32; w < n; w++) {
+					uint32 garbage = pg->m_allocated[w] & ~pg->m_marks[w];
+					while (garbage) {
+						int i = w * 32 + lowest_bit(garbage);
+						garbage &= garbage - 1;
+
+						block_meta* meta = &pg->m_meta[i];
+						assert(meta->m_obj_offset >= 0);
+						delete reinterpret_cast<gc_object_generic_base*>(pg->block_address(i) + meta->m_obj_offset);
+					}
+					pg->m_marks[w] = 0;
+				}
+
+				if (pg->m_live_blocks == 0) {
+					m_heap.release_page(pg);
+				}
+			}
+		}
+
+		void finish_cycle() {
+			incremental_marksweep::s_marking = false;
+			sweep_dead_objects();
+
+			m_last_collection_heap_size = m_current_heap_bytes;
+			TU_PROFILE_COUNTER("gc live heap bytes", (int) m_current_heap_bytes);
+			set_collection_rate(m_percent_growth);
+		}
+
+		//
+		// steps
+		//
+
+		// Does a step of work, or with finish, does the rest of
+		// the cycle.
+		void step(bool finish) {
+			TU_PROFILE_ZONE("gc::step");
+			uint64 start_ticks = tu_timer::get_profile_ticks();
+
+			if (incremental_marksweep::s_marking == false) {
+				start_marking();
+			}
+			if (mark(finish ? 0 : start_ticks + m_step_budget_ticks)) {
+				finish_cycle();
+			}
+			m_bytes_since_step = 0;
+
+			record_pause(start_ticks);
+		}
+
+		void record_pause(uint64 start_ticks) {
+			uint64 pause_ticks = tu_timer::get_profile_ticks() - start_ticks;
+			m_collections++;
+			m_total_pause_ticks += pause_ticks;
+			if (pause_ticks > m_max_pause_ticks) {
+				m_max_pause_ticks = pause_ticks;
+			}
+		}
+
+		void get_stats(incremental_marksweep::stats* s) {
+			assert(s);
+			s->live_heap_bytes = m_current_heap_bytes;
+			s->garbage_bytes = 0;
+			s->root_pointers = m_root_pointer_count;
+			s->live_pointers = m_root_pointer_count + m_heap_pointer_count;
+			s->root_containers = m_root_container_count;
+			s->collections = m_collections;
+			s->total_pause_ticks = m_total_pause_ticks;
+			s->max_pause_ticks = m_max_pause_ticks;
+		}
+
+		void collect_garbage(incremental_marksweep::stats* s) {
+			TU_PROFILE_ZONE("gc::collect_garbage");
+			uint64 start_ticks = tu_timer::get_profile_ticks();
+			size_t precollection_heap_bytes = m_current_heap_bytes;
+
+			if (incremental_marksweep::s_marking) {
+				// Blocks that died since this cycle
+				// started would survive it.
+				mark(0);
+				finish_cycle();
+			}
+			start_marking();
+			mark(0);
+			finish_cycle();
+			m_bytes_since_step = 0;
+
+			record_pause(start_ticks);
+
+			if (s) {
+				get_stats(s);
+				s->garbage_bytes = precollection_heap_bytes - s->live_heap_bytes;
+			}
+		}
+
+	} im_state;
+
+	/*static*/ void incremental_marksweep::get_stats(incremental_marksweep::stats* s) {
+		im_state.get_stats(s);
+	}
+
+	/*static*/ void incremental_marksweep::collect_garbage(incremental_marksweep::stats* s) {
+		im_state.collect_garbage(s);
+	}
+
+	/*static*/ void incremental_marksweep::collect_step() {
+		im_state.step(false);
+	}
+
+	/*static*/ void incremental_marksweep::set_collection_rate(
+		int percent_growth_before_next_collection) {
+		im_state.set_collection_rate(percent_growth_before_next_collection);
+	}
+
+	/*static*/ void incremental_marksweep::set_step_budget(int microseconds) {
+		im_state.set_step_budget(microseconds);
+	}
+
+	/*static*/ void incremental_marksweep::set_mark_threads(int thread_count) {
+		im_state.set_mark_threads(thread_count);
+	}
+
+	/*static*/ void* incremental_marksweep::allocate(size_t sz, block_construction_locker_base* lock) {
+		return im_state.allocate(sz, lock);
+	}
+
+	/*static*/ void incremental_marksweep::deallocate(void* p) {
+		im_state.deallocate(p);
+	}
+
+	/*static*/ void incremental_marksweep::block_construction_finished(void* block) {
+		im_state.block_construction_finished(block);
+	}
+
+	/*static*/ void incremental_marksweep::constructing_gc_object_base(gc_object_generic_base* obj) {
+		im_state.constructing_gc_object_base(obj);
+	}
+
+	/*static*/ void incremental_marksweep::clearing_pointer(void* address_of_gc_ptr) {
+		im_state.clearing_pointer(address_of_gc_ptr);
+	}
+
+	/*static*/ void incremental_marksweep::initing_pointer(void* address_of_gc_ptr, gc_object_generic_base* object_pointed_to) {
+		im_state.initing_pointer(address_of_gc_ptr, object_pointed_to);
+	}
+
+	/*static*/ void incremental_marksweep::changing_pointer(void* address_of_gc_ptr, gc_object_generic_base* object_pointed_to) {
+		im_state.changing_pointer(address_of_gc_ptr, object_pointed_to);
+	}
+
+	/*static*/ void incremental_marksweep::contained_pointer_changing(gc_object_generic_base* old_value, gc_object_generic_base* new_value) {
+		im_state.contained_pointer_changing(old_value, new_value);
+	}
+
+	/*static*/ void incremental_marksweep::construct_container(gc_container_base* c) {
+		im_state.construct_container(c);
+	}
+
+	/*static*/ void incremental_marksweep::destruct_container(gc_container_base* c) {
+		im_state.destruct_container(c);
+	}
+
+	/*static*/ void incremental_marksweep::visit_contained_ptr(const gc_object_generic_base* obj) {
+		im_state.visit_contained_ptr(obj);
+	}
+
+}  // tu_gc
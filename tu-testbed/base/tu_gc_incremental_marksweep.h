@@ -0,0 +1,268 @@
+// tu_gc_incremental_marksweep.h  -- incremental mark/sweep collector
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// An incremental mark/sweep garbage collector, for use with
+// tu_gc::gc_ptr<>.  Like singlethreaded_marksweep, the gc heap
+// belongs to one thread; but instead of stopping that thread for a
+// whole collection, it marks a little at a time, in steps of bounded
+// length, interleaved with the program.  Optionally, each step fans
+// the marking out over several threads.
+//
+// See tu_gc.h for basic usage.  See the documented methods below for
+// additional (optional) interfaces.
+//
+// How it works: tri-color marking.  A cycle starts by shading (i.e.
+// marking and queueing) everything the roots point at.  Each step
+// then takes shaded blocks off the queue and shades what they point
+// at, until the time budget runs out.  While a cycle is under way,
+// write_barrier() and contained_pointer_write_barrier() shade both
+// the value being overwritten (Yuasa's deletion barrier: everything
+// reachable when the cycle started gets marked) and the new value
+// (Dijkstra's insertion barrier: which covers pointers that come out
+// of a weak_ptr), and new blocks are allocated already marked.  When
+// the queue runs dry, the step sweeps the heap, all at once.
+//
+// Mark threads only run inside a step, so they never see the heap
+// change underneath them; the point of them is to make the steps
+// shorter, not to mark behind the program's back.
+//
+// Steps are triggered by allocation.  A cycle starts once the heap
+// has grown by the collection rate since the last one (as with
+// singlethreaded_marksweep), and then a step runs every so often as
+// the program allocates.  If the heap grows by the collection rate
+// again before marking is done, the collector stops and finishes
+// the cycle.  Call collect_step() to do the work at a time of your
+// choosing instead, e.g. once per frame.
+
+
+#include "base/tu_gc.h"
+#include "base/tu_types.h"
+
+namespace tu_gc {
+
+	struct incremental_marksweep_state;
+
+	class incremental_marksweep {
+	public:
+		typedef incremental_marksweep this_class;
+
+		// This is a base class of gc_object_base.  Different
+		// collectors can use it to add properties to gc_object_base.
+		//
+		// We don't do anything with it.
+		class gc_object_collector_base : public tu_gc::gc_object_generic_base {
+		};
+
+		// Client interfaces.
+		struct stats {
+			size_t live_heap_bytes;
+			size_t garbage_bytes;
+			size_t root_pointers;
+			size_t live_pointers;
+			size_t root_containers;
+
+			// Collection pauses since startup, in
+			// tu_timer profile ticks.  Every step is a
+			// pause.
+			int collections;
+			uint64 total_pause_ticks;
+			uint64 max_pause_ticks;
+		};
+		// Gets basic stats.  garbage_bytes will be zero
+		// (since we don't know what is garbage) and
+		// live_heap_bytes will include everything including
+		// potential garbage.
+		static void get_stats(stats* s);
+
+		// Collects all garbage, right now.  Finishes the cycle
+		// that's under way, if any, and then does a whole new
+		// one.
+		//
+		// If s is not NULL, fills it with interesting
+		// statistics.
+		static void collect_garbage(stats* s);
+
+		// Does one step: starts a cycle if there isn't one
+		// under way, and marks until the step budget runs out
+		// or marking is done (in which case it sweeps too).
+		static void collect_step();
+
+		// Determines when a cycle starts.  A cycle starts when
+		// the total number of heap bytes exceeds the
+		// last-known live byte count by the given percentage.
+		//
+		// 0 will start a cycle as soon as the last one is
+		// done.
+		//
+		// The default is 100.
+		static void set_collection_rate(int percent_growth_before_next_collection);
+
+		// How long a step may mark for, in microseconds.  A
+		// step that finishes marking also sweeps, which takes
+		// longer.  The default is 1000.
+		static void set_step_budget(int microseconds);
+
+		// Number of threads that mark during a step, counting
+		// the thread that's running the step.  0 means one per
+		// processor.  The default is 1.
+		static void set_mark_threads(int thread_count);
+
+		// Semi-private interfaces.  TODO: figure out how to
+		// protect these.
+
+		// Called by the block construction locker after the
+		// new() expression completes (presumably after the
+		// new block has been assigned to a gc_ptr).
+		static void block_construction_finished(void* block);
+
+		// Called from gc_object_base constructor.  Helps us
+		// associate a gc_object_generic_base* with its
+		// containing heap block (in case of gnarly multiple
+		// inheritance).
+		static void constructing_gc_object_base(gc_object_generic_base* obj);
+
+		// Called by the smart ptr during construction.
+		//
+		// This collector doesn't care, until the pointer
+		// takes a non-null value, which is notified via
+		// write_barrier().
+		template<class T>
+		static void construct_pointer(gc_ptr<T, this_class>* gc_ptr_p) {}
+
+		// Called by the smart ptr during destruction.
+		//
+		// This collector doesn't care.  What it does care
+		// about is when the pointer is cleared, which is
+		// notified via write_barrier().
+		template<class T>
+		static void destruct_pointer(gc_ptr<T, this_class>* gc_ptr_p) {}
+
+		// Used by the smart ptr to change the value of the
+		// pointer.
+		//
+		// We take notice whenever the pointer changes from
+		// null to a value or vice-versa, and, while marking,
+		// of every change.
+		template<class T>
+		static void write_barrier(gc_ptr<T, this_class>* gc_ptr_p, T* new_val_p) {
+			assert(gc_ptr_p);
+			if (new_val_p == gc_ptr_p->get()) {
+				return;
+			}
+			if (gc_ptr_p->get()) {
+				if (!new_val_p) {
+					clearing_pointer(gc_ptr_p);
+				} else {
+					changing_pointer(gc_ptr_p, new_val_p);
+				}
+			} else if (new_val_p) {
+				initing_pointer(gc_ptr_p, new_val_p);
+			}
+			gc_ptr_p->raw_set_ptr_gc_access_only(new_val_p);
+		}
+
+		// Containers
+
+		// Contained pointers are only found by visiting their
+		// container, so the collector only needs to hear about
+		// changes while marking.
+		template<class T>
+		static void contained_pointer_write_barrier(contained_gc_ptr<T, this_class>* gc_ptr_p, T* new_val_p) {
+			if (s_marking && new_val_p != gc_ptr_p->get()) {
+				contained_pointer_changing(gc_ptr_p->get(), new_val_p);
+			}
+			gc_ptr_p->raw_set_ptr_gc_access_only(new_val_p);
+		}
+
+		template<class T>
+		static void construct_contained_pointer(contained_gc_ptr<T, this_class>* gc_ptr_p) {}
+		template<class T>
+		static void destruct_contained_pointer(contained_gc_ptr<T, this_class>* gc_ptr_p) {}
+
+		class gc_container_base {
+		    public:
+			gc_container_base() {
+				construct_container(this);
+			}
+			virtual ~gc_container_base() {
+				destruct_container(this);
+			}
+
+			virtual void visit_contained_ptrs() = 0;
+
+		    private:
+			friend struct incremental_marksweep_state;
+
+			// Links in the collector's list of root
+			// containers (unused for containers inside
+			// heap blocks).
+			gc_container_base* m_prev_root;
+			gc_container_base* m_next_root;
+		};
+
+		// gc_container, for collections of pointers
+		template<class container_type>
+		class gc_container : public gc_container_base, public container_type {
+		public:
+			// visit contained pointers
+			virtual void visit_contained_ptrs() {
+				for (typename container_type::const_iterator it = this->begin();
+				     it != this->end();
+				     ++it) {
+					visit_contained_ptr(it->get());
+				}
+			}
+		};
+
+		template<class container_type>
+		class gc_pair_container : public gc_container_base, public container_type {
+		public:
+			// Visit values.
+			virtual void visit_contained_ptrs() {
+				for (typename container_type::const_iterator it = this->begin();
+				     it != this->end();
+				     ++it) {
+					visit_contained_value(it->first);
+					visit_contained_value(it->second);
+				}
+			}
+		};
+
+	private:
+		friend class gc_object_base<incremental_marksweep>;
+		friend struct incremental_marksweep_state;
+
+		// Used by gc_object_base new/delete.
+		static void* allocate(size_t sz, block_construction_locker_base* lock);
+		static void deallocate(void* p);
+
+		// Notifications from write_barrier().
+		static void clearing_pointer(void* address_of_gc_ptr);
+		static void initing_pointer(void* address_of_gc_ptr, gc_object_generic_base* object_pointed_to);
+		static void changing_pointer(void* address_of_gc_ptr, gc_object_generic_base* object_pointed_to);
+
+		// Notification from contained_pointer_write_barrier().
+		static void contained_pointer_changing(gc_object_generic_base* old_value, gc_object_generic_base* new_value);
+
+		// True while a cycle is marking.
+		static bool s_marking;
+
+		// Notifications from gc_container
+		static void construct_container(gc_container_base* c);
+		static void destruct_container(gc_container_base* c);
+
+		static void visit_contained_ptr(const gc_object_generic_base* obj);
+
+		template<class T>
+		static void visit_contained_value(T val) {
+			// Default action: do nothing.
+		}
+		// Specialize for gc objects.
+		template<typename T>
+		static void visit_contained_value(const contained_gc_ptr<T, this_class>& val) {
+			visit_contained_ptr(val.get());
+		}
+	};
+}  // tu_gc
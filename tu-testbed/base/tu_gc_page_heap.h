@@ -0,0 +1,554 @@
+// tu_gc_page_heap.h  -- Thatcher Ulrich <http://tulrich.com> 2007
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// The paged heap shared by the mark/sweep collectors.  Internal to
+// their .cpp files; clients don't need this.
+//
+// Heap layout: gc blocks live in pages of PAGE_SIZE bytes, aligned to
+// PAGE_SIZE.  A page holds blocks of a single size class; a block
+// too big for the size classes gets a run of pages to itself.  A hash
+// table maps page numbers to page headers, so finding the block that
+// contains an address is a hash lookup and a multiply.
+//
+// Each page header has side bitmaps: allocated and mark bits, one per
+// block; and pointer and container bits, one per pointer-sized word.
+// A set pointer bit means a non-null gc_ptr lives at that address
+// (gc_ptr<> holds nothing but its pointer), so marking a block scans
+// its range of pointer bits and reads the pointers straight out of
+// the block.  Likewise a set container bit means a gc_container_base
+// lives there.
+//
+// The page_heap only hands out and takes back blocks; what the mark
+// bits mean, and when pages are released, is up to the collector.
+
+
+#ifndef TU_GC_PAGE_HEAP_H
+#define TU_GC_PAGE_HEAP_H
+
+
+#include "base/tu_config.h"
+#include "base/tu_types.h"
+#include <assert.h>
+#include <string.h>
+
+namespace tu_gc {
+namespace page_heap_detail {
+
+	const int PAGE_SHIFT = 14;
+	const size_t PAGE_SIZE = size_t(1) << PAGE_SHIFT;
+	const size_t PAGE_MASK = PAGE_SIZE - 1;
+
+	// Small pages are allocated this many at a time.
+	const int BATCH_PAGES = 32;
+
+	const int WORD_SIZE = sizeof(void*);
+
+	const int s_class_size[] = {
+		16, 32, 48, 64, 80, 96, 112, 128,
+		160, 192, 224, 256,
+		320, 384, 448, 512,
+		640, 768, 896, 1024,
+		1280, 1536, 1792, 2048,
+	};
+	const int CLASS_COUNT = sizeof(s_class_size) / sizeof(s_class_size[0]);
+	const int MAX_SMALL_SIZE = 2048;
+
+	inline size_t align_up(size_t n, size_t alignment) {
+		return (n + alignment - 1) & ~(alignment - 1);
+	}
+
+	inline bool get_bit(const uint32* bits, int i) {
+		return (bits[i >> 5] >> (i & 31)) & 1;
+	}
+
+	inline void set_bit(uint32* bits, int i) {
+		bits[i >> 5] |= 1u << (i & 31);
+	}
+
+	inline void clear_bit(uint32* bits, int i) {
+		bits[i >> 5] &= ~(1u << (i & 31));
+	}
+
+	inline int lowest_bit(uint32 x) {
+		assert(x);
+#ifdef __GNUC__
+		return __builtin_ctz(x);
+#else
+		int i = 0;
+		while ((x & 1) == 0) {
+			x >>= 1;
+			i++;
+		}
+		return i;
+#endif
+	}
+
+	// Returns the index of the first set bit in [i, end),
+	// or end if there isn't one.
+	inline int next_bit(const uint32* bits, int i, int end) {
+		while (i < end) {
+			uint32 word = bits[i >> 5] >> (i & 31);
+			if (word) {
+				i += lowest_bit(word);
+				return i < end ? i : end;
+			}
+			i = (i | 31) + 1;
+		}
+		return end;
+	}
+
+	// Clears bits [begin, end).
+	inline void clear_bits(uint32* bits, int begin, int end) {
+		while (begin < end && (begin & 31)) {
+			clear_bit(bits, begin++);
+		}
+		while (begin + 32 <= end) {
+			bits[begin >> 5] = 0;
+			begin += 32;
+		}
+		while (begin < end) {
+			clear_bit(bits, begin++);
+		}
+	}
+
+	struct block_meta {
+		// Links in the collector's list of blocks that roots
+		// point at.
+		block_meta* m_prev_root;
+		block_meta* m_next_root;
+		int m_root_count;
+
+		// Where the gc_object_generic_base is, from the start
+		// of the block (not always 0, with multiple
+		// inheritance); -1 until it's constructed.
+		//
+		// We need it in order to call the object's virtual
+		// destructor.
+		int m_obj_offset;
+	};
+
+	struct page {
+		// Links in the size class's list of pages with free
+		// blocks.
+		page* m_prev;
+		page* m_next;
+		bool m_listed;
+
+		// Links in the list of all pages in use.
+		page* m_prev_used;
+		page* m_next_used;
+
+		int m_size_class;	// -1 for a big block's page run
+		int m_block_size;
+		int m_block_count;
+		uint64 m_block_size_reciprocal;	// 2^32 / m_block_size, rounded up
+		int m_live_blocks;
+		int m_container_count;
+		size_t m_bytes;		// PAGE_SIZE, or more for a page run
+		void* m_raw;		// what to free, for a page run
+
+		char* m_blocks;
+		char* m_bump;		// blocks from here on have never been used
+		void* m_free;		// freed blocks
+
+		block_meta* m_meta;
+		uint32* m_allocated;	// a bit per block
+		uint32* m_marks;	// a bit per block
+		uint32* m_ptrs;		// a bit per word
+		uint32* m_containers;	// a bit per word
+
+		int block_index(const void* p) const {
+			size_t offset = static_cast<const char*>(p) - m_blocks;
+			assert(offset < size_t(m_block_size) * m_block_count);
+			if (m_block_count == 1) {
+				return 0;
+			}
+			// Exact, as long as offset < 2^32 / m_block_size,
+			// which holds within a small page.
+			return int((offset * m_block_size_reciprocal) >> 32);
+		}
+
+		char* block_address(int i) const {
+			return m_blocks + i * m_block_size;
+		}
+
+		int word_index(const void* p) const {
+			return int((static_cast<const char*>(p) - reinterpret_cast<const char*>(this)) / WORD_SIZE);
+		}
+
+		void* word_address(int i) const {
+			return (char*) this + i * WORD_SIZE;
+		}
+
+		// Returns the size of the header, bitmaps and
+		// blocks, for the given layout.
+		static size_t layout_bytes(size_t page_bytes, int block_size, int block_count) {
+			size_t bytes = align_up(sizeof(page), 16);
+			bytes += sizeof(block_meta) * block_count;
+			bytes += 4 * 2 * ((block_count + 31) / 32);
+			bytes += 4 * 2 * ((page_bytes / WORD_SIZE + 31) / 32);
+			bytes = align_up(bytes, 16);
+			return bytes + size_t(block_size) * block_count;
+		}
+
+		void init(size_t page_bytes, int size_class, int block_size, int block_count) {
+			m_prev = m_next = NULL;
+			m_listed = false;
+			m_prev_used = m_next_used = NULL;
+			m_size_class = size_class;
+			m_block_size = block_size;
+			m_block_count = block_count;
+			m_block_size_reciprocal = (uint64(1) << 32) / block_size + 1;
+			m_live_blocks = 0;
+			m_container_count = 0;
+			m_bytes = page_bytes;
+			m_raw = NULL;
+
+			char* p = (char*) this + align_up(sizeof(page), 16);
+			m_meta = (block_meta*) p;
+			p += sizeof(block_meta) * block_count;
+			int block_bitmap_bytes = 4 * ((block_count + 31) / 32);
+			int word_bitmap_bytes = 4 * int((page_bytes / WORD_SIZE + 31) / 32);
+			m_allocated = (uint32*) p;
+			p += block_bitmap_bytes;
+			m_marks = (uint32*) p;
+			p += block_bitmap_bytes;
+			m_ptrs = (uint32*) p;
+			p += word_bitmap_bytes;
+			m_containers = (uint32*) p;
+			p += word_bitmap_bytes;
+			memset(m_allocated, 0, p - (char*) m_allocated);
+
+			m_blocks = (char*) align_up((size_t) p, 16);
+			m_bump = m_blocks;
+			m_free = NULL;
+			assert(m_blocks + size_t(block_size) * block_count <= (char*) this + page_bytes);
+		}
+	};
+
+	// Returns the page whose meta array holds meta.
+	inline page* page_of_meta(block_meta* meta) {
+		return (page*) ((size_t) meta & ~PAGE_MASK);
+	}
+
+	struct page_heap {
+		// Size class of each multiple of 16 bytes.
+		unsigned char m_class_of[MAX_SMALL_SIZE / 16 + 1];
+		int m_class_block_count[CLASS_COUNT];
+
+		// Pages with free blocks, by size class.
+		page* m_partial[CLASS_COUNT];
+
+		// All pages in use.
+		page* m_used_pages;
+
+		// Empty small pages, and the unused part of the
+		// newest batch.
+		page* m_free_pages;
+		char* m_batch_next;
+		char* m_batch_end;
+
+		// Page number -> page.  Open addressing, linear
+		// probing; page number 0 marks an empty slot.
+		struct page_entry {
+			size_t m_page_number;
+			page* m_page;
+		};
+		page_entry* m_page_table;
+		int m_page_table_mask;
+		int m_page_table_count;
+
+		page_heap() :
+			m_used_pages(NULL),
+			m_free_pages(NULL),
+			m_batch_next(NULL),
+			m_batch_end(NULL),
+			m_page_table(NULL),
+			m_page_table_mask(-1),
+			m_page_table_count(0) {
+			int c = 0;
+			for (int i = 0; i <= MAX_SMALL_SIZE / 16; i++) {
+				while (s_class_size[c] < i * 16) {
+					c++;
+				}
+				m_class_of[i] = (unsigned char) c;
+			}
+
+			for (int i = 0; i < CLASS_COUNT; i++) {
+				m_partial[i] = NULL;
+
+				int size = s_class_size[i];
+				int count = int(PAGE_SIZE / size);
+				while (page::layout_bytes(PAGE_SIZE, size, count) > PAGE_SIZE) {
+					count--;
+				}
+				m_class_block_count[i] = count;
+			}
+		}
+
+		//
+		// page table
+		//
+
+		static int page_hash(size_t page_number) {
+			return int(uint32(page_number ^ (page_number >> 16)) * 0x9E3779B1u);
+		}
+
+		// Returns the page holding p, or NULL if p isn't in
+		// the heap.
+		page* find_page(const void* p) const {
+			if (m_page_table == NULL) {
+				return NULL;
+			}
+			size_t page_number = (size_t) p >> PAGE_SHIFT;
+			for (int i = page_hash(page_number) & m_page_table_mask; ; i = (i + 1) & m_page_table_mask) {
+				const page_entry& e = m_page_table[i];
+				if (e.m_page_number == page_number) {
+					return e.m_page;
+				}
+				if (e.m_page_number == 0) {
+					return NULL;
+				}
+			}
+		}
+
+		void add_page_entry(size_t page_number, page* pg) {
+			if ((m_page_table_count + 1) * 2 > m_page_table_mask + 1) {
+				// Grow.
+				page_entry* old_table = m_page_table;
+				int old_size = m_page_table_mask + 1;
+				int new_size = old_size ? old_size * 2 : 256;
+				m_page_table = new page_entry[new_size];
+				memset(m_page_table, 0, sizeof(page_entry) * new_size);
+				m_page_table_mask = new_size - 1;
+				m_page_table_count = 0;
+				for (int i = 0; i < old_size; i++) {
+					if (old_table[i].m_page_number) {
+						add_page_entry(old_table[i].m_page_number, old_table[i].m_page);
+					}
+				}
+				delete [] old_table;
+			}
+
+			int i = page_hash(page_number) & m_page_table_mask;
+			while (m_page_table[i].m_page_number) {
+				assert(m_page_table[i].m_page_number != page_number);
+				i = (i + 1) & m_page_table_mask;
+			}
+			m_page_table[i].m_page_number = page_number;
+			m_page_table[i].m_page = pg;
+			m_page_table_count++;
+		}
+
+		void remove_page_entry(size_t page_number) {
+			int i = page_hash(page_number) & m_page_table_mask;
+			while (m_page_table[i].m_page_number != page_number) {
+				assert(m_page_table[i].m_page_number);
+				i = (i + 1) & m_page_table_mask;
+			}
+
+			// Shift back any entries that probed past this
+			// slot, so lookups don't stop short at the hole.
+			for (int j = (i + 1) & m_page_table_mask; m_page_table[j].m_page_number; j = (j + 1) & m_page_table_mask) {
+				int home = page_hash(m_page_table[j].m_page_number) & m_page_table_mask;
+				bool movable = (j > i) ? (home <= i || home > j) : (home <= i && home > j);
+				if (movable) {
+					m_page_table[i] = m_page_table[j];
+					i = j;
+				}
+			}
+			m_page_table[i].m_page_number = 0;
+			m_page_table[i].m_page = NULL;
+			m_page_table_count--;
+		}
+
+		void register_page(page* pg) {
+			for (size_t offset = 0; offset < pg->m_bytes; offset += PAGE_SIZE) {
+				add_page_entry(((size_t) pg + offset) >> PAGE_SHIFT, pg);
+			}
+
+			pg->m_prev_used = NULL;
+			pg->m_next_used = m_used_pages;
+			if (m_used_pages) {
+				m_used_pages->m_prev_used = pg;
+			}
+			m_used_pages = pg;
+		}
+
+		//
+		// pages
+		//
+
+		void link_partial(page* pg) {
+			assert(pg->m_listed == false);
+			page** head = &m_partial[pg->m_size_class];
+			pg->m_prev = NULL;
+			pg->m_next = *head;
+			if (*head) {
+				(*head)->m_prev = pg;
+			}
+			*head = pg;
+			pg->m_listed = true;
+		}
+
+		void unlink_partial(page* pg) {
+			assert(pg->m_listed);
+			if (pg->m_prev) {
+				pg->m_prev->m_next = pg->m_next;
+			} else {
+				m_partial[pg->m_size_class] = pg->m_next;
+			}
+			if (pg->m_next) {
+				pg->m_next->m_prev = pg->m_prev;
+			}
+			pg->m_listed = false;
+		}
+
+		page* new_small_page(int size_class) {
+			page* pg = m_free_pages;
+			if (pg) {
+				m_free_pages = pg->m_next;
+			} else {
+				if (m_batch_next == m_batch_end) {
+					// Batches are never freed; their
+					// empty pages get reused.
+					char* raw = (char*) tu_malloc(BATCH_PAGES * PAGE_SIZE + PAGE_SIZE);
+					m_batch_next = (char*) align_up((size_t) raw, PAGE_SIZE);
+					m_batch_end = m_batch_next + BATCH_PAGES * PAGE_SIZE;
+				}
+				pg = (page*) m_batch_next;
+				m_batch_next += PAGE_SIZE;
+			}
+
+			pg->init(PAGE_SIZE, size_class, s_class_size[size_class], m_class_block_count[size_class]);
+			register_page(pg);
+			link_partial(pg);
+			return pg;
+		}
+
+		page* new_big_page(size_t sz) {
+			int block_size = int(align_up(sz, 16));
+			size_t bytes = align_up(page::layout_bytes(0, block_size, 1), PAGE_SIZE);
+			while (page::layout_bytes(bytes, block_size, 1) > bytes) {
+				bytes += PAGE_SIZE;
+			}
+
+			void* raw = tu_malloc(bytes + PAGE_SIZE);
+			page* pg = (page*) align_up((size_t) raw, PAGE_SIZE);
+			pg->init(bytes, -1, block_size, 1);
+			pg->m_raw = raw;
+			register_page(pg);
+			return pg;
+		}
+
+		// Gives an empty page back.
+		void release_page(page* pg) {
+			assert(pg->m_live_blocks == 0);
+
+			if (pg->m_listed) {
+				unlink_partial(pg);
+			}
+			if (pg->m_prev_used) {
+				pg->m_prev_used->m_next_used = pg->m_next_used;
+			} else {
+				m_used_pages = pg->m_next_used;
+			}
+			if (pg->m_next_used) {
+				pg->m_next_used->m_prev_used = pg->m_prev_used;
+			}
+			for (size_t offset = 0; offset < pg->m_bytes; offset += PAGE_SIZE) {
+				remove_page_entry(((size_t) pg + offset) >> PAGE_SHIFT);
+			}
+
+			if (pg->m_size_class >= 0) {
+				pg->m_next = m_free_pages;
+				m_free_pages = pg;
+			} else {
+				tu_free(pg->m_raw, pg->m_bytes + PAGE_SIZE);
+			}
+		}
+
+		//
+		// blocks
+		//
+
+		// Returns a new block of at least sz bytes, with its
+		// allocated bit set and its meta reset, and its page
+		// in *page_out.
+		char* allocate_block(size_t sz, page** page_out) {
+			page* pg;
+			char* block;
+			if (sz <= size_t(MAX_SMALL_SIZE)) {
+				int size_class = m_class_of[(sz + 15) >> 4];
+				pg = m_partial[size_class];
+				if (pg == NULL) {
+					pg = new_small_page(size_class);
+				}
+				if (pg->m_free) {
+					block = (char*) pg->m_free;
+					pg->m_free = *(void**) block;
+				} else {
+					block = pg->m_bump;
+					pg->m_bump += pg->m_block_size;
+				}
+				if (pg->m_free == NULL && pg->m_bump == pg->block_address(pg->m_block_count)) {
+					// Full.
+					unlink_partial(pg);
+				}
+			} else {
+				pg = new_big_page(sz);
+				block = pg->m_blocks;
+			}
+
+			int i = pg->block_index(block);
+			assert(get_bit(pg->m_allocated, i) == false);
+			set_bit(pg->m_allocated, i);
+			block_meta* meta = &pg->m_meta[i];
+			meta->m_prev_root = meta->m_next_root = NULL;
+			meta->m_root_count = 0;
+			meta->m_obj_offset = -1;
+			pg->m_live_blocks++;
+
+			*page_out = pg;
+			return block;
+		}
+
+		// Takes back block i.  Its page stays in use, even if
+		// it's empty now; the collector decides when to
+		// release pages.
+		void free_block(page* pg, int i) {
+			char* block = pg->block_address(i);
+			assert(get_bit(pg->m_allocated, i));
+			assert(pg->m_meta[i].m_root_count == 0);
+
+			// The block's gc_ptrs and containers have
+			// normally cleared their bits by now, but a
+			// constructor that threw may have left some.
+			int begin = pg->word_index(block);
+			int end = pg->word_index(block + pg->m_block_size);
+			clear_bits(pg->m_ptrs, begin, end);
+			clear_bits(pg->m_containers, begin, end);
+			clear_bit(pg->m_allocated, i);
+			clear_bit(pg->m_marks, i);
+			pg->m_live_blocks--;
+
+			// Fill with junk.
+			//TODO 0xCAFFE14E
+
+			if (pg->m_size_class >= 0) {
+				*(void**) block = pg->m_free;
+				pg->m_free = block;
+				if (pg->m_listed == false) {
+					link_partial(pg);
+				}
+			}
+		}
+	};
+
+}  // page_heap_detail
+}  // tu_gc
+
+
+#endif  // TU_GC_PAGE_HEAP_H
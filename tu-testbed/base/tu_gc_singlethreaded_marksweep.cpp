@@ -4,60 +4,44 @@
 // whatever you want with it.
 
 // Single-threaded mark-sweep collector.
+//
+// Blocks live in a page_heap (see tu_gc_page_heap.h), which keeps the
+// mark bits and the locations of heap gc_ptrs and containers in side
+// bitmaps.
+//
+// Roots are counted per block: each block knows how many root gc_ptrs
+// (ones that aren't inside a block) point at it, and the blocks with
+// a nonzero count are on an intrusive list, which is where marking
+// starts.  Root containers are on an intrusive list of their own.
 
 
 #include "base/tu_gc_singlethreaded_marksweep.h"
-#include <map>
-#include <set>
+#include "base/tu_gc_page_heap.h"
+#include "base/tu_profile.h"
+#include "base/tu_timer.h"
 #include <vector>
 
 namespace tu_gc {
 
-	struct blockinfo {
-		bool mark;
-		// start of the object memory block
-		void* p;
-		// size of the object memory block
-		size_t sz;
-		// This is somewhere inside the block (usually at the
-		// very beginning, but not if there is multiple
-		// inheritance going on).
-		//
-		// We need it in order to call the object's virtual
-		// destructor.
-		gc_object_generic_base* obj;
-
-		blockinfo() : mark(false), p(0), sz(0), obj(0) {
-		}
-		blockinfo(void* p_in, size_t sz_in) : mark(false), p(p_in), sz(sz_in), obj(0) {
-		}
-
-		void* end() const {
-			return static_cast<char*>(p) + sz;
-		}
+	using namespace page_heap_detail;
 
-		bool operator<(const blockinfo& bi) const {
-			return p < bi.p;
-		}
-
-		bool is_address_inside(const void* ptr) const {
-			return (ptr >= p && ptr < end());
-		}
-	};
+	typedef singlethreaded_marksweep::gc_container_base gc_container_base;
 
 	struct singlethreaded_marksweep_state : public collector_access {
-		// Convenience typedefs.
-		typedef std::map<void*, gc_object_generic_base*>::iterator ptr_iterator;
-		typedef std::set<void*>::iterator floating_blocks_iterator;
-		typedef std::map<void*, blockinfo>::iterator heap_block_iterator;
-		typedef std::set<singlethreaded_marksweep::gc_container_base*>::iterator container_iterator;
+		page_heap m_heap;
 
 		// roots
-		std::map<void*, gc_object_generic_base*> m_roots;
+		block_meta* m_root_blocks;
+		gc_container_base* m_root_containers;
+		int m_root_pointer_count;
+		int m_root_container_count;
+
+		// non-roots
+		int m_heap_pointer_count;
 
-		// A set of blocks that are not yet under the control
-		// of a gc_ptr.  Typically this happens between the
-		// time gc_object_base::new returns void* and when the
+		// Blocks that are not yet under the control of a
+		// gc_ptr.  Typically this happens between the time
+		// gc_object_base::new returns void* and when the
 		// value is assigned to a gc_ptr.  We have to treat
 		// such blocks as rooted to avoid problems with code
 		// like:
@@ -67,32 +51,35 @@ namespace tu_gc {
 		// since the block for MyObj must be allocated before
 		// the MyObj constructor is called, and the MyObj
 		// constructor must happen before p is assigned.
-		std::set<void*> m_floating_blocks;
-
-		// non-roots
-		std::map<void*, gc_object_generic_base*> m_heap_ptrs;
-
-		// heap blocks
-		std::map<void*, blockinfo> m_heap_blocks;
-
-		// containers
-		std::set<singlethreaded_marksweep::gc_container_base*> m_root_containers;
-		std::set<singlethreaded_marksweep::gc_container_base*> m_containers;
+		//
+		// These nest, so it's used as a stack.
+		std::vector<void*> m_floating_blocks;
 
 		// mark state
-		std::vector<const gc_object_generic_base*> m_to_mark;
+		std::vector<const void*> m_to_mark;
 
 		// Stats & control values.
 		int m_percent_growth;
 		size_t m_current_heap_bytes;
 		size_t m_next_collection_heap_size;
 		size_t m_last_collection_heap_size;
+		int m_collections;
+		uint64 m_total_pause_ticks;
+		uint64 m_max_pause_ticks;
 
 		singlethreaded_marksweep_state() :
+			m_root_blocks(NULL),
+			m_root_containers(NULL),
+			m_root_pointer_count(0),
+			m_root_container_count(0),
+			m_heap_pointer_count(0),
 			m_percent_growth(100),
 			m_current_heap_bytes(0),
 			m_next_collection_heap_size(1 << 16),
-			m_last_collection_heap_size(1 << 16) {
+			m_last_collection_heap_size(1 << 16),
+			m_collections(0),
+			m_total_pause_ticks(0),
+			m_max_pause_ticks(0) {
 		}
 
 		void set_collection_rate(int percent) {
@@ -103,6 +90,10 @@ namespace tu_gc {
 			m_next_collection_heap_size = static_cast<size_t>(c);
 		}
 
+		//
+		// blocks
+		//
+
 		void* allocate(size_t sz, block_construction_locker_base* lock) {
 			assert(sz > 0);
 			assert(lock);
@@ -111,138 +102,262 @@ namespace tu_gc {
 				// It's time to collect.
 				collect_garbage(NULL);
 			}
-		
-			gc_object_generic_base* block = static_cast<gc_object_generic_base*>(operator new(sz /* + overhead? */));
-			m_heap_blocks.insert(std::make_pair(block, blockinfo(block, sz)));
-			m_current_heap_bytes += sz;
+
+			page* pg;
+			char* block = m_heap.allocate_block(sz, &pg);
+			m_current_heap_bytes += pg->m_block_size;
 
 			// Keep this block from being collected during
 			// construction, before it has a chance to be
 			// assigned to a gc_ptr.
-			m_floating_blocks.insert(block);
+			m_floating_blocks.push_back(block);
 			block_ref(lock) = block;
 
 			return block;
 		}
 
 		void deallocate(void* p) {
-			// assert(no heap pointers inside this block);
-		
-			// Fill with junk.
-			//TODO 0xCAFFE14E
-
-			// Return the memory to the C++ heap.
-			operator delete(p);
+			page* pg = m_heap.find_page(p);
+			assert(pg);
+			int i = pg->block_index(p);
+			assert(pg->block_address(i) == p);
+			m_heap.free_block(pg, i);
+			// Empty pages are released by the sweep.
 		}
 
 		void block_construction_finished(void* block) {
-			floating_blocks_iterator it = m_floating_blocks.find(block);
-			assert(it != m_floating_blocks.end());
-			m_floating_blocks.erase(it);
+			// Usually the newest one.
+			for (int i = int(m_floating_blocks.size()) - 1; i >= 0; i--) {
+				if (m_floating_blocks[i] == block) {
+					m_floating_blocks[i] = m_floating_blocks.back();
+					m_floating_blocks.pop_back();
+					return;
+				}
+			}
+			assert(0);
 		}
 
 		void constructing_gc_object_base(gc_object_generic_base* obj) {
-			heap_block_iterator it = find_containing_block(obj);
-			assert(it != m_heap_blocks.end());  // gc_objects must be constructed on the heap
-			assert(it->second.obj == NULL);
-			it->second.obj = obj;
+			page* pg = m_heap.find_page(obj);
+			assert(pg);  // gc_objects must be constructed on the heap
+			int i = pg->block_index(obj);
+			assert(pg->m_meta[i].m_obj_offset == -1);
+			pg->m_meta[i].m_obj_offset = int((char*) obj - pg->block_address(i));
+		}
+
+		//
+		// roots
+		//
+
+		void add_root_ref(const void* obj) {
+			page* pg = m_heap.find_page(obj);
+			assert(pg);
+			block_meta* meta = &pg->m_meta[pg->block_index(obj)];
+			if (meta->m_root_count++ == 0) {
+				meta->m_prev_root = NULL;
+				meta->m_next_root = m_root_blocks;
+				if (m_root_blocks) {
+					m_root_blocks->m_prev_root = meta;
+				}
+				m_root_blocks = meta;
+			}
+		}
+
+		void remove_root_ref(const void* obj) {
+			page* pg = m_heap.find_page(obj);
+			assert(pg);
+			block_meta* meta = &pg->m_meta[pg->block_index(obj)];
+			assert(meta->m_root_count > 0);
+			if (--meta->m_root_count == 0) {
+				if (meta->m_prev_root) {
+					meta->m_prev_root->m_next_root = meta->m_next_root;
+				} else {
+					m_root_blocks = meta->m_next_root;
+				}
+				if (meta->m_next_root) {
+					meta->m_next_root->m_prev_root = meta->m_prev_root;
+				}
+			}
 		}
 
+		// write_barrier() calls these before it stores the new
+		// value, so *address_of_gc_ptr is still the old value.
+
+		void initing_pointer(void* address_of_gc_ptr, gc_object_generic_base* object_pointed_to) {
+			assert(address_of_gc_ptr);
+			assert(object_pointed_to);
+
+			// Inside a heap block?
+			page* pg = m_heap.find_page(address_of_gc_ptr);
+			if (pg) {
+				int w = pg->word_index(address_of_gc_ptr);
+				assert(get_bit(pg->m_ptrs, w) == false);
+				set_bit(pg->m_ptrs, w);
+				m_heap_pointer_count++;
+			} else {
+				add_root_ref(object_pointed_to);
+				m_root_pointer_count++;
+			}
+		}
+
+		void changing_pointer(void* address_of_gc_ptr, gc_object_generic_base* object_pointed_to) {
+			assert(address_of_gc_ptr);
+			if (m_heap.find_page(address_of_gc_ptr)) {
+				// Heap pointers are read when marking.
+				return;
+			}
+			add_root_ref(object_pointed_to);
+			remove_root_ref(*(void**) address_of_gc_ptr);
+		}
+
+		void clearing_pointer(void* address_of_gc_ptr) {
+			assert(address_of_gc_ptr);
+			page* pg = m_heap.find_page(address_of_gc_ptr);
+			if (pg) {
+				int w = pg->word_index(address_of_gc_ptr);
+				assert(get_bit(pg->m_ptrs, w));
+				clear_bit(pg->m_ptrs, w);
+				m_heap_pointer_count--;
+			} else {
+				remove_root_ref(*(void**) address_of_gc_ptr);
+				m_root_pointer_count--;
+			}
+		}
+
+		void construct_container(gc_container_base* c) {
+			page* pg = m_heap.find_page(c);
+			if (pg) {
+				set_bit(pg->m_containers, pg->word_index(c));
+				pg->m_container_count++;
+			} else {
+				c->m_prev_root = NULL;
+				c->m_next_root = m_root_containers;
+				if (m_root_containers) {
+					m_root_containers->m_prev_root = c;
+				}
+				m_root_containers = c;
+				m_root_container_count++;
+			}
+		}
+
+		void destruct_container(gc_container_base* c) {
+			page* pg = m_heap.find_page(c);
+			if (pg) {
+				clear_bit(pg->m_containers, pg->word_index(c));
+				pg->m_container_count--;
+			} else {
+				if (c->m_prev_root) {
+					c->m_prev_root->m_next_root = c->m_next_root;
+				} else {
+					m_root_containers = c->m_next_root;
+				}
+				if (c->m_next_root) {
+					c->m_next_root->m_prev_root = c->m_prev_root;
+				}
+				m_root_container_count--;
+			}
+		}
+
+		void visit_contained_ptr(const gc_object_generic_base* obj) {
+			if (obj) {
+				m_to_mark.push_back(obj);
+			}
+		}
+
+		//
+		// collection
+		//
+
 		void get_stats(singlethreaded_marksweep::stats* s) {
 			assert(s);
 			s->live_heap_bytes = m_current_heap_bytes;
 			s->garbage_bytes = 0;
-			s->root_pointers = m_roots.size();
-			s->live_pointers = s->root_pointers + m_heap_ptrs.size();
-			s->root_containers = m_root_containers.size();
+			s->root_pointers = m_root_pointer_count;
+			s->live_pointers = m_root_pointer_count + m_heap_pointer_count;
+			s->root_containers = m_root_container_count;
+			s->collections = m_collections;
+			s->total_pause_ticks = m_total_pause_ticks;
+			s->max_pause_ticks = m_max_pause_ticks;
 		}
 
 		void collect_garbage(singlethreaded_marksweep::stats* s) {
+			TU_PROFILE_ZONE("gc::collect_garbage");
+			uint64 start_ticks = tu_timer::get_profile_ticks();
 			size_t precollection_heap_bytes = m_current_heap_bytes;
 
 			mark_live_objects();
 			sweep_dead_objects();
-		
+
 			m_last_collection_heap_size = m_current_heap_bytes;
+			TU_PROFILE_COUNTER("gc live heap bytes", (int) m_current_heap_bytes);
 			set_collection_rate(m_percent_growth);
 
+			uint64 pause_ticks = tu_timer::get_profile_ticks() - start_ticks;
+			m_collections++;
+			m_total_pause_ticks += pause_ticks;
+			if (pause_ticks > m_max_pause_ticks) {
+				m_max_pause_ticks = pause_ticks;
+			}
+
 			if (s) {
-				s->live_heap_bytes = m_current_heap_bytes;
+				get_stats(s);
 				s->garbage_bytes = precollection_heap_bytes - s->live_heap_bytes;
-				s->root_pointers = m_roots.size();
-				s->live_pointers = s->root_pointers + m_heap_ptrs.size();
-				s->root_containers = m_root_containers.size();
 			}
 		}
 
-
 		void mark_live_objects() {
+			TU_PROFILE_ZONE("gc::mark");
 			assert(m_to_mark.size() == 0);
-			m_to_mark.reserve(m_heap_blocks.size() /* heuristic */);
 
 			// Mark all blocks pointed to by roots.
-			for (ptr_iterator it = m_roots.begin();
-			     it != m_roots.end();
-			     ++it) {
-				gc_object_generic_base* p = it->second;
-				assert(p);
-				m_to_mark.push_back(p);
-				//push_heap(m_to_mark);
+			for (block_meta* meta = m_root_blocks; meta; meta = meta->m_next_root) {
+				page* pg = page_of_meta(meta);
+				mark_block(pg, int(meta - pg->m_meta));
 			}
+
 			// Mark all blocks pointed to by root containers.
-			for (container_iterator it_cnt = m_root_containers.begin();
-			     it_cnt != m_root_containers.end();
-			     ++it_cnt) {
-				(*it_cnt)->visit_contained_ptrs();
+			for (gc_container_base* c = m_root_containers; c; c = c->m_next_root) {
+				c->visit_contained_ptrs();
 			}
 
-
 			// Mark all the floating blocks.
-			for (floating_blocks_iterator it = m_floating_blocks.begin();
-			     it != m_floating_blocks.end();
-			     ++it) {
-				assert(*it);
-				m_to_mark.push_back(static_cast<gc_object_generic_base*>(*it));
+			for (size_t i = 0; i < m_floating_blocks.size(); i++) {
+				m_to_mark.push_back(m_floating_blocks[i]);
 			}
 
-			// Flood-fill all reachable objects.
+			// Flood-fill all reachable blocks.
 			while (m_to_mark.size()) {
-				//pop_heap(m_to_mark);
-				const gc_object_generic_base* b = m_to_mark.back();
-				m_to_mark.resize(m_to_mark.size() - 1);
+				const void* p = m_to_mark.back();
+				m_to_mark.pop_back();
 
-				mark_object(b);
+				page* pg = m_heap.find_page(p);
+				assert(pg);
+				mark_block(pg, pg->block_index(p));
 			}
 		}
 
-		void mark_object(const gc_object_generic_base* b) {
-			heap_block_iterator it = find_containing_block(b);
-			assert(it != m_heap_blocks.end());
-			assert(it->second.is_address_inside(b));
-			if (it->second.mark == false) {
-				// Mark this block.
-				it->second.mark = true;
-
-				// Find all gc pointers that are inside this heap block.
-				// Mark the blocks that they point to.
-				ptr_iterator it_ptr = m_heap_ptrs.lower_bound(it->second.p);
-				void* block_end = it->second.end();
-				while (it_ptr != m_heap_ptrs.end() && it_ptr->first < block_end) {
-					gc_object_generic_base* p = it_ptr->second;
-					assert(p);
-					m_to_mark.push_back(p);
-					//push_heap(m_to_mark);
-					++it_ptr;
-				}
+		void mark_block(page* pg, int i) {
+			assert(get_bit(pg->m_allocated, i));
+			if (get_bit(pg->m_marks, i)) {
+				return;
+			}
+			set_bit(pg->m_marks, i);
+
+			// Queue the blocks pointed to by gc pointers
+			// inside this block.
+			char* block = pg->block_address(i);
+			int begin = pg->word_index(block);
+			int end = pg->word_index(block + pg->m_block_size);
+			for (int w = next_bit(pg->m_ptrs, begin, end); w < end; w = next_bit(pg->m_ptrs, w + 1, end)) {
+				const void* p = *(void**) pg->word_address(w);
+				assert(p);
+				m_to_mark.push_back(p);
+			}
 
-				// Find all gc containers that are inside this heap block.
-				{
-					container_iterator it_cnt = m_containers.lower_bound((singlethreaded_marksweep::gc_container_base*) it->second.p);
-					void* block_end = it->second.end();
-					while (it_cnt != m_containers.end() && *it_cnt < block_end) {
-						(*it_cnt)->visit_contained_ptrs();
-						++it_cnt;
-					}
+			// Visit gc containers inside this block.
+			if (pg->m_container_count) {
+				for (int w = next_bit(pg->m_containers, begin, end); w < end; w = next_bit(pg->m_containers, w + 1, end)) {
+					static_cast<gc_container_base*>(pg->word_address(w))->visit_contained_ptrs();
 				}
 			}
 		}
@@ -252,113 +367,39 @@ namespace tu_gc {
 		// is marked is live, and should have its mark
 		// cleared.
 		void sweep_dead_objects() {
+			TU_PROFILE_ZONE("gc::sweep");
 			size_t heap_bytes = 0;
 
-			for (heap_block_iterator it = m_heap_blocks.begin(); it != m_heap_blocks.end(); ) {
-				if (it->second.mark == true) {
-					// Ham.
-					heap_bytes += it->second.sz;
-					it->second.mark = false;
-					++it;
-				} else {
+			page* next = NULL;
+			for (page* pg = m_heap.m_used_pages; pg; pg = next) {
+				next = pg->m_next_used;
+
+				for (int w = 0, n = (pg->m_block_count + 31) / 32; w < n; w++) {
 					// Spam.
-					gc_object_generic_base* block = it->second.obj;
-					assert(block);
-					delete block;
-					m_heap_blocks.erase(it++);
+					uint32 garbage = pg->m_allocated[w] & ~pg->m_marks[w];
+					while (garbage) {
+						int i = w * 32 + lowest_bit(garbage);
+						garbage &= garbage - 1;
+
+						block_meta* meta = &pg->m_meta[i];
+						assert(meta->m_obj_offset >= 0);
+						delete reinterpret_cast<gc_object_generic_base*>(pg->block_address(i) + meta->m_obj_offset);
+					}
+					// Ham.
+					pg->m_marks[w] = 0;
 				}
-			}
 
-			m_current_heap_bytes = heap_bytes;
-		}
-
-		void clearing_pointer(void* address_of_gc_ptr) {
-			assert(address_of_gc_ptr);
-			// remove gcp from pointer list
-			ptr_iterator it = m_heap_ptrs.find(address_of_gc_ptr);
-			if (it != m_heap_ptrs.end()) {
-				m_heap_ptrs.erase(it);
-			} else {
-				it = m_roots.find(address_of_gc_ptr);
-				assert(it != m_roots.end());
-				m_roots.erase(it);
-			}
-		}
-
-		heap_block_iterator find_containing_block(const void* p) {
-			heap_block_iterator it(m_heap_blocks.upper_bound((void*) p));
-			if (it != m_heap_blocks.begin()) {
-				--it;
-				if (p < it->second.end()) {
-					assert(p >= it->second.p);
-					// p is inside this heap block.
-					return it;
+				heap_bytes += size_t(pg->m_live_blocks) * pg->m_block_size;
+				if (pg->m_live_blocks == 0) {
+					m_heap.release_page(pg);
 				}
 			}
-			return m_heap_blocks.end();
-		}
-		
-		// Return true if gcp is inside a heap block.
-		bool inside_heap_block(void* gcp) {
-			heap_block_iterator it = find_containing_block(gcp);
-			if (it != m_heap_blocks.end()) {
-				return true;
-			}
-			return false;
-		}
-
-		void initing_pointer(void* address_of_gc_ptr, gc_object_generic_base* object_pointed_to) {
-			assert(address_of_gc_ptr);
-			assert(object_pointed_to);
-			assert(m_roots.find(address_of_gc_ptr) == m_roots.end());
-			assert(m_heap_ptrs.find(address_of_gc_ptr) == m_heap_ptrs.end());
-		
-			// Inside a heap block?
-			if (inside_heap_block(address_of_gc_ptr)) {
-				m_heap_ptrs.insert(std::make_pair(address_of_gc_ptr, object_pointed_to));
-			} else {
-				m_roots.insert(std::make_pair(address_of_gc_ptr, object_pointed_to));
-			}
-		}
-
-		void changing_pointer(void* address_of_gc_ptr, gc_object_generic_base* object_pointed_to) {
-			assert(address_of_gc_ptr);
-			// remove gcp from pointer list
-			ptr_iterator it = m_heap_ptrs.find(address_of_gc_ptr);
-			if (it != m_heap_ptrs.end()) {
-				it->second = object_pointed_to;
-			} else {
-				it = m_roots.find(address_of_gc_ptr);
-				assert(it != m_roots.end());
-				it->second = object_pointed_to;
-			}
-		}
-
-		void construct_container(singlethreaded_marksweep::gc_container_base* c) {
-			if (inside_heap_block(c)) {
-				m_containers.insert(c);
-			} else {
-				m_root_containers.insert(c);
-			}
-		}
-
-		void destruct_container(singlethreaded_marksweep::gc_container_base* c) {
-			container_iterator it = m_containers.find(c);
-			if (it != m_containers.end()) {
-				m_containers.erase(it);
-			} else {
-				it = m_root_containers.find(c);
-				assert(it != m_root_containers.end());
-				m_root_containers.erase(it);
-			}
-		}
 
-		void visit_contained_ptr(const gc_object_generic_base* obj) {
-			m_to_mark.push_back(obj);
+			m_current_heap_bytes = heap_bytes;
 		}
 
 	} sm_state;
-	
+
 	/*static*/ void singlethreaded_marksweep::get_stats(singlethreaded_marksweep::stats* s) {
 		sm_state.get_stats(s);
 	}
@@ -366,7 +407,7 @@ namespace tu_gc {
 	/*static*/ void singlethreaded_marksweep::collect_garbage(singlethreaded_marksweep::stats* s) {
 		sm_state.collect_garbage(s);
 	}
-	
+
 	/*static*/ void singlethreaded_marksweep::set_collection_rate(
 		int percent_growth_before_next_collection) {
 		sm_state.set_collection_rate(percent_growth_before_next_collection);
@@ -412,134 +453,15 @@ namespace tu_gc {
 		sm_state.visit_contained_ptr(obj);
 	}
 
-	// In the initial implementation, overhead is pretty high.
-	//
-	// Tempting optimizations:
-	//
-	// Use root ref-counts on the blocks (i.e. if a pointer is a
-	// root, inc/dec ref counts on the pointed-to block; if a
-	// pointer is not a root, don't do ref-counting.  This skips
-	// the first step of mark-sweep: no need to mark the blocks
-	// pointed to by roots -- just scan through the heap looking
-	// for blocks that have a positive ref-count; mark their
-	// descendents.
-	//
-	// * maybe not much of a win -- have to scan the heap to get
-	//   the root blocks, instead of walking an internal set.
-	//   Though we could keep a linked list of root blocks, and
-	//   add/remove blocks when their ref counts change to/from
-	//   zero.
+	// Tempting optimizations that are left:
 	//
-	// * not free -- adds a ref count to each block, adds
-	//   ref-count inc/dec to each root ptr change, and we still
-	//   need a fast way to decide if a gc_ptr is a root.
+	// Per-type lists of pointer offsets, recorded when the first
+	// object of a type is constructed, instead of the pointer
+	// bitmaps.  Would save the bitmap scan when marking, but
+	// there's no cheap place to hang the type info.
 	//
-	// Decide if a gc_ptr is a root at construction time and cache
-	// the info -- if it's inside a heap block, it's a heap ptr
-	// until the block is deleted; otherwise it's a root.
-	//
-	// * adds a bit to the gc_ptr.  Bloats the ptr, or else we
-	//   stash it in the low bit or something; requires unmasking
-	//   on pointer use, and re-masking on pointer change.
-	//
-	// * still need a list of roots for initial marking.  Either
-	//   that, or combine with the ref-counting scheme.
-	//
-	// Conservative determination of root ptrs -- bloom filter?
-	// Still need a way for initial marking.
-	//
-	// Use doubly-linked list for m_roots?  Should be an easy win.
-	// Intrudes into the gc_ptr (ideally), so the thing to do is
-	// inject some fields into gc_ptr via a collector-specific
-	// base class.
-	//
-	// How to represent m_heap_ptrs?  The main problem with
-	// m_heap_ptrs is: when marking, how to quickly find all heap
-	// ptrs inside a newly-marked block?  Currently we use
-	// set::lower_bound, which wouldn't work with the linked-list.
-	// One good approach is to have a type spec for each block,
-	// with a list of pointer offsets for each type spec.  The
-	// type spec could be built during object construction and
-	// stored in a hash map.  Most type specs would be reused by
-	// many object instances, so the storage should be much
-	// smaller than currently.  The trick would be making sure
-	// it's cheap to create the type specs, though I suppose it
-	// would be hard to do worse than what we're already doing.
-	//
-	// Put the mark bits in the block headers (duh).
-	//
-	// Put the floating_block bits in the block headers (duh).
-	//
-	// Replace the m_heap_blocks map with links in the block
-	// headers (e.g. maybe a skip list).  This probably saves a
-	// good bit of memory compared to using std::map<>.  Also,
-	// then some of the searches can cache the last position and
-	// proceed from there; this could be a huge win if done right.
+	// Give empty batches of pages back to the C++ heap.  Right
+	// now the small-block heap only grows, though empty pages
+	// are reused by any size class.
 
-
-	// Sketch of an alternative design:
-	//
-	// set<memblock*> m_heap_blocks;
-	// set<pointer_offset_list> m_pointer_lists;
-	// memblock* m_root_list;
-	//
-	// class memblock {
-	//   bool m_mark;
-	//   bool m_under_construction;
-	//   int m_root_ref_count;
-	//   memblock* m_prev_root;
-	//   memblock* m_next_root;
-	//   pointer_offset_list* m_internal_ptrs;
-	//   char data[0];
-	// };
-	//
-	// class gc_ptr {
-	//   bool m_is_root;
-	//   T* m_ptr;
-	// };
-	//
-	// write_barrier(ptr, new_val) {
-	//   if (ptr->m_is_root) {
-	//     increment_ref_count(new_val);
-	//     decrement_ref_count(ptr->get());
-	//   }
-	//   ptr->m_ptr = new_val;
-	// }
-	//
-	// block_construction_finished(block) {
-	//   add m_internal_ptrs to m_pointer_lists;  // share identical instances
-	//   block->m_under_construction = false;
-	// }
-	//
-	// increment_ref_count(block) {
-	//   if (block->m_root_ref_count == 0) {
-	//     link into root blocks;
-	//   }
-	//   block->m_root_ref_count++;
-	// }
-	//
-	// decrement_ref_count(block) {
-	//   block->m_root_ref_count--;
-	//   if (block->m_root_ref_count == 0) {
-	//     unlink from root blocks;
-	//   }
-	// }
-	//
-	// mark() {
-	//   to_mark = addresses of root blocks;
-	//   while (to_mark) {
-	//     memblock* b = get_containing_block(to_mark.pop_back());
-	//     if (!b->m_mark) {
-	//       b->m_mark = true;
-	//       for (p in b->m_internal_ptrs(b)) {
-	//         if (*p) {
-	//           to_mark.push_back(*p);
-	//         }
-	//       }
-	//     }
-	//   }
-	// }
-	
 }  // tu_gc
-
-
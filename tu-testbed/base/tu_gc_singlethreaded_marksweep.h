@@ -9,12 +9,13 @@
 // See tu_gc.h for basic usage.  See the documented methods below for
 // additional (optional) interfaces.
 //
-// This implementation is very vanilla C++ and hopefully portable to
-// any runtime environment, at the expense of not being especially
-// optimized for space or time.
+// This implementation is plain C++ and hopefully portable to any
+// runtime environment.  It keeps its own paged heap, with the
+// collector's bookkeeping in side bitmaps; see the notes at the top
+// of tu_gc_singlethreaded_marksweep.cpp.
 //
-// Performance: it's much slower and uses much more space than manual
-// explicit memory management.  I did some sanity tests using
+// Performance: it's slower and uses more space than manual explicit
+// memory management.  I did some sanity tests using
 // GCBench.cpp (from
 // http://www.hpl.hp.com/personal/Hans_Boehm/gc/gc_bench/) which
 // creates large binary trees.  It's a small synthetic benchmark that
@@ -28,12 +29,26 @@
 // explicit (no gc)                         13 M          6.3 M    5.0 s
 // singlethreaded refcount                  17 M          8   M    5.5 s
 // singlethreaded marksweep                 95 M         30   M   56   s
+//
+// Later, with the paged heap, on Linux (GCBench, default sizes):
+//
+// Collector                  Peak Mem    Time    Pauses    Max pause
+// ---------------------------------------------------------------------
+// explicit (no gc)              18 M    0.5 s
+// singlethreaded refcount       26 M    0.6 s
+// singlethreaded marksweep      33 M    1.9 s       129      31 ms
+//
+// (The std::map-based version of the marksweep collector took 22 s,
+// peaked at 100 M, and paused up to 163 ms, on the same machine.)
 
 
 #include "base/tu_gc.h"
+#include "base/tu_types.h"
 
 namespace tu_gc {
 
+	struct singlethreaded_marksweep_state;
+
 	class singlethreaded_marksweep {
 	public:
 		typedef singlethreaded_marksweep this_class;
@@ -52,6 +67,12 @@ namespace tu_gc {
 			size_t root_pointers;
 			size_t live_pointers;
 			size_t root_containers;
+
+			// Collection pauses since startup, in
+			// tu_timer profile ticks.
+			int collections;
+			uint64 total_pause_ticks;
+			uint64 max_pause_ticks;
 		};
 		// Gets basic stats.  garbage_bytes will be zero
 		// (since we don't know what is garbage) and
@@ -154,6 +175,15 @@ namespace tu_gc {
 			}
 		
 			virtual void visit_contained_ptrs() = 0;
+
+		    private:
+			friend struct singlethreaded_marksweep_state;
+
+			// Links in the collector's list of root
+			// containers (unused for containers inside
+			// heap blocks).
+			gc_container_base* m_prev_root;
+			gc_container_base* m_next_root;
 		};
 
 		// gc_container, for collections of pointers
@@ -16,6 +16,8 @@
 // It does NOT collect cycles.
 
 #include "base/tu_gc.h"
+#include "base/tu_arena.h"
+#include "base/tu_types.h"
 
 namespace tu_gc {
 
@@ -45,6 +47,12 @@ namespace tu_gc {
 			size_t root_pointers;
 			size_t live_pointers;
 			size_t root_containers;
+
+			// Collection pauses since startup, in
+			// tu_timer profile ticks.
+			int collections;
+			uint64 total_pause_ticks;
+			uint64 max_pause_ticks;
 		};
 		// Returns basic stats.  Mostly not applicable to
 		// ref-counting.
@@ -54,6 +62,9 @@ namespace tu_gc {
 			s->root_pointers = 0;
 			s->live_pointers = 0;  // TODO: could track this
 			s->root_containers = 0;
+			s->collections = 0;
+			s->total_pause_ticks = 0;
+			s->max_pause_ticks = 0;
 		}
 
 		// Collects all garbage.
@@ -172,12 +183,13 @@ namespace tu_gc {
 	private:
 		friend class gc_object_base<singlethreaded_refcount>;
 
-		// Used by gc_object_base new/delete.
+		// Used by gc_object_base new/delete.  Small objects
+		// come from the current tu_arena heap, if there is one.
 		static void* allocate(size_t sz, block_construction_locker_base* lock) {
-			return operator new(sz);
+			return tu_arena::allocate(sz);
 		}
 		static void deallocate(void* p) {
-			return operator delete(p);
+			tu_arena::free(p);
 		}
 
 		// Notifications from write_barrier().
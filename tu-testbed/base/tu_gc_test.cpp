@@ -5,11 +5,12 @@
 
 // Some test code for garbage collectors.
 //
-// cl -Zi -GX -GR tu_gc_test.cpp tu_gc_singlethreaded_marksweep.cpp container.cpp utf8.cpp -I.. -DTEST_GC
+// cl -Zi -GX -GR tu_gc_test.cpp tu_gc_singlethreaded_marksweep.cpp tu_gc_incremental_marksweep.cpp tu_arena.cpp tu_profile.cpp tu_file.cpp tu_thread.cpp tu_timer.cpp container.cpp membuf.cpp utf8.cpp utility.cpp -I.. -DTEST_GC
 
 
 #ifdef TEST_GC
 
+#include "base/tu_gc_incremental_marksweep.h"
 #include "base/tu_gc_singlethreaded_marksweep.h"
 #include "base/tu_gc_singlethreaded_refcount.h"
 #include <map>
@@ -20,7 +21,9 @@
 
 namespace test_ms {
 #define GC_COLLECTOR tu_gc::singlethreaded_marksweep
+#define GC_COLLECTS_CYCLES
 #include "base/tu_gc_test_impl.h"
+#undef GC_COLLECTS_CYCLES
 #undef GC_COLLECTOR
 }  // test_ms
 
@@ -29,7 +32,57 @@ namespace test_rc {
 #include "base/tu_gc_test_impl.h"
 #undef GC_COLLECTOR
 }  // test_rc
-	
+
+namespace test_im {
+#define GC_COLLECTOR tu_gc::incremental_marksweep
+#define GC_COLLECTS_CYCLES
+#include "base/tu_gc_test_impl.h"
+#undef GC_COLLECTS_CYCLES
+#undef GC_COLLECTOR
+}  // test_im
+
+// Runs the same random workload under each collector, and under the
+// incremental one with a few different settings; the graphs had better
+// come out the same.
+int run_stress_tests() {
+	const int OPS = 50000;
+	int failures = 0;
+
+	for (int seed = 1; seed <= 3; seed++) {
+		unsigned int expected = test_ms::run_stress_test(seed, OPS);
+		unsigned int results[4];
+		int result_count = 0;
+
+		results[result_count++] = test_rc::run_stress_test(seed, OPS);
+
+		results[result_count++] = test_im::run_stress_test(seed, OPS);
+
+		// Lots of tiny steps, so the barriers see plenty of
+		// marking in progress.
+		tu_gc::incremental_marksweep::set_collection_rate(10);
+		tu_gc::incremental_marksweep::set_step_budget(5);
+		results[result_count++] = test_im::run_stress_test(seed, OPS);
+
+		tu_gc::incremental_marksweep::set_mark_threads(4);
+		results[result_count++] = test_im::run_stress_test(seed, OPS);
+
+		tu_gc::incremental_marksweep::set_mark_threads(1);
+		tu_gc::incremental_marksweep::set_step_budget(1000);
+		tu_gc::incremental_marksweep::set_collection_rate(100);
+
+		for (int i = 0; i < result_count; i++) {
+			if (results[i] != expected) {
+				printf("seed %d: run %d got checksum %08x, expected %08x\n", seed, i, results[i], expected);
+				failures++;
+			}
+		}
+	}
+
+	failures += test_ms::s_stress_failures + test_rc::s_stress_failures + test_im::s_stress_failures;
+	printf(failures ? "stress test FAILED\n" : "stress test ok\n");
+	return failures;
+}
+
 int main() {
 	printf("\nmark-sweep:\n\n");
 	test_ms::run_tests();
@@ -37,7 +90,11 @@ int main() {
 	printf("\nref-counting:\n\n");
 	test_rc::run_tests();
 
-	return 0;
+	printf("\nincremental mark-sweep:\n\n");
+	test_im::run_tests();
+
+	printf("\nstress:\n\n");
+	return run_stress_tests() ? 1 : 0;
 }
 
 
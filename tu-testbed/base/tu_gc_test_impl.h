@@ -303,6 +303,237 @@ void test_weak_ptr() {
 	}
 }
 
+// Stress test: random changes to a graph of objects, with roots on
+// the stack and in a root container, and pointers in objects and in
+// containers inside objects.  Every so often, collects and checks
+// that exactly the reachable objects are still alive (for a
+// ref-counter, at least those).  Returns a checksum of the graph,
+// which should come out the same under every collector.
+
+const int STRESS_ROOTS = 64;
+const int STRESS_MAGIC = 0x5EED5EED;
+
+int s_stress_live = 0;
+int s_stress_failures = 0;
+
+struct stress_node : public gc_object, public weak_pointee_mixin {
+	stress_node(int id) : m_id(id), m_magic(STRESS_MAGIC) {
+		s_stress_live++;
+	}
+	~stress_node() {
+		assert(m_magic == STRESS_MAGIC);
+		m_magic = 0;
+		s_stress_live--;
+	}
+
+	int m_id;
+	int m_magic;
+	gc_ptr<stress_node> m_a;
+	gc_ptr<stress_node> m_b;
+	gc_vector<gc_ptr<stress_node> > m_children;
+};
+
+// Same sequence everywhere, unlike rand().
+struct stress_random {
+	stress_random(int seed) : m_state(seed) {
+	}
+	// Returns a number in [0, n).
+	int next(int n) {
+		m_state = m_state * 1664525u + 1013904223u;
+		return int((m_state >> 8) % (unsigned int) n);
+	}
+	unsigned int m_state;
+};
+
+// Takes a short random walk from a random root.
+stress_node* stress_pick(gc_ptr<stress_node>* roots, stress_random* r) {
+	stress_node* x = roots[r->next(STRESS_ROOTS)].get();
+	for (int steps = r->next(4); x && steps > 0; steps--) {
+		stress_node* y = NULL;
+		switch (r->next(3)) {
+		case 0:
+			y = x->m_a.get();
+			break;
+		case 1:
+			y = x->m_b.get();
+			break;
+		default:
+			if (x->m_children.size()) {
+				y = x->m_children[r->next(x->m_children.size())].get();
+			}
+			break;
+		}
+		if (y) {
+			x = y;
+		}
+	}
+	return x;
+}
+
+// Walks everything reachable from x that isn't in *visited yet,
+// checking each object, and folds the ids into *checksum.  Stops
+// once *visited holds limit objects.
+void stress_walk(stress_node* x, std::set<stress_node*>* visited, unsigned int* checksum, size_t limit = size_t(-1)) {
+	std::vector<stress_node*> stack;
+	stack.push_back(x);
+	while (stack.size() && visited->size() < limit) {
+		x = stack.back();
+		stack.pop_back();
+		if (x == NULL || visited->find(x) != visited->end()) {
+			continue;
+		}
+		visited->insert(x);
+		if (x->m_magic != STRESS_MAGIC) {
+			printf("stress: reachable object %p is dead\n", x);
+			s_stress_failures++;
+			continue;
+		}
+		*checksum = *checksum * 31 + x->m_id;
+		stack.push_back(x->m_a.get());
+		stack.push_back(x->m_b.get());
+		for (int i = int(x->m_children.size()) - 1; i >= 0; i--) {
+			stack.push_back(x->m_children[i].get());
+		}
+	}
+}
+
+unsigned int stress_checksum(gc_ptr<stress_node>* roots, gc_vector<gc_ptr<stress_node> >* root_list, std::set<stress_node*>* visited) {
+	unsigned int checksum = 0;
+	for (int i = 0; i < STRESS_ROOTS; i++) {
+		stress_walk(roots[i].get(), visited, &checksum);
+	}
+	for (size_t i = 0; i < root_list->size(); i++) {
+		stress_walk((*root_list)[i].get(), visited, &checksum);
+	}
+	return checksum;
+}
+
+void stress_check_live(gc_ptr<stress_node>* roots, gc_vector<gc_ptr<stress_node> >* root_list, const gc_ptr<stress_node>& scratch) {
+	gc_collector::collect_garbage(NULL);
+
+	std::set<stress_node*> visited;
+	unsigned int checksum = stress_checksum(roots, root_list, &visited);
+	stress_walk(scratch.get(), &visited, &checksum);
+	int reachable = int(visited.size());
+#ifdef GC_COLLECTS_CYCLES
+	bool ok = s_stress_live == reachable;
+#else
+	bool ok = s_stress_live >= reachable;
+#endif
+	if (!ok) {
+		printf("stress: %d objects alive, %d reachable\n", s_stress_live, reachable);
+		s_stress_failures++;
+	}
+}
+
+unsigned int run_stress_test(int seed, int op_count) {
+	stress_random r(seed);
+	int next_id = 0;
+
+	gc_ptr<stress_node> roots[STRESS_ROOTS];
+	gc_vector<gc_ptr<stress_node> > root_list;
+
+	// Holds objects brought back through a weak_ptr.  Not
+	// part of the checksum: under a ref-counter they're gone
+	// sooner.
+	gc_ptr<stress_node> scratch = new stress_node(-1);
+	weak_ptr<stress_node> weak;
+
+	for (int op = 0; op < op_count; op++) {
+		stress_node* x = NULL;
+		stress_node* y = NULL;
+		switch (r.next(10)) {
+		case 0:
+			roots[r.next(STRESS_ROOTS)] = new stress_node(next_id++);
+			break;
+		case 1:
+			if (r.next(4) == 0) {
+				roots[r.next(STRESS_ROOTS)] = NULL;
+			}
+			break;
+		case 2:
+			// May make a cycle, or cut something loose.
+			x = stress_pick(roots, &r);
+			y = stress_pick(roots, &r);
+			if (x) {
+				if (r.next(2)) {
+					x->m_a = y;
+				} else {
+					x->m_b = y;
+				}
+			}
+			break;
+		case 3:
+			x = stress_pick(roots, &r);
+			if (x) {
+				x->m_a = new stress_node(next_id++);
+				x->m_a->m_b = new stress_node(next_id++);
+			}
+			break;
+		case 4:
+			x = stress_pick(roots, &r);
+			y = stress_pick(roots, &r);
+			if (x && y) {
+				x->m_children.push_back(y);
+			}
+			break;
+		case 5:
+			x = stress_pick(roots, &r);
+			if (x && x->m_children.size()) {
+				x->m_children.erase(x->m_children.begin() + r.next(x->m_children.size()));
+			}
+			break;
+		case 6:
+			x = stress_pick(roots, &r);
+			if (x) {
+				if (r.next(8) == 0) {
+					x->m_children.clear();
+				} else {
+					x->m_children.push_back(new stress_node(next_id++));
+				}
+			}
+			break;
+		case 7:
+			x = stress_pick(roots, &r);
+			if (x) {
+				root_list.push_back(x);
+				if (root_list.size() > 1024) {
+					root_list.erase(root_list.begin());
+				}
+			}
+			break;
+		case 8:
+			if (root_list.size()) {
+				roots[r.next(STRESS_ROOTS)] = root_list[r.next(root_list.size())].get();
+			}
+			break;
+		default:
+			x = stress_pick(roots, &r);
+			if (x) {
+				weak = x;
+			}
+			if (gc_ptr<stress_node> p = weak.get_ptr()) {
+				std::set<stress_node*> visited;
+				unsigned int ignored = 0;
+				stress_walk(p.get(), &visited, &ignored, 256);
+				scratch->m_a = p;
+			}
+			break;
+		}
+
+		if (op % 5000 == 4999) {
+			stress_check_live(roots, &root_list, scratch);
+		}
+	}
+
+	stress_check_live(roots, &root_list, scratch);
+	std::set<stress_node*> visited;
+	unsigned int checksum = stress_checksum(roots, &root_list, &visited);
+
+	printf("seed %d: checksum %08x\n", seed, checksum);
+	return checksum;
+}
+
 void run_tests() {
 	test_basic_stuff();
 	test_multiple_inheritance();
@@ -0,0 +1,496 @@
+// tu_profile.cpp	-- lightweight instrumenting profiler
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Lightweight instrumenting profiler; see tu_profile.h.
+//
+// Each thread gets a thread_buffer the first time it records
+// something.  The buffers go on a list that's only ever pushed onto
+// (with compare-and-swap), and live until exit, so write_chrome_trace()
+// can walk the list without locks, and still find the events of
+// threads that have finished.  Only the owning thread writes a
+// buffer; it publishes each event by storing the new head index.
+
+
+#include "base/tu_profile.h"
+#include "base/tu_atomic.h"
+#include "base/tu_file.h"
+#include "base/utility.h"
+#include <string.h>
+
+
+namespace tu_profile
+{
+	volatile bool	s_enabled = false;
+}
+
+
+namespace {
+// anonymous namespace to hold local stuff.
+
+
+enum event_type
+{
+	ZONE,
+	COUNTER
+};
+
+
+struct event
+{
+	const char*	m_name;
+	int	m_type;
+	int	m_value;	// COUNTER
+	uint64	m_start_ticks;
+	uint64	m_end_ticks;	// ZONE
+};
+
+
+struct thread_buffer
+{
+	event* volatile	m_events;	// made on the first event
+	int	m_mask;			// size - 1
+	volatile int	m_head;		// next slot to write
+	volatile int	m_wrapped;	// set once m_head has gone around
+	int	m_thread_index;
+	char	m_name[32];
+	thread_buffer*	m_next;
+};
+
+
+thread_buffer* volatile	s_buffers = NULL;
+volatile int	s_thread_count = 0;
+int	s_buffer_size = 1 << 15;
+
+// Events older than this are ignored by write_chrome_trace().
+volatile uint64	s_clear_ticks = 0;
+
+TU_THREAD_LOCAL thread_buffer*	s_thread_buffer = NULL;
+
+
+thread_buffer*	get_thread_buffer()
+// The calling thread's buffer; makes it, and puts it on the list,
+// the first time.
+{
+	thread_buffer*	b = s_thread_buffer;
+	if (b)
+	{
+		return b;
+	}
+
+	b = new thread_buffer;
+	b->m_events = NULL;
+	b->m_mask = 0;
+	b->m_head = 0;
+	b->m_wrapped = 0;
+	b->m_thread_index = tu_atomic_increment(&s_thread_count);
+	b->m_name[0] = 0;
+	do
+	{
+		b->m_next = tu_atomic_load_ptr(&s_buffers);
+	}
+	while (tu_atomic_compare_and_swap_ptr(&s_buffers, b->m_next, b) == false);
+
+	s_thread_buffer = b;
+	return b;
+}
+
+
+void	push_event(const event& e)
+// Append to the calling thread's ring.
+{
+	thread_buffer*	b = get_thread_buffer();
+	if (b->m_events == NULL)
+	{
+		int	size = 1;
+		while (size < s_buffer_size)
+		{
+			size <<= 1;
+		}
+		b->m_mask = size - 1;
+		tu_atomic_store_ptr(&b->m_events, new event[size]);
+	}
+
+	int	head = b->m_head;
+	b->m_events[head] = e;
+	head = (head + 1) & b->m_mask;
+	if (head == 0)
+	{
+		tu_atomic_store(&b->m_wrapped, 1);
+	}
+	tu_atomic_store(&b->m_head, head);
+}
+
+
+struct buffer_view
+// A snapshot of the published part of a thread_buffer: the events
+// [m_first, m_first + m_count), modulo the buffer size.
+{
+	const event*	m_events;
+	int	m_mask;
+	int	m_first;
+	int	m_count;
+
+	buffer_view(const thread_buffer* b)
+	{
+		m_events = tu_atomic_load_ptr(&b->m_events);
+		int	head = tu_atomic_load(&b->m_head);
+		bool	wrapped = tu_atomic_load(&b->m_wrapped) != 0;
+		m_mask = b->m_mask;
+		if (m_events == NULL)
+		{
+			m_first = m_count = 0;
+		}
+		else if (wrapped)
+		{
+			m_first = head;
+			m_count = m_mask + 1;
+		}
+		else
+		{
+			m_first = 0;
+			m_count = head;
+		}
+	}
+
+	const event&	get(int i) const { return m_events[(m_first + i) & m_mask]; }
+};
+
+
+bool	is_wanted(const event& e)
+// False for events from before the last clear(), and ones that got
+// torn by a wrap while we were reading them.
+{
+	if (e.m_name == NULL || e.m_start_ticks < s_clear_ticks)
+	{
+		return false;
+	}
+	if (e.m_type == ZONE && e.m_end_ticks < e.m_start_ticks)
+	{
+		return false;
+	}
+	return true;
+}
+
+
+void	write_json_string(tu_file* out, const char* s)
+{
+	out->write_byte('"');
+	for ( ; *s; s++)
+	{
+		if (*s == '"' || *s == '\\')
+		{
+			out->write_byte('\\');
+			out->write_byte(*s);
+		}
+		else if ((unsigned char) *s < 0x20)
+		{
+			out->printf("\\u%04x", (unsigned char) *s);
+		}
+		else
+		{
+			out->write_byte(*s);
+		}
+	}
+	out->write_byte('"');
+}
+
+
+double	ticks_to_microseconds(uint64 ticks)
+{
+	return tu_timer::profile_ticks_to_seconds(ticks) * 1000000.0;
+}
+
+
+}	// end anonymous namespace
+
+
+namespace tu_profile
+{
+	void	set_enabled(bool enabled)
+	{
+		if (enabled)
+		{
+			// Make our buffer now, rather than in the
+			// middle of the first zone.
+			get_thread_buffer();
+		}
+		s_enabled = enabled;
+	}
+
+
+	void	set_buffer_size(int events)
+	{
+		s_buffer_size = imax(events, 1);
+	}
+
+
+	void	set_thread_name(const char* name)
+	{
+		thread_buffer*	b = get_thread_buffer();
+		strncpy(b->m_name, name, sizeof(b->m_name) - 1);
+		b->m_name[sizeof(b->m_name) - 1] = 0;
+	}
+
+
+	void	record_zone(const char* name, uint64 start_ticks, uint64 end_ticks)
+	{
+		event	e;
+		e.m_name = name;
+		e.m_type = ZONE;
+		e.m_value = 0;
+		e.m_start_ticks = start_ticks;
+		e.m_end_ticks = end_ticks;
+		push_event(e);
+	}
+
+
+	void	record_counter(const char* name, int value)
+	{
+		event	e;
+		e.m_name = name;
+		e.m_type = COUNTER;
+		e.m_value = value;
+		e.m_start_ticks = tu_timer::get_profile_ticks();
+		e.m_end_ticks = e.m_start_ticks;
+		push_event(e);
+	}
+
+
+	int	write_chrome_trace(tu_file* out)
+	// See https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+	// for the format.  Times are in microseconds, from the
+	// earliest event.
+	{
+		// Find the earliest event.
+		uint64	base_ticks = 0;
+		bool	have_base = false;
+		for (thread_buffer* b = tu_atomic_load_ptr(&s_buffers); b; b = b->m_next)
+		{
+			buffer_view	v(b);
+			for (int i = 0; i < v.m_count; i++)
+			{
+				const event&	e = v.get(i);
+				if (is_wanted(e) && (have_base == false || e.m_start_ticks < base_ticks))
+				{
+					base_ticks = e.m_start_ticks;
+					have_base = true;
+				}
+			}
+		}
+
+		int	event_count = 0;
+		out->printf("{\"traceEvents\":[\n");
+		for (thread_buffer* b = tu_atomic_load_ptr(&s_buffers); b; b = b->m_next)
+		{
+			// Thread name.
+			out->printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+				    b->m_thread_index);
+			if (b->m_name[0])
+			{
+				write_json_string(out, b->m_name);
+			}
+			else
+			{
+				out->printf("\"thread %d\"", b->m_thread_index);
+			}
+			out->printf("}}");
+
+			buffer_view	v(b);
+			for (int i = 0; i < v.m_count; i++)
+			{
+				event	e = v.get(i);
+				if (is_wanted(e) == false)
+				{
+					continue;
+				}
+
+				out->printf(",\n{\"name\":");
+				write_json_string(out, e.m_name);
+				double	ts = ticks_to_microseconds(e.m_start_ticks - base_ticks);
+				if (e.m_type == ZONE)
+				{
+					out->printf(",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+						    b->m_thread_index, ts,
+						    ticks_to_microseconds(e.m_end_ticks - e.m_start_ticks));
+				}
+				else
+				{
+					out->printf(",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"value\":%d}}",
+						    b->m_thread_index, ts, e.m_value);
+				}
+				event_count++;
+			}
+			if (b->m_next)
+			{
+				out->printf(",\n");
+			}
+		}
+		out->printf("\n]}\n");
+
+		return event_count;
+	}
+
+
+	void	clear()
+	{
+		s_clear_ticks = tu_timer::get_profile_ticks();
+	}
+}
+
+
+#ifdef TU_PROFILE_TEST
+
+
+// Records zones from a few threads, checks what comes out, and
+// measures the cost of a zone with profiling off and on.
+//
+// g++ tu_profile.cpp tu_file.cpp tu_thread.cpp tu_timer.cpp container.cpp membuf.cpp utf8.cpp utility.cpp -O2 -I.. -DTU_PROFILE_TEST -DTU_CONFIG_LINK_TO_THREAD=2 -lpthread -o tu_profile_test
+
+
+#include "base/membuf.h"
+#include "base/tu_thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+
+static volatile int	s_sink = 0;
+
+
+static void	busy_work(int n)
+{
+	TU_PROFILE_ZONE("busy_work");
+	for (int i = 0; i < n; i++)
+	{
+		s_sink += i;
+	}
+}
+
+
+static void	worker(void* arg, int index)
+{
+	TU_PROFILE_ZONE("worker");
+	TU_PROFILE_COUNTER("worker index", index);
+	for (int i = 0; i < 10; i++)
+	{
+		busy_work(1000);
+	}
+}
+
+
+static void	many_zones(void* arg)
+{
+	for (int i = 0; i < 100; i++)
+	{
+		busy_work(10);
+	}
+}
+
+
+static int	count_substrings(const char* s, int len, const char* pattern)
+{
+	int	count = 0;
+	int	plen = strlen(pattern);
+	for (int i = 0; i + plen <= len; i++)
+	{
+		if (memcmp(s + i, pattern, plen) == 0)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+
+static double	time_zones(int n)
+// Nanoseconds per empty zone.
+{
+	uint64	start = tu_timer::get_profile_ticks();
+	for (int i = 0; i < n; i++)
+	{
+		TU_PROFILE_ZONE("empty");
+	}
+	return tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start) * 1e9 / n;
+}
+
+
+static bool	check_trace(const char* label, int expected_events, int expected_zones)
+{
+	tu_file	out(tu_file::memory_buffer);
+	int	count = tu_profile::write_chrome_trace(&out);
+
+	membuf	json;
+	out.set_position(0);
+	out.copy_to(&json);
+	const char*	s = (const char*) json.data();
+	int	zones = count_substrings(s, json.size(), "\"name\":\"busy_work\"");
+
+	bool	ok = count == expected_events && zones == expected_zones
+		&& json.size() > 16 && memcmp(s, "{\"traceEvents\":[", 16) == 0
+		&& memcmp(s + json.size() - 4, "\n]}\n", 4) == 0;
+	printf("%s: %d events, %d busy_work zones, %d bytes of JSON: %s\n",
+	       label, count, zones, json.size(), ok ? "ok" : "FAILED");
+	return ok;
+}
+
+
+int	main(int argc, const char** argv)
+{
+	bool	ok = true;
+	tu_thread::pool	pool(4);
+
+	// Nothing is recorded while disabled.
+	pool.run(worker, NULL, 8);
+	ok = check_trace("disabled", 0, 0) && ok;
+
+	tu_profile::set_enabled(true);
+	tu_profile::set_thread_name("main \"thread\"");
+	pool.run(worker, NULL, 8);
+	tu_profile::set_enabled(false);
+
+	// 8 workers x (1 + 10 zones, 1 counter).
+	ok = check_trace("enabled", 8 * 12, 80) && ok;
+
+	if (argc > 1)
+	{
+		tu_file	out(argv[1], "wb");
+		tu_profile::write_chrome_trace(&out);
+		printf("wrote %s\n", argv[1]);
+	}
+
+	tu_profile::clear();
+	ok = check_trace("cleared", 0, 0) && ok;
+
+	// A small buffer (on a new thread) keeps only the newest
+	// events.
+	tu_profile::set_buffer_size(16);
+	tu_profile::set_enabled(true);
+	{
+		tu_thread::thread	t(many_zones, NULL);
+		t.wait();
+	}
+	tu_profile::set_enabled(false);
+	ok = check_trace("wrapped", 16, 16) && ok;
+
+	const int	N = 10000000;
+	tu_profile::set_buffer_size(1 << 15);
+	printf("zone cost: %.2f ns disabled, ", time_zones(N));
+	tu_profile::set_enabled(true);
+	printf("%.2f ns enabled\n", time_zones(N));
+	tu_profile::set_enabled(false);
+
+	printf(ok ? "OK\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
+
+
+#endif // TU_PROFILE_TEST
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
@@ -0,0 +1,126 @@
+// tu_profile.h	-- lightweight instrumenting profiler
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Lightweight instrumenting profiler.  Mark a scope with
+//
+//	TU_PROFILE_ZONE("root::advance");
+//
+// and, while profiling is enabled, each pass through the scope is
+// recorded with its start & end time.  TU_PROFILE_COUNTER() records
+// a value over time (heap size, queue length, ...).  Events go into
+// a ring buffer owned by the recording thread, so recording takes no
+// locks; when a buffer fills, its oldest events are overwritten.
+// write_chrome_trace() dumps everything as JSON that chrome://tracing
+// (or Perfetto) can load.
+//
+// Zone and counter names must be string literals (or otherwise live
+// forever); only the pointer is stored.
+//
+// While profiling is disabled (the default), a zone costs a load and
+// a branch.  Build with TU_CONFIG_PROFILE 0 to compile the zones out
+// entirely.
+
+
+#ifndef TU_PROFILE_H
+#define TU_PROFILE_H
+
+
+#include "base/tu_config.h"
+#include "base/tu_types.h"
+#include "base/tu_timer.h"
+
+class tu_file;
+
+
+namespace tu_profile
+{
+	// Runtime switch.  Turning it on makes the calling thread's
+	// buffer (and each other thread's, on its first event).
+	exported_module void	set_enabled(bool enabled);
+	inline bool	is_enabled();
+
+	// Events per thread buffer; rounded up to a power of two.
+	// Only affects buffers made after the call.  The default is
+	// 32768 (about 1 MB).
+	exported_module void	set_buffer_size(int events);
+
+	// Name the calling thread, for the trace.  name is copied.
+	exported_module void	set_thread_name(const char* name);
+
+	// Recording; normally called via the macros below.
+	exported_module void	record_zone(const char* name, uint64 start_ticks, uint64 end_ticks);
+	exported_module void	record_counter(const char* name, int value);
+
+	// Write the events in all the thread buffers in the Chrome
+	// trace event format.  Events recorded while this runs may or
+	// may not make it in; the few at the point where a buffer wraps
+	// can come out garbled, so for clean traces, call it while
+	// things are quiet (or after set_enabled(false)).  Returns the
+	// number of events written.
+	exported_module int	write_chrome_trace(tu_file* out);
+
+	// Drop all recorded events.  Same caveat as above.
+	exported_module void	clear();
+
+
+	// Implementation.
+
+	extern exported_module volatile bool	s_enabled;
+
+	inline bool	is_enabled()
+	{
+		return s_enabled;
+	}
+
+	struct zone
+	// Records the time from construction to destruction.
+	{
+		zone(const char* name)
+			:
+			m_name(name),
+			m_start_ticks(s_enabled ? tu_timer::get_profile_ticks() : 0)
+		{
+		}
+
+		~zone()
+		{
+			if (m_start_ticks)
+			{
+				record_zone(m_name, m_start_ticks, tu_timer::get_profile_ticks());
+			}
+		}
+
+	private:
+		const char*	m_name;
+		uint64	m_start_ticks;	// 0 if profiling was off
+	};
+}
+
+
+#if TU_CONFIG_PROFILE
+
+#define TU_PROFILE_CONCAT2(a, b) a##b
+#define TU_PROFILE_CONCAT(a, b) TU_PROFILE_CONCAT2(a, b)
+
+#define TU_PROFILE_ZONE(name)	tu_profile::zone	TU_PROFILE_CONCAT(tu_profile_zone_, __LINE__)(name)
+#define TU_PROFILE_COUNTER(name, value)	(tu_profile::s_enabled ? tu_profile::record_counter((name), (value)) : (void) 0)
+
+#else // not TU_CONFIG_PROFILE
+
+#define TU_PROFILE_ZONE(name)
+#define TU_PROFILE_COUNTER(name, value)	((void) 0)
+
+#endif // not TU_CONFIG_PROFILE
+
+
+#endif // TU_PROFILE_H
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
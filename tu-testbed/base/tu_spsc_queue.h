@@ -0,0 +1,129 @@
+// tu_spsc_queue.h	-- bounded lock-free queue for one producer & one consumer
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Fixed-capacity FIFO that one thread can push into while another
+// thread pops from it, with no locking.  Neither side ever blocks;
+// push() fails when the queue is full and pop() fails when it's
+// empty.  If several threads need to push, serialize them with a
+// mutex on the producer side -- the consumer still doesn't lock.
+//
+// T should be a small plain-old-data type; it is copied in and out.
+
+
+#ifndef TU_SPSC_QUEUE_H
+#define TU_SPSC_QUEUE_H
+
+
+#include "base/tu_atomic.h"
+#include "base/utility.h"
+
+
+template<class T>
+class tu_spsc_queue
+{
+public:
+	tu_spsc_queue(int capacity)
+		:
+		m_head(0),
+		m_tail(0)
+	{
+		assert(capacity > 0);
+
+		// Round up to a power of two, plus the one slot that
+		// distinguishes full from empty.
+		int	size = 2;
+		while (size < capacity + 1)
+		{
+			size <<= 1;
+		}
+		m_mask = size - 1;
+		m_buffer = new T[size];
+	}
+
+	~tu_spsc_queue()
+	{
+		delete [] m_buffer;
+	}
+
+	int	capacity() const { return m_mask; }
+
+	// Producer side.
+
+	bool	push(const T& value)
+	// Returns false (and drops nothing) if the queue is full.
+	{
+		int	head = m_head;
+		int	next = (head + 1) & m_mask;
+		if (next == tu_atomic_load(&m_tail))
+		{
+			return false;
+		}
+		m_buffer[head] = value;
+		tu_atomic_store(&m_head, next);
+		return true;
+	}
+
+	// Consumer side.
+
+	bool	is_empty() const
+	{
+		return m_tail == tu_atomic_load(&m_head);
+	}
+
+	T*	front()
+	// Returns the oldest element without removing it, or NULL if
+	// the queue is empty.
+	{
+		int	tail = m_tail;
+		if (tail == tu_atomic_load(&m_head))
+		{
+			return NULL;
+		}
+		return &m_buffer[tail];
+	}
+
+	bool	pop(T* value)
+	// Copies out and removes the oldest element.  Returns false if
+	// the queue is empty.
+	{
+		T*	f = front();
+		if (f == NULL)
+		{
+			return false;
+		}
+		if (value)
+		{
+			*value = *f;
+		}
+		tu_atomic_store(&m_tail, (m_tail + 1) & m_mask);
+		return true;
+	}
+
+private:
+	// Not copyable.
+	tu_spsc_queue(const tu_spsc_queue&);
+	void	operator=(const tu_spsc_queue&);
+
+	T*	m_buffer;
+	int	m_mask;
+
+	// Written by the producer only.
+	volatile int	m_head;
+
+	// Written by the consumer only.  (Ideally on a separate cache
+	// line from m_head.)
+	volatile int	m_tail;
+};
+
+
+#endif // TU_SPSC_QUEUE_H
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
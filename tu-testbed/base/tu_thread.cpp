@@ -0,0 +1,324 @@
+// tu_thread.cpp	-- threads, mutexes & condition variables
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// SDL, pthreads and no-threads versions of tu_thread.h.
+
+
+#include "base/tu_thread.h"
+#include "base/tu_atomic.h"
+#include "base/utility.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+
+#if TU_CONFIG_LINK_TO_THREAD == 1
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+namespace tu_thread
+{
+	struct start_info
+	{
+		start_func	m_func;
+		void*	m_arg;
+	};
+
+	static int	sdl_start(void* arg)
+	{
+		start_info	info = *(start_info*) arg;
+		delete (start_info*) arg;
+		info.m_func(info.m_arg);
+		return 0;
+	}
+
+	thread::thread(start_func fn, void* arg)
+	{
+		start_info*	info = new start_info;
+		info->m_func = fn;
+		info->m_arg = arg;
+		m_handle = SDL_CreateThread(sdl_start, info);
+		assert(m_handle);
+	}
+
+	void	thread::wait()
+	{
+		if (m_handle)
+		{
+			SDL_WaitThread((SDL_Thread*) m_handle, NULL);
+			m_handle = NULL;
+		}
+	}
+
+	mutex::mutex() { m_handle = SDL_CreateMutex(); }
+	mutex::~mutex() { SDL_DestroyMutex((SDL_mutex*) m_handle); }
+	void	mutex::lock() { SDL_LockMutex((SDL_mutex*) m_handle); }
+	void	mutex::unlock() { SDL_UnlockMutex((SDL_mutex*) m_handle); }
+
+	condition::condition() { m_handle = SDL_CreateCond(); }
+	condition::~condition() { SDL_DestroyCond((SDL_cond*) m_handle); }
+	void	condition::wait(mutex* m) { SDL_CondWait((SDL_cond*) m_handle, (SDL_mutex*) m->m_handle); }
+	void	condition::signal() { SDL_CondSignal((SDL_cond*) m_handle); }
+	void	condition::broadcast() { SDL_CondBroadcast((SDL_cond*) m_handle); }
+}
+
+
+#elif TU_CONFIG_LINK_TO_THREAD == 2
+
+#include <pthread.h>
+
+namespace tu_thread
+{
+	struct start_info
+	{
+		start_func	m_func;
+		void*	m_arg;
+	};
+
+	static void*	pthread_start(void* arg)
+	{
+		start_info	info = *(start_info*) arg;
+		delete (start_info*) arg;
+		info.m_func(info.m_arg);
+		return NULL;
+	}
+
+	thread::thread(start_func fn, void* arg)
+	{
+		start_info*	info = new start_info;
+		info->m_func = fn;
+		info->m_arg = arg;
+
+		pthread_t*	t = new pthread_t;
+		int	result = pthread_create(t, NULL, pthread_start, info);
+		assert(result == 0);
+		UNUSED(result);
+		m_handle = t;
+	}
+
+	void	thread::wait()
+	{
+		if (m_handle)
+		{
+			pthread_join(*(pthread_t*) m_handle, NULL);
+			delete (pthread_t*) m_handle;
+			m_handle = NULL;
+		}
+	}
+
+	mutex::mutex()
+	{
+		pthread_mutex_t*	m = new pthread_mutex_t;
+		pthread_mutex_init(m, NULL);
+		m_handle = m;
+	}
+
+	mutex::~mutex()
+	{
+		pthread_mutex_destroy((pthread_mutex_t*) m_handle);
+		delete (pthread_mutex_t*) m_handle;
+	}
+
+	void	mutex::lock() { pthread_mutex_lock((pthread_mutex_t*) m_handle); }
+	void	mutex::unlock() { pthread_mutex_unlock((pthread_mutex_t*) m_handle); }
+
+	condition::condition()
+	{
+		pthread_cond_t*	c = new pthread_cond_t;
+		pthread_cond_init(c, NULL);
+		m_handle = c;
+	}
+
+	condition::~condition()
+	{
+		pthread_cond_destroy((pthread_cond_t*) m_handle);
+		delete (pthread_cond_t*) m_handle;
+	}
+
+	void	condition::wait(mutex* m) { pthread_cond_wait((pthread_cond_t*) m_handle, (pthread_mutex_t*) m->m_handle); }
+	void	condition::signal() { pthread_cond_signal((pthread_cond_t*) m_handle); }
+	void	condition::broadcast() { pthread_cond_broadcast((pthread_cond_t*) m_handle); }
+}
+
+
+#else // no threads
+
+
+namespace tu_thread
+{
+	thread::thread(start_func fn, void* arg) : m_handle(NULL) { fn(arg); }
+	void	thread::wait() {}
+
+	mutex::mutex() : m_handle(NULL) {}
+	mutex::~mutex() {}
+	void	mutex::lock() {}
+	void	mutex::unlock() {}
+
+	condition::condition() : m_handle(NULL) {}
+	condition::~condition() {}
+	void	condition::wait(mutex* m)
+	{
+		// Nobody else could ever signal us.
+		assert(0);
+	}
+	void	condition::signal() {}
+	void	condition::broadcast() {}
+}
+
+
+#endif // no threads
+
+
+namespace tu_thread
+{
+	thread::~thread()
+	{
+		wait();
+	}
+
+
+	int	get_processor_count()
+	{
+#if TU_CONFIG_LINK_TO_THREAD == 0
+		return 1;
+#elif defined(_WIN32)
+		SYSTEM_INFO	info;
+		GetSystemInfo(&info);
+		return imax(1, (int) info.dwNumberOfProcessors);
+#elif defined(_SC_NPROCESSORS_ONLN)
+		return imax(1, (int) sysconf(_SC_NPROCESSORS_ONLN));
+#else
+		return 1;
+#endif
+	}
+
+
+	pool::pool(int thread_count)
+		:
+		m_generation(0),
+		m_busy_workers(0),
+		m_quit(false),
+		m_func(NULL),
+		m_arg(NULL),
+		m_count(0),
+		m_next_index(0)
+	{
+		if (thread_count <= 0)
+		{
+			thread_count = get_processor_count();
+		}
+#if TU_CONFIG_LINK_TO_THREAD == 0
+		// A worker would run its whole loop on creation.
+		thread_count = 1;
+#endif
+		for (int i = 1; i < thread_count; i++)
+		{
+			m_workers.push_back(new thread(worker_main, this));
+		}
+	}
+
+
+	pool::~pool()
+	{
+		{
+			autolock	lock(&m_mutex);
+			m_quit = true;
+			m_start.broadcast();
+		}
+		for (int i = 0; i < m_workers.size(); i++)
+		{
+			delete m_workers[i];	// waits for it
+		}
+	}
+
+
+	void	pool::run(task_func fn, void* arg, int count)
+	{
+		assert(fn);
+		if (count <= 0)
+		{
+			return;
+		}
+
+		{
+			autolock	lock(&m_mutex);
+			assert(m_busy_workers == 0);
+			m_func = fn;
+			m_arg = arg;
+			m_count = count;
+			m_next_index = 0;
+			m_busy_workers = m_workers.size();
+			m_generation++;
+			m_start.broadcast();
+		}
+
+		do_tasks();
+
+		autolock	lock(&m_mutex);
+		while (m_busy_workers > 0)
+		{
+			m_done.wait(&m_mutex);
+		}
+	}
+
+
+	void	pool::do_tasks()
+	// Run tasks from the current loop until there are none left.
+	{
+		for (;;)
+		{
+			int	i = tu_atomic_increment(&m_next_index) - 1;
+			if (i >= m_count)
+			{
+				break;
+			}
+			m_func(m_arg, i);
+		}
+	}
+
+
+	/*static*/ void	pool::worker_main(void* arg)
+	{
+		pool*	p = (pool*) arg;
+		int	generation = 0;
+
+		p->m_mutex.lock();
+		for (;;)
+		{
+			while (p->m_quit == false && p->m_generation == generation)
+			{
+				p->m_start.wait(&p->m_mutex);
+			}
+			if (p->m_quit)
+			{
+				break;
+			}
+			generation = p->m_generation;
+			p->m_mutex.unlock();
+
+			p->do_tasks();
+
+			p->m_mutex.lock();
+			p->m_busy_workers--;
+			if (p->m_busy_workers == 0)
+			{
+				p->m_done.signal();
+			}
+		}
+		p->m_mutex.unlock();
+	}
+}
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
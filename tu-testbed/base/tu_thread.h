@@ -0,0 +1,147 @@
+// tu_thread.h	-- threads, mutexes & condition variables
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Minimal threading for library code that wants to use more than one
+// core.  TU_CONFIG_LINK_TO_THREAD picks the implementation: 1 is SDL,
+// 2 is pthreads, and 0 means no threads at all, in which case a
+// thread runs its function to completion when it's created and the
+// locks do nothing.
+//
+// (gameswf has its own gameswf::tu_thread etc.; these live in a
+// namespace so the two don't collide.)
+
+
+#ifndef TU_THREAD_H
+#define TU_THREAD_H
+
+
+#include "base/tu_config.h"
+#include "base/container.h"
+
+
+namespace tu_thread
+{
+	typedef void	(*start_func)(void* arg);
+
+	struct thread
+	{
+		// Starts running fn(arg) on a new thread.
+		thread(start_func fn, void* arg);
+
+		// Waits for the thread, if nobody has yet.
+		~thread();
+
+		// Blocks until the thread's function returns.
+		void	wait();
+
+	private:
+		thread(const thread&);
+		void	operator=(const thread&);
+
+		void*	m_handle;
+	};
+
+	struct mutex
+	{
+		mutex();
+		~mutex();
+
+		void	lock();
+		void	unlock();
+
+	private:
+		friend struct condition;
+		mutex(const mutex&);
+		void	operator=(const mutex&);
+
+		void*	m_handle;
+	};
+
+	struct autolock
+	// Holds a mutex for its lifetime.
+	{
+		autolock(mutex* m) : m_mutex(m) { m_mutex->lock(); }
+		~autolock() { m_mutex->unlock(); }
+
+	private:
+		mutex*	m_mutex;
+	};
+
+	struct condition
+	{
+		condition();
+		~condition();
+
+		// Atomically unlocks m and waits to be signaled; m is
+		// locked again on return.  May return spuriously, so
+		// check the condition in a loop.
+		void	wait(mutex* m);
+
+		void	signal();	// wakes one waiter
+		void	broadcast();	// wakes all waiters
+
+	private:
+		condition(const condition&);
+		void	operator=(const condition&);
+
+		void*	m_handle;
+	};
+
+	// Number of processors we can run on; at least 1.  Always 1
+	// when threads are disabled.
+	int	get_processor_count();
+
+	struct pool
+	// A fixed set of worker threads for data-parallel loops.
+	// run() hands out the indices of a loop one at a time to the
+	// workers and the calling thread, and returns when they're
+	// all done.  One run() at a time per pool.
+	{
+		typedef void	(*task_func)(void* arg, int index);
+
+		// thread_count includes the thread that calls run(), so
+		// a pool of 1 runs everything on the caller.  0 means
+		// one per processor.
+		pool(int thread_count = 0);
+		~pool();
+
+		int	get_thread_count() const { return m_workers.size() + 1; }
+
+		// Calls fn(arg, i) for every i in [0, count).
+		void	run(task_func fn, void* arg, int count);
+
+	private:
+		pool(const pool&);
+		void	operator=(const pool&);
+
+		static void	worker_main(void* arg);
+		void	do_tasks();
+
+		array<thread*>	m_workers;
+
+		mutex	m_mutex;
+		condition	m_start;	// a new run() or quitting
+		condition	m_done;		// the last busy worker finished
+		int	m_generation;		// bumped by each run()
+		int	m_busy_workers;
+		bool	m_quit;
+
+		task_func	m_func;
+		void*	m_arg;
+		int	m_count;
+		volatile int	m_next_index;
+	};
+}
+
+
+#endif // TU_THREAD_H
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
@@ -0,0 +1,1523 @@
+// tu_xml.cpp	-- streaming XML parser and compact document
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// See tu_xml.h.
+
+
+#include "base/tu_xml.h"
+#include "base/utf8.h"
+#include <string.h>
+
+
+namespace tu_xml
+{
+	static bool	is_space(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+
+	static bool	is_name_end(char c)
+	{
+		return is_space(c) || c == '/' || c == '>' || c == '=';
+	}
+
+
+	static char*	find(char* p, char* end, const char* pattern, int pattern_length)
+	// Returns the first occurrence of pattern in [p, end), or NULL.
+	{
+		end -= pattern_length - 1;
+		while (p < end)
+		{
+			p = (char*) memchr(p, pattern[0], end - p);
+			if (p == NULL)
+			{
+				return NULL;
+			}
+			if (memcmp(p, pattern, pattern_length) == 0)
+			{
+				return p;
+			}
+			p++;
+		}
+		return NULL;
+	}
+
+
+	static bool	decode_entity(const char* p, const char* end, Uint32* ucs, int* length)
+	// Decodes the entity reference at p (which points at '&').
+	// Returns false if it's not one we know.
+	{
+		const char*	semicolon = (const char*) memchr(p, ';', imin(int(end - p), 12));
+		if (semicolon == NULL)
+		{
+			return false;
+		}
+		*length = int(semicolon - p) + 1;
+
+		const char*	name = p + 1;
+		int	name_length = int(semicolon - name);
+		if (name_length >= 2 && name[0] == '#')
+		{
+			Uint32	c = 0;
+			if (name[1] == 'x' || name[1] == 'X')
+			{
+				if (name_length < 3) return false;
+				for (const char* d = name + 2; d < semicolon; d++)
+				{
+					int	digit;
+					if (*d >= '0' && *d <= '9') digit = *d - '0';
+					else if (*d >= 'a' && *d <= 'f') digit = *d - 'a' + 10;
+					else if (*d >= 'A' && *d <= 'F') digit = *d - 'A' + 10;
+					else return false;
+					c = (c << 4) | digit;
+				}
+			}
+			else
+			{
+				for (const char* d = name + 1; d < semicolon; d++)
+				{
+					if (*d < '0' || *d > '9') return false;
+					c = c * 10 + (*d - '0');
+				}
+			}
+			if (c > 0x10FFFF)
+			{
+				return false;
+			}
+			*ucs = c;
+			return true;
+		}
+
+		static const struct { const char* m_name; int m_length; char m_char; } s_entities[] =
+		{
+			{ "lt", 2, '<' },
+			{ "gt", 2, '>' },
+			{ "amp", 3, '&' },
+			{ "quot", 4, '"' },
+			{ "apos", 4, '\'' },
+		};
+		for (int i = 0; i < int(sizeof(s_entities) / sizeof(s_entities[0])); i++)
+		{
+			if (name_length == s_entities[i].m_length
+			    && memcmp(name, s_entities[i].m_name, name_length) == 0)
+			{
+				*ucs = s_entities[i].m_char;
+				return true;
+			}
+		}
+		return false;
+	}
+
+
+	static int	decode_entities(char* text, int length)
+	// Replaces entity references in place.  Returns the new length;
+	// the text never gets longer.
+	{
+		char*	end = text + length;
+		char*	p = (char*) memchr(text, '&', length);
+		if (p == NULL)
+		{
+			return length;
+		}
+
+		char*	out = p;
+		while (p < end)
+		{
+			Uint32	ucs;
+			int	entity_length;
+			if (*p == '&' && decode_entity(p, end, &ucs, &entity_length))
+			{
+				// The shortest reference, "&#9;", is 4 bytes;
+				// UTF-8 for anything up to 0x10FFFF fits in
+				// the space it leaves.
+				int	offset = 0;
+				utf8::encode_unicode_character(out, &offset, ucs);
+				out += offset;
+				p += entity_length;
+			}
+			else
+			{
+				*out++ = *p++;
+			}
+		}
+		return int(out - text);
+	}
+
+
+	//
+	// parser
+	//
+
+
+	parser::parser(handler* h) :
+		m_handler(h),
+		m_status(OK),
+		m_line(1),
+		m_bytes_fed(0),
+		m_start(0),
+		m_end(0),
+		m_scanned(0),
+		m_depth(0)
+	{
+		assert(m_handler);
+	}
+
+
+	void	parser::set_error(status s, const char* p)
+	{
+		if (m_status == OK)
+		{
+			count_lines(get_buffer() + m_start, p);
+			m_status = s;
+		}
+	}
+
+
+	void	parser::count_lines(const char* p, const char* end)
+	{
+		while (p < end && (p = (const char*) memchr(p, '\n', end - p)) != NULL)
+		{
+			m_line++;
+			p++;
+		}
+	}
+
+
+	bool	parser::feed(const void* data, int length)
+	{
+		assert(length >= 0);
+		m_bytes_fed += length;
+		if (m_status != OK)
+		{
+			return false;
+		}
+
+		// Move the unconsumed input down, so the buffer only
+		// ever has to hold the largest token plus one piece.
+		if (m_start > 0)
+		{
+			memmove(get_buffer(), get_buffer() + m_start, m_end - m_start);
+			m_end -= m_start;
+			m_scanned -= m_start;
+			m_start = 0;
+		}
+		if (m_end + length > m_buffer.size())
+		{
+			m_buffer.resize(m_end + length);
+		}
+		if (length > 0)
+		{
+			memcpy(get_buffer() + m_end, data, length);
+			m_end += length;
+		}
+
+		parse(false);
+		return m_status == OK;
+	}
+
+
+	bool	parser::finish()
+	{
+		if (m_status == OK)
+		{
+			parse(true);
+		}
+		if (m_status == OK && m_depth > 0)
+		{
+			m_status = MISSING_END_TAG;
+		}
+		return m_status == OK;
+	}
+
+
+	void	parser::parse(bool at_eof)
+	{
+		while (m_start < m_end && m_status == OK)
+		{
+			char*	p = get_buffer() + m_start;
+			char*	end = get_buffer() + m_end;
+			int	consumed = *p == '<' ? parse_markup(p, end, at_eof) : parse_text(p, end, at_eof);
+			if (consumed == 0)
+			{
+				break;
+			}
+			m_start += consumed;
+			m_scanned = m_start;
+		}
+	}
+
+
+	char*	parser::resume_find(char* p, char* end, const char* pattern, int pattern_length)
+	// Looks for the end of the pending token at p, skipping
+	// whatever an earlier call already searched.
+	{
+		char*	from = get_buffer() + m_scanned - (pattern_length - 1);
+		if (from < p)
+		{
+			from = p;
+		}
+		char*	found = find(from, end, pattern, pattern_length);
+		if (found == NULL)
+		{
+			m_scanned = int(end - get_buffer());
+		}
+		return found;
+	}
+
+
+	int	parser::parse_text(char* p, char* end, bool at_eof)
+	{
+		char*	text_end = resume_find(p, end, "<", 1);
+		if (text_end == NULL)
+		{
+			if (at_eof == false)
+			{
+				return 0;
+			}
+			text_end = end;
+		}
+
+		int	length = int(text_end - p);
+		count_lines(p, text_end);
+		m_handler->text(p, decode_entities(p, length));
+		return length;
+	}
+
+
+	int	parser::parse_markup(char* p, char* end, bool at_eof)
+	// p points at '<'.  Returns the number of bytes consumed, or 0
+	// if we need more input.
+	{
+		int	available = int(end - p);
+		if (available < 2)
+		{
+			if (at_eof)
+			{
+				set_error(MALFORMED_ELEMENT, p);
+			}
+			return 0;
+		}
+
+		if (p[1] == '?')
+		{
+			char*	close = resume_find(p + 2, end, "?>", 2);
+			if (close == NULL)
+			{
+				if (at_eof) set_error(UNTERMINATED_XML_DECLARATION, p);
+				return 0;
+			}
+			int	length = int(close + 2 - p);
+			count_lines(p, close);
+			m_handler->processing_instruction(p, length);
+			return length;
+		}
+
+		if (p[1] == '!')
+		{
+			// Wait until we can tell which kind it is.
+			if (available < 9 && at_eof == false)
+			{
+				return 0;
+			}
+
+			if (available >= 4 && memcmp(p, "<!--", 4) == 0)
+			{
+				char*	close = resume_find(p + 4, end, "-->", 3);
+				if (close == NULL)
+				{
+					if (at_eof) set_error(UNTERMINATED_COMMENT, p);
+					return 0;
+				}
+				int	length = int(close + 3 - p);
+				count_lines(p, close);
+				m_handler->comment(p, length);
+				return length;
+			}
+
+			if (available >= 9 && memcmp(p, "<![CDATA[", 9) == 0)
+			{
+				char*	close = resume_find(p + 9, end, "]]>", 3);
+				if (close == NULL)
+				{
+					if (at_eof) set_error(UNTERMINATED_CDATA, p);
+					return 0;
+				}
+				count_lines(p, close);
+				m_handler->text(p + 9, int(close - (p + 9)));
+				return int(close + 3 - p);
+			}
+
+			if (available >= 9 && memcmp(p, "<!DOCTYPE", 9) == 0)
+			{
+				// Skip over an internal subset in [...].
+				int	depth = 0;
+				for (char* c = p + 9; c < end; c++)
+				{
+					if (*c == '[') depth++;
+					else if (*c == ']') depth--;
+					else if (*c == '>' && depth <= 0)
+					{
+						int	length = int(c + 1 - p);
+						count_lines(p, c);
+						m_handler->doctype(p, length);
+						return length;
+					}
+				}
+				if (at_eof) set_error(UNTERMINATED_DOCTYPE, p);
+				return 0;
+			}
+
+			set_error(MALFORMED_ELEMENT, p);
+			return 0;
+		}
+
+		// Find the closing '>', which may not be inside an
+		// attribute value.  Tags are short, so rescanning one
+		// that arrives in pieces is cheap.
+		char	quote = 0;
+		char*	close = NULL;
+		for (char* c = p + 1; c < end; c++)
+		{
+			if (quote)
+			{
+				if (*c == quote) quote = 0;
+			}
+			else if (*c == '"' || *c == '\'')
+			{
+				quote = *c;
+			}
+			else if (*c == '>')
+			{
+				close = c;
+				break;
+			}
+		}
+		if (close == NULL)
+		{
+			if (at_eof) set_error(quote ? UNTERMINATED_ATTRIBUTE : MALFORMED_ELEMENT, p);
+			return 0;
+		}
+
+		count_lines(p, close);
+		if (p[1] == '/')
+		{
+			return parse_end_tag(p, close);
+		}
+		return parse_start_tag(p, close);
+	}
+
+
+	int	parser::parse_end_tag(char* p, char* close)
+	// Handles "</name>"; close points at the '>'.
+	{
+		char*	name = p + 2;
+		char*	name_end = name;
+		while (name_end < close && is_name_end(*name_end) == false)
+		{
+			name_end++;
+		}
+		for (char* c = name_end; c < close; c++)
+		{
+			if (is_space(*c) == false)
+			{
+				set_error(MALFORMED_ELEMENT, p);
+				return 0;
+			}
+		}
+		*name_end = 0;
+
+		if (m_depth == 0
+		    || strcmp(&m_open_names[m_open_offsets[m_depth - 1]], name) != 0)
+		{
+			set_error(MISSING_START_TAG, p);
+			return 0;
+		}
+		m_depth--;
+
+		m_handler->end_element(name);
+		return int(close + 1 - p);
+	}
+
+
+	int	parser::parse_start_tag(char* p, char* close)
+	// Handles "<name a='v'...>" and "<name .../>"; close points at
+	// the '>'.  We write '\0's into the buffer to terminate the
+	// name and attributes.
+	{
+		int	length = int(close + 1 - p);
+		bool	empty = close[-1] == '/' && close - 1 > p + 1;
+		char*	tag_end = empty ? close - 1 : close;
+
+		char*	name = p + 1;
+		char*	c = name;
+		while (c < tag_end && is_name_end(*c) == false)
+		{
+			c++;
+		}
+		if (c == name)
+		{
+			set_error(MALFORMED_ELEMENT, p);
+			return 0;
+		}
+		char*	name_end = c;
+
+		int	attribute_count = 0;
+		for (;;)
+		{
+			bool	had_space = false;
+			while (c < tag_end && is_space(*c))
+			{
+				c++;
+				had_space = true;
+			}
+			if (c == tag_end)
+			{
+				break;
+			}
+			if (had_space == false)
+			{
+				set_error(MALFORMED_ELEMENT, p);
+				return 0;
+			}
+
+			char*	attr_name = c;
+			while (c < tag_end && is_name_end(*c) == false)
+			{
+				c++;
+			}
+			char*	attr_name_end = c;
+			while (c < tag_end && is_space(*c))
+			{
+				c++;
+			}
+			if (attr_name_end == attr_name || c == tag_end || *c != '=')
+			{
+				set_error(MALFORMED_ELEMENT, p);
+				return 0;
+			}
+			c++;
+			while (c < tag_end && is_space(*c))
+			{
+				c++;
+			}
+			if (c == tag_end || (*c != '"' && *c != '\''))
+			{
+				set_error(MALFORMED_ELEMENT, p);
+				return 0;
+			}
+			char	quote = *c++;
+			char*	value = c;
+			char*	value_end = (char*) memchr(value, quote, tag_end - value);
+			if (value_end == NULL)
+			{
+				set_error(UNTERMINATED_ATTRIBUTE, p);
+				return 0;
+			}
+			c = value_end + 1;
+
+			*attr_name_end = 0;
+			value[decode_entities(value, int(value_end - value))] = 0;
+
+			if (attribute_count == m_attributes.size())
+			{
+				m_attributes.resize(attribute_count + 1);
+			}
+			m_attributes[attribute_count].m_name = attr_name;
+			m_attributes[attribute_count].m_value = value;
+			attribute_count++;
+		}
+
+		*name_end = 0;
+		int	name_length = int(name_end - name);
+		if (empty == false)
+		{
+			// These arrays only grow, so after the first few
+			// tags we don't allocate.
+			int	offset = m_depth > 0 ? m_open_offsets[m_depth - 1] + int(strlen(&m_open_names[m_open_offsets[m_depth - 1]])) + 1 : 0;
+			if (offset + name_length + 1 > m_open_names.size())
+			{
+				m_open_names.resize(offset + name_length + 1);
+			}
+			memcpy(&m_open_names[offset], name, name_length + 1);
+			if (m_depth == m_open_offsets.size())
+			{
+				m_open_offsets.resize(m_depth + 1);
+			}
+			m_open_offsets[m_depth++] = offset;
+		}
+
+		m_handler->start_element(name, attribute_count ? &m_attributes[0] : NULL, attribute_count);
+		if (empty)
+		{
+			m_handler->end_element(name);
+		}
+		return length;
+	}
+
+
+	//
+	// document
+	//
+
+
+	// Don't bother compacting documents smaller than this.
+	static const int	MIN_COMPACT_BYTES = 16 << 10;
+
+
+	document::document() :
+		m_current(0),
+		m_xml_decl(-1),
+		m_doctype(-1),
+		m_ignore_white(false),
+		m_compacted_size(0)
+	{
+		clear();
+	}
+
+
+	void	document::clear()
+	{
+		m_nodes.resize(0);
+		m_attributes.resize(0);
+		m_strings.resize(0);
+		m_xml_decl = -1;
+		m_doctype = -1;
+		m_text_node = -1;
+		m_current = add_node(ELEMENT_NODE);
+	}
+
+
+	status	document::parse(const char* xml, int length)
+	{
+		clear();
+		parser	p(this);
+		p.feed(xml, length);
+		p.finish();
+		m_compacted_size = get_memory_used();
+		return p.get_status();
+	}
+
+
+	int	document::add_node(int type)
+	{
+		node	n;
+		n.m_type = type;
+		n.m_name = -1;
+		n.m_value = -1;
+		n.m_parent = -1;
+		n.m_first_child = -1;
+		n.m_last_child = -1;
+		n.m_prev_sibling = -1;
+		n.m_next_sibling = -1;
+		n.m_first_attribute = 0;
+		n.m_attribute_count = 0;
+		m_nodes.push_back(n);
+		return m_nodes.size() - 1;
+	}
+
+
+	int	document::add_string(const char* str, int length)
+	{
+		int	offset = m_strings.size();
+		m_strings.resize(offset + length + 1);
+		memcpy(&m_strings[offset], str, length);
+		m_strings[offset + length] = 0;
+		return offset;
+	}
+
+
+	const char*	document::get_attribute_name(int index, int i) const
+	{
+		assert(i >= 0 && i < m_nodes[index].m_attribute_count);
+		return get_string(m_attributes[(m_nodes[index].m_first_attribute + i) * 2]);
+	}
+
+
+	const char*	document::get_attribute_value(int index, int i) const
+	{
+		assert(i >= 0 && i < m_nodes[index].m_attribute_count);
+		return get_string(m_attributes[(m_nodes[index].m_first_attribute + i) * 2 + 1]);
+	}
+
+
+	void	document::set_attribute(int index, const char* name, const char* value)
+	{
+		node&	n = m_nodes[index];
+		for (int i = 0; i < n.m_attribute_count; i++)
+		{
+			if (strcmp(get_attribute_name(index, i), name) == 0)
+			{
+				int	value_offset = add_string(value, int(strlen(value)));
+				m_attributes[(n.m_first_attribute + i) * 2 + 1] = value_offset;
+				return;
+			}
+		}
+
+		// The node's attributes have to stay contiguous, so
+		// unless they're already at the end, move them there.
+		int	pairs = m_attributes.size() / 2;
+		if (n.m_first_attribute + n.m_attribute_count != pairs || n.m_attribute_count == 0)
+		{
+			for (int i = 0; i < n.m_attribute_count * 2; i++)
+			{
+				int	offset = m_attributes[n.m_first_attribute * 2 + i];
+				m_attributes.push_back(offset);
+			}
+			n.m_first_attribute = pairs;
+		}
+		m_attributes.push_back(add_string(name, int(strlen(name))));
+		m_attributes.push_back(add_string(value, int(strlen(value))));
+		n.m_attribute_count++;
+	}
+
+
+	int	document::create_node(int type, const char* name_or_value)
+	{
+		int	index = add_node(type);
+		if (name_or_value)
+		{
+			int	offset = add_string(name_or_value, int(strlen(name_or_value)));
+			if (type == TEXT_NODE)
+			{
+				m_nodes[index].m_value = offset;
+			}
+			else
+			{
+				m_nodes[index].m_name = offset;
+			}
+		}
+		return index;
+	}
+
+
+	int	document::clone_node(int index, bool deep)
+	{
+		int	copy = add_node(m_nodes[index].m_type);
+
+		// Strings are never modified in place, so the copy can
+		// share them.
+		node&	n = m_nodes[copy];
+		const node&	src = m_nodes[index];
+		n.m_name = src.m_name;
+		n.m_value = src.m_value;
+		n.m_first_attribute = m_attributes.size() / 2;
+		n.m_attribute_count = src.m_attribute_count;
+		for (int i = 0; i < src.m_attribute_count * 2; i++)
+		{
+			int	offset = m_attributes[src.m_first_attribute * 2 + i];
+			m_attributes.push_back(offset);
+		}
+
+		if (deep)
+		{
+			for (int child = m_nodes[index].m_first_child; child >= 0; child = m_nodes[child].m_next_sibling)
+			{
+				insert_child(copy, clone_node(child, true), -1);
+			}
+		}
+		return copy;
+	}
+
+
+	int	document::import_node(const document& src, int index)
+	{
+		assert(&src != this);
+
+		const node&	n = src.m_nodes[index];
+		int	copy = add_node(n.m_type);
+		if (n.m_name >= 0) set_name(copy, src.get_string(n.m_name));
+		if (n.m_value >= 0) set_value(copy, src.get_string(n.m_value));
+		for (int i = 0; i < n.m_attribute_count; i++)
+		{
+			set_attribute(copy, src.get_attribute_name(index, i), src.get_attribute_value(index, i));
+		}
+
+		for (int child = n.m_first_child; child >= 0; child = src.m_nodes[child].m_next_sibling)
+		{
+			insert_child(copy, import_node(src, child), -1);
+		}
+		return copy;
+	}
+
+
+	void	document::set_name(int index, const char* name)
+	{
+		m_nodes[index].m_name = name ? add_string(name, int(strlen(name))) : -1;
+	}
+
+
+	void	document::set_value(int index, const char* value)
+	{
+		m_nodes[index].m_value = value ? add_string(value, int(strlen(value))) : -1;
+	}
+
+
+	void	document::insert_child(int parent, int child, int before)
+	{
+		assert(m_nodes[child].m_parent == -1);
+		assert(before == -1 || m_nodes[before].m_parent == parent);
+
+		node&	p = m_nodes[parent];
+		node&	c = m_nodes[child];
+		c.m_parent = parent;
+		c.m_next_sibling = before;
+		if (before == -1)
+		{
+			c.m_prev_sibling = p.m_last_child;
+			p.m_last_child = child;
+		}
+		else
+		{
+			c.m_prev_sibling = m_nodes[before].m_prev_sibling;
+			m_nodes[before].m_prev_sibling = child;
+		}
+		if (c.m_prev_sibling == -1)
+		{
+			p.m_first_child = child;
+		}
+		else
+		{
+			m_nodes[c.m_prev_sibling].m_next_sibling = child;
+		}
+	}
+
+
+	void	document::remove_from_parent(int index)
+	{
+		node&	n = m_nodes[index];
+		if (n.m_parent == -1)
+		{
+			return;
+		}
+
+		node&	p = m_nodes[n.m_parent];
+		if (n.m_prev_sibling == -1) p.m_first_child = n.m_next_sibling;
+		else m_nodes[n.m_prev_sibling].m_next_sibling = n.m_next_sibling;
+		if (n.m_next_sibling == -1) p.m_last_child = n.m_prev_sibling;
+		else m_nodes[n.m_next_sibling].m_prev_sibling = n.m_prev_sibling;
+
+		n.m_parent = -1;
+		n.m_prev_sibling = -1;
+		n.m_next_sibling = -1;
+	}
+
+
+	bool	document::is_ancestor(int ancestor, int index) const
+	{
+		for (; index >= 0; index = m_nodes[index].m_parent)
+		{
+			if (index == ancestor)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+
+	static void	append(tu_string* out, const char* str, int length)
+	{
+		if (length > 0)
+		{
+			int	old_length = out->length();
+			out->resize(old_length + length);
+			memcpy(&(*out)[old_length], str, length);
+		}
+	}
+
+
+	void	escape(const char* str, tu_string* out, bool quotes)
+	{
+		const char*	run = str;
+		for (const char* p = str; ; p++)
+		{
+			const char*	entity = NULL;
+			switch (*p)
+			{
+			case 0: break;
+			case '<': entity = "&lt;"; break;
+			case '>': entity = "&gt;"; break;
+			case '&': entity = "&amp;"; break;
+			case '"': if (quotes) entity = "&quot;"; break;
+			default: continue;
+			}
+			if (*p == 0)
+			{
+				append(out, run, int(p - run));
+				return;
+			}
+			if (entity)
+			{
+				append(out, run, int(p - run));
+				*out += entity;
+				run = p + 1;
+			}
+		}
+	}
+
+
+	void	document::write(int index, tu_string* out) const
+	{
+		const node&	n = m_nodes[index];
+		if (n.m_type == TEXT_NODE)
+		{
+			if (n.m_value >= 0)
+			{
+				escape(get_string(n.m_value), out, false);
+			}
+			return;
+		}
+
+		if (n.m_name >= 0)
+		{
+			*out += '<';
+			*out += get_string(n.m_name);
+			for (int i = 0; i < n.m_attribute_count; i++)
+			{
+				*out += ' ';
+				*out += get_attribute_name(index, i);
+				*out += "=\"";
+				escape(get_attribute_value(index, i), out, true);
+				*out += '"';
+			}
+			if (n.m_first_child == -1)
+			{
+				*out += " />";
+				return;
+			}
+			*out += '>';
+		}
+
+		for (int child = n.m_first_child; child >= 0; child = m_nodes[child].m_next_sibling)
+		{
+			write(child, out);
+		}
+
+		if (n.m_name >= 0)
+		{
+			*out += "</";
+			*out += get_string(n.m_name);
+			*out += '>';
+		}
+	}
+
+
+	int	document::get_memory_used() const
+	{
+		return m_nodes.size() * sizeof(node)
+			+ m_attributes.size() * sizeof(int)
+			+ m_strings.size();
+	}
+
+
+	bool	document::needs_compact() const
+	{
+		int	used = get_memory_used();
+		return used > MIN_COMPACT_BYTES && used > m_compacted_size * 2;
+	}
+
+
+	void	document::mark_tree(int top, array<int>* marks) const
+	// Sets (*marks)[i] to 0 for top and all its descendants.
+	{
+		int	i = top;
+		for (;;)
+		{
+			(*marks)[i] = 0;
+			if (m_nodes[i].m_first_child >= 0)
+			{
+				i = m_nodes[i].m_first_child;
+				continue;
+			}
+			while (i != top && m_nodes[i].m_next_sibling == -1)
+			{
+				i = m_nodes[i].m_parent;
+			}
+			if (i == top)
+			{
+				return;
+			}
+			i = m_nodes[i].m_next_sibling;
+		}
+	}
+
+
+	void	document::compact(array<int>* keep)
+	{
+		assert(m_current == 0);	// not in the middle of parsing
+
+		// Find the nodes to keep: whole trees, since script can
+		// walk from any node to its parent and siblings.
+		array<int>	new_index;
+		new_index.resize(m_nodes.size());
+		for (int i = 0; i < new_index.size(); i++)
+		{
+			new_index[i] = -1;
+		}
+		mark_tree(0, &new_index);
+		for (int k = 0; k < keep->size(); k++)
+		{
+			int	top = (*keep)[k];
+			if (top < 0)
+			{
+				continue;
+			}
+			while (m_nodes[top].m_parent >= 0)
+			{
+				top = m_nodes[top].m_parent;
+			}
+			if (new_index[top] == -1)
+			{
+				mark_tree(top, &new_index);
+			}
+		}
+
+		int	count = 0;
+		for (int i = 0; i < new_index.size(); i++)
+		{
+			if (new_index[i] == 0)
+			{
+				new_index[i] = count++;
+			}
+		}
+
+		// Copy what's left into new arrays, in the same order.
+		// Strings that were shared stay shared.
+		array<node>	nodes;
+		array<int>	attributes;
+		array<char>	strings;
+		hash<int, int>	string_map;
+		nodes.reserve(count);
+		for (int i = 0; i < m_nodes.size(); i++)
+		{
+			if (new_index[i] == -1)
+			{
+				continue;
+			}
+
+			node	n = m_nodes[i];
+			n.m_parent = n.m_parent >= 0 ? new_index[n.m_parent] : -1;
+			n.m_first_child = n.m_first_child >= 0 ? new_index[n.m_first_child] : -1;
+			n.m_last_child = n.m_last_child >= 0 ? new_index[n.m_last_child] : -1;
+			n.m_prev_sibling = n.m_prev_sibling >= 0 ? new_index[n.m_prev_sibling] : -1;
+			n.m_next_sibling = n.m_next_sibling >= 0 ? new_index[n.m_next_sibling] : -1;
+			n.m_name = copy_string(n.m_name, &strings, &string_map);
+			n.m_value = copy_string(n.m_value, &strings, &string_map);
+
+			int	first = n.m_first_attribute;
+			n.m_first_attribute = attributes.size() / 2;
+			for (int a = 0; a < n.m_attribute_count * 2; a++)
+			{
+				attributes.push_back(copy_string(m_attributes[first * 2 + a], &strings, &string_map));
+			}
+			nodes.push_back(n);
+		}
+		m_xml_decl = copy_string(m_xml_decl, &strings, &string_map);
+		m_doctype = copy_string(m_doctype, &strings, &string_map);
+
+		m_nodes.resize(0);
+		m_nodes.transfer_members(&nodes);
+		m_attributes.resize(0);
+		m_attributes.transfer_members(&attributes);
+		m_strings.resize(0);
+		m_strings.transfer_members(&strings);
+		m_text_node = -1;
+
+		for (int k = 0; k < keep->size(); k++)
+		{
+			if ((*keep)[k] >= 0)
+			{
+				(*keep)[k] = new_index[(*keep)[k]];
+			}
+		}
+
+		m_compacted_size = get_memory_used();
+	}
+
+
+	int	document::copy_string(int offset, array<char>* strings, hash<int, int>* string_map) const
+	// Copies the string at offset in our pool to the end of
+	// *strings, unless it's been copied already.  Returns its new
+	// offset.
+	{
+		if (offset < 0)
+		{
+			return -1;
+		}
+
+		int	new_offset;
+		if (string_map->get(offset, &new_offset) == false)
+		{
+			const char*	str = get_string(offset);
+			int	length = int(strlen(str)) + 1;
+			new_offset = strings->size();
+			strings->resize(new_offset + length);
+			memcpy(&(*strings)[new_offset], str, length);
+			string_map->add(offset, new_offset);
+		}
+		return new_offset;
+	}
+
+
+	void	document::start_element(const char* name, const attribute* attributes, int attribute_count)
+	{
+		int	index = add_node(ELEMENT_NODE);
+		node&	n = m_nodes[index];
+		n.m_name = add_string(name, int(strlen(name)));
+		n.m_first_attribute = m_attributes.size() / 2;
+		n.m_attribute_count = attribute_count;
+		for (int i = 0; i < attribute_count; i++)
+		{
+			m_attributes.push_back(add_string(attributes[i].m_name, int(strlen(attributes[i].m_name))));
+			m_attributes.push_back(add_string(attributes[i].m_value, int(strlen(attributes[i].m_value))));
+		}
+
+		insert_child(m_current, index, -1);
+		m_current = index;
+		m_text_node = -1;
+	}
+
+
+	void	document::end_element(const char* name)
+	{
+		m_current = m_nodes[m_current].m_parent;
+		assert(m_current >= 0);
+		m_text_node = -1;
+	}
+
+
+	void	document::text(const char* text, int length)
+	{
+		if (m_ignore_white)
+		{
+			int	i = 0;
+			while (i < length && is_space(text[i]))
+			{
+				i++;
+			}
+			if (i == length)
+			{
+				return;
+			}
+		}
+
+		if (m_text_node >= 0)
+		{
+			// Continues the text node we just added (e.g. text
+			// then CDATA), whose value is last in the pool.
+			int	old_size = m_strings.size() - 1;
+			m_strings.resize(old_size + length + 1);
+			memcpy(&m_strings[old_size], text, length);
+			m_strings[old_size + length] = 0;
+			return;
+		}
+
+		int	index = add_node(TEXT_NODE);
+		m_nodes[index].m_value = add_string(text, length);
+		insert_child(m_current, index, -1);
+		m_text_node = index;
+	}
+
+
+	void	document::processing_instruction(const char* text, int length)
+	{
+		if (m_xml_decl == -1 && length >= 6 && memcmp(text, "<?xml", 5) == 0 && is_space(text[5]))
+		{
+			m_xml_decl = add_string(text, length);
+			m_text_node = -1;
+		}
+	}
+
+
+	void	document::doctype(const char* text, int length)
+	{
+		if (m_doctype == -1)
+		{
+			m_doctype = add_string(text, length);
+			m_text_node = -1;
+		}
+	}
+}
+
+
+#ifdef TU_XML_UNIT_TEST
+
+
+// Compile this test case with something like:
+//
+// gcc tu_xml.cpp container.cpp utf8.cpp tu_timer.cpp -O2 -I.. -DTU_XML_UNIT_TEST -lstdc++ -o tu_xml_test
+//
+// Add -DHAVE_LIBXML `xml2-config --cflags --libs` to compare against
+// libxml2.  The benchmark parses a generated ~5MB document the way
+// the old libxml-based as_xml did (a libxml tree, then an object per
+// node and attribute) and the way it does now (a tu_xml::document
+// fed 64K at a time, nodes materialized only when touched).
+
+
+#include "base/tu_timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef HAVE_LIBXML
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#endif
+
+
+// On glibc we count every malloc in the process, ours and libxml's.
+static int	s_allocations = 0;
+static bool	s_counting = false;
+
+#if defined(__GLIBC__) && !defined(USE_DL_MALLOC) && !defined(__SANITIZE_ADDRESS__)
+#define COUNT_ALLOCATIONS 1
+extern "C"
+{
+	extern void*	__libc_malloc(size_t size);
+	extern void*	__libc_calloc(size_t count, size_t size);
+	extern void*	__libc_realloc(void* ptr, size_t size);
+
+	void*	malloc(size_t size) { if (s_counting) s_allocations++; return __libc_malloc(size); }
+	void*	calloc(size_t count, size_t size) { if (s_counting) s_allocations++; return __libc_calloc(count, size); }
+	void*	realloc(void* ptr, size_t size) { if (s_counting) s_allocations++; return __libc_realloc(ptr, size); }
+}
+#endif
+
+
+static void	check(bool ok, const char* what)
+{
+	if (!ok)
+	{
+		printf("FAILED: %s\n", what);
+		exit(1);
+	}
+}
+
+
+static void	check_parse(const char* xml, tu_xml::status expected, const char* expected_output)
+// Parses xml in pieces of every size from 1 up, and checks the
+// status and what the tree writes back out.
+{
+	int	length = int(strlen(xml));
+	for (int piece = 1; piece <= length; piece++)
+	{
+		tu_xml::document	doc;
+		tu_xml::parser	p(&doc);
+		for (int i = 0; i < length; i += piece)
+		{
+			p.feed(xml + i, imin(piece, length - i));
+		}
+		p.finish();
+		if (p.get_status() != expected)
+		{
+			printf("'%s' in %d byte pieces: status %d, expected %d\n", xml, piece, p.get_status(), expected);
+			exit(1);
+		}
+		if (expected_output)
+		{
+			tu_string	out;
+			doc.write(0, &out);
+			if (out != expected_output)
+			{
+				printf("'%s' in %d byte pieces: got '%s', expected '%s'\n", xml, piece, out.c_str(), expected_output);
+				exit(1);
+			}
+		}
+	}
+}
+
+
+static void	test_parser()
+{
+	check_parse("<a/>", tu_xml::OK, "<a />");
+	check_parse("<a b='1' c=\"x&amp;y\">t</a>", tu_xml::OK, "<a b=\"1\" c=\"x&amp;y\">t</a>");
+	check_parse("<a b='>'/>", tu_xml::OK, "<a b=\"&gt;\" />");
+	check_parse("<?xml version=\"1.0\"?><!DOCTYPE a [<!ENTITY x \"y\">]><!-- c --><a>1<![CDATA[<2>]]>3</a>",
+		    tu_xml::OK, "<a>1&lt;2&gt;3</a>");
+	check_parse("<a>&lt;&#65;&#x42;&bogus;&#xe9;</a>", tu_xml::OK, "<a>&lt;AB&amp;bogus;\xc3\xa9</a>");
+	check_parse("<a>\n  <b>x</b>\n</a>", tu_xml::OK, "<a>\n  <b>x</b>\n</a>");
+
+	check_parse("<a>", tu_xml::MISSING_END_TAG, NULL);
+	check_parse("<a></b>", tu_xml::MISSING_START_TAG, NULL);
+	check_parse("</a>", tu_xml::MISSING_START_TAG, NULL);
+	check_parse("<a b='1>", tu_xml::UNTERMINATED_ATTRIBUTE, NULL);
+	check_parse("<a b=1/>", tu_xml::MALFORMED_ELEMENT, NULL);
+	check_parse("<a><!-- x", tu_xml::UNTERMINATED_COMMENT, NULL);
+	check_parse("<a><![CDATA[ x", tu_xml::UNTERMINATED_CDATA, NULL);
+	check_parse("<?xml x", tu_xml::UNTERMINATED_XML_DECLARATION, NULL);
+	check_parse("<!DOCTYPE a", tu_xml::UNTERMINATED_DOCTYPE, NULL);
+
+	tu_xml::document	doc;
+	doc.set_ignore_white(true);
+	check(doc.parse("<?xml version=\"1.0\"?>\n<a x=\"1\">\n  <b/>\n  <c>t</c>\n</a>\n", 54) == tu_xml::OK, "parse");
+	check(strcmp(doc.get_xml_decl(), "<?xml version=\"1.0\"?>") == 0, "xml decl");
+	int	a = doc.get_node(0).m_first_child;
+	check(strcmp(doc.get_name(a), "a") == 0 && doc.get_node(a).m_attribute_count == 1, "element a");
+	int	b = doc.get_node(a).m_first_child;
+	int	c = doc.get_node(b).m_next_sibling;
+	check(doc.get_node(c).m_next_sibling == -1 && doc.get_node(c).m_prev_sibling == b, "siblings");
+	check(strcmp(doc.get_value(doc.get_node(c).m_first_child), "t") == 0, "text");
+
+	// Editing.
+	doc.remove_from_parent(b);
+	doc.insert_child(a, b, -1);
+	doc.set_attribute(b, "y", "\"2\"");
+	doc.set_attribute(a, "x", "3");
+	int	d = doc.clone_node(c, true);
+	doc.insert_child(a, d, c);
+	doc.insert_child(d, doc.create_node(tu_xml::TEXT_NODE, "<u>"), -1);
+	check(doc.is_ancestor(a, d) && !doc.is_ancestor(d, a), "is_ancestor");
+	tu_string	out;
+	doc.write(0, &out);
+	check(out == "<a x=\"3\"><c>t&lt;u&gt;</c><c>t</c><b y=\"&quot;2&quot;\" /></a>", "edits");
+
+	tu_xml::document	other;
+	other.insert_child(0, other.import_node(doc, a), -1);
+	tu_string	copy;
+	other.write(0, &copy);
+	check(copy == out, "import_node");
+}
+
+
+static void	test_compact()
+// Edits in a loop, the way a script might, holding on to a few
+// detached nodes; the arrays have to stay bounded.
+{
+	tu_xml::document	doc;
+	check(doc.parse("<list><item n=\"0\">zero</item></list>", 36) == tu_xml::OK, "parse list");
+	int	list = doc.get_node(0).m_first_child;
+
+	// Held by "script": a detached subtree, and the list.
+	array<int>	keep;
+	keep.push_back(doc.create_node(tu_xml::ELEMENT_NODE, "held"));
+	doc.insert_child(keep[0], doc.create_node(tu_xml::TEXT_NODE, "inside"), -1);
+	keep.push_back(list);
+
+	int	max_used = 0;
+	char	buffer[32];
+	for (int i = 0; i < 100000; i++)
+	{
+		snprintf(buffer, sizeof(buffer), "%d", i);
+		list = keep[1];
+		int	item = doc.get_node(list).m_first_child;
+		doc.set_attribute(item, "n", buffer);
+		doc.set_value(doc.get_node(item).m_first_child, buffer);
+
+		// Replace the extras.
+		while (doc.get_node(item).m_next_sibling >= 0)
+		{
+			doc.remove_from_parent(doc.get_node(item).m_next_sibling);
+		}
+		int	extra = doc.create_node(tu_xml::ELEMENT_NODE, "extra");
+		doc.set_attribute(extra, "a", buffer);
+		doc.insert_child(list, extra, -1);
+		doc.insert_child(list, doc.clone_node(extra, true), -1);
+
+		if (doc.needs_compact())
+		{
+			doc.compact(&keep);
+		}
+		max_used = imax(max_used, doc.get_memory_used());
+	}
+	check(max_used < 64 << 10, "compact keeps the document bounded");
+
+	tu_string	out;
+	doc.write(0, &out);
+	check(out == "<list><item n=\"99999\">99999</item><extra a=\"99999\" /><extra a=\"99999\" /></list>", "compacted tree");
+	tu_string	held;
+	doc.write(keep[0], &held);
+	check(held == "<held>inside</held>", "kept detached node");
+	check(doc.get_node(keep[1]).m_parent == 0, "kept node renumbered");
+}
+
+
+static void	append(array<char>* xml, const char* fmt, int i)
+{
+	char	buffer[200];
+	int	length = snprintf(buffer, sizeof(buffer), fmt, i, i, (i % 3) ? "weapon" : "armor", i % 50, i % 10);
+	xml->append(buffer, length);
+}
+
+
+static void	make_document(array<char>* xml, int target_bytes)
+// Something like a big game config: records with attributes and a
+// few text children.
+{
+	static const char*	s_header = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<config>\n";
+	static const char*	s_footer = "</config>\n";
+	xml->append(s_header, int(strlen(s_header)));
+	for (int i = 0; xml->size() < target_bytes; i++)
+	{
+		append(xml, "  <item id=\"%d\" name=\"item_%d\" type=\"%s\" weight=\"%d.%d\">\n", i);
+		append(xml, "    <desc>Item number %d &amp; friends</desc>\n", i);
+		append(xml, "    <stats hp=\"%d\" mp=\"%d\"/>\n", i % 100);
+		append(xml, "    <tags><tag>common</tag><tag>tradable</tag></tags>\n  </item>\n", i);
+	}
+	xml->append(s_footer, int(strlen(s_footer)));
+}
+
+
+static void	report(const char* what, Uint64 start_ticks, int allocations)
+{
+	double	ms = tu_timer::profile_ticks_to_milliseconds(tu_timer::get_profile_ticks() - start_ticks);
+#ifdef COUNT_ALLOCATIONS
+	printf("%-40s %8.1f ms %9d allocations\n", what, ms, allocations);
+#else
+	printf("%-40s %8.1f ms\n", what, ms);
+#endif
+}
+
+
+struct counting_handler : public tu_xml::handler
+{
+	int	m_elements, m_attributes, m_text_bytes;
+
+	counting_handler() : m_elements(0), m_attributes(0), m_text_bytes(0) {}
+	virtual void	start_element(const char* name, const tu_xml::attribute* attributes, int attribute_count)
+	{
+		m_elements++;
+		m_attributes += attribute_count;
+	}
+	virtual void	end_element(const char* name) {}
+	virtual void	text(const char* text, int length) { m_text_bytes += length; }
+};
+
+
+#ifdef HAVE_LIBXML
+
+// What the old as_xml built for each node.
+struct old_xml_node
+{
+	char*	m_name;
+	char*	m_value;
+	array<old_xml_node*>	m_children;
+	array<char*>	m_attributes;
+
+	~old_xml_node()
+	{
+		free(m_name);
+		free(m_value);
+		for (int i = 0; i < m_children.size(); i++) delete m_children[i];
+		for (int i = 0; i < m_attributes.size(); i++) free(m_attributes[i]);
+	}
+};
+
+
+static old_xml_node*	extract_node(xmlNodePtr node, int* count)
+{
+	old_xml_node*	n = new old_xml_node;
+	(*count)++;
+	n->m_name = node->name ? strdup((const char*) node->name) : NULL;
+	n->m_value = NULL;
+	if (node->type == XML_TEXT_NODE)
+	{
+		xmlChar*	content = xmlNodeGetContent(node);
+		n->m_value = strdup((const char*) content);
+		xmlFree(content);
+	}
+	for (xmlAttrPtr attr = node->properties; attr; attr = attr->next)
+	{
+		xmlChar*	value = xmlGetProp(node, attr->name);
+		n->m_attributes.push_back(strdup((const char*) attr->name));
+		n->m_attributes.push_back(strdup((const char*) value));
+		xmlFree(value);
+		(*count)++;
+	}
+	for (xmlNodePtr child = node->children; child; child = child->next)
+	{
+		n->m_children.push_back(extract_node(child, count));
+	}
+	return n;
+}
+
+#endif // HAVE_LIBXML
+
+
+static void	benchmark()
+{
+	array<char>	xml;
+	make_document(&xml, 5 << 20);
+	printf("\n%d KB document\n", xml.size() >> 10);
+
+	static const int	PIECE = 64 << 10;
+	Uint64	start;
+
+	{
+		counting_handler	h;
+		s_allocations = 0;
+		s_counting = true;
+		start = tu_timer::get_profile_ticks();
+		tu_xml::parser	p(&h);
+		for (int i = 0; i < xml.size(); i += PIECE)
+		{
+			p.feed(&xml[0] + i, imin(PIECE, xml.size() - i));
+		}
+		check(p.finish(), "benchmark parse");
+		s_counting = false;
+		report("tu_xml::parser, callbacks only", start, s_allocations);
+		printf("  %d elements, %d attributes, %d bytes of text\n", h.m_elements, h.m_attributes, h.m_text_bytes);
+	}
+
+	{
+		s_allocations = 0;
+		s_counting = true;
+		start = tu_timer::get_profile_ticks();
+		tu_xml::document	doc;
+		doc.set_ignore_white(true);
+		tu_xml::parser	p(&doc);
+		for (int i = 0; i < xml.size(); i += PIECE)
+		{
+			p.feed(&xml[0] + i, imin(PIECE, xml.size() - i));
+		}
+		check(p.finish(), "benchmark parse");
+		s_counting = false;
+		report("tu_xml::document", start, s_allocations);
+		printf("  %d nodes, %d KB\n", doc.get_node_count(), doc.get_memory_used() >> 10);
+	}
+
+#ifdef HAVE_LIBXML
+	{
+		xmlKeepBlanksDefault(0);
+		s_allocations = 0;
+		s_counting = true;
+		start = tu_timer::get_profile_ticks();
+		xmlDocPtr	doc = xmlReadMemory(&xml[0], xml.size(), NULL, NULL, XML_PARSE_NOBLANKS);
+		check(doc != NULL, "libxml parse");
+		int	libxml_allocations = s_allocations;
+		int	objects = 0;
+		old_xml_node*	root = extract_node(xmlDocGetRootElement(doc), &objects);
+		s_counting = false;
+		report("libxml2 tree + node objects (old path)", start, s_allocations);
+		printf("  %d allocations in libxml, %d node & attribute objects\n", libxml_allocations, objects);
+
+		delete root;
+		xmlFreeDoc(doc);
+	}
+#else
+	printf("(built without HAVE_LIBXML; no libxml2 comparison)\n");
+#endif
+}
+
+
+int	main()
+{
+	test_parser();
+	test_compact();
+	printf("OK\n");
+
+	benchmark();
+	return 0;
+}
+
+
+#endif // TU_XML_UNIT_TEST
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
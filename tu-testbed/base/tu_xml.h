@@ -0,0 +1,265 @@
+// tu_xml.h	-- streaming XML parser and compact document
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// A small non-validating XML parser with no dependencies.
+//
+// tu_xml::parser is a push parser: feed() it the input in pieces of
+// any size and it calls a handler for each element, text run,
+// comment, etc. as soon as it has seen all of it.  It doesn't
+// allocate per token; names and text are handed to the handler as
+// pointers into its input buffer, with entities already decoded.
+//
+// tu_xml::document is a handler that stores the tree in a few flat
+// arrays (nodes, attributes, one string pool), so building even a
+// large document costs a handful of allocations.  Nodes are referred
+// to by index.
+
+
+#ifndef TU_XML_H
+#define TU_XML_H
+
+
+#include "base/tu_config.h"
+#include "base/container.h"
+
+
+namespace tu_xml
+{
+	// Parse results.  The values match ActionScript's XML.status.
+	enum status
+	{
+		OK = 0,
+		UNTERMINATED_CDATA = -2,
+		UNTERMINATED_XML_DECLARATION = -3,
+		UNTERMINATED_DOCTYPE = -4,
+		UNTERMINATED_COMMENT = -5,
+		MALFORMED_ELEMENT = -6,
+		OUT_OF_MEMORY = -7,
+		UNTERMINATED_ATTRIBUTE = -8,
+		MISSING_END_TAG = -9,
+		MISSING_START_TAG = -10
+	};
+
+	struct attribute
+	{
+		const char*	m_name;
+		const char*	m_value;
+	};
+
+	struct handler
+	// Parser callbacks.  The strings are only valid during the
+	// call.  Names and attribute values are '\0' terminated; text
+	// and markup are not.
+	{
+		virtual ~handler() {}
+
+		virtual void	start_element(const char* name, const attribute* attributes, int attribute_count) = 0;
+		virtual void	end_element(const char* name) = 0;
+
+		// Character data between tags, and the contents of
+		// CDATA sections.  Adjacent runs aren't merged.
+		virtual void	text(const char* text, int length) = 0;
+
+		// These get the complete markup, e.g. "<!-- ... -->".
+		virtual void	comment(const char* text, int length) {}
+		virtual void	processing_instruction(const char* text, int length) {}	// including <?xml ...?>
+		virtual void	doctype(const char* text, int length) {}
+	};
+
+	struct parser
+	{
+		parser(handler* h);
+
+		// Parses the next piece of input.  Complete tokens are
+		// reported to the handler right away; a partial one is
+		// kept until more input arrives.  Returns false once the
+		// input is known to be malformed; further input is then
+		// ignored.
+		bool	feed(const void* data, int length);
+
+		// End of input.  Reports any trailing text and checks
+		// that everything was closed.  Returns get_status() == OK.
+		bool	finish();
+
+		status	get_status() const { return m_status; }
+
+		// Line number (1-based) where parsing stopped, for
+		// error messages.
+		int	get_line() const { return m_line; }
+
+		// Bytes given to feed() so far.
+		int	get_bytes_fed() const { return m_bytes_fed; }
+
+	private:
+		void	parse(bool at_eof);
+		char*	resume_find(char* p, char* end, const char* pattern, int pattern_length);
+		int	parse_text(char* p, char* end, bool at_eof);
+		int	parse_markup(char* p, char* end, bool at_eof);
+		int	parse_end_tag(char* p, char* close);
+		int	parse_start_tag(char* p, char* close);
+		void	set_error(status s, const char* p);
+		void	count_lines(const char* p, const char* end);
+		char*	get_buffer() { return m_buffer.size() ? &m_buffer[0] : NULL; }
+
+		handler*	m_handler;
+		status	m_status;
+		int	m_line;
+		int	m_bytes_fed;
+
+		// Input we haven't consumed yet is [m_start, m_end).
+		array<char>	m_buffer;
+		int	m_start;
+		int	m_end;
+
+		// How far the scan for the end of the pending token got,
+		// so a large token arriving in small pieces isn't
+		// rescanned from the beginning each time.
+		int	m_scanned;
+
+		// Names of the open elements, '\0' separated.
+		array<char>	m_open_names;
+		array<int>	m_open_offsets;
+		int	m_depth;
+
+		array<attribute>	m_attributes;
+	};
+
+
+	// Flash's XML node types.
+	enum node_type
+	{
+		ELEMENT_NODE = 1,
+		TEXT_NODE = 3
+	};
+
+	struct document : public handler
+	// The parsed tree.  Node 0 is the root; it has no name, and its
+	// children are the top-level elements and text.
+	//
+	// The tree can be edited in place.  Replaced strings and
+	// attributes, and nodes that have been cut loose, stay in the
+	// arrays until compact() squeezes them out.
+	{
+		struct node
+		{
+			int	m_type;
+			int	m_name;		// string offset, or -1
+			int	m_value;	// string offset, or -1
+			int	m_parent;	// node indices, or -1
+			int	m_first_child;
+			int	m_last_child;
+			int	m_prev_sibling;
+			int	m_next_sibling;
+			int	m_first_attribute;	// into m_attributes
+			int	m_attribute_count;
+		};
+
+		document();
+
+		// If ignore_white is set, text nodes that are all
+		// whitespace are dropped while parsing, like
+		// XML.ignoreWhite.
+		void	set_ignore_white(bool ignore_white) { m_ignore_white = ignore_white; }
+
+		// Back to just an empty root.
+		void	clear();
+
+		// Parses a complete string into a cleared document.
+		status	parse(const char* xml, int length);
+
+		int	get_node_count() const { return m_nodes.size(); }
+		const node&	get_node(int index) const { return m_nodes[index]; }
+
+		// NULL if the node has no name or value.
+		const char*	get_name(int index) const { return get_string(m_nodes[index].m_name); }
+		const char*	get_value(int index) const { return get_string(m_nodes[index].m_value); }
+
+		const char*	get_attribute_name(int index, int i) const;
+		const char*	get_attribute_value(int index, int i) const;
+		void	set_attribute(int index, const char* name, const char* value);
+
+		// From <?xml ...?> and <!DOCTYPE ...>, or NULL.
+		const char*	get_xml_decl() const { return get_string(m_xml_decl); }
+		const char*	get_doctype() const { return get_string(m_doctype); }
+
+		//
+		// Editing.
+		//
+
+		// Returns the new node's index.  It has no parent.
+		int	create_node(int type, const char* name_or_value);
+		int	clone_node(int index, bool deep);
+
+		// Deep copy of a node from another document.
+		int	import_node(const document& src, int index);
+
+		void	set_name(int index, const char* name);
+		void	set_value(int index, const char* value);
+
+		// Inserts child (which must not have a parent) before
+		// the given sibling, or last if before == -1.
+		void	insert_child(int parent, int child, int before);
+		void	remove_from_parent(int index);
+
+		// True if index is ancestor or one of its ancestors.
+		bool	is_ancestor(int ancestor, int index) const;
+
+		// Appends the node as XML text.
+		void	write(int index, tu_string* out) const;
+
+		// Bytes of node, attribute and string data.
+		int	get_memory_used() const;
+
+		// Drops the nodes that aren't in the root's tree or in
+		// the tree of any node listed in *keep, and the strings
+		// and attributes nothing uses any more.  The nodes left
+		// are renumbered, and *keep is updated to match; -1
+		// entries are left alone.
+		void	compact(array<int>* keep);
+
+		// True if the arrays have grown enough since they were
+		// last compacted (or parsed into) that compact() is
+		// worth calling.
+		bool	needs_compact() const;
+
+		// handler
+		virtual void	start_element(const char* name, const attribute* attributes, int attribute_count);
+		virtual void	end_element(const char* name);
+		virtual void	text(const char* text, int length);
+		virtual void	processing_instruction(const char* text, int length);
+		virtual void	doctype(const char* text, int length);
+
+	private:
+		const char*	get_string(int offset) const { return offset >= 0 ? &m_strings[offset] : NULL; }
+		int	add_string(const char* str, int length);
+		int	add_node(int type);
+		void	mark_tree(int top, array<int>* marks) const;
+		int	copy_string(int offset, array<char>* strings, hash<int, int>* string_map) const;
+
+		array<node>	m_nodes;
+		array<int>	m_attributes;	// name, value string offsets
+		array<char>	m_strings;
+		int	m_current;	// open element while parsing
+		int	m_text_node;	// text node we're still adding to, or -1
+		int	m_xml_decl;
+		int	m_doctype;
+		bool	m_ignore_white;
+		int	m_compacted_size;	// get_memory_used() after the last parse or compact
+	};
+
+	// Appends str with <, >, &, and (if quotes is set) " escaped.
+	void	escape(const char* str, tu_string* out, bool quotes);
+}
+
+
+#endif // TU_XML_H
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
@@ -18,7 +18,7 @@
 #include <string.h>
 
 #include "bt_array.h"
-#include "mmap_util.h"
+#include "base/mmap_util.h"
 #include "base/utility.h"
 #include "base/tu_file.h"
 #include <string.h>
@@ -276,21 +276,73 @@ float	bt_array::get_sample(int x, int z) const
 		index = (m_height - 1 - z) + m_height * x;
 	}
 
+	return decode_sample(data, index);
+}
+
+
+void	bt_array::get_samples(float* samples, int x0, int z0, int width, int height) const
+// Read a block of samples.  The .bt data is in columns, so we read a
+// column's worth of the block at a time.
+{
+	assert(samples);
+	assert(width > 0 && height > 0);
+
+	// The rows of the block that are in the file; rows outside
+	// get copies of the nearest of these.
+	int	z_min = iclamp(z0, 0, m_height - 1);
+	int	z_max = iclamp(z0 + height - 1, 0, m_height - 1);
+	int	v_min = m_height - 1 - z_max;
+	int	column_bytes = (z_max - z_min + 1) * m_sizeof_element;
+
+	array<Uint8>	buffer;
+	if (m_data == NULL) {
+		buffer.resize(column_bytes);
+	}
+
+	for (int i = 0; i < width; i++) {
+		int	x = iclamp(x0 + i, 0, m_width - 1);
+
+		const void*	column = NULL;
+		if (m_data) {
+			column = ((const Uint8*) m_data) + BT_HEADER_SIZE + (v_min + m_height * x) * m_sizeof_element;
+		} else {
+			Uint64	offset_i64 =
+				(Uint64) BT_HEADER_SIZE
+				+ ((Uint64) v_min + (Uint64) m_height * (Uint64) x)
+				* (Uint64) m_sizeof_element;
+
+			tu_thread::autolock	lock(&m_file_mutex);
+			lseek64(m_file_handle, offset_i64, SEEK_SET);
+			read(m_file_handle, &buffer[0], column_bytes);
+			column = &buffer[0];
+		}
+
+		for (int j = 0; j < height; j++) {
+			int	z = iclamp(z0 + j, z_min, z_max);
+			samples[j * width + i] = decode_sample(column, z_max - z);
+		}
+	}
+}
+
+
+float	bt_array::decode_sample(const void* data, int index) const
+// Return the sample at the given index in some raw .bt data.
+{
 	if (m_float_data) {
 		// raw data is floats.
-		data += index * 4;
+		const Uint8*	p = (const Uint8*) data + index * 4;
 		union {
 			float	f;
 			Uint32	u;
 		} raw;
-		raw.u = swap_le32(*(Uint32*) data);
+		raw.u = swap_le32(*(const Uint32*) p);
 
 		return raw.f;
 
 	} else {
 		// Raw data is 16-bit integer.
-		data += index * 2;
-		Uint16	y = swap_le16(*(Uint16*) data);
+		const Uint8*	p = (const Uint8*) data + index * 2;
+		Uint16	y = swap_le16(*(const Uint16*) p);
 
 		return y;
 	}
@@ -13,6 +13,7 @@
 
 
 #include "base/container.h"
+#include "base/tu_thread.h"
 
 
 class bt_array
@@ -38,6 +39,12 @@ public:
 	// out-of-bounds access is clamped.
 	float	get_sample(int x, int z) const;
 
+	// Fills samples[] with the block of width x height samples
+	// whose northwest corner is (x0, z0), row by row.  Clamps like
+	// get_sample().  Doesn't go through the cache, so any number
+	// of threads can call this at once.
+	void	get_samples(float* samples, int x0, int z0, int width, int height) const;
+
 private:
 	// We're going to cache short vertical strips of data, because
 	// our processing tools often want to scan horizontally, but
@@ -69,6 +76,9 @@ private:
 	int	m_data_size;
 
 	int	m_file_handle;
+	mutable tu_thread::mutex	m_file_mutex;	// for get_samples() from an unmapped file
+
+	float	decode_sample(const void* data, int index) const;
 };
 
 
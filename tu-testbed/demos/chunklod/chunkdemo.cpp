@@ -575,6 +575,10 @@ int	main(int argc, char *argv[])
 	// Does it look like a .tqt file?
 	if (tqt::is_tqt_file(texturefile)) {
 		texture_quadtree = new tqt(texturefile);
+
+		// Keep decoded tiles around, so textures that get
+		// unloaded and loaded again don't need decoding again.
+		texture_quadtree->set_cache(32 << 20);
 	}
 
 	if (texture_quadtree == NULL) {
@@ -622,13 +626,8 @@ int	main(int argc, char *argv[])
 #endif // CATCH_EXCEPTIONS
 	{
 
-		// Load our chunked model.
-		tu_file*	in = new tu_file(chunkfile, "rb");
-		if (in->get_error()) {
-			printf("Can't open '%s'\n", chunkfile);
-			exit(1);
-		}
-		lod_chunk_tree*	model = new lod_chunk_tree(in, texture_quadtree);
+		// Load our chunked model.  It maps the file, if it can.
+		lod_chunk_tree*	model = new lod_chunk_tree(chunkfile, texture_quadtree);
 
 		vec3	center, extent;
 		model->get_bounding_box(&center, &extent);
@@ -721,6 +720,16 @@ int	main(int argc, char *argv[])
 					float	tps = total_triangle_count / (performance_timer / 1000.f);
 					printf("fps = %3.1f : tri/s = %3.2fM : tri/frame = %2.3fM\n", fps, tps / 1000000.f, frame_triangle_count / 1000000.f);
 
+					if (texture_quadtree) {
+						tqt_cache_stats	stats;
+						texture_quadtree->get_cache_stats(&stats);
+						printf("tile cache: hit rate = %2.0f%% : decodes = %d (%1.2f ms avg) : prefetch hits = %d/%d : resident = %dK\n",
+						       stats.get_hit_rate() * 100, stats.m_decodes,
+						       stats.m_decodes ? stats.m_decode_seconds * 1000 / stats.m_decodes : 0.0,
+						       stats.m_prefetch_hits, stats.m_prefetches, stats.m_resident_bytes >> 10);
+						texture_quadtree->clear_cache_stats();
+					}
+
 					total_triangle_count = 0;
 					performance_timer = 0;
 					frame_count = 0;
@@ -737,9 +746,6 @@ int	main(int argc, char *argv[])
 			delete texture_quadtree;
 			texture_quadtree = NULL;
 		}
-
-		delete in;
-		in = NULL;
 	}
 #ifdef CATCH_EXCEPTIONS
 	catch (const char* message) {
@@ -17,13 +17,15 @@
 
 #include "base/dlmalloc.h"
 #include "base/image.h"
+#include "base/mmap_util.h"
 #include "base/ogl.h"
+#include "base/tu_atomic.h"
 #include "base/tu_file.h"
+#include "base/tu_thread.h"
+#include "base/tu_timer.h"
 #include "base/utility.h"
 #include "geometry/tqt.h"
 
-#include "SDL_thread.h"
-
 #include "chunklod.h"
 
 
@@ -229,18 +231,26 @@ struct vertex_info {
 
 	int	triangle_count;	// for statistics.
 
+	bool	mapped;	// vertices & indices point into a memory-mapped file
+
 //code:
 	vertex_info()
 		: vertex_count(0),
 		  vertices(0),
 		  index_count(0),
 		  indices(0),
-		  triangle_count(0)
+		  triangle_count(0),
+		  mapped(false)
 	{
 	}
 
 	~vertex_info()
 	{
+		if (mapped) {
+			// Not ours.
+			vertices = NULL;
+			indices = NULL;
+		}
 		if (vertices) {
 //			delete [] vertices;
 			dlfree(vertices);
@@ -254,6 +264,7 @@ struct vertex_info {
 	}
 
 	void	read(tu_file* in);
+	void	map(const Uint8* data, int size);
 
 	int	get_data_size() const
 	// Return the data bytes used by this object.
@@ -292,6 +303,44 @@ void	vertex_info::read(tu_file* in)
 }
 
 
+void	vertex_info::map(const Uint8* data, int size)
+// Use the vert info at data, from a memory-mapped .chu file, in
+// place.  The layout is the same as read() expects; the file is
+// little-endian, and chunk data is aligned, so on little-endian
+// machines the vertex & index arrays can be used as they are.
+{
+#if _TU_LITTLE_ENDIAN_
+	const Uint8*	p = data;
+	vertex_count = p[0] | (p[1] << 8);
+	p += 2;
+	vertices = (vertex*) p;
+	p += vertex_count * sizeof(vertex);
+
+	index_count = p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+	p += 4;
+	indices = index_count > 0 ? (Uint16*) p : NULL;
+	p += index_count * sizeof(Uint16);
+
+	triangle_count = p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+	p += 4;
+
+	assert(p - data <= size);
+	mapped = true;
+
+	// Touch every page now, so they're resident before the main
+	// thread renders from them.
+	volatile Uint8	sink = 0;
+	for (const Uint8* page = data; page < p; page += 4096) {
+		sink += *page;
+	}
+#else // not _TU_LITTLE_ENDIAN_
+	// Have to swap; make a copy.
+	tu_file	in(tu_file::memory_buffer, size, (void*) data);
+	read(&in);
+#endif // not _TU_LITTLE_ENDIAN_
+}
+
+
 struct lod_chunk;
 
 
@@ -310,6 +359,13 @@ struct lod_chunk_data {
 		m_verts.read(in);
 	}
 
+	lod_chunk_data(const Uint8* mapped_data, int size)
+	// Constructor.  Use our data in place, from a memory-mapped
+	// file.
+	{
+		m_verts.map(mapped_data, size);
+	}
+
 
 	~lod_chunk_data()
 	// Destructor.
@@ -347,7 +403,8 @@ struct lod_chunk {
 	// Vertical bounds, for constructing bounding box.
 	Sint16	m_min_y, m_max_y;
 
-	long	m_data_file_position;
+	Uint64	m_data_file_position;
+	int	m_data_size;	// 0 if the file doesn't say (format version < 10)
 	lod_chunk_data*	m_data;
 	unsigned int	m_texture_id;		// OpenGL texture id for this chunk's texture map.
 
@@ -385,7 +442,7 @@ struct lod_chunk {
 
 	int	render(const lod_chunk_tree& c, const view_state& v, cull::result_info cull_info, render_options opt, bool texture_bound);
 
-	void	read(tu_file* in, int recursion_count, lod_chunk_tree* tree, bool vert_data_at_end);
+	void	read(tu_file* in, int recursion_count, lod_chunk_tree* tree, int format_version);
 	void	lookup_neighbors(lod_chunk_tree* tree);
 
 	// Utilities.
@@ -424,7 +481,18 @@ struct lod_chunk {
 
 //
 // chunk_tree_loader -- helper for lod_chunk_tree that handles the
-// background loader thread.
+// background loader threads.
+//
+// The main thread collects load requests during update(), and in
+// sync_loader_thread() publishes the most urgent ones (up to
+// MAX_REQUESTS of each kind) in a small array, best first.  Each
+// chunk has a state word per kind (data & texture); the workers
+// claim a published chunk by swapping its state from QUEUED to
+// LOADING, so the array itself is only a hint and the main thread can
+// rewrite it, or cancel a stale request by swapping QUEUED back to
+// IDLE, without stopping the workers.  Finished loads go on a
+// lock-free stack, which the main thread empties in the next
+// sync_loader_thread() and links into the tree.
 //
 
 
@@ -443,15 +511,44 @@ public:
 
 	tu_file*	get_source() { return m_source_stream; }
 
-	// Call this to enable/disable the background loader thread.
+	// Call this to enable/disable the background loader threads.
 	void	set_use_loader_thread(bool use);
+	void	set_thread_count(int count);
+
+	void	set_memory_budget(int bytes) { m_memory_budget = bytes; }
+	const chunk_load_stats&	get_stats() const { return m_stats; }
 
-	int	loader_thread();		// thread function!
 private:
-	void	start_loader_thread();
-	bool	loader_service_data();		// in loader thread
-	bool	loader_service_texture();	// in loader thread
-	
+	enum load_kind
+	{
+		LOAD_DATA,
+		LOAD_TEXTURE,
+
+		LOAD_KIND_COUNT
+	};
+
+	enum load_state
+	{
+		IDLE,		// not wanted, or already resident
+		QUEUED,		// published; waiting for a worker
+		LOADING,	// a worker has it
+		LOADED,		// waiting in the retire stack
+	};
+
+	enum { MAX_REQUESTS = 32 };	// published requests per kind
+
+	struct load_slot
+	// Loader bookkeeping for one chunk's data or texture.
+	{
+		volatile int	m_state;	// load_state
+		int	m_request_frame;	// last frame this was asked for
+		int	m_publish_frame;	// last frame this was published
+		int	m_queue_index;		// into m_load_queue, if m_request_frame is this frame
+		uint64	m_first_request_ticks;	// when it was first asked for, in the current run of frames
+		void*	m_result;		// lod_chunk_data* or image::rgb*
+		load_slot* volatile	m_next;	// in the retire stack
+	};
+
 	struct pending_load_request
 	{
 		lod_chunk*	m_chunk;
@@ -476,51 +573,49 @@ private:
 		}
 	};
 
-	struct retire_info
-	// A struct that associates a chunk with its newly loaded
-	// data.  For communicating between m_loader_thread and the
-	// main thread.
-	{
-		lod_chunk*	m_chunk;
-		lod_chunk_data*	m_chunk_data;
-
-		retire_info() : m_chunk(0), m_chunk_data(0) {}
-	};
+	load_slot*	get_slot(int kind, lod_chunk* chunk) { return &m_slots[kind][chunk - m_tree->m_chunks]; }
+	lod_chunk*	get_chunk(int kind, load_slot* slot) { return &m_tree->m_chunks[slot - &m_slots[kind][0]]; }
+	bool	is_resident(int kind, lod_chunk* c) const { return kind == LOAD_DATA ? c->m_data != NULL : c->m_texture_id != 0; }
 
-	struct retire_texture_info
-	// Associates a chunk with its newly loaded texture data.
-	{
-		lod_chunk*	m_chunk;
-		image::rgb*	m_texture_image;
+	void	add_request(int kind, lod_chunk* chunk, float priority);
+	void	publish_requests(int kind);
+	void	retire_loads(int kind);
+	void	record_latency(int kind, load_slot* slot);
 
-		retire_texture_info() : m_chunk(0), m_texture_image(0) {}
-	};
+	void	start_threads(int count);
+	void	stop_threads();
+	static void	thread_main(void* loader);
+	bool	service(int kind);	// in a loader thread
 
 	lod_chunk_tree*	m_tree;
 	tu_file*	m_source_stream;
+	tu_thread::mutex	m_source_mutex;	// for m_source_stream, if it can't read_at()
 
-	// These two are for the main thread's use only.  For
-	// update()/update_texture() to communicate with
-	// sync_loader_thread().
+	// Main thread only.  For update()/update_texture() to
+	// communicate with sync_loader_thread().
 	array<lod_chunk*>	m_unload_queue;
-	array<pending_load_request>	m_load_queue;
-
 	array<lod_chunk*>	m_unload_texture_queue;
-	array<lod_chunk*>	m_load_texture_queue;
-
-	// These two are for the main thread to communicate with the
-	// loader thread & vice versa.
-#define REQUEST_BUFFER_SIZE 4
-	lod_chunk* volatile	m_request_buffer[REQUEST_BUFFER_SIZE];	// chunks waiting to be loaded; filled will NULLs otherwise.
-	retire_info volatile	m_retire_buffer[REQUEST_BUFFER_SIZE];	// chunks waiting to be united with their loaded data.
-
-	lod_chunk* volatile	m_request_texture_buffer[REQUEST_BUFFER_SIZE];		// chunks waiting for their textures to be loaded.
-	retire_texture_info volatile	m_retire_texture_buffer[REQUEST_BUFFER_SIZE];	// chunks waiting to be united with their loaded textures.
-
-	// Loader thread stuff.
-	SDL_Thread*	m_loader_thread;
-	volatile bool	m_run_loader_thread;	// loader thread watches for this to go false, then exits.
-	SDL_mutex*	m_mutex;
+	array<pending_load_request>	m_load_queue[LOAD_KIND_COUNT];
+	array<lod_chunk*>	m_published[LOAD_KIND_COUNT];	// what's in m_requests
+	int	m_frame;
+
+	// Shared with the loader threads.
+	array<load_slot>	m_slots[LOAD_KIND_COUNT];	// one per chunk
+	lod_chunk* volatile	m_requests[LOAD_KIND_COUNT][MAX_REQUESTS];	// best first; NULL-terminated unless full
+	load_slot* volatile	m_retired[LOAD_KIND_COUNT];	// stack, linked through m_next
+
+	// Loader threads.  They sleep on m_wake until
+	// m_wake_generation changes.
+	array<tu_thread::thread*>	m_threads;
+	int	m_thread_count;		// to use when the threads are on
+	bool	m_use_threads;
+	tu_thread::mutex	m_wake_mutex;
+	tu_thread::condition	m_wake;
+	int	m_wake_generation;
+	bool	m_quit;
+
+	int	m_memory_budget;	// for chunk data; 0 means no limit
+	chunk_load_stats	m_stats;
 };
 
 
@@ -529,532 +624,608 @@ chunk_tree_loader::chunk_tree_loader(lod_chunk_tree* tree, tu_file* src)
 {
 	m_tree = tree;
 	m_source_stream = src;
+	m_frame = 0;
 
-	for (int i = 0; i < REQUEST_BUFFER_SIZE; i++)
+	for (int kind = 0; kind < LOAD_KIND_COUNT; kind++)
 	{
-		m_request_buffer[i] = NULL;
-		m_retire_buffer[i].m_chunk = NULL;
-		m_request_texture_buffer[i] = NULL;
-		m_retire_texture_buffer[i].m_chunk = NULL;
+		m_slots[kind].resize(tree->m_chunk_count);
+		for (int i = 0; i < m_slots[kind].size(); i++)
+		{
+			load_slot&	s = m_slots[kind][i];
+			s.m_state = IDLE;
+			s.m_request_frame = -2;
+			s.m_publish_frame = -2;
+			s.m_queue_index = 0;
+			s.m_first_request_ticks = 0;
+			s.m_result = NULL;
+			s.m_next = NULL;
+		}
+		for (int i = 0; i < MAX_REQUESTS; i++)
+		{
+			m_requests[kind][i] = NULL;
+		}
+		m_retired[kind] = NULL;
 	}
 
-	// Set up thread communication stuff.
-	m_mutex = SDL_CreateMutex();
-	assert(m_mutex);
-	start_loader_thread();
+	// I/O bound, so use at least two threads even on one
+	// processor.
+	m_thread_count = iclamp(tu_thread::get_processor_count(), 2, 8);
+	m_use_threads = false;
+	m_wake_generation = 0;
+	m_quit = false;
+	m_memory_budget = 0;
+	m_stats.clear();
+
+	set_use_loader_thread(true);
 }
 
 
 chunk_tree_loader::~chunk_tree_loader()
-// Destructor.  Make sure thread is done.
+// Destructor.  Make sure the threads are done, and throw away
+// anything they loaded that didn't get used.
+{
+	stop_threads();
+
+	for (int kind = 0; kind < LOAD_KIND_COUNT; kind++)
+	{
+		for (load_slot* s = m_retired[kind]; s; s = s->m_next)
+		{
+			if (kind == LOAD_DATA)
+			{
+				delete (lod_chunk_data*) s->m_result;
+			}
+			else
+			{
+				delete (image::rgb*) s->m_result;
+			}
+		}
+		m_retired[kind] = NULL;
+	}
+}
+
+
+void	chunk_tree_loader::set_use_loader_thread(bool use)
+// Call this to enable/disable the use of background loader threads.
+// Turning them off may take a moment, since we have to wait for any
+// loads in progress.  With the threads off, sync_loader_thread() does
+// a few loads itself.
 {
-	// Make sure to kill the loader thread.
-	set_use_loader_thread(false);
+#if TU_CONFIG_LINK_TO_THREAD == 0
+	// No real threads; a worker would never return.
+	use = false;
+#endif
+
+	if (use == m_use_threads)
+	{
+		return;
+	}
+	m_use_threads = use;
 
-	SDL_DestroyMutex(m_mutex);
-	m_mutex = NULL;
+	if (use)
+	{
+		start_threads(m_thread_count);
+	}
+	else
+	{
+		stop_threads();
+	}
 }
 
 
-void	chunk_tree_loader::start_loader_thread()
-// Initiate the loader thread, then return.
+void	chunk_tree_loader::set_thread_count(int count)
+// Set the number of loader threads to use.  0 means pick a number
+// based on the processor count.
 {
-	m_run_loader_thread = true;
+	if (count <= 0)
+	{
+		count = iclamp(tu_thread::get_processor_count(), 2, 8);
+	}
+	m_thread_count = count;
 
-	// Thunk to wrap loader_thread(), which is a member fn.
-	struct wrapper {
-		static int	thread_wrapper(void* loader)
-		{
-			return ((chunk_tree_loader*) loader)->loader_thread();
-		}
-	};
-	m_loader_thread = SDL_CreateThread(wrapper::thread_wrapper, this);
+	if (m_use_threads && m_threads.size() != count)
+	{
+		stop_threads();
+		start_threads(count);
+	}
 }
 
 
-void	chunk_tree_loader::set_use_loader_thread(bool use)
-// Call this to enable/disable the use of a background loader thread.
-// May take a moment of latency to return, since if the background
-// thread is active, then this function has to signal it and wait for
-// it to terminate.
+void	chunk_tree_loader::start_threads(int count)
 {
-	if (m_run_loader_thread) {
-		assert(m_loader_thread);
-		if (use) {
-			// We're already using the thread; nothing to do.
-			return;
-		}
-		else {
-			// Thread is running -- kill it.
-			m_run_loader_thread = false;
-			SDL_WaitThread(m_loader_thread, NULL);
-			m_loader_thread = NULL;
-			return;
-		}
-	}
-	else {
-		assert(m_loader_thread == NULL);
-		if (use == false) {
-			// We're already not using the loader thread; nothing to do.
-			return;
-		} else {
-			// Thread is not running -- start it up.
-			start_loader_thread();
-			assert(m_loader_thread);
-		}
+	assert(m_threads.size() == 0);
+
+	m_quit = false;
+	for (int i = 0; i < count; i++)
+	{
+		m_threads.push_back(new tu_thread::thread(thread_main, this));
 	}
 }
 
 
-void	chunk_tree_loader::sync_loader_thread()
-// Call this periodically, to implement previously requested changes
-// to the lod_chunk_tree.  Most of the work in preparing changes is
-// done in a background thread, so this call is intended to be
-// low-latency.
-//
-// The chunk_tree_loader is not allowed to make any changes to the
-// lod_chunk_tree, except in this call.
+void	chunk_tree_loader::stop_threads()
+// Tell the loader threads to quit, and wait for them.
 {
-	// mutex section
-	SDL_LockMutex(m_mutex);
-	{
-		// Unload data.
-		for (int i = 0; i < m_unload_queue.size(); i++) {
-			lod_chunk*	c = m_unload_queue[i];
-			// Only unload the chunk if it's not currently in use.
-			// Sometimes a chunk will be marked for unloading, but
-			// then is still being used due to a dependency in a
-			// neighboring part of the hierarchy.  We want to
-			// ignore the unload request in that case.
-			if (c->m_parent != NULL
-			    && c->m_parent->m_split == false)
+	{
+		tu_thread::autolock	lock(&m_wake_mutex);
+		m_quit = true;
+		m_wake.broadcast();
+	}
+	for (int i = 0; i < m_threads.size(); i++)
+	{
+		delete m_threads[i];	// waits
+	}
+	m_threads.resize(0);
+}
+
+
+/*static*/ void	chunk_tree_loader::thread_main(void* loader)
+// Loader thread.  Load whatever's published, then sleep until the
+// main thread publishes more, until we're told to quit.
+{
+	chunk_tree_loader*	l = (chunk_tree_loader*) loader;
+
+	for (;;)
+	{
+		int	generation;
+		{
+			tu_thread::autolock	lock(&l->m_wake_mutex);
+			if (l->m_quit)
 			{
-				c->unload_data();
+				return;
 			}
+			generation = l->m_wake_generation;
 		}
-		m_unload_queue.resize(0);
-
-		// Unload textures.
-		{for (int i = 0; i < m_unload_texture_queue.size(); i++) {
-			lod_chunk*	c = m_unload_texture_queue[i];
-			if (c->m_parent != NULL) {
-				assert(c->m_parent->m_texture_id != 0);
-				assert(c->has_children() == false
-				       || (c->m_children[0]->m_texture_id == 0
-					   && c->m_children[1]->m_texture_id == 0
-					   && c->m_children[2]->m_texture_id == 0
-					   && c->m_children[3]->m_texture_id == 0));
-				
-				c->release_texture();
-			}
-		}}
-		m_unload_texture_queue.resize(0);
 
-		// Retire any serviced requests.
-		{for (int i = 0; i < REQUEST_BUFFER_SIZE; i++)
+		// Geometry first; a chunk can't split until its
+		// children have data.
+		for (;;)
 		{
-			retire_info&	r = const_cast<retire_info&>(m_retire_buffer[i]);	// cast away 'volatile' (we're inside the mutex section)
-			if (r.m_chunk)
-			{
-				assert(r.m_chunk->m_data == NULL);
-
-				if (r.m_chunk->m_parent != NULL
-				    && r.m_chunk->m_parent->m_data == NULL)
-				{
-					// Drat!  Our parent data was unloaded, while we were
-					// being loaded.  Only thing to do is discard the newly loaded
-					// data, to avoid breaking an invariant.
-					// (No big deal; this situation is rare.)
-					delete r.m_chunk_data;
-				}
-				else
-				{
-					// Connect the chunk with its data!
-					r.m_chunk->m_data = r.m_chunk_data;
-				}
-			}
-			// Clear out this entry.
-			r.m_chunk = NULL;
-			r.m_chunk_data = NULL;
-		}}
+			if (l->service(LOAD_DATA)) continue;
+			if (l->service(LOAD_TEXTURE)) continue;
+			break;
+		}
 
-		// Retire any serviced texture requests.
-		{for (int i = 0; i < REQUEST_BUFFER_SIZE; i++)
 		{
-			retire_texture_info&	r = const_cast<retire_texture_info&>(m_retire_texture_buffer[i]);
-			if (r.m_chunk)
+			tu_thread::autolock	lock(&l->m_wake_mutex);
+			while (l->m_quit == false && l->m_wake_generation == generation)
 			{
-				assert(r.m_chunk->m_texture_id == 0);
-
-				if (r.m_chunk->m_parent != NULL
-				    && r.m_chunk->m_parent->m_texture_id == 0)
-				{
-					// Drat!  Our parent texture was unloaded, while we were
-					// being loaded.  Only thing to do is to discard the
-					// newly loaded image, to avoid breaking the invariant.
-					// (No big deal; this situation is rare.)
-					delete r.m_texture_image;
-				}
-				else
-				{
-					// Connect the chunk with its texture!
-					r.m_chunk->m_texture_id = lod_tile_freelist::make_texture(r.m_texture_image);	// @@ this actually could cause some bad latency, because we build mipmaps...
-				}
+				l->m_wake.wait(&l->m_wake_mutex);
 			}
-			// Clear out this entry.
-			r.m_chunk = NULL;
-			r.m_texture_image = NULL;
-		}}
-
-		//
-		// Pass new data requests to the loader thread.  Go in
-		// order of priority, and only take a few.
-		//
+		}
+	}
+}
 
-		// Wipe out stale requests.
-		{for (int i = 0; i < REQUEST_BUFFER_SIZE; i++) {
-			m_request_buffer[i] = NULL;
-		}}
 
-		// Fill in new requests.
-		int	qsize = m_load_queue.size();
-		if (qsize > 0)
+bool	chunk_tree_loader::service(int kind)
+// Claim the best published request of the given kind, and load it.
+// Return true if we loaded something; false if there was nothing to
+// claim.
+{
+	load_slot*	slot = NULL;
+	lod_chunk*	chunk = NULL;
+	for (int i = 0; i < MAX_REQUESTS; i++)
+	{
+		lod_chunk*	c = tu_atomic_load_ptr(&m_requests[kind][i]);
+		if (c == NULL)
 		{
-			int	req_count = 0;
+			break;
+		}
+		load_slot*	s = get_slot(kind, c);
+		if (tu_atomic_compare_and_swap(&s->m_state, QUEUED, LOADING))
+		{
+			slot = s;
+			chunk = c;
+			break;
+		}
+	}
+	if (slot == NULL)
+	{
+		return false;
+	}
 
-			// Sort by priority.
-			qsort(&m_load_queue[0], qsize, sizeof(m_load_queue[0]), pending_load_request::compare);
-			{for (int i = 0; i < qsize; i++)
+	// The chunk is ours until we put it on the retire stack.  The
+	// main thread doesn't touch its data or texture meanwhile, so
+	// it can't change its mind about the parent either, except by
+	// unloading it, which retire_loads() checks for.
+	if (kind == LOAD_DATA)
+	{
+		const Uint8*	mapped_data = m_tree->m_mapped_data;
+		if (mapped_data)
+		{
+			// Use the data in place.
+			Uint64	position = chunk->m_data_file_position;
+			assert(position < m_tree->m_mapped_size);
+			int	size = chunk->m_data_size;
+			if (size == 0)
 			{
-				lod_chunk*	c = m_load_queue[qsize - 1 - i].m_chunk;	// Do the higher priority requests first.
-				// Must make sure the chunk wasn't just retired.
-				if (c->m_data == NULL
-				    && (c->m_parent == NULL || c->m_parent->m_data != NULL))
-				{
-					// Request this chunk.
-					m_request_buffer[req_count++] = c;
-					if (req_count >= REQUEST_BUFFER_SIZE) {
-						// We've queued up enough requests.
-						break;
-					}
-				}
-			}}
-		
-			m_load_queue.resize(0);	// forget this frame's requests; we'll generate a fresh list during the next update()
+				// Old file; we don't know the size.
+				Uint64	left = m_tree->m_mapped_size - position;
+				size = left > 0x7FFFFFFF ? 0x7FFFFFFF : (int) left;
+			}
+			slot->m_result = new lod_chunk_data(mapped_data + position, size);
 		}
+		else if (m_source_stream->has_read_at())
+		{
+			// Read through our own view of the file, so
+			// the other threads can too.
+			assert(chunk->m_data_file_position <= 0x7FFFFFFF);	// tu_file positions are ints
+			tu_file	in(tu_file::view, m_source_stream, (int) chunk->m_data_file_position);
+			slot->m_result = new lod_chunk_data(&in);
+		}
+		else
+		{
+			tu_thread::autolock	lock(&m_source_mutex);
+			m_source_stream->set_position((int) chunk->m_data_file_position);
+			slot->m_result = new lod_chunk_data(m_source_stream);
+		}
+	}
+	else
+	{
+		const tqt*	qt = m_tree->m_texture_quadtree;
+		assert(qt && chunk->m_level < qt->get_depth());
+		slot->m_result = qt->load_image(chunk->m_level, chunk->m_x, chunk->m_z);
+	}
 
-		//
-		// Pass texture requests.
-		//
+	// Retire: push the slot on the stack for the main thread.
+	tu_atomic_store(&slot->m_state, LOADED);
+	for (;;)
+	{
+		load_slot*	top = tu_atomic_load_ptr(&m_retired[kind]);
+		slot->m_next = top;
+		if (tu_atomic_compare_and_swap_ptr(&m_retired[kind], top, slot))
+		{
+			break;
+		}
+	}
 
-		// Wipe out stale requests.
-		{for (int i = 0; i < REQUEST_BUFFER_SIZE; i++) {
-			m_request_texture_buffer[i] = NULL;
-		}}
+	return true;
+}
 
-		int	tqsize = m_load_texture_queue.size();
-		if (tqsize > 0)
-		{
-			int	req_count = 0;
 
-			{for (int i = 0; i < tqsize; i++)
-			{
-				lod_chunk*	c = m_load_texture_queue[i];
-				// Must make sure the chunk wasn't
-				// just retired, and also that its
-				// parent wasn't just unloaded.
-				if (c->m_texture_id == 0
-				    && (c->m_parent == NULL || c->m_parent->m_texture_id != 0))
-				{
-					// Request this chunk.
-					m_request_texture_buffer[req_count++] = c;
-					if (req_count >= REQUEST_BUFFER_SIZE) {
-						// We've queued up enough requests.
-						break;
-					}
-				}
-			}}
-		
-			m_load_texture_queue.resize(0);	// forget this frame's requests; we'll generate a fresh list during the next update()
+void	chunk_tree_loader::sync_loader_thread()
+// Call this periodically, to implement previously requested changes
+// to the lod_chunk_tree.  The loading happens in the background
+// threads, so this call is intended to be low-latency.
+//
+// The chunk_tree_loader is not allowed to make any changes to the
+// lod_chunk_tree, except in this call.
+{
+	// Unload data.
+	for (int i = 0; i < m_unload_queue.size(); i++) {
+		lod_chunk*	c = m_unload_queue[i];
+		// Only unload the chunk if it's not currently in use.
+		// Sometimes a chunk will be marked for unloading, but
+		// then is still being used due to a dependency in a
+		// neighboring part of the hierarchy.  We want to
+		// ignore the unload request in that case.
+		if (c->m_parent != NULL
+		    && c->m_parent->m_split == false
+		    && c->m_data)
+		{
+			m_stats.m_resident_bytes -= c->m_data->get_data_size();
+			m_stats.m_resident_chunks--;
+			c->unload_data();
 		}
 	}
-	SDL_UnlockMutex(m_mutex);
+	m_unload_queue.resize(0);
+
+	// Unload textures.
+	{for (int i = 0; i < m_unload_texture_queue.size(); i++) {
+		lod_chunk*	c = m_unload_texture_queue[i];
+		if (c->m_parent != NULL) {
+			assert(c->m_parent->m_texture_id != 0);
+			assert(c->has_children() == false
+			       || (c->m_children[0]->m_texture_id == 0
+				   && c->m_children[1]->m_texture_id == 0
+				   && c->m_children[2]->m_texture_id == 0
+				   && c->m_children[3]->m_texture_id == 0));
+			
+			c->release_texture();
+		}
+	}}
+	m_unload_texture_queue.resize(0);
 
+	// Link in finished loads, and hand out this frame's requests.
+	{for (int kind = 0; kind < LOAD_KIND_COUNT; kind++)
+	{
+		retire_loads(kind);
+		publish_requests(kind);
+	}}
 
-	if (m_run_loader_thread == false)
+	if (m_use_threads == false)
 	{
-		// Loader thread is not actually running (at client
-		// request, via set_use_loader_thread()), so instead,
-		// service any requests synchronously, right now.
+		// The loader threads are off (at client request, via
+		// set_use_loader_thread()), so instead, service a few
+		// requests synchronously, right now.  They get linked
+		// in on the next call.
 		int	count;
 		for (count = 0; count < 4; count++) {
-			bool	loaded = loader_service_data();
-			if (loaded == false) break;
+			if (service(LOAD_DATA) == false) break;
 		}
 		for (count = 0; count < 4; count++) {
-			bool	loaded = loader_service_texture();
-			if (loaded == false) break;
+			if (service(LOAD_TEXTURE) == false) break;
 		}
 	}
+
+	m_frame++;
 }
 
 
-void	chunk_tree_loader::request_chunk_load(lod_chunk* chunk, float urgency)
-// Request that the specified chunk have its data loaded.  May
-// take a while; data doesn't actually show up & get linked in
-// until some future call to sync_loader_thread().
+void	chunk_tree_loader::retire_loads(int kind)
+// Link the finished loads of the given kind into the tree.
 {
-	assert(chunk);
-	assert(chunk->m_data == NULL);
+	// Take the whole stack at once.
+	load_slot*	list;
+	for (;;)
+	{
+		list = tu_atomic_load_ptr(&m_retired[kind]);
+		if (list == NULL
+		    || tu_atomic_compare_and_swap_ptr(&m_retired[kind], list, (load_slot*) NULL))
+		{
+			break;
+		}
+	}
 
-	// Don't schedule for load unless our parent already has data.
-	if (chunk->m_parent == NULL
-	    || chunk->m_parent->m_data != NULL)
+	while (list)
 	{
-#if 0
-		// See if we're in the request queue already.
-		// Ugh, N^2.  TODO use a hash to do this lookup.
-		for (int i = 0; i < m_load_queue.size(); i++) {
-			if (m_load_queue[i].m_chunk == chunk) {
-				// Already listed; use the max priority.
-				m_load_queue[i].m_priority = fmax(urgency, m_load_queue[i].m_priority);
-				return;
+		load_slot*	s = list;
+		list = s->m_next;
+		s->m_next = NULL;
+		assert(tu_atomic_load(&s->m_state) == LOADED);
+
+		lod_chunk*	c = get_chunk(kind, s);
+		if (kind == LOAD_DATA)
+		{
+			lod_chunk_data*	data = (lod_chunk_data*) s->m_result;
+			assert(c->m_data == NULL);
+
+			if (c->m_parent != NULL
+			    && c->m_parent->m_data == NULL)
+			{
+				// Drat!  Our parent data was unloaded, while we were
+				// being loaded.  Only thing to do is discard the newly loaded
+				// data, to avoid breaking an invariant.
+				// (No big deal; this situation is rare.)
+				delete data;
+				m_stats.m_discarded++;
+			}
+			else
+			{
+				// Connect the chunk with its data!
+				c->m_data = data;
+				m_stats.m_resident_bytes += data->get_data_size();
+				m_stats.m_resident_chunks++;
+				record_latency(kind, s);
 			}
 		}
-		// Not listed already.
-#endif // 0
-
-		m_load_queue.push_back(pending_load_request(chunk, urgency));
-		
-	}
-}
+		else
+		{
+			image::rgb*	texture_image = (image::rgb*) s->m_result;
+			assert(c->m_texture_id == 0);
 
+			if (c->m_parent != NULL
+			    && c->m_parent->m_texture_id == 0)
+			{
+				// Drat!  Our parent texture was unloaded, while we were
+				// being loaded.  Only thing to do is to discard the
+				// newly loaded image, to avoid breaking the invariant.
+				// (No big deal; this situation is rare.)
+				delete texture_image;
+				m_stats.m_discarded++;
+			}
+			else
+			{
+				// Connect the chunk with its texture!
+				c->m_texture_id = lod_tile_freelist::make_texture(texture_image);	// @@ this actually could cause some bad latency, because we build mipmaps...
+				record_latency(kind, s);
+			}
+		}
 
-void	chunk_tree_loader::request_chunk_unload(lod_chunk* chunk)
-// Request that the specified chunk have its data unloaded;
-// happens within short latency.
-{
-	m_unload_queue.push_back(chunk);
+		s->m_result = NULL;
+		tu_atomic_store(&s->m_state, IDLE);
+	}
 }
 
 
-void	chunk_tree_loader::request_chunk_load_texture(lod_chunk* chunk)
-// Request that the specified chunk have its texture loaded.  May
-// take a while; data doesn't actually show up & get linked in
-// until some future call to sync_loader_thread().
+void	chunk_tree_loader::record_latency(int kind, load_slot* s)
+// Add the time from s's first request until now to the histogram.
 {
-	assert(chunk);
-	assert(chunk->m_texture_id == 0);
-	assert(m_tree->m_texture_quadtree->get_depth() >= chunk->m_level);
+	double	ms = tu_timer::profile_ticks_to_milliseconds(tu_timer::get_profile_ticks() - s->m_first_request_ticks);
+	int	bucket = 0;
+	for (double limit = 1; ms >= limit && bucket < chunk_load_stats::LATENCY_BUCKETS - 1; limit *= 2)
+	{
+		bucket++;
+	}
 
-	// Don't schedule for load unless our parent already has a texture.
-	if (chunk->m_parent == NULL
-	    || chunk->m_parent->m_texture_id != 0)
+	if (kind == LOAD_DATA)
+	{
+		m_stats.m_data_latency[bucket]++;
+		m_stats.m_data_loads++;
+	}
+	else
 	{
-		m_load_texture_queue.push_back(chunk);
+		m_stats.m_texture_latency[bucket]++;
+		m_stats.m_texture_loads++;
 	}
 }
 
 
-void	chunk_tree_loader::request_chunk_unload_texture(lod_chunk* chunk)
-// Request that the specified chunk have its texture unloaded; happens
-// within short latency.
+void	chunk_tree_loader::publish_requests(int kind)
+// Replace the published requests of the given kind with the most
+// urgent of this frame's requests.  Requests that are still queued
+// but no longer wanted get canceled.
 {
-	assert(chunk->m_texture_id != 0);
-	
-	m_unload_texture_queue.push_back(chunk);
-}
+	array<pending_load_request>&	queue = m_load_queue[kind];
+	array<lod_chunk*>&	published = m_published[kind];
 
+	// While we're over the memory budget, only load data that's
+	// needed right now to split a chunk; warm-ups can wait.
+	bool	over_budget = kind == LOAD_DATA
+		&& m_memory_budget > 0
+		&& m_stats.m_resident_bytes >= m_memory_budget;
 
-int	chunk_tree_loader::loader_thread()
-// Thread function for the loader thread.  Sit and load chunk data
-// from the request queue, until we get killed.
-{
-	while (m_run_loader_thread == true)
+	array<lod_chunk*>	next;
+	if (queue.size() > 0)
+	{
+		// Sort by priority.
+		qsort(&queue[0], queue.size(), sizeof(queue[0]), pending_load_request::compare);
+	}
+	for (int i = queue.size() - 1; i >= 0 && next.size() < MAX_REQUESTS; i--)	// Do the higher priority requests first.
 	{
-		bool	loaded = false;
-		loaded = loader_service_data() || loaded;
-		loaded = loader_service_texture() || loaded;
+		lod_chunk*	c = queue[i].m_chunk;
+		load_slot*	s = get_slot(kind, c);
 
-		if (loaded == false)
+		// Must make sure the chunk wasn't just retired, and
+		// that its parent wasn't just unloaded.
+		if (is_resident(kind, c)
+		    || (c->m_parent != NULL && is_resident(kind, c->m_parent) == false))
 		{
-			// We seem to be dormant; sleep for a while
-			// and then check again.
-			SDL_Delay(10);
+			continue;
+		}
+		if (over_budget && queue[i].m_priority < 1.0f)
+		{
+			continue;
 		}
-	}
-
-	return 0;
-}
 
+		int	state = tu_atomic_load(&s->m_state);
+		if (state == IDLE)
+		{
+			// Only we move chunks out of IDLE.
+			tu_atomic_store(&s->m_state, QUEUED);
+		}
+		else if (state != QUEUED)
+		{
+			// Already loading, or loaded.
+			continue;
+		}
+		s->m_publish_frame = m_frame;
+		next.push_back(c);
+	}
+	queue.resize(0);	// forget this frame's requests; we'll generate a fresh list during the next update()
 
-bool	chunk_tree_loader::loader_service_data()
-// Service a request for data.  Return true if we actually serviced
-// anything; false if there was nothing to service.
-{
-	// Grab a request.
-	lod_chunk*	chunk_to_load = NULL;
-	SDL_LockMutex(m_mutex);
+	// Cancel the old requests that didn't make the cut.  A worker
+	// may have claimed one already, in which case this fails and
+	// the load goes ahead.
+	for (int i = 0; i < published.size(); i++)
 	{
-		// Get first request that's not already in the
-		// retire buffer.
-		for (int req = 0; req < REQUEST_BUFFER_SIZE; req++)
+		load_slot*	s = get_slot(kind, published[i]);
+		if (s->m_publish_frame != m_frame
+		    && tu_atomic_compare_and_swap(&s->m_state, QUEUED, IDLE))
 		{
-			chunk_to_load = m_request_buffer[0];	// (could be NULL)
-
-			// shift requests down.
-			int	i;
-			for (i = 0; i < REQUEST_BUFFER_SIZE - 1; i++)
-			{
-				m_request_buffer[i] = m_request_buffer[i + 1];
-			}
-			m_request_buffer[i] = NULL;	// fill empty slot with NULL
-
-			if (chunk_to_load == NULL) break;
-			
-			// Make sure the request is not in the retire buffer.
-			bool	in_retire_buffer = false;
-			{for (int i = 0; i < REQUEST_BUFFER_SIZE; i++) {
-				if (m_retire_buffer[i].m_chunk == chunk_to_load) {
-					// This request has already been serviced.  Don't
-					// service it again.
-					chunk_to_load = NULL;
-					in_retire_buffer = true;
-					break;
-				}
-			}}
-			if (in_retire_buffer == false) break;
+			m_stats.m_canceled++;
 		}
 	}
-	SDL_UnlockMutex(m_mutex);
 
-	if (chunk_to_load == NULL)
+	// Publish, best first.
+	for (int i = 0; i < MAX_REQUESTS; i++)
 	{
-		// There's no request to service right now.
-		return false;
+		tu_atomic_store_ptr(&m_requests[kind][i], i < next.size() ? next[i] : (lod_chunk*) NULL);
+	}
+	published.resize(next.size());
+	for (int i = 0; i < next.size(); i++)
+	{
+		published[i] = next[i];
 	}
 
-	assert(chunk_to_load->m_data == NULL);
-	assert(chunk_to_load->m_parent == NULL || chunk_to_load->m_parent->m_data != NULL);
-	
-	// Service the request by loading the chunk's data.  This
-	// could take a while, and involves waiting on IO, so we do it
-	// with the mutex unlocked so the main update/render thread
-	// can hopefully get some work done.
-	lod_chunk_data*	loaded_data = NULL;
+	if (kind == LOAD_DATA)
+	{
+		m_stats.m_queued_data = next.size();
+	}
+	else
+	{
+		m_stats.m_queued_textures = next.size();
+	}
+
+	if (next.size() > 0 && m_threads.size() > 0)
+	{
+		tu_thread::autolock	lock(&m_wake_mutex);
+		m_wake_generation++;
+		m_wake.broadcast();
+	}
+}
 
-	// Geometry.
-	m_source_stream->set_position(chunk_to_load->m_data_file_position);
-	loaded_data = new lod_chunk_data(m_source_stream);
 
-	// "Retire" the request.  Must do this with the mutex locked.
-	// The main thread will do "chunk_to_load->m_data = loaded_data".
-	SDL_LockMutex(m_mutex);
+void	chunk_tree_loader::add_request(int kind, lod_chunk* chunk, float priority)
+// Add chunk to this frame's requests of the given kind.  If it's
+// already there, keep the higher priority.
+{
+	load_slot*	s = get_slot(kind, chunk);
+	if (s->m_request_frame == m_frame)
 	{
-		for (int i = 0; i < REQUEST_BUFFER_SIZE; i++)
-		{
-			if (m_retire_buffer[i].m_chunk == 0)
-			{
-				// empty slot; put the info here.
-				m_retire_buffer[i].m_chunk = chunk_to_load;
-				m_retire_buffer[i].m_chunk_data = loaded_data;
-				break;
-			}
-		}
-		// TODO: assert if we didn't find a retire slot!
-		// (there should always be one, because it's as big as
-		// the request queue)
+		pending_load_request&	r = m_load_queue[kind][s->m_queue_index];
+		assert(r.m_chunk == chunk);
+		r.m_priority = fmax(r.m_priority, priority);
+		return;
 	}
-	SDL_UnlockMutex(m_mutex);
 
-	return true;
+	if (s->m_request_frame != m_frame - 1)
+	{
+		// It wasn't wanted last frame, so start the clock
+		// for the latency stats.
+		s->m_first_request_ticks = tu_timer::get_profile_ticks();
+	}
+	s->m_request_frame = m_frame;
+	s->m_queue_index = m_load_queue[kind].size();
+	m_load_queue[kind].push_back(pending_load_request(chunk, priority));
 }
 
 
-bool	chunk_tree_loader::loader_service_texture()
-// Service a pending texture request.  Return true if we serviced
-// something.  Return false if there was nothing to service.
+void	chunk_tree_loader::request_chunk_load(lod_chunk* chunk, float urgency)
+// Request that the specified chunk have its data loaded.  May
+// take a while; data doesn't actually show up & get linked in
+// until some future call to sync_loader_thread().
 {
-	// Grab a request.
-	lod_chunk*	chunk_to_load = NULL;
-	SDL_LockMutex(m_mutex);
+	assert(chunk);
+	assert(chunk->m_data == NULL);
+
+	// Don't schedule for load unless our parent already has data.
+	if (chunk->m_parent == NULL
+	    || chunk->m_parent->m_data != NULL)
 	{
-		// Get first request that's not already in the
-		// retire buffer.
-		for (int req = 0; req < REQUEST_BUFFER_SIZE; req++)
-		{
-			chunk_to_load = m_request_texture_buffer[0];	// (could be NULL)
+		add_request(LOAD_DATA, chunk, urgency);
+	}
+}
 
-			// shift requests down.
-			int	i;
-			for (i = 0; i < REQUEST_BUFFER_SIZE - 1; i++)
-			{
-				m_request_texture_buffer[i] = m_request_texture_buffer[i + 1];
-			}
-			m_request_texture_buffer[i] = NULL;	// fill empty slot with NULL
 
-			if (chunk_to_load == NULL) break;
-			assert(chunk_to_load->m_texture_id == 0);
-			
-			// Make sure the request is not in the retire buffer.
-			bool	in_retire_buffer = false;
-			{for (int i = 0; i < REQUEST_BUFFER_SIZE; i++) {
-				if (m_retire_texture_buffer[i].m_chunk == chunk_to_load) {
-					// This request has already been serviced.  Don't
-					// service it again.
-					chunk_to_load = NULL;
-					in_retire_buffer = true;
-					break;
-				}
-			}}
-			if (in_retire_buffer == false) break;
-		}
-	}
-	SDL_UnlockMutex(m_mutex);
+void	chunk_tree_loader::request_chunk_unload(lod_chunk* chunk)
+// Request that the specified chunk have its data unloaded;
+// happens within short latency.
+{
+	m_unload_queue.push_back(chunk);
+}
+
 
-	if (chunk_to_load == NULL)
+void	chunk_tree_loader::request_chunk_load_texture(lod_chunk* chunk)
+// Request that the specified chunk have its texture loaded.  May
+// take a while; data doesn't actually show up & get linked in
+// until some future call to sync_loader_thread().
+{
+	assert(chunk);
+	assert(chunk->m_texture_id == 0);
+	assert(m_tree->m_texture_quadtree->get_depth() >= chunk->m_level);
+
+	// Don't schedule for load unless our parent already has a texture.
+	if (chunk->m_parent == NULL
+	    || chunk->m_parent->m_texture_id != 0)
 	{
-		// There's no request to service right now.
-		return false;
-	}
+		// Coarse levels first; they cover more of the view.
+		add_request(LOAD_TEXTURE, chunk, -float(chunk->m_level));
 
-	assert(chunk_to_load->m_texture_id == 0);
-	assert(chunk_to_load->m_parent == NULL || chunk_to_load->m_parent->m_texture_id != 0);
-	
-	// Service the request by loading the chunk's data.
-	// This could take a while, and involves wating on IO,
-	// so we do it with the mutex unlocked so the main
-	// update/render thread can hopefully get some work
-	// done.
-	image::rgb*	texture_image = NULL;
-
-	// Texture.
-	const tqt*	qt = m_tree->m_texture_quadtree;
-	assert(qt && chunk_to_load->m_level < qt->get_depth());
-
-	texture_image = qt->load_image(chunk_to_load->m_level,
-				       chunk_to_load->m_x,
-				       chunk_to_load->m_z);
-
-	// "Retire" the request.  Must do this with the mutex
-	// locked.  The main thread will do
-	// "chunk_to_load->m_data = loaded_data".
-	SDL_LockMutex(m_mutex);
-	{
-		for (int i = 0; i < REQUEST_BUFFER_SIZE; i++)
-		{
-			if (m_retire_texture_buffer[i].m_chunk == 0)
-			{
-				// empty slot; put the info here.
-				m_retire_texture_buffer[i].m_chunk = chunk_to_load;
-				m_retire_texture_buffer[i].m_texture_image = texture_image;
-				break;
-			}
-		}
+		// The viewer is likely to want the tiles around this
+		// one, and under it, next.  If the tqt has a cache,
+		// it decodes them in the background.
+		m_tree->m_texture_quadtree->prefetch_neighbors(chunk->m_level, chunk->m_x, chunk->m_z);
 	}
-	SDL_UnlockMutex(m_mutex);
+}
 
-	return true;
+
+void	chunk_tree_loader::request_chunk_unload_texture(lod_chunk* chunk)
+// Request that the specified chunk have its texture unloaded; happens
+// within short latency.
+{
+	assert(chunk->m_texture_id != 0);
+	
+	m_unload_texture_queue.push_back(chunk);
 }
 
 
@@ -1830,7 +2001,7 @@ int	lod_chunk::render(const lod_chunk_tree& c, const view_state& v, cull::result
 }
 
 
-void	lod_chunk::read(tu_file* in, int recurse_count, lod_chunk_tree* tree, bool vert_data_at_end)
+void	lod_chunk::read(tu_file* in, int recurse_count, lod_chunk_tree* tree, int format_version)
 // Read chunk data from the given file and initialize this chunk with it.
 // Recursively loads child chunks for recurse_count > 0.
 {
@@ -1865,10 +2036,17 @@ void	lod_chunk::read(tu_file* in, int recurse_count, lod_chunk_tree* tree, bool
 
 	// Skip the chunk data but remember our filepos, so we can load it
 	// when it's demanded.
-	if (vert_data_at_end)
+	m_data_size = 0;
+	if (format_version >= 10)
+	{
+		// The header has a 64-bit file offset & the data size.
+		m_data_file_position = in->read_le64();
+		m_data_size = in->read_le32();
+	}
+	else if (format_version >= 9)
 	{
-		// Format version 9 and later.  Vert data file offset
-		// is just stored directly in the header.
+		// Vert data file offset is just stored directly in
+		// the header.
 		m_data_file_position = in->read_le32();
 	}
 	else
@@ -1888,7 +2066,7 @@ void	lod_chunk::read(tu_file* in, int recurse_count, lod_chunk_tree* tree, bool
 			m_children[i] = &tree->m_chunks[tree->m_chunks_allocated++];
 			m_children[i]->m_lod = m_lod + 0x100;
 			m_children[i]->m_parent = this;
-			m_children[i]->read(in, recurse_count - 1, tree, vert_data_at_end);
+			m_children[i]->read(in, recurse_count - 1, tree, format_version);
 		}
 	} else {
 		for (int i = 0; i < 4; i++) {
@@ -1928,10 +2106,57 @@ void	lod_chunk::lookup_neighbors(lod_chunk_tree* tree)
 //
 
 
+// Size of a chunk header in a version 10 .chu file; see
+// CHUNK_HEADER_BYTES in heightfield_chunker.cpp.
+static const int	CHUNK_TOC_ENTRY_BYTES = 4 + 4*4 + 1 + 2 + 2 + 2*2 + 8 + 4;
+
+
 lod_chunk_tree::lod_chunk_tree(tu_file* src, const tqt* texture_quadtree)
 // Construct and initialize a tree of LOD chunks, using data from the given
 // source.  Uses a special .chu file format which is a pretty direct
 // encoding of the chunk data.
+	:
+	m_mapped_data(NULL),
+	m_mapped_size(0),
+	m_owned_source(NULL)
+{
+	init(src, texture_quadtree);
+}
+
+
+lod_chunk_tree::lod_chunk_tree(const char* filename, const tqt* texture_quadtree)
+// Construct a tree of LOD chunks from the named .chu file.  If we can,
+// we memory-map the file, and use chunk data in place instead of
+// reading it.
+	:
+	m_mapped_data(NULL),
+	m_mapped_size(0),
+	m_owned_source(NULL)
+{
+	m_mapped_data = (const Uint8*) mmap_util::map_file(filename, &m_mapped_size);
+	if (m_mapped_data)
+	{
+		// The header & table-of-contents are at the front, so
+		// the first 2GB is plenty.
+		int	header_size = m_mapped_size > 0x7FFFFFFF ? 0x7FFFFFFF : (int) m_mapped_size;
+		tu_file	header(tu_file::memory_buffer, header_size, (void*) m_mapped_data);
+		init(&header, texture_quadtree);
+	}
+	else
+	{
+		m_owned_source = new tu_file(filename, "rb");
+		if (m_owned_source->get_error()) {
+			printf("Can't open '%s'\n", filename);
+			exit(1);
+		}
+		init(m_owned_source, texture_quadtree);
+	}
+}
+
+
+void	lod_chunk_tree::init(tu_file* src, const tqt* texture_quadtree)
+// Read the chunk tree header & table-of-contents from src, and set up
+// our loader.
 {
 	m_texture_quadtree = texture_quadtree;
 
@@ -1943,16 +2168,11 @@ lod_chunk_tree::lod_chunk_tree(tu_file* src, const tqt* texture_quadtree)
 	}
 
 	int	format_version = src->read_le16();
-	if (format_version != 8 && format_version != 9)
+	if (format_version < 8 || format_version > 10)
 	{
 		printf("Input format has non-matching version number");
 		exit(1);
 	}
-
-	bool	vert_data_at_end = false;
-	if (format_version >= 9) {
-		vert_data_at_end = true;
-	}
 	
 	m_tree_depth = src->read_le16();
 	m_error_LODmax = src->read_float32();
@@ -1975,24 +2195,54 @@ lod_chunk_tree::lod_chunk_tree(tu_file* src, const tqt* texture_quadtree)
 	m_chunks_allocated++;
 	m_chunks[0].m_lod = 0;
 	m_chunks[0].m_parent = 0;
-	m_chunks[0].read(src, m_tree_depth-1, this, vert_data_at_end);
+	if (format_version >= 10)
+	{
+		// The chunk headers are all together at the front of
+		// the file; read them in one go.
+		int	toc_bytes = m_chunk_count * CHUNK_TOC_ENTRY_BYTES;
+		array<Uint8>	toc_data;
+		toc_data.resize(toc_bytes);
+		if (src->read_bytes(&toc_data[0], toc_bytes) != toc_bytes)
+		{
+			printf("Input file is truncated");
+			exit(1);
+		}
+		tu_file	toc(tu_file::memory_buffer, toc_bytes, &toc_data[0]);
+		m_chunks[0].read(&toc, m_tree_depth-1, this, format_version);
+	}
+	else
+	{
+		// Older files have to be read header by header.
+		m_chunks[0].read(src, m_tree_depth-1, this, format_version);
+	}
 	m_chunks[0].lookup_neighbors(this);
 
-	// Set up our loader.
-	m_loader = new chunk_tree_loader(this, src);
+	// Set up our loader.  With a mapped file, the loader doesn't
+	// read src at all.
+	m_loader = new chunk_tree_loader(this, m_mapped_data ? NULL : src);
 }
 
 
 lod_chunk_tree::~lod_chunk_tree()
 // Destructor.
 {
+	// The loader threads may be using the chunks; stop them
+	// first.
+	delete m_loader;
 	delete [] m_chunk_table;
 	delete [] m_chunks;
-	delete m_loader;
 
 	m_chunk_table = NULL;
 	m_chunks = NULL;
 	m_loader = NULL;
+
+	if (m_mapped_data)
+	{
+		mmap_util::unmap_file(m_mapped_data, m_mapped_size);
+		m_mapped_data = NULL;
+	}
+	delete m_owned_source;
+	m_owned_source = NULL;
 }
 
 
@@ -2103,6 +2353,29 @@ void	lod_chunk_tree::set_use_loader_thread(bool use)
 }
 
 
+void	lod_chunk_tree::set_loader_thread_count(int count)
+// Sets the number of background loader threads; 0 means pick a
+// number based on the processor count.
+{
+	m_loader->set_thread_count(count);
+}
+
+
+void	lod_chunk_tree::set_memory_budget(int bytes)
+// While the resident chunk data takes more than this many bytes, only
+// load data that's needed right away.  0 means no limit.
+{
+	m_loader->set_memory_budget(bytes);
+}
+
+
+const chunk_load_stats&	lod_chunk_tree::get_load_stats() const
+// Returns the loader's stats, as of the last update().
+{
+	return m_loader->get_stats();
+}
+
+
 void	lod_chunk_tree::set_parameters(float max_pixel_error, float max_texel_size, float screen_width_pixels, float horizontal_FOV_degrees)
 // Initializes some internal parameters which are used to compute
 // which chunks are split during update().
@@ -31,11 +31,55 @@ struct render_options {
 };
 
 
+struct chunk_load_stats
+// Chunk streaming stats, as of the last lod_chunk_tree::update().
+// Latency is from the first update() that asked for a chunk's data
+// (or texture) to the update() that linked it in.  Bucket 0 counts
+// loads that took under 1 ms, bucket i those that took [2^(i-1), 2^i)
+// ms, and the last bucket everything longer.
+{
+	enum { LATENCY_BUCKETS = 16 };
+
+	int	m_data_latency[LATENCY_BUCKETS];
+	int	m_texture_latency[LATENCY_BUCKETS];
+	int	m_data_loads;
+	int	m_texture_loads;
+	int	m_discarded;	// loaded, but the parent was gone by then
+	int	m_canceled;	// queued, then no longer wanted
+
+	int	m_queued_data;		// requests handed to the loader threads
+	int	m_queued_textures;	// in the last update()
+	int	m_resident_chunks;	// chunks with data
+	int	m_resident_bytes;	// in their data
+
+	void	clear()
+	{
+		for (int i = 0; i < LATENCY_BUCKETS; i++)
+		{
+			m_data_latency[i] = 0;
+			m_texture_latency[i] = 0;
+		}
+		m_data_loads = 0;
+		m_texture_loads = 0;
+		m_discarded = 0;
+		m_canceled = 0;
+		m_queued_data = 0;
+		m_queued_textures = 0;
+		m_resident_chunks = 0;
+		m_resident_bytes = 0;
+	}
+};
+
+
 class lod_chunk_tree {
 // Use this class as the UI to a chunked-LOD object.
 // !!! turn this into an interface class and get the data into the .cpp file !!!
 public:
 	lod_chunk_tree(tu_file* src, const tqt* texture_quadtree);
+
+	// Opens the file itself, and memory-maps it if it can.  Then
+	// chunk data is used in place instead of being read & copied.
+	lod_chunk_tree(const char* filename, const tqt* texture_quadtree);
 	~lod_chunk_tree();
 
 	// External interface.
@@ -49,8 +93,16 @@ public:
 	Uint16	compute_lod(const vec3& center, const vec3& extent, const vec3& viewpoint) const;
 	int	compute_texture_lod(const vec3& center, const vec3& extent, const vec3& viewpoint) const;
 
-	// Call this to enable/disable loading in a background thread.
+	// Call this to enable/disable loading in background threads.
 	void	set_use_loader_thread(bool use);
+	void	set_loader_thread_count(int count);
+
+	// Limit on resident chunk data, in bytes; 0 means no limit.
+	// Over the limit, data is only loaded when it's needed to
+	// split a chunk.
+	void	set_memory_budget(int bytes);
+
+	const chunk_load_stats&	get_load_stats() const;
 
 //data:
 	lod_chunk*	m_chunks;
@@ -65,6 +117,12 @@ public:
 	lod_chunk**	m_chunk_table;
 	const tqt*	m_texture_quadtree;
 	chunk_tree_loader*	m_loader;
+	const Uint8*	m_mapped_data;	// the whole .chu file, if it's mapped
+	Uint64	m_mapped_size;
+	tu_file*	m_owned_source;	// if we opened the file ourselves
+
+private:
+	void	init(tu_file* src, const tqt* texture_quadtree);
 };
 
 
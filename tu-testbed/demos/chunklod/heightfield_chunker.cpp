@@ -19,7 +19,9 @@
 
 #include "base/utility.h"
 #include "base/container.h"
+#include "base/membuf.h"
 #include "base/tu_file.h"
+#include "base/tu_thread.h"
 #include "geometry/geometry.h"
 #include "geometry/tqt.h"
 
@@ -32,14 +34,11 @@ void	heightfield_chunker(const char* infile, tu_file* out,
 			    float base_max_error,
 			    float spacing,
 			    float vertical_scale,
-			    float input_vertical_scale
+			    float input_vertical_scale,
+			    int thread_count
 	);
 
 
-static const char*	spinner = "-\\|/";
-static int spin_count = 0;
-
-
 void	error(const char* fmt)
 // Generic bail function.
 //
@@ -58,7 +57,7 @@ void	print_usage()
 	printf("heightfield_chunker: program for processing terrain data and generating\n"
 		   "a chunked LOD data file suitable for viewing by 'chunklod'.\n\n"
 		   "This program has been donated to the Public Domain by Thatcher Ulrich <tu@tulrich.com>\n\n"
-		   "usage: heightfield_chunker [-d depth] [-e error] [-s hspacing] [-v input_vscale]\n"
+		   "usage: heightfield_chunker [-d depth] [-e error] [-s hspacing] [-v input_vscale] [-t threads]\n"
 		   "\t<input_filename> <output_filename>\n"
 		   "\n"
 		   "\tThe input filename should either be a .BT format terrain file with\n"
@@ -69,6 +68,7 @@ void	print_usage()
 		   "\t'hspacing' determines the horizontal spacing between grid points, ONLY if the\n"
 		   "\t\tinput file is a bitmap (.bt files contain spacing info).  default = 4\n"
 		   "\t'input_vscale' is a factor by which to scale the input data.  default = 1\n"
+		   "\t'threads' is the number of threads to process with; default = one per processor\n"
 		);
 }
 
@@ -111,6 +111,7 @@ int	wrapped_main(int argc, char* argv[])
 	float	spacing = 4.0f;
 	float	vertical_scale = MAX_HEIGHT / 32767.0f;
 	float	input_vertical_scale = 1.0f;
+	int	thread_count = 0;
 
 	// Process command-line options.
 	char*	infile = NULL;
@@ -178,6 +179,19 @@ int	wrapped_main(int argc, char* argv[])
 					exit(1);
 				}
 				break;
+
+			case 't':
+				// Set the number of threads.
+				arg++;
+				if (arg < argc) {
+					thread_count = atoi(argv[arg]);
+				}
+				else {
+					printf("error: -t option must be followed by the number of threads\n");
+					print_usage();
+					exit(1);
+				}
+				break;
 			}
 
 		} else {
@@ -218,7 +232,7 @@ int	wrapped_main(int argc, char* argv[])
 	printf("input vertical scale = %f\n", input_vertical_scale);
 
 	// Process the data.
-	heightfield_chunker(infile, out, tree_depth, max_geometric_error, spacing, vertical_scale, input_vertical_scale);
+	heightfield_chunker(infile, out, tree_depth, max_geometric_error, spacing, vertical_scale, input_vertical_scale, thread_count);
 
 	stats.output_size = out->get_position();
 
@@ -345,9 +359,9 @@ struct heightfield {
 	float	sample_spacing;
 	float	vertical_scale;	// scales the units stored in heightfield_elem's.  meters == stored_Sint16 * vertical_scale
 	float	input_vertical_scale;	// scale factor to apply to input data.
-//	mmap_array<Sint16>*	m_height;
+	mmap_array<Sint16>*	m_height;	// scaled copy of the .bt data
 	bt_array*	m_bt;
-	mmap_array<Uint8>*	m_level;
+	mmap_array<Uint8>*	m_level;	// activation levels
 
 	heightfield(float initial_vertical_scale, float input_scale) {
 		m_size = 0;
@@ -355,6 +369,7 @@ struct heightfield {
 		sample_spacing = 1.0f;
 		vertical_scale = initial_vertical_scale;
 		input_vertical_scale = input_scale;
+		m_height = NULL;
 		m_bt = NULL;
 		m_level = NULL;
 	}
@@ -370,42 +385,48 @@ struct heightfield {
 			delete m_level;
 			m_level = 0;
 		}
+		if (m_height) {
+			delete m_height;
+			m_height = 0;
+		}
+		if (m_bt) {
+			delete m_bt;
+			m_bt = 0;
+		}
 
 		m_size = 0;
 		m_log_size = 0;
 	}
 
-	Sint16	height(int x, int z)
-	// Return a (writable) reference to the height element at (x, z).
+	Sint16	height(int x, int z) const
+	// Return the height element at (x, z).  Valid once load_tile()
+	// has been over the whole heightfield.
+	{
+		assert(m_height);
+		return ((const mmap_array<Sint16>*) m_height)->get(x, z);
+	}
+
+	Sint16	scale_sample(float sample) const
+	// Convert a sample from the .bt file to our height units.
 	{
-		assert(m_bt);
-		return Sint16(m_bt->get_sample(x, z) * input_vertical_scale / vertical_scale);
+		return Sint16(sample * input_vertical_scale / vertical_scale);
 	}
 
-	int	get_level(int x, int z)
+	int	get_level(int x, int z) const
 	// Return the activation level at (x, z)
 	{
 		assert(m_level);
-		int val = m_level->get(z, x >> 1); // swap indices for VM performance -- .bt is column major
-		if (x & 1) {
-			val = val >> 4;
-		}
-		val &= 0x0F;
+		int val = ((const mmap_array<Uint8>*) m_level)->get(x, z);
 		if (val == 0x0F) return -1;
 		else return val;
 	}
 
 	void	set_level(int x, int z, int lev)
+	// Levels get a byte each, not a nibble, so that threads
+	// working on neighboring vertices don't share bytes.
 	{
 		assert(lev >= -1 && lev < 15);
-		lev &= 0x0F;
-		Uint8	current = m_level->get(z, x >> 1); // swap indices for VM performance -- .bt is column major
-		if (x & 1) {
-			current = (current & 0x0F) | (lev << 4);
-		} else {
-			current = (current & 0xF0) | (lev);
-		}
-		m_level->get(z, x >> 1) = current;
+		m_level->get(x, z) = lev & 0x0F;
 	}
 	
 	void	activate(int x, int z, int lev)
@@ -415,14 +436,11 @@ struct heightfield {
 		assert(lev < 15);	// 15 is our flag value.
 		int	current_level = get_level(x, z);
 		if (lev > current_level) {
-			if (current_level == -1) {
-				stats.output_vertices++;
-			}
 			set_level(x, z, lev);
 		}
 	}
 
-	int	node_index(int x, int z)
+	int	node_index(int x, int z) const
 	// Given the coordinates of the center of a quadtree node, this
 	// function returns its node index.  The node index is essentially
 	// the node's rank in a breadth-first quadtree traversal.  Assumes
@@ -449,7 +467,7 @@ struct heightfield {
 	}
 
 
-	int	minimum_edge_lod(int coord)
+	int	minimum_edge_lod(int coord) const
 	// Given an x or z coordinate, along which an edge runs, this
 	// function returns the lowest LOD level that the edge divides.
 	//
@@ -559,19 +577,13 @@ struct heightfield {
 		sample_spacing = (float) (fabs(m_bt->get_right() - m_bt->get_left()) / (double) (m_size - 1));
 		printf("sample_spacing = %f\n", sample_spacing);//xxxxxxx
 
-		// Allocate storage for vertex activation levels.
-//		m_height = new mmap_array<Sint16>(size, size, true);
-		m_level = new mmap_array<Uint8>(m_size, (m_size + 1) >> 1, true);	// swap height/width; .bt is column-major
-//		assert(m_height);
+		// Allocate storage for heights and vertex activation
+		// levels.  load_tile() fills them in.
+		m_height = new mmap_array<Sint16>(m_size, m_size, true);
+		m_level = new mmap_array<Uint8>(m_size, m_size, true);
+		assert(m_height);
 		assert(m_level);
 
-		// Initialize level array.
-		for (int i = 0; i < m_size; i++) {
-			for (int j = 0; j < m_size; j++) {
-				m_level->get(m_size - 1 - j, i >> 1) = 255;	// swap height/width -- (to match .bt order; good idea??)
-			}
-		}
-
 #if 0
 		printf("Loading .bt data....");
 
@@ -662,14 +674,82 @@ struct heightfield {
 };
 
 
-void	update(heightfield& hf, float base_max_error, int ax, int az, int rx, int rz, int lx, int lz);
-void	propagate_activation_level(heightfield& hf, int cx, int cz, int level, int target_level);
+struct tile_pass;
+void	load_tile(void* arg, int index);
+void	update_tile_corners(heightfield& hf, float base_max_error, int tile_size);
+void	propagate_edges(void* arg, int index);
+void	propagate_centers(void* arg, int index);
+void	finish_tile(void* arg, int index);
 int	check_propagation(heightfield& hf, int cx, int cz, int level);
 void	generate_empty_TOC(tu_file* rw, int level);
-void	generate_node_data(tu_file* rw, heightfield& hf, int x0, int z0, int log_size, int level);
+void	generate_chunks(tu_file* out, heightfield& hf, tu_thread::pool* pool);
+
+
+static void	show_progress(const char* label, int done, int total)
+// Print "label... N%" over the previous progress report, if N has
+// changed, or "label... done" and a newline once done == total.
+{
+	static int	s_last_percent = -1;
+
+	int	percent = done * 100 / total;
+	if (done >= total) {
+		printf("\r%s... done\n", label);
+		s_last_percent = -1;
+	} else if (percent != s_last_percent) {
+		printf("\r%s... %d%%", label, percent);
+		s_last_percent = percent;
+	}
+	fflush(stdout);
+}
+
+
+struct tile_pass
+// The passes that compute the activation levels cut the heightfield
+// into square tiles, which the thread pool works on independently.
+// Each vertex belongs to one tile -- the last row and column of tiles
+// also get the heightfield's south and east edges -- and a pass only
+// writes to the vertices of its tile, so the tiles don't need any
+// locking.
+{
+	enum { LOG_TILE_SIZE = 8 };
+
+	heightfield*	m_hf;
+	float	m_base_max_error;
+	int	m_tile_size;
+	int	m_tiles_across;
+	int	m_first_tile;	// pool task indices are relative to this
+	int	m_level;	// for propagate_edges() and propagate_centers()
+	array<int>	m_vertex_counts;	// per tile, from finish_tile()
+
+	tile_pass(heightfield* hf, float base_max_error)
+		:
+		m_hf(hf),
+		m_base_max_error(base_max_error),
+		m_first_tile(0),
+		m_level(0)
+	{
+		m_tile_size = imin(1 << LOG_TILE_SIZE, hf->m_size - 1);
+		m_tiles_across = (hf->m_size - 1) / m_tile_size;
+		m_vertex_counts.resize(get_tile_count());
+	}
+
+	int	get_tile_count() const { return m_tiles_across * m_tiles_across; }
 
+	void	get_tile(int index, int* x0, int* z0, int* x1, int* z1) const
+	// The tile's vertices are [x0, x1) by [z0, z1).
+	{
+		int	tile = m_first_tile + index;
+		int	tx = tile % m_tiles_across;
+		int	tz = tile / m_tiles_across;
+		*x0 = tx * m_tile_size;
+		*z0 = tz * m_tile_size;
+		*x1 = (tx == m_tiles_across - 1) ? m_hf->m_size : *x0 + m_tile_size;
+		*z1 = (tz == m_tiles_across - 1) ? m_hf->m_size : *z0 + m_tile_size;
+	}
+};
 
-void	heightfield_chunker(const char* infile, tu_file* out, int tree_depth, float base_max_error, float spacing, float vertical_scale, float input_vertical_scale)
+
+void	heightfield_chunker(const char* infile, tu_file* out, int tree_depth, float base_max_error, float spacing, float vertical_scale, float input_vertical_scale, int thread_count)
 // Generate LOD chunks from the given heightfield.
 // 
 // tree_depth determines the depth of the chunk quadtree.
@@ -679,6 +759,9 @@ void	heightfield_chunker(const char* infile, tu_file* out, int tree_depth, float
 //
 // Spacing determines the horizontal sample spacing for bitmap
 // heightfields only.
+//
+// thread_count is the number of threads to work on; 0 means one per
+// processor.  The output doesn't depend on it.
 {
 	heightfield	hf(vertical_scale, input_vertical_scale);
 
@@ -699,85 +782,295 @@ void	heightfield_chunker(const char* infile, tu_file* out, int tree_depth, float
 
 	stats.input_vertices = hf.m_size * hf.m_size;
 
-	printf("updating...");
+	tu_thread::pool	pool(thread_count);
+	printf("threads = %d\n", pool.get_thread_count());
 
-	// Run a view-independent L-K style BTT update on the heightfield, to generate
-	// error and activation_level values for each element.
-	update(hf, base_max_error, 0, hf.m_size - 1, hf.m_size - 1, hf.m_size - 1, 0, 0);	// sw half of the square
-	update(hf, base_max_error, hf.m_size - 1, 0, 0, 0, hf.m_size - 1, hf.m_size - 1);	// ne half of the square
+	tile_pass	pass(&hf, base_max_error);
 
-	printf("done.\n");
+	// Read the heightfield a row of tiles at a time, and run a
+	// view-independent L-K style BTT update on it, to generate
+	// error and activation_level values for each element.
+	for (int row = 0; row < pass.m_tiles_across; row++) {
+		pass.m_first_tile = row * pass.m_tiles_across;
+		pool.run(load_tile, &pass, pass.m_tiles_across);
+		show_progress("updating", row + 1, pass.m_tiles_across);
+	}
+	pass.m_first_tile = 0;
+	update_tile_corners(hf, base_max_error, pass.m_tile_size);
 
-	printf("propagating....");
+	// Our copy of the heights is all we need from here on.
+	delete hf.m_bt;
+	hf.m_bt = NULL;
 
 	// Propagate the activation_level values of verts to their
 	// parent verts, quadtree LOD style.  Gives same result as
-	// L-K.
+	// L-K.  Each level of squares needs the level below it done,
+	// and the squares' centers need their edges done, so each of
+	// those is a separate pass over the tiles.
 	for (int i = 0; i < hf.m_log_size; i++) {
-		propagate_activation_level(hf, hf.m_size >> 1, hf.m_size >> 1, hf.m_log_size - 1, i);
-		propagate_activation_level(hf, hf.m_size >> 1, hf.m_size >> 1, hf.m_log_size - 1, i);
-		printf("\b%c", spinner[(spin_count++)&3]);
+		pass.m_level = i;
+		if (i > 0) {
+			pool.run(propagate_edges, &pass, pass.get_tile_count());
+		}
+		pool.run(propagate_centers, &pass, pass.get_tile_count());
+		show_progress("propagating", i + 1, hf.m_log_size);
 	}
 
 //	check_propagation(hf, hf.size >> 1, hf.size >> 1, hf.log_size - 1);//xxxxx
 
-	printf("done\n");
+	pool.run(finish_tile, &pass, pass.get_tile_count());
+	{for (int i = 0; i < pass.get_tile_count(); i++) {
+		stats.output_vertices += pass.m_vertex_counts[i];
+	}}
 
 	// Write a .chu header for the output file.
 	out->write_le32(('C') | ('H' << 8) | ('U' << 16));	// four byte "CHU\0" tag
-	out->write_le32(9);	// file format version.
-	out->write_le32(tree_depth);	// depth of the chunk quadtree.
+	out->write_le16(10);	// file format version.
+	out->write_le16(tree_depth);	// depth of the chunk quadtree.
 	out->write_float32(base_max_error);	// max geometric error at base level mesh.
 	out->write_float32(vertical_scale);	// meters / unit of vertical measurement.
 	out->write_float32((1 << (hf.m_log_size - (tree_depth - 1))) * hf.sample_spacing);	// x/z dimension, in meters, of highest LOD chunks.
 	out->write_le32(0x55555555 & ((1 << (tree_depth*2)) - 1));	// Chunk count.  Fully populated quadtree.
 
-	printf("meshing....");
-
 	// Make space for our chunk table-of-contents.  Fixed-size
 	// chunk headers will go in this space; the vertex/index data
 	// for chunks gets appended to the end of the stream.
 	generate_empty_TOC(out, hf.root_level);
 
 	// Write out the node data for the entire chunk tree.
-	generate_node_data(out, hf, 0, 0, hf.m_log_size, hf.root_level);
+	generate_chunks(out, hf, &pool);
 
-	printf("done\n");
+	out->go_to_end();
 }
 
 
-void	update(heightfield& hf, float base_max_error, int ax, int az, int rx, int rz, int lx, int lz)
-// Given the triangle, computes an error value and activation level
-// for its base vertex, and recurses to child triangles.
+static bool	get_base_edge(int size, int x, int z, int* lx, int* lz, int* rx, int* rz)
+// In the binary triangle tree over the heightfield, the vertex at (x,
+// z) is the base vertex of one or two triangles: the midpoint of
+// their hypotenuse.  This gives the ends of that hypotenuse.  Returns
+// false for the heightfield's corners, which aren't base vertices.
 {
-	// Compute the coordinates of this triangle's base vertex.
-	int	dx = lx - rx;
-	int	dz = lz - rz;
-	if (iabs(dx) <= 1 && iabs(dz) <= 1) {
-		// We've reached the base level.  There's no base
-		// vertex to update, and no child triangles to
-		// recurse to.
-		return;
+	if (x == 0 && z == 0) {
+		return false;
 	}
 
-	// base vert is midway between left and right verts.
-	int	bx = rx + (dx >> 1);
-	int	bz = rz + (dz >> 1);
+	int	l1 = lowest_one(x | z);
+	int	s = 1 << l1;
+
+	if ((x >> l1) & (z >> l1) & 1) {
+		// (x, z) is the center of a square.  The hypotenuse is
+		// the diagonal through the corner that's the center of
+		// the next bigger square.
+		*lx = ((x >> (l1 + 1)) & 1) ? x - s : x + s;
+		*lz = ((z >> (l1 + 1)) & 1) ? z - s : z + s;
+		*rx = 2 * x - *lx;
+		*rz = 2 * z - *lz;
+	} else if ((x >> l1) & 1) {
+		// Midpoint of a horizontal edge.
+		*lx = x - s;
+		*lz = z;
+		*rx = x + s;
+		*rz = z;
+	} else {
+		// Midpoint of a vertical edge.
+		*lx = x;
+		*lz = z - s;
+		*rx = x;
+		*rz = z + s;
+	}
+
+	return *lx >= 0 && *lx < size && *lz >= 0 && *lz < size
+		&& *rx >= 0 && *rx < size && *rz >= 0 && *rz < size;
+}
+
 
-	float	error = fabsf((hf.height(bx, bz) - (hf.height(lx, lz) + hf.height(rx, rz)) / 2.f) * hf.vertical_scale);
+static int	compute_activation_level(const heightfield& hf, Sint16 y, Sint16 left_y, Sint16 right_y, float base_max_error)
+// Given the heights of a base vertex and the ends of its hypotenuse,
+// compute the mesh level above which the vertex needs to be included
+// in LOD meshes.  Returns -1 if it's never needed.
+{
+	float	error = fabsf((y - (left_y + right_y) / 2.f) * hf.vertical_scale);
 	assert(error >= 0);
 	if (error >= base_max_error) {
-		// Compute the mesh level above which this vertex
-		// needs to be included in LOD meshes.
-		int	activation_level = (int) floor(log2(error / base_max_error) + 0.5f);
+		return (int) floor(log2(error / base_max_error) + 0.5f);
+	}
+	return -1;
+}
+
+
+static int	first_coord(int start, int offset, int step)
+// Returns the smallest coordinate >= start that's offset plus a
+// multiple of step.
+{
+	int	c = start - start % step + offset;
+	if (c < start) {
+		c += step;
+	}
+	return c;
+}
+
+
+void	load_tile(void* arg, int index)
+// Copies a tile of the .bt data into hf.m_height, and computes the
+// activation levels of the tile's vertices.  A vertex's hypotenuse
+// ends are inside the tile (counting the first row and column of the
+// next tiles over) for every vertex but the tile's corners;
+// update_tile_corners() does those.
+{
+	tile_pass*	p = (tile_pass*) arg;
+	heightfield&	hf = *p->m_hf;
+
+	int	x0, z0, x1, z1;
+	p->get_tile(index, &x0, &z0, &x1, &z1);
+
+	int	size = p->m_tile_size + 1;
+	array<float>	samples;
+	samples.resize(size * size);
+	hf.m_bt->get_samples(&samples[0], x0, z0, size, size);
+
+	array<Sint16>	heights;
+	heights.resize(size * size);
+	{for (int i = 0; i < size * size; i++) {
+		heights[i] = hf.scale_sample(samples[i]);
+	}}
+
+	for (int z = z0; z < z1; z++) {
+		for (int x = x0; x < x1; x++) {
+			Sint16	y = heights[(z - z0) * size + (x - x0)];
+			hf.m_height->get(x, z) = y;
+			hf.set_level(x, z, -1);
 
-		// Force the base vert to at least this activation level.
-		hf.activate(bx, bz, activation_level);
+			int	lx, lz, rx, rz;
+			if (((x | z) & (p->m_tile_size - 1)) == 0
+			    || get_base_edge(hf.m_size, x, z, &lx, &lz, &rx, &rz) == false)
+			{
+				// A tile corner.
+				continue;
+			}
+
+			int	lev = compute_activation_level(
+				hf,
+				y,
+				heights[(lz - z0) * size + (lx - x0)],
+				heights[(rz - z0) * size + (rx - x0)],
+				p->m_base_max_error);
+			hf.activate(x, z, lev);
+		}
 	}
+}
+
 
-	// Recurse to child triangles.
-	update(hf, base_max_error, bx, bz, ax, az, rx, rz);	// base, apex, right
-	update(hf, base_max_error, bx, bz, lx, lz, ax, az);	// base, left, apex
+void	update_tile_corners(heightfield& hf, float base_max_error, int tile_size)
+// Computes the activation levels of the tile corners, which
+// load_tile() skips, once all the tiles are loaded.
+{
+	for (int z = 0; z < hf.m_size; z += tile_size) {
+		for (int x = 0; x < hf.m_size; x += tile_size) {
+			int	lx, lz, rx, rz;
+			if (get_base_edge(hf.m_size, x, z, &lx, &lz, &rx, &rz)) {
+				int	lev = compute_activation_level(hf, hf.height(x, z), hf.height(lx, lz), hf.height(rx, rz), base_max_error);
+				hf.activate(x, z, lev);
+			}
+		}
+	}
+}
+
+
+void	propagate_edges(void* arg, int index)
+// For the squares of size (2 ^ (level + 1) + 1), propagates each
+// square's child center verts to its edge verts.  Rather than each
+// square pushing to its edges, each edge vert in the tile pulls from
+// the children of the squares on either side of it, which is the same
+// thing.  Essentially the quadtree meshing update dependency graph as
+// in my Gamasutra article.
+{
+	tile_pass*	p = (tile_pass*) arg;
+	heightfield&	hf = *p->m_hf;
+
+	int	x0, z0, x1, z1;
+	p->get_tile(index, &x0, &z0, &x1, &z1);
+
+	int	half_size = 1 << p->m_level;
+	int	quarter_size = half_size >> 1;
+	int	size = half_size << 1;
+
+	// Edge verts are on a multiple of the square size along one
+	// axis, and halfway between along the other.
+	for (int dir = 0; dir < 2; dir++) {
+		int	x_offset = dir ? half_size : 0;
+		int	z_offset = dir ? 0 : half_size;
+		for (int z = first_coord(z0, z_offset, size); z < z1; z += size) {
+			for (int x = first_coord(x0, x_offset, size); x < x1; x += size) {
+				{for (int i = 0; i < 4; i++) {
+					int	cx = x + ((i & 1) ? quarter_size : -quarter_size);
+					int	cz = z + ((i & 2) ? quarter_size : -quarter_size);
+					if (cx >= 0 && cx < hf.m_size && cz >= 0 && cz < hf.m_size) {
+						hf.activate(x, z, hf.get_level(cx, cz));
+					}
+				}}
+			}
+		}
+	}
+}
+
+
+void	propagate_centers(void* arg, int index)
+// For the squares of size (2 ^ (level + 1) + 1) whose centers are in
+// the tile, propagates the edge verts to the center.
+{
+	tile_pass*	p = (tile_pass*) arg;
+	heightfield&	hf = *p->m_hf;
+
+	int	x0, z0, x1, z1;
+	p->get_tile(index, &x0, &z0, &x1, &z1);
+
+	int	half_size = 1 << p->m_level;
+	int	size = half_size << 1;
+
+	for (int cz = first_coord(z0, half_size, size); cz < z1; cz += size) {
+		for (int cx = first_coord(x0, half_size, size); cx < x1; cx += size) {
+			hf.activate(cx, cz, hf.get_level(cx + half_size, cz));
+			hf.activate(cx, cz, hf.get_level(cx, cz - half_size));
+			hf.activate(cx, cz, hf.get_level(cx, cz + half_size));
+			hf.activate(cx, cz, hf.get_level(cx - half_size, cz));
+		}
+	}
+}
+
+
+void	finish_tile(void* arg, int index)
+// Makes sure the corner verts of every chunk are active at the
+// chunk's level, and counts the tile's active verts.
+{
+	tile_pass*	p = (tile_pass*) arg;
+	heightfield&	hf = *p->m_hf;
+
+	int	x0, z0, x1, z1;
+	p->get_tile(index, &x0, &z0, &x1, &z1);
+
+	// Chunks at level L are (1 << (leaf_log_size + L)) across.
+	int	leaf_log_size = hf.m_log_size - hf.root_level;
+	int	leaf_size = 1 << leaf_log_size;
+	for (int z = first_coord(z0, 0, leaf_size); z < z1; z += leaf_size) {
+		for (int x = first_coord(x0, 0, leaf_size); x < x1; x += leaf_size) {
+			// Level of the biggest chunk this is a corner of.
+			int	level = hf.root_level;
+			if (x | z) {
+				level = imin(lowest_one(x | z) - leaf_log_size, hf.root_level);
+			}
+			hf.activate(x, z, level);
+		}
+	}
+
+	int	count = 0;
+	for (int z = z0; z < z1; z++) {
+		for (int x = x0; x < x1; x++) {
+			if (hf.get_level(x, z) != -1) {
+				count++;
+			}
+		}
+	}
+	p->m_vertex_counts[p->m_first_tile + index] = count;
 }
 
 
@@ -859,61 +1152,6 @@ Sint16	get_height_at_LOD(heightfield& hf, int level, int x, int z)
 }
 
 
-void	propagate_activation_level(heightfield& hf, int cx, int cz, int level, int target_level)
-// Does a quadtree descent through the heightfield, in the square with
-// center at (cx, cz) and size of (2 ^ (level + 1) + 1).  Descends
-// until level == target_level, and then propagates this square's
-// child center verts to the corresponding edge vert, and the edge
-// verts to the center.  Essentially the quadtree meshing update
-// dependency graph as in my Gamasutra article.  Must call this with
-// successively increasing target_level to get correct propagation.
-{
-	int	half_size = 1 << level;
-	int	quarter_size = half_size >> 1;
-
-	if (level > target_level) {
-		// Recurse to children.
-		for (int j = 0; j < 2; j++) {
-			for (int i = 0; i < 2; i++) {
-				propagate_activation_level(hf,
-							   cx - quarter_size + half_size * i,
-							   cz - quarter_size + half_size * j,
-							   level - 1, target_level);
-			}
-		}
-		return;
-	}
-
-	// We're at the target level.  Do the propagation on this
-	// square.
-
-	if (level > 0) {
-		// Propagate child verts to edge verts.
-		int	lev = hf.get_level(cx + quarter_size, cz - quarter_size);	// ne
-		hf.activate(cx + half_size, cz, lev);
-		hf.activate(cx, cz - half_size, lev);
-
-		lev = hf.get_level(cx - quarter_size, cz - quarter_size);	// nw
-		hf.activate(cx, cz - half_size, lev);
-		hf.activate(cx - half_size, cz, lev);
-
-		lev = hf.get_level(cx - quarter_size, cz + quarter_size);	// sw
-		hf.activate(cx - half_size, cz, lev);
-		hf.activate(cx, cz + half_size, lev);
-
-		lev = hf.get_level(cx + quarter_size, cz + quarter_size);	// se
-		hf.activate(cx, cz + half_size, lev);
-		hf.activate(cx + half_size, cz, lev);
-	}
-
-	// Propagate edge verts to center.
-	hf.activate(cx, cz, hf.get_level(cx + half_size, cz));
-	hf.activate(cx, cz, hf.get_level(cx, cz - half_size));
-	hf.activate(cx, cz, hf.get_level(cx, cz + half_size));
-	hf.activate(cx, cz, hf.get_level(cx - half_size, cz));
-}
-
-
 int	check_propagation(heightfield& hf, int cx, int cz, int level)
 // Debugging function -- verifies that activation level dependencies
 // are correct throughout the tree.
@@ -976,7 +1214,10 @@ int	check_propagation(heightfield& hf, int cx, int cz, int level)
 }
 
 
-namespace mesh {
+struct mesh
+// Builds up the mesh data for a chunk.  Each chunk being generated
+// has its own.
+{
 	void	clear();
 	void	emit_vertex(heightfield& hf, int ax, int az);	// call this in strip order.
 	void	emit_previous_vertex();	// for ending a strip and starting another.
@@ -988,15 +1229,68 @@ namespace mesh {
 
 	int	lookup_index(int x, int z);
 
-	void	write(tu_file* rw, heightfield& hf, int activation_level);
+	// Writes the y range into the chunk's header, and the
+	// vertex & index data into data.
+	void	write(tu_file* header, tu_file* data, heightfield& hf, int activation_level);
 
 //	void	add_edge_strip_index(int edge_dir, int index);
 //	void	add_edge_vertex_lo(int edge_dir, int x, int z);
 //	void	add_edge_vertex_hi(int edge_dir, int hi_index, int x, int z);
+
+	mesh() { clear(); }
+
+//data:
+	struct vert_info
+	{
+		Sint16	x, z;
+		Sint16	y;
+		bool	special;
+
+		// hash function, for hash<>.
+		size_t	operator()(const vert_info& data)
+		{
+			return data.x + (data.y << 5) * 101 + (data.z << 10) * 101 + data.special;
+		}
+
+
+		vert_info() : x(-1), z(-1), y(0), special(false) {}
+		vert_info(int vx, int vz) : x(vx), z(vz), y(0), special(false) {}
+
+		// A "special" vert is not on the heightfield, but has its own Y value.
+		vert_info(int vx, int vy, int vz)
+			: x(vx),
+			  z(vz),
+			  y(vy),
+			  special(true)
+		{}
+
+		bool	operator==(const vert_info& v) const { return x == v.x && z == v.z; }
+	};
+
+	array<vert_info>	vertices;
+	array<int>	vertex_indices;
+	hash<vert_info, int, vert_info>	index_table;	// to accelerate get_vertex_index()
+
+	array<int>	edge_strip[4];
+	array<vert_info>	edge_lo[4];
+	array<vert_info>	edge_hi[4][2];
+
+	vec3	min, max;	// for bounding box.
+
+	Sint16	min_y, max_y;
+
+	int	real_triangles;	// counted by write()
+	int	degenerate_triangles;
+
+private:
+	int	get_vertex_index(int x, int z);
+	int	special_vertex_index(int x, Sint16 y, int z);
+	void	write_vertex(tu_file* rw, heightfield& hf, int level, const vec3& box_center, const vec3& compress_factor, const vert_info& v);
+	void	update_bounds(heightfield& hf, const vec3& v, Sint16 y);
 };
 
 
-void	generate_edge_data(tu_file* out, heightfield& hf, int dir, int x0, int z0, int x1, int z1, int level);
+void	generate_edge_data(mesh* m, heightfield& hf, int dir, int x0, int z0, int x1, int z1, int level);
 
 
 // Manually synced!!!  (@@ should use a fixed-size struct, to be
@@ -1004,7 +1298,15 @@ void	generate_edge_data(tu_file* out, heightfield& hf, int dir, int x0, int z0,
 // header contents, you must keep this constant in sync.  In DEBUG
 // builds, there's an assert that should catch discrepancies, but be
 // careful.
-const int	CHUNK_HEADER_BYTES = 4 + 4*4 + 1 + 2 + 2 + 2*2 + 4;
+//
+// The headers make up the table-of-contents at the start of the file,
+// in tree order; the viewer reads them all in one go.  Format
+// version 10 added the 64-bit data offset and the data size.
+const int	CHUNK_HEADER_BYTES = 4 + 4*4 + 1 + 2 + 2 + 2*2 + 8 + 4;
+
+// Chunk mesh data starts on a multiple of this, so the viewer can use
+// it in place from a memory-mapped file.
+const int	CHUNK_DATA_ALIGNMENT = 4;
 
 
 void	generate_empty_TOC(tu_file* rw, int root_level)
@@ -1030,27 +1332,83 @@ void	generate_empty_TOC(tu_file* rw, int root_level)
 
 
 struct gen_state;
-void	generate_block(heightfield& hf, int level, int log_size, int cx, int cz);
-void	generate_quadrant(heightfield& hf, gen_state* s, int lx, int lz, int tx, int tz, int rx, int rz, int level);
+void	generate_block(mesh* m, heightfield& hf, int level, int log_size, int cx, int cz);
+void	generate_quadrant(mesh* m, heightfield& hf, gen_state* s, int lx, int lz, int tx, int tz, int rx, int rz, int level);
+
+
+struct chunk_job
+// A chunk for the thread pool to generate.
+{
+	int	m_x0, m_z0;	// northwest corner
+	int	m_log_size;
+	int	m_level;
+
+	// Results: the chunk header, up to the mesh data position & size,
+	// and the mesh data.
+	tu_file*	m_header;
+	tu_file*	m_data;
+	int	m_real_triangles;
+	int	m_degenerate_triangles;
+};
+
+
+struct chunk_batch
+// Argument for generate_chunk().
+{
+	heightfield*	m_hf;
+	chunk_job*	m_jobs;
+};
+
+
+static void	add_chunk_jobs(array<chunk_job>* jobs, int x0, int z0, int log_size, int level)
+// Append jobs for the given chunk and all its descendants, in the
+// order their headers go in the table of contents.
+{
+	chunk_job	job;
+	job.m_x0 = x0;
+	job.m_z0 = z0;
+	job.m_log_size = log_size;
+	job.m_level = level;
+	job.m_header = NULL;
+	job.m_data = NULL;
+	job.m_real_triangles = 0;
+	job.m_degenerate_triangles = 0;
+	jobs->push_back(job);
+
+	if (level > 0) {
+		int	half_size = (1 << (log_size-1));
+		add_chunk_jobs(jobs, x0, z0, log_size-1, level-1);	// nw
+		add_chunk_jobs(jobs, x0 + half_size, z0, log_size-1, level-1);	// ne
+		add_chunk_jobs(jobs, x0, z0 + half_size, log_size-1, level-1);	// sw
+		add_chunk_jobs(jobs, x0 + half_size, z0 + half_size, log_size-1, level-1);	// se
+	}
+}
 
 
-void	generate_node_data(tu_file* out, heightfield& hf, int x0, int z0, int log_size, int level)
+void	generate_chunk(void* arg, int index)
 // Given a square of data, with northwest corner at (x0, z0) and
 // comprising ((1<<log_size)+1) verts along each axis, this function
-// generates the mesh using verts which are active at the given level.
-//
-// If we're not at the base level (level > 0), then also recurses to
-// quadtree child nodes and generates their data.
+// generates the mesh using verts which are active at the given level,
+// into memory.  Runs on the thread pool; by now the heightfield is
+// read-only, so chunks can be generated in any order.
 {
-	int	start_pos = out->get_position();	// use this to verify the value of CHUNK_HEADER_BYTES
+	chunk_batch*	batch = (chunk_batch*) arg;
+	heightfield&	hf = *batch->m_hf;
+	chunk_job*	job = &batch->m_jobs[index];
 
-	stats.output_chunks++;
+	int	x0 = job->m_x0;
+	int	z0 = job->m_z0;
+	int	log_size = job->m_log_size;
+	int	level = job->m_level;
 
 	int	size = (1 << log_size);
 	int	half_size = size >> 1;
 	int	cx = x0 + half_size;
 	int	cz = z0 + half_size;
 
+	tu_file*	out = new tu_file(tu_file::memory_buffer);
+	job->m_header = out;
+
 	// Assign a label to this chunk, so edges can reference the chunks.
 	int	chunk_label = hf.node_index(cx, cz);
 //	printf("chunk_label(%d,%d) = %d\n", cx, cz, chunk_label);//xxxx
@@ -1068,48 +1426,96 @@ void	generate_node_data(tu_file* out, heightfield& hf, int x0, int z0, int log_s
 	int	LOD_level = hf.root_level - level;
 	assert(LOD_level >= 0 && LOD_level < 256);
 	out->write_byte(LOD_level);
-	out->write_le32(x0 >> log_size);
-	out->write_le32(z0 >> log_size);
-
-	// Start making the mesh.
-	mesh::clear();
+	out->write_le16(x0 >> log_size);
+	out->write_le16(z0 >> log_size);
 
-	// !!! This needs to be done in propagate, or something (too late now) !!!
-	// Make sure our corner verts are activated on this level.
-	hf.activate(x0 + size, z0, level);
-	hf.activate(x0, z0, level);
-	hf.activate(x0, z0 + size, level);
-	hf.activate(x0 + size, z0 + size, level);
-
-	// Generate the mesh.
-	generate_block(hf, level, log_size, x0 + half_size, z0 + half_size);
-
-	printf("\b%c", spinner[(spin_count++)&3]);
+	// Generate the mesh.  (finish_tile() has made sure our corner
+	// verts are activated on this level.)
+	mesh	m;
+	generate_block(&m, hf, level, log_size, x0 + half_size, z0 + half_size);
 
 //	// Print some interesting info.
 //	printf("chunk: (%d, %d) size = %d\n", x0, z0, size);
 
 	// Generate data for our edge skirts.  Go counterclockwise around
 	// the outside (ensures correct winding).
-	generate_edge_data(out, hf, 0, cx + half_size, cz + half_size, cx + half_size, cz - half_size, level);	// east
-	generate_edge_data(out, hf, 1, cx + half_size, cz - half_size, cx - half_size, cz - half_size, level);	// north
-	generate_edge_data(out, hf, 2, cx - half_size, cz - half_size, cx - half_size, cz + half_size, level);	// west
-	generate_edge_data(out, hf, 3, cx - half_size, cz + half_size, cx + half_size, cz + half_size, level);	// south
+	generate_edge_data(&m, hf, 0, cx + half_size, cz + half_size, cx + half_size, cz - half_size, level);	// east
+	generate_edge_data(&m, hf, 1, cx + half_size, cz - half_size, cx - half_size, cz - half_size, level);	// north
+	generate_edge_data(&m, hf, 2, cx - half_size, cz - half_size, cx - half_size, cz + half_size, level);	// west
+	generate_edge_data(&m, hf, 3, cx - half_size, cz + half_size, cx + half_size, cz + half_size, level);	// south
 
 	// Finish writing our data.
-	mesh::write(out, hf, level);
+	job->m_data = new tu_file(tu_file::memory_buffer);
+	m.write(out, job->m_data, hf, level);
+	job->m_real_triangles = m.real_triangles;
+	job->m_degenerate_triangles = m.degenerate_triangles;
+}
+
+
+static void	write_chunk(tu_file* out, int header_position, chunk_job* job)
+// Append a generated chunk's mesh data to the output, and fill in its
+// header in the table of contents.  Frees the job's results.
+{
+	membuf	header;
+	job->m_header->set_position(0);
+	job->m_header->copy_to(&header);
+
+	membuf	data;
+	job->m_data->set_position(0);
+	job->m_data->copy_to(&data);
+
+	out->go_to_end();
+	while (out->get_position() % CHUNK_DATA_ALIGNMENT) {
+		out->write_byte(0);
+	}
+	int	data_position = out->get_position();
+	out->write_bytes(data.data(), data.size());
+
+	out->set_position(header_position);
+	out->write_bytes(header.data(), header.size());
+	out->write_le64(data_position);
+	out->write_le32(data.size());
 
-	int	header_bytes_written = out->get_position() - start_pos;
+	int	header_bytes_written = out->get_position() - header_position;
 	assert(header_bytes_written == CHUNK_HEADER_BYTES);
 	header_bytes_written = header_bytes_written;	// don't warn about unused var
 
-	// recurse to child regions, to generate child chunks.
-	if (level > 0) {
-		int	half_size = (1 << (log_size-1));
-		generate_node_data(out, hf, x0, z0, log_size-1, level-1);	// nw
-		generate_node_data(out, hf, x0 + half_size, z0, log_size-1, level-1);	// ne
-		generate_node_data(out, hf, x0, z0 + half_size, log_size-1, level-1);	// sw
-		generate_node_data(out, hf, x0 + half_size, z0 + half_size, log_size-1, level-1);	// se
+	stats.output_chunks++;
+	stats.output_real_triangles += job->m_real_triangles;
+	stats.output_degenerate_triangles += job->m_degenerate_triangles;
+
+	delete job->m_header;
+	job->m_header = NULL;
+	delete job->m_data;
+	job->m_data = NULL;
+}
+
+
+void	generate_chunks(tu_file* out, heightfield& hf, tu_thread::pool* pool)
+// Generate the whole chunk tree.  The table of contents goes at the
+// current position in out, and the mesh data after it.
+//
+// The pool generates a batch of chunks at a time, which we write
+// before starting the next batch.  That keeps the memory use down,
+// and the output the same whatever the thread count.
+{
+	int	toc_position = out->get_position();
+
+	array<chunk_job>	jobs;
+	add_chunk_jobs(&jobs, 0, 0, hf.m_log_size, hf.root_level);
+
+	int	batch_size = pool->get_thread_count() * 8;
+	for (int first = 0; first < jobs.size(); first += batch_size) {
+		int	count = imin(batch_size, jobs.size() - first);
+
+		chunk_batch	batch = { &hf, &jobs[first] };
+		pool->run(generate_chunk, &batch, count);
+
+		for (int i = first; i < first + count; i++) {
+			write_chunk(out, toc_position + i * CHUNK_HEADER_BYTES, &jobs[i]);
+		}
+
+		show_progress("meshing", first + count, jobs.size());
 	}
 }
 
@@ -1136,7 +1542,7 @@ struct gen_state {
 };
 
 
-void	generate_block(heightfield& hf, int activation_level, int log_size, int cx, int cz)
+void	generate_block(mesh* m, heightfield& hf, int activation_level, int log_size, int cx, int cz)
 // Generate the mesh for the specified square with the given center.
 // This is paraphrased directly out of Lindstrom et al, SIGGRAPH '96.
 // It generates a square mesh by walking counterclockwise around four
@@ -1162,7 +1568,7 @@ void	generate_block(heightfield& hf, int activation_level, int log_size, int cx,
 		state.my_buffer[i>>1][i&1] = -1;
 	}
 
-	mesh::emit_vertex(hf, q[0][0], q[0][1]);
+	m->emit_vertex(hf, q[0][0], q[0][1]);
 	state.set_my_buffer(q[0][0], q[0][1]);
 
 	{for (int i = 0; i < 4; i++) {
@@ -1173,15 +1579,15 @@ void	generate_block(heightfield& hf, int activation_level, int log_size, int cx,
 			// tulrich: jump via degenerate?
 			int	x = state.my_buffer[1 - state.ptr][0];
 			int	z = state.my_buffer[1 - state.ptr][1];
-			mesh::emit_vertex(hf, x, z);	// or, emit vertex(last - 1);
+			m->emit_vertex(hf, x, z);	// or, emit vertex(last - 1);
 		}
 
 		// Initial vertex of quadrant.
-		mesh::emit_vertex(hf, q[i][0], q[i][1]);
+		m->emit_vertex(hf, q[i][0], q[i][1]);
 		state.set_my_buffer(q[i][0], q[i][1]);
 		state.previous_level = 2 * log_size + 1;
 
-		generate_quadrant(hf,
+		generate_quadrant(m, hf,
 				  &state,
 				  q[i][0], q[i][1],	// q[i][l]
 				  cx, cz,	// q[i][t]
@@ -1191,12 +1597,12 @@ void	generate_block(heightfield& hf, int activation_level, int log_size, int cx,
 	}}
 	if (state.in_my_buffer(q[0][0], q[0][1]) == false) {
 		// finish off the strip.  @@ may not be necessary?
-		mesh::emit_vertex(hf, q[0][0], q[0][1]);
+		m->emit_vertex(hf, q[0][0], q[0][1]);
 	}
 }
 
 
-void	generate_quadrant(heightfield& hf, gen_state* s, int lx, int lz, int tx, int tz, int rx, int rz, int recursion_level)
+void	generate_quadrant(mesh* m, heightfield& hf, gen_state* s, int lx, int lz, int tx, int tz, int rx, int rz, int recursion_level)
 // Auxiliary function for generate_block().  Generates a mesh from a
 // triangular quadrant of a square heightfield block.  Paraphrased
 // directly out of Lindstrom et al, SIGGRAPH '96.
@@ -1208,7 +1614,7 @@ void	generate_quadrant(heightfield& hf, gen_state* s, int lx, int lz, int tx, in
 		int	bx = (lx + rx) >> 1;
 		int	bz = (lz + rz) >> 1;
 
-		generate_quadrant(hf, s, lx, lz, bx, bz, tx, tz, recursion_level - 1);	// left half of quadrant
+		generate_quadrant(m, hf, s, lx, lz, bx, bz, tx, tz, recursion_level - 1);	// left half of quadrant
 
 		if (s->in_my_buffer(tx,tz) == false) {
 			if ((recursion_level + s->previous_level) & 1) {
@@ -1216,19 +1622,19 @@ void	generate_quadrant(heightfield& hf, gen_state* s, int lx, int lz, int tx, in
 			} else {
 				int	x = s->my_buffer[1 - s->ptr][0];
 				int	z = s->my_buffer[1 - s->ptr][1];
-				mesh::emit_vertex(hf, x, z);	// or, emit vertex(last - 1);
+				m->emit_vertex(hf, x, z);	// or, emit vertex(last - 1);
 			}
-			mesh::emit_vertex(hf, tx, tz);
+			m->emit_vertex(hf, tx, tz);
 			s->set_my_buffer(tx, tz);
 			s->previous_level = recursion_level;
 		}
 
-		generate_quadrant(hf, s, tx, tz, bx, bz, rx, rz, recursion_level - 1);
+		generate_quadrant(m, hf, s, tx, tz, bx, bz, rx, rz, recursion_level - 1);
 	}
 }
 
 
-void	generate_edge_data(tu_file* out, heightfield& hf, int dir, int x0, int z0, int x1, int z1, int level)
+void	generate_edge_data(mesh* m, heightfield& hf, int dir, int x0, int z0, int x1, int z1, int level)
 // Write out the data for an edge of the chunk that was just generated.
 // (x0,z0) - (x1,z1) defines the extent of the edge in the heightfield.
 // level determines which vertices in the mesh are active.
@@ -1343,13 +1749,13 @@ void	generate_edge_data(tu_file* out, heightfield& hf, int dir, int x0, int z0,
 	// (simplified) edges and the true shape of the mesh along our
 	// edges.
 
-	mesh::emit_previous_vertex();	// end the previous strip; starting a new one.
-	if ((mesh::get_index_count() & 1) == 0) {
+	m->emit_previous_vertex();	// end the previous strip; starting a new one.
+	if ((m->get_index_count() & 1) == 0) {
 		// even number of verts, which means current winding order
 		// will be backwards, after we add the degenerate to start the
 		// strip.  Emit an extra degenerate vert to restore the normal
 		// winding order.
-		mesh::emit_previous_vertex();
+		m->emit_previous_vertex();
 	}
 
 	int	vert_index = 0;
@@ -1365,11 +1771,11 @@ void	generate_edge_data(tu_file* out, heightfield& hf, int dir, int x0, int z0,
 				min_height = imin(min_height, vert_minimums[vert_index + 1]);
 			}
 
-			mesh::emit_vertex(hf, x, z);
+			m->emit_vertex(hf, x, z);
 			if (i == 0) {
-				mesh::emit_previous_vertex();	// starting a new strip.
+				m->emit_previous_vertex();	// starting a new strip.
 			}
-			mesh::emit_special_vertex(hf, x, min_height, z);
+			m->emit_special_vertex(hf, x, min_height, z);
 
 			vert_index++;
 		}
@@ -1378,320 +1784,256 @@ void	generate_edge_data(tu_file* out, heightfield& hf, int dir, int x0, int z0,
 
 
 
-namespace mesh {
-// mini module for building up mesh data.
-
-//data:
-	struct vert_info
-	{
-		Sint16	x, z;
-		Sint16	y;
-		bool	special;
+int	mesh::get_vertex_index(int x, int z)
+// Return the index of the specified vert.  If the vert isn't
+// in our vertex list, then add it to the end.
+{
+	int	index = lookup_index(x, z);
 
-		// hash function, for hash<>.
-		size_t	operator()(const vert_info& data)
-		{
-			return data.x + (data.y << 5) * 101 + (data.z << 10) * 101 + data.special;
-		}
+	if (index != -1) {
+		// We already have that vert.
+		return index;
+	}
 
+	index = vertices.size();
+	vert_info	v(x, z);
+	vertices.push_back(v);
+	index_table.add(v, index);
 
-		vert_info() : x(-1), z(-1), y(0), special(false) {}
-		vert_info(int vx, int vz) : x(vx), z(vz), y(0), special(false) {}
+	return index;
+}
 
-		// A "special" vert is not on the heightfield, but has its own Y value.
-		vert_info(int vx, int vy, int vz)
-			: x(vx),
-			  z(vz),
-			  y(vy),
-			  special(true)
-		{}
 
-		bool	operator==(const vert_info& v) const { return x == v.x && z == v.z; }
-	};
+int	mesh::special_vertex_index(int x, Sint16 y, int z)
+// Add a "special" vertex; i.e. a vert that is not on the
+// heightfield.
+{
+	int	index = vertices.size();
+	vert_info	v(x, y, z);
+	vertices.push_back(v);
 
-	array<vert_info>	vertices;
-	array<int>	vertex_indices;
-	hash<vert_info, int, vert_info>	index_table;	// to accelerate get_vertex_index()
+	return index;
+}
 
-	array<int>	edge_strip[4];
-	array<vert_info>	edge_lo[4];
-	array<vert_info>	edge_hi[4][2];
 
-	vec3	min, max;	// for bounding box.
+int	mesh::lookup_index(int x, int z)
+// Return the index in the current vertex array of the specified
+// vertex.  If the vertex can't be found in the current array,
+// then returns -1.
+{
+	int	index;
+	if (index_table.get(vert_info(x, z), &index)) {
+		// Found it.
+		return index;
+	}
+	// Didn't find it.
+	return -1;
+}
 
-	Sint16	min_y, max_y;
 
+void	mesh::clear()
+// Reset and empty all our containers, to start a fresh mesh.
+{
+	vertices.clear();
+	vertex_indices.clear();
+	index_table.clear();
+	index_table.resize(4096);
 
-//code:
-	int	get_vertex_index(int x, int z)
-	// Return the index of the specified vert.  If the vert isn't
-	// in our vertex list, then add it to the end.
-	{
-		int	index = lookup_index(x, z);
+	for (int i = 0; i < 4; i++) {
+		edge_strip[i].clear();
+		edge_lo[i].clear();
+		edge_hi[i][0].clear();
+		edge_hi[i][1].clear();
+	}
 
-		if (index != -1) {
-			// We already have that vert.
-			return index;
-		}
+	min = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 
-		index = vertices.size();
-		vert_info	v(x, z);
-		vertices.push_back(v);
-		index_table.add(v, index);
+	min_y = (Sint16) 0x7FFF;
+	max_y = (Sint16) 0x8000;
 
-		return index;
-	}
+	real_triangles = 0;
+	degenerate_triangles = 0;
+}
 
-	
-	int	special_vertex_index(int x, Sint16 y, int z)
-	// Add a "special" vertex; i.e. a vert that is not on the
-	// heightfield.
-	{
-		int	index = vertices.size();
-		vert_info	v(x, y, z);
-		vertices.push_back(v);
+void	mesh::write_vertex(tu_file* rw, heightfield& hf,
+			 int level, const vec3& box_center, const vec3& compress_factor,
+			     const vert_info& v)
+// Utility function, to output the quantized data for a vertex.
+{
+	Sint16	x, y, z;
 
-		return index;
+	x = (int) floor(((v.x * hf.sample_spacing - box_center.get_x()) * compress_factor.get_x()) + 0.5);
+	if (v.special) {
+		y = v.y;
+	} else {
+		y = hf.height(v.x, v.z);
 	}
-
-
-	int	lookup_index(int x, int z)
-	// Return the index in the current vertex array of the specified
-	// vertex.  If the vertex can't be found in the current array,
-	// then returns -1.
-	{
-		int	index;
-		if (index_table.get(vert_info(x, z), &index)) {
-			// Found it.
-			return index;
-		}
-		// Didn't find it.
-		return -1;
+	z = (int) floor(((v.z * hf.sample_spacing - box_center.get_z()) * compress_factor.get_z()) + 0.5);
+
+	rw->write_le16(x);
+	rw->write_le16(y);
+	rw->write_le16(z);
+
+	// Morph info.  Calculate the difference between the
+	// vert height, and the height of the same spot in the
+	// next lower-LOD mesh.
+	Sint16	lerped_height;
+	if (v.special) {
+		lerped_height = y;	// special verts don't morph.
+	} else {
+		lerped_height = get_height_at_LOD(hf, level + 1, v.x, v.z);
 	}
+	int	morph_delta = (lerped_height - y);
+	rw->write_le16((Sint16) morph_delta);
+	assert(morph_delta == (Sint16) morph_delta);	// Watch out for overflow.
+}
 
 
-	void	clear()
-	// Reset and empty all our containers, to start a fresh mesh.
-	{
-		vertices.clear();
-		vertex_indices.clear();
-		index_table.clear();
-		index_table.resize(4096);
-
-		for (int i = 0; i < 4; i++) {
-			edge_strip[i].clear();
-			edge_lo[i].clear();
-			edge_hi[i][0].clear();
-			edge_hi[i][1].clear();
-		}
+void	mesh::write(tu_file* header, tu_file* rw, heightfield& hf, int level)
+// Write out the current chunk.  The caller puts the vertex data at
+// the *end* of the file, and fills in its position & size after the
+// rest of the header.
+{
+	// Write min & max y values.  This can be used to reconstruct
+	// the bounding box.
+	header->write_le16(min_y);
+	header->write_le16(max_y);
+
+	// Compute bounding box.  Determines the scale and offset for
+	// quantizing the verts.
+	vec3	box_center = (min + max) * 0.5f;
+	vec3	box_extent = (max - min) * 0.5f;
+
+	// Use (1 << 14) values in both positive and negative
+	// directions.  Wastes just under 1 bit, but the total range
+	// is [-2^14, 2^14], which is 2^15+1 values.  This is good --
+	// fits nicely w/ 2^N+1 dimensions of binary-triangle-tree
+	// vertex locations.
+
+	vec3	compress_factor;
+	{for (int i = 0; i < 3; i++) {
+		compress_factor.set(i, (1 << 14) / fmax(1.0, box_extent.get(i)));
+	}}
 
-		min = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
-		max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	// Make sure the vertex buffer is not too big.
+	if (vertices.size() >= (1 << 16)) {
+		printf("error: chunk contains > 64K vertices.  Try processing again, but use\n"
+		       "the -d <depth> option to make a deeper chunk tree.\n"
+		       "Or, maybe the height scale is too big; use the -v option to scale it down.\n");
+		exit(1);
+	}
 
-		min_y = (Sint16) 0x7FFF;
-		max_y = (Sint16) 0x8000;
+	// Write vertices.  All verts contain morph info.
+	rw->write_le16(vertices.size());
+	for (int i = 0; i < vertices.size(); i++) {
+		write_vertex(rw, hf, level, box_center, compress_factor, vertices[i]);
 	}
 
-	static void	write_vertex(tu_file* rw, heightfield& hf,
-				     int level, const vec3& box_center, const vec3& compress_factor,
-				     const vert_info& v)
-	// Utility function, to output the quantized data for a vertex.
 	{
-		Sint16	x, y, z;
-
-		x = (int) floor(((v.x * hf.sample_spacing - box_center.get_x()) * compress_factor.get_x()) + 0.5);
-		if (v.special) {
-			y = v.y;
-		} else {
-			y = hf.height(v.x, v.z);
+		// Write triangle-strip vertex indices.
+		rw->write_le32(vertex_indices.size());
+		for (int i = 0; i < vertex_indices.size(); i++) {
+			rw->write_le16(vertex_indices[i]);
 		}
-		z = (int) floor(((v.z * hf.sample_spacing - box_center.get_z()) * compress_factor.get_z()) + 0.5);
-
-		rw->write_le16(x);
-		rw->write_le16(y);
-		rw->write_le16(z);
-
-		// Morph info.  Calculate the difference between the
-		// vert height, and the height of the same spot in the
-		// next lower-LOD mesh.
-		Sint16	lerped_height;
-		if (v.special) {
-			lerped_height = y;	// special verts don't morph.
-		} else {
-			lerped_height = get_height_at_LOD(hf, level + 1, v.x, v.z);
-		}
-		int	morph_delta = (lerped_height - y);
-		rw->write_le16((Sint16) morph_delta);
-		assert(morph_delta == (Sint16) morph_delta);	// Watch out for overflow.
 	}
 
-
-	void	write(tu_file* rw, heightfield& hf, int level)
-	// Write out the current chunk.
+	// Count the real triangles in the main chunk.
 	{
-		// Write min & max y values.  This can be used to reconstruct
-		// the bounding box.
-		rw->write_le16(min_y);
-		rw->write_le16(max_y);
-
-//		// Make a placeholder for this data chunk's data size.
-//		int	size_filepos = SDL_RWtell(rw);
-//		SDL_WriteLE32(rw, 0);
-
-		// Write a placeholder for the mesh data file pos.
-		int	current_pos = rw->get_position();
-		rw->write_le32(0);
-		
-		// write out the vertex data at the *end* of the file.
-		rw->go_to_end();
-		int	mesh_pos = rw->get_position();
-
-		// Compute bounding box.  Determines the scale and offset for
-		// quantizing the verts.
-		vec3	box_center = (min + max) * 0.5f;
-		vec3	box_extent = (max - min) * 0.5f;
-
-		// Use (1 << 14) values in both positive and negative
-		// directions.  Wastes just under 1 bit, but the total range
-		// is [-2^14, 2^14], which is 2^15+1 values.  This is good --
-		// fits nicely w/ 2^N+1 dimensions of binary-triangle-tree
-		// vertex locations.
-
-		vec3	compress_factor;
-		{for (int i = 0; i < 3; i++) {
-			compress_factor.set(i, (1 << 14) / fmax(1.0, box_extent.get(i)));
-		}}
-
-		// Make sure the vertex buffer is not too big.
-		if (vertices.size() >= (1 << 16)) {
-			printf("error: chunk contains > 64K vertices.  Try processing again, but use\n"
-			       "the -d <depth> option to make a deeper chunk tree.\n"
-			       "Or, maybe the height scale is too big; use the -v option to scale it down.\n");
-			exit(1);
-		}
-
-		// Write vertices.  All verts contain morph info.
-		rw->write_le16(vertices.size());
-		for (int i = 0; i < vertices.size(); i++) {
-			write_vertex(rw, hf, level, box_center, compress_factor, vertices[i]);
-		}
-
-		{
-			// Write triangle-strip vertex indices.
-			rw->write_le32(vertex_indices.size());
-			for (int i = 0; i < vertex_indices.size(); i++) {
-				rw->write_le16(vertex_indices[i]);
-			}
-		}
-
-		// Count the real triangles in the main chunk.
-		{
-			int	tris = 0;
-			for (int i = 0; i < vertex_indices.size() - 2; i++) {
-				if (vertex_indices[i] != vertex_indices[i+1]
-					&& vertex_indices[i] != vertex_indices[i+2])
-				{
-					// Real triangle.
-					tris++;
-				}
+		int	tris = 0;
+		for (int i = 0; i < vertex_indices.size() - 2; i++) {
+			if (vertex_indices[i] != vertex_indices[i+1]
+				&& vertex_indices[i] != vertex_indices[i+2])
+			{
+				// Real triangle.
+				tris++;
 			}
-
-			stats.output_real_triangles += tris;
-			stats.output_degenerate_triangles += (vertex_indices.size() - 2) - tris;
-
-			// Write real triangle count.
-			rw->write_le32(tris);
 		}
 
-		// Rewind, and fill in the mesh data file pos.
-		rw->set_position(current_pos);
-		rw->write_le32(mesh_pos);
+		real_triangles = tris;
+		degenerate_triangles = (vertex_indices.size() - 2) - tris;
 
-//		// Go back and write the size of the chunk we just wrote.
-//		int	current_filepos = SDL_RWtell(rw);
-//		int	data_size = current_filepos - size_filepos - 4;
-//		SDL_RWseek(rw, size_filepos, SEEK_SET);
-//		SDL_WriteLE32(rw, data_size);
-//		SDL_RWseek(rw, current_filepos, SEEK_SET);
+		// Write real triangle count.
+		rw->write_le32(tris);
 	}
+}
 
 
-	void	update_bounds(heightfield& hf, const vec3& v, Sint16 y)
-	// Update our bounding box given the specified newly added vertex.
-	{
-		for (int i = 0; i < 3; i++) {
-			if (v.get(i) < min.get(i)) {
-				min.set(i, v.get(i));
-			}
-			if (v.get(i) > max.get(i)) {
-				max.set(i, v.get(i));
-			}
-		}
-
-		// Update min/max y.
-		if (y < min_y) {
-			min_y = y;
+void	mesh::update_bounds(heightfield& hf, const vec3& v, Sint16 y)
+// Update our bounding box given the specified newly added vertex.
+{
+	for (int i = 0; i < 3; i++) {
+		if (v.get(i) < min.get(i)) {
+			min.set(i, v.get(i));
 		}
-		if (y > max_y) {
-			max_y = y;
-		}
-
-		// Peephole optimization: if the strip begins with three of
-		// the same vert in a row, as generate_block() often causes,
-		// then the first two are a no-op, so strip them away.
-		if (vertex_indices.size() == 3
-			&& vertex_indices[0] == vertex_indices[1]
-			&& vertex_indices[0] == vertex_indices[2])
-		{
-			vertex_indices.resize(1);
+		if (v.get(i) > max.get(i)) {
+			max.set(i, v.get(i));
 		}
 	}
 
+	// Update min/max y.
+	if (y < min_y) {
+		min_y = y;
+	}
+	if (y > max_y) {
+		max_y = y;
+	}
 
-	void	emit_vertex(heightfield& hf, int x, int z)
-	// Call this in strip order.  Inserts the given vert into the current strip.
+	// Peephole optimization: if the strip begins with three of
+	// the same vert in a row, as generate_block() often causes,
+	// then the first two are a no-op, so strip them away.
+	if (vertex_indices.size() == 3
+		&& vertex_indices[0] == vertex_indices[1]
+		&& vertex_indices[0] == vertex_indices[2])
 	{
-		int	index = get_vertex_index(x, z);
-		vertex_indices.push_back(index);
-
-		// Check coordinates and update bounding box.
-		Sint16	y = hf.height(x, z);
-		vec3	v(x * hf.sample_spacing, y * hf.vertical_scale, z * hf.sample_spacing);
-		update_bounds(hf, v, y);
+		vertex_indices.resize(1);
 	}
+}
 
 
-	void	emit_special_vertex(heightfield& hf, int x, Sint16 y, int z)
-	// Emit a vertex that's not on the heightfield (and doesn't have vertex sharing).
-	{
-		int	index = special_vertex_index(x, y, z);
-		vertex_indices.push_back(index);
+void	mesh::emit_vertex(heightfield& hf, int x, int z)
+// Call this in strip order.  Inserts the given vert into the current strip.
+{
+	int	index = get_vertex_index(x, z);
+	vertex_indices.push_back(index);
 
-		// Check coordinates and update bounding box.
-		vec3	v(x * hf.sample_spacing, y * hf.vertical_scale, z * hf.sample_spacing);
-		update_bounds(hf, v, y);
-	}
+	// Check coordinates and update bounding box.
+	Sint16	y = hf.height(x, z);
+	vec3	v(x * hf.sample_spacing, y * hf.vertical_scale, z * hf.sample_spacing);
+	update_bounds(hf, v, y);
+}
 
 
-	void	emit_previous_vertex()
-	// Emit the last vertex index again.  This creates a degenerate
-	// triangle, useful for ending a strip and starting a new strip
-	// elsewhere.
-	{
-		assert(vertex_indices.size() > 0);
-		int	last_index = vertex_indices[vertex_indices.size() - 1];
-		vertex_indices.push_back(last_index);
-	}
+void	mesh::emit_special_vertex(heightfield& hf, int x, Sint16 y, int z)
+// Emit a vertex that's not on the heightfield (and doesn't have vertex sharing).
+{
+	int	index = special_vertex_index(x, y, z);
+	vertex_indices.push_back(index);
 
+	// Check coordinates and update bounding box.
+	vec3	v(x * hf.sample_spacing, y * hf.vertical_scale, z * hf.sample_spacing);
+	update_bounds(hf, v, y);
+}
 
-	int	get_index_count()
-	// Return the current count of strip indices.  This is helpful for
-	// determining whether we need an extra degenerate triangle to get
-	// the correct winding order for a new strip.
-	{
-		return vertex_indices.size();
-	}
-};
+
+void	mesh::emit_previous_vertex()
+// Emit the last vertex index again.  This creates a degenerate
+// triangle, useful for ending a strip and starting a new strip
+// elsewhere.
+{
+	assert(vertex_indices.size() > 0);
+	int	last_index = vertex_indices[vertex_indices.size() - 1];
+	vertex_indices.push_back(last_index);
+}
+
+
+int	mesh::get_index_count()
+// Return the current count of strip indices.  This is helpful for
+// determining whether we need an extra degenerate triangle to get
+// the correct winding order for a new strip.
+{
+	return vertex_indices.size();
+}
 
 
 // Local Variables:
@@ -6,6 +6,15 @@
 // Program to take a large image and turn it into a quadtree of image
 // tiles, a "texture quadtree".  Texture quadtree (".tqt") files can
 // be fed into the chunkdemo for hi-res textured terrain.
+//
+// The tree is built bottom-up, a row of tiles at a time.  Leaf tiles
+// are resampled from a strip of the input image, which is decoded
+// once, from top to bottom.  Once both rows of children under a row
+// of parents are done, the parents are made from the children's
+// images, which are still in memory -- so every tile is resampled
+// from undamaged data, and no tile is decoded again.  The tiles of a
+// row are resampled and encoded (JPEG, or BC1 with -c) on a thread
+// pool, while the next strip of the input is decoded.
 
 
 #include <stdlib.h>
@@ -19,47 +28,283 @@ extern "C" {
 #include "base/container.h"
 #include "base/jpeg.h"
 #include "base/image.h"
+#include "base/membuf.h"
 #include "base/tu_file.h"
+#include "base/tu_thread.h"
 #include "geometry/geometry.h"
 #include "geometry/tqt.h"
 
 
-static const char*	spinner = "-\\|/";
-static int spin_count = 0;
-
-
 void	print_usage()
 // Print usage info.
 {
 	printf("maketqt: program for making a texture quadtree file from a .jpg input texture.\n\n"
 	       "This program has been donated to the Public Domain by Thatcher Ulrich http://tulrich.com\n"
 	       "Incorporates software from the Independent JPEG Group\n\n"
-		   "usage: maketqt <input_jpeg> <output_tqt> [-d tree_depth] [-t tile_size]\n"
+		   "usage: maketqt <input_jpeg> <output_tqt> [-d tree_depth] [-t tile_size] [-j threads] [-c]\n"
 		   "\n"
 		   "tree_depth determines the depth of the fully-populated quadtree.  The default is 6.\n"
 		   "tile_size should be a power of two.  The default is 256.\n"
+		   "threads is the number of threads to use.  The default is one per processor.\n"
+		   "-c stores the tiles block-compressed (BC1), ready to upload, instead of as JPEG.\n"
 		);
 }
 
 
-struct tqt_info
+struct tile_job
+// A tile for the thread pool to make.
+{
+	int	m_col;
+
+	// Results: the tile image, and its JPEG (or BC1) data.
+	image::rgb*	m_image;
+	tu_file*	m_encoded;
+};
+
+
+struct tqt_builder
 {
-	tu_file* out;
-	array<Uint32>&	toc;
-	int	tree_depth;
-	int	tile_size;
-
-	tqt_info(tu_file* o, array<Uint32>* tocptr, int d, int ts)
-		: out(o),
-		  toc(*tocptr),
-		  tree_depth(d),
-		  tile_size(ts)
+	tu_file*	m_out;
+	array<Uint32>	m_toc;
+	int	m_tree_depth;
+	int	m_tile_size;
+	bool	m_compress;	// BC1 tiles instead of JPEG
+	tu_thread::pool*	m_pool;
+
+	// Finished tiles whose parents haven't been made yet: at most
+	// two rows per level.  m_pending[level][(row & 1) * (1 << level) + col].
+	array< array<image::rgb*> >	m_pending;
+
+	int	m_tiles_done;
+	int	m_last_percent;
+
+	tqt_builder(tu_file* out, int tree_depth, int tile_size, bool compress, tu_thread::pool* pool)
+		:
+		m_out(out),
+		m_tree_depth(tree_depth),
+		m_tile_size(tile_size),
+		m_compress(compress),
+		m_pool(pool),
+		m_tiles_done(0),
+		m_last_percent(-1)
 	{
+		m_toc.resize(tqt::node_count(tree_depth));
+		for (int i = 0; i < m_toc.size(); i++) {
+			m_toc[i] = 0;
+		}
+
+		m_pending.resize(tree_depth);
+		for (int level = 0; level < tree_depth; level++) {
+			m_pending[level].resize(2 << level);
+			for (int i = 0; i < m_pending[level].size(); i++) {
+				m_pending[level][i] = NULL;
+			}
+		}
+	}
+};
+
+
+static void	encode_tile(tile_job* job, const tqt_builder* b, int quality)
+// Compress the job's image into memory.  quality is for JPEG.
+{
+	job->m_encoded = new tu_file(tu_file::memory_buffer);
+	if (b->m_compress) {
+		image::compressed*	blocks = image::compress_bc1(job->m_image);
+		image::write_compressed(job->m_encoded, blocks);
+		delete blocks;
+	} else {
+		image::write_jpeg(job->m_encoded, job->m_image, quality);
+	}
+}
+
+
+struct source_strip
+// Scanlines [m_top, m_top + height) of the input image.
+{
+	image::rgb*	m_image;
+	int	m_top;
+};
+
+
+static void	advance_strip(source_strip* next, const source_strip& cur, jpeg::input* j_in, int bottom)
+// Fill next with the strip that follows cur and ends at scanline
+// 'bottom': copy the lines the two strips share, and read the rest.
+{
+	image::rgb*	im = next->m_image;
+	int	lines_to_read = imax(0, bottom - (cur.m_top + im->m_height));
+	int	lines_to_keep = im->m_height - lines_to_read;
+	assert(lines_to_keep >= 0);
+
+	next->m_top = cur.m_top + lines_to_read;
+	{for (int i = 0; i < lines_to_keep; i++) {
+		memcpy(image::scanline(im, i), image::scanline(cur.m_image, i + lines_to_read), im->m_width * 3);
+	}}
+	{for (int i = lines_to_keep; i < im->m_height; i++) {
+		j_in->read_scanline(image::scanline(im, i));
+	}}
+}
+
+
+struct leaf_row
+// Argument for make_leaf_tile().
+{
+	const tqt_builder*	m_builder;
+	jpeg::input*	m_input;
+	int	m_row;
+	const source_strip*	m_strip;	// covers this row
+	source_strip*	m_next_strip;	// gets filled in for the next row; NULL on the last row
+	int	m_next_bottom;
+	tile_job*	m_jobs;
+};
+
+
+static float	source_coord(int i, int tile_dim, int size)
+// Where the edge of tile i falls, in an input image dimension.
+{
+	return float(i) / tile_dim * size;
+}
+
+
+static void	make_leaf_tile(void* arg, int index)
+// Task 0 decodes the next strip of the input; the others resample a
+// tile each out of the current strip, and encode it.
+{
+	leaf_row*	r = (leaf_row*) arg;
+
+	if (index == 0) {
+		if (r->m_next_strip) {
+			advance_strip(r->m_next_strip, *r->m_strip, r->m_input, r->m_next_bottom);
+		}
+		return;
 	}
+
+	tile_job*	job = &r->m_jobs[index - 1];
+	int	tile_dim = 1 << (r->m_builder->m_tree_depth - 1);
+	int	tile_size = r->m_builder->m_tile_size;
+	int	width = r->m_input->get_width();
+	int	height = r->m_input->get_height();
+
+	float	x0 = source_coord(job->m_col, tile_dim, width);
+	float	x1 = source_coord(job->m_col + 1, tile_dim, width);
+	float	y0 = source_coord(r->m_row, tile_dim, height);
+	float	y1 = source_coord(r->m_row + 1, tile_dim, height);
+
+	job->m_image = image::create_rgb(tile_size, tile_size);
+	image::resample(job->m_image, 0, 0, tile_size - 1, tile_size - 1,
+			r->m_strip->m_image, x0, y0 - r->m_strip->m_top, x1, y1 - r->m_strip->m_top);
+
+	encode_tile(job, r->m_builder, 90);
+}
+
+
+struct parent_row
+// Argument for make_parent_tile().
+{
+	const tqt_builder*	m_builder;
+	int	m_level;	// of the children
+	tile_job*	m_jobs;
 };
 
 
-image::rgb*	generate_tiles(tqt_info* p, int level, int col, int row);
+static void	make_parent_tile(void* arg, int index)
+// Resample a tile from the images of its four children, and encode
+// it.
+{
+	parent_row*	r = (parent_row*) arg;
+	tile_job*	job = &r->m_jobs[index];
+	int	tile_size = r->m_builder->m_tile_size;
+	const array<image::rgb*>&	children = r->m_builder->m_pending[r->m_level];
+	int	child_cols = 1 << r->m_level;
+
+	// Put the children in one big image.  Neighboring tiles
+	// share their edge pixels, so they overlap by one.
+	image::rgb*	workspace = image::create_rgb(tile_size * 2 - 1, tile_size * 2 - 1);
+	for (int j = 0; j < 2; j++) {
+		for (int i = 0; i < 2; i++) {
+			const image::rgb*	child = children[j * child_cols + job->m_col * 2 + i];
+			assert(child);
+
+			int	ox = i ? tile_size - 1 : 0;
+			int	oy = j ? tile_size - 1 : 0;
+			for (int row = 0; row < tile_size; row++, oy++) {
+				memcpy(image::scanline(workspace, oy) + ox * 3, image::scanline(child, row), tile_size * 3);
+			}
+		}
+	}
+
+	job->m_image = image::create_rgb(tile_size, tile_size);
+	image::resample(job->m_image, 0, 0, tile_size - 1, tile_size - 1,
+			workspace, 0.f, 0.f, float(workspace->m_width - 1), float(workspace->m_height - 1));
+	delete workspace;
+
+	encode_tile(job, r->m_builder, 80);
+}
+
+
+static void	finish_row(tqt_builder* b, int level, int row, tile_job* jobs)
+// The tiles of the given row are made; append their encoded data to
+// the output, and keep their images until their parents are made.  The
+// second row of a pair completes a row of parents, so make those,
+// and so on up the tree.
+{
+	int	cols = 1 << level;
+	for (int col = 0; col < cols; col++) {
+		tile_job*	job = &jobs[col];
+
+		membuf	data;
+		job->m_encoded->set_position(0);
+		job->m_encoded->copy_to(&data);
+		delete job->m_encoded;
+		job->m_encoded = NULL;
+
+		b->m_out->go_to_end();
+		b->m_toc[tqt::node_index(level, col, row)] = b->m_out->get_position();
+		b->m_out->write_bytes(data.data(), data.size());
+
+		image::rgb**	slot = &b->m_pending[level][(row & 1) * cols + col];
+		assert(*slot == NULL);
+		*slot = job->m_image;
+		job->m_image = NULL;
+	}
+
+	b->m_tiles_done += cols;
+	int	percent = b->m_tiles_done * 100 / b->m_toc.size();
+	if (percent != b->m_last_percent) {
+		printf("\b\b\b\b%3d%%", percent);
+		fflush(stdout);
+		b->m_last_percent = percent;
+	}
+
+	if (level == 0) {
+		// That was the root.
+		delete b->m_pending[0][0];
+		b->m_pending[0][0] = NULL;
+		return;
+	}
+	if ((row & 1) == 0) {
+		// Wait for the second row.
+		return;
+	}
+
+	// Make the parents.
+	array<tile_job>	parent_jobs;
+	parent_jobs.resize(cols >> 1);
+	for (int col = 0; col < parent_jobs.size(); col++) {
+		parent_jobs[col].m_col = col;
+		parent_jobs[col].m_image = NULL;
+		parent_jobs[col].m_encoded = NULL;
+	}
+	parent_row	r = { b, level, &parent_jobs[0] };
+	b->m_pool->run(make_parent_tile, &r, parent_jobs.size());
+
+	// Done with the children.
+	for (int i = 0; i < b->m_pending[level].size(); i++) {
+		delete b->m_pending[level][i];
+		b->m_pending[level][i] = NULL;
+	}
+
+	finish_row(b, level - 1, row >> 1, &parent_jobs[0]);
+}
 
 
 #undef main	// @@ Under Win32, SDL wants to put in its own main(), to process args.  We don't need that.
@@ -69,6 +314,8 @@ int	main(int argc, char* argv[])
 	char*	outfile = NULL;
 	int	tree_depth = 6;
 	int	tile_size = 256;
+	int	thread_count = 0;
+	bool	compress = false;
 
 	for ( int arg = 1; arg < argc; arg++ ) {
 		if ( argv[arg][0] == '-' ) {
@@ -101,6 +348,20 @@ int	main(int argc, char* argv[])
 				arg++;
 				tree_depth = atoi(argv[arg]);
 				break;
+			case 'j':
+				// Number of threads.
+				if (arg + 1 >= argc) {
+					printf("error: -j option requires the number of threads\n");
+					print_usage();
+					exit(1);
+				}
+				arg++;
+				thread_count = atoi(argv[arg]);
+				break;
+			case 'c':
+				// BC1 tiles.
+				compress = true;
+				break;
 
 			default:
 				printf("error: unknown command-line switch -%c\n", argv[arg][1]);
@@ -186,107 +447,75 @@ int	main(int argc, char* argv[])
 
 	// Write .tqt header.
 	out->write_bytes("tqt\0", 4);	// filetype tag
-	out->write_le32(1);			// version number.
+	out->write_le32(compress ? 2 : 1);	// version number; 1 means JPEG tiles.
 	out->write_le32(tree_depth);
 	out->write_le32(tile_size);
+	if (compress) {
+		out->write_le32(tqt::BC1_TILES);
+	}
 
-	// Make a null table of contents, and write it to the file.
-	array<Uint32>	toc;
-	toc.resize(tqt::node_count(tree_depth));
-
+	// Write a null table of contents, to fill in at the end.
 	int	toc_start = out->get_position();
-	for (int i = 0; i < toc.size(); i++) {
-		toc[i] = 0;
-		out->write_le32(toc[i]);
+	for (int i = 0; i < tqt::node_count(tree_depth); i++) {
+		out->write_le32(0);
 	}
 
-	int	tile_max_source_height = int(j_in->get_height() / float(tile_dim) + 1);
 
-	// Create a horizontal strip, as wide as the image, and tall
-	// enough to cover a whole tile.
-	image::rgb*	strip = image::create_rgb(j_in->get_width(), tile_max_source_height);
+	tu_thread::pool	pool(thread_count);
+	tqt_builder	builder(out, tree_depth, tile_size, compress, &pool);
 
-	// Initialize the strip by reading the first set of scanlines.
-	int	next_scanline = 0;
-	int	strip_top = 0;
-	while (next_scanline < tile_max_source_height) {
-		j_in->read_scanline(image::scanline(strip, next_scanline));
-		next_scanline++;
-	}
+	// Make a pair of horizontal strips, as wide as the image, and
+	// tall enough to cover a row of tiles.  One holds the input
+	// for the current row of tiles while the other is read.
+	int	tile_max_source_height = imin(int(j_in->get_height() / float(tile_dim) + 1), j_in->get_height());
+	source_strip	strips[2];
+	{for (int i = 0; i < 2; i++) {
+		strips[i].m_image = image::create_rgb(j_in->get_width(), tile_max_source_height);
+		strips[i].m_top = 0;
+	}}
 
-	image::rgb*	tile = image::create_rgb(tile_size, tile_size);
+	// Initialize the first strip by reading the first set of scanlines.
+	{for (int i = 0; i < tile_max_source_height; i++) {
+		j_in->read_scanline(image::scanline(strips[0].m_image, i));
+	}}
 
-	printf("making leaf tiles....     ");
+	printf("making tiles....     ");
 
-	// generate base level tiles.
+	array<tile_job>	jobs;
+	jobs.resize(tile_dim);
 	for (int row = 0; row < tile_dim; row++) {
-		float	y0 = float(row) / tile_dim * j_in->get_height();
-		float	y1 = float(row + 1) / tile_dim * j_in->get_height();
-
-		int	lines_to_read = imin(int(y1), j_in->get_height()) - (strip_top + strip->m_height);
-		if (lines_to_read > 0)
-		{
-			// Copy existing lines up...
-			int	lines_to_keep = strip->m_height - lines_to_read;
-			{for (int i = 0; i < lines_to_keep; i++) {
-				memcpy(image::scanline(strip, i), image::scanline(strip, i + lines_to_read /*keep*/), strip->m_width * 3);
-			}}
-
-			// Read new lines
-			{for (int i = lines_to_keep; i < strip->m_height; i++) {
-				j_in->read_scanline(image::scanline(strip, i));
-			}}
-
-			strip_top += lines_to_read;
-		}
-
 		for (int col = 0; col < tile_dim; col++) {
-			float	x0 = float(col) / tile_dim * j_in->get_width();
-			float	x1 = float(col + 1) / tile_dim * j_in->get_width();
-
-			// Resample from the input strip to the output tile.
-			image::resample(tile, 0, 0, tile_size - 1, tile_size - 1,
-					strip, x0, y0 - strip_top, x1, y1 - strip_top);
-
-			// Update the table of contents with an offset
-			// to the data we're about to write.
-			int	offset = out->get_position();
-			int	quadtree_index = tqt::node_index(tree_depth - 1, col, row);
-			toc[quadtree_index] = offset;
-
-			// Write the jpeg data.
-			image::write_jpeg(out, tile, 90);
-
-			int	percent_done = int(100.f * float(col + row * tile_dim) / (tile_dim * tile_dim));
-			printf("\b\b\b\b\b\b%3d%% %c", percent_done, spinner[(spin_count++)&3]);
+			jobs[col].m_col = col;
+			jobs[col].m_image = NULL;
+			jobs[col].m_encoded = NULL;
 		}
+
+		leaf_row	r;
+		r.m_builder = &builder;
+		r.m_input = j_in;
+		r.m_row = row;
+		r.m_strip = &strips[row & 1];
+		r.m_next_strip = row + 1 < tile_dim ? &strips[(row + 1) & 1] : NULL;
+		r.m_next_bottom = imin(int(source_coord(row + 2, tile_dim, j_in->get_height())), j_in->get_height());
+		r.m_jobs = &jobs[0];
+		pool.run(make_leaf_tile, &r, tile_dim + 1);
+
+		finish_row(&builder, tree_depth - 1, row, &jobs[0]);
 	}
 
+	printf("\n");
 
 	// Done reading the input file.
 	delete j_in;
 	delete in;
 
-	delete strip;
-	delete tile;	// done with the working tile surface.
-
-	printf("\n");
-
-	printf("making interior tiles....");
-
-	// Now generate the upper levels of the tree by resampling the
-	// lower levels.
-	// 
-	// The output file is both input and output at this point.
-	tqt_info	inf(out, &toc, tree_depth, tile_size);
-	image::rgb*	root_tile = generate_tiles(&inf, 0, 0, 0);
-
-	delete root_tile;	// dispose of root tile.
+	delete strips[0].m_image;
+	delete strips[1].m_image;
 
 	// Write the TOC back into the head of the file.
 	out->set_position(toc_start);
-	{for (int i = 0; i < toc.size(); i++) {
-		out->write_le32(toc[i]);
+	{for (int i = 0; i < builder.m_toc.size(); i++) {
+		out->write_le32(builder.m_toc[i]);
 	}}
 
 	delete out;
@@ -295,87 +524,6 @@ int	main(int argc, char* argv[])
 }
 
 
-image::rgb*	generate_tiles(tqt_info* p, int level, int col, int row)
-// (Recursively) generate quadtree tiles by resampling child tiles.
-// Returns the tile for the specified node.  As tiles are generated,
-// write offsets into the table of contents.
-{
-	int	qindex = tqt::node_index(level, col, row);
-	int	offset = p->toc[qindex];
-	if (offset) {
-		// Tile already built.  Read it from the file.
-		p->out->set_position(offset);
-		image::rgb*	tile = image::read_jpeg(p->out);
-		return tile;
-	}
-
-	if (level >= p->tree_depth - 1) {
-		// We're at the bottom of the tree.  Don't recurse.
-		assert(0);	// should not happen, if we generated tiles for all leaf nodes.
-		throw "bug";
-	}
-
-	// Make a workspace to temporarily hold child tile data in one big image.
-	image::rgb*	workspace = image::create_rgb(p->tile_size * 2 - 1, p->tile_size * 2 - 1);
-
-	// Resample the four child tiles to make this tile.
-	image::rgb*	tile = image::create_rgb(p->tile_size, p->tile_size);
-
-	for (int j = 0; j < 2; j++) {
-		for (int i = 0; i < 2; i++) {
-			int	ccol = col * 2 + i;
-			int	crow = row * 2 + j;
-			image::rgb*	child_tile = generate_tiles(p, level + 1, ccol, crow);
-
-#if 0
-			int	half_tile = p->tile_size >> 1;
-			int	ox = i ? half_tile - 1 : 0;
-			int	oy = j ? half_tile - 1 : 0;
-			float	shave = 0.5f * float(p->tile_size - 1) / float(p->tile_size - 2);
-			float	ix = i ? shave : 0;
-			float	iy = j ? shave : 0;
-			image::resample(tile, ox, oy, ox + half_tile - 1, oy + half_tile - 1,
-					child_tile,
-					ix, iy,
-					ix + float(p->tile_size) - shave, iy + float(p->tile_size) - shave);
-#else
-			// Copy image data into workspace.
-			{
-				int	ox = i ? p->tile_size - 1 : 0;
-				int	oy = j ? p->tile_size - 1 : 0;
-				for (int row = 0; row < p->tile_size; row++, oy++) {
-					memcpy(image::scanline(workspace, oy) + ox * 3, image::scanline(child_tile, row), p->tile_size * 3);
-				}
-			}
-#endif // 0
-
-			delete child_tile;
-		}
-	}
-
-	// Resample from the workspace into the output tile.
-	image::resample(tile, 0, 0, p->tile_size - 1, p->tile_size - 1,
-			workspace, 0.f, 0.f, float(workspace->m_width - 1), float(workspace->m_height - 1));
-
-	delete workspace;
-
-	// Write out the generated tile.
-	{
-		p->out->go_to_end();
-		int	offset = p->out->get_position();
-		
-		// Update table of contents.
-		p->toc[qindex] = offset;
-		
-		image::write_jpeg(p->out, tile, 80);
-	}
-
-	printf("\b%c", spinner[(spin_count++)&3]);
-
-	return tile;	// return to caller, so it can use it.
-}
-
-
 // Local Variables:
 // mode: C++
 // c-basic-offset: 8 
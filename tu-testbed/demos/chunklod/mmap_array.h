@@ -13,16 +13,27 @@
 #define MMAP_ARRAY_H
 
 
-#include "mmap_util.h"
+#include "base/mmap_util.h"
 
 
 template<class data_type>
 class mmap_array {
 // Use this class for dealing with huge 2D arrays.
+//
+// The elements are stored in square tiles, so the neighborhood of an
+// element is in a few pages, whichever direction you're scanning in.
+// That's the layout in the file, too, if you give a filename.
 public:
+	enum {
+		TILE_SHIFT = 6,
+		TILE_SIZE = 1 << TILE_SHIFT,
+		TILE_MASK = TILE_SIZE - 1
+	};
+
 	mmap_array(int width, int height, bool writeable, const char* filename = NULL) :
 		m_width(width),
 		m_height(height),
+		m_tiles_across((width + TILE_MASK) >> TILE_SHIFT),
 		m_writeable(writeable)
 	{
 		m_data = mmap_util::map(total_bytes(), m_writeable, filename);
@@ -51,18 +62,24 @@ public:
 		assert(x >= 0 && x < m_width);
 		assert(z >= 0 && z < m_height);
 
-		// @@ could do clever indexing here, for better paging locality...
+		int	tile = (x >> TILE_SHIFT) + (z >> TILE_SHIFT) * m_tiles_across;
+		int	index = (tile << (TILE_SHIFT * 2)) + ((z & TILE_MASK) << TILE_SHIFT) + (x & TILE_MASK);
 
-		return ((data_type*) m_data)[x + z * m_width];
+		return ((data_type*) m_data)[index];
 	}
 
 private:
 
-	int	total_bytes() { return m_height * m_width * sizeof(data_type); }
+	int	total_bytes()
+	{
+		int	tiles_down = (m_height + TILE_MASK) >> TILE_SHIFT;
+		return m_tiles_across * tiles_down * TILE_SIZE * TILE_SIZE * sizeof(data_type);
+	}
 
 	void*	m_data;
 	int	m_width;
 	int	m_height;
+	int	m_tiles_across;
 	bool	m_writeable;
 };
 
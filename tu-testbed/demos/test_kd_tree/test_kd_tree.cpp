@@ -11,6 +11,8 @@
 #include "geometry/axial_box.h"
 #include "base/tu_file.h"
 #include "base/tu_timer.h"
+#include "base/tu_random.h"
+#include "base/tu_thread.h"
 
 
 void	print_usage()
@@ -26,14 +28,27 @@ void	print_usage()
 		"  -y    dump mesh diagram projected along y axis, in PostScript format\n"
 		"  -z    dump mesh diagram projected along z axis, in PostScript format\n"
 		"  -r    shoot random rays at the model and print timings\n"
-		"  -c <file>  shoot recorded rays from a corpus, and print timings\n"
+		"  -c <file>  shoot recorded rays from a corpus, singly and in packets,\n"
+		"        and print timings\n"
+		"  -b    compare tree builders: build time, and ray casting speed with the\n"
+		"        recorded rays (if -c is given) or random rays\n"
+		"  -s    sweep capsules and spheres through the mesh, singly and batched\n"
+		"        on thread pools, and check the results against every face\n"
+		"  -m <basename>  write the packed trees to <basename>N.kdp, load them\n"
+		"        back with map() and read(), and compare ray results\n"
 		);
 }
 
 
+static void	read_mesh(array<vec3>* verts, array<int>* indices, const char* filename);
 static void	make_kd_trees(array<kd_tree_dynamic*>* treelist, const char* filename);
+static void	compare_builders(const char* filename, const char* recorded_rays_file);
+static void	read_rays(array<vec3>* rays, const char* filename);
 static void	test_cast_against_tree(const array<kd_tree_dynamic*>& treelist);
 static void	test_cast_recorded_rays(const array<kd_tree_dynamic*>& treelist, const char* recorded_rays_file);
+static void	test_cast_packets(const array<kd_tree_packed*>& kds, const array<vec3>& rays);
+static void	test_map_trees(const array<kd_tree_dynamic*>& treelist, const char* basename);
+static void	test_sweep_spheres(const array<kd_tree_dynamic*>& treelist, const char* filename);
 
 
 int main(int argc, const char** argv)
@@ -43,8 +58,11 @@ int main(int argc, const char** argv)
 	bool	do_ray_test = false;
 	bool	do_mesh_dump = false;
 	bool	do_recorded_rays = false;
+	bool	do_compare_builders = false;
+	bool	do_sweep_test = false;
 	int	mesh_axis = 0;
 	const char*	recorded_rays_file = NULL;
+	const char*	map_basename = NULL;
 
 	// Parse args.
 	for (int arg = 1; arg < argc; arg++)
@@ -77,6 +95,13 @@ int main(int argc, const char** argv)
 				do_mesh_dump = false;
 				break;
 
+			case 'b':
+				do_dump = false;
+				do_ray_test = false;
+				do_mesh_dump = false;
+				do_compare_builders = true;
+				break;
+
 			case 'c':
 				do_dump = false;
 				// Grab recorded rays filename.
@@ -94,6 +119,27 @@ int main(int argc, const char** argv)
 				}
 				break;
 
+			case 's':
+				do_dump = false;
+				do_sweep_test = true;
+				break;
+
+			case 'm':
+				do_dump = false;
+				// Grab basename for the packed files.
+				arg++;
+				if (arg < argc)
+				{
+					map_basename = argv[arg];
+				}
+				else
+				{
+					printf("-m option needs a basename\n");
+					print_usage();
+					exit(1);
+				}
+				break;
+
 			case 'x':
 				do_dump = false;
 				do_ray_test = false;
@@ -136,6 +182,12 @@ int main(int argc, const char** argv)
 		exit(1);
 	}
 
+	if (do_compare_builders)
+	{
+		compare_builders(infile, do_recorded_rays ? recorded_rays_file : NULL);
+		return 0;
+	}
+
 	uint64	start_ticks = tu_timer::get_profile_ticks();
 	array<kd_tree_dynamic*>	treelist;
 	{
@@ -151,12 +203,14 @@ int main(int argc, const char** argv)
 
 	if (do_dump && treelist.size())
 	{
-		treelist[0]->diagram_dump(&tu_file(stdout, false));
+		tu_file	out(stdout, false);
+		treelist[0]->diagram_dump(&out);
 	}
 
 	if (do_mesh_dump && treelist.size())
 	{
-		treelist[0]->mesh_diagram_dump(&tu_file(stdout, false), mesh_axis);
+		tu_file	out(stdout, false);
+		treelist[0]->mesh_diagram_dump(&out, mesh_axis);
 	}
 
 	if (do_ray_test && treelist.size())
@@ -169,6 +223,16 @@ int main(int argc, const char** argv)
 		test_cast_recorded_rays(treelist, recorded_rays_file);
 	}
 
+	if (do_sweep_test && treelist.size())
+	{
+		test_sweep_spheres(treelist, infile);
+	}
+
+	if (map_basename && treelist.size())
+	{
+		test_map_trees(treelist, map_basename);
+	}
+
 	// Clean up.
 	{for (int i = 0; i < treelist.size(); i++)
 	{
@@ -180,7 +244,19 @@ int main(int argc, const char** argv)
 
 
 void	make_kd_trees(array<kd_tree_dynamic*>* treelist, const char* filename)
-// Build a list of kd-trees from the specified text file.  Format is:
+// Build a list of kd-trees from the specified text file.
+{
+	array<vec3>	verts;
+	array<int>	indices;
+	read_mesh(&verts, &indices, filename);
+
+	// Make the kd-trees.
+	kd_tree_dynamic::build_trees(treelist, verts.size(), &verts[0], indices.size() / 3, &indices[0]);
+}
+
+
+void	read_mesh(array<vec3>* verts, array<int>* indices, const char* filename)
+// Read a mesh from the specified text file.  Format is:
 //
 // tridata
 // verts: 1136
@@ -193,9 +269,6 @@ void	make_kd_trees(array<kd_tree_dynamic*>* treelist, const char* filename)
 // Faces are 3 vertex indices, a surface type int, and a face-flags
 // int.
 {
-	array<vec3>	verts;
-	array<int>	indices;
-
 	FILE*	in = fopen(filename, "r");
 	if (in == NULL)
 	{
@@ -242,7 +315,7 @@ void	make_kd_trees(array<kd_tree_dynamic*>* treelist, const char* filename)
 			printf("error reading vert at vertex index %d\n", i);
 		}
 		
-		verts.push_back(v);
+		verts->push_back(v);
 	}
 
 	// Read triangles.
@@ -264,18 +337,15 @@ void	make_kd_trees(array<kd_tree_dynamic*>* treelist, const char* filename)
 				   i, vi0, vi1, vi2);
 		}
 
-		indices.push_back(vi0);
-		indices.push_back(vi1);
-		indices.push_back(vi2);
+		indices->push_back(vi0);
+		indices->push_back(vi1);
+		indices->push_back(vi2);
 	}}
 
-	assert(indices.size() == tri_count * 3);
+	assert(indices->size() == tri_count * 3);
 
 	// Done.
 	fclose(in);
-
-	// Make the kd-trees.
-	kd_tree_dynamic::build_trees(treelist, vert_count, &verts[0], tri_count, &indices[0]);
 }
 
 
@@ -387,59 +457,61 @@ void	test_cast_against_tree(const array<kd_tree_dynamic*>& treelist)
 }
 
 
-void	test_cast_recorded_rays(const array<kd_tree_dynamic*>& treelist, const char* filename)
-// Shoot the rays from the given filename against the kdtrees.
+void	read_rays(array<vec3>* rays, const char* filename)
+// Read recorded rays from the given file, as {start,end} pairs.
 {
-	assert(treelist.size() > 0);
-	assert(recorded_rays_file);
-
-	//
-	// read rays
-	//
-
-	array<vec3>	rays;	// {start,end} pairs
 	printf("parsing ray list from '%s'\n", filename);
+	uint64	start_read_rays = tu_timer::get_profile_ticks();
+
+	FILE*	in = fopen(filename, "r");
+	if (in == NULL)
 	{
-		uint64	start_read_rays = tu_timer::get_profile_ticks();
+		printf("can't open '%s'\n", filename);
+		return;
+	}
+
+	static const int LINE_MAX = 1000;
+	char line[LINE_MAX];
 
-		FILE*	in = fopen(filename, "r");
-		if (in == NULL)
+	while (feof(in) == 0)
+	{
+		fgets(line, LINE_MAX, in);
+		vec3	start, end;
+		int	read_elements = sscanf(
+			line, "(%f %f %f) (%f %f %f)",
+			&start.x, &start.y, &start.z,
+			&end.x, &end.y, &end.z);
+		if (read_elements != 6)
 		{
-			printf("can't open '%s'\n", filename);
-			return;
+			printf("error reading line '%s'\n", line);
 		}
-
-		static const int LINE_MAX = 1000;
-		char line[LINE_MAX];
-
-		while (feof(in) == 0)
+		else if ((start - end).sqrmag() >= 1e-3f)
 		{
-			fgets(line, LINE_MAX, in);
-			vec3	start, end;
-			int	read_elements = sscanf(
-				line, "(%f %f %f) (%f %f %f)",
-				&start.x, &start.y, &start.z,
-				&end.x, &end.y, &end.z);
-			if (read_elements != 6)
-			{
-				printf("error reading line '%s'\n");
-			}
-			else if ((start - end).sqrmag() >= 1e-3f)
-			{
-				// Apparently good data.
-				rays.push_back(start);
-				rays.push_back(end);
-			}
-			// else ray too short!
+			// Apparently good data.
+			rays->push_back(start);
+			rays->push_back(end);
 		}
-		assert((rays.size() % 2) == 0);
+		// else ray too short!
+	}
+	fclose(in);
+	assert((rays->size() % 2) == 0);
 
-		uint64	end_read_rays = tu_timer::get_profile_ticks();
+	uint64	end_read_rays = tu_timer::get_profile_ticks();
 
-		printf("read %d rays in %3.3f seconds\n",
-		       rays.size() / 2,
-		       tu_timer::profile_ticks_to_seconds(end_read_rays - start_read_rays));
-	}
+	printf("read %d rays in %3.3f seconds\n",
+	       rays->size() / 2,
+	       tu_timer::profile_ticks_to_seconds(end_read_rays - start_read_rays));
+}
+
+
+void	test_cast_recorded_rays(const array<kd_tree_dynamic*>& treelist, const char* filename)
+// Shoot the rays from the given filename against the kdtrees.
+{
+	assert(treelist.size() > 0);
+	assert(filename);
+
+	array<vec3>	rays;	// {start,end} pairs
+	read_rays(&rays, filename);
 
 	if (rays.size() < 2)
 	{
@@ -507,9 +579,541 @@ void	test_cast_recorded_rays(const array<kd_tree_dynamic*>& treelist, const char
 	int	ray_count = rays.size() / 2;
 
 	print_ray_stats(start_cast_ticks, end_ticks, ray_count, hit_count);
+
+	test_cast_packets(kds, rays);
+}
+
+
+static void	reset_ray_stats()
+{
+	kd_tree_packed::s_ray_test_node_count = 0;
+	kd_tree_packed::s_ray_test_leaf_count = 0;
+	kd_tree_packed::s_ray_test_face_count = 0;
+}
+
+
+void	test_cast_packets(const array<kd_tree_packed*>& kds, const array<vec3>& rays)
+// Cast the rays singly and in packets, for both any-hit and
+// closest-hit queries, and compare timings and results.
+{
+	array<ray_query>	queries;
+	for (int i = 0, n = rays.size(); i < n; i += 2)
+	{
+		queries.push_back(ray_query(ray_query::start_end, rays[i], rays[i + 1]));
+	}
+	int	ray_count = queries.size();
+
+	array<bool>	single_results;
+	array<bool>	packet_results;
+	single_results.resize(ray_count);
+	packet_results.resize(ray_count);
+
+	array<ray_hit>	single_hits;
+	array<ray_hit>	packet_hits;
+	single_hits.resize(ray_count);
+	packet_hits.resize(ray_count);
+
+	// any hit, single rays
+	printf("\nany hit, single rays:\n");
+	reset_ray_stats();
+	uint64	start_ticks = tu_timer::get_profile_ticks();
+	int	hit_count = 0;
+	for (int i = 0; i < ray_count; i++)
+	{
+		single_results[i] = false;
+		for (int ti = 0, tn = kds.size(); ti < tn; ti++)
+		{
+			if (kds[ti]->ray_test(queries[i]))
+			{
+				single_results[i] = true;
+				hit_count++;
+				break;
+			}
+		}
+	}
+	print_ray_stats(start_ticks, tu_timer::get_profile_ticks(), ray_count, hit_count);
+
+	// any hit, packets
+	printf("\nany hit, packets of %d:\n", int(kd_tree_packed::RAY_PACKET_SIZE));
+	reset_ray_stats();
+	start_ticks = tu_timer::get_profile_ticks();
+	{for (int i = 0; i < ray_count; i++)
+	{
+		packet_results[i] = false;
+	}}
+	{for (int ti = 0, tn = kds.size(); ti < tn; ti++)
+	{
+		kds[ti]->ray_test_packet(ray_count, &queries[0], &packet_results[0]);
+	}}
+	uint64	end_ticks = tu_timer::get_profile_ticks();
+	hit_count = 0;
+	int	mismatch_count = 0;
+	{for (int i = 0; i < ray_count; i++)
+	{
+		if (packet_results[i]) hit_count++;
+		if (packet_results[i] != single_results[i]) mismatch_count++;
+	}}
+	print_ray_stats(start_ticks, end_ticks, ray_count, hit_count);
+	printf("%d results differ from single rays\n", mismatch_count);
+
+	// closest hit, single rays
+	printf("\nclosest hit, single rays:\n");
+	reset_ray_stats();
+	start_ticks = tu_timer::get_profile_ticks();
+	{for (int i = 0; i < ray_count; i++)
+	{
+		single_hits[i] = ray_hit();
+		for (int ti = 0, tn = kds.size(); ti < tn; ti++)
+		{
+			kds[ti]->ray_closest_hit(queries[i], &single_hits[i]);
+		}
+	}}
+	end_ticks = tu_timer::get_profile_ticks();
+	hit_count = 0;
+	{for (int i = 0; i < ray_count; i++)
+	{
+		if (single_hits[i].m_face_index >= 0) hit_count++;
+	}}
+	print_ray_stats(start_ticks, end_ticks, ray_count, hit_count);
+
+	// closest hit, packets
+	printf("\nclosest hit, packets of %d:\n", int(kd_tree_packed::RAY_PACKET_SIZE));
+	reset_ray_stats();
+	start_ticks = tu_timer::get_profile_ticks();
+	{for (int i = 0; i < ray_count; i++)
+	{
+		packet_hits[i] = ray_hit();
+	}}
+	{for (int ti = 0, tn = kds.size(); ti < tn; ti++)
+	{
+		kds[ti]->ray_closest_hit_packet(ray_count, &queries[0], &packet_hits[0]);
+	}}
+	end_ticks = tu_timer::get_profile_ticks();
+	hit_count = 0;
+	mismatch_count = 0;
+	{for (int i = 0; i < ray_count; i++)
+	{
+		if (packet_hits[i].m_face_index >= 0) hit_count++;
+		// (Compare t, not the face; a ray through an edge can
+		// legitimately report either face.)
+		if ((packet_hits[i].m_face_index >= 0) != (single_hits[i].m_face_index >= 0)
+		    || fabsf(packet_hits[i].m_t - single_hits[i].m_t) > 1e-5f)
+		{
+			mismatch_count++;
+		}
+	}}
+	print_ray_stats(start_ticks, end_ticks, ray_count, hit_count);
+	printf("%d results differ from single rays\n", mismatch_count);
+}
+
+
+static void	count_nodes(const kd_tree_dynamic::node* n, int* nodes, int* leaves)
+{
+	if (n == NULL) return;
+	if (n->m_leaf)
+	{
+		(*leaves)++;
+	}
+	else
+	{
+		(*nodes)++;
+		count_nodes(n->m_neg, nodes, leaves);
+		count_nodes(n->m_pos, nodes, leaves);
+	}
+}
+
+
+void	compare_builders(const char* filename, const char* recorded_rays_file)
+// Build the mesh's trees with each builder, and print the build
+// times next to how fast the resulting trees cast rays.
+{
+	array<vec3>	verts;
+	array<int>	indices;
+	read_mesh(&verts, &indices, filename);
+	if (verts.size() == 0 || indices.size() == 0)
+	{
+		return;
+	}
+
+	array<vec3>	rays;
+	if (recorded_rays_file)
+	{
+		read_rays(&rays, recorded_rays_file);
+	}
+	else
+	{
+		// Random rays between points within the mesh bound.
+		axial_box	bound(axial_box::INVALID, vec3::flt_max, vec3::minus_flt_max);
+		for (int i = 0; i < verts.size(); i++)
+		{
+			bound.set_enclosing(verts[i]);
+		}
+		tu_random::seed_random(12345);
+		for (int i = 0; i < 100000; i++)
+		{
+			vec3	start = bound.get_random_point();
+			vec3	end = bound.get_random_point();
+			while ((start - end).sqrmag() < 1e-3f)
+			{
+				end = bound.get_random_point();
+			}
+			rays.push_back(start);
+			rays.push_back(end);
+		}
+	}
+	if (rays.size() < 2)
+	{
+		printf("no rays!\n");
+		return;
+	}
+
+	array<ray_query>	queries;
+	for (int i = 0, n = rays.size(); i < n; i += 2)
+	{
+		queries.push_back(ray_query(ray_query::start_end, rays[i], rays[i + 1]));
+	}
+	int	ray_count = queries.size();
+	array<ray_hit>	hits;
+	hits.resize(ray_count);
+
+	struct builder
+	{
+		const char*	m_name;
+		kd_tree_dynamic::build_options::method	m_method;
+		int	m_thread_count;
+	};
+	builder	builders[] =
+	{
+		{ "candidate planes", kd_tree_dynamic::build_options::CANDIDATE_PLANES, 1 },
+		{ "binned SAH, 1 thread", kd_tree_dynamic::build_options::BINNED_SAH, 1 },
+		{ "binned SAH, all cores", kd_tree_dynamic::build_options::BINNED_SAH, 0 },
+	};
+
+	// Ray timings are the best of several passes, since a single
+	// pass is at the mercy of whatever else the machine is doing.
+	static const int	PASS_COUNT = 5;
+
+	printf("\n%d triangles, %d rays, %d processors, best of %d passes\n\n",
+	       indices.size() / 3, ray_count, tu_thread::get_processor_count(), PASS_COUNT);
+	printf("builder                 build secs    nodes   leaves     hits  nodes/ray  faces/ray  any-hit Krays/s  closest-hit Krays/s\n");
+
+	for (int bi = 0; bi < int(sizeof(builders) / sizeof(builders[0])); bi++)
+	{
+		kd_tree_dynamic::build_options	options;
+		options.m_method = builders[bi].m_method;
+		options.m_thread_count = builders[bi].m_thread_count;
+
+		array<kd_tree_dynamic*>	treelist;
+		uint64	start_ticks = tu_timer::get_profile_ticks();
+		kd_tree_dynamic::build_trees(&treelist, verts.size(), &verts[0], indices.size() / 3, &indices[0], options);
+		double	build_seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+
+		int	nodes = 0, leaves = 0;
+		array<kd_tree_packed*>	kds;
+		for (int i = 0; i < treelist.size(); i++)
+		{
+			count_nodes(treelist[i]->get_root(), &nodes, &leaves);
+			kds.push_back(kd_tree_packed::build(treelist[i]));
+		}
+
+		// any hit, single rays
+		double	any_hit_seconds = 0;
+		int	node_tests = 0, face_tests = 0;
+		for (int pass = 0; pass < PASS_COUNT; pass++)
+		{
+			kd_tree_packed::s_ray_test_node_count = 0;
+			kd_tree_packed::s_ray_test_face_count = 0;
+			start_ticks = tu_timer::get_profile_ticks();
+			for (int i = 0; i < ray_count; i++)
+			{
+				for (int ti = 0, tn = kds.size(); ti < tn; ti++)
+				{
+					if (kds[ti]->ray_test(queries[i]))
+					{
+						break;
+					}
+				}
+			}
+			double	seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+			if (pass == 0 || seconds < any_hit_seconds)
+			{
+				any_hit_seconds = seconds;
+			}
+			node_tests = kd_tree_packed::s_ray_test_node_count;
+			face_tests = kd_tree_packed::s_ray_test_face_count;
+		}
+
+		// closest hit, packets
+		double	closest_hit_seconds = 0;
+		for (int pass = 0; pass < PASS_COUNT; pass++)
+		{
+			{for (int i = 0; i < ray_count; i++)
+			{
+				hits[i] = ray_hit();
+			}}
+			start_ticks = tu_timer::get_profile_ticks();
+			{for (int ti = 0, tn = kds.size(); ti < tn; ti++)
+			{
+				kds[ti]->ray_closest_hit_packet(ray_count, &queries[0], &hits[0]);
+			}}
+			double	seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+			if (pass == 0 || seconds < closest_hit_seconds)
+			{
+				closest_hit_seconds = seconds;
+			}
+		}
+
+		// Every builder should give the same hits.
+		int	hit_count = 0;
+		{for (int i = 0; i < ray_count; i++)
+		{
+			if (hits[i].m_face_index >= 0) hit_count++;
+		}}
+
+		printf("%-22s  %10.3f  %7d  %7d  %7d  %9.2f  %9.2f  %15.1f  %19.1f\n",
+		       builders[bi].m_name,
+		       build_seconds,
+		       nodes,
+		       leaves,
+		       hit_count,
+		       node_tests / double(ray_count),
+		       face_tests / double(ray_count),
+		       ray_count / fmax(any_hit_seconds, 1e-9) / 1000,
+		       ray_count / fmax(closest_hit_seconds, 1e-9) / 1000);
+
+		{for (int i = 0; i < treelist.size(); i++)
+		{
+			delete kds[i];
+			delete treelist[i];
+		}}
+	}
 }
 
 
+void	test_map_trees(const array<kd_tree_dynamic*>& treelist, const char* basename)
+// Write packed trees to files, load them back with map() and read(),
+// and check that they give the same ray results as the originals.
+{
+	assert(treelist.size() > 0);
+
+	array<kd_tree_packed*>	kds;
+	array<tu_string>	paths;
+	axial_box	bound(axial_box::INVALID, vec3::flt_max, vec3::minus_flt_max);
+	for (int i = 0; i < treelist.size(); i++)
+	{
+		kd_tree_packed*	kd = kd_tree_packed::build(treelist[i]);
+		kds.push_back(kd);
+		bound.set_enclosing(kd->get_bound());
+
+		char	path[1000];
+		snprintf(path, sizeof(path), "%s%d.kdp", basename, i);
+		paths.push_back(path);
+
+		tu_file	out(path, "wb");
+		if (out.get_error())
+		{
+			printf("can't open %s for output\n", path);
+			return;
+		}
+		kd->write(&out);
+	}
+
+	uint64	start_ticks = tu_timer::get_profile_ticks();
+	array<kd_tree_packed*>	mapped;
+	{for (int i = 0; i < paths.size(); i++)
+	{
+		kd_tree_packed*	kd = kd_tree_packed::map(paths[i].c_str());
+		if (kd == NULL)
+		{
+			printf("can't map %s\n", paths[i].c_str());
+			return;
+		}
+		mapped.push_back(kd);
+	}}
+	uint64	mapped_ticks = tu_timer::get_profile_ticks();
+
+	array<kd_tree_packed*>	loaded;
+	{for (int i = 0; i < paths.size(); i++)
+	{
+		tu_file	in(paths[i].c_str(), "rb");
+		kd_tree_packed*	kd = kd_tree_packed::read(&in);
+		if (kd == NULL)
+		{
+			printf("can't read %s\n", paths[i].c_str());
+			return;
+		}
+		loaded.push_back(kd);
+	}}
+	uint64	loaded_ticks = tu_timer::get_profile_ticks();
+
+	printf("%d trees: map() took %3.6f seconds, read() took %3.6f seconds\n",
+	       paths.size(),
+	       tu_timer::profile_ticks_to_seconds(mapped_ticks - start_ticks),
+	       tu_timer::profile_ticks_to_seconds(loaded_ticks - mapped_ticks));
+
+	// Compare closest hits.
+	static const int	RAY_COUNT = 100000;
+	int	hit_count = 0;
+	int	mismatch_count = 0;
+	for (int i = 0; i < RAY_COUNT; i++)
+	{
+		vec3	start = bound.get_random_point();
+		vec3	end = bound.get_random_point();
+		while ((start - end).sqrmag() < 1e-3f)
+		{
+			end = bound.get_random_point();
+		}
+		ray_query	ray(ray_query::start_end, start, end);
+
+		ray_hit	hit, mapped_hit, loaded_hit;
+		for (int ti = 0; ti < kds.size(); ti++)
+		{
+			kds[ti]->ray_closest_hit(ray, &hit);
+			mapped[ti]->ray_closest_hit(ray, &mapped_hit);
+			loaded[ti]->ray_closest_hit(ray, &loaded_hit);
+		}
+		if (hit.m_face_index >= 0)
+		{
+			hit_count++;
+		}
+		if (hit.m_face_index != mapped_hit.m_face_index || hit.m_t != mapped_hit.m_t
+		    || hit.m_face_index != loaded_hit.m_face_index || hit.m_t != loaded_hit.m_t)
+		{
+			mismatch_count++;
+		}
+	}
+	printf("%d rays, %d hits, %d results differ from the original trees\n", RAY_COUNT, hit_count, mismatch_count);
+
+	{for (int i = 0; i < kds.size(); i++)
+	{
+		delete kds[i];
+		delete mapped[i];
+		delete loaded[i];
+	}}
+}
+
+static bool	same_hit(const lss_hit& a, const lss_hit& b)
+{
+	if ((a.m_face_index >= 0) != (b.m_face_index >= 0))
+	{
+		return false;
+	}
+	return fabsf(a.m_t - b.m_t) <= 1e-4f && fabsf(a.m_depth - b.m_depth) <= 1e-4f;
+}
+
+
+void	test_sweep_spheres(const array<kd_tree_dynamic*>& treelist, const char* filename)
+// Sweep spheres through the mesh, the way character controllers
+// would: one at a time, and batched on thread pools.  Checks the
+// tree results against testing every face.
+{
+	assert(treelist.size() > 0);
+
+	array<vec3>	verts;
+	array<int>	indices;
+	read_mesh(&verts, &indices, filename);
+
+	array<kd_tree_packed*>	kds;
+	axial_box	bound(axial_box::INVALID, vec3::flt_max, vec3::minus_flt_max);
+	for (int i = 0; i < treelist.size(); i++)
+	{
+		kds.push_back(kd_tree_packed::build(treelist[i]));
+		bound.set_enclosing(kds.back()->get_bound());
+	}
+
+	// Agent-sized capsules making frame-sized moves.
+	static const int	QUERY_COUNT = 20000;
+	float	size = (bound.get_max() - bound.get_min()).magnitude();
+	axial_box	move_box(vec3(-1, -1, -1) * (size * 0.02f), vec3(1, 1, 1) * (size * 0.02f));
+	tu_random::seed_random(54321);
+	array<lss_query>	queries;
+	array<lss_query>	spheres;
+	for (int i = 0; i < QUERY_COUNT; i++)
+	{
+		vec3	start = bound.get_random_point();
+		vec3	end = start + move_box.get_random_point();
+		float	radius = size * 0.002f * (1 + (i % 4));
+		queries.push_back(lss_query(start, end, radius));
+		spheres.push_back(lss_query(start, radius * 4));
+	}
+
+	array<lss_hit>	hits;
+	hits.resize(QUERY_COUNT);
+
+	// One at a time.
+	uint64	start_ticks = tu_timer::get_profile_ticks();
+	int	hit_count = 0;
+	for (int i = 0; i < QUERY_COUNT; i++)
+	{
+		hits[i] = lss_hit();
+		for (int ti = 0; ti < kds.size(); ti++)
+		{
+			kds[ti]->lss_closest_hit(queries[i], &hits[i]);
+		}
+		if (hits[i].m_face_index >= 0) hit_count++;
+	}
+	double	single_seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+	printf("%d capsule sweeps, %d hit: %3.1f Kqueries/s on one thread\n",
+	       QUERY_COUNT, hit_count, QUERY_COUNT / single_seconds / 1000);
+
+	// Batched.
+	int	thread_counts[] = { 1, 4, 0 };
+	for (int pi = 0; pi < int(sizeof(thread_counts) / sizeof(thread_counts[0])); pi++)
+	{
+		tu_thread::pool	pool(thread_counts[pi]);
+		array<lss_hit>	batch_hits;
+		batch_hits.resize(QUERY_COUNT);
+
+		start_ticks = tu_timer::get_profile_ticks();
+		kd_tree_packed::lss_closest_hit_batch(&pool, kds.size(), &kds[0], QUERY_COUNT, &queries[0], &batch_hits[0]);
+		double	seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+
+		int	mismatch_count = 0;
+		for (int i = 0; i < QUERY_COUNT; i++)
+		{
+			if (batch_hits[i].m_face_index != hits[i].m_face_index || batch_hits[i].m_t != hits[i].m_t)
+			{
+				mismatch_count++;
+			}
+		}
+		printf("batched on %2d threads: %3.1f Kqueries/s, %d results differ\n",
+		       pool.get_thread_count(), QUERY_COUNT / seconds / 1000, mismatch_count);
+	}
+
+	// Check against every face, for some of the queries.
+	static const int	CHECK_COUNT = 300;
+	int	sweep_mismatch_count = 0;
+	int	sphere_mismatch_count = 0;
+	int	sphere_hit_count = 0;
+	for (int i = 0; i < CHECK_COUNT; i++)
+	{
+		lss_hit	brute, brute_sphere, sphere;
+		for (int fi = 0; fi < indices.size() / 3; fi++)
+		{
+			const vec3&	v0 = verts[indices[fi * 3 + 0]];
+			const vec3&	v1 = verts[indices[fi * 3 + 1]];
+			const vec3&	v2 = verts[indices[fi * 3 + 2]];
+			if (lss_hit_triangle(queries[i], v0, v1, v2, &brute)) brute.m_face_index = fi;
+			if (lss_hit_triangle(spheres[i], v0, v1, v2, &brute_sphere)) brute_sphere.m_face_index = fi;
+		}
+		for (int ti = 0; ti < kds.size(); ti++)
+		{
+			kds[ti]->lss_closest_hit(spheres[i], &sphere);
+		}
+
+		if (same_hit(brute, hits[i]) == false) sweep_mismatch_count++;
+		if (same_hit(brute_sphere, sphere) == false) sphere_mismatch_count++;
+		if (sphere.m_face_index >= 0) sphere_hit_count++;
+	}
+	printf("checked %d sweeps and %d spheres (%d overlapping) against all faces: %d and %d differ\n",
+	       CHECK_COUNT, CHECK_COUNT, sphere_hit_count, sweep_mismatch_count, sphere_mismatch_count);
+
+	{for (int i = 0; i < kds.size(); i++)
+	{
+		delete kds[i];
+	}}
+}
+
 // Local Variables:
 // mode: C++
 // c-basic-offset: 8 
@@ -29,7 +29,7 @@ class render_handler;
 
 // @@ forward decl to avoid including base/image.h; TODO change the
 // render_handler interface to not depend on these structs at all.
-namespace image { struct rgb; struct rgba; struct image_base; }
+namespace image { struct rgb; struct rgba; struct compressed; struct image_base; }
 
 // forward decl
 namespace jpeg { struct input; }
@@ -144,6 +144,10 @@ namespace gameswf
 #endif
 	exported_module sound_handler*	create_sound_handler_openal();
 
+	// No audio device: mixes into a WAV file as the host calls
+	// sound_handler::advance().  See gameswf_sound_handler_offline.h.
+	exported_module sound_handler*	create_sound_handler_offline(const char* wav_filename, int sample_rate = 44100);
+
 
 	// For things that should be automatically garbage-collected.
 	struct ref_counted : public gc_object, public weak_pointee_mixin
@@ -190,6 +194,8 @@ namespace gameswf
 		AS_LOADVARS,
 		AS_TIMER,
 		AS_MOUSE,
+		AS_XMLNODE,
+		AS_XML,
 
 		// flash9
 		AS_EVENT,
@@ -383,6 +389,13 @@ namespace gameswf
 	// loading movies.
 	exported_module void	set_use_cache_files(bool use_cache);
 
+	// When enabled, bitmaps are block-compressed (BC1, or BC3 if
+	// they have alpha) as they're loaded, and handed to the
+	// render_handler via create_bitmap_info_compressed().  The
+	// compressed data also goes into cache files.  Off by default.
+	exported_module void	set_compress_bitmaps(bool compress);
+	exported_module bool	get_compress_bitmaps();
+
 	//
 	// Use DO_NOT_LOAD_BITMAPS if you have pre-processed bitmaps
 	// stored externally somewhere, and you plan to install them
@@ -443,7 +456,7 @@ namespace gameswf
 		enum format_type
 		{
 			FORMAT_RAW = 0,		// unspecified format.	Useful for 8-bit sounds???
-			FORMAT_ADPCM = 1,	// gameswf doesn't pass this through; it uncompresses and sends FORMAT_NATIVE16
+			FORMAT_ADPCM = 1,	// gameswf uncompresses this and sends FORMAT_NATIVE16, unless can_decode() says otherwise
 			FORMAT_MP3 = 2,
 			FORMAT_UNCOMPRESSED = 3,	// 16 bits/sample, little-endian
 			FORMAT_NELLYMOSER = 6,	// Mystery proprietary format; see nellymoser.com
@@ -454,6 +467,13 @@ namespace gameswf
 
 		// If stereo is true, samples are interleaved w/ left sample first.
 
+		// Return true if you'd rather get data in the given format
+		// as-is and decode it yourself.  gameswf only asks about
+		// FORMAT_ADPCM; each block of data passed to create_sound()
+		// or append_sound() is then a complete ADPCM packet,
+		// starting with its 2-bit code size.
+		virtual bool	can_decode(format_type format) { return false; }
+
 		// gameswf calls at load-time with sound data, to be
 		// played later.  You should create a sample with the
 		// data, and return a handle that can be used to play
@@ -728,6 +748,12 @@ namespace gameswf
 		virtual bitmap_info*	create_bitmap_info_alpha(int w, int h, unsigned char* data) = 0;
 		virtual bitmap_info*	create_bitmap_info_rgb(image::rgb* im) = 0;
 		virtual bitmap_info*	create_bitmap_info_rgba(image::rgba* im) = 0;
+
+		// For a block-compressed (BC1/BC3) image.  Handlers
+		// that can upload the blocks as they are should
+		// override this; the default decodes them and calls
+		// create_bitmap_info_rgba().
+		virtual bitmap_info*	create_bitmap_info_compressed(image::compressed* im);
 		virtual video_handler*	create_video_handler() = 0;
 
 		// Bracket the displaying of a frame from a movie.
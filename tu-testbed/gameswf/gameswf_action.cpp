@@ -232,6 +232,7 @@ namespace gameswf
 
 		// Return pointer to static string for return value.
 		static tu_string	s_retval;
+		tu_arena::scoped_heap	no_arena(NULL);
 		s_retval = result.to_tu_string();
 		return s_retval.c_str();
 	}
@@ -374,7 +375,7 @@ namespace gameswf
 				}
 			}
 
-			IF_VERBOSE_ACTION(log_msg("%4d\t", pc); log_disasm(&(*m_buffer.get_ptr())[instruction_start]); );
+			IF_VERBOSE_ACTION(log_msg_deferred("%4d\t", pc); log_disasm(&(*m_buffer.get_ptr())[instruction_start]); );
 
 			if (action_id == 0)
 			{
@@ -610,7 +611,7 @@ namespace gameswf
 			int	action_id = buffer[pc];
 			if ((action_id & 0x80) == 0)
 			{
-				IF_VERBOSE_ACTION(log_msg("EX:\t"); log_disasm(&buffer[pc]));
+				IF_VERBOSE_ACTION(log_msg_deferred("EX:\t"); log_disasm(&buffer[pc]));
 
 				// IF_VERBOSE_ACTION(log_msg("Action ID is: 0x%x\n", action_id));
 			
@@ -1707,7 +1708,7 @@ namespace gameswf
 			}
 			else
 			{
-				IF_VERBOSE_ACTION(log_msg("EX:\t"); log_disasm(&buffer[pc]));
+				IF_VERBOSE_ACTION(log_msg_deferred("EX:\t"); log_disasm(&buffer[pc]));
 
 				// Action containing extra data.
 				int	length = buffer[pc + 1] | (buffer[pc + 2] << 8);
@@ -267,6 +267,18 @@ namespace gameswf
 		M_PASSWORD,
 		M_MOUSE_MOVE,
 
+		// XMLNode
+		M_NODE_TYPE,
+		M_NODE_NAME,
+		M_NODE_VALUE,
+		M_FIRST_CHILD,
+		M_LAST_CHILD,
+		M_NEXT_SIBLING,
+		M_PREVIOUS_SIBLING,
+		M_PARENT_NODE,
+		M_CHILD_NODES,
+		M_ATTRIBUTES,
+
 		AS_STANDARD_MEMBER_COUNT
 	};
 	// Return the standard enum, if the arg names a standard member.
@@ -280,6 +292,7 @@ namespace gameswf
 		BUILTIN_NUMBER_METHOD,
 		BUILTIN_BOOLEAN_METHOD,
 		BUILTIN_STRING_METHOD,
+		BUILTIN_XMLNODE_METHOD,
 		// and so far
 
 		BUILTIN_COUNT
@@ -53,7 +53,8 @@ namespace gameswf
 		m_seek_time(-1.0f),
 		m_buffer_time(0.1f)	// The default value is 0.1 second
 	{
-		// fill static hash once
+		// fill static hash once, outside the player's heap
+		tu_arena::scoped_heap	no_arena(NULL);
 		if (s_netstream_event_level.size() == 0)
 		{
 			s_netstream_event_level.add(status, "status");
@@ -72,14 +72,14 @@ namespace gameswf
 			}
 			const char*	str = sstr.c_str();
 			const char*	p = strstr(
-				str + start_index,	// FIXME: not UTF-8 correct!
+				str + sstr.utf8_byte_offset(start_index),
 				fn.arg(0).to_string());
 			if (p == NULL)
 			{
 				fn.result->set_double(-1);
 				return;
 			}
-			fn.result->set_double(tu_string::utf8_char_count(str, (int) (p - str)));
+			fn.result->set_double(sstr.utf8_char_index((int) (p - str)));
 		}
 	}
 
@@ -98,11 +98,12 @@ namespace gameswf
 				start_index = fn.arg(1).to_int();
 			}
 			const char* str = sstr.c_str();
+			const char* limit = str + sstr.utf8_byte_offset(start_index);
 			const char* last_hit = NULL;
 			const char* haystack = str;
 			for (;;) {
 				const char*	p = strstr(haystack, fn.arg(0).to_string());
-				if (p == NULL || (start_index !=0 && p > str + start_index ) )	// FIXME: not UTF-8 correct!
+				if (p == NULL || (start_index !=0 && p > limit ) )
 				{
 					break;
 				}
@@ -112,7 +113,7 @@ namespace gameswf
 			if (last_hit == NULL) {
 				fn.result->set_double(-1);
 			} else {
-				fn.result->set_double(tu_string::utf8_char_count(str, (int) (last_hit - str)));
+				fn.result->set_double(sstr.utf8_char_index((int) (last_hit - str)));
 			}
 		}
 	}
@@ -306,9 +307,8 @@ namespace gameswf
 		int	index = fn.arg(0).to_int();
 		if (index >= 0 && index < this_str.utf8_length()) 
 		{
-			char c[2];
-			c[0] = this_str.utf8_char_at(index);
-			c[1] = 0;
+			tu_string c;
+			c.append_wide_char(this_str.utf8_char_at(index));
 			fn.result->set_tu_string(c);
 		}
 	}
@@ -322,7 +322,7 @@ namespace gameswf
 	void string_length(const fn_call& fn)
 	{
 		const tu_string& str = fn.this_value.to_tu_string();
-		fn.result->set_int(str.size());
+		fn.result->set_int(str.utf8_length());
 	}
 
 	void as_global_string_ctor(const fn_call& fn)
@@ -1,383 +1,169 @@
-#ifndef __XML_H__
-#define __XML_H__
+// as_xml.h	-- ActionScript XML and XMLNode classes
 
-//#define DEBUG_MEMORY_ALLOCATION 1
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
 
-#include "base/tu_config.h"
-#include "gameswf/gameswf_log.h"
-#include "gameswf/gameswf_action.h"
-#include "gameswf/gameswf_impl.h"
-#include "gameswf/gameswf_log.h"
+// The parsed tree lives in a tu_xml::document (a few flat arrays),
+// not in as_objects.  An as_xmlnode is a handle to one node of it,
+// created the first time script reaches that node through
+// firstChild, childNodes, etc., so a large document that's only
+// partly read never turns into a large object graph.
+//
+// XML.load() reads and parses a piece of the file each frame.
 
-#ifdef HAVE_LIBXML
 
-#include <libxml/xmlmemory.h>
-#include <libxml/parser.h>
-#include <libxml/xmlreader.h>
+#ifndef GAMESWF_AS_XML_H
+#define GAMESWF_AS_XML_H
 
-namespace gameswf
-{
 
-class XMLAttr {
- public:
-  XMLAttr();
-  ~XMLAttr();
-  
-  char        *_name;
-  char        *_value;
-
-  XMLAttr *operator = (XMLAttr node) {
-    log_msg("\t\tCopying XMLAttr object at %p\n", this);
-    
-    _name = new char[strlen(node._name)+2];
-    memset(_name, 0, strlen(node._name)+2);
-    strcpy(_name, node._name);
-
-    _value = new char[strlen(node._value)+2];
-    memset(_value, 0, strlen(node._value)+2);
-    strcpy(_value, node._value);
-
-    return this;
-  }
-};
-
-struct xmlattr_as_object : public gameswf::as_object
-{
-  //XMLAttr obj;
-  int   padding;
-#ifdef DEBUG_MEMORY_ALLOCATION
-  xmlattr_as_object() 
-  {
-    log_msg("\t\tCreating xmlattr_as_object at %p\n", this);
-  };
-  ~xmlattr_as_object() 
-  {
-    log_msg("\tDeleting xmlattr_as_object at %p \n", this);
-  };
-#endif
-};
- 
-class XMLNode
-{
-public:
-  XMLNode();
-  ~XMLNode();
-
-  int length() { return _children.size(); }
-  tu_string nodeName() 
-  {
-    return _name;
-  }
-
-  char *nodeValue()
-  {
-    return _value;
-  }
-  
-  //  nodeType 	XML.nodeType
-
-  bool hasChildNodes()
-  {
-    if (_children.size() > 0) {
-      return true;
-    }
-    return false;
-  }
-  
-  XMLNode *firstChild()
-  {
-    return _children[0];
-  }
-  
-  array<XMLNode *>childNodes()
-  {
-    return _children;
-  }  
-
-  XMLNode *operator [] (int x)
-  {
-    gameswf::log_msg("%s: get element %d\n", __FUNCTION__, x);
-    
-    return _children[x];
-  }
-  
-  XMLNode *operator = (XMLNode &node)
-  {
-    _name = node._name;
-    _value = node._value;
-    _children = node._children;
-    _attributes = node._attributes;
-    return this;
-  }
-
-  XMLNode *operator = (XMLNode *node)
-  {
-    _name = node->_name;
-    _value = node->_value;
-    _children = node->_children;
-    _attributes = node->_attributes;
-    return this;
-  }
-
-  void appendChild(XMLNode *node)
-  {
-    node->_children.push_back(node);
-  }
-
-  void  change_stack_frame(int frame, gameswf::as_object *xml, gameswf::as_environment *env);
-
-  
-#if 0
-appendChild()   	 XML.appendChild()
-attributes 	XML.attributes
-childNodes 	XML.childNodes
-cloneNode() 	XML.cloneNode()
-insertBefore() 	XML.insertBefore()
-lastChild 	XML.lastChild
-nextSibling 	XML.nextSibling
-nodeType 	XML.nodeType
-parentNode 	XML.parentNode
-previousSibling 	XML.previousSibling
-removeNode() 	XML.removeNode()
-toString() 	XML.toString()
-#endif
-  char               *_name;
-  char               *_value;
-  array<XMLNode *>   _children;
-  array<XMLAttr *>   _attributes;
-};
-
-struct xmlnode_as_object : public gameswf::as_object
-{
-  //XMLNode obj;
-  int                _padding;
-
-#ifdef DEBUG_MEMORY_ALLOCATION
-  xmlnode_as_object() 
-  {
-    log_msg("\tCreating xmlnode_as_object at %p \n", this);
-  };
-  ~xmlnode_as_object() 
-  {
-    log_msg("\tDeleting xmlnode_as_object at %p \n", this);
-  };
-#endif
-  virtual bool	get_member(const tu_stringi& name, as_value* val)
-  {
-    //printf("GET XMLNode MEMBER: %s at %p for object %p\n", name.c_str(), val, this);
-
-    if ((name == "firstChild") || (name == "childNodes")) {
-      //printf("Returning a self reference for %s for object at %p\n", name.c_str(), this);
-			val->set_as_object_interface(this);
-      return true;
-    }
-    
-//    if (m_members.get(name, val) == false) {
-    if (get_member(name, val) == false) {
-      if (m_prototype != NULL) {
-        return m_prototype->get_member(name, val);
-      }
-      return false;
-    }
-    return true;
-  }
-};
-
-class XML {
- public:
-  XML();
-  XML(tu_string xml_in);
-  XML(struct node * childNode);
-  virtual ~XML();
-
-  // Methods
-  bool parseDoc(xmlDocPtr document, bool mem); // This is the base method used by both parseXML() and load().
-  bool parseXML(tu_string xml_in); // Parses an XML document into the specified XML object tree.
-  bool load(const char *filespec);  // Loads a document (specified by
-                                    // the XML object) from a URL.
-
-  bool onLoad();                   // An event handler that returns a
-                                   // Boolean value indicating whether
-                                   // the XML object was successfully
-                                   // loaded with XML.load() or
-                                   // XML.sendAndLoad().
-
-  // Appends a node to the end of the specified object's child list.
-  void appendChild(XMLNode *node)
-  {
-    _nodes->_children.push_back(node);
-  }
-  
-  virtual bool on_event(gameswf::event_id id);
-  virtual void	on_event_load();
-  bool loaded()    { return _loaded; }
-
-  XMLNode *firstChild()
-  {
-    return _nodes;
-    //return _node_data[0];
-  }
-  
-  void clear()
-  {
-    delete _nodes;
-  }
-  
-  array<XMLNode *> childNodes()
-  {
-    return _nodes->_children;
-  }
-  
-  //  Returns true if the specified node has child nodes; otherwise, returns false.
-  bool hasChildNodes()
-  {
-		return _nodes->_children.size() > 0 ? true : false;
-  }
-
-  XMLNode *extractNode(xmlNodePtr node, bool mem);
-  XMLNode *processNode(xmlTextReaderPtr reader, XMLNode *node);
-
-  void  change_stack_frame(int frame, gameswf::as_object *xml, gameswf::as_environment *env);
-  void  setupStackFrames(gameswf::as_object *xml, gameswf::as_environment *env);
-  void  cleanupStackFrames( XMLNode *data);
-  as_object *setupFrame(gameswf::as_object *xml, XMLNode *data, bool src);
-  
-  const char *nodeNameGet() 
-    {
-      return _nodename;
-    }
-  
-  int length() { return _nodes->length(); }
-  
-#if 0
-  void addRequestHeader();          // Adds or changes HTTP headers for POST
-                                    // operations. 
-  void appendChild();               // Appends a node to the end of
-                                    // the specified object's child
-                                    // list.
-  void cloneNode();                 // Clones the specified node and,
-                                    // optionally, recursively clones
-                                    // all children. 
-  void createElement(); // Creates a new XML element.
-  void createTextNode(); //Creates a new XML text node.
-  void getBytesLoaded(); // Returns the number of bytes loaded for the specified XML document.
-  void getBytesTotal(); // Returns the size of the XML document, in bytes.
-  void insertBefore();// Inserts a node in front of an existing node in the specified node's child list.
-  void removeNode();// Removes the specified node from its parent.
-  void send();             // Sends the specified XML object to a URL.
-  void sendAndLoad(); // Sends the specified XML object to a URL and loads the server response into another XML object.void 
-  gameswf::tu_string toString();                // Converts the specified node and 
-                                                // any children to XML text. 
-#endif
-  virtual void	on_xml_event(gameswf::event_id id) { on_event(id); }
-  
-  // Special event handler; 
-  void	on_event_close() { on_event(gameswf::event_id::SOCK_CLOSE); }
-  
-  XMLNode *operator [] (int x);
-#if 0
-  XMLNode *operator = (XMLNode &node)
-  {
-    gameswf::log_msg("%s: copy element %s\n", __FUNCTION__, node._name.c_str());
-    _nodes = node;
-  }
-
-#endif
-  XML *operator = (XMLNode *node)
-  {
-    _nodes = node;    
-    return this;
-  }
-
-  private:
-  //bool _on_event_loaded;
-    xmlDocPtr _doc;
-    xmlNodePtr _firstChild;
-    
-    // Properties
-    bool _loaded;                           // Read-only; checks if
-                                            // the specified XML object has loaded.
-    const char  *_nodename;                  // The node name of an XML object.
-    XMLNode     *_nodes;
-    //    array<XMLNode *>  _node_data;
-  //    hash<gameswf::event_id, gameswf::as_value>	_event_handlers;
-#if 0
-    array<struct node *> _childNodes; // Read-only; returns an array containing
-                                            // references to the child
-                                            // nodes of the specified
-                                            // node.
-  contentType; //	Indicates the MIME type transmitted to the server.
-  docTypeDecl;	// Sets and returns information about an XML document's DOCTYPE declaration.
-  firstChild;	// Read-only; references the first child in the list for the specified node.
-  bool ignoreWhite;	// When set to true, text nodes that contain only white space are discarded during the parsing process.
-  lastChild;	// References the last child in the list for the specified node.
-  nextSibling;	// Read-only; references the next sibling in the parent node's child list.
-  tu_string nodeType;	// The type of the specified node (XML element or text node).
-  nodeValue;	// The text of the specified node if the node is a text node.
-  parentNode;	// Read-only; references the parent node of the specified node.
-  previousSibling; //	Read-only; references the previous sibling in the parent node's child list.
-  status; //	A numeric status code indicating the success or failure of an XML document parsing operation.
-  xmlDecl; //	Specifies information about a document's XML declaration.
-
-  // Collections data
-  attributes; // Returns an associative array containing all of the attributes of the specified node.
-  // Event Handlers
-  onData; // An event handler that is invoked when XML text has been
-          // completely downloaded from the server, or when an error
-          // occurs downloading XML text from a server. 
-#endif  
-};
-
-struct xml_as_object : public gameswf::as_object
+#include "base/tu_xml.h"
+#include "gameswf/gameswf_action.h"	// for as_object
+
+
+class tu_file;
+
+
+namespace gameswf
 {
-  XML obj;
-#ifdef DEBUG_MEMORY_ALLOCATION
-  xml_as_object() 
-  {
-    log_msg("\tCreating xml_as_object at %p\n", this);
-  };
-  ~xml_as_object() 
-  {
-    log_msg("\tDeleting xml_as_object at %p\n", this);
-  };
-#endif
-  virtual bool	get_member(const tu_stringi& name, as_value* val)
-  {
-    //printf("GET XML MEMBER: %s at %p for object %p\n", name.c_str(), val, this);
-
-    if ((name == "firstChild") || (name == "childNodes")) {
-      //printf("Returning a self reference for %s for object at %p\n", name.c_str(), this);
-			val->set_as_object_interface(this);
-      return true;
-    }
-    
-//    if (m_members.get(name, val) == false) {
-    if (get_member(name, val) == false) {
-      if (m_prototype != NULL) {
-        return m_prototype->get_member(name, val);
-      }
-      return false;
-    }
-    return true;
-  }
-};
-
-exported_module virtual bool is_instance_of(const as_function& constructor) const;
-void xml_load(const fn_call& fn);
-void xml_set_current(const fn_call& fn);
-void xml_new(const fn_call& fn);
-
-// These are the event handlers called for this object
-void xml_onload(const fn_call& fn);
-void xml_ondata(const fn_call& fn);
-void xml_loaded(const fn_call& fn);
-
-int memadjust(int x);
+	struct as_xmlattributes;
+	struct as_xmlnode;
+
+	void	as_global_xml_ctor(const fn_call& fn);
+	void	as_global_xmlnode_ctor(const fn_call& fn);
+
+	// XMLNode methods, shared by all nodes via
+	// BUILTIN_XMLNODE_METHOD.
+	void	as_xmlnode_append_child(const fn_call& fn);
+	void	as_xmlnode_clone_node(const fn_call& fn);
+	void	as_xmlnode_has_child_nodes(const fn_call& fn);
+	void	as_xmlnode_insert_before(const fn_call& fn);
+	void	as_xmlnode_remove_node(const fn_call& fn);
+	void	as_xmlnode_to_string(const fn_call& fn);
+
+	struct xml_document : public ref_counted
+	// A tree, and the nodes of it that script currently holds.
+	{
+		tu_xml::document	m_doc;
+
+		// Returns the node's as_xmlnode, creating it if there
+		// isn't a live one.  NULL for index -1.
+		as_xmlnode*	get_node(player* player, int index);
+
+		void	add_node(as_xmlnode* node);
+		void	remove_node(as_xmlnode* node);
+		void	add_attributes(as_xmlattributes* attributes);
+
+		// Squeezes edited-away nodes and strings out of m_doc
+		// once enough have piled up, renumbering the nodes
+		// script holds.  Call before an edit, when no node
+		// index is kept anywhere but in those objects.
+		void	compact_if_needed();
+
+	private:
+		// Weak, so the nodes and the document don't keep each
+		// other alive.  A node that script lets go of is freed,
+		// and a new one is made if script comes back to it.
+		hash<int, weak_ptr<as_xmlnode> >	m_nodes;
+
+		// node.attributes objects, which can outlive their
+		// node.
+		array<weak_ptr<as_xmlattributes> >	m_attributes;
+	};
+
+	struct as_xmlattributes : public as_object
+	// node.attributes.  Writes go through to the document.
+	{
+		as_xmlattributes(player* player, xml_document* doc, int index);
+
+		virtual bool	set_member(const tu_stringi& name, const as_value& val);
+
+		gc_ptr<xml_document>	m_doc;
+		int	m_index;
+	};
+
+	struct as_xmlnode : public as_object
+	{
+		// Unique id of a gameswf resource
+		enum { m_class_id = AS_XMLNODE };
+		virtual bool is(int class_id) const
+		{
+			if (m_class_id == class_id) return true;
+			else return as_object::is(class_id);
+		}
+
+		as_xmlnode(player* player, xml_document* doc, int index);
+		virtual ~as_xmlnode();
+
+		virtual bool	get_member(const tu_stringi& name, as_value* val);
+		virtual bool	set_member(const tu_stringi& name, const as_value& val);
+		virtual const char*	to_string();
+
+		const tu_xml::document::node&	get_node() const { return m_doc->m_doc.get_node(m_index); }
+
+		// Makes this node a child of parent, before the given
+		// sibling (or last if before is NULL).  Nodes from another
+		// document are copied into parent's.
+		void	move_to(as_xmlnode* parent, as_xmlnode* before);
+
+		gc_ptr<xml_document>	m_doc;
+		int	m_index;
+		gc_ptr<as_xmlattributes>	m_attributes;
+		tu_string	m_string_value;
+	};
+
+	struct as_xml : public as_xmlnode
+	// The document root.
+	{
+		// Unique id of a gameswf resource
+		enum { m_class_id = AS_XML };
+		virtual bool is(int class_id) const
+		{
+			if (m_class_id == class_id) return true;
+			else return as_xmlnode::is(class_id);
+		}
+
+		as_xml(player* player);
+		virtual ~as_xml();
+
+		// Replaces the tree.  Sets status, loaded etc.
+		void	parse(const char* xml, int length);
+
+		// Starts loading a local file; returns false if it can't
+		// be opened.  onLoad is called when it's done.
+		bool	load(const char* url);
+		void	cancel_load();
+
+		int	get_bytes_loaded() const;
+		int	get_bytes_total() const;
+
+		virtual void	advance(float delta_time);
+		virtual const char*	to_string();
+
+	private:
+		bool	get_ignore_white();
+		void	set_document(xml_document* doc, tu_xml::status status);
+		void	end_load(bool ok);
+		void	call_on_load(bool success);
+
+		// While loading.
+		tu_file*	m_file;
+		int	m_file_size;
+		int	m_bytes_loaded;
+		tu_xml::parser*	m_parser;
+		gc_ptr<xml_document>	m_loading;
+		tu_string	m_raw_data;	// for a script's own onData
+		bool	m_use_on_data;
+	};
 
 }	// end namespace gameswf
 
 
-#endif // HAVE_LIBXML
+#endif // GAMESWF_AS_XML_H
 
-#endif	// __XML_H__
 
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
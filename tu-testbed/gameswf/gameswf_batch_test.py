@@ -11,20 +11,43 @@ import string
 import sys
 import commands
 import difflib
+import hashlib
+import os
 import re
 
 GAMESWF = "../dmb-out/vc9-debug/gameswf/gameswf_test_ogl"
 BATCH_ARGS = " -r 0 -1 -t 10 -v "
+WAV_FILE = "batch_test_audio.wav"
 
 
-def run_batch_test(testname, testfile, expected_output):
+def run_batch_test(testname, testfile, expected_output, expected_wav_md5):
   '''Run gameswf on a test file, and compare its output to the given expected output.
+  If expected_wav_md5 is given, the movie's sound is also rendered to a
+  WAV file, whose MD5 must match.
   Return an error code and a report string summarizing the results'''
 
+  # Don't let a WAV left over from an earlier run stand in for ours.
+  remove_wav_file()
+  try:
+    return run_batch_test_body(testname, testfile, expected_output, expected_wav_md5)
+  finally:
+    remove_wav_file()
+
+
+def remove_wav_file():
+  if os.path.exists(WAV_FILE):
+    os.remove(WAV_FILE)
+
+
+def run_batch_test_body(testname, testfile, expected_output, expected_wav_md5):
   report = "";
   success = True;
 
-  [status, output] = commands.getstatusoutput(GAMESWF + BATCH_ARGS + testfile)
+  args = BATCH_ARGS
+  if expected_wav_md5:
+    args += " -o " + WAV_FILE + " "
+
+  [status, output] = commands.getstatusoutput(GAMESWF + args + testfile)
 
   # Clean up the output.
   output = output.splitlines(1)
@@ -48,6 +71,19 @@ def run_batch_test(testname, testfile, expected_output):
       report += format_header_line(testfile, "[failed]")
       report += "    " + string.join(difference, "    ")
 
+  if success and expected_wav_md5:
+    if not os.path.exists(WAV_FILE):
+      success = False;
+      report = format_header_line(testfile, "[failed]")
+      report += "  no audio written to " + WAV_FILE + "\n"
+      return success, report
+
+    wav_md5 = hashlib.md5(open(WAV_FILE, "rb").read()).hexdigest()
+    if wav_md5 != expected_wav_md5:
+      success = False;
+      report = format_header_line(testfile, "[failed]")
+      report += "  audio MD5 is " + wav_md5 + ", expected " + expected_wav_md5 + "\n"
+
   return success, report
 
 
@@ -83,9 +119,10 @@ def parse_testfile(testfile):
   The expected output is taken from the remainder of testfile.
 
   Any lines in the testfile that start with '#' are comments, and are
-  ignored.
+  ignored, except for an optional '#wav_md5 <md5>' line, which gives
+  the expected MD5 of the movie's sound rendered to a WAV file.
 
-  Returns [None,None,None] if the testfile couldn't be parsed.'''
+  Returns [None,None,None,None] if the testfile couldn't be parsed.'''
 
   # Pull out the filename part of the testfile, minus any path and
   # extension.
@@ -95,7 +132,7 @@ def parse_testfile(testfile):
   # Read the test file.
   f = file(testfile, "r")
   if not f:
-    return [None, None, None]
+    return [None, None, None, None]
 
   # The first non-comment line gives the swf file to run.
   swf_file = next_non_comment_line(f).rstrip()
@@ -109,7 +146,13 @@ def parse_testfile(testfile):
       break
   f.close()
 
-  return testname, swf_file, expected
+  # Optional audio check.
+  wav_md5 = None
+  for line in file(testfile, "r"):
+    if line.startswith("#wav_md5 "):
+      wav_md5 = line.split()[1]
+
+  return testname, swf_file, expected, wav_md5
 
 
 def do_tests(filenames):
@@ -118,13 +161,13 @@ def do_tests(filenames):
   report = ""
 
   for testfile in filenames:
-    [testname, swf_file, expected_output] = parse_testfile(testfile)
+    [testname, swf_file, expected_output, expected_wav_md5] = parse_testfile(testfile)
     if testname == None:
       success = False
       rep = format_header_line(testfile, "[failed]\n")
       rep += "  Couldn't load test file %s\n" % testfile
     else:
-      [success, rep] = run_batch_test(testname, swf_file, expected_output)
+      [success, rep] = run_batch_test(testname, swf_file, expected_output, expected_wav_md5)
 
     if success:
       success_count += 1
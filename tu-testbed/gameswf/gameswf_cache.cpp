@@ -0,0 +1,326 @@
+// gameswf_cache.cpp	-- relocatable cache files for gameswf
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Reader/writer helpers for the mapped .gsc format; see
+// gameswf_cache.h for the layout.
+
+
+#include "gameswf/gameswf_cache.h"
+#include "gameswf/gameswf_log.h"
+#include "base/mmap_util.h"
+#include "base/tu_file.h"
+#include "base/utility.h"
+#include <string.h>
+
+
+namespace gameswf
+{
+	static const Uint32	ENDIAN_TAG = 0x01020304;
+
+
+	Uint32	compute_source_hash(tu_file* in, Uint32* length)
+	{
+		Uint32	h = 5381;
+		Uint32	total = 0;
+
+		static const int	BUFFER_SIZE = 65536;
+		array<Uint8>	buffer;
+		buffer.resize(BUFFER_SIZE);
+		for (;;)
+		{
+			int	bytes = in->read_bytes(&buffer[0], BUFFER_SIZE);
+			if (bytes <= 0)
+			{
+				break;
+			}
+			h = (Uint32) bernstein_hash(&buffer[0], bytes, h);
+			total += bytes;
+		}
+
+		if (length)
+		{
+			*length = total;
+		}
+		return h;
+	}
+
+
+	//
+	// cache_image
+	//
+
+
+	cache_image::cache_image(const Uint8* data, int size)
+		:
+		m_data(data),
+		m_size(size),
+		m_ref_count(0)
+	{
+	}
+
+
+	cache_image::~cache_image()
+	{
+		mmap_util::unmap((void*) m_data, m_size);
+	}
+
+
+	/* static */ cache_image*	cache_image::map(const char* filename)
+	{
+		int	size = mmap_util::file_size(filename);
+		if (size < (int) sizeof(mapped_cache_header))
+		{
+			// Missing, or too short to even hold a header.
+			return NULL;
+		}
+
+		const Uint8*	data = (const Uint8*) mmap_util::map(size, false, filename);
+		if (data == NULL)
+		{
+			return NULL;
+		}
+
+		const mapped_cache_header&	h = *(const mapped_cache_header*) data;
+		if (h.m_magic[0] != 'g' || h.m_magic[1] != 's' || h.m_magic[2] != 'c'
+			|| h.m_magic[3] != MAPPED_CACHE_FILE_VERSION)
+		{
+			// Not ours; probably the streamed format.
+			mmap_util::unmap((void*) data, size);
+			return NULL;
+		}
+
+		if (h.m_endian_tag != ENDIAN_TAG
+			|| h.m_coord_size != sizeof(coord_component)
+			|| h.m_file_size != (Uint64) size
+			|| h.m_entry_table_offset + (Uint64) h.m_entry_count * sizeof(mapped_cache_entry) > (Uint64) size)
+		{
+			log_error("cache file '%s' was written for a different platform or is truncated; skipping\n", filename);
+			mmap_util::unmap((void*) data, size);
+			return NULL;
+		}
+
+		return new cache_image(data, size);
+	}
+
+
+	const void*	cache_image::get_range(Uint64 offset, Uint64 bytes) const
+	{
+		if (offset > (Uint64) m_size || bytes > (Uint64) m_size - offset)
+		{
+			return NULL;
+		}
+		return m_data + offset;
+	}
+
+
+	//
+	// mapped_cache_writer
+	//
+
+
+	mapped_cache_writer::mapped_cache_writer(tu_file* out, Uint32 source_hash, Uint32 source_length)
+		:
+		m_out(out),
+		m_entry_start(-1)
+	{
+		memset(&m_header, 0, sizeof(m_header));
+		m_header.m_magic[0] = 'g';
+		m_header.m_magic[1] = 's';
+		m_header.m_magic[2] = 'c';
+		m_header.m_magic[3] = MAPPED_CACHE_FILE_VERSION;
+		m_header.m_endian_tag = ENDIAN_TAG;
+		m_header.m_coord_size = sizeof(coord_component);
+		m_header.m_source_hash = source_hash;
+		m_header.m_source_length = source_length;
+
+		compiler_assert(sizeof(mapped_cache_header) == 64);
+		compiler_assert(sizeof(mapped_cache_entry) == 16);
+
+		// Placeholder; the real header is written by finish().
+		m_out->write_bytes(&m_header, sizeof(m_header));
+	}
+
+
+	void	mapped_cache_writer::pad_to_alignment()
+	{
+		static const Uint8	zeros[MAPPED_CACHE_ALIGNMENT] = { 0 };
+		int	pos = m_out->get_position();
+		int	pad = (MAPPED_CACHE_ALIGNMENT - (pos % MAPPED_CACHE_ALIGNMENT)) % MAPPED_CACHE_ALIGNMENT;
+		if (pad)
+		{
+			m_out->write_bytes(zeros, pad);
+		}
+	}
+
+
+	Uint64	mapped_cache_writer::write_array(const void* data, int bytes)
+	{
+		if (bytes <= 0)
+		{
+			return 0;
+		}
+
+		pad_to_alignment();
+		Uint64	offset = m_out->get_position();
+		m_out->write_bytes(data, bytes);
+		return offset;
+	}
+
+
+	void	mapped_cache_writer::begin_entry(int id, mapped_cache_entry::kind k)
+	{
+		assert(m_entry_start == -1);
+		assert(id >= 0 && id < 65536);
+
+		mapped_cache_entry	e;
+		e.m_id = (Uint16) id;
+		e.m_kind = (Uint16) k;
+		e.m_reserved = 0;
+		e.m_record_offset = m_records.size();	// relative until finish()
+		m_entries.push_back(e);
+		m_entry_start = m_records.size();
+	}
+
+
+	void	mapped_cache_writer::end_entry()
+	{
+		assert(m_entry_start != -1);
+		if (m_records.size() == m_entry_start)
+		{
+			// Nothing cached for this one.
+			m_entries.pop_back();
+		}
+		m_entry_start = -1;
+	}
+
+
+	bool	mapped_cache_writer::finish()
+	{
+		assert(m_entry_start == -1);
+
+		pad_to_alignment();
+		Uint64	records_offset = m_out->get_position();
+		if (m_records.size() > 0)
+		{
+			m_out->write_bytes(m_records.data(), m_records.size());
+		}
+
+		pad_to_alignment();
+		m_header.m_entry_table_offset = m_out->get_position();
+		m_header.m_entry_count = m_entries.size();
+		for (int i = 0; i < m_entries.size(); i++)
+		{
+			mapped_cache_entry	e = m_entries[i];
+			e.m_record_offset += records_offset;
+			m_out->write_bytes(&e, sizeof(e));
+		}
+
+		m_header.m_file_size = m_out->get_position();
+		m_out->set_position(0);
+		m_out->write_bytes(&m_header, sizeof(m_header));
+		m_out->go_to_end();
+
+		return m_out->get_error() == TU_FILE_NO_ERROR;
+	}
+
+
+	//
+	// mapped_cache_reader
+	//
+
+
+	mapped_cache_reader::mapped_cache_reader(cache_image* image, Uint64 offset)
+		:
+		m_image(image),
+		m_pos(offset),
+		m_error(false)
+	{
+		assert(m_image);
+	}
+
+
+	void	mapped_cache_reader::read(void* dst, int bytes)
+	{
+		const void*	src = m_image->get_range(m_pos, bytes);
+		if (src == NULL)
+		{
+			m_error = true;
+			memset(dst, 0, bytes);
+			return;
+		}
+		memcpy(dst, src, bytes);
+		m_pos += bytes;
+	}
+
+
+	Uint32	mapped_cache_reader::read_u32()
+	{
+		Uint32	u;
+		read(&u, sizeof(u));
+		return u;
+	}
+
+
+	Uint64	mapped_cache_reader::read_u64()
+	{
+		Uint64	u;
+		read(&u, sizeof(u));
+		return u;
+	}
+
+
+	float	mapped_cache_reader::read_float()
+	{
+		float	f;
+		read(&f, sizeof(f));
+		return f;
+	}
+
+
+	int	mapped_cache_reader::read_count(int min_record_bytes)
+	{
+		assert(min_record_bytes > 0);
+
+		Uint32	n = read_u32();
+		if (m_error)
+		{
+			return 0;
+		}
+
+		Uint64	left = (Uint64) m_image->get_size() - m_pos;
+		if ((Uint64) n * min_record_bytes > left)
+		{
+			m_error = true;
+			return 0;
+		}
+		return (int) n;
+	}
+
+
+	const void*	mapped_cache_reader::get_array(Uint64 offset, Uint64 bytes)
+	{
+		if (bytes == 0)
+		{
+			return NULL;
+		}
+
+		const void*	p = m_image->get_range(offset, bytes);
+		if (p == NULL || (offset % MAPPED_CACHE_ALIGNMENT) != 0)
+		{
+			m_error = true;
+			return NULL;
+		}
+		return p;
+	}
+
+}	// end namespace gameswf
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
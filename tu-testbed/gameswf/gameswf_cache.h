@@ -0,0 +1,194 @@
+// gameswf_cache.h	-- relocatable cache files for gameswf
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Support for the mapped (.gsc version 7) cache format.  Unlike the
+// streamed format written by movie_def_impl::output_cached_data(),
+// this one is laid out so the file can be memory-mapped and the
+// mesh coordinate arrays used in place, with no per-mesh copying.
+//
+// File layout (all values in the native byte order of the machine
+// that wrote the file; a reader on a different machine rejects it):
+//
+//   mapped_cache_header	64 bytes at offset 0
+//   coordinate arrays		each aligned to MAPPED_CACHE_ALIGNMENT
+//     & bitmap blocks
+//   records		per-character mesh descriptions, referring
+//				to the arrays by 64-bit file offset
+//   mapped_cache_entry[]	table of contents, one per character/font
+
+
+#ifndef GAMESWF_CACHE_H
+#define GAMESWF_CACHE_H
+
+
+#include "base/container.h"
+#include "base/membuf.h"
+#include "base/smart_ptr.h"
+
+class tu_file;
+
+
+namespace gameswf
+{
+	// Increment this when the mapped cache layout changes.  Must
+	// not collide with CACHE_FILE_VERSION, since both formats share
+	// the "gsc" magic.
+	#define MAPPED_CACHE_FILE_VERSION 7
+
+	// Arrays in the file start on this boundary, so they can be
+	// handed to SIMD code or a GPU upload straight from the mapping.
+	#define MAPPED_CACHE_ALIGNMENT 16
+
+	struct mapped_cache_header
+	{
+		Uint8	m_magic[4];	// 'g', 's', 'c', MAPPED_CACHE_FILE_VERSION
+		Uint32	m_endian_tag;	// 0x01020304 in the writer's byte order
+		Uint32	m_coord_size;	// sizeof(coord_component) of the writer
+		Uint32	m_source_hash;	// compute_source_hash() of the .swf
+		Uint32	m_source_length;
+		Uint32	m_entry_count;
+		Uint64	m_entry_table_offset;
+		Uint64	m_file_size;
+		Uint8	m_reserved[24];
+	};
+
+	struct mapped_cache_entry
+	{
+		enum kind
+		{
+			CHARACTER = 0,	// a shape in movie_def_impl::m_characters
+			FONT = 1,	// the glyph shapes of a font
+			BITMAP = 2,	// block-compressed image of a bitmap character
+		};
+
+		Uint16	m_id;
+		Uint16	m_kind;
+		Uint32	m_reserved;
+		Uint64	m_record_offset;
+	};
+
+
+	// Hash of the complete contents of a .swf stream, read from the
+	// current position to eof.  Stored in mapped cache files, so
+	// a cache made from a different version of the movie is ignored.
+	exported_module Uint32	compute_source_hash(tu_file* in, Uint32* length);
+
+
+	struct cache_image
+	// A read-only mapping of a mapped cache file.  Meshes loaded
+	// from the file point into the image, so mesh_set holds a
+	// smart_ptr to it to keep the mapping alive.
+	{
+		// Maps the named file; returns NULL if it doesn't
+		// exist, is truncated, or was written for a different
+		// version/byte order/coordinate type.
+		static cache_image*	map(const char* filename);
+
+		const mapped_cache_header&	get_header() const { return *(const mapped_cache_header*) m_data; }
+		const Uint8*	get_data() const { return m_data; }
+		int	get_size() const { return m_size; }
+
+		// Returns a pointer to 'bytes' bytes at the given file
+		// offset, or NULL if that range isn't inside the image.
+		const void*	get_range(Uint64 offset, Uint64 bytes) const;
+
+		void	add_ref() { m_ref_count++; }
+		void	drop_ref()
+		{
+			assert(m_ref_count > 0);
+			if (--m_ref_count == 0)
+			{
+				delete this;
+			}
+		}
+
+	private:
+		cache_image(const Uint8* data, int size);
+		~cache_image();
+
+		const Uint8*	m_data;
+		int	m_size;
+		int	m_ref_count;
+	};
+
+
+	struct mapped_cache_writer
+	// Serializes a mapped cache file.  Arrays are streamed straight
+	// into the output; the records that describe them are buffered
+	// and appended, along with the table of contents, by finish().
+	{
+		mapped_cache_writer(tu_file* out, Uint32 source_hash, Uint32 source_length);
+
+		// Copies an array into the file and returns its offset.
+		Uint64	write_array(const void* data, int bytes);
+
+		void	write_u32(Uint32 u) { m_records.append(&u, sizeof(u)); }
+		void	write_u64(Uint64 u) { m_records.append(&u, sizeof(u)); }
+		void	write_float(float f) { m_records.append(&f, sizeof(f)); }
+
+		// Records written between begin_entry() and end_entry()
+		// belong to the given character or font.  Entries that
+		// write nothing are dropped.
+		void	begin_entry(int id, mapped_cache_entry::kind k);
+		void	end_entry();
+
+		// Writes the records, the table of contents and the
+		// final header.  Returns false on a write error.
+		bool	finish();
+
+	private:
+		void	pad_to_alignment();
+
+		tu_file*	m_out;
+		mapped_cache_header	m_header;
+		membuf	m_records;
+		array<mapped_cache_entry>	m_entries;
+		int	m_entry_start;
+	};
+
+
+	struct mapped_cache_reader
+	// Cursor over the records of a mapped cache_image.
+	{
+		mapped_cache_reader(cache_image* image, Uint64 offset);
+
+		Uint32	read_u32();
+		Uint64	read_u64();
+		float	read_float();
+
+		// Reads a u32 element count, and checks that that many
+		// records of at least min_record_bytes each could fit in
+		// the rest of the image.  Returns 0 and sets the error
+		// flag if they can't.
+		int	read_count(int min_record_bytes);
+
+		// Returns a pointer into the image for an array written
+		// with mapped_cache_writer::write_array(), or NULL (and
+		// sets the error flag) if it's out of bounds.
+		const void*	get_array(Uint64 offset, Uint64 bytes);
+
+		cache_image*	get_image() const { return m_image; }
+		bool	get_error() const { return m_error; }
+
+	private:
+		void	read(void* dst, int bytes);
+
+		cache_image*	m_image;
+		Uint64	m_pos;
+		bool	m_error;
+	};
+
+}	// end namespace gameswf
+
+
+#endif // GAMESWF_CACHE_H
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
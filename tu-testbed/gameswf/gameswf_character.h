@@ -25,6 +25,8 @@ namespace gameswf
 	struct root;
 	struct swf_event;
 	struct as_mcloader;
+	struct mapped_cache_writer;
+	struct mapped_cache_reader;
 
 	// A character_def is the immutable data representing the template of a
 	// movie element.
@@ -64,6 +66,10 @@ namespace gameswf
 		virtual void	output_cached_data(tu_file* out, const cache_options& options) {}
 		virtual void	input_cached_data(tu_file* in) {}
 
+		// Same, for the mapped cache format (see gameswf_cache.h).
+		virtual void	output_mapped_cache_data(mapped_cache_writer* out) {}
+		virtual void	input_mapped_cache_data(mapped_cache_reader* in) {}
+
 		// for definetext, definetext2 & defineedittext tags
 		virtual void	csm_textsetting(stream* in, int tag_type) { assert(0); };
 
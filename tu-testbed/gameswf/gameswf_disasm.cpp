@@ -9,6 +9,7 @@
 
 #include "gameswf/gameswf_disasm.h"
 #include "gameswf/gameswf_log.h"
+#include "base/tu_arena.h"
 #include <stdarg.h>
 
 namespace gameswf
@@ -251,6 +252,10 @@ namespace gameswf
 	{
 		if (s_instr.size() == 0)
 		{
+			// Lives until the last player goes; keep it off
+			// the current player's heap.
+			tu_arena::scoped_heap	no_arena(NULL);
+
 			s_instr.add(0x03, inst_info_avm2("throw"));
 			s_instr.add(0x04, inst_info_avm2("getsuper", ARG_MULTINAME, ARG_END ));
 			s_instr.add(0x05, inst_info_avm2("setsuper" ));
@@ -598,11 +603,11 @@ namespace gameswf
 		// Show instruction.
 		if (info == NULL)
 		{
-			log_msg("<unknown>[0x%02X]", action_id);
+			log_msg_deferred("<unknown>[0x%02X]", action_id);
 		}
 		else
 		{
-			log_msg("%-15s", info->m_instruction);
+			log_msg_deferred("%-15s", info->m_instruction);
 			fmt = info->m_arg_format;
 		}
 
@@ -613,62 +618,62 @@ namespace gameswf
 
 			int	length = instruction_data[1] | (instruction_data[2] << 8);
 
-			// log_msg(" [%d]", length);
+			// log_msg_deferred(" [%d]", length);
 
 			if (fmt == ARG_HEX)
 			{
 				for (int i = 0; i < length; i++)
 				{
-					log_msg(" 0x%02X", instruction_data[3 + i]);
+					log_msg_deferred(" 0x%02X", instruction_data[3 + i]);
 				}
-				log_msg("\n");
+				log_msg_deferred("\n");
 			}
 			else if (fmt == ARG_STR)
 			{
-				log_msg(" \"");
+				log_msg_deferred(" \"");
 				for (int i = 0; i < length; i++)
 				{
-					log_msg("%c", instruction_data[3 + i]);
+					log_msg_deferred("%c", instruction_data[3 + i]);
 				}
-				log_msg("\"\n");
+				log_msg_deferred("\"\n");
 			}
 			else if (fmt == ARG_U8)
 			{
 				int	val = instruction_data[3];
-				log_msg(" %d\n", val);
+				log_msg_deferred(" %d\n", val);
 			}
 			else if (fmt == ARG_U16)
 			{
 				int	val = instruction_data[3] | (instruction_data[4] << 8);
-				log_msg(" %d\n", val);
+				log_msg_deferred(" %d\n", val);
 			}
 			else if (fmt == ARG_S16)
 			{
 				int	val = instruction_data[3] | (instruction_data[4] << 8);
 				if (val & 0x8000) val |= ~0x7FFF;	// sign-extend
-				log_msg(" %d\n", val);
+				log_msg_deferred(" %d\n", val);
 			}
 			else if (fmt == ARG_PUSH_DATA)
 			{
-				log_msg("\n");
+				log_msg_deferred("\n");
 				int i = 0;
 
 				while (i < length)
 				{
 					int	type = instruction_data[3 + i];
 					i++;
-					log_msg("\t\t");	// indent
+					log_msg_deferred("\t\t");	// indent
 					if (type == 0)
 					{
 						// string
-						log_msg("\"");
+						log_msg_deferred("\"");
 						while (instruction_data[3 + i])
 						{
-							log_msg("%c", instruction_data[3 + i]);
+							log_msg_deferred("%c", instruction_data[3 + i]);
 							i++;
 						}
 						i++;
-						log_msg("\"\n");
+						log_msg_deferred("\"\n");
 					}
 					else if (type == 1)
 					{
@@ -683,28 +688,28 @@ namespace gameswf
 						u.i = swap_le32(u.i);
 						i += 4;
 
-						log_msg("(float) %f\n", u.f);
+						log_msg_deferred("(float) %f\n", u.f);
 					}
 					else if (type == 2)
 					{
-						log_msg("NULL\n");
+						log_msg_deferred("NULL\n");
 					}
 					else if (type == 3)
 					{
-						log_msg("undef\n");
+						log_msg_deferred("undef\n");
 					}
 					else if (type == 4)
 					{
 						// contents of register
 						int	reg = instruction_data[3 + i];
 						i++;
-						log_msg("reg[%d]\n", reg);
+						log_msg_deferred("reg[%d]\n", reg);
 					}
 					else if (type == 5)
 					{
 						int	bool_val = instruction_data[3 + i];
 						i++;
-						log_msg("bool(%d)\n", bool_val);
+						log_msg_deferred("bool(%d)\n", bool_val);
 					}
 					else if (type == 6)
 					{
@@ -726,7 +731,7 @@ namespace gameswf
 						i += 8;
 
 
-						log_msg("(double) %f\n", u.d);
+						log_msg_deferred("(double) %f\n", u.d);
 					}
 					else if (type == 7)
 					{
@@ -736,19 +741,19 @@ namespace gameswf
 							| (instruction_data[3 + i + 2] << 16)
 							| (instruction_data[3 + i + 3] << 24);
 						i += 4;
-						log_msg("(int) %d\n", val);
+						log_msg_deferred("(int) %d\n", val);
 					}
 					else if (type == 8)
 					{
 						int	id = instruction_data[3 + i];
 						i++;
-						log_msg("dict_lookup[%d]\n", id);
+						log_msg_deferred("dict_lookup[%d]\n", id);
 					}
 					else if (type == 9)
 					{
 						int	id = instruction_data[3 + i] | (instruction_data[3 + i + 1] << 8);
 						i += 2;
-						log_msg("dict_lookup_lg[%d]\n", id);
+						log_msg_deferred("dict_lookup_lg[%d]\n", id);
 					}
 				}
 			}
@@ -758,27 +763,27 @@ namespace gameswf
 				int	count = instruction_data[3 + i] | (instruction_data[3 + i + 1] << 8);
 				i += 2;
 
-				log_msg(" [%d]\n", count);
+				log_msg_deferred(" [%d]\n", count);
 
 				// Print strings.
 				for (int ct = 0; ct < count; ct++)
 				{
-					log_msg("\t\t");	// indent
+					log_msg_deferred("\t\t");	// indent
 
-					log_msg("\"");
+					log_msg_deferred("\"");
 					while (instruction_data[3 + i])
 					{
 						// safety check.
 						if (i >= length)
 						{
-							log_msg("<disasm error -- length exceeded>\n");
+							log_msg_deferred("<disasm error -- length exceeded>\n");
 							break;
 						}
 
-						log_msg("%c", instruction_data[3 + i]);
+						log_msg_deferred("%c", instruction_data[3 + i]);
 						i++;
 					}
-					log_msg("\"\n");
+					log_msg_deferred("\"\n");
 					i++;
 				}
 			}
@@ -795,7 +800,7 @@ namespace gameswf
 				int	reg_count = instruction_data[3 + i];
 				i++;
 
-				log_msg("\n\t\tname = '%s', arg_count = %d, reg_count = %d\n",
+				log_msg_deferred("\n\t\tname = '%s', arg_count = %d, reg_count = %d\n",
 					function_name, arg_count, reg_count);
 
 				uint16	flags = (instruction_data[3 + i]) | (instruction_data[3 + i + 1] << 8);
@@ -814,7 +819,7 @@ namespace gameswf
 				bool	suppress_this  = (flags & 0x02) != 0;
 				bool	preload_this   = (flags & 0x01) != 0;
 
-				log_msg("\t\t		pg = %d\n"
+				log_msg_deferred("\t\t		pg = %d\n"
 					"\t\t		pp = %d\n"
 					"\t\t		pr = %d\n"
 					"\t\tss = %d, ps = %d\n"
@@ -837,18 +842,18 @@ namespace gameswf
 					const char*	arg_name = (const char*) &instruction_data[3 + i];
 					i += (int) strlen(arg_name) + 1;
 
-					log_msg("\t\targ[%d] - reg[%d] - '%s'\n", argi, arg_register, arg_name);
+					log_msg_deferred("\t\targ[%d] - reg[%d] - '%s'\n", argi, arg_register, arg_name);
 				}
 
 				int	function_length = instruction_data[3 + i] | (instruction_data[3 + i + 1] << 8);
 				i += 2;
 
-				log_msg("\t\tfunction length = %d\n", function_length);
+				log_msg_deferred("\t\tfunction length = %d\n", function_length);
 			}
 		}
 		else
 		{
-			log_msg("\n");
+			log_msg_deferred("\n");
 		}
 	}
 
@@ -434,6 +434,52 @@ namespace gameswf
 #endif // 0
 	}
 
+
+	void	font::output_mapped_cache_data(mapped_cache_writer* out)
+	// Dump the tesselated glyph shapes.  Every glyph gets a flag,
+	// so NULL glyphs are cheap to skip when reading.
+	{
+		int	n = m_glyphs.size();
+		out->write_u32(n);
+		for (int i = 0; i < n; i++)
+		{
+			shape_character_def*	s = m_glyphs[i].get_ptr();
+			out->write_u32(s ? 1 : 0);
+			if (s)
+			{
+				s->output_mapped_cache_data(out);
+			}
+		}
+	}
+
+
+	void	font::input_mapped_cache_data(mapped_cache_reader* in)
+	// Read the glyph shapes written by output_mapped_cache_data().
+	{
+		int	n = in->read_u32();
+		if (n != m_glyphs.size())
+		{
+			log_error("error reading cache file in font::input_mapped_cache_data() "
+				  "glyph count mismatch.\n");
+			return;
+		}
+
+		for (int i = 0; i < n && in->get_error() == false; i++)
+		{
+			bool	present = in->read_u32() != 0;
+			if (present != (m_glyphs[i] != NULL))
+			{
+				log_error("error reading cache file in font::input_mapped_cache_data() "
+					  "glyph mismatch.\n");
+				return;
+			}
+			if (present)
+			{
+				m_glyphs[i]->input_mapped_cache_data(in);
+			}
+		}
+	}
+
 };	// end namespace gameswf
 
 
@@ -80,6 +80,8 @@ namespace gameswf
 
 		void	output_cached_data(tu_file* out, const cache_options& options);
 		void	input_cached_data(tu_file* in);
+		void	output_mapped_cache_data(mapped_cache_writer* out);
+		void	input_mapped_cache_data(mapped_cache_reader* in);
 
 		const tu_string& get_name() const { return m_fontname; }
 		void	set_name(const tu_string& name) { m_fontname = name; }
@@ -7,6 +7,7 @@
 
 
 #include "base/container.h"
+#include "base/tu_arena.h"
 #include "base/tu_file.h"
 #include "gameswf/gameswf.h"
 #include "gameswf/gameswf_font.h"
@@ -161,6 +162,9 @@ namespace gameswf
 	// Add the given rect to our list.  Eliminate any anchor
 	// points that are disqualified by this new rect.
 	{
+		// Not from a player's heap: these lists outlive players.
+		tu_arena::scoped_heap	no_arena(NULL);
+
 		s_covered_rects.push_back(r);
 
 		for (int i = 0; i < s_anchor_points.size(); i++)
@@ -179,6 +183,8 @@ namespace gameswf
 	void	add_anchor_point(const pointi& p)
 	// Add point to our list of anchors.  Keep the list sorted.
 	{
+		tu_arena::scoped_heap	no_arena(NULL);
+
 		// Add it to end, since we expect new points to be
 		// relatively greater than existing points.
 		s_anchor_points.push_back(p);
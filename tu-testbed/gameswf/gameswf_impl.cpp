@@ -10,6 +10,7 @@
 // http://sswf.sourceforge.net/SWFalexref.html
 // http://www.openswf.org
 
+#include "base/tu_arena.h"
 #include "base/tu_file.h"
 #include "base/utility.h"
 #include "gameswf/gameswf_action.h"
@@ -30,6 +31,7 @@
 #include "gameswf/gameswf_sprite.h"
 #include "gameswf/gameswf_function.h"
 #include "gameswf/gameswf_abc.h"
+#include "gameswf/gameswf_cache.h"
 #include "gameswf/gameswf_filters.h"
 #include "base/image.h"
 #include "base/jpeg.h"
@@ -165,6 +167,9 @@ namespace gameswf
 
 		if (s_registered == false)
 		{
+			// The loader table is shared by all players.
+			tu_arena::scoped_heap	no_arena(NULL);
+
 			// Register the standard loaders.
 			s_registered = true;
 			register_tag_loader(0, end_loader);
@@ -534,6 +539,32 @@ namespace gameswf
 	}
 
 
+	static bitmap_info*	create_bitmap_info(image::rgb* im, image::compressed** payload)
+	// Hand a loaded image to the renderer.  If get_compress_bitmaps(),
+	// it's block-compressed first, and *payload gets the compressed
+	// image, for cache files.
+	{
+		if (get_compress_bitmaps())
+		{
+			*payload = image::compress_bc1(im);
+			return render::create_bitmap_info_compressed(*payload);
+		}
+		return render::create_bitmap_info_rgb(im);
+	}
+
+
+	static bitmap_info*	create_bitmap_info(image::rgba* im, image::compressed** payload)
+	// As above, with alpha.
+	{
+		if (get_compress_bitmaps())
+		{
+			*payload = image::compress_bc3(im);
+			return render::create_bitmap_info_compressed(*payload);
+		}
+		return render::create_bitmap_info_rgba(im);
+	}
+
+
 	void	define_bits_jpeg_loader(stream* in, int tag_type, movie_definition_sub* m)
 	// A JPEG image without included tables; those should be in an
 	// existing jpeg::input object stored in the movie.
@@ -546,6 +577,7 @@ namespace gameswf
 		// Read the image data.
 		//
 		bitmap_info*	bi = NULL;
+		image::compressed*	payload = NULL;
 
 		if (m->get_create_bitmaps() == DO_LOAD_BITMAPS)
 		{
@@ -564,7 +596,7 @@ namespace gameswf
 				j_in->discard_partial_buffer();
 				im = image::read_swf_jpeg2_with_tables(j_in);
 			}
-			bi = render::create_bitmap_info_rgb(im);
+			bi = create_bitmap_info(im, &payload);
 			delete im;
 
 #else
@@ -577,7 +609,7 @@ namespace gameswf
 			bi = render::create_bitmap_info_empty();
 		}
 
-		bitmap_character*	ch = new bitmap_character(m, bi);
+		bitmap_character*	ch = new bitmap_character(m, bi, payload);
 
 		m->add_bitmap_character(character_id, ch);
 	}
@@ -614,12 +646,13 @@ namespace gameswf
 		//
 
 		bitmap_info*	bi = NULL;
+		image::compressed*	payload = NULL;
 
 		if (m->get_create_bitmaps() == DO_LOAD_BITMAPS)
 		{
 #if TU_CONFIG_LINK_TO_JPEGLIB
 			image::rgb* im = image::read_swf_jpeg2(in->get_underlying_stream());
-			bi = render::create_bitmap_info_rgb(im);
+			bi = create_bitmap_info(im, &payload);
 			delete im;
 #else
 			log_error("gameswf is not linked to jpeglib -- can't load jpeg image data!\n");
@@ -631,7 +664,7 @@ namespace gameswf
 			bi = render::create_bitmap_info_empty();
 		}
 
-		bitmap_character*	ch = new bitmap_character(m, bi);
+		bitmap_character*	ch = new bitmap_character(m, bi, payload);
 
 		m->add_bitmap_character(character_id, ch);
 	}
@@ -705,6 +738,7 @@ namespace gameswf
 		Uint32	alpha_position = in->get_position() + jpeg_size;
 
 		bitmap_info*	bi = NULL;
+		image::compressed*	payload = NULL;
 
 		if (m->get_create_bitmaps() == DO_LOAD_BITMAPS)
 		{
@@ -734,7 +768,7 @@ namespace gameswf
 
 			delete [] buffer;
 
-			bi = render::create_bitmap_info_rgba(im);
+			bi = create_bitmap_info(im, &payload);
 
 			delete im;
 #endif
@@ -746,7 +780,7 @@ namespace gameswf
 		}
 
 		// Create bitmap character.
-		bitmap_character*	ch = new bitmap_character(m, bi);
+		bitmap_character*	ch = new bitmap_character(m, bi, payload);
 
 		m->add_bitmap_character(character_id, ch);
 	}
@@ -769,6 +803,7 @@ namespace gameswf
 			height));
 
 		bitmap_info*	bi = NULL;
+		image::compressed*	payload = NULL;
 		if (m->get_create_bitmaps() == DO_LOAD_BITMAPS)
 		{
 #if TU_CONFIG_LINK_TO_ZLIB == 0
@@ -876,7 +911,7 @@ namespace gameswf
 				}
 
 				//				bitmap_character*	ch = new bitmap_character(image);
-				bi = render::create_bitmap_info_rgb(image);
+				bi = create_bitmap_info(image, &payload);
 				delete image;
 
 				//				// add image to movie, under character id.
@@ -978,7 +1013,7 @@ namespace gameswf
 					}
 				}
 
-				bi = render::create_bitmap_info_rgba(image);
+				bi = create_bitmap_info(image, &payload);
 				//				bitmap_character*	ch = new bitmap_character(image);
 				delete image;
 
@@ -992,7 +1027,7 @@ namespace gameswf
 			bi = render::create_bitmap_info_empty();
 		}
 
-		bitmap_character*	ch = new bitmap_character(m, bi);
+		bitmap_character*	ch = new bitmap_character(m, bi, payload);
 
 		// add image to movie, under character id.
 		m->add_bitmap_character(character_id, ch);
@@ -2016,9 +2051,10 @@ namespace gameswf
 
 	// Bitmap character implementation
 
-	bitmap_character::bitmap_character(movie_definition* rdef, bitmap_info* bi) :
+	bitmap_character::bitmap_character(movie_definition* rdef, bitmap_info* bi, image::compressed* payload) :
 		bitmap_character_def(rdef->get_player()),
-		m_bitmap_info(bi)
+		m_bitmap_info(bi),
+		m_payload(payload)
 	{
 		if (get_player()->get_log_bitmap_info() == true)
 		{
@@ -2114,6 +2150,83 @@ namespace gameswf
 		return m_bitmap_info.get_ptr();
 	}
 
+	bitmap_character::~bitmap_character()
+	{
+		delete m_payload;
+	}
+
+	void	bitmap_character::set_payload(image::compressed* payload)
+	// Use a compressed image from a cache file in place of whatever
+	// we loaded from the movie.
+	{
+		delete m_payload;
+		m_payload = payload;
+		m_bitmap_info = render::create_bitmap_info_compressed(payload);
+	}
+
+	void	bitmap_character::output_cached_data(tu_file* out, const cache_options& options)
+	{
+		out->write_byte(m_payload ? 1 : 0);
+		if (m_payload)
+		{
+			image::write_compressed(out, m_payload);
+		}
+	}
+
+	void	bitmap_character::input_cached_data(tu_file* in)
+	{
+		if (in->read_byte())
+		{
+			image::compressed*	payload = image::read_compressed(in);
+			if (payload == NULL)
+			{
+				log_error("bad bitmap in cache file\n");
+				return;
+			}
+			set_payload(payload);
+		}
+	}
+
+	void	bitmap_character::output_mapped_cache_data(mapped_cache_writer* out)
+	// Record: format, width, height, block data size and offset.
+	// Writes nothing if there's no compressed image, so the entry
+	// gets dropped.
+	{
+		if (m_payload)
+		{
+			out->write_u32(m_payload->m_type);
+			out->write_u32(m_payload->m_width);
+			out->write_u32(m_payload->m_height);
+			out->write_u32(m_payload->get_size());
+			out->write_u64(out->write_array(m_payload->m_data, m_payload->get_size()));
+		}
+	}
+
+	void	bitmap_character::input_mapped_cache_data(mapped_cache_reader* in)
+	{
+		int	type = in->read_u32();
+		int	width = in->read_u32();
+		int	height = in->read_u32();
+		Uint32	size = in->read_u32();
+		Uint64	offset = in->read_u64();
+		if (in->get_error()
+		    || (type != image::image_base::BC1 && type != image::image_base::BC3)
+		    || width <= 0 || width > 65535 || height <= 0 || height > 65535)
+		{
+			return;
+		}
+
+		image::compressed*	payload = image::create_compressed((image::image_base::id_image) type, width, height);
+		const void*	data = in->get_array(offset, size);
+		if (data == NULL || (int) size != payload->get_size())
+		{
+			delete payload;
+			return;
+		}
+		memcpy(payload->m_data, data, size);
+		set_payload(payload);
+	}
+
 }
 
 // Local Variables:
@@ -118,7 +118,11 @@ namespace gameswf
 	// Bitmap character
 	struct bitmap_character : public bitmap_character_def
 	{
-		bitmap_character(movie_definition* rdef, bitmap_info* bi);
+		// payload, if not NULL, is the block-compressed image
+		// bi was made from; we keep (and own) it, so it can go
+		// into cache files.
+		bitmap_character(movie_definition* rdef, bitmap_info* bi, image::compressed* payload = NULL);
+		~bitmap_character();
 
 		// Return true if the specified point is on the interior of our shape.
 		// Incoming coords are local coords.
@@ -128,9 +132,19 @@ namespace gameswf
 		virtual void	display(character* ch);
 		gameswf::bitmap_info*	get_bitmap_info();
 
+		// Cache the compressed image, if there is one.  Reading
+		// it back replaces the bitmap_info made at load time.
+		virtual void	output_cached_data(tu_file* out, const cache_options& options);
+		virtual void	input_cached_data(tu_file* in);
+		virtual void	output_mapped_cache_data(mapped_cache_writer* out);
+		virtual void	input_mapped_cache_data(mapped_cache_reader* in);
+
 		private:
 
+			void	set_payload(image::compressed* payload);
+
 			gc_ptr<gameswf::bitmap_info>	m_bitmap_info;
+			image::compressed*	m_payload;
 	};
 
 	// Execute tags include things that control the operation of
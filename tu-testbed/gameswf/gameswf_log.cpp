@@ -8,6 +8,7 @@
 
 #include "gameswf/gameswf_log.h"
 #include "gameswf/gameswf.h"
+#include "base/tu_async_log.h"
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -32,10 +33,6 @@ namespace gameswf
 	// Function pointer to log callback.
 	static void (*s_log_callback)(bool error, const char* message) = standard_logger;
 
-	// Workspace for vsnprintf formatting.
-	static const int	BUFFER_SIZE = 4096;
-	static char	s_buffer[BUFFER_SIZE];
-
 
 	void	register_log_callback(void (*callback)(bool error, const char* message))
 	// The host app can use this to install a function to receive log
@@ -47,14 +44,19 @@ namespace gameswf
 	}
 
 
-#ifdef _WIN32
-#define vsnprintf	_vsnprintf
-#endif // _WIN32
+	static void	write_message(int error, const char* message)
+	// tu_async_log hands finished messages to this.
+	{
+		if (s_log_callback)
+		{
+			s_log_callback(error != 0, message);
+		}
+	}
 
-#define FORMAT_INTO_BUFFER(fmt)				\
+#define POST_MESSAGE(post_func, error, fmt)		\
 		va_list ap;				\
 		va_start(ap, fmt);			\
-		vsnprintf(s_buffer, BUFFER_SIZE, fmt, ap);	\
+		post_func(write_message, error, fmt, ap);	\
 		va_end(ap);
 
 	void	log_msg(const char* fmt, ...)
@@ -65,9 +67,20 @@ namespace gameswf
 			return;
 		}
 
-		FORMAT_INTO_BUFFER(fmt);
+		POST_MESSAGE(tu_async_log::vpost, 0, fmt);
+	}
+
 
-		s_log_callback(false, s_buffer);
+	void	log_msg_deferred(const char* fmt, ...)
+	// Like log_msg(), but lets the log writer thread do the
+	// formatting.
+	{
+		if (s_log_callback == NULL)
+		{
+			return;
+		}
+
+		POST_MESSAGE(tu_async_log::vpost_deferred, 0, fmt);
 	}
 
 
@@ -79,9 +92,7 @@ namespace gameswf
 			return;
 		}
 
-		FORMAT_INTO_BUFFER(fmt);
-
-		s_log_callback(true, s_buffer);
+		POST_MESSAGE(tu_async_log::vpost, 1, fmt);
 	}
 }
 
@@ -14,13 +14,20 @@
 namespace gameswf
 {
 	// Printf-style interfaces.
+	//
+	// log_msg_deferred() is for hot spots like the action
+	// tracing: once tu_async_log is started, the formatting
+	// happens on the log writer thread, so fmt must be a string
+	// literal.
 
 #ifdef __GNUC__
 	// use the following to catch errors: (only with gcc)
 	void	log_msg(const char* fmt, ...) __attribute__((format (printf, 1, 2)));
+	void	log_msg_deferred(const char* fmt, ...) __attribute__((format (printf, 1, 2)));
 	void	log_error(const char* fmt, ...) __attribute__((format (printf, 1, 2)));
 #else	// not __GNUC__
 	exported_module void	log_msg(const char* fmt, ...);
+	exported_module void	log_msg_deferred(const char* fmt, ...);
 	exported_module void	log_error(const char* fmt, ...);
 #endif	// not __GNUC__
 
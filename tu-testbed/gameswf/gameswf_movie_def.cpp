@@ -14,6 +14,8 @@
 
 
 #include "base/tu_file.h"
+#include "base/tu_profile.h"
+#include "gameswf/gameswf_cache.h"
 #include "gameswf/gameswf_font.h"
 #include "gameswf/gameswf_sound.h"
 #include "gameswf/gameswf_stream.h"
@@ -483,6 +485,7 @@ namespace gameswf
 	// is running in loader thread
 	void	movie_def_impl::read_tags()
 	{
+		TU_PROFILE_ZONE("movie_def_impl::read_tags");
 
 		while ((Uint32) m_str->get_position() < m_file_end_pos && get_break_loading() == false)
 		{
@@ -500,6 +503,7 @@ namespace gameswf
 			{
 				// call the tag loader.	 The tag loader should add
 				// characters or tags to the movie data structure.
+				TU_PROFILE_ZONE("tag loader");
 				(*lf)(m_str, tag_type, this);
 
 			}
@@ -579,8 +583,9 @@ namespace gameswf
 		}
 	}
 
-	// Increment this when the cache data format changes.
-	#define CACHE_FILE_VERSION 6
+	// Increment this when the cache data format changes.  (7 is
+	// taken by MAPPED_CACHE_FILE_VERSION.)
+	#define CACHE_FILE_VERSION 8
 
 	void	movie_def_impl::output_cached_data(tu_file* out, const cache_options& options)
 	// Dump our cached data into the given stream.
@@ -608,6 +613,17 @@ namespace gameswf
 		}}
 
 		out->write_le16(static_cast<uint16>(-1));	// end of characters marker
+
+		// Write bitmap data.
+		{for (hash<int, gc_ptr<bitmap_character_def> >::iterator it = m_bitmap_characters.begin();
+		it != m_bitmap_characters.end();
+		++it)
+		{
+			out->write_le16(it->first);
+			it->second->output_cached_data(out, options);
+		}}
+
+		out->write_le16(static_cast<uint16>(-1));	// end of bitmaps marker
 	}
 
 	void	movie_def_impl::input_cached_data(tu_file* in)
@@ -664,6 +680,123 @@ namespace gameswf
 				return;
 			}
 		}
+
+		// Read the cached bitmap data.
+		for (;;)
+		{
+			if (in->get_error() != TU_FILE_NO_ERROR || in->get_eof())
+			{
+				log_error("error reading cache file (bitmaps); skipping\n");
+				return;
+			}
+
+			Sint16	id = in->read_le16();
+			if (id == (Sint16) -1) { break; }	// done
+
+			gc_ptr<bitmap_character_def> ch;
+			m_bitmap_characters.get(id, &ch);
+			if (ch != NULL)
+			{
+				ch->input_cached_data(in);
+			}
+			else
+			{
+				log_error("sync error in cache file (reading bitmaps)!  "
+					"Skipping rest of cache data.\n");
+				return;
+			}
+		}
+	}
+
+	bool	movie_def_impl::write_mapped_cache_file(tu_file* out, Uint32 source_hash, Uint32 source_length)
+	// Write our cached data in the mapped format.  Each character
+	// and font gets an entry in the table of contents, so the reader
+	// doesn't depend on the order or completeness of m_characters.
+	{
+		mapped_cache_writer	w(out, source_hash, source_length);
+
+		for (hash<int, gc_ptr<character_def> >::iterator it = m_characters.begin();
+			it != m_characters.end();
+			++it)
+		{
+			w.begin_entry(it->first, mapped_cache_entry::CHARACTER);
+			it->second->output_mapped_cache_data(&w);
+			w.end_entry();
+		}
+
+		for (hash<int, gc_ptr<font> >::iterator it = m_fonts.begin();
+			it != m_fonts.end();
+			++it)
+		{
+			if (it->second->get_owning_movie() == this)
+			{
+				w.begin_entry(it->first, mapped_cache_entry::FONT);
+				it->second->output_mapped_cache_data(&w);
+				w.end_entry();
+			}
+		}
+
+		for (hash<int, gc_ptr<bitmap_character_def> >::iterator it = m_bitmap_characters.begin();
+			it != m_bitmap_characters.end();
+			++it)
+		{
+			w.begin_entry(it->first, mapped_cache_entry::BITMAP);
+			it->second->output_mapped_cache_data(&w);
+			w.end_entry();
+		}
+
+		return w.finish();
+	}
+
+	void	movie_def_impl::use_mapped_cache(cache_image* image)
+	// Point our characters' meshes at the data in the given mapped
+	// cache file.  The caller has already checked that the image
+	// belongs to our .swf.
+	{
+		assert(image);
+		smart_ptr<cache_image>	hold(image);
+
+		const mapped_cache_header&	h = image->get_header();
+		const mapped_cache_entry*	entries = (const mapped_cache_entry*)
+			image->get_range(h.m_entry_table_offset, (Uint64) h.m_entry_count * sizeof(mapped_cache_entry));
+		assert(entries);	// cache_image::map() checks the table bounds
+
+		for (Uint32 i = 0; i < h.m_entry_count; i++)
+		{
+			const mapped_cache_entry&	e = entries[i];
+			mapped_cache_reader	r(image, e.m_record_offset);
+
+			if (e.m_kind == mapped_cache_entry::CHARACTER)
+			{
+				gc_ptr<character_def>	ch;
+				if (m_characters.get(e.m_id, &ch) && ch != NULL)
+				{
+					ch->input_mapped_cache_data(&r);
+				}
+			}
+			else if (e.m_kind == mapped_cache_entry::FONT)
+			{
+				gc_ptr<font>	f;
+				if (m_fonts.get(e.m_id, &f) && f != NULL)
+				{
+					f->input_mapped_cache_data(&r);
+				}
+			}
+			else if (e.m_kind == mapped_cache_entry::BITMAP)
+			{
+				gc_ptr<bitmap_character_def>	ch;
+				if (m_bitmap_characters.get(e.m_id, &ch) && ch != NULL)
+				{
+					ch->input_mapped_cache_data(&r);
+				}
+			}
+
+			if (r.get_error())
+			{
+				log_error("corrupt entry for id %d in mapped cache file; skipping rest of cache data\n", e.m_id);
+				return;
+			}
+		}
 	}
 
 	// flash9
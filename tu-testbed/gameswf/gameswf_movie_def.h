@@ -24,6 +24,7 @@ namespace gameswf
 	struct action_buffer;
 	struct bitmap_character_def;
 	struct bitmap_info;
+	struct cache_image;
 	struct character;
 	struct character_def;
 	struct display_info;
@@ -56,6 +57,11 @@ namespace gameswf
 		virtual void	output_cached_data(tu_file* out, const cache_options& options) = 0;
 		virtual void	input_cached_data(tu_file* in) = 0;
 
+		// Mapped cache format (see gameswf_cache.h).  The source
+		// hash & length identify the .swf the cache belongs to.
+		virtual bool	write_mapped_cache_file(tu_file* out, Uint32 source_hash, Uint32 source_length) { return false; }
+		virtual void	use_mapped_cache(cache_image* image) {}
+
 		// Causes this movie def to generate texture-mapped
 		// versions of all the fonts it owns.  This improves
 		// speed and quality of text rendering.	 The
@@ -394,6 +400,8 @@ namespace gameswf
 
 		void	output_cached_data(tu_file* out, const cache_options& options);
 		void	input_cached_data(tu_file* in);
+		bool	write_mapped_cache_file(tu_file* out, Uint32 source_hash, Uint32 source_length);
+		void	use_mapped_cache(cache_image* image);
 
 		virtual bool is_multithread() const { return m_thread != NULL; }
 
@@ -9,6 +9,7 @@
 #include "base/tu_timer.h"
 #include "base/tu_file.h"
 #include "base/tu_random.h"
+#include "gameswf/gameswf_cache.h"
 #include "gameswf/gameswf_player.h"
 #include "gameswf/gameswf_object.h"
 #include "gameswf/gameswf_action.h"
@@ -27,6 +28,7 @@
 #include "gameswf/gameswf_as_classes/as_string.h"
 #include "gameswf/gameswf_as_classes/as_color.h"
 #include "gameswf/gameswf_as_classes/as_date.h"
+#include "gameswf/gameswf_as_classes/as_xml.h"
 #include "gameswf/gameswf_as_classes/as_xmlsocket.h"
 #include "gameswf/gameswf_as_classes/as_loadvars.h"
 #include "gameswf/gameswf_as_classes/as_flash.h"
@@ -85,6 +87,19 @@ namespace gameswf
 		s_use_cache_files = use_cache;
 	}
 
+	static bool	s_compress_bitmaps = false;
+
+	void	set_compress_bitmaps(bool compress)
+	// Enable/disable block compression of bitmaps as they're loaded.
+	{
+		s_compress_bitmaps = compress;
+	}
+
+	bool	get_compress_bitmaps()
+	{
+		return s_compress_bitmaps;
+	}
+
 
 	int player::s_player_count = 0;
 
@@ -217,6 +232,14 @@ namespace gameswf
 		// Flash9
 		map->add("addFrameScript", sprite_add_script);
 
+		// as_xmlnode builtins
+		map = new_standard_method_map(BUILTIN_XMLNODE_METHOD);
+		map->add("appendChild", as_xmlnode_append_child);
+		map->add("cloneNode", as_xmlnode_clone_node);
+		map->add("hasChildNodes", as_xmlnode_has_child_nodes);
+		map->add("insertBefore", as_xmlnode_insert_before);
+		map->add("removeNode", as_xmlnode_remove_node);
+		map->add("toString", as_xmlnode_to_string);
 	}
 
 	// Standard property lookup.
@@ -368,6 +391,16 @@ namespace gameswf
 			s_standard_property_map.add("enabled", M_ENABLED);
 			s_standard_property_map.add("password", M_PASSWORD);
 			s_standard_property_map.add("onMouseMove", M_MOUSE_MOVE);
+			s_standard_property_map.add("nodeType", M_NODE_TYPE);
+			s_standard_property_map.add("nodeName", M_NODE_NAME);
+			s_standard_property_map.add("nodeValue", M_NODE_VALUE);
+			s_standard_property_map.add("firstChild", M_FIRST_CHILD);
+			s_standard_property_map.add("lastChild", M_LAST_CHILD);
+			s_standard_property_map.add("nextSibling", M_NEXT_SIBLING);
+			s_standard_property_map.add("previousSibling", M_PREVIOUS_SIBLING);
+			s_standard_property_map.add("parentNode", M_PARENT_NODE);
+			s_standard_property_map.add("childNodes", M_CHILD_NODES);
+			s_standard_property_map.add("attributes", M_ATTRIBUTES);
 		}
 
 		as_standard_member	result = M_INVALID_MEMBER;
@@ -438,14 +471,20 @@ namespace gameswf
 
 	player::player() :
 		m_force_realtime_framerate(false),
-		m_log_bitmap_info(false)
+		m_log_bitmap_info(false),
+		m_arena(tu_arena::create_heap())
 	{
+		tu_arena::scoped_heap	arena(m_arena);
+
 		m_global = new as_object(this);
 
 		action_init();
 
 		if (s_player_count == 0)
 		{
+			// Shared by all players, so not on our heap.
+			tu_arena::scoped_heap	no_arena(NULL);
+
 			// timer should be inited only once
 			tu_timer::init_timer();
 
@@ -500,6 +539,10 @@ namespace gameswf
 		gameswf_engine_mutex().unlock();
 
 		action_clear();
+
+		// Blocks still in use (e.g. by our members, or by the
+		// host) keep the arena alive until they're freed.
+		tu_arena::destroy_heap(m_arena);
 	}
 
 	void player::set_flash_vars(const tu_string& param)
@@ -538,7 +581,8 @@ namespace gameswf
 		m_global->builtin_member("SharedObject", new as_sharedobject(this));
 		m_global->builtin_member("Mouse", new as_mouse(this));
 
-		//			m_global->set_member("XML", as_value(xml_new));
+		m_global->builtin_member("XML", as_global_xml_ctor);
+		m_global->builtin_member("XMLNode", as_global_xmlnode_ctor);
 		m_global->builtin_member("MovieClipLoader", as_global_mcloader_ctor);
 		m_global->builtin_member("String", get_global_string_ctor(this));
 		m_global->builtin_member("Number", as_global_number_ctor);
@@ -749,6 +793,33 @@ namespace gameswf
 			// Try to load a .gsc file.
 			tu_string	cache_filename(filename);
 			cache_filename += ".gsc";
+
+			// Prefer the mapped format; its meshes are used
+			// straight from the file.
+			smart_ptr<cache_image>	image = cache_image::map(cache_filename.c_str());
+			if (image != NULL)
+			{
+				Uint32	source_length = 0;
+				Uint32	source_hash = 0;
+				tu_file*	source_in = s_opener_function(filename);
+				if (source_in && source_in->get_error() == TU_FILE_NO_ERROR)
+				{
+					source_hash = compute_source_hash(source_in, &source_length);
+				}
+				delete source_in;
+
+				if (source_hash == image->get_header().m_source_hash
+					&& source_length == image->get_header().m_source_length)
+				{
+					m->use_mapped_cache(image.get_ptr());
+				}
+				else
+				{
+					log_msg("cache file '%s' is stale; ignoring it\n", cache_filename.c_str());
+				}
+				return m;
+			}
+
 			tu_file*	cache_in = s_opener_function(cache_filename.c_str());
 			if (cache_in == NULL
 				|| cache_in->get_error() != TU_FILE_NO_ERROR)
@@ -771,6 +842,8 @@ namespace gameswf
 	gc_ptr<root> player::load_file(const char* infile)
 	// Load the actual movie.
 	{
+		tu_arena::scoped_heap	arena(m_arena);
+
 		gc_ptr<gameswf::movie_definition>	md = create_movie(infile);
 		if (md == NULL)
 		{
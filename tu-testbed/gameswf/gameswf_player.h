@@ -13,6 +13,7 @@
 
 #include "base/utility.h"
 #include "base/tu_loadlib.h"
+#include "base/tu_arena.h"
 #include "gameswf/gameswf_object.h"
 
 namespace gameswf
@@ -45,6 +46,11 @@ namespace gameswf
 		// it's used to watch texture memory
 		bool m_log_bitmap_info;
 
+		// Small allocations (ActionScript objects, strings,
+		// containers) made while loading or running our movies
+		// come from here, and go away together with the player.
+		tu_arena::heap* m_arena;
+
 		// Players count to release all static stuff at the right time
 		static int s_player_count;
 
@@ -12,8 +12,16 @@
 
 #include "base/tu_file.h"
 #include "base/container.h"
+#include "base/file_util.h"
 #include "gameswf/gameswf.h"
 #include "gameswf/gameswf_impl.h"
+#include "gameswf/gameswf_cache.h"
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 
 static bool	s_verbose = false;
@@ -71,6 +79,12 @@ static void	print_usage()
 		"\n"
 		"  -h          Print this info.\n"
 		"  -w          Write a .gsc file with preprocessed info, for each input file.\n"
+		"  -m          Write the .gsc files in the mapped format, which loads\n"
+		"              without copying.  Implies -w.\n"
+		"  -c          Block-compress bitmaps (BC1, or BC3 with alpha) into the\n"
+		"              .gsc files, so they can be uploaded without decoding.\n"
+		"  -d <dir>    Process every .swf file in the given directory.\n"
+		"  -j <n>      Process the files with n worker processes (not on win32).\n"
 		"  -v          Be verbose; i.e. print log messages to stdout\n"
 		"  -vp         Be verbose about movie parsing\n"
 		"  -va         Be verbose about ActionScript\n"
@@ -87,9 +101,12 @@ struct movie_data
 
 static gameswf::movie_definition*	play_movie(gameswf::player* player, const char* filename);
 static int	write_cache_file(const movie_data& md);
+static int	process_files(const array<tu_string>& infiles, int first, int stride);
+static int	process_files_in_parallel(const array<tu_string>& infiles, int jobs);
 
 
 static bool	s_do_output = false;
+static bool	s_do_mapped_output = false;
 static bool	s_stop_on_errors = true;
 
 
@@ -97,7 +114,8 @@ int	main(int argc, char *argv[])
 {
 	assert(tu_types_validate());
 
-	array<const char*> infiles;
+	array<tu_string> infiles;
+	int	jobs = 1;
 
 	for (int arg = 1; arg < argc; arg++)
 	{
@@ -116,6 +134,45 @@ int	main(int argc, char *argv[])
 				// Write cache files.
 				s_do_output = true;
 			}
+			else if (argv[arg][1] == 'm')
+			{
+				// Write mapped cache files.
+				s_do_output = true;
+				s_do_mapped_output = true;
+			}
+			else if (argv[arg][1] == 'c')
+			{
+				// Put compressed bitmaps in the cache files.
+				gameswf::set_compress_bitmaps(true);
+			}
+			else if (argv[arg][1] == 'd')
+			{
+				// Process a whole directory.
+				arg++;
+				if (arg >= argc)
+				{
+					printf("-d requires a directory name\n");
+					print_usage();
+					exit(1);
+				}
+				if (file_util::list_files(argv[arg], "swf", &infiles) == false)
+				{
+					fprintf(stderr, "error: can't read directory '%s'\n", argv[arg]);
+					exit(1);
+				}
+			}
+			else if (argv[arg][1] == 'j')
+			{
+				// Number of worker processes.
+				arg++;
+				if (arg >= argc || atoi(argv[arg]) < 1)
+				{
+					printf("-j requires a positive number of jobs\n");
+					print_usage();
+					exit(1);
+				}
+				jobs = atoi(argv[arg]);
+			}
 			else if (argv[arg][1] == 'v')
 			{
 				// Be verbose; i.e. print log messages to stdout.
@@ -146,6 +203,19 @@ int	main(int argc, char *argv[])
 		print_usage();
 		exit(1);
 	}
+
+	if (jobs > 1 && infiles.size() > 1)
+	{
+		return process_files_in_parallel(infiles, jobs);
+	}
+	return process_files(infiles, 0, 1);
+}
+
+
+int	process_files(const array<tu_string>& infiles, int first, int stride)
+// Play through infiles[first], infiles[first + stride], ... and
+// write their cache files.  Returns 0 on success.
+{
 	gameswf::gc_ptr<gameswf::player> player = new gameswf::player();
 	gameswf::register_file_opener_callback(file_opener);
 	gameswf::register_log_callback(log_callback);
@@ -154,15 +224,15 @@ int	main(int argc, char *argv[])
 	array<movie_data>	data;
 
 	// Play through all the movies.
-	for (int i = 0, n = infiles.size(); i < n; i++)
+	for (int i = first, n = infiles.size(); i < n; i += stride)
 	{
-		gameswf::movie_definition*	m = play_movie(player.get_ptr(), infiles[i]);
+		gameswf::movie_definition*	m = play_movie(player.get_ptr(), infiles[i].c_str());
 		if (m == NULL)
 		{
 			if (s_stop_on_errors)
 			{
 				// Fail.
-				fprintf(stderr, "error playing through movie '%s', quitting\n", infiles[i]);
+				fprintf(stderr, "error playing through movie '%s', quitting\n", infiles[i].c_str());
 				exit(1);
 			}
 		}
@@ -195,6 +265,58 @@ int	main(int argc, char *argv[])
 }
 
 
+int	process_files_in_parallel(const array<tu_string>& infiles, int jobs)
+// Split the files across worker processes.  gameswf keeps global
+// state (the player, render & sound handlers), so separate processes
+// are the simplest safe unit of parallelism.
+{
+#ifdef _WIN32
+	printf("note: -j is not supported on win32; processing serially\n");
+	return process_files(infiles, 0, 1);
+#else
+	if (jobs > infiles.size())
+	{
+		jobs = infiles.size();
+	}
+
+	array<pid_t>	workers;
+	for (int i = 0; i < jobs; i++)
+	{
+		fflush(stdout);
+		fflush(stderr);
+		pid_t	pid = fork();
+		if (pid == 0)
+		{
+			// Child.
+			int	child_result = process_files(infiles, i, jobs);
+			fflush(stdout);
+			fflush(stderr);
+			_exit(child_result);
+		}
+		else if (pid < 0)
+		{
+			fprintf(stderr, "error: can't fork worker process\n");
+			break;
+		}
+		workers.push_back(pid);
+	}
+
+	int	result = workers.size() == jobs ? 0 : 1;
+	for (int i = 0; i < workers.size(); i++)
+	{
+		int	status = 0;
+		if (waitpid(workers[i], &status, 0) != workers[i]
+			|| WIFEXITED(status) == false
+			|| WEXITSTATUS(status) != 0)
+		{
+			result = 1;
+		}
+	}
+	return result;
+#endif
+}
+
+
 gameswf::movie_definition*	play_movie(gameswf::player* player, const char* filename)
 // Load the named movie, make an instance, and play it, virtually.
 // I.e. run through and render all the frames, even though we are not
@@ -285,8 +407,20 @@ int	write_cache_file(const movie_data& md)
 	if (out.get_error() == TU_FILE_NO_ERROR)
 	{
 		// Write out the data.
-		gameswf::cache_options	opt;
-		md.m_movie->output_cached_data(&out, opt);
+		if (s_do_mapped_output)
+		{
+			// The mapped format is tied to the exact .swf it
+			// was made from.
+			tu_file	source(md.m_filename.c_str(), "rb");
+			Uint32	source_length = 0;
+			Uint32	source_hash = gameswf::compute_source_hash(&source, &source_length);
+			md.m_movie->write_mapped_cache_file(&out, source_hash, source_length);
+		}
+		else
+		{
+			gameswf::cache_options	opt;
+			md.m_movie->output_cached_data(&out, opt);
+		}
 		if (out.get_error() == TU_FILE_NO_ERROR)
 		{
 			printf(
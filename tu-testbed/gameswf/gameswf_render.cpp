@@ -25,6 +25,16 @@ namespace gameswf
 	}
 
 
+	bitmap_info*	render_handler::create_bitmap_info_compressed(image::compressed* im)
+	// Default, for handlers that only take uncompressed images.
+	{
+		image::rgba*	decoded = image::decompress(im);
+		bitmap_info*	bi = create_bitmap_info_rgba(decoded);
+		delete decoded;
+		return bi;
+	}
+
+
 	namespace render
 	{
 		struct bogus_bi : public bitmap_info
@@ -56,6 +66,12 @@ namespace gameswf
 			else return new bogus_bi;
 		}
 
+		bitmap_info*	create_bitmap_info_compressed(image::compressed* im)
+		{
+			if (s_render_handler) return s_render_handler->create_bitmap_info_compressed(im);
+			else return new bogus_bi;
+		}
+
 		video_handler*	create_video_handler()
 		{
 			if (s_render_handler) return s_render_handler->create_video_handler();
@@ -25,6 +25,7 @@ namespace gameswf
 		bitmap_info*	create_bitmap_info_alpha(int w, int h, unsigned char* data);
 		bitmap_info*	create_bitmap_info_rgb(image::rgb* im);
 		bitmap_info*	create_bitmap_info_rgba(image::rgba* im);
+		bitmap_info*	create_bitmap_info_compressed(image::compressed* im);
 		video_handler*	create_video_handler();
 
 		// Bracket the displaying of a frame from a movie.
@@ -104,8 +104,21 @@ PFNGLUNIFORM1IPROC glUniform1i = 0;
 
 typedef void (APIENTRY* PFNGLUSEPROGRAMPROC) (GLuint program);
 PFNGLUSEPROGRAMPROC glUseProgram = 0;
+
+typedef void (APIENTRY* PFNGLCOMPRESSEDTEXIMAGE2DARBPROC) (GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data);
+PFNGLCOMPRESSEDTEXIMAGE2DARBPROC _glCompressedTexImage2DARB = 0;
 #endif  // TU_USE_SDL
 
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// True if we can upload BC1/BC3 blocks as they are.
+static bool s_s3tc_available = false;
+
 static GLint s_num_compressed_format = 0;
 void create_texture(int format, int w, int h, void* data, int level)
 {
@@ -435,6 +448,7 @@ struct bitmap_info_ogl : public gameswf::bitmap_info
 	bitmap_info_ogl(int width, int height, Uint8* data);
 	bitmap_info_ogl(image::rgb* im);
 	bitmap_info_ogl(image::rgba* im);
+	bitmap_info_ogl(image::compressed* im);
 
 	virtual void layout();
 
@@ -449,6 +463,7 @@ struct bitmap_info_ogl : public gameswf::bitmap_info
 				case image::image_base::RGB: return 3;
 				case image::image_base::RGBA: return 4;
 				case image::image_base::ALPHA: return 1;
+				// (compressed images have no bytes per pixel)
 			};
 		}
 		return 0;
@@ -456,7 +471,7 @@ struct bitmap_info_ogl : public gameswf::bitmap_info
 
 	virtual unsigned char* get_data() const
 	{
-		if (m_suspended_image)
+		if (m_suspended_image && get_bpp() > 0)
 		{
 			return m_suspended_image->m_data;
 		}
@@ -667,6 +682,12 @@ struct render_handler_ogl : public gameswf::render_handler
 		glUniform1f = (PFNGLUNIFORM1FPROC) SDL_GL_GetProcAddress("glUniform1f");
 		glUniform1i = (PFNGLUNIFORM1IPROC) SDL_GL_GetProcAddress("glUniform1i");
 		glUseProgram = (PFNGLUSEPROGRAMPROC) SDL_GL_GetProcAddress("glUseProgram");
+		_glCompressedTexImage2DARB = (PFNGLCOMPRESSEDTEXIMAGE2DARBPROC) SDL_GL_GetProcAddress("glCompressedTexImage2DARB");
+
+		const char*	extensions = (const char*) glGetString(GL_EXTENSIONS);
+		s_s3tc_available = _glCompressedTexImage2DARB
+			&& extensions
+			&& strstr(extensions, "GL_EXT_texture_compression_s3tc");
 #endif
 		glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS_ARB, &s_num_compressed_format);
 	}
@@ -954,6 +975,15 @@ struct render_handler_ogl : public gameswf::render_handler
 	}
 
 
+	gameswf::bitmap_info*	create_bitmap_info_compressed(image::compressed* im)
+	// Block-compressed version.  The blocks go to the card as
+	// they are if it supports S3TC; otherwise they're decoded when
+	// the texture is made.
+	{
+		return new bitmap_info_ogl(im);
+	}
+
+
 	gameswf::bitmap_info*	create_bitmap_info_empty()
 	// Create a placeholder bitmap_info.  Used when
 	// DO_NOT_LOAD_BITMAPS is set; then later on the host program
@@ -1779,6 +1809,17 @@ bitmap_info_ogl::bitmap_info_ogl(image::rgb* im) :
 	memcpy(m_suspended_image->m_data, im->m_data, im->m_pitch * im->m_height);
 }
 
+bitmap_info_ogl::bitmap_info_ogl(image::compressed* im) :
+	m_texture_id(0),
+	m_width(im->m_width),
+	m_height(im->m_height)
+{
+	assert(im);
+	image::compressed*	copy = image::create_compressed(im->m_type, im->m_width, im->m_height);
+	memcpy(copy->m_data, im->m_data, im->get_size());
+	m_suspended_image = copy;
+}
+
 // layout image to opengl texture memory
 void bitmap_info_ogl::layout()
 {
@@ -1802,6 +1843,28 @@ void bitmap_info_ogl::layout()
 		int bpp = 4;
 		int format = GL_RGBA;
 
+		if (m_suspended_image->m_type == image::image_base::BC1
+		    || m_suspended_image->m_type == image::image_base::BC3)
+		{
+			image::compressed*	im = (image::compressed*) m_suspended_image;
+			if (s_s3tc_available && p2(im->m_width) == im->m_width && p2(im->m_height) == im->m_height)
+			{
+#if TU_USE_SDL == 1
+				_glCompressedTexImage2DARB(GL_TEXTURE_2D, 0,
+					im->m_type == image::image_base::BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+					im->m_width, im->m_height, 0, im->get_size(), im->m_data);
+#endif
+				delete m_suspended_image;
+				m_suspended_image = NULL;
+				return;
+			}
+
+			// The card can't take it as is (or it needs
+			// rescaling); decode it, and carry on.
+			m_suspended_image = image::decompress(im);
+			delete im;
+		}
+
 		switch (m_suspended_image->m_type)
 		{
 			case image::image_base::RGB:
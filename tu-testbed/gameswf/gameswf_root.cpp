@@ -14,6 +14,7 @@
 #include "gameswf/gameswf_render.h"
 #include "gameswf/gameswf_root.h"
 #include "gameswf/gameswf_sprite.h"
+#include "base/tu_profile.h"
 #include "base/tu_random.h"
 
 #ifdef _WIN32
@@ -596,6 +597,9 @@ namespace gameswf
 
 	void	root::advance(float delta_time)
 	{
+		TU_PROFILE_ZONE("root::advance");
+		tu_arena::scoped_heap	arena(m_player->m_arena);
+
 		// Lock gameswf engine. Video is running in separate thread and
 		// it calls gameswf functions from separate thread to set
 		// status of netstream object
@@ -679,6 +683,9 @@ namespace gameswf
 
 	void	root::display()
 	{
+		TU_PROFILE_ZONE("root::display");
+		tu_arena::scoped_heap	arena(m_player != NULL ? m_player->m_arena : NULL);
+
 		if (m_movie->get_visible() == false)
 		{
 			// Don't display.
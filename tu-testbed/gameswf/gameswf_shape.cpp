@@ -367,16 +367,47 @@ namespace gameswf
 		return in->read_le16();
 	}
 
-	void	write_coord_array(tu_file* out, const array<coord_component>& pt_array)
+	void	write_coord_array(tu_file* out, const coord_component* coords, int n)
 	// Dump the given coordinate array into the given stream.
 	{
-		int	n = pt_array.size();
-
 		out->write_le32(n);
 		for (int i = 0; i < n; i++)
 		{
-			write_le<coord_component>(out, pt_array[i]);
+			write_le<coord_component>(out, coords[i]);
+		}
+	}
+
+
+	void	write_coord_array(tu_file* out, const array<coord_component>& pt_array)
+	{
+		write_coord_array(out, pt_array.size() ? &pt_array[0] : NULL, pt_array.size());
+	}
+
+
+	Uint64	write_mapped_coord_array(mapped_cache_writer* out, const coord_component* coords, int n)
+	// Put the coordinates in the mapped file and write the record
+	// (count, offset) that refers to them.
+	{
+		out->write_u32(n);
+		Uint64	offset = out->write_array(coords, n * sizeof(coord_component));
+		out->write_u64(offset);
+		return offset;
+	}
+
+
+	const coord_component*	read_mapped_coord_array(mapped_cache_reader* in, int* n)
+	// Counterpart to write_mapped_coord_array(); returns a pointer
+	// into the mapped file.
+	{
+		*n = in->read_u32();
+		Uint64	offset = in->read_u64();
+		const coord_component*	coords =
+			(const coord_component*) in->get_array(offset, (Uint64) *n * sizeof(coord_component));
+		if (coords == NULL)
+		{
+			*n = 0;
 		}
+		return coords;
 	}
 
 
@@ -399,6 +430,11 @@ namespace gameswf
 
 	
 	mesh::mesh()
+		:
+		m_mapped_triangle_strip(NULL),
+		m_mapped_triangle_strip_size(0),
+		m_mapped_triangle_list(NULL),
+		m_mapped_triangle_list_size(0)
 	{
 	}
 
@@ -437,16 +473,32 @@ namespace gameswf
 			style.apply(0, ratio, bm);
 			render::draw_mesh_strip(&m_triangle_strip[0], m_triangle_strip.size() >> 1);
 		}
+		else if (m_mapped_triangle_strip_size > 0)
+		{
+			style.apply(0, ratio, bm);
+			render::draw_mesh_strip(m_mapped_triangle_strip, m_mapped_triangle_strip_size >> 1);
+		}
 		if (m_triangle_list.size() > 0) {
 			style.apply(0, ratio, bm);
 			render::draw_triangle_list(&m_triangle_list[0], m_triangle_list.size() >> 1);
 		}
+		else if (m_mapped_triangle_list_size > 0)
+		{
+			style.apply(0, ratio, bm);
+			render::draw_triangle_list(m_mapped_triangle_list, m_mapped_triangle_list_size >> 1);
+		}
 	}
 
 
 	void	mesh::output_cached_data(tu_file* out)
 	// Dump our data to *out.
 	{
+		if (m_mapped_triangle_strip || m_mapped_triangle_list)
+		{
+			write_coord_array(out, m_mapped_triangle_strip, m_mapped_triangle_strip_size);
+			write_coord_array(out, m_mapped_triangle_list, m_mapped_triangle_list_size);
+			return;
+		}
 		write_coord_array(out, m_triangle_strip);
 		write_coord_array(out, m_triangle_list);
 	}
@@ -460,6 +512,30 @@ namespace gameswf
 	}
 
 
+	void	mesh::output_mapped_cache_data(mapped_cache_writer* out) const
+	// Put our coordinates in the mapped file.
+	{
+		if (m_mapped_triangle_strip || m_mapped_triangle_list)
+		{
+			write_mapped_coord_array(out, m_mapped_triangle_strip, m_mapped_triangle_strip_size);
+			write_mapped_coord_array(out, m_mapped_triangle_list, m_mapped_triangle_list_size);
+			return;
+		}
+		write_mapped_coord_array(out, m_triangle_strip.size() ? &m_triangle_strip[0] : NULL, m_triangle_strip.size());
+		write_mapped_coord_array(out, m_triangle_list.size() ? &m_triangle_list[0] : NULL, m_triangle_list.size());
+	}
+
+
+	void	mesh::input_mapped_cache_data(mapped_cache_reader* in)
+	// Point at our coordinates inside the mapped file; no copying.
+	{
+		m_triangle_strip.resize(0);
+		m_triangle_list.resize(0);
+		m_mapped_triangle_strip = read_mapped_coord_array(in, &m_mapped_triangle_strip_size);
+		m_mapped_triangle_list = read_mapped_coord_array(in, &m_mapped_triangle_list_size);
+	}
+
+
 	//
 	// line_strip
 	//
@@ -468,14 +544,18 @@ namespace gameswf
 	line_strip::line_strip()
 	// Default constructor, for array<>.
 		:
-		m_style(-1)
+		m_style(-1),
+		m_mapped_coords(NULL),
+		m_mapped_coords_size(0)
 	{}
 
 
 	line_strip::line_strip(int style, const point coords[], int coord_count)
 	// Construct the line strip (polyline) made up of the given sequence of points.
 		:
-		m_style(style)
+		m_style(style),
+		m_mapped_coords(NULL),
+		m_mapped_coords_size(0)
 	{
 		assert(style >= 0);
 		assert(coords != NULL);
@@ -497,6 +577,18 @@ namespace gameswf
 	void	line_strip::display(const base_line_style& style, float ratio) const
 	// Render this line strip in the given style.
 	{
+		if (m_mapped_coords)
+		{
+			if (m_mapped_coords_size < 4)
+			{
+				// Less than one segment; nothing to draw.
+				return;
+			}
+			style.apply(ratio);
+			render::draw_line_strip(m_mapped_coords, m_mapped_coords_size >> 1);
+			return;
+		}
+
 		assert(m_coords.size() > 1);
 		assert((m_coords.size() & 1) == 0);
 
@@ -509,6 +601,11 @@ namespace gameswf
 	// Dump our data to *out.
 	{
 		out->write_le32(m_style);
+		if (m_mapped_coords)
+		{
+			write_coord_array(out, m_mapped_coords, m_mapped_coords_size);
+			return;
+		}
 		write_coord_array(out, m_coords);
 	}
 
@@ -521,6 +618,26 @@ namespace gameswf
 	}
 
 
+	void	line_strip::output_mapped_cache_data(mapped_cache_writer* out) const
+	{
+		out->write_u32(m_style);
+		if (m_mapped_coords)
+		{
+			write_mapped_coord_array(out, m_mapped_coords, m_mapped_coords_size);
+			return;
+		}
+		write_mapped_coord_array(out, m_coords.size() ? &m_coords[0] : NULL, m_coords.size());
+	}
+
+
+	void	line_strip::input_mapped_cache_data(mapped_cache_reader* in)
+	{
+		m_style = in->read_u32();
+		m_coords.resize(0);
+		m_mapped_coords = read_mapped_coord_array(in, &m_mapped_coords_size);
+	}
+
+
 	// Utility: very simple greedy tri-stripper.  Useful for
 	// stripping the stacks of trapezoids that come out of our
 	// tesselator.
@@ -987,6 +1104,89 @@ namespace gameswf
 	}
 
 
+	void	mesh_set::output_mapped_cache_data(mapped_cache_writer* out) const
+	// Same structure as output_cached_data(), but the coordinate
+	// arrays go in the mapped file's aligned array area.
+	{
+		out->write_float(m_error_tolerance);
+
+		int layer_n = m_layers.size();
+		out->write_u32(layer_n);
+
+		for (int j = 0; j < layer_n; j++) {
+			const layer& l = m_layers[j];
+
+			int	mesh_n = l.m_meshes.size();
+			out->write_u32(mesh_n);
+			for (int i = 0; i < mesh_n; i++)
+			{
+				if (l.m_meshes[i]) {
+					out->write_u32(1);
+					l.m_meshes[i]->output_mapped_cache_data(out);
+				} else {
+					out->write_u32(0);
+				}
+			}
+
+			int	lines_n = l.m_line_strips.size();
+			out->write_u32(lines_n);
+			{for (int i = 0; i < lines_n; i++)
+			{
+				l.m_line_strips[i]->output_mapped_cache_data(out);
+			}}
+		}
+	}
+
+
+	void	mesh_set::input_mapped_cache_data(mapped_cache_reader* in)
+	// Build our layers on top of the mapped file.  Only the small
+	// mesh/line_strip headers are allocated; coordinates stay in
+	// the mapping, which we keep a reference to.
+	{
+		// Smallest possible records, for bounding the counts
+		// against what's left in the image.
+		static const int	LAYER_BYTES = 4 + 4;	// mesh_n, lines_n
+		static const int	MESH_BYTES = 4;	// present flag
+		static const int	LINE_STRIP_BYTES = 4 + 4 + 8;	// style, coord count, offset
+
+		m_cache_image = in->get_image();
+		m_error_tolerance = in->read_float();
+
+		int layer_n = in->read_count(LAYER_BYTES);
+		m_layers.resize(layer_n);
+		for (int j = 0; j < layer_n && in->get_error() == false; j++) {
+			layer* l = &m_layers[j];
+
+			int	mesh_n = in->read_count(MESH_BYTES);
+			l->m_meshes.resize(mesh_n);
+			for (int i = 0; i < mesh_n && in->get_error() == false; i++)
+			{
+				l->m_meshes[i] = NULL;
+				Uint32	present = in->read_u32();
+				if (present && in->get_error() == false) {
+					l->m_meshes[i] = new mesh;
+					l->m_meshes[i]->input_mapped_cache_data(in);
+				}
+			}
+
+			int	lines_n = in->read_count(LINE_STRIP_BYTES);
+			l->m_line_strips.resize(lines_n);
+			{for (int i = 0; i < lines_n && in->get_error() == false; i++)
+			{
+				l->m_line_strips[i] = new line_strip;
+				l->m_line_strips[i]->input_mapped_cache_data(in);
+			}}
+		}
+
+		if (in->get_error())
+		{
+			// Corrupt or truncated; don't keep pointers into it.
+			m_layers.resize(0);
+			m_cache_image = NULL;
+		}
+	}
+
+
 	//
 	// helper functions.
 	//
@@ -1768,6 +1968,46 @@ namespace gameswf
 			m_cached_meshes[i] = ms;
 		}
 	}
+
+
+	void	shape_character_def::output_mapped_cache_data(mapped_cache_writer* out)
+	// Dump our precomputed meshes into a mapped cache file.
+	{
+		int	n = m_cached_meshes.size();
+		out->write_u32(n);
+		for (int i = 0; i < n; i++)
+		{
+			m_cached_meshes[i]->output_mapped_cache_data(out);
+		}
+	}
+
+
+	void	shape_character_def::input_mapped_cache_data(mapped_cache_reader* in)
+	// Use the meshes in a mapped cache file.
+	{
+		// error tolerance + layer count
+		int	n = in->read_count(4 + 4);
+		if (in->get_error())
+		{
+			return;
+		}
+
+		flush_cache();
+		m_cached_meshes.resize(n);
+		for (int i = 0; i < n; i++)
+		{
+			mesh_set*	ms = new mesh_set();
+			ms->input_mapped_cache_data(in);
+			m_cached_meshes[i] = ms;
+		}
+
+		if (in->get_error())
+		{
+			// Drop the partial cache; the meshes get
+			// tesselated again on demand.
+			flush_cache();
+		}
+	}
 	
 	void    shape_character_def::flush_cache()
 	{
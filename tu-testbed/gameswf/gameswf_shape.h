@@ -11,6 +11,7 @@
 
 
 #include "gameswf/gameswf_styles.h"
+#include "gameswf/gameswf_cache.h"
 
 
 namespace gameswf
@@ -86,9 +87,18 @@ namespace gameswf
 
 		void	output_cached_data(tu_file* out);
 		void	input_cached_data(tu_file* in);
+		void	output_mapped_cache_data(mapped_cache_writer* out) const;
+		void	input_mapped_cache_data(mapped_cache_reader* in);
 	private:
 		array<coord_component>	m_triangle_strip;// TODO remove
 		array<coord_component> m_triangle_list;
+
+		// When loaded from a mapped cache file, the coordinates
+		// are used in place and the arrays above stay empty.
+		const coord_component*	m_mapped_triangle_strip;
+		int	m_mapped_triangle_strip_size;
+		const coord_component*	m_mapped_triangle_list;
+		int	m_mapped_triangle_list_size;
 	};
 
 
@@ -103,9 +113,15 @@ namespace gameswf
 		int	get_style() const { return m_style; }
 		void	output_cached_data(tu_file* out);
 		void	input_cached_data(tu_file* in);
+		void	output_mapped_cache_data(mapped_cache_writer* out) const;
+		void	input_mapped_cache_data(mapped_cache_reader* in);
 	private:
 		int	m_style;
 		array<coord_component>	m_coords;
+
+		// Points into a mapped cache file instead of m_coords.
+		const coord_component*	m_mapped_coords;
+		int	m_mapped_coords_size;
 	};
 
 
@@ -131,11 +147,16 @@ namespace gameswf
 		
 		void	output_cached_data(tu_file* out);
 		void	input_cached_data(tu_file* in);
+		void	output_mapped_cache_data(mapped_cache_writer* out) const;
+		void	input_mapped_cache_data(mapped_cache_reader* in);
 
 	private:
 		void expand_styles_to_include(int style);
 		
 		float	m_error_tolerance;
+
+		// Keeps the mapping alive while our meshes point into it.
+		smart_ptr<cache_image>	m_cache_image;
 		struct layer {
 			array<mesh*> m_meshes;  // one mesh per style.
 			array<line_strip*> m_line_strips;
@@ -172,6 +193,8 @@ namespace gameswf
 
 		void	output_cached_data(tu_file* out, const cache_options& options);
 		void	input_cached_data(tu_file* in);
+		virtual void	output_mapped_cache_data(mapped_cache_writer* out);
+		virtual void	input_mapped_cache_data(mapped_cache_reader* in);
 
 		const array<fill_style>&	get_fill_styles() const { return m_fill_styles; }
 		const array<line_style>&	get_line_styles() const { return m_line_styles; }
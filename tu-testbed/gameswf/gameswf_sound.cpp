@@ -88,7 +88,8 @@ namespace gameswf
 			int	data_bytes = 0;
 			unsigned char*	data = NULL;
 
-			if (format == sound_handler::FORMAT_ADPCM)
+			if (format == sound_handler::FORMAT_ADPCM
+			    && s_sound_handler->can_decode(sound_handler::FORMAT_ADPCM) == false)
 			{
 				// Uncompress the ADPCM before handing data to host.
 				data_bytes = sample_count * (stereo ? 4 : 2);
@@ -98,6 +99,9 @@ namespace gameswf
 			}
 			else
 			{
+				// Pass the data through as-is.  (ADPCM lands
+				// here only if the handler decodes it itself.)
+				//
 				// @@ This is pretty awful -- lots of copying, slow reading.
 				data_bytes = in->get_tag_end_position() - in->get_position();
 				data = new unsigned char[data_bytes];
@@ -444,6 +448,27 @@ namespace gameswf
 	}
 
 
+	void	adpcm_decode_code(int n_bits, int raw_code, int* sample, int* stepsize_index)
+	// Decode a single ADPCM code, for handlers that decode as they
+	// play instead of all at once.
+	{
+		int	s = *sample;
+		int	index = *stepsize_index;
+
+		switch (n_bits)
+		{
+		default: assert(0); break;
+		case 2: DO_SAMPLE(2, s, index, raw_code); break;
+		case 3: DO_SAMPLE(3, s, index, raw_code); break;
+		case 4: DO_SAMPLE(4, s, index, raw_code); break;
+		case 5: DO_SAMPLE(5, s, index, raw_code); break;
+		}
+
+		*sample = s;
+		*stepsize_index = index;
+	}
+
+
 };	// end namespace gameswf
 
 
@@ -14,6 +14,12 @@ namespace gameswf
 {
 	int get_sample_rate(int index);
 
+	// ADPCM decoding step, shared with sound handlers that decode
+	// FORMAT_ADPCM themselves (see sound_handler::can_decode()).
+	// sample & stepsize_index are in/out parameters; the first
+	// stepsize_index of a block is the 6-bit value from the stream.
+	void	adpcm_decode_code(int n_bits, int raw_code, int* sample, int* stepsize_index);
+
 	struct sound_envelope
 	{
 		Uint32 m_mark44;
@@ -0,0 +1,487 @@
+// gameswf_sound_handler_offline.cpp	-- render a movie's sound to a WAV file
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// See gameswf_sound_handler_offline.h.  The mixer runs on the
+// caller's thread, inside advance(), so it needs no audio lock.
+
+
+#include "gameswf/gameswf_sound_handler_offline.h"
+#include "gameswf/gameswf_log.h"
+#include "gameswf/gameswf_root.h"
+#include "base/tu_file.h"
+#include "base/tu_timer.h"
+#include "base/utility.h"
+#include <string.h>
+
+#if TU_CONFIG_LINK_TO_FFMPEG == 1
+#include <ffmpeg/avformat.h>
+#endif
+
+
+namespace gameswf
+{
+	// advance() renders in blocks of this many frames.
+	static const int	BUFFER_FRAMES = 4096;
+
+	static const int	WAV_HEADER_BYTES = 44;
+
+	// advance() calls mix() on the game thread, so there's
+	// nothing to hold off.
+	static void	lock_audio() {}
+	static void	unlock_audio() {}
+
+
+	offline_sound_handler::offline_sound_handler(const char* wav_filename, int sample_rate)
+		:
+		m_mixer(NULL),
+		m_file(NULL),
+		m_sample_rate(sample_rate),
+		m_max_volume(1.0f),
+		m_time(0),
+		m_frames_written(0),
+		m_render_ticks(0),
+		m_buffer(NULL),
+		m_aux_buffer(NULL)
+	{
+		assert(wav_filename);
+		assert(sample_rate > 0);
+
+		m_mixer = new sound_mixer(m_sample_rate);
+		m_mixer->set_audio_lock(lock_audio, unlock_audio);
+		m_buffer = new Sint16[BUFFER_FRAMES * 2];
+		m_aux_buffer = new Sint16[BUFFER_FRAMES * 2];
+
+#if TU_CONFIG_LINK_TO_FFMPEG == 1
+		avcodec_init();
+		av_log_set_level(-1);		// do not print ffmeg messages
+		avcodec_register_all();
+#endif
+
+		m_file = new tu_file(wav_filename, "wb");
+		if (m_file->get_error() != TU_FILE_NO_ERROR)
+		{
+			log_error("offline_sound_handler: can't create %s\n", wav_filename);
+			delete m_file;
+			m_file = NULL;
+			return;
+		}
+
+		// The sizes get filled in by close().
+		write_header(0);
+	}
+
+
+	offline_sound_handler::~offline_sound_handler()
+	{
+		close();
+		delete m_mixer;
+		delete [] m_buffer;
+		delete [] m_aux_buffer;
+	}
+
+
+	void	offline_sound_handler::close()
+	{
+		if (m_file == NULL)
+		{
+			return;
+		}
+
+		Uint64	data_bytes = m_frames_written * 4;
+		if (data_bytes > 0xFFFFFFFFU - WAV_HEADER_BYTES)
+		{
+			log_error("offline_sound_handler: too much audio for a WAV file\n");
+			data_bytes = 0xFFFFFFFFU - WAV_HEADER_BYTES;
+		}
+
+		m_file->set_position(0);
+		write_header((Uint32) data_bytes);
+
+		delete m_file;
+		m_file = NULL;
+	}
+
+
+	void	offline_sound_handler::write_header(Uint32 data_bytes)
+	// Canonical 44-byte header for 16-bit stereo PCM.
+	{
+		m_file->write_bytes("RIFF", 4);
+		m_file->write_le32(WAV_HEADER_BYTES - 8 + data_bytes);
+		m_file->write_bytes("WAVE", 4);
+
+		m_file->write_bytes("fmt ", 4);
+		m_file->write_le32(16);
+		m_file->write_le16(1);	// PCM
+		m_file->write_le16(2);	// channels
+		m_file->write_le32(m_sample_rate);
+		m_file->write_le32(m_sample_rate * 4);	// bytes per second
+		m_file->write_le16(4);	// bytes per frame
+		m_file->write_le16(16);	// bits per sample
+
+		m_file->write_bytes("data", 4);
+		m_file->write_le32(data_bytes);
+	}
+
+
+	bool	offline_sound_handler::can_decode(format_type format)
+	{
+		return format == FORMAT_ADPCM;
+	}
+
+
+	int	offline_sound_handler::load_sound(const char* url)
+	{
+		tu_file	in(url, "rb");
+		if (in.get_error() != TU_FILE_NO_ERROR)
+		{
+			log_error("loadSound: can't load %s\n", url);
+			return -1;
+		}
+
+		char	tag[4];
+		in.read_bytes(tag, 4);
+		in.read_le32();
+		if (memcmp(tag, "RIFF", 4) != 0 || in.read_bytes(tag, 4) != 4 || memcmp(tag, "WAVE", 4) != 0)
+		{
+			log_error("loadSound: %s is not a WAV file\n", url);
+			return -1;
+		}
+
+		int	channels = 0;
+		int	freq = 0;
+		int	bits = 0;
+		while (in.read_bytes(tag, 4) == 4)
+		{
+			int	chunk_bytes = in.read_le32();
+			if (chunk_bytes < 0)
+			{
+				break;
+			}
+
+			int	chunk_start = in.get_position();
+			if (memcmp(tag, "fmt ", 4) == 0)
+			{
+				int	format = in.read_le16();
+				channels = in.read_le16();
+				freq = in.read_le32();
+				in.read_le32();	// bytes per second
+				in.read_le16();	// bytes per frame
+				bits = in.read_le16();
+				if (format != 1 || (bits != 8 && bits != 16) || channels < 1 || channels > 2)
+				{
+					log_error("loadSound: %s: only 8 or 16-bit PCM WAV files are supported\n", url);
+					return -1;
+				}
+			}
+			else if (memcmp(tag, "data", 4) == 0 && bits != 0)
+			{
+				int	frame_bytes = channels * bits / 8;
+				int	frames = chunk_bytes / frame_bytes;
+				int	samples = frames * channels;
+
+				Sint16*	data = new Sint16[samples > 0 ? samples : 1];
+				for (int i = 0; i < samples; i++)
+				{
+					if (bits == 8)
+					{
+						data[i] = (Sint16) (((int) in.read_byte() - 128) << 8);
+					}
+					else
+					{
+						data[i] = (Sint16) in.read_le16();
+					}
+				}
+
+				int	id = create_sound(data, samples * 2, frames, FORMAT_NATIVE16,
+							  freq, channels == 2);
+				delete [] data;
+				return id;
+			}
+
+			// Chunks are padded to an even size.
+			in.set_position(chunk_start + ((chunk_bytes + 1) & ~1));
+		}
+
+		log_error("loadSound: %s has no sound data\n", url);
+		return -1;
+	}
+
+
+	int	offline_sound_handler::create_sound(
+		void* data,
+		int data_bytes,
+		int sample_count,
+		format_type format,
+		int sample_rate,
+		bool stereo)
+	{
+		return m_mixer->create_sample(data, data_bytes, sample_count, format, sample_rate, stereo);
+	}
+
+
+	void	offline_sound_handler::append_sound(int sound_handle, void* data, int data_bytes)
+	{
+		m_mixer->append_sample(sound_handle, data, data_bytes);
+	}
+
+
+	void	offline_sound_handler::play_sound(as_object* listener_obj, int sound_handle, int loop_count)
+	{
+		if (m_mixer->play(sound_handle, loop_count) == false)
+		{
+			return;
+		}
+
+		if (listener_obj)
+		{
+			gc_ptr<listener>&	l = m_listeners[sound_handle];
+			if (l == NULL)
+			{
+				l = new listener();
+			}
+			l->add(listener_obj);
+		}
+	}
+
+
+	void	offline_sound_handler::set_max_volume(int vol)
+	{
+		if (vol >= 0 && vol <= 100)
+		{
+			m_max_volume = (float) vol / 100.0f;
+			m_mixer->set_master_volume(vol);
+		}
+	}
+
+
+	void	offline_sound_handler::stop_sound(int sound_handle)
+	{
+		m_mixer->stop(sound_handle);
+	}
+
+
+	void	offline_sound_handler::delete_sound(int sound_handle)
+	{
+		m_listeners.erase(sound_handle);
+		m_mixer->delete_sample(sound_handle);
+	}
+
+
+	void	offline_sound_handler::stop_all_sounds()
+	{
+		m_mixer->stop_all();
+	}
+
+
+	int	offline_sound_handler::get_volume(int sound_handle)
+	{
+		return m_mixer->get_volume(sound_handle);
+	}
+
+
+	void	offline_sound_handler::set_volume(int sound_handle, int volume)
+	{
+		m_mixer->set_volume(sound_handle, volume);
+	}
+
+
+	void	offline_sound_handler::pause(int sound_handle, bool paused)
+	{
+		m_mixer->pause(sound_handle, paused);
+	}
+
+
+	int	offline_sound_handler::get_position(int sound_handle)
+	{
+		return m_mixer->get_position(sound_handle);
+	}
+
+
+	void	offline_sound_handler::attach_aux_streamer(aux_streamer_ptr ptr, as_object* netstream)
+	{
+		assert(netstream);
+		assert(ptr);
+		m_aux_mutex.lock();
+		m_aux_streamer[netstream] = ptr;
+		m_aux_mutex.unlock();
+	}
+
+
+	void	offline_sound_handler::detach_aux_streamer(as_object* netstream)
+	{
+		m_aux_mutex.lock();
+		m_aux_streamer.erase(netstream);
+		m_aux_mutex.unlock();
+	}
+
+
+	void	offline_sound_handler::cvt(short int** adjusted_data, int* adjusted_size, unsigned char* data,
+					   int size, int channels, int freq)
+	// Linear interpolation to our rate, mono -> stereo.
+	{
+		*adjusted_data = NULL;
+		*adjusted_size = 0;
+
+		if (channels < 1 || channels > 2 || freq <= 0)
+		{
+			log_error("offline_sound_handler: can't convert %d channels at %d Hz\n", channels, freq);
+			return;
+		}
+
+		const Sint16*	in = (const Sint16*) data;
+		int	in_frames = size / (2 * channels);
+		if (in_frames <= 0)
+		{
+			return;
+		}
+
+		int	out_frames = (int) (((Sint64) in_frames * m_sample_rate + freq / 2) / freq);
+		Sint16*	out = (Sint16*) malloc(out_frames * 4);
+
+		// 16.16 fixed-point source position.
+		Sint64	step = ((Sint64) freq << 16) / m_sample_rate;
+		Sint64	pos = 0;
+		for (int i = 0; i < out_frames; i++, pos += step)
+		{
+			int	i0 = (int) (pos >> 16);
+			int	frac = (int) (pos & 0xFFFF);
+			if (i0 >= in_frames - 1)
+			{
+				i0 = in_frames - 1;
+				frac = 0;
+			}
+			int	i1 = imin(i0 + 1, in_frames - 1);
+
+			for (int c = 0; c < 2; c++)
+			{
+				int	ch = channels == 2 ? c : 0;
+				int	s0 = in[i0 * channels + ch];
+				int	s1 = in[i1 * channels + ch];
+				out[i * 2 + c] = (Sint16) (s0 + (((s1 - s0) * frac) >> 16));
+			}
+		}
+
+		*adjusted_data = out;
+		*adjusted_size = out_frames * 4;
+	}
+
+
+	void	offline_sound_handler::render(int frame_count)
+	// Mix the next frame_count frames and append them to the file.
+	{
+		assert(frame_count > 0 && frame_count <= BUFFER_FRAMES);
+
+		m_mixer->mix(m_buffer, frame_count);
+
+		// mix audio of video
+		int	bytes = frame_count * 4;
+		int	volume = (int) (256 * m_max_volume);
+		m_aux_mutex.lock();
+		for (hash<as_object*, aux_streamer_ptr>::const_iterator it = m_aux_streamer.begin();
+		     it != m_aux_streamer.end();
+		     ++it)
+		{
+			memset(m_aux_buffer, 0, bytes);
+			(it->second)(it->first, (Uint8*) m_aux_buffer, bytes);
+
+			for (int i = 0; i < frame_count * 2; i++)
+			{
+				int	s = m_buffer[i] + ((m_aux_buffer[i] * volume) >> 8);
+				m_buffer[i] = (Sint16) iclamp(s, -32768, 32767);
+			}
+		}
+		m_aux_mutex.unlock();
+
+#ifndef _TU_LITTLE_ENDIAN_
+		for (int i = 0; i < frame_count * 2; i++)
+		{
+			Uint16	s = (Uint16) m_buffer[i];
+			m_buffer[i] = (Sint16) ((s >> 8) | (s << 8));
+		}
+#endif
+
+		if (m_file->write_bytes(m_buffer, bytes) != bytes)
+		{
+			log_error("offline_sound_handler: write failed\n");
+			close();
+			return;
+		}
+		m_frames_written += frame_count;
+	}
+
+
+	void	offline_sound_handler::advance(float delta_time)
+	{
+		if (m_file && delta_time > 0)
+		{
+			Uint64	start = tu_timer::get_profile_ticks();
+
+			// Derive the frame count from the running total, so
+			// rounding doesn't drift no matter how the time is
+			// sliced up.
+			m_time += delta_time;
+			Uint64	target = (Uint64) (m_time * m_sample_rate + 0.5);
+			while (m_file && m_frames_written < target)
+			{
+				Uint64	remaining = target - m_frames_written;
+				render(remaining < BUFFER_FRAMES ? (int) remaining : BUFFER_FRAMES);
+			}
+
+			m_render_ticks += tu_timer::get_profile_ticks() - start;
+		}
+
+		array<int>	completed;
+		m_mixer->update(&completed);
+
+		// notify onSoundComplete
+		if (completed.size() > 0)
+		{
+			gameswf_engine_mutex().lock();
+			for (int i = 0, n = completed.size(); i < n; i++)
+			{
+				gc_ptr<listener>	l;
+				if (m_listeners.get(completed[i], &l) && l != NULL)
+				{
+					l->notify(event_id::ON_SOUND_COMPLETE);
+				}
+			}
+			gameswf_engine_mutex().unlock();
+		}
+	}
+
+
+	double	offline_sound_handler::get_rendered_seconds() const
+	{
+		return (double) m_frames_written / m_sample_rate;
+	}
+
+
+	double	offline_sound_handler::get_render_seconds() const
+	{
+		return tu_timer::profile_ticks_to_seconds(m_render_ticks);
+	}
+
+
+	void	offline_sound_handler::get_mixer_stats(mixer_stats* stats) const
+	{
+		m_mixer->get_stats(stats);
+	}
+
+
+	sound_handler*	create_sound_handler_offline(const char* wav_filename, int sample_rate)
+	// Factory.
+	{
+		return new offline_sound_handler(wav_filename, sample_rate);
+	}
+
+}	// end namespace gameswf
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
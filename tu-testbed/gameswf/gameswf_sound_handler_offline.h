@@ -0,0 +1,121 @@
+// gameswf_sound_handler_offline.h	-- render a movie's sound to a WAV file
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// A sound_handler with no audio device.  Each advance() mixes
+// exactly delta_time seconds of sound and appends it to a 16-bit
+// stereo WAV file, so the output depends only on the sequence of
+// delta times the host feeds in, and it's produced as fast as the
+// CPU can mix it.  Drive root::advance() with fixed steps (e.g.
+// gameswf_test_ogl -r 0 -o out.wav) for reproducible audio, or for
+// benchmarking the mixer.
+
+
+#ifndef GAMESWF_SOUND_HANDLER_OFFLINE_H
+#define GAMESWF_SOUND_HANDLER_OFFLINE_H
+
+
+#include "gameswf/gameswf.h"
+#include "gameswf/gameswf_listener.h"
+#include "gameswf/gameswf_mutex.h"
+#include "gameswf/gameswf_sound_mixer.h"
+#include "base/container.h"
+
+
+class tu_file;
+
+
+namespace gameswf
+{
+
+	struct offline_sound_handler : public sound_handler
+	{
+		offline_sound_handler(const char* wav_filename, int sample_rate);
+		virtual ~offline_sound_handler();	// calls close()
+
+		// False if the WAV file couldn't be created.
+		virtual bool is_open() { return m_file != NULL; }
+
+		// We decode ADPCM as it plays.
+		virtual bool can_decode(format_type format);
+
+		// Loads an uncompressed 8 or 16-bit PCM .WAV file.
+		virtual int	load_sound(const char* url);
+
+		virtual int	create_sound(void* data, int data_bytes,
+			int sample_count, format_type format,
+			int sample_rate, bool stereo);
+		virtual void	append_sound(int sound_handle, void* data, int data_bytes);
+		virtual void	play_sound(as_object* listener_obj, int sound_handle, int loop_count);
+		virtual void	set_max_volume(int vol);
+		virtual void	stop_sound(int sound_handle);
+		virtual void	delete_sound(int sound_handle);
+		virtual void	stop_all_sounds();
+		virtual int	get_volume(int sound_handle);
+		virtual void	set_volume(int sound_handle, int volume);
+		virtual void	pause(int sound_handle, bool paused);
+		virtual int	get_position(int sound_handle);
+
+		virtual void	attach_aux_streamer(aux_streamer_ptr ptr, as_object* netstream);
+		virtual void	detach_aux_streamer(as_object* netstream);
+
+		// Converts 16-bit native-endian input to our output
+		// format.  The result is malloc()'d.
+		virtual void	cvt(short int** adjusted_data, int* adjusted_size, unsigned char* data,
+				    int size, int channels, int freq);
+
+		// Renders delta_time seconds of sound into the file,
+		// then sends onSoundComplete.
+		virtual void	advance(float delta_time);
+
+		// Fills in the WAV header and closes the file.  Further
+		// advance() calls are ignored.
+		void	close();
+
+		// Seconds of audio written so far.
+		double	get_rendered_seconds() const;
+
+		// Wall-clock seconds spent in advance() producing it,
+		// including the file writes.
+		double	get_render_seconds() const;
+
+		// Mixer CPU time etc.; see sound_mixer.
+		void	get_mixer_stats(mixer_stats* stats) const;
+
+	private:
+		void	render(int frame_count);
+		void	write_header(Uint32 data_bytes);
+
+		sound_mixer*	m_mixer;
+		tu_file*	m_file;
+		int	m_sample_rate;
+		float	m_max_volume;
+
+		// NetStream audio callbacks.  NetStream detaches from
+		// its decoder thread, so they're guarded by m_aux_mutex.
+		hash<as_object* /* netstream */, aux_streamer_ptr /* callback */>	m_aux_streamer;
+		tu_mutex	m_aux_mutex;
+
+		// onSoundComplete event listeners, by sound handle.
+		hash<int, gc_ptr<listener> >	m_listeners;
+
+		double	m_time;	// total of the delta times we've been given
+		Uint64	m_frames_written;
+		Uint64	m_render_ticks;
+		Sint16*	m_buffer;
+		Sint16*	m_aux_buffer;
+	};
+
+}	// end namespace gameswf
+
+
+#endif // GAMESWF_SOUND_HANDLER_OFFLINE_H
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
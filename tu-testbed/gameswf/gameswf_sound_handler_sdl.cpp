@@ -8,6 +8,10 @@
 
 #ifdef TU_USE_SDL
 
+#if TU_CONFIG_LINK_TO_FFMPEG == 1
+#include <ffmpeg/avformat.h>
+#endif
+
 #pragma comment (lib, "SDL.lib")
 
 
@@ -16,9 +20,15 @@ namespace gameswf
 	tu_mutex& gameswf_engine_mutex();
 	static void sdl_audio_callback(void *udata, Uint8 *stream, int len); // SDL C audio handler
 
+	static void lock_audio() { SDL_LockAudio(); }
+	static void unlock_audio() { SDL_UnlockAudio(); }
+
 	SDL_sound_handler::SDL_sound_handler():
+		m_aux_count(0),
+		m_mixer(NULL),
 		m_max_volume(1.0f),
-		m_is_open(true)
+		m_is_open(true),
+		m_is_paused(true)
 	{
 		// This is our sound settings
 		m_audioSpec.freq = 44100;
@@ -28,11 +38,13 @@ namespace gameswf
 		m_audioSpec.userdata = this;
 		m_audioSpec.samples = 4096;
 
+		m_mixer = new sound_mixer(m_audioSpec.freq);
+		m_mixer->set_audio_lock(lock_audio, unlock_audio);
+
 #if TU_CONFIG_LINK_TO_FFMPEG == 1
 		avcodec_init();
 		av_log_set_level(-1);		// do not print ffmeg messages
 		avcodec_register_all();
-		m_MP3_codec = avcodec_find_decoder(CODEC_ID_MP3);
 #endif
 
 		if (SDL_OpenAudio(&m_audioSpec, NULL) < 0 )
@@ -48,7 +60,12 @@ namespace gameswf
 	SDL_sound_handler::~SDL_sound_handler()
 	{
 		if (m_is_open) SDL_CloseAudio();
-		m_sound.clear();
+		delete m_mixer;
+	}
+
+	bool SDL_sound_handler::can_decode(format_type format)
+	{
+		return format == FORMAT_ADPCM;
 	}
 
 	// loads external sound file
@@ -89,14 +106,7 @@ namespace gameswf
 		// Called to create a sample.  We'll return a sample ID that
 		// can be use for playing it.
 	{
-		m_mutex.lock();
-
-		int sound_id = m_sound.size();
-		m_sound[sound_id] = new sound(data_bytes, (Uint8*) data, format,
-			sample_count, sample_rate, stereo);
-
-		m_mutex.unlock();
-		return sound_id;
+		return m_mixer->create_sample(data, data_bytes, sample_count, format, sample_rate, stereo);
 	}
 
 	void	SDL_sound_handler::set_max_volume(int vol)
@@ -104,107 +114,65 @@ namespace gameswf
 		if (vol >= 0 && vol <= 100)
 		{
 			m_max_volume = (float) vol / 100.0f;
+			m_mixer->set_master_volume(vol);
 		}
 	}
 
 	void	SDL_sound_handler::append_sound(int sound_handle, void* data, int data_bytes)
 	{
-		m_mutex.lock();
-		hash<int, gc_ptr<sound> >::iterator it = m_sound.find(sound_handle);
-		if (it != m_sound.end())
-		{
-			it->second->append(data, data_bytes, this);
-		}
-		m_mutex.unlock();
+		m_mixer->append_sample(sound_handle, data, data_bytes);
 	}
 
 	void SDL_sound_handler::pause(int sound_handle, bool paused)
 	{
-		m_mutex.lock();
-
-		hash<int, gc_ptr<sound> >::iterator it = m_sound.find(sound_handle);
-		if (it != m_sound.end())
-		{
-			it->second->pause(paused);
-		}
-
-		m_mutex.unlock();
+		m_mixer->pause(sound_handle, paused);
 	}
 
 	void	SDL_sound_handler::play_sound(as_object* listener_obj, int sound_handle, int loops)
 	// Play the index'd sample.
 	{
-		m_mutex.lock();
+		if (m_mixer->play(sound_handle, loops) == false)
+		{
+			return;
+		}
 
-		hash<int, gc_ptr<sound> >::iterator it = m_sound.find(sound_handle);
-		if (it != m_sound.end())
+		if (listener_obj)
 		{
-			if (listener_obj)
+			// create listener
+			gc_ptr<listener>& l = m_listeners[sound_handle];
+			if (l == NULL)
 			{
-				// create listener
-				if (it->second->m_listeners == NULL)
-				{
-					it->second->m_listeners = new listener();
-				}
-				it->second->m_listeners->add(listener_obj);
+				l = new listener();
 			}
-
-			it->second->play(loops, this);
+			l->add(listener_obj);
 		}
 
-		m_mutex.unlock();
+		set_device_paused(false);
 	}
 
 	void	SDL_sound_handler::stop_sound(int sound_handle)
 	{
-		m_mutex.lock();
-
-		hash<int, gc_ptr<sound> >::iterator it = m_sound.find(sound_handle);
-		if (it != m_sound.end())
-		{
-			it->second->clear_playlist();
-		}
-
-		m_mutex.unlock();
+		m_mixer->stop(sound_handle);
 	}
 
 
 	void	SDL_sound_handler::delete_sound(int sound_handle)
 	// this gets called when it's done with a sample.
 	{
-		m_mutex.lock();
-
-		//		stop_sound(sound_handle);
-		m_sound.erase(sound_handle);
-
-		m_mutex.unlock();
+		m_listeners.erase(sound_handle);
+		m_mixer->delete_sample(sound_handle);
 	}
 
 	void	SDL_sound_handler::stop_all_sounds()
 	{
-		m_mutex.lock();
-
-		for (hash<int, gc_ptr<sound> >::iterator it = m_sound.begin(); it != m_sound.end(); ++it)
-		{
-			it->second->clear_playlist();
-		}
-		m_mutex.unlock();
+		m_mixer->stop_all();
 	}
 
 	//	returns the sound volume level as an integer from 0 to 100,
 	//	where 0 is off and 100 is full volume. The default setting is 100.
 	int	SDL_sound_handler::get_volume(int sound_handle)
 	{
-		m_mutex.lock();
-
-		int vol = 0;
-		hash<int, gc_ptr<sound> >::iterator it = m_sound.find(sound_handle);
-		if (it != m_sound.end())
-		{
-			vol = it->second->get_volume();
-		}
-		m_mutex.unlock();
-		return vol;
+		return m_mixer->get_volume(sound_handle);
 	}
 
 
@@ -212,15 +180,7 @@ namespace gameswf
 	//	100 is full volume and 0 is no volume. The default setting is 100.
 	void	SDL_sound_handler::set_volume(int sound_handle, int volume)
 	{
-		m_mutex.lock();
-
-		hash<int, gc_ptr<sound> >::iterator it = m_sound.find(sound_handle);
-		if (it != m_sound.end())
-		{
-			it->second->set_volume(volume);
-		}
-
-		m_mutex.unlock();
+		m_mixer->set_volume(sound_handle, volume);
 	}
 
 	void	SDL_sound_handler::attach_aux_streamer(aux_streamer_ptr ptr, as_object* netstream)
@@ -228,19 +188,22 @@ namespace gameswf
 		assert(netstream);
 		assert(ptr);
 
-		m_mutex.lock();
+		m_aux_mutex.lock();
 
 		m_aux_streamer[netstream] = ptr;
-		SDL_PauseAudio(0);
+		tu_atomic_store(&m_aux_count, m_aux_streamer.size());
+
+		m_aux_mutex.unlock();
 
-		m_mutex.unlock();
+		set_device_paused(false);
 	}
 
 	void SDL_sound_handler::detach_aux_streamer(as_object* netstream)
 	{
-		m_mutex.lock();
+		m_aux_mutex.lock();
 		m_aux_streamer.erase(netstream);
-		m_mutex.unlock();
+		tu_atomic_store(&m_aux_count, m_aux_streamer.size());
+		m_aux_mutex.unlock();
 	}
 
 	void SDL_sound_handler::cvt(short int** adjusted_data, int* adjusted_size, unsigned char* data, 
@@ -275,126 +238,48 @@ namespace gameswf
 
 	int SDL_sound_handler::get_position(int sound_handle)
 	{
-		int ms = 0;
-		m_mutex.lock();
-
-		hash<int, gc_ptr<sound> >::iterator it = m_sound.find(sound_handle);
-		if (it != m_sound.end())
-		{
-			int bytes = it->second->get_played_bytes();
-
-			// convert to the time in ms
-			ms = bytes / (m_audioSpec.freq *(m_audioSpec.channels > 1 ? 4 : 2) / 1000);
-		}
-
-		m_mutex.unlock();
-		return ms;
+		return m_mixer->get_position(sound_handle);
 	}
 
-	sound::sound(int size, Uint8* data, sound_handler::format_type format, int sample_count, 
-		int sample_rate, bool stereo):
-		m_data(data),
-		m_size(size),
-		m_volume(1.0f),
-		m_format(format),
-		m_sample_count(sample_count),
-		m_sample_rate(sample_rate),
-		m_stereo(stereo),
-		m_is_paused(false)
+	void SDL_sound_handler::advance(float delta_time)
 	{
-		if (data != NULL && size > 0)
+		array<int> completed;
+		m_mixer->update(&completed);
+
+		// notify onSoundComplete
+		if (completed.size() > 0)
 		{
-			m_data = (Uint8*) malloc(size);
-			memcpy(m_data, data, size);
+			gameswf_engine_mutex().lock();
+			for (int i = 0, n = completed.size(); i < n; i++)
+			{
+				gc_ptr<listener> l;
+				if (m_listeners.get(completed[i], &l) && l != NULL)
+				{
+					l->notify(event_id::ON_SOUND_COMPLETE);
+				}
+			}
+			gameswf_engine_mutex().unlock();
 		}
-	}
-
-	sound::~sound()
-	{
-		free(m_data);
-	}
-
-	void sound::append(void* data, int size, SDL_sound_handler* handler)
-	{
-		m_data = (Uint8*) realloc(m_data, size + m_size);
-		memcpy(m_data + m_size, data, size);
-		m_size += size;
-	}
-
-	void sound::pause(bool paused)
-	{
-		m_is_paused = paused;
-	}
 
-	// returns the current sound position in ms
-	int  sound::get_played_bytes()
-	{
-		// What to do if m_playlist.size() > 1 ???
-		if (m_playlist.size() > 0)
+		// Let the device sleep while there's nothing to play.
+		if (m_mixer->get_voices_in_flight() == 0 && tu_atomic_load(&m_aux_count) == 0)
 		{
-			return m_playlist[0]->get_played_bytes();
+			set_device_paused(true);
 		}
-		return 0;
 	}
 
-	void sound::play(int loops, SDL_sound_handler* handler)
+	void SDL_sound_handler::get_mixer_stats(mixer_stats* stats) const
 	{
-		if (m_size == 0)
-		{
-			log_error("the attempt to play the empty sound\n");
-			return;
-		}
-
-#if TU_CONFIG_LINK_TO_FFMPEG == 1
-		m_playlist.push_back(new active_sound(this, loops));
-		SDL_PauseAudio(0);
-#else
-		if (m_format != sound_handler::FORMAT_MP3)
-		{
-			m_playlist.push_back(new active_sound(this, loops));
-			SDL_PauseAudio(0);
-		}
-		else
-		{
-			log_error("MP3 requires FFMPEG library\n");
-		}
-#endif
+		m_mixer->get_stats(stats);
 	}
 
-	// called from audio callback
-	bool sound::mix(Uint8* stream, int len, array< gc_ptr<listener> >* listeners, float max_volume)
+	void SDL_sound_handler::set_device_paused(bool paused)
 	{
-		if (m_is_paused)
+		if (m_is_open && m_is_paused != paused)
 		{
-			return true;
+			m_is_paused = paused;
+			SDL_PauseAudio(paused ? 1 : 0);
 		}
-
-		Uint8* buf = new Uint8[len];
-
-		bool play = false;
-		for (int i = 0; i < m_playlist.size(); )
-		{
-			play = true;
-			if (m_playlist[i]->mix(buf, len))
-			{
-				i++;
-			}
-			else
-			{
-				if (m_listeners != NULL)
-				{
-					listeners->push_back(m_listeners);
-				}
-
-				m_playlist.remove(i);
-			}
-
-			int volume = (int) floorf(SDL_MIX_MAXVOLUME * max_volume * m_volume);
-			SDL_MixAudio(stream, buf, len, volume);
-		}
-
-		delete [] buf;
-		return play;
 	}
 
 	sound_handler*	create_sound_handler_sdl()
@@ -403,37 +288,24 @@ namespace gameswf
 		return new SDL_sound_handler;
 	}
 
-	/// The callback function which refills the buffer with data
-	/// We run through all of the sounds, and mix all of the active sounds 
-	/// into the stream given by the callback.
-	/// If sound is compresssed (mp3) a mp3-frame is decoded into a buffer,
-	/// and resampled if needed. When the buffer has been sampled, another
-	/// frame is decoded until all frames has been decoded.
-	/// If a sound is looping it will be decoded from the beginning again.
+	/// The callback function which refills the buffer with data.
+	/// The mixer renders all the playing sounds, decoding ADPCM and
+	/// MP3 a little at a time as it goes, without taking any locks.
+	/// Audio from video (aux streamers) is then mixed on top.
 
 	static void	sdl_audio_callback (void *udata, Uint8 *stream, int len)
 	{
 		// Get the soundhandler
 		SDL_sound_handler* handler = static_cast<SDL_sound_handler*>(udata);
 
-		handler->m_mutex.lock();
-
-		int pause = 1;
-		memset(stream, 0, len);
-
-		array< gc_ptr<listener> > listeners;
-
 		// mix Flash audio
-		for (hash<int, gc_ptr<sound> >::iterator snd = handler->m_sound.begin();
-			snd != handler->m_sound.end(); ++snd)
-		{
-			bool play = snd->second->mix(stream, len, &listeners, handler->m_max_volume);
-			pause = play ? 0 : pause;
-		}
+		handler->m_mixer->mix((Sint16*) stream, len / 4);	// 16-bit stereo
 
 		// mix audio of video 
-		if (handler->m_aux_streamer.size() > 0)
+		if (tu_atomic_load(&handler->m_aux_count) > 0)
 		{
+			handler->m_aux_mutex.lock();
+
 			Uint8* mix_buf = new Uint8[len];
 			for (hash< as_object*, gameswf::sound_handler::aux_streamer_ptr>::const_iterator it = handler->m_aux_streamer.begin();
 			     it != handler->m_aux_streamer.end();
@@ -447,20 +319,10 @@ namespace gameswf
 				int volume = (int) floorf(SDL_MIX_MAXVOLUME * handler->m_max_volume);
 				SDL_MixAudio(stream, mix_buf, len, volume);
 			}
-			pause = 0;
 			delete [] mix_buf;
-		}
-		SDL_PauseAudio(pause);
-		handler->m_mutex.unlock();
 
-		// notify onSoundComplete
-		gameswf_engine_mutex().lock();
-		for (int i = 0, n = listeners.size(); i < n; i++)
-		{
-			listeners[i]->notify(event_id::ON_SOUND_COMPLETE);
+			handler->m_aux_mutex.unlock();
 		}
-		gameswf_engine_mutex().unlock();
-
 	}
 
 }
@@ -0,0 +1,1181 @@
+// gameswf_sound_mixer.cpp	-- software sound mixer for gameswf sound handlers
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// See gameswf_sound_mixer.h.  The game side owns the sample table;
+// the audio side owns the voice slots.  Pointers cross between them
+// only through the two queues, and memory is always freed on the
+// game side, after the audio side has said it's done with it.
+
+
+#include "gameswf/gameswf_sound_mixer.h"
+#include "gameswf/gameswf_sound.h"
+#include "gameswf/gameswf_log.h"
+#include "base/tu_timer.h"
+#include "base/utility.h"
+#include <string.h>
+
+#if TU_CONFIG_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if TU_CONFIG_LINK_TO_FFMPEG == 1
+#include <ffmpeg/avformat.h>
+#endif
+
+
+namespace gameswf
+{
+	static const int	MAX_VOICES = 128;
+	static const int	COMMAND_QUEUE_SIZE = 1024;
+	static const int	EVENT_QUEUE_SIZE = 1024;
+
+	// Per-voice buffer of decoded source frames.  Small, so a
+	// compressed sound is only ever decoded a little ahead of
+	// where it's playing.
+	static const int	DECODE_FRAMES = 512;
+
+	// mix() works in blocks of this many output frames.
+	static const int	MIX_BLOCK_FRAMES = 256;
+
+	static const int	ADPCM_BLOCK_FRAMES = 4096;
+
+
+	static bool	is_supported_format(sound_handler::format_type format)
+	{
+		switch (format)
+		{
+		case sound_handler::FORMAT_NATIVE16:
+		case sound_handler::FORMAT_ADPCM:
+			return true;
+		case sound_handler::FORMAT_MP3:
+			return TU_CONFIG_LINK_TO_FFMPEG == 1;
+		default:
+			return false;
+		}
+	}
+
+
+	struct mixer_chunk
+	// A block of sample data.  Immutable once it's linked into a
+	// sample, so the audio side can read it while the game side
+	// appends more.
+	{
+		mixer_chunk* volatile	m_next;
+		int	m_size;
+
+		Uint8*	get_data() { return (Uint8*) (this + 1); }
+
+		static mixer_chunk*	create(const void* data, int bytes)
+		{
+			mixer_chunk*	c = (mixer_chunk*) malloc(sizeof(mixer_chunk) + bytes);
+			c->m_next = NULL;
+			c->m_size = bytes;
+			memcpy(c->get_data(), data, bytes);
+			return c;
+		}
+	};
+
+
+	struct mixer_sample
+	{
+		int	m_handle;
+		sound_handler::format_type	m_format;
+		int	m_sample_count;
+		int	m_sample_rate;
+		int	m_channels;
+		bool	m_is_stream;	// created empty, filled by append_sample()
+
+		mixer_chunk* volatile	m_first;
+		mixer_chunk*	m_last;	// game side only
+
+		volatile int	m_volume;	// [0..100]
+		volatile int	m_paused;
+		volatile int	m_position;	// source frames; written by the audio side
+		int	m_position_serial;	// audio side only
+
+		mixer_sample(int handle, sound_handler::format_type format, int sample_count, int sample_rate, bool stereo)
+			:
+			m_handle(handle),
+			m_format(format),
+			m_sample_count(sample_count),
+			m_sample_rate(sample_rate),
+			m_channels(stereo ? 2 : 1),
+			m_is_stream(false),
+			m_first(NULL),
+			m_last(NULL),
+			m_volume(100),
+			m_paused(0),
+			m_position(0),
+			m_position_serial(0)
+		{
+		}
+
+		~mixer_sample()
+		{
+			mixer_chunk*	c = m_first;
+			while (c)
+			{
+				mixer_chunk*	next = c->m_next;
+				free(c);
+				c = next;
+			}
+		}
+
+		void	append(const void* data, int bytes)
+		// Game side.
+		{
+			if (data == NULL || bytes <= 0)
+			{
+				return;
+			}
+
+			mixer_chunk*	c = mixer_chunk::create(data, bytes);
+			if (m_last)
+			{
+				tu_atomic_store_ptr(&m_last->m_next, c);
+			}
+			else
+			{
+				tu_atomic_store_ptr(&m_first, c);
+			}
+			m_last = c;
+		}
+	};
+
+
+	struct mixer_voice
+	// One playing instance of a sample.  Created on the game side;
+	// owned by the audio side from the PLAY command until it sends
+	// VOICE_DONE.
+	{
+		mixer_sample*	m_sample;
+		int	m_loops_left;	// -1 == forever
+		int	m_step;		// source frames per output frame, 16.16
+		bool	m_finished;	// waiting for room in the event queue
+		bool	m_completed;
+
+		// Source cursor.
+		mixer_chunk*	m_chunk;
+		int	m_offset;
+
+		// Decoded source frames, interleaved.  m_pos/m_frac is
+		// the resampler's read position.
+		Sint16	m_buffer[DECODE_FRAMES * 2];
+		int	m_frames;
+		int	m_pos;
+		int	m_frac;
+		int	m_played;	// source frames before m_buffer[0], this loop
+
+		// ADPCM decoder.  Each chunk is one packet.
+		int	m_adpcm_bits;	// code size; 0 == need a packet header
+		int	m_adpcm_block_left;
+		int	m_adpcm_packet_frames;
+		int	m_adpcm_sample[2];
+		int	m_adpcm_index[2];
+		Uint32	m_bit_buffer;
+		int	m_bit_count;
+
+#if TU_CONFIG_LINK_TO_FFMPEG == 1
+		AVCodecContext*	m_cc;
+		AVCodecParserContext*	m_parser;
+		Sint16*	m_mp3_pcm;	// one decoded MP3 frame
+		int	m_mp3_channels;
+		int	m_mp3_frames;
+		int	m_mp3_pos;
+#endif
+
+		mixer_voice(mixer_sample* sample, int loop_count, int output_rate)
+			:
+			m_sample(sample),
+			m_loops_left(loop_count),
+			m_finished(false),
+			m_completed(false)
+#if TU_CONFIG_LINK_TO_FFMPEG == 1
+			,
+			m_cc(NULL),
+			m_parser(NULL),
+			m_mp3_pcm(NULL)
+#endif
+		{
+			m_step = (int) ((double) sample->m_sample_rate / output_rate * 65536.0 + 0.5);
+			m_step = iclamp(m_step, 1, 64 << 16);
+			restart();
+
+#if TU_CONFIG_LINK_TO_FFMPEG == 1
+			if (sample->m_format == sound_handler::FORMAT_MP3)
+			{
+				AVCodec*	codec = avcodec_find_decoder(CODEC_ID_MP3);
+				m_parser = av_parser_init(CODEC_ID_MP3);
+				m_cc = avcodec_alloc_context();
+				if (codec == NULL || m_parser == NULL || m_cc == NULL || avcodec_open(m_cc, codec) < 0)
+				{
+					log_error("Could not open MP3 codec\n");
+					if (m_cc)
+					{
+						av_free(m_cc);
+						m_cc = NULL;
+					}
+				}
+				m_mp3_pcm = (Sint16*) malloc(AVCODEC_MAX_AUDIO_FRAME_SIZE);
+			}
+#endif
+		}
+
+		~mixer_voice()
+		{
+#if TU_CONFIG_LINK_TO_FFMPEG == 1
+			if (m_cc)
+			{
+				avcodec_close(m_cc);
+				av_free(m_cc);
+			}
+			if (m_parser)
+			{
+				av_parser_close(m_parser);
+			}
+			free(m_mp3_pcm);
+#endif
+		}
+
+		bool	is_valid() const
+		{
+#if TU_CONFIG_LINK_TO_FFMPEG == 1
+			if (m_sample->m_format == sound_handler::FORMAT_MP3)
+			{
+				return m_cc != NULL && m_parser != NULL;
+			}
+#endif
+			return true;
+		}
+
+		void	restart()
+		// Rewind to the start of the sample.
+		{
+			m_chunk = NULL;
+			m_offset = 0;
+			m_frames = 0;
+			m_pos = 0;
+			m_frac = 0;
+			m_played = 0;
+			m_adpcm_bits = 0;
+			m_bit_count = 0;
+#if TU_CONFIG_LINK_TO_FFMPEG == 1
+			m_mp3_frames = 0;
+			m_mp3_pos = 0;
+#endif
+		}
+
+		bool	next_chunk()
+		// Step the cursor to the next chunk of sample data, if
+		// the game side has published one.
+		{
+			mixer_chunk*	c = m_chunk ? tu_atomic_load_ptr(&m_chunk->m_next) : tu_atomic_load_ptr(&m_sample->m_first);
+			if (c == NULL)
+			{
+				return false;
+			}
+			m_chunk = c;
+			m_offset = 0;
+			return true;
+		}
+
+		int	decode_pcm(Sint16* out, int max_frames)
+		{
+			int	frame_bytes = 2 * m_sample->m_channels;
+			Uint8*	dst = (Uint8*) out;
+			int	want = max_frames * frame_bytes;
+			int	got = 0;
+			while (got < want)
+			{
+				if (m_chunk == NULL || m_offset >= m_chunk->m_size)
+				{
+					if (next_chunk() == false)
+					{
+						break;
+					}
+					continue;
+				}
+				int	n = imin(m_chunk->m_size - m_offset, want - got);
+				memcpy(dst + got, m_chunk->get_data() + m_offset, n);
+				m_offset += n;
+				got += n;
+			}
+
+			// A trailing partial frame (malformed data) is dropped.
+			return got / frame_bytes;
+		}
+
+		bool	read_bits(int bit_count, int* result)
+		// ADPCM bit reader; MSB first, like stream::read_uint().
+		// Fails at the end of the current packet.
+		{
+			while (m_bit_count < bit_count)
+			{
+				if (m_chunk == NULL || m_offset >= m_chunk->m_size)
+				{
+					return false;
+				}
+				m_bit_buffer = (m_bit_buffer << 8) | m_chunk->get_data()[m_offset++];
+				m_bit_count += 8;
+			}
+			m_bit_count -= bit_count;
+			*result = (m_bit_buffer >> m_bit_count) & ((1 << bit_count) - 1);
+			return true;
+		}
+
+		int	decode_adpcm(Sint16* out, int max_frames)
+		{
+			const int	channels = m_sample->m_channels;
+			int	frames = 0;
+			while (frames < max_frames)
+			{
+				if (m_adpcm_bits == 0)
+				{
+					// Start the next packet.
+					if (next_chunk() == false)
+					{
+						break;
+					}
+					m_bit_count = 0;
+					int	code_size;
+					if (read_bits(2, &code_size) == false)
+					{
+						continue;
+					}
+					m_adpcm_bits = code_size + 2;
+					m_adpcm_block_left = 0;
+					m_adpcm_packet_frames = 0;
+				}
+
+				// A DefineSound packet holds exactly
+				// m_sample_count frames; stream blocks are
+				// bounded by their data.
+				bool	ok = m_sample->m_is_stream || m_adpcm_packet_frames < m_sample->m_sample_count;
+
+				if (ok && m_adpcm_block_left == 0)
+				{
+					// Block header: the first sample is
+					// stored as-is.
+					for (int ch = 0; ok && ch < channels; ch++)
+					{
+						int	s = 0, index = 0;
+						ok = read_bits(16, &s) && read_bits(6, &index);
+						if (ok)
+						{
+							m_adpcm_sample[ch] = (Sint16) s;
+							m_adpcm_index[ch] = index;
+						}
+					}
+					m_adpcm_block_left = ADPCM_BLOCK_FRAMES;
+				}
+				else
+				{
+					for (int ch = 0; ok && ch < channels; ch++)
+					{
+						int	code;
+						ok = read_bits(m_adpcm_bits, &code);
+						if (ok)
+						{
+							adpcm_decode_code(m_adpcm_bits, code, &m_adpcm_sample[ch], &m_adpcm_index[ch]);
+						}
+					}
+				}
+
+				if (ok == false)
+				{
+					// End of packet.
+					m_adpcm_bits = 0;
+					continue;
+				}
+
+				for (int ch = 0; ch < channels; ch++)
+				{
+					*out++ = (Sint16) m_adpcm_sample[ch];
+				}
+				m_adpcm_block_left--;
+				m_adpcm_packet_frames++;
+				frames++;
+			}
+			return frames;
+		}
+
+#if TU_CONFIG_LINK_TO_FFMPEG == 1
+		int	decode_mp3(Sint16* out, int max_frames)
+		{
+			const int	channels = m_sample->m_channels;
+			int	frames = 0;
+			while (frames < max_frames)
+			{
+				if (m_mp3_pos < m_mp3_frames)
+				{
+					// Copy out of the current MP3 frame.
+					int	n = imin(m_mp3_frames - m_mp3_pos, max_frames - frames);
+					const Sint16*	src = m_mp3_pcm + m_mp3_pos * m_mp3_channels;
+					for (int i = 0; i < n; i++)
+					{
+						for (int ch = 0; ch < channels; ch++)
+						{
+							*out++ = src[imin(ch, m_mp3_channels - 1)];
+						}
+						src += m_mp3_channels;
+					}
+					m_mp3_pos += n;
+					frames += n;
+					continue;
+				}
+
+				if (m_chunk == NULL || m_offset >= m_chunk->m_size)
+				{
+					if (next_chunk() == false)
+					{
+						break;
+					}
+					continue;
+				}
+
+				uint8_t*	frame;
+				int	frame_size;
+				int	used = av_parser_parse(m_parser, m_cc, &frame, &frame_size,
+							       m_chunk->get_data() + m_offset, m_chunk->m_size - m_offset, 0, 0);
+				if (used < 0)
+				{
+					// Corrupt stream; treat it as the end.
+					break;
+				}
+				m_offset += used;
+
+				if (frame_size > 0)
+				{
+					int	len = AVCODEC_MAX_AUDIO_FRAME_SIZE;
+					if (avcodec_decode_audio(m_cc, (int16_t*) m_mp3_pcm, &len, frame, frame_size) >= 0
+					    && m_cc->channels > 0)
+					{
+						m_mp3_channels = m_cc->channels;
+						m_mp3_frames = len / (2 * m_mp3_channels);
+						m_mp3_pos = 0;
+					}
+				}
+			}
+			return frames;
+		}
+#endif
+
+		int	decode(Sint16* out, int max_frames)
+		// Decode up to max_frames more source frames.  Returns 0 at
+		// the end of the data.
+		{
+			switch (m_sample->m_format)
+			{
+			case sound_handler::FORMAT_NATIVE16:
+				return decode_pcm(out, max_frames);
+			case sound_handler::FORMAT_ADPCM:
+				return decode_adpcm(out, max_frames);
+#if TU_CONFIG_LINK_TO_FFMPEG == 1
+			case sound_handler::FORMAT_MP3:
+				return decode_mp3(out, max_frames);
+#endif
+			default:
+				return 0;
+			}
+		}
+
+		bool	fill()
+		// Make sure source frames m_pos and m_pos + 1 are in the
+		// decode buffer.  Returns false when the sound is over.
+		{
+			const int	channels = m_sample->m_channels;
+			bool	restarted = false;
+			for (;;)
+			{
+				// Discard what's been played.
+				int	drop = imin(m_pos, m_frames);
+				if (drop > 0)
+				{
+					memmove(m_buffer, m_buffer + drop * channels, (m_frames - drop) * channels * sizeof(Sint16));
+					m_frames -= drop;
+					m_pos -= drop;
+					m_played += drop;
+				}
+
+				if (m_pos + 1 < m_frames)
+				{
+					return true;
+				}
+
+				int	got = decode(m_buffer + m_frames * channels, DECODE_FRAMES - m_frames);
+				if (got > 0)
+				{
+					m_frames += got;
+					restarted = false;
+					continue;
+				}
+
+				// Out of data.
+				if (m_loops_left == 0 || restarted)
+				{
+					return false;
+				}
+				if (m_loops_left > 0)
+				{
+					m_loops_left--;
+				}
+
+				// Loop seamlessly: keep what's buffered and
+				// decode from the start after it.
+				Sint16	last[2] = { 0, 0 };
+				bool	have_last = m_frames > 0;
+				if (have_last)
+				{
+					memcpy(last, m_buffer + (m_frames - 1) * channels, channels * sizeof(Sint16));
+				}
+				int	pos = have_last ? m_pos - (m_frames - 1) : m_pos;
+				int	frac = m_frac;
+				restart();
+				if (have_last)
+				{
+					memcpy(m_buffer, last, channels * sizeof(Sint16));
+					m_frames = 1;
+				}
+				m_pos = pos;
+				m_frac = frac;
+				restarted = true;
+			}
+		}
+
+		int	render(Sint16* out, int frame_count)
+		// Resample to the output rate, as stereo.  Returns the
+		// number of frames written; less than frame_count means
+		// the sound ended.
+		{
+			const int	channels = m_sample->m_channels;
+			for (int i = 0; i < frame_count; i++)
+			{
+				if (m_pos + 1 >= m_frames && fill() == false)
+				{
+					return i;
+				}
+
+				// Linear interpolation; 15-bit fraction so the
+				// product fits in an int.
+				const Sint16*	s = m_buffer + m_pos * channels;
+				int	f = m_frac >> 1;
+				int	left = s[0] + (((s[channels] - s[0]) * f) >> 15);
+				int	right = left;
+				if (channels == 2)
+				{
+					right = s[1] + (((s[3] - s[1]) * f) >> 15);
+				}
+				out[0] = (Sint16) left;
+				out[1] = (Sint16) right;
+				out += 2;
+
+				m_frac += m_step;
+				m_pos += m_frac >> 16;
+				m_frac &= 0xFFFF;
+			}
+			return frame_count;
+		}
+
+		int	get_position() const
+		{
+			return m_played + m_pos;
+		}
+	};
+
+
+	static void	accumulate(int* acc, const Sint16* src, int count, int gain)
+	// acc[i] += src[i] * gain / 256
+	{
+		int	i = 0;
+
+#if TU_CONFIG_USE_SSE2
+		// The 16x16 -> 32 bit products come from combining the
+		// low & high halves with unpack.
+		__m128i	g = _mm_set1_epi16((short) gain);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i	s = _mm_loadu_si128((const __m128i*) (src + i));
+			__m128i	lo = _mm_mullo_epi16(s, g);
+			__m128i	hi = _mm_mulhi_epi16(s, g);
+			__m128i	p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 8);
+			__m128i	p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 8);
+
+			__m128i*	a = (__m128i*) (acc + i);
+			_mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), p0));
+			_mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), p1));
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			acc[i] += (src[i] * gain) >> 8;
+		}
+	}
+
+
+	static void	saturate(Sint16* out, const int* acc, int count)
+	// out[i] = acc[i], clamped to 16 bits.
+	{
+		int	i = 0;
+
+#if TU_CONFIG_USE_SSE2
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i	a0 = _mm_loadu_si128((const __m128i*) (acc + i));
+			__m128i	a1 = _mm_loadu_si128((const __m128i*) (acc + i + 4));
+			_mm_storeu_si128((__m128i*) (out + i), _mm_packs_epi32(a0, a1));
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			out[i] = (Sint16) iclamp(acc[i], -32768, 32767);
+		}
+	}
+
+
+	mixer_stats::mixer_stats()
+		:
+		m_callback_count(0),
+		m_active_voices(0),
+		m_peak_voices(0),
+		m_last_mix_us(0),
+		m_peak_mix_us(0),
+		m_last_buffer_us(0),
+		m_total_mix_ms(0),
+		m_voice_overflows(0)
+	{
+	}
+
+
+	sound_mixer::sound_mixer(int output_rate)
+		:
+		m_output_rate(output_rate),
+		m_next_handle(0),
+		m_voices_in_flight(0),
+		m_lock_audio(NULL),
+		m_unlock_audio(NULL),
+		m_commands(COMMAND_QUEUE_SIZE),
+		m_events(EVENT_QUEUE_SIZE),
+		m_master_volume(100),
+		m_voice_count(0),
+		m_finished_voices(0),
+		m_serial(0)
+	{
+		assert(output_rate > 0);
+
+		m_voices = new mixer_voice*[MAX_VOICES];
+		for (int i = 0; i < MAX_VOICES; i++)
+		{
+			m_voices[i] = NULL;
+		}
+		m_accumulator = new int[MIX_BLOCK_FRAMES * 2];
+		m_scratch = new Sint16[MIX_BLOCK_FRAMES * 2];
+	}
+
+
+	sound_mixer::~sound_mixer()
+	{
+		// Nobody is mixing any more, so just free everything,
+		// wherever it is.
+		command	c;
+		while (m_commands.pop(&c))
+		{
+			if (c.m_type == command::PLAY)
+			{
+				delete c.m_voice;
+			}
+			else if (c.m_type == command::RELEASE)
+			{
+				delete c.m_sample;
+			}
+		}
+
+		event	e;
+		while (m_events.pop(&e))
+		{
+			if (e.m_type == event::VOICE_DONE)
+			{
+				delete e.m_voice;
+			}
+			else
+			{
+				delete e.m_sample;
+			}
+		}
+
+		for (int i = 0; i < MAX_VOICES; i++)
+		{
+			delete m_voices[i];
+		}
+		delete [] m_voices;
+
+		for (hash<int, mixer_sample*>::iterator it = m_samples.begin(); it != m_samples.end(); ++it)
+		{
+			delete it->second;
+		}
+
+		delete [] m_accumulator;
+		delete [] m_scratch;
+	}
+
+
+	//
+	// Game side.
+	//
+
+
+	mixer_sample*	sound_mixer::find_sample(int handle)
+	{
+		mixer_sample*	s = NULL;
+		m_samples.get(handle, &s);
+		return s;
+	}
+
+
+	void	sound_mixer::send(const command& c)
+	// Queue a command for the audio side.  Called with m_mutex held.
+	{
+		while (m_commands.push(c) == false)
+		{
+			// The audio side isn't draining the queue;
+			// probably the device is paused.
+			assert(m_lock_audio && m_unlock_audio);	// see set_audio_lock()
+			if (m_lock_audio == NULL || m_unlock_audio == NULL)
+			{
+				// No way to hold mix() off, so the voices
+				// aren't ours to touch; wait for it.
+				handle_events();
+				tu_timer::sleep(1);
+				continue;
+			}
+
+			// Hold the audio side off and run the commands
+			// here.
+			m_lock_audio();
+			flush_finished_voices();
+			run_commands();
+			m_unlock_audio();
+
+			// Make room for the events that generated.
+			handle_events();
+		}
+	}
+
+
+	void	sound_mixer::handle_events()
+	// Free what the audio side is done with.  Called with m_mutex
+	// held.
+	{
+		event	e;
+		while (m_events.pop(&e))
+		{
+			if (e.m_type == event::VOICE_DONE)
+			{
+				if (e.m_completed)
+				{
+					m_completed.push_back(e.m_sample->m_handle);
+				}
+				delete e.m_voice;
+				m_voices_in_flight--;
+				assert(m_voices_in_flight >= 0);
+			}
+			else
+			{
+				assert(e.m_type == event::SAMPLE_RELEASED);
+				delete e.m_sample;
+			}
+		}
+	}
+
+
+	int	sound_mixer::create_sample(const void* data, int data_bytes, int sample_count,
+					   sound_handler::format_type format, int sample_rate, bool stereo)
+	{
+		tu_autolock	lock(m_mutex);
+
+		if (is_supported_format(format) == false)
+		{
+			log_error("sound format %d is not supported; the sound will be silent\n", int(format));
+		}
+
+		int	handle = m_next_handle++;
+		mixer_sample*	s = new mixer_sample(handle, format, sample_count, sample_rate, stereo);
+		s->m_is_stream = (data == NULL || data_bytes == 0);
+		s->append(data, data_bytes);
+		m_samples.add(handle, s);
+		return handle;
+	}
+
+
+	void	sound_mixer::append_sample(int handle, const void* data, int data_bytes)
+	{
+		tu_autolock	lock(m_mutex);
+
+		mixer_sample*	s = find_sample(handle);
+		if (s)
+		{
+			s->append(data, data_bytes);
+		}
+	}
+
+
+	void	sound_mixer::delete_sample(int handle)
+	{
+		tu_autolock	lock(m_mutex);
+
+		mixer_sample*	s = find_sample(handle);
+		if (s)
+		{
+			// The audio side stops any voices and hands it
+			// back for deletion.
+			m_samples.erase(handle);
+			command	c = { command::RELEASE, s, NULL };
+			send(c);
+		}
+	}
+
+
+	bool	sound_mixer::play(int handle, int loop_count)
+	{
+		tu_autolock	lock(m_mutex);
+
+		mixer_sample*	s = find_sample(handle);
+		if (s == NULL)
+		{
+			return false;
+		}
+
+		if (is_supported_format(s->m_format) == false)
+		{
+			return false;
+		}
+
+		if (s->m_first == NULL)
+		{
+			log_error("the attempt to play the empty sound\n");
+			return false;
+		}
+
+		mixer_voice*	v = new mixer_voice(s, loop_count, m_output_rate);
+		if (v->is_valid() == false)
+		{
+			delete v;
+			return false;
+		}
+
+		m_voices_in_flight++;
+		command	c = { command::PLAY, s, v };
+		send(c);
+		return true;
+	}
+
+
+	void	sound_mixer::stop(int handle)
+	{
+		tu_autolock	lock(m_mutex);
+
+		mixer_sample*	s = find_sample(handle);
+		if (s)
+		{
+			command	c = { command::STOP, s, NULL };
+			send(c);
+		}
+	}
+
+
+	void	sound_mixer::stop_all()
+	{
+		tu_autolock	lock(m_mutex);
+
+		command	c = { command::STOP_ALL, NULL, NULL };
+		send(c);
+	}
+
+
+	void	sound_mixer::pause(int handle, bool paused)
+	{
+		tu_autolock	lock(m_mutex);
+
+		mixer_sample*	s = find_sample(handle);
+		if (s)
+		{
+			tu_atomic_store(&s->m_paused, paused ? 1 : 0);
+		}
+	}
+
+
+	void	sound_mixer::set_volume(int handle, int volume)
+	{
+		tu_autolock	lock(m_mutex);
+
+		mixer_sample*	s = find_sample(handle);
+		if (s)
+		{
+			tu_atomic_store(&s->m_volume, iclamp(volume, 0, 100));
+		}
+	}
+
+
+	int	sound_mixer::get_volume(int handle)
+	{
+		tu_autolock	lock(m_mutex);
+
+		mixer_sample*	s = find_sample(handle);
+		return s ? s->m_volume : 0;
+	}
+
+
+	void	sound_mixer::set_master_volume(int volume)
+	{
+		tu_atomic_store(&m_master_volume, iclamp(volume, 0, 100));
+	}
+
+
+	int	sound_mixer::get_position(int handle)
+	{
+		tu_autolock	lock(m_mutex);
+
+		mixer_sample*	s = find_sample(handle);
+		if (s == NULL || s->m_sample_rate <= 0)
+		{
+			return 0;
+		}
+		return (int) ((Uint64) tu_atomic_load(&s->m_position) * 1000 / s->m_sample_rate);
+	}
+
+
+	void	sound_mixer::update(array<int>* completed)
+	{
+		tu_autolock	lock(m_mutex);
+
+		handle_events();
+		if (completed)
+		{
+			for (int i = 0; i < m_completed.size(); i++)
+			{
+				completed->push_back(m_completed[i]);
+			}
+		}
+		m_completed.resize(0);
+	}
+
+
+	void	sound_mixer::get_stats(mixer_stats* stats) const
+	{
+		*stats = m_stats;
+	}
+
+
+	void	sound_mixer::set_audio_lock(void (*lock)(), void (*unlock)())
+	{
+		tu_autolock	autolock(m_mutex);
+
+		m_lock_audio = lock;
+		m_unlock_audio = unlock;
+	}
+
+
+	//
+	// Audio side.
+	//
+
+
+	void	sound_mixer::finish_voice(int slot, bool completed)
+	// Report the voice in the given slot done, or mark it to be
+	// reported once there's room in the event queue.
+	{
+		mixer_voice*	v = m_voices[slot];
+		assert(v);
+
+		if (v->m_finished == false)
+		{
+			v->m_finished = true;
+			v->m_completed = completed;
+			m_finished_voices++;
+		}
+
+		event	e = { event::VOICE_DONE, v->m_completed, v->m_sample, v };
+		if (m_events.push(e))
+		{
+			m_voices[slot] = NULL;
+			m_voice_count--;
+			m_finished_voices--;
+		}
+	}
+
+
+	bool	sound_mixer::flush_finished_voices()
+	// Retry finished voices that didn't fit in the event queue.
+	// Returns true if none are left.
+	{
+		for (int i = 0; i < MAX_VOICES && m_finished_voices > 0; i++)
+		{
+			if (m_voices[i] && m_voices[i]->m_finished)
+			{
+				finish_voice(i, m_voices[i]->m_completed);
+			}
+		}
+		return m_finished_voices == 0;
+	}
+
+
+	void	sound_mixer::run_commands()
+	{
+		command*	c;
+		while ((c = m_commands.front()) != NULL)
+		{
+			switch (c->m_type)
+			{
+			default:
+				assert(0);
+				break;
+
+			case command::PLAY:
+			{
+				int	slot = -1;
+				if (m_voice_count < MAX_VOICES)
+				{
+					for (slot = 0; m_voices[slot]; slot++)
+					{
+					}
+				}
+
+				if (slot >= 0)
+				{
+					m_voices[slot] = c->m_voice;
+					m_voice_count++;
+				}
+				else
+				{
+					// No free voice: hand it straight back.
+					event	e = { event::VOICE_DONE, false, c->m_sample, c->m_voice };
+					if (m_events.push(e) == false)
+					{
+						return;	// retry next time
+					}
+					m_stats.m_voice_overflows++;
+				}
+				break;
+			}
+
+			case command::STOP:
+			case command::STOP_ALL:
+			case command::RELEASE:
+				for (int i = 0; i < MAX_VOICES; i++)
+				{
+					mixer_voice*	v = m_voices[i];
+					if (v && v->m_finished == false
+					    && (c->m_type == command::STOP_ALL || v->m_sample == c->m_sample))
+					{
+						finish_voice(i, false);
+					}
+				}
+
+				if (c->m_type == command::RELEASE)
+				{
+					// Voices must be reported before the
+					// sample goes away.
+					if (flush_finished_voices() == false)
+					{
+						return;
+					}
+					event	e = { event::SAMPLE_RELEASED, false, c->m_sample, NULL };
+					if (m_events.push(e) == false)
+					{
+						return;
+					}
+				}
+				break;
+			}
+
+			m_commands.pop(NULL);
+		}
+	}
+
+
+	void	sound_mixer::mix(Sint16* stream, int frame_count)
+	{
+		Uint64	start_ticks = tu_timer::get_profile_ticks();
+
+		flush_finished_voices();
+		run_commands();
+
+		// Per-sample position is taken from the first voice
+		// mixed this time around.
+		m_serial++;
+
+		int	master = tu_atomic_load(&m_master_volume);
+		int	active_voices = 0;
+
+		for (int done = 0; done < frame_count; )
+		{
+			int	n = imin(MIX_BLOCK_FRAMES, frame_count - done);
+			memset(m_accumulator, 0, n * 2 * sizeof(int));
+
+			for (int i = 0; i < MAX_VOICES; i++)
+			{
+				mixer_voice*	v = m_voices[i];
+				if (v == NULL || v->m_finished)
+				{
+					continue;
+				}
+
+				mixer_sample*	s = v->m_sample;
+				if (tu_atomic_load(&s->m_paused))
+				{
+					continue;
+				}
+				if (done == 0)
+				{
+					active_voices++;
+				}
+
+				// Silent voices still render, so they keep
+				// time.
+				int	got = v->render(m_scratch, n);
+				int	gain = (tu_atomic_load(&s->m_volume) * master * 256 + 5000) / 10000;
+				if (gain > 0)
+				{
+					accumulate(m_accumulator, m_scratch, got * 2, gain);
+				}
+
+				if (s->m_position_serial != m_serial)
+				{
+					s->m_position_serial = m_serial;
+					tu_atomic_store(&s->m_position, v->get_position());
+				}
+
+				if (got < n)
+				{
+					finish_voice(i, true);
+				}
+			}
+
+			saturate(stream + done * 2, m_accumulator, n * 2);
+			done += n;
+		}
+
+		// Instrumentation.
+		Uint64	ticks = tu_timer::get_profile_ticks() - start_ticks;
+		int	mix_us = (int) (tu_timer::profile_ticks_to_seconds(ticks) * 1000000.0);
+		m_stats.m_callback_count++;
+		m_stats.m_active_voices = active_voices;
+		m_stats.m_peak_voices = imax(m_stats.m_peak_voices, active_voices);
+		m_stats.m_last_mix_us = mix_us;
+		m_stats.m_peak_mix_us = imax(m_stats.m_peak_mix_us, mix_us);
+		m_stats.m_last_buffer_us = (int) ((Uint64) frame_count * 1000000 / m_output_rate);
+		m_stats.m_total_mix_ms += mix_us / 1000.0;
+	}
+
+}	// end namespace gameswf
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
@@ -0,0 +1,186 @@
+// gameswf_sound_mixer.h	-- software sound mixer for gameswf sound handlers
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Device-independent mixer.  A sound handler owns one, forwards the
+// sound_handler calls to it from the game side, and calls mix() from
+// its audio callback to render 16-bit stereo at the device rate.
+//
+// mix() never takes a lock and never allocates.  The game side talks
+// to it through a lock-free command queue (play, stop, release) and
+// a few atomic per-sample values (volume, pause); mix() answers
+// through an event queue that update() drains on the game side.
+// Voices and their decode buffers are allocated by the game side and
+// handed over in the play command, so compressed sounds (ADPCM, and
+// MP3 with ffmpeg) decode a few hundred frames at a time, as they
+// play.
+
+
+#ifndef GAMESWF_SOUND_MIXER_H
+#define GAMESWF_SOUND_MIXER_H
+
+
+#include "gameswf/gameswf.h"
+#include "gameswf/gameswf_mutex.h"
+#include "base/container.h"
+#include "base/tu_spsc_queue.h"
+
+
+namespace gameswf
+{
+	struct mixer_sample;
+	struct mixer_voice;
+
+	struct mixer_stats
+	// Instrumentation, written by the audio side at the end of
+	// each mix().  The fields are read without locking, so a
+	// snapshot may straddle two callbacks.
+	{
+		int	m_callback_count;
+		int	m_active_voices;	// voices mixed in the last callback
+		int	m_peak_voices;
+		int	m_last_mix_us;		// mixer CPU time in the last callback
+		int	m_peak_mix_us;
+		int	m_last_buffer_us;	// duration of the audio it produced
+		double	m_total_mix_ms;
+		int	m_voice_overflows;	// plays dropped because all voices were busy
+
+		mixer_stats();
+	};
+
+
+	struct sound_mixer
+	{
+		sound_mixer(int output_rate);
+		~sound_mixer();	// the audio side must be stopped by now
+
+		//
+		// Game side.  These may be called from any thread except the
+		// audio thread; they're serialized with an internal mutex.
+		//
+
+		// Same meaning as sound_handler::create_sound() and
+		// append_sound().  Returns a handle >= 0.  FORMAT_ADPCM
+		// data is a sequence of complete ADPCM packets, one per
+		// create/append call.
+		int	create_sample(const void* data, int data_bytes, int sample_count,
+				      sound_handler::format_type format, int sample_rate, bool stereo);
+		void	append_sample(int handle, const void* data, int data_bytes);
+		void	delete_sample(int handle);
+
+		// loop_count == 0 plays once; -1 loops forever.
+		bool	play(int handle, int loop_count);
+		void	stop(int handle);
+		void	stop_all();
+		void	pause(int handle, bool paused);
+
+		void	set_volume(int handle, int volume);	// [0..100]
+		int	get_volume(int handle);
+		void	set_master_volume(int volume);	// [0..100]
+
+		// Milliseconds into the current loop of the sample's
+		// first playing voice.
+		int	get_position(int handle);
+
+		// Frees finished voices and released samples, and appends
+		// the handles of sounds that played to completion (for
+		// onSoundComplete).  Call it regularly, e.g. from
+		// sound_handler::advance().
+		void	update(array<int>* completed);
+
+		// Voices that have been started and not yet reported
+		// finished by update().  When this is 0 the audio
+		// device may be paused.
+		int	get_voices_in_flight() const { return m_voices_in_flight; }
+
+		void	get_stats(mixer_stats* stats) const;
+
+		// Gives the mixer a way to hold mix() off (e.g.
+		// SDL_LockAudio()).  It's only used when the command
+		// queue fills up because the audio side isn't draining
+		// it, e.g. while the device is paused; the game side then
+		// runs the commands itself.  Required: without it a full
+		// queue asserts, and release builds wait for mix() to
+		// catch up.  If mix() is called from the game thread,
+		// pass functions that do nothing.
+		void	set_audio_lock(void (*lock)(), void (*unlock)());
+
+		//
+		// Audio side.  Call from one thread only.
+		//
+
+		// Render frame_count stereo frames (interleaved Sint16)
+		// into stream, replacing its contents.
+		void	mix(Sint16* stream, int frame_count);
+
+		int	get_output_rate() const { return m_output_rate; }
+
+	private:
+		struct command
+		{
+			enum type { PLAY, STOP, STOP_ALL, RELEASE };
+
+			int	m_type;
+			mixer_sample*	m_sample;
+			mixer_voice*	m_voice;
+		};
+
+		struct event
+		{
+			enum type { VOICE_DONE, SAMPLE_RELEASED };
+
+			int	m_type;
+			bool	m_completed;	// VOICE_DONE: played to the end
+			mixer_sample*	m_sample;
+			mixer_voice*	m_voice;
+		};
+
+		// Game side.
+		mixer_sample*	find_sample(int handle);
+		void	send(const command& c);
+		void	handle_events();
+
+		// Audio side.
+		void	run_commands();
+		void	finish_voice(int slot, bool completed);
+		bool	flush_finished_voices();
+
+		int	m_output_rate;
+
+		// Game side state, guarded by m_mutex.
+		tu_mutex	m_mutex;
+		hash<int, mixer_sample*>	m_samples;
+		int	m_next_handle;
+		int	m_voices_in_flight;
+		array<int>	m_completed;	// events drained early by send()
+		void	(*m_lock_audio)();
+		void	(*m_unlock_audio)();
+
+		// Shared.
+		tu_spsc_queue<command>	m_commands;	// game -> audio
+		tu_spsc_queue<event>	m_events;	// audio -> game
+		volatile int	m_master_volume;
+		mixer_stats	m_stats;
+
+		// Audio side state.
+		mixer_voice**	m_voices;	// fixed array of slots
+		int	m_voice_count;
+		int	m_finished_voices;	// slots waiting for room in m_events
+		int	m_serial;
+		int*	m_accumulator;
+		Sint16*	m_scratch;
+	};
+
+}	// end namespace gameswf
+
+
+#endif // GAMESWF_SOUND_MIXER_H
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
@@ -118,6 +118,7 @@
 #include "gameswf/gameswf_types.h"
 #include "base/utility.h"
 #include "base/container.h"
+#include "base/tu_profile.h"
 #include <stdlib.h>
 #include "base/ear_clip_triangulate.h"
 
@@ -458,6 +459,7 @@ namespace tesselate
 
 	void	end_shape()
 	{
+		TU_PROFILE_ZONE("tesselate::end_shape");
 		output_current_segments();
 		s_accepter = NULL;
 		s_current_path.clear();
@@ -711,6 +713,8 @@ namespace tesselate_new
 	
 	void	end_shape()
 	{
+		TU_PROFILE_ZONE("tesselate::end_shape");
+
 		// TODO: there's a ton of gratuitous array copying in
 		// here! Fix it by being smarter, and by better
 		// abstracting the I/O methods for the triangulator.
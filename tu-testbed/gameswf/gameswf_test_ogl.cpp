@@ -19,11 +19,13 @@
 #include "base/tu_file.h"
 #include "base/tu_types.h"
 #include "base/tu_timer.h"
+#include "base/tu_async_log.h"
 #include "gameswf/gameswf_types.h"
 #include "gameswf/gameswf_impl.h"
 #include "gameswf/gameswf_root.h"
 #include "gameswf/gameswf_freetype.h"
 #include "gameswf/gameswf_player.h"
+#include "gameswf/gameswf_sound_handler_offline.h"
 
 #if TU_ENABLE_NETWORK == 1
 #	include "net/tu_net_file.h"
@@ -59,6 +61,7 @@ void	print_usage()
 		"  -v          Be verbose; i.e. print log messages to stdout\n"
 		"  -va         Be verbose about movie Actions\n"
 		"  -vp         Be verbose about parsing the movie\n"
+		"  -l          Write the log from a background thread (makes -va & -vp cheaper)\n"
 		"  -ml <bias>  Specify the texture LOD bias (float, default is -1)\n"
 		"  -p          Run full speed (no sleep) and log frame rate\n"
 		"  -1          Play once; exit when/if movie reaches the last frame\n"
@@ -73,6 +76,8 @@ void	print_usage()
 		"  -w <w>x<h>  Specify the window size, for example 1024x768\n"
 		"  -f          Force realtime framerate\n"
 		"  -i          Grub bitmaps from swf file\n"
+		"  -o <file>   Mix the sound into the given .WAV file instead of playing it;\n"
+		"              with -r 0 this runs faster than real time (-p logs the speed)\n"
 		"\n"
 		"keys:\n"
 		"  CTRL-Q          Quit/Exit\n"
@@ -310,6 +315,7 @@ int	main(int argc, char *argv[])
 		bool	sdl_cursor = true;
 		float	tex_lod_bias;
 		bool	force_realtime_framerate = false;
+		const char*	wav_file = NULL;
 
 	#ifdef _WIN32
 
@@ -517,6 +523,12 @@ int	main(int argc, char *argv[])
 					}
 					// ...
 				}
+				else if (argv[arg][1] == 'l')
+				{
+					// Log asynchronously.
+					tu_async_log::start();
+					tu_async_log::install_crash_handler();
+				}
 				else if (argv[arg][1] == 'm')
 				{
 					if (argv[arg][2] == 'l') {
@@ -540,6 +552,21 @@ int	main(int argc, char *argv[])
 					player->set_separate_thread(false);
 					player->set_log_bitmap_info(true);
 				}
+				else if (argv[arg][1] == 'o')
+				{
+					// Render the sound to a file.
+					arg++;
+					if (arg < argc)
+					{
+						wav_file = argv[arg];
+					}
+					else
+					{
+						fprintf(stderr, "-o must be followed by a .WAV filename\n");
+						print_usage();
+						exit(1);
+					}
+				}
 			}
 			else
 			{
@@ -581,9 +608,17 @@ int	main(int argc, char *argv[])
 		
 		gameswf::sound_handler*	sound = NULL;
 		gameswf::render_handler*	render = NULL;
+		if (wav_file)
+		{
+			// Works without rendering too; the simulated time
+			// makes the output reproducible.
+			sound = gameswf::create_sound_handler_offline(wav_file);
+			gameswf::set_sound_handler(sound);
+			do_sound = true;
+		}
 		if (do_render)
 		{
-			if (do_sound)
+			if (do_sound && sound == NULL)
 			{
 
 #if TU_USE_SDL == 1
@@ -1127,6 +1162,19 @@ int	main(int argc, char *argv[])
 
 	done:
 
+			if (wav_file && s_measure_performance)
+			{
+				gameswf::offline_sound_handler* offline = (gameswf::offline_sound_handler*) sound;
+				gameswf::mixer_stats stats;
+				offline->get_mixer_stats(&stats);
+
+				double	audio_sec = offline->get_rendered_seconds();
+				double	mix_sec = stats.m_total_mix_ms / 1000.0;
+				printf("wrote %.2f sec of audio to %s in %.3f sec\n",
+					audio_sec, wav_file, offline->get_render_seconds());
+				printf("mixer: %.3f sec, %.0fx real time, peak %d voices\n",
+					mix_sec, mix_sec > 0 ? audio_sec / mix_sec : 0.0, stats.m_peak_voices);
+			}
 
 			gameswf::set_sound_handler(NULL);
 			delete sound;
@@ -12,6 +12,7 @@
 
 #include "gameswf/gameswf_text.h"
 #include "gameswf/gameswf_sprite.h"
+#include "base/tu_arena.h"
 
 namespace gameswf
 {
@@ -26,6 +27,10 @@ namespace gameswf
 			return;
 		}
 
+		// These tables are shared by every player, so keep
+		// them off the current player's heap.
+		tu_arena::scoped_heap	no_arena(NULL);
+
 		s_gameswf_key_to_ascii.resize(key::KEYCOUNT);
 		s_gameswf_key_to_ascii_shifted.resize(key::KEYCOUNT);
 
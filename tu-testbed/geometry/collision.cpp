@@ -81,6 +81,255 @@ void	ray_query::compute_inverses()
 }
 
 
+lss_query::lss_query(const vec3& start_pos, const vec3& end_pos, float radius)
+	:
+	m_start(start_pos),
+	m_end(end_pos),
+	m_disp(end_pos - start_pos),
+	m_radius(radius)
+{
+	assert(m_radius >= 0);
+
+	for (int i = 0; i < 3; i++)
+	{
+		// 0 tells the traversal this axis doesn't move.
+		m_inv_disp[i] = fabsf(m_disp[i]) <= 1e-25f ? 0 : 1.0f / m_disp[i];
+	}
+}
+
+
+lss_query::lss_query(const vec3& center, float radius)
+	:
+	m_start(center),
+	m_end(center),
+	m_disp(vec3::zero),
+	m_inv_disp(vec3::zero),
+	m_radius(radius)
+{
+	assert(m_radius >= 0);
+}
+
+
+vec3	closest_point_on_triangle(const vec3& p, const vec3& v0, const vec3& v1, const vec3& v2)
+// Finds which Voronoi region of the triangle p is in; see Ericson,
+// _Real-Time Collision Detection_, 5.1.5.
+{
+	vec3	ab = v1 - v0;
+	vec3	ac = v2 - v0;
+
+	vec3	ap = p - v0;
+	float	d1 = ab * ap;
+	float	d2 = ac * ap;
+	if (d1 <= 0 && d2 <= 0) return v0;
+
+	vec3	bp = p - v1;
+	float	d3 = ab * bp;
+	float	d4 = ac * bp;
+	if (d3 >= 0 && d4 <= d3) return v1;
+
+	float	vc = d1 * d4 - d3 * d2;
+	if (vc <= 0 && d1 >= 0 && d3 <= 0)
+	{
+		// edge v0-v1
+		return v0 + ab * (d1 / (d1 - d3));
+	}
+
+	vec3	cp = p - v2;
+	float	d5 = ab * cp;
+	float	d6 = ac * cp;
+	if (d6 >= 0 && d5 <= d6) return v2;
+
+	float	vb = d5 * d2 - d1 * d6;
+	if (vb <= 0 && d2 >= 0 && d6 <= 0)
+	{
+		// edge v0-v2
+		return v0 + ac * (d2 / (d2 - d6));
+	}
+
+	float	va = d3 * d6 - d5 * d4;
+	if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+	{
+		// edge v1-v2
+		return v1 + (v2 - v1) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+	}
+
+	// Inside the face.
+	float	denom = 1.0f / (va + vb + vc);
+	return v0 + ab * (vb * denom) + ac * (vc * denom);
+}
+
+
+static bool	sweep_sphere(const vec3& m, const vec3& d, float r, float* t)
+// The sphere center moves along m + d * t, starting outside a sphere
+// of radius r at the origin.  If it reaches that sphere before *t,
+// set *t to when and return true.
+{
+	float	a = d * d;
+	float	b = m * d;
+	float	c = m * m - r * r;
+	if (b >= 0 || a <= 0)
+	{
+		return false;	// moving away, or not moving
+	}
+	float	disc = b * b - a * c;
+	if (disc < 0)
+	{
+		return false;
+	}
+	float	root = (-b - sqrtf(disc)) / a;
+	if (root < 0 || root >= *t)
+	{
+		return false;
+	}
+	*t = root;
+	return true;
+}
+
+
+static bool	sweep_edge(const vec3& start, const vec3& disp, float r, const vec3& a, const vec3& b, float* t, vec3* point)
+// Like sweep_sphere(), against the cylinder of radius r around edge
+// a-b; *point gets the contact point on the edge.  The end caps are
+// the vertex spheres, handled separately.
+{
+	vec3	e = b - a;
+	float	ee = e * e;
+	if (ee <= 0)
+	{
+		return false;
+	}
+
+	// Work in the plane perpendicular to the edge.
+	vec3	m = start - a;
+	float	me = m * e;
+	float	de = disp * e;
+	vec3	m_perp = m - e * (me / ee);
+	vec3	d_perp = disp - e * (de / ee);
+
+	float	t_edge = *t;
+	if (sweep_sphere(m_perp, d_perp, r, &t_edge) == false)
+	{
+		return false;
+	}
+
+	float	s = (me + de * t_edge) / ee;
+	if (s < 0 || s > 1)
+	{
+		return false;	// hits the infinite cylinder off the ends of the edge
+	}
+
+	*t = t_edge;
+	*point = a + e * s;
+	return true;
+}
+
+
+bool	lss_hit_triangle(const lss_query& query, const vec3& v0, const vec3& v1, const vec3& v2, lss_hit* hit)
+// The first contact is either with the face, one of its edges, or
+// one of its verts.  Check for an initial overlap first; after that
+// the earliest of those contacts is the answer.
+{
+	assert(hit);
+
+	float	r = query.m_radius;
+
+	vec3	normal;
+	normal.set_cross(v1 - v0, v2 - v0);
+	if (normal.sqrmag() <= 0)
+	{
+		return false;	// degenerate
+	}
+	normal.normalize();
+
+	float	start_dist = (query.m_start - v0) * normal;
+	float	end_dist = (query.m_end - v0) * normal;
+	if (start_dist < 0
+	    || (start_dist > r && end_dist > r))
+	{
+		// Starts behind the face, or stays too far in front
+		// of it.
+		return false;
+	}
+
+	// Overlapping at the start?
+	vec3	closest = closest_point_on_triangle(query.m_start, v0, v1, v2);
+	vec3	to_center = query.m_start - closest;
+	float	dist2 = to_center.sqrmag();
+	if (dist2 < r * r)
+	{
+		float	dist = sqrtf(dist2);
+		float	depth = r - dist;
+		if (hit->m_t < 0 || (hit->m_t == 0 && hit->m_depth >= depth))
+		{
+			return false;
+		}
+		hit->m_t = 0;
+		hit->m_depth = depth;
+		hit->m_point = closest;
+		hit->m_normal = dist > 1e-6f ? to_center / dist : normal;
+		return true;
+	}
+
+	float	t = hit->m_t;
+	vec3	point;
+	bool	found = false;
+
+	// Face: the sphere touches the plane when the center is r in
+	// front of it.
+	if (end_dist < start_dist)
+	{
+		float	t_plane = (start_dist - r) / (start_dist - end_dist);
+		if (t_plane >= 0 && t_plane < t)
+		{
+			vec3	p = query.m_start + query.m_disp * t_plane - normal * r;
+
+			// Inside all three edges?
+			vec3	c0, c1, c2;
+			c0.set_cross(v1 - v0, p - v0);
+			c1.set_cross(v2 - v1, p - v1);
+			c2.set_cross(v0 - v2, p - v2);
+			if (c0 * normal >= 0 && c1 * normal >= 0 && c2 * normal >= 0)
+			{
+				t = t_plane;
+				point = p;
+				found = true;
+			}
+		}
+	}
+
+	// Edges & verts.  If the face was hit, an edge or vert can only
+	// be hit at the same time, so don't bother.
+	if (found == false)
+	{
+		if (sweep_edge(query.m_start, query.m_disp, r, v0, v1, &t, &point)) found = true;
+		if (sweep_edge(query.m_start, query.m_disp, r, v1, v2, &t, &point)) found = true;
+		if (sweep_edge(query.m_start, query.m_disp, r, v2, v0, &t, &point)) found = true;
+
+		const vec3*	verts[3] = { &v0, &v1, &v2 };
+		for (int i = 0; i < 3; i++)
+		{
+			if (sweep_sphere(query.m_start - *verts[i], query.m_disp, r, &t))
+			{
+				point = *verts[i];
+				found = true;
+			}
+		}
+	}
+
+	if (found == false)
+	{
+		return false;
+	}
+
+	hit->m_t = t;
+	hit->m_depth = 0;
+	hit->m_point = point;
+	hit->m_normal = query.m_start + query.m_disp * t - point;
+	hit->m_normal.normalize(normal);
+
+	return true;
+}
+
+
 
 
 // Local Variables:
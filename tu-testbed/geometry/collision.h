@@ -16,6 +16,7 @@
 // Actually a line-segment query.
 struct ray_query
 {
+	ray_query() {}	// uninitialized, for arrays of queries
 	ray_query(const vec3& start_pos, const vec3& unit_direction, float distance);
 
 	enum start_end_enum { start_end };
@@ -33,6 +34,58 @@ struct ray_query
 };
 
 
+// Nearest hit along a ray_query.
+struct ray_hit
+{
+	ray_hit() : m_t(1), m_face_index(-1), m_normal(vec3::zero) {}
+
+	float	m_t;	// hit point is m_start + (m_end - m_start) * m_t
+	int	m_face_index;	// triangle index in the source mesh, or -1
+	vec3	m_normal;	// unit normal of the face that was hit
+};
+
+
+// Line-swept sphere: a sphere of radius m_radius moving from m_start
+// to m_end; i.e. a capsule.  With m_start == m_end it's a sphere
+// overlap query.
+struct lss_query
+{
+	lss_query() {}	// uninitialized, for arrays of queries
+	lss_query(const vec3& start_pos, const vec3& end_pos, float radius);
+	lss_query(const vec3& center, float radius);	// sphere
+
+	vec3	m_start;
+	vec3	m_end;
+	vec3	m_disp;		// m_end - m_start
+	vec3	m_inv_disp;	// 1/x for each component of m_disp; 0 if x is tiny
+	float	m_radius;
+};
+
+
+// First contact along an lss_query.
+struct lss_hit
+{
+	lss_hit() : m_t(1), m_depth(0), m_face_index(-1), m_point(vec3::zero), m_normal(vec3::zero) {}
+
+	float	m_t;	// sphere center is at m_start + m_disp * m_t
+	float	m_depth;	// penetration at m_t; only non-zero if the sphere starts out overlapping (m_t == 0)
+	int	m_face_index;	// triangle index in the source mesh, or -1
+	vec3	m_point;	// contact point on the face
+	vec3	m_normal;	// unit contact normal, from m_point toward the sphere center
+};
+
+
+// Return the point on triangle (v0, v1, v2) nearest to p.
+vec3	closest_point_on_triangle(const vec3& p, const vec3& v0, const vec3& v1, const vec3& v2);
+
+// If the query touches the triangle earlier than hit->m_t (or at the
+// same time but deeper), fill in *hit (except m_face_index) and
+// return true.  Triangles are one-sided like the ray queries: the
+// front is the side (v1 - v0) x (v2 - v0) points to, and a query
+// whose center starts behind the plane doesn't hit.
+bool	lss_hit_triangle(const lss_query& query, const vec3& v0, const vec3& v1, const vec3& v2, lss_hit* hit);
+
+
 #endif // COLLISION_H
 
 
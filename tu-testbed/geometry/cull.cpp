@@ -4,6 +4,7 @@
 
 
 #include "geometry/cull.h"
+#include "base/tu_float4.h"
 #include "base/tu_math.h"
 #include "base/utility.h"
 
@@ -58,5 +59,423 @@ result_info	compute_box_visibility(const vec3& center, const vec3& extent, const
 }
 
 
+//
+// batches
+//
+
+
+// The frustum planes, each component splatted across a float4.
+struct frustum4 {
+	float4	nx[6], ny[6], nz[6];	// normal
+	float4	ax[6], ay[6], az[6];	// abs(normal)
+	float4	d[6];
+
+	frustum4(const plane_info frustum[6])
+	{
+		for (int i = 0; i < 6; i++) {
+			const vec3&	n = frustum[i].normal;
+			nx[i] = float4(n.x);
+			ny[i] = float4(n.y);
+			nz[i] = float4(n.z);
+			ax[i] = float4(fabsf(n.x));
+			ay[i] = float4(fabsf(n.y));
+			az[i] = float4(fabsf(n.z));
+			d[i] = float4(frustum[i].d);
+		}
+	}
+};
+
+
+static int	compute_four(const frustum4& f,
+			     const float4& cx, const float4& cy, const float4& cz,
+			     const float4& ex, const float4& ey, const float4& ez,
+			     Uint32* planes)
+// Check four boxes against the planes that are active for each of
+// them.  Byte i of *planes holds the active planes for the box in lane
+// i, and gets updated the same way compute_box_visibility() updates
+// active_planes.  Returns a mask with bit i set if the box in lane i
+// is culled.
+{
+	float4	zero(0.0f);
+
+	int	culled = 0;
+	Uint32	result = 0;
+	for (int i = 0; i < 6; i++) {
+		// Gather bit i of each byte into the low four bits.
+		Uint32	x = (*planes >> i) & 0x01010101;
+		int	lanes = (x | (x >> 7) | (x >> 14) | (x >> 21)) & 15 & ~culled;
+		if (lanes == 0) {
+			continue;
+		}
+
+		// Same arithmetic as compute_box_visibility(), so the
+		// results match exactly.
+		float4	d = f.nx[i] * cx + f.ny[i] * cy + f.nz[i] * cz - f.d[i];
+		float4	extent_toward_plane = ex * f.ax[i] + ey * f.ay[i] + ez * f.az[i];
+		int	out = (d < zero - extent_toward_plane).bits() & lanes;
+		int	in = (d > extent_toward_plane).bits() & lanes;
+		culled |= out;
+
+		// Scatter the lanes that still need this plane back
+		// into bit i of each byte.
+		Uint32	still_active = lanes & ~in;
+		result |= ((still_active & 1) | ((still_active & 2) << 7) | ((still_active & 4) << 14) | ((still_active & 8) << 21)) << i;
+	}
+
+	// Culled boxes have no active planes.
+	for (int j = 0; j < 4; j++) {
+		if (culled & (1 << j)) result &= ~(0xFFu << (j * 8));
+	}
+	*planes = result;
+	return culled;
+}
+
+
+static int	compute_four(const frustum4& f, const box_array& boxes, int first, Uint32* planes)
+// compute_four() on boxes [first, first + 4).
+{
+	return compute_four(f,
+			    float4::load(boxes.center_x + first),
+			    float4::load(boxes.center_y + first),
+			    float4::load(boxes.center_z + first),
+			    float4::load(boxes.extent_x + first),
+			    float4::load(boxes.extent_y + first),
+			    float4::load(boxes.extent_z + first),
+			    planes);
+}
+
+
+static result_info	compute_one(const box_array& boxes, int i, const plane_info frustum[6], result_info in)
+// compute_box_visibility() on box i.
+{
+	return compute_box_visibility(
+		vec3(boxes.center_x[i], boxes.center_y[i], boxes.center_z[i]),
+		vec3(boxes.extent_x[i], boxes.extent_y[i], boxes.extent_z[i]),
+		frustum,
+		in);
+}
+
+
+void	compute_box_visibility_batch(int count, const box_array& boxes,
+				     const plane_info frustum[6], const result_info in[], result_info out[])
+{
+	frustum4	f(frustum);
+
+	int	i = 0;
+	for ( ; i + 4 <= count; i += 4) {
+		Uint32	planes = 0x3f3f3f3f;
+		if (in) {
+			planes = in[i].active_planes | (in[i + 1].active_planes << 8)
+				| (in[i + 2].active_planes << 16) | (Uint32(in[i + 3].active_planes) << 24);
+		}
+		int	culled = compute_four(f, boxes, i, &planes);
+		for (int j = 0; j < 4; j++) {
+			out[i + j] = result_info((culled >> j) & 1, Uint8(planes >> (j * 8)));
+		}
+	}
+	for ( ; i < count; i++) {
+		out[i] = compute_one(boxes, i, frustum, in ? in[i] : result_info());
+	}
+}
+
+
+static void	compute_gathered(const frustum4& f, const box_array& boxes, const int index[4], int count,
+				 result_info out[])
+// Check up to four scattered boxes, each starting from the active
+// planes already in its out[] entry.  Unused lanes repeat the first
+// box with no active planes, so they aren't tested.
+{
+	int	k[4];
+	Uint32	planes = 0;
+	for (int j = 0; j < 4; j++) {
+		k[j] = j < count ? index[j] : index[0];
+		if (j < count) {
+			planes |= Uint32(out[k[j]].active_planes) << (j * 8);
+		}
+	}
+
+	int	culled = compute_four(f,
+		float4(boxes.center_x[k[0]], boxes.center_x[k[1]], boxes.center_x[k[2]], boxes.center_x[k[3]]),
+		float4(boxes.center_y[k[0]], boxes.center_y[k[1]], boxes.center_y[k[2]], boxes.center_y[k[3]]),
+		float4(boxes.center_z[k[0]], boxes.center_z[k[1]], boxes.center_z[k[2]], boxes.center_z[k[3]]),
+		float4(boxes.extent_x[k[0]], boxes.extent_x[k[1]], boxes.extent_x[k[2]], boxes.extent_x[k[3]]),
+		float4(boxes.extent_y[k[0]], boxes.extent_y[k[1]], boxes.extent_y[k[2]], boxes.extent_y[k[3]]),
+		float4(boxes.extent_z[k[0]], boxes.extent_z[k[1]], boxes.extent_z[k[2]], boxes.extent_z[k[3]]),
+		&planes);
+	for (int j = 0; j < count; j++) {
+		out[index[j]] = result_info((culled >> j) & 1, Uint8(planes >> (j * 8)));
+	}
+}
+
+
+void	compute_tree_visibility(int count, const box_array& boxes, const int parent[],
+				const plane_info frustum[6], result_info out[])
+{
+	frustum4	f(frustum);
+
+	// Nodes that still have active planes after their parent,
+	// waiting to be tested four at a time.  Their out[] entries
+	// hold the parent's planes meanwhile.
+	int	pending[4];
+	int	pending_count = 0;
+
+	for (int i = 0; i < count; i++) {
+		int	p = parent[i];
+		assert(p < i);
+
+		if (pending_count > 0 && p >= pending[0]) {
+			// The parent may not be done yet.
+			for (int j = 0; j < pending_count; j++) {
+				if (pending[j] == p) {
+					compute_gathered(f, boxes, pending, pending_count, out);
+					pending_count = 0;
+					break;
+				}
+			}
+		}
+
+		// Under a culled or entirely visible parent there's
+		// nothing to test.  (A culled parent has no active
+		// planes.)
+		out[i] = p >= 0 ? out[p] : result_info();
+		if (out[i].active_planes == 0) {
+			continue;
+		}
+
+		pending[pending_count++] = i;
+		if (pending_count == 4) {
+			compute_gathered(f, boxes, pending, pending_count, out);
+			pending_count = 0;
+		}
+	}
+	if (pending_count > 0) {
+		compute_gathered(f, boxes, pending, pending_count, out);
+	}
+}
+
+
 }; // end namespace cull
 
+
+
+#ifdef CULL_TEST
+
+
+// Checks the batch culling routines against compute_box_visibility(),
+// and times them on a million boxes.
+//
+// g++ cull.cpp geometry.cpp ../base/container.cpp ../base/membuf.cpp ../base/tu_file.cpp ../base/tu_random.cpp ../base/tu_timer.cpp ../base/utf8.cpp -O2 -I.. -DCULL_TEST -o cull_test
+
+
+#include "base/container.h"
+#include "base/tu_random.h"
+#include "base/tu_timer.h"
+#include <stdio.h>
+
+
+static const int	BOX_COUNT = 1000000;
+static const int	TREE_LEVELS = 10;	// quadtree; 349525 nodes
+static const int	REPEAT_COUNT = 20;
+static const float	WORLD_SIZE = 1000;
+
+
+static float	random_float(float max)
+{
+	return (tu_random::next_random() & 0xFFFFFF) / float(0xFFFFFF) * max;
+}
+
+
+static void	make_frustum(plane_info frustum[6], const vec3& eye, const vec3& dir, float far_dist)
+// 90-degree frustum looking along (horizontal) dir, with the normals
+// pointing inward.
+{
+	vec3	f = dir;
+	f.normalize();
+	vec3	right = f.cross(vec3::z_axis);
+	right.normalize();
+	vec3	n[4] = { f + right, f - right, f + vec3::z_axis, f - vec3::z_axis };
+	for (int i = 0; i < 4; i++) {
+		n[i].normalize();
+		frustum[i].set(n[i], n[i] * eye);
+	}
+	frustum[4].set(f, f * eye + 1);
+	frustum[5].set(-f, -(f * eye + far_dist));
+}
+
+
+// Boxes stored both ways: vec3's for the scalar code, and separate
+// arrays for the batch code.
+struct test_boxes {
+	array<vec3>	center, extent;
+	array<float>	cx, cy, cz, ex, ey, ez;
+
+	void	add(const vec3& c, const vec3& e)
+	{
+		center.push_back(c);
+		extent.push_back(e);
+		cx.push_back(c.x);
+		cy.push_back(c.y);
+		cz.push_back(c.z);
+		ex.push_back(e.x);
+		ey.push_back(e.y);
+		ez.push_back(e.z);
+	}
+
+	cull::box_array	get_array() const
+	{
+		cull::box_array	a;
+		a.center_x = &cx[0];
+		a.center_y = &cy[0];
+		a.center_z = &cz[0];
+		a.extent_x = &ex[0];
+		a.extent_y = &ey[0];
+		a.extent_z = &ez[0];
+		return a;
+	}
+};
+
+
+static void	add_quadtree(test_boxes* boxes, array<int>* parent)
+// Breadth-first quadtree over a terrain-like slab.
+{
+	int	level_start = 0;
+	boxes->add(vec3(WORLD_SIZE / 2, WORLD_SIZE / 2, 50), vec3(WORLD_SIZE / 2, WORLD_SIZE / 2, 50));
+	parent->push_back(-1);
+	for (int level = 1; level < TREE_LEVELS; level++) {
+		int	level_end = boxes->center.size();
+		for (int p = level_start; p < level_end; p++) {
+			vec3	c = boxes->center[p];
+			float	half = boxes->extent[p].x / 2;
+			for (int j = 0; j < 4; j++) {
+				vec3	cc(c.x + ((j & 1) ? half : -half), c.y + ((j & 2) ? half : -half), 0);
+				// Children's vertical extent shrinks a bit, like terrain chunks.
+				float	top = 50 + random_float(50);
+				cc.z = top / 2;
+				boxes->add(cc, vec3(half, half, top / 2));
+				parent->push_back(p);
+			}
+		}
+		level_start = level_end;
+	}
+}
+
+
+static int	count_differences(int count, const cull::result_info a[], const cull::result_info b[])
+{
+	int	differences = 0;
+	for (int i = 0; i < count; i++) {
+		if (a[i].culled != b[i].culled || a[i].active_planes != b[i].active_planes) differences++;
+	}
+	return differences;
+}
+
+
+int	main()
+{
+	tu_random::seed_random(1234);
+
+	test_boxes	boxes;
+	array<cull::result_info>	in;
+	for (int i = 0; i < BOX_COUNT; i++) {
+		vec3	e(0.5f + random_float(10), 0.5f + random_float(10), 0.5f + random_float(10));
+		boxes.add(vec3(random_float(WORLD_SIZE), random_float(WORLD_SIZE), random_float(WORLD_SIZE)), e);
+		in.push_back(cull::result_info(false, Uint8(tu_random::next_random() & 0x3f)));
+	}
+
+	test_boxes	tree;
+	array<int>	parent;
+	add_quadtree(&tree, &parent);
+
+	plane_info	frustum[6];
+	make_frustum(frustum, vec3(WORLD_SIZE / 2, WORLD_SIZE / 2, WORLD_SIZE / 2), vec3(1, 0.3f, 0), WORLD_SIZE);
+	plane_info	tree_frustum[6];
+	make_frustum(tree_frustum, vec3(WORLD_SIZE / 2, WORLD_SIZE / 2, 60), vec3(1, 0.7f, 0), WORLD_SIZE);
+
+	array<cull::result_info>	scalar_out, batch_out;
+	scalar_out.resize(BOX_COUNT);
+	batch_out.resize(BOX_COUNT);
+	int	differences = 0;
+	int	visible_count = 0;
+
+	// Flat list, all planes active.
+	uint64	start_ticks = tu_timer::get_profile_ticks();
+	for (int r = 0; r < REPEAT_COUNT; r++) {
+		for (int i = 0; i < BOX_COUNT; i++) {
+			scalar_out[i] = cull::compute_box_visibility(boxes.center[i], boxes.extent[i], frustum, cull::result_info());
+		}
+	}
+	double	scalar_seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+
+	start_ticks = tu_timer::get_profile_ticks();
+	for (int r = 0; r < REPEAT_COUNT; r++) {
+		cull::compute_box_visibility_batch(BOX_COUNT, boxes.get_array(), frustum, NULL, &batch_out[0]);
+	}
+	double	batch_seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+	differences += count_differences(BOX_COUNT, &scalar_out[0], &batch_out[0]);
+	for (int i = 0; i < BOX_COUNT; i++) {
+		if (batch_out[i].culled == false) visible_count++;
+	}
+
+	// Flat list, random subsets of planes active.
+	start_ticks = tu_timer::get_profile_ticks();
+	for (int r = 0; r < REPEAT_COUNT; r++) {
+		for (int i = 0; i < BOX_COUNT; i++) {
+			scalar_out[i] = cull::compute_box_visibility(boxes.center[i], boxes.extent[i], frustum, in[i]);
+		}
+	}
+	double	scalar_partial_seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+
+	start_ticks = tu_timer::get_profile_ticks();
+	for (int r = 0; r < REPEAT_COUNT; r++) {
+		cull::compute_box_visibility_batch(BOX_COUNT, boxes.get_array(), frustum, &in[0], &batch_out[0]);
+	}
+	double	batch_partial_seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+	differences += count_differences(BOX_COUNT, &scalar_out[0], &batch_out[0]);
+
+	// Tree; the scalar version is the usual walk, skipping the
+	// tests under culled or entirely visible nodes.
+	int	node_count = tree.center.size();
+	start_ticks = tu_timer::get_profile_ticks();
+	for (int r = 0; r < REPEAT_COUNT; r++) {
+		for (int i = 0; i < node_count; i++) {
+			int	p = parent[i];
+			if (p >= 0 && scalar_out[p].culled) {
+				scalar_out[i] = cull::result_info(true, 0);
+			} else {
+				cull::result_info	start = p >= 0 ? scalar_out[p] : cull::result_info();
+				scalar_out[i] = start.active_planes
+					? cull::compute_box_visibility(tree.center[i], tree.extent[i], tree_frustum, start)
+					: start;
+			}
+		}
+	}
+	double	scalar_tree_seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+
+	start_ticks = tu_timer::get_profile_ticks();
+	for (int r = 0; r < REPEAT_COUNT; r++) {
+		cull::compute_tree_visibility(node_count, tree.get_array(), &parent[0], tree_frustum, &batch_out[0]);
+	}
+	double	batch_tree_seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+	differences += count_differences(node_count, &scalar_out[0], &batch_out[0]);
+	int	tree_visible_count = 0;
+	for (int i = 0; i < node_count; i++) {
+		if (batch_out[i].culled == false) tree_visible_count++;
+	}
+
+	printf("%d boxes (%d visible), %d tree nodes (%d visible), %s\n",
+	       BOX_COUNT, visible_count, node_count, tree_visible_count,
+	       TU_CONFIG_USE_SSE2 ? "SSE2" : "no SSE2");
+	printf("%d results differ\n\n", differences);
+	printf("Mboxes/s             scalar     batch\n");
+	printf("all planes active  %8.1f  %8.1f\n",
+	       BOX_COUNT * REPEAT_COUNT / scalar_seconds / 1e6, BOX_COUNT * REPEAT_COUNT / batch_seconds / 1e6);
+	printf("some planes active %8.1f  %8.1f\n",
+	       BOX_COUNT * REPEAT_COUNT / scalar_partial_seconds / 1e6, BOX_COUNT * REPEAT_COUNT / batch_partial_seconds / 1e6);
+	printf("tree               %8.1f  %8.1f\n",
+	       node_count * REPEAT_COUNT / scalar_tree_seconds / 1e6, node_count * REPEAT_COUNT / batch_tree_seconds / 1e6);
+
+	return differences ? 1 : 0;
+}
+
+
+#endif // CULL_TEST
@@ -25,6 +25,37 @@ namespace cull {
 	
 	result_info	compute_box_visibility(const vec3& center, const vec3& extent,
 					       const plane_info frustum[6], result_info in);
+
+
+	// Boxes for the batch routines, as separate arrays of each
+	// coordinate: box i has center (center_x[i], center_y[i],
+	// center_z[i]), extent (extent_x[i], ...).
+	struct box_array {
+		const float*	center_x;
+		const float*	center_y;
+		const float*	center_z;
+		const float*	extent_x;
+		const float*	extent_y;
+		const float*	extent_z;
+	};
+
+	// Same as calling compute_box_visibility() on each box, with
+	// the results identical, but four boxes at a time.  in may be
+	// NULL to start every box with all planes active; otherwise
+	// in and out may be the same array.
+	void	compute_box_visibility_batch(int count, const box_array& boxes,
+					     const plane_info frustum[6], const result_info in[], result_info out[]);
+
+	// For a hierarchy of boxes where each box contains its
+	// children (e.g. a chunk tree).  parent[i] is the index of box
+	// i's parent, or -1 for a root, and must be less than i.
+	// Children of culled boxes are culled, and children of boxes
+	// that are entirely inside are visible with no active planes,
+	// without being tested; the boxes that do need testing are
+	// gathered and tested four at a time.  In breadth-first order
+	// a group is only rarely cut short by a parent in it.
+	void	compute_tree_visibility(int count, const box_array& boxes, const int parent[],
+					const plane_info frustum[6], result_info out[]);
 };
 
 
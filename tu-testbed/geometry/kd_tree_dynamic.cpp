@@ -9,6 +9,9 @@
 
 #include "geometry/kd_tree_dynamic.h"
 #include "base/tu_file.h"
+#include "base/tu_swap.h"
+#include "base/tu_atomic.h"
+#include "base/tu_thread.h"
 #include <float.h>
 
 
@@ -51,16 +54,20 @@ float	kd_tree_dynamic::face::get_max_coord(int axis, const array<vec3>& verts) c
 void split_mesh(
 	array<vec3>* verts0,
 	array<int>* tris0,
+	array<int>* face_indices0,
 	array<vec3>* verts1,
 	array<int>* tris1,
+	array<int>* face_indices1,
 	int vert_count,
 	const vec3 verts[],
 	int triangle_count,
 	const int indices[],
+	const int face_indices[],
 	int axis,
 	float offset)
 // Divide a mesh into two pieces, roughly along the plane [axis]=offset.
-// Assign faces to one side or the other based on centroid.
+// Assign faces to one side or the other based on centroid.  The
+// face_indices arrays get each face's index in the original mesh.
 {
 	assert(verts0 && tris0 && verts1 && tris1);
 	assert(verts0->size() == 0);
@@ -68,9 +75,18 @@ void split_mesh(
 	assert(verts1->size() == 0);
 	assert(tris1->size() == 0);
 
-	// Remap table from verts array to new verts0/1 arrays.
-	hash<int, int>	verts_to_verts0;
-	hash<int, int>	verts_to_verts1;
+	// Remap table from verts array to new verts0/1 arrays; -1
+	// means not added yet.  (Plain arrays, since the source
+	// indices are dense; a hash is much slower here.)
+	array<int>	verts_to_verts0;
+	array<int>	verts_to_verts1;
+	verts_to_verts0.resize(vert_count);
+	verts_to_verts1.resize(vert_count);
+	for (int i = 0; i < vert_count; i++)
+	{
+		verts_to_verts0[i] = -1;
+		verts_to_verts1[i] = -1;
+	}
 
 	// Divide the faces.
 	for (int i = 0; i < triangle_count; i++)
@@ -83,22 +99,21 @@ void split_mesh(
 		};
 
 		float centroid = (verts[v[0]][axis] + verts[v[1]][axis] + verts[v[2]][axis]) / 3.0f;
+		int	face_index = face_indices ? face_indices[i] : i;
 
 		if (centroid < offset)
 		{
+			face_indices0->push_back(face_index);
+
 			// Put this face into verts0/tris0
 			for (int ax = 0; ax < 3; ax++)
 			{
-				int	new_index;
-				if (verts_to_verts0.get(v[ax], &new_index))
-				{
-					// OK.
-				}
-				else
+				int	new_index = verts_to_verts0[v[ax]];
+				if (new_index == -1)
 				{
 					// Must add.
 					new_index = verts0->size();
-					verts_to_verts0.add(v[ax], new_index);
+					verts_to_verts0[v[ax]] = new_index;
 					verts0->push_back(verts[v[ax]]);
 				}
 				tris0->push_back(new_index);
@@ -106,19 +121,17 @@ void split_mesh(
 		}
 		else
 		{
+			face_indices1->push_back(face_index);
+
 			// Put this face into verts1/tris1
 			for (int ax = 0; ax < 3; ax++)
 			{
-				int	new_index;
-				if (verts_to_verts1.get(v[ax], &new_index))
-				{
-					// OK.
-				}
-				else
+				int	new_index = verts_to_verts1[v[ax]];
+				if (new_index == -1)
 				{
 					// Must add.
 					new_index = verts1->size();
-					verts_to_verts1.add(v[ax], new_index);
+					verts_to_verts1[v[ax]] = new_index;
 					verts1->push_back(verts[v[ax]]);
 				}
 				tris1->push_back(new_index);
@@ -172,7 +185,9 @@ static void	remap_vertex_order(kd_tree_dynamic::node* node, hash<int,int>* map_i
 	int vert_count,
 	const vec3 verts[],
 	int triangle_count,
-	const int indices[]
+	const int indices[],
+	const build_options& options /* = build_options() */,
+	const int face_indices[] /* = NULL */
 	)
 // Build one or more kd trees to represent the given mesh.
 {
@@ -187,15 +202,19 @@ static void	remap_vertex_order(kd_tree_dynamic::node* node, hash<int,int>* map_i
 
 		array<vec3>	verts0, verts1;
 		array<int>	tris0, tris1;
+		array<int>	face_indices0, face_indices1;
 		split_mesh(
 			&verts0,
 			&tris0,
+			&face_indices0,
 			&verts1,
 			&tris1,
+			&face_indices1,
 			vert_count,
 			verts,
 			triangle_count,
 			indices,
+			face_indices,
 			longest_axis,
 			offset);
 
@@ -208,13 +227,13 @@ static void	remap_vertex_order(kd_tree_dynamic::node* node, hash<int,int>* map_i
 			return;
 		}
 
-		build_trees(treelist, verts0.size(), &verts0[0], tris0.size() / 3, &tris0[0]);
-		build_trees(treelist, verts1.size(), &verts1[0], tris1.size() / 3, &tris1[0]);
+		build_trees(treelist, verts0.size(), &verts0[0], tris0.size() / 3, &tris0[0], options, &face_indices0[0]);
+		build_trees(treelist, verts1.size(), &verts1[0], tris1.size() / 3, &tris1[0], options, &face_indices1[0]);
 
 		return;
 	}
 
-	treelist->push_back(new kd_tree_dynamic(vert_count, verts, triangle_count, indices));
+	treelist->push_back(new kd_tree_dynamic(vert_count, verts, triangle_count, indices, options, face_indices));
 }
 
 
@@ -222,7 +241,9 @@ kd_tree_dynamic::kd_tree_dynamic(
 	int vert_count,
 	const vec3 verts[],
 	int triangle_count,
-	const int indices[])
+	const int indices[],
+	const build_options& options /* = build_options() */,
+	const int face_indices[] /* = NULL */)
 // Constructor; build the kd-tree from the given triangle soup.
 {
 	assert(vert_count > 0 && vert_count < 65536);
@@ -242,6 +263,7 @@ kd_tree_dynamic::kd_tree_dynamic(
 		f.m_vi[1] = indices[i * 3 + 1];
 		f.m_vi[2] = indices[i * 3 + 2];
 		f.m_flags = 0;	// @@ should be a way to initialize this
+		f.m_index = face_indices ? face_indices[i] : i;
 
 		faces.push_back(f);
 
@@ -253,7 +275,14 @@ kd_tree_dynamic::kd_tree_dynamic(
 
 	m_bound = bounds;
 
-	m_root = build_tree(1, faces.size(), &faces[0], bounds);
+	if (options.m_method == build_options::BINNED_SAH)
+	{
+		m_root = build_tree_sah(faces.size(), &faces[0], bounds, options.m_thread_count);
+	}
+	else
+	{
+		m_root = build_tree(1, faces.size(), &faces[0], bounds);
+	}
 
 #ifdef SORT_VERTICES
 	// Sort vertices in the order they first appear in a
@@ -422,6 +451,410 @@ kd_tree_dynamic::node*	kd_tree_dynamic::build_tree(int depth, int face_count, fa
 }
 
 
+//
+// Binned SAH builder
+//
+
+
+// The surface area heuristic estimates the cost of a split as
+//
+//   TRAVERSAL_COST + (area(neg) * neg_faces + area(pos) * pos_faces) / area(node)
+//
+// in units of one face test, since a random ray that hits the node
+// hits a child with probability proportional to the child's surface
+// area.  A leaf costs its face count.  Candidate splits come from
+// sorting face centroids into bins along each axis and trying each
+// boundary between bins; the neg & pos offsets are then the extents
+// of the faces on either side, as in the loose tree described in
+// kd_tree_dynamic.h.
+//
+// That estimate undervalues empty space: it treats both children as
+// leaves, so a split that only trims a node down to its faces looks
+// no better than leaving the node alone, although it lets every ray
+// that passes through the empty part skip the whole subtree.  So
+// before looking for a split, a node whose faces leave enough of it
+// empty at one end gets a node with only one child, which carves that
+// space off.
+//
+// Faces are referred to by index and partitioned in place, so there's
+// no copying of face data until the leaves are made.  Once a subtree
+// is big enough, its pos child is built on another thread while this
+// one does the neg child.
+
+
+static const int	SAH_BIN_COUNT = 32;
+static const float	SAH_TRAVERSAL_COST = 1.0f;
+static const float	SAH_EMPTY_FRACTION = 0.15f;	// carve off an empty end this big, relative to the node
+static const int	SAH_MAX_LEAF_FACES = 255;	// kd_tree_packed leaves can't hold more
+static const int	SAH_MIN_THREAD_FACES = 4096;	// smaller subtrees aren't worth a thread
+
+
+struct kd_sah_builder
+{
+	const kd_tree_dynamic::face*	m_faces;
+	array<axial_box>	m_face_bounds;
+	array<vec3>	m_centroids;
+
+	// Threads we may still start.
+	volatile int	m_free_threads;
+};
+
+
+struct kd_sah_bin
+{
+	int	m_count;
+	float	m_min;	// lowest face min coord of the faces in this bin
+	float	m_max;	// highest face max coord
+};
+
+
+static kd_tree_dynamic::node*	make_sah_leaf(const kd_sah_builder* b, const int indices[], int count)
+{
+	kd_tree_dynamic::node*	n = new kd_tree_dynamic::node;
+	n->m_leaf = new kd_tree_dynamic::leaf;
+	n->m_leaf->m_faces.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		n->m_leaf->m_faces[i] = b->m_faces[indices[i]];
+	}
+	return n;
+}
+
+
+static kd_tree_dynamic::node*	build_sah_node(kd_sah_builder* b, int indices[], int count, const axial_box& bounds);
+
+
+struct kd_sah_task
+// A subtree to build on another thread.
+{
+	kd_sah_builder*	m_builder;
+	int*	m_indices;
+	int	m_count;
+	axial_box	m_bounds;
+	kd_tree_dynamic::node*	m_result;
+
+	static void	run(void* arg)
+	{
+		kd_sah_task*	task = (kd_sah_task*) arg;
+		task->m_result = build_sah_node(task->m_builder, task->m_indices, task->m_count, task->m_bounds);
+	}
+};
+
+
+static kd_tree_dynamic::node*	build_sah_node(kd_sah_builder* b, int indices[], int count, const axial_box& bounds)
+// Build the subtree for the given faces, whose bounds (as the
+// run-time traversal sees them) are bounds.
+{
+	assert(count > 0);
+
+	if (count <= LEAF_FACE_COUNT)
+	{
+		return make_sah_leaf(b, indices, count);
+	}
+
+	// Range of the centroids, which is what we bin over.
+	vec3	centroid_min(vec3::flt_max);
+	vec3	centroid_max(vec3::minus_flt_max);
+	for (int i = 0; i < count; i++)
+	{
+		const vec3&	c = b->m_centroids[indices[i]];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			centroid_min[axis] = fmin(centroid_min[axis], c[axis]);
+			centroid_max[axis] = fmax(centroid_max[axis], c[axis]);
+		}
+	}
+
+	// Bin the faces on all three axes in one pass.
+	kd_sah_bin	bins[3][SAH_BIN_COUNT];
+	float	bin_scale[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float	extent = centroid_max[axis] - centroid_min[axis];
+		bin_scale[axis] = extent > EPSILON ? SAH_BIN_COUNT * 0.9999f / extent : 0;
+		for (int i = 0; i < SAH_BIN_COUNT; i++)
+		{
+			bins[axis][i].m_count = 0;
+			bins[axis][i].m_min = FLT_MAX;
+			bins[axis][i].m_max = -FLT_MAX;
+		}
+	}
+	for (int i = 0; i < count; i++)
+	{
+		const vec3&	c = b->m_centroids[indices[i]];
+		const axial_box&	fb = b->m_face_bounds[indices[i]];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			int	bin = imin(int((c[axis] - centroid_min[axis]) * bin_scale[axis]), SAH_BIN_COUNT - 1);
+			kd_sah_bin*	bn = &bins[axis][bin];
+			bn->m_count++;
+			bn->m_min = fmin(bn->m_min, fb.get_min()[axis]);
+			bn->m_max = fmax(bn->m_max, fb.get_max()[axis]);
+		}
+	}
+
+	// Carve off the biggest empty end, if there's one worth it.
+	int	carve_axis = -1;
+	bool	carve_neg = false;
+	float	carve_offset = 0;
+	float	carve_fraction = SAH_EMPTY_FRACTION;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float	extent = bounds.get_max()[axis] - bounds.get_min()[axis];
+		if (extent <= EPSILON)
+		{
+			continue;
+		}
+
+		// Every face is in some bin on each axis.
+		float	face_min = FLT_MAX;
+		float	face_max = -FLT_MAX;
+		for (int i = 0; i < SAH_BIN_COUNT; i++)
+		{
+			face_min = fmin(face_min, bins[axis][i].m_min);
+			face_max = fmax(face_max, bins[axis][i].m_max);
+		}
+
+		float	neg_empty = (face_min - bounds.get_min()[axis]) / extent;
+		float	pos_empty = (bounds.get_max()[axis] - face_max) / extent;
+		if (neg_empty > carve_fraction)
+		{
+			carve_fraction = neg_empty;
+			carve_axis = axis;
+			carve_neg = true;
+			carve_offset = face_min;
+		}
+		if (pos_empty > carve_fraction)
+		{
+			carve_fraction = pos_empty;
+			carve_axis = axis;
+			carve_neg = false;
+			carve_offset = face_max;
+		}
+	}
+	if (carve_axis >= 0)
+	{
+		// The carved child's bounds are tight on carve_axis, so
+		// it won't carve there again.
+		kd_tree_dynamic::node*	n = new kd_tree_dynamic::node;
+		n->m_axis = carve_axis;
+		axial_box	child_bounds(bounds);
+		if (carve_neg)
+		{
+			n->m_neg_offset = bounds.get_min()[carve_axis];
+			n->m_pos_offset = carve_offset;
+			child_bounds.set_axis_min(carve_axis, carve_offset);
+			n->m_pos = build_sah_node(b, indices, count, child_bounds);
+		}
+		else
+		{
+			n->m_neg_offset = carve_offset;
+			n->m_pos_offset = bounds.get_max()[carve_axis];
+			child_bounds.set_axis_max(carve_axis, carve_offset);
+			n->m_neg = build_sah_node(b, indices, count, child_bounds);
+		}
+		return n;
+	}
+
+	// Try each boundary between bins.
+	float	node_area = bounds.get_surface_area();
+	if (node_area <= 0)
+	{
+		node_area = 1;
+	}
+	float	best_cost = float(count);	// i.e. make a leaf
+	int	best_axis = -1;
+	int	best_bin = 0;
+	float	best_neg_offset = 0;
+	float	best_pos_offset = 0;
+	bool	must_split = count > SAH_MAX_LEAF_FACES;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (bin_scale[axis] == 0)
+		{
+			// All the centroids are in one plane.
+			continue;
+		}
+
+		// Sweep from the pos end, so we know what's on the pos
+		// side of each boundary.
+		int	pos_count[SAH_BIN_COUNT];
+		float	pos_min[SAH_BIN_COUNT];
+		int	running_count = 0;
+		float	running_min = FLT_MAX;
+		for (int i = SAH_BIN_COUNT - 1; i > 0; i--)
+		{
+			running_count += bins[axis][i].m_count;
+			running_min = fmin(running_min, bins[axis][i].m_min);
+			pos_count[i] = running_count;
+			pos_min[i] = running_min;
+		}
+
+		// Now from the neg end; boundary i is between bins
+		// i-1 and i.
+		int	neg_count = 0;
+		float	neg_max = -FLT_MAX;
+		for (int i = 1; i < SAH_BIN_COUNT; i++)
+		{
+			neg_count += bins[axis][i - 1].m_count;
+			neg_max = fmax(neg_max, bins[axis][i - 1].m_max);
+			if (neg_count == 0 || pos_count[i] == 0)
+			{
+				continue;
+			}
+
+			axial_box	neg_bounds(bounds);
+			neg_bounds.set_axis_max(axis, neg_max);
+			axial_box	pos_bounds(bounds);
+			pos_bounds.set_axis_min(axis, pos_min[i]);
+
+			float	cost = SAH_TRAVERSAL_COST
+				+ (neg_bounds.get_surface_area() * neg_count
+				   + pos_bounds.get_surface_area() * pos_count[i]) / node_area;
+			if (cost < best_cost || (must_split && best_axis == -1))
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = i;
+				best_neg_offset = neg_max;
+				best_pos_offset = pos_min[i];
+			}
+		}
+	}
+
+	int	neg_count = 0;
+	if (best_axis >= 0)
+	{
+		// Partition the indices in place: centroids in bins
+		// below best_bin go to the neg side.
+		int	front = 0;
+		int	back = count;
+		while (front < back)
+		{
+			float	c = b->m_centroids[indices[front]][best_axis];
+			int	bin = imin(int((c - centroid_min[best_axis]) * bin_scale[best_axis]), SAH_BIN_COUNT - 1);
+			if (bin < best_bin)
+			{
+				front++;
+			}
+			else
+			{
+				back--;
+				tu_swap(&indices[front], &indices[back]);
+			}
+		}
+		neg_count = front;
+	}
+	else if (must_split)
+	{
+		// Every centroid coincides, but there are too many
+		// faces for a leaf.  Split the list in half; the
+		// children will overlap, which the loose tree allows.
+		best_axis = bounds.get_longest_axis();
+		neg_count = count / 2;
+		best_neg_offset = -FLT_MAX;
+		best_pos_offset = FLT_MAX;
+		for (int i = 0; i < count; i++)
+		{
+			const axial_box&	fb = b->m_face_bounds[indices[i]];
+			if (i < neg_count)
+			{
+				best_neg_offset = fmax(best_neg_offset, fb.get_max()[best_axis]);
+			}
+			else
+			{
+				best_pos_offset = fmin(best_pos_offset, fb.get_min()[best_axis]);
+			}
+		}
+	}
+	else
+	{
+		// No split beats a leaf.
+		return make_sah_leaf(b, indices, count);
+	}
+
+	assert(neg_count > 0 && neg_count < count);
+
+	kd_tree_dynamic::node*	n = new kd_tree_dynamic::node;
+	n->m_axis = best_axis;
+	n->m_neg_offset = best_neg_offset;
+	n->m_pos_offset = best_pos_offset;
+
+	axial_box	neg_bounds(bounds);
+	neg_bounds.set_axis_max(best_axis, best_neg_offset);
+	axial_box	pos_bounds(bounds);
+	pos_bounds.set_axis_min(best_axis, best_pos_offset);
+
+	int	pos_count = count - neg_count;
+	if (pos_count >= SAH_MIN_THREAD_FACES && neg_count >= SAH_MIN_THREAD_FACES
+	    && tu_atomic_decrement(&b->m_free_threads) >= 0)
+	{
+		// Build the pos child on another thread.
+		kd_sah_task	task;
+		task.m_builder = b;
+		task.m_indices = indices + neg_count;
+		task.m_count = pos_count;
+		task.m_bounds = pos_bounds;
+		task.m_result = NULL;
+		{
+			tu_thread::thread	t(kd_sah_task::run, &task);
+			n->m_neg = build_sah_node(b, indices, neg_count, neg_bounds);
+			t.wait();
+		}
+		tu_atomic_increment(&b->m_free_threads);
+		n->m_pos = task.m_result;
+	}
+	else
+	{
+		if (pos_count >= SAH_MIN_THREAD_FACES && neg_count >= SAH_MIN_THREAD_FACES)
+		{
+			// Didn't get a thread; give the token back.
+			tu_atomic_increment(&b->m_free_threads);
+		}
+		n->m_neg = build_sah_node(b, indices, neg_count, neg_bounds);
+		n->m_pos = build_sah_node(b, indices + neg_count, pos_count, pos_bounds);
+	}
+
+	return n;
+}
+
+
+kd_tree_dynamic::node*	kd_tree_dynamic::build_tree_sah(int face_count, const face faces[], const axial_box& bounds, int thread_count)
+// Build a tree over the given faces with the binned SAH builder,
+// using up to thread_count threads (0 means one per processor).
+{
+	assert(face_count > 0);
+
+	if (thread_count <= 0)
+	{
+		thread_count = tu_thread::get_processor_count();
+	}
+
+	kd_sah_builder	b;
+	b.m_faces = faces;
+	b.m_free_threads = thread_count - 1;
+	b.m_face_bounds.resize(face_count);
+	b.m_centroids.resize(face_count);
+
+	array<int>	indices;
+	indices.resize(face_count);
+
+	for (int i = 0; i < face_count; i++)
+	{
+		const face&	f = faces[i];
+		axial_box*	fb = &b.m_face_bounds[i];
+		fb->set_min_max_invalid(m_verts[f.m_vi[0]], m_verts[f.m_vi[0]]);
+		fb->set_enclosing(m_verts[f.m_vi[1]]);
+		fb->set_enclosing(m_verts[f.m_vi[2]]);
+		b.m_centroids[i] = fb->get_center();
+		indices[i] = i;
+	}
+
+	return build_sah_node(&b, &indices[0], face_count, bounds);
+}
+
+
 kd_tree_dynamic::node::node()
 // Default constructor, null everything out.
 	:
@@ -557,7 +990,7 @@ void	kd_tree_dynamic::do_split(
 
 			// Swap this face up to the beginning of the front faces.
 			front_faces_start--;
-			swap(&faces[back_faces_end], &faces[front_faces_start]);
+			tu_swap(&faces[back_faces_end], &faces[front_faces_start]);
 		}
 	}
 
@@ -802,18 +1235,18 @@ void	kd_tree_dynamic::clip_faces(array<face>* faces, int axis, float offset)
 			// Sort...
 			if (vr[0] > vr[1])
 			{
-				swap(&vr[0], &vr[1]);
-				swap(&f.m_vi[0], &f.m_vi[1]);
+				tu_swap(&vr[0], &vr[1]);
+				tu_swap(&f.m_vi[0], &f.m_vi[1]);
 			}
 			if (vr[1] > vr[2])
 			{
-				swap(&vr[1], &vr[2]);
-				swap(&f.m_vi[1], &f.m_vi[2]);
+				tu_swap(&vr[1], &vr[2]);
+				tu_swap(&f.m_vi[1], &f.m_vi[2]);
 			}
 			if (vr[0] > vr[1])
 			{
-				swap(&vr[0], &vr[1]);
-				swap(&f.m_vi[0], &f.m_vi[1]);
+				tu_swap(&vr[0], &vr[1]);
+				tu_swap(&f.m_vi[0], &f.m_vi[1]);
 			}
 
 			if (vr[0] == 0 || vr[2] == 0)
@@ -21,13 +21,40 @@ struct kd_diagram_dump_info;
 
 struct kd_tree_dynamic
 {
+	struct build_options
+	{
+		enum method
+		{
+			// The original builder: tries splits at a few
+			// face boundaries per axis.  Single-threaded.
+			CANDIDATE_PLANES,
+
+			// Surface area heuristic over face centroids
+			// sorted into bins; subtrees are built on
+			// several threads.  Faster, and makes faster
+			// trees.
+			BINNED_SAH
+		};
+
+		build_options() : m_method(BINNED_SAH), m_thread_count(0) {}
+
+		method	m_method;
+		int	m_thread_count;	// for BINNED_SAH; 0 means one per processor
+	};
+
 	// Build tree(s) from the given mesh.
+	//
+	// Each face remembers its triangle's index in the mesh, for
+	// reporting hits; face_indices overrides that (it's how a mesh
+	// that gets split keeps its original numbering).
 	static void	build_trees(
 		array<kd_tree_dynamic*>* treelist,
 		int vert_count,
 		const vec3 verts[],
 		int triangle_count,
-		const int indices[]
+		const int indices[],
+		const build_options& options = build_options(),
+		const int face_indices[] = NULL
 		);
 
 	// vert count must be under 64K
@@ -35,7 +62,9 @@ struct kd_tree_dynamic
 		int vert_count,
 		const vec3 verts[],
 		int triangle_count,
-		const int indices[]
+		const int indices[],
+		const build_options& options = build_options(),
+		const int face_indices[] = NULL
 		);
 	~kd_tree_dynamic();
 
@@ -43,6 +72,7 @@ struct kd_tree_dynamic
 	{
 		Uint16	m_vi[3];	// indices of verts
 		Uint16	m_flags;
+		int	m_index;	// triangle index in the source mesh
 
 		float	get_min_coord(int axis, const array<vec3>& verts) const;
 		float	get_max_coord(int axis, const array<vec3>& verts) const;
@@ -108,6 +138,7 @@ private:
 
 	void	compute_actual_bounds(axial_box* result, int face_count, face faces[]);
 	node*	build_tree(int depth, int face_count, face faces[], const axial_box& bounds);
+	node*	build_tree_sah(int face_count, const face faces[], const axial_box& bounds, int thread_count);
 
 	void	do_split(
 		int* neg_end,
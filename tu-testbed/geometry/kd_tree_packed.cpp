@@ -9,7 +9,10 @@
 
 #include "geometry/kd_tree_packed.h"
 
+#include "base/mmap_util.h"
 #include "base/tu_file.h"
+#include "base/tu_float4.h"
+#include "base/tu_thread.h"
 #include "base/tu_types.h"
 #include "base/utility.h"
 #include "geometry/axial_box.h"
@@ -133,6 +136,7 @@ struct kd_leaf
 {
 	uint8	m_flags;	// low two bits == 0b11
 	uint8	m_face_count;
+	uint8	m_first_face[4];	// our first face's number in m_face_indices, little-endian
 
 	kd_face*	get_face(int index)
 	{
@@ -141,7 +145,12 @@ struct kd_leaf
 		return (kd_face*) (((uint8*) this) + sizeof(kd_leaf) + sizeof(kd_face) * index);
 	}
 
-	void	local_assert() { compiler_assert(sizeof(kd_leaf) == 2); }
+	int	get_first_face() const
+	{
+		return m_first_face[0] | (m_first_face[1] << 8) | (m_first_face[2] << 16) | (m_first_face[3] << 24);
+	}
+
+	void	local_assert() { compiler_assert(sizeof(kd_leaf) == 6); }
 };
 
 
@@ -208,13 +217,32 @@ kd_tree_packed::kd_tree_packed()
 	m_vert_count(0),
 	m_verts(0),
 	m_packed_tree_size(0),
-	m_packed_tree(0)
+	m_packed_tree(0),
+	m_face_count(0),
+	m_face_indices(0),
+	m_image(0),
+	m_image_size(0),
+	m_image_is_mapped(false)
 {
 }
 
 
 kd_tree_packed::~kd_tree_packed()
 {
+	if (m_image)
+	{
+		// Our arrays all point into the image.
+		if (m_image_is_mapped)
+		{
+			mmap_util::unmap(m_image, m_image_size);
+		}
+		else
+		{
+			tu_free(m_image, m_image_size);
+		}
+		return;
+	}
+
 	if (m_verts)
 	{
 		tu_free(m_verts, sizeof(vec3) * m_vert_count);
@@ -224,11 +252,17 @@ kd_tree_packed::~kd_tree_packed()
 	{
 		tu_free(m_packed_tree, m_packed_tree_size);
 	}
+
+	if (m_face_indices)
+	{
+		tu_free(m_face_indices, sizeof(int) * m_face_count);
+	}
 }
 
 
-static void	write_packed_data(tu_file* out, const kd_tree_dynamic::node* source)
+static void	write_packed_data(tu_file* out, array<int>* face_indices, const kd_tree_dynamic::node* source)
 // Write kd tree data in the form of packed node & leaf structs.
+// Appends the source index of each face written to face_indices.
 {
 	if (source->m_leaf)
 	{
@@ -251,11 +285,18 @@ static void	write_packed_data(tu_file* out, const kd_tree_dynamic::node* source)
 		{
 			l.m_face_count = sl->m_faces.size();
 		}
+		int	first_face = face_indices->size();
+		l.m_first_face[0] = (first_face      ) & 0x0FF;
+		l.m_first_face[1] = (first_face >> 8 ) & 0x0FF;
+		l.m_first_face[2] = (first_face >> 16) & 0x0FF;
+		l.m_first_face[3] = (first_face >> 24) & 0x0FF;
 		out->write_bytes(&l, sizeof(l));
 
 		// write faces.
 		for (int i = 0; i < l.m_face_count; i++)
 		{
+			face_indices->push_back(sl->m_faces[i].m_index);
+
 			kd_face	f;
 			f.m_vi[0] = sl->m_faces[i].m_vi[0];
 			f.m_vi[1] = sl->m_faces[i].m_vi[1];
@@ -295,7 +336,7 @@ static void	write_packed_data(tu_file* out, const kd_tree_dynamic::node* source)
 		// Neg child data.
 		if (source->m_neg)
 		{
-			write_packed_data(out, source->m_neg);
+			write_packed_data(out, face_indices, source->m_neg);
 		}
 
 		// Pos child data.
@@ -318,7 +359,7 @@ static void	write_packed_data(tu_file* out, const kd_tree_dynamic::node* source)
 				out->set_position(pos_child_start);
 
 				// Write pos child.
-				write_packed_data(out, source->m_pos);
+				write_packed_data(out, face_indices, source->m_pos);
 			}
 		}
 	}
@@ -331,7 +372,8 @@ static void	write_packed_data(tu_file* out, const kd_tree_dynamic::node* source)
 
 	assert(source->get_root());
 
-	write_packed_data(&buf, source->get_root());
+	array<int>	face_indices;
+	write_packed_data(&buf, &face_indices, source->get_root());
 
 	kd_tree_packed*	kd = new kd_tree_packed;
 
@@ -349,17 +391,237 @@ static void	write_packed_data(tu_file* out, const kd_tree_dynamic::node* source)
 	buf.set_position(0);
 	buf.read_bytes(kd->m_packed_tree, kd->m_packed_tree_size);
 
+	// Copy face indices.
+	kd->m_face_count = face_indices.size();
+	kd->m_face_indices = (int*) tu_malloc(kd->m_face_count * sizeof(int));
+	memcpy(kd->m_face_indices, &face_indices[0], sizeof(int) * kd->m_face_count);
+
+	return kd;
+}
+
+
+//
+// file image
+//
+
+
+static const uint32	KD_FILE_MAGIC = 0x706B646B;	// "kdkp" when little-endian
+static const uint32	KD_FILE_VERSION = 1;
+static const int	KD_FILE_ALIGNMENT = 16;
+
+
+struct kd_file_header
+// Start of a kd_tree_packed file; all offsets are from the start of
+// the file.  Written and used in native byte order, so m_magic
+// doubles as a byte-order check.
+{
+	uint32	m_magic;
+	uint32	m_version;
+	uint32	m_file_size;
+
+	float	m_bound_min[3];
+	float	m_bound_max[3];
+
+	uint32	m_vert_count;
+	uint32	m_verts_offset;		// vec3[m_vert_count]
+
+	uint32	m_packed_tree_size;
+	uint32	m_packed_tree_offset;	// kd_node / kd_leaf data
+
+	uint32	m_face_count;
+	uint32	m_face_indices_offset;	// int[m_face_count]
+
+	uint32	m_pad;
+
+	void	local_assert() { compiler_assert((sizeof(kd_file_header) % KD_FILE_ALIGNMENT) == 0); }
+};
+
+
+static int	align_offset(int offset)
+{
+	return (offset + KD_FILE_ALIGNMENT - 1) & ~(KD_FILE_ALIGNMENT - 1);
+}
+
+
+static void	write_padding(tu_file* out, int offset)
+// Write zeros up to the given offset.
+{
+	static const char	zeros[KD_FILE_ALIGNMENT] = { 0 };
+	int	pad = offset - out->get_position();
+	assert(pad >= 0 && pad < KD_FILE_ALIGNMENT);
+	out->write_bytes(zeros, pad);
+}
+
+
+void	kd_tree_packed::write(tu_file* out) const
+// Write our image; see map().
+{
+	assert(out);
+
+	int	start = out->get_position();
+
+	kd_file_header	h;
+	memset(&h, 0, sizeof(h));
+	h.m_magic = KD_FILE_MAGIC;
+	h.m_version = KD_FILE_VERSION;
+	for (int i = 0; i < 3; i++)
+	{
+		h.m_bound_min[i] = m_bound.get_min()[i];
+		h.m_bound_max[i] = m_bound.get_max()[i];
+	}
+
+	int	offset = sizeof(h);
+	h.m_vert_count = m_vert_count;
+	h.m_verts_offset = offset;
+	offset = align_offset(offset + sizeof(vec3) * m_vert_count);
+
+	h.m_packed_tree_size = m_packed_tree_size;
+	h.m_packed_tree_offset = offset;
+	offset = align_offset(offset + m_packed_tree_size);
+
+	h.m_face_count = m_face_count;
+	h.m_face_indices_offset = offset;
+	offset = align_offset(offset + sizeof(int) * m_face_count);
+
+	h.m_file_size = offset;
+
+	out->write_bytes(&h, sizeof(h));
+	out->write_bytes(m_verts, sizeof(vec3) * m_vert_count);
+	write_padding(out, start + h.m_packed_tree_offset);
+	out->write_bytes(m_packed_tree, m_packed_tree_size);
+	write_padding(out, start + h.m_face_indices_offset);
+	out->write_bytes(m_face_indices, sizeof(int) * m_face_count);
+	write_padding(out, start + h.m_file_size);
+}
+
+
+static bool	section_ok(const kd_file_header& h, uint32 offset, uint32 count, uint32 element_size)
+// True if the given array lies within the file, aligned.
+{
+	if (offset % KD_FILE_ALIGNMENT) return false;
+	if (offset < sizeof(h) || offset > h.m_file_size) return false;
+	if (count > (h.m_file_size - offset) / element_size) return false;
+	return true;
+}
+
+
+bool	kd_tree_packed::set_image(void* image, int image_size)
+// Point our data into the given file image.  Returns false if the
+// image isn't a valid file.  On success, we own the image.
+{
+	assert(m_image == NULL);
+
+	if (image_size < (int) sizeof(kd_file_header))
+	{
+		return false;
+	}
+
+	const kd_file_header&	h = *(const kd_file_header*) image;
+	if (h.m_magic != KD_FILE_MAGIC
+	    || h.m_version != KD_FILE_VERSION
+	    || h.m_file_size > (uint32) image_size
+	    || h.m_vert_count >= 65536	// we use 16-bit indices for verts
+	    || section_ok(h, h.m_verts_offset, h.m_vert_count, sizeof(vec3)) == false
+	    || section_ok(h, h.m_packed_tree_offset, h.m_packed_tree_size, 1) == false
+	    || section_ok(h, h.m_face_indices_offset, h.m_face_count, sizeof(int)) == false
+	    || h.m_packed_tree_size < sizeof(kd_node))
+	{
+		return false;
+	}
+
+	m_bound = axial_box(
+		vec3(h.m_bound_min[0], h.m_bound_min[1], h.m_bound_min[2]),
+		vec3(h.m_bound_max[0], h.m_bound_max[1], h.m_bound_max[2]));
+
+	uint8*	data = (uint8*) image;
+	m_vert_count = h.m_vert_count;
+	m_verts = (vec3*) (data + h.m_verts_offset);
+	m_packed_tree_size = h.m_packed_tree_size;
+	m_packed_tree = (kd_node*) (data + h.m_packed_tree_offset);
+	m_face_count = h.m_face_count;
+	m_face_indices = (int*) (data + h.m_face_indices_offset);
+
+	m_image = image;
+	m_image_size = image_size;
+
+	return true;
+}
+
+
+/*static*/ kd_tree_packed*	kd_tree_packed::read(tu_file* in)
+// Read a tree written by write(), from the current position in the
+// stream.  The file image is read into a single block.
+{
+	assert(in);
+
+	kd_file_header	h;
+	if (in->read_bytes(&h, sizeof(h)) != sizeof(h)
+	    || h.m_magic != KD_FILE_MAGIC
+	    || h.m_file_size < sizeof(h))
+	{
+		return NULL;
+	}
+
+	int	size = h.m_file_size;
+	uint8*	image = (uint8*) tu_malloc(size);
+	memcpy(image, &h, sizeof(h));
+	int	rest = size - sizeof(h);
+	if (in->read_bytes(image + sizeof(h), rest) != rest)
+	{
+		tu_free(image, size);
+		return NULL;
+	}
+
+	kd_tree_packed*	kd = new kd_tree_packed;
+	if (kd->set_image(image, size) == false)
+	{
+		tu_free(image, size);
+		delete kd;
+		return NULL;
+	}
+
+	return kd;
+}
+
+
+/*static*/ kd_tree_packed*	kd_tree_packed::map(const char* path)
+// Map the given file, written by write(), and use it in place.
+{
+	assert(path);
+
+	int	size = mmap_util::file_size(path);
+	if (size < (int) sizeof(kd_file_header))
+	{
+		return NULL;
+	}
+
+	void*	image = mmap_util::map(size, false, path);
+	if (image == NULL)
+	{
+		return NULL;
+	}
+
+	kd_tree_packed*	kd = new kd_tree_packed;
+	if (kd->set_image(image, size) == false)
+	{
+		mmap_util::unmap(image, size);
+		delete kd;
+		return NULL;
+	}
+	kd->m_image_is_mapped = true;
+
 	return kd;
 }
 
 
 struct kd_ray_query_info
 {
-	kd_ray_query_info(const ray_query& query, const vec3* verts, int vert_count)
+	kd_ray_query_info(const ray_query& query, const vec3* verts, int vert_count, const int* face_indices = NULL)
 		:
 		m_query(query),
 		m_vert_count(vert_count),
-		m_verts(verts)
+		m_verts(verts),
+		m_face_indices(face_indices)
 	{
 	}
 
@@ -367,6 +629,7 @@ struct kd_ray_query_info
 	ray_query	m_query;
 	int	m_vert_count;
 	const vec3*	m_verts;
+	const int*	m_face_indices;
 	
 	// other helpful precomputed data?
 };
@@ -456,7 +719,7 @@ static bool	ray_test_face(const kd_ray_query_info& qi, kd_face* face)
 		return false;
 	}
 
-	if (qi.m_query.m_end * unscaled_normal > 0)
+	if (qi.m_query.m_end * unscaled_normal > plane_d)
 	{
 		// ray doesn't reach the face.
 		return false;
@@ -627,6 +890,692 @@ bool	kd_tree_packed::ray_test(const ray_query& query)
 }
 
 
+//
+// closest hit
+//
+
+
+static bool	ray_hit_face(const kd_ray_query_info& qi, kd_face* face, int face_number, ray_hit* hit)
+// If the ray hits the face closer than hit->m_t, update *hit and
+// return true.  Same front-face rules as ray_test_face().
+{
+	kd_tree_packed::s_ray_test_face_count++;	// stats
+
+	const vec3&	v0 = qi.m_verts[face->m_vi[0]];
+	const vec3&	v1 = qi.m_verts[face->m_vi[1]];
+	const vec3&	v2 = qi.m_verts[face->m_vi[2]];
+
+	vec3	edge1(v1); edge1 -= v0;
+	vec3	edge2(v2); edge2 -= v0;
+	vec3	unscaled_normal;
+	unscaled_normal.set_cross(edge1, edge2);
+
+	float	plane_d = v0 * unscaled_normal;
+
+	float	start_dist = qi.m_query.m_start * unscaled_normal - plane_d;
+	float	end_dist = qi.m_query.m_end * unscaled_normal - plane_d;
+	if (start_dist < 0 || end_dist > 0 || start_dist == end_dist)
+	{
+		// Starts behind the face, doesn't reach it, or lies
+		// in its plane.
+		return false;
+	}
+
+	float	t = start_dist / (start_dist - end_dist);
+	if (t >= hit->m_t)
+	{
+		return false;
+	}
+
+	if (intersect_triangle(qi.m_query.m_start, qi.m_query.m_dir, v0, v1, v2, edge1, edge2) == false)
+	{
+		return false;
+	}
+
+	hit->m_t = t;
+	hit->m_face_index = qi.m_face_indices[face_number];
+	hit->m_normal = unscaled_normal;
+	hit->m_normal.normalize();
+
+	return true;
+}
+
+
+static bool	ray_closest_hit_node(const kd_ray_query_info& qi, float t_min, float t_max, kd_node* node, ray_hit* hit)
+// Look for a hit closer than hit->m_t, within [t_min,t_max] of the
+// ray.  Near child first, so that the far child can usually be
+// skipped once something is hit.
+{
+	assert(node);
+
+	t_max = fmin(t_max, hit->m_t);
+	if (t_min > t_max)
+	{
+		return false;
+	}
+
+	if (node->is_leaf())
+	{
+		kd_tree_packed::s_ray_test_leaf_count++;	// stats
+
+		kd_leaf*	leaf = node->get_leaf();
+		int	first_face = leaf->get_first_face();
+		bool	result = false;
+		for (int i = 0, n = leaf->m_face_count; i < n; i++)
+		{
+			if (ray_hit_face(qi, leaf->get_face(i), first_face + i, hit))
+			{
+				result = true;
+			}
+		}
+		return result;
+	}
+
+	kd_tree_packed::s_ray_test_node_count++;	// stats
+
+	// See ray_test_node() for how this handles a query parallel
+	// to the splitting plane.
+	int	axis = node->get_axis();
+	float	t_neg = (node->m_neg_offset - qi.m_query.m_start[axis]) * qi.m_query.m_inv_displacement[axis];
+	float	t_pos = (node->m_pos_offset - qi.m_query.m_start[axis]) * qi.m_query.m_inv_displacement[axis];
+
+	kd_node*	near_child;
+	kd_node*	far_child;
+	float	near_max, far_min;
+	if (qi.m_query.m_dir[axis] > 0)
+	{
+		near_child = node->get_neg_child();
+		near_max = fmin(t_neg, t_max);
+		far_child = node->get_pos_child();
+		far_min = fmax(t_pos, t_min);
+	}
+	else
+	{
+		near_child = node->get_pos_child();
+		near_max = fmin(t_pos, t_max);
+		far_child = node->get_neg_child();
+		far_min = fmax(t_neg, t_min);
+	}
+
+	bool	result = false;
+	if (near_child && ray_closest_hit_node(qi, t_min, near_max, near_child, hit))
+	{
+		result = true;
+	}
+	if (far_child && ray_closest_hit_node(qi, far_min, t_max, far_child, hit))
+	{
+		result = true;
+	}
+	return result;
+}
+
+
+bool	kd_tree_packed::ray_closest_hit(const ray_query& query, ray_hit* hit)
+// Find the nearest face the query hits, if it's closer than hit->m_t.
+{
+	assert(m_packed_tree);
+	assert(m_verts);
+	assert(hit);
+
+	kd_ray_query_info	qi(query, m_verts, m_vert_count, m_face_indices);
+
+	return ray_closest_hit_node(qi, 0, 1, m_packed_tree, hit);
+}
+
+
+//
+// line-swept spheres
+//
+
+
+// The traversal is the same as for rays, but against the splitting
+// planes pushed out by the sphere's radius: the neg child can be
+// touched while the center is below m_neg_offset + radius, and the
+// pos child while it's above m_pos_offset - radius.
+
+
+struct kd_lss_query_info
+{
+	kd_lss_query_info(const lss_query& query, const vec3* verts, const int* face_indices, bool any_hit)
+		:
+		m_query(query),
+		m_verts(verts),
+		m_face_indices(face_indices),
+		m_any_hit(any_hit)
+	{
+	}
+
+	const lss_query&	m_query;
+	const vec3*	m_verts;
+	const int*	m_face_indices;
+	bool	m_any_hit;	// stop at the first contact found
+};
+
+
+static bool	lss_hit_node(const kd_lss_query_info& qi, float t_min, float t_max, kd_node* node, lss_hit* hit)
+// Look for a contact earlier than hit->m_t, within [t_min,t_max] of
+// the sweep.
+{
+	assert(node);
+
+	t_max = fmin(t_max, hit->m_t);
+	if (t_min > t_max)
+	{
+		return false;
+	}
+
+	if (node->is_leaf())
+	{
+		kd_leaf*	leaf = node->get_leaf();
+		int	first_face = leaf->get_first_face();
+		bool	result = false;
+		for (int i = 0, n = leaf->m_face_count; i < n; i++)
+		{
+			kd_face*	f = leaf->get_face(i);
+			if (lss_hit_triangle(qi.m_query, qi.m_verts[f->m_vi[0]], qi.m_verts[f->m_vi[1]], qi.m_verts[f->m_vi[2]], hit))
+			{
+				hit->m_face_index = qi.m_face_indices[first_face + i];
+				result = true;
+				if (qi.m_any_hit)
+				{
+					break;
+				}
+			}
+		}
+		return result;
+	}
+
+	int	axis = node->get_axis();
+	float	start = qi.m_query.m_start[axis];
+	float	disp = qi.m_query.m_disp[axis];
+	float	inv_disp = qi.m_query.m_inv_disp[axis];
+	float	neg_plane = node->m_neg_offset + qi.m_query.m_radius;
+	float	pos_plane = node->m_pos_offset - qi.m_query.m_radius;
+
+	kd_node*	neg_child = node->get_neg_child();
+	kd_node*	pos_child = node->get_pos_child();
+	float	neg_min = t_min, neg_max = t_max;
+	float	pos_min = t_min, pos_max = t_max;
+	if (inv_disp == 0)
+	{
+		// Not moving along this axis.
+		if (start > neg_plane) neg_child = NULL;
+		if (start < pos_plane) pos_child = NULL;
+	}
+	else
+	{
+		float	t_neg = (neg_plane - start) * inv_disp;
+		float	t_pos = (pos_plane - start) * inv_disp;
+		if (disp > 0)
+		{
+			neg_max = fmin(neg_max, t_neg);
+			pos_min = fmax(pos_min, t_pos);
+		}
+		else
+		{
+			neg_min = fmax(neg_min, t_neg);
+			pos_max = fmin(pos_max, t_pos);
+		}
+	}
+
+	// Near child first.
+	bool	result = false;
+	if (disp >= 0)
+	{
+		if (neg_child && lss_hit_node(qi, neg_min, neg_max, neg_child, hit))
+		{
+			result = true;
+			if (qi.m_any_hit) return true;
+		}
+		if (pos_child && lss_hit_node(qi, pos_min, pos_max, pos_child, hit))
+		{
+			result = true;
+		}
+	}
+	else
+	{
+		if (pos_child && lss_hit_node(qi, pos_min, pos_max, pos_child, hit))
+		{
+			result = true;
+			if (qi.m_any_hit) return true;
+		}
+		if (neg_child && lss_hit_node(qi, neg_min, neg_max, neg_child, hit))
+		{
+			result = true;
+		}
+	}
+	return result;
+}
+
+
+bool	kd_tree_packed::lss_test(const lss_query& query)
+// Return true if the query touches any of our faces.
+{
+	assert(m_packed_tree);
+	assert(m_verts);
+
+	kd_lss_query_info	qi(query, m_verts, m_face_indices, true);
+	lss_hit	hit;
+	return lss_hit_node(qi, 0, 1, m_packed_tree, &hit);
+}
+
+
+bool	kd_tree_packed::lss_closest_hit(const lss_query& query, lss_hit* hit)
+// Find the first contact, if it's earlier than hit->m_t.
+{
+	assert(m_packed_tree);
+	assert(m_verts);
+	assert(hit);
+
+	kd_lss_query_info	qi(query, m_verts, m_face_indices, false);
+	return lss_hit_node(qi, 0, 1, m_packed_tree, hit);
+}
+
+
+// Queries per pool task; enough to make handing out tasks cheap.
+static const int	LSS_BATCH_TASK_SIZE = 16;
+
+
+struct kd_lss_batch
+{
+	int	m_tree_count;
+	kd_tree_packed* const*	m_trees;
+	int	m_query_count;
+	const lss_query*	m_queries;
+	lss_hit*	m_hits;
+};
+
+
+static void	lss_batch_task(void* arg, int index)
+{
+	kd_lss_batch*	b = (kd_lss_batch*) arg;
+
+	int	end = imin(b->m_query_count, (index + 1) * LSS_BATCH_TASK_SIZE);
+	for (int i = index * LSS_BATCH_TASK_SIZE; i < end; i++)
+	{
+		for (int ti = 0; ti < b->m_tree_count; ti++)
+		{
+			b->m_trees[ti]->lss_closest_hit(b->m_queries[i], &b->m_hits[i]);
+		}
+	}
+}
+
+
+/*static*/ void	kd_tree_packed::lss_closest_hit_batch(
+	tu_thread::pool* pool,
+	int tree_count,
+	kd_tree_packed* const trees[],
+	int query_count,
+	const lss_query queries[],
+	lss_hit hits[])
+{
+	kd_lss_batch	b;
+	b.m_tree_count = tree_count;
+	b.m_trees = trees;
+	b.m_query_count = query_count;
+	b.m_queries = queries;
+	b.m_hits = hits;
+
+	int	task_count = (query_count + LSS_BATCH_TASK_SIZE - 1) / LSS_BATCH_TASK_SIZE;
+	if (pool)
+	{
+		pool->run(lss_batch_task, &b, task_count);
+	}
+	else
+	{
+		for (int i = 0; i < task_count; i++)
+		{
+			lss_batch_task(&b, i);
+		}
+	}
+}
+
+
+//
+// ray packets
+//
+
+
+// The packet traversal is the closest-hit traversal above, done on
+// RAY_PACKET_SIZE rays at once with float4 lanes.  Each lane keeps
+// its own [t_min, t_max] interval; a child is visited if any lane's
+// interval reaches it.  A face's edges and plane are computed once
+// per packet instead of once per ray, and the plane and triangle
+// tests then run on all the lanes together.
+//
+// For an any-hit query, a lane that hits something sets its m_t to
+// -1, which makes every interval empty, so it drops out of the rest
+// of the traversal.
+//
+// Without SSE the lanes would be processed one at a time anyway, and
+// that measures slower than plain single rays, so the packet entry
+// points just loop over the single-ray queries.
+
+#if TU_CONFIG_USE_SSE2
+
+
+struct kd_ray_packet
+{
+	float4	m_start[3];
+	float4	m_end[3];
+	float4	m_dir[3];
+	float4	m_inv_displacement[3];
+	float4	m_t;	// nearest hit so far, per lane
+
+	// Per-axis visiting order, by majority vote of the lanes.
+	bool	m_neg_first[3];
+
+	bool	m_any_hit;	// stop each lane at its first hit
+	mask4	m_hit;	// lanes that hit something
+
+	// Closest-hit results for lanes in m_hit.
+	int	m_face_number[4];
+	vec3	m_normal[4];
+
+	const vec3*	m_verts;
+};
+
+
+static void	ray_packet_leaf(kd_ray_packet* pk, kd_leaf* leaf, mask4 active)
+{
+	kd_tree_packed::s_ray_test_leaf_count++;	// stats
+
+	const float4	zero(0.0f);
+	const float4	epsilon((float) INTERSECT_EPSILON);
+	const float4	minus_epsilon((float) -INTERSECT_EPSILON);
+
+	int	first_face = leaf->get_first_face();
+	for (int i = 0, n = leaf->m_face_count; i < n; i++)
+	{
+		kd_tree_packed::s_ray_test_face_count++;	// stats
+
+		kd_face*	face = leaf->get_face(i);
+		const vec3&	v0 = pk->m_verts[face->m_vi[0]];
+		const vec3&	v1 = pk->m_verts[face->m_vi[1]];
+		const vec3&	v2 = pk->m_verts[face->m_vi[2]];
+
+		vec3	edge1(v1); edge1 -= v0;
+		vec3	edge2(v2); edge2 -= v0;
+		vec3	unscaled_normal;
+		unscaled_normal.set_cross(edge1, edge2);
+
+		float4	nx(unscaled_normal.x), ny(unscaled_normal.y), nz(unscaled_normal.z);
+		float4	plane_d(v0 * unscaled_normal);
+
+		// Plane crossing; same rules as ray_hit_face().
+		float4	start_dist = pk->m_start[0] * nx + pk->m_start[1] * ny + pk->m_start[2] * nz - plane_d;
+		float4	end_dist = pk->m_end[0] * nx + pk->m_end[1] * ny + pk->m_end[2] * nz - plane_d;
+		mask4	mask = active & (start_dist >= zero) & (end_dist <= zero) & (end_dist < start_dist);
+		if (mask.any() == false)
+		{
+			continue;
+		}
+
+		float4	t = start_dist / (start_dist - end_dist);
+		mask = mask & (pk->m_any_hit ? t <= pk->m_t : t < pk->m_t);
+		if (mask.any() == false)
+		{
+			continue;
+		}
+
+		// Triangle bounds; intersect_triangle() on each lane.
+		float4	e1x(edge1.x), e1y(edge1.y), e1z(edge1.z);
+		float4	e2x(edge2.x), e2y(edge2.y), e2z(edge2.z);
+
+		float4	px = pk->m_dir[1] * e2z - pk->m_dir[2] * e2y;
+		float4	py = pk->m_dir[2] * e2x - pk->m_dir[0] * e2z;
+		float4	pz = pk->m_dir[0] * e2y - pk->m_dir[1] * e2x;
+		float4	det = fabs(e1x * px + e1y * py + e1z * pz);
+
+		float4	tx = pk->m_start[0] - float4(v0.x);
+		float4	ty = pk->m_start[1] - float4(v0.y);
+		float4	tz = pk->m_start[2] - float4(v0.z);
+
+		float4	u = tx * px + ty * py + tz * pz;
+		mask = mask & (u >= minus_epsilon) & (u <= det + epsilon);
+		if (mask.any() == false)
+		{
+			continue;
+		}
+
+		// v = dir * (tvec cross edge1)
+		float4	v = pk->m_dir[0] * (ty * e1z - tz * e1y)
+			+ pk->m_dir[1] * (tz * e1x - tx * e1z)
+			+ pk->m_dir[2] * (tx * e1y - ty * e1x);
+		mask = mask & (v >= minus_epsilon) & (u + v <= det + epsilon);
+		if (mask.any() == false)
+		{
+			continue;
+		}
+
+		pk->m_hit = pk->m_hit | mask;
+		if (pk->m_any_hit)
+		{
+			pk->m_t = select(mask, float4(-1.0f), pk->m_t);
+			active = and_not(active, mask);
+			if (active.any() == false)
+			{
+				return;
+			}
+		}
+		else
+		{
+			pk->m_t = select(mask, t, pk->m_t);
+			int	bits = mask.bits();
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if (bits & (1 << lane))
+				{
+					pk->m_face_number[lane] = first_face + i;
+					pk->m_normal[lane] = unscaled_normal;
+				}
+			}
+		}
+	}
+}
+
+
+static void	ray_packet_node(kd_ray_packet* pk, float4 t_min, float4 t_max, mask4 active, kd_node* node)
+// Lanes in active are to be tested over [t_min, t_max].
+{
+	assert(node);
+
+	t_max = fmin(t_max, pk->m_t);
+	active = active & (t_min <= t_max);
+	if (active.any() == false)
+	{
+		return;
+	}
+
+	if (node->is_leaf())
+	{
+		ray_packet_leaf(pk, node->get_leaf(), active);
+		return;
+	}
+
+	kd_tree_packed::s_ray_test_node_count++;	// stats
+
+	// Per lane, the same intervals ray_closest_hit_node() picks.
+	int	axis = node->get_axis();
+	float4	t_neg = (float4(node->m_neg_offset) - pk->m_start[axis]) * pk->m_inv_displacement[axis];
+	float4	t_pos = (float4(node->m_pos_offset) - pk->m_start[axis]) * pk->m_inv_displacement[axis];
+	mask4	positive = pk->m_dir[axis] > float4(0.0f);
+
+	kd_node*	neg_child = node->get_neg_child();
+	kd_node*	pos_child = node->get_pos_child();
+	if (pk->m_neg_first[axis])
+	{
+		if (neg_child)
+		{
+			ray_packet_node(pk, select(positive, t_min, fmax(t_neg, t_min)), select(positive, fmin(t_neg, t_max), t_max), active, neg_child);
+		}
+		if (pos_child)
+		{
+			ray_packet_node(pk, select(positive, fmax(t_pos, t_min), t_min), select(positive, t_max, fmin(t_pos, t_max)), active, pos_child);
+		}
+	}
+	else
+	{
+		if (pos_child)
+		{
+			ray_packet_node(pk, select(positive, fmax(t_pos, t_min), t_min), select(positive, t_max, fmin(t_pos, t_max)), active, pos_child);
+		}
+		if (neg_child)
+		{
+			ray_packet_node(pk, select(positive, t_min, fmax(t_neg, t_min)), select(positive, fmin(t_neg, t_max), t_max), active, neg_child);
+		}
+	}
+}
+
+
+static mask4	setup_ray_packet(kd_ray_packet* pk, const vec3* verts, int lane_count, const ray_query queries[], const float t[])
+// Load up to four queries into the packet; unused lanes are
+// inactive.  Returns the active lanes.
+{
+	assert(lane_count > 0 && lane_count <= 4);
+
+	float	start[3][4], end[3][4], dir[3][4], inv_displacement[3][4], max_t[4];
+	for (int lane = 0; lane < 4; lane++)
+	{
+		// Pad with copies of the last query.
+		const ray_query&	q = queries[lane < lane_count ? lane : lane_count - 1];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			start[axis][lane] = q.m_start[axis];
+			end[axis][lane] = q.m_end[axis];
+			dir[axis][lane] = q.m_dir[axis];
+			inv_displacement[axis][lane] = q.m_inv_displacement[axis];
+		}
+		max_t[lane] = lane < lane_count ? t[lane] : -1;
+	}
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		pk->m_start[axis] = float4::load(start[axis]);
+		pk->m_end[axis] = float4::load(end[axis]);
+		pk->m_dir[axis] = float4::load(dir[axis]);
+		pk->m_inv_displacement[axis] = float4::load(inv_displacement[axis]);
+
+		int	positive = 0;
+		for (int lane = 0; lane < lane_count; lane++)
+		{
+			if (dir[axis][lane] > 0) positive++;
+		}
+		pk->m_neg_first[axis] = positive * 2 >= lane_count;
+	}
+	pk->m_t = float4::load(max_t);
+	pk->m_hit = mask4::none();
+	pk->m_verts = verts;
+
+	return float4(0.0f) <= pk->m_t;
+}
+
+#endif // TU_CONFIG_USE_SSE2
+
+
+void	kd_tree_packed::ray_test_packet(int query_count, const ray_query queries[], bool results[])
+// Set results[i] for each query that hits any of our faces.
+{
+	assert(m_packed_tree);
+	assert(m_verts);
+
+#if TU_CONFIG_USE_SSE2
+	kd_ray_packet	pk;
+	pk.m_any_hit = true;
+
+	for (int i = 0; i < query_count; i += RAY_PACKET_SIZE)
+	{
+		int	lane_count = imin(RAY_PACKET_SIZE, query_count - i);
+
+		// Skip rays that are already known to hit.
+		float	t[4];
+		int	untested = 0;
+		for (int lane = 0; lane < lane_count; lane++)
+		{
+			t[lane] = results[i + lane] ? -1.0f : 1.0f;
+			if (results[i + lane] == false) untested++;
+		}
+		if (untested == 0)
+		{
+			continue;
+		}
+
+		mask4	active = setup_ray_packet(&pk, m_verts, lane_count, queries + i, t);
+		ray_packet_node(&pk, float4(0.0f), float4(1.0f), active, m_packed_tree);
+
+		int	bits = pk.m_hit.bits();
+		for (int lane = 0; lane < lane_count; lane++)
+		{
+			if (bits & (1 << lane))
+			{
+				results[i + lane] = true;
+			}
+		}
+	}
+#else
+	for (int i = 0; i < query_count; i++)
+	{
+		if (results[i] == false)
+		{
+			results[i] = ray_test(queries[i]);
+		}
+	}
+#endif
+}
+
+
+void	kd_tree_packed::ray_closest_hit_packet(int query_count, const ray_query queries[], ray_hit hits[])
+// ray_closest_hit() on each query.
+{
+	assert(m_packed_tree);
+	assert(m_verts);
+
+#if TU_CONFIG_USE_SSE2
+	kd_ray_packet	pk;
+	pk.m_any_hit = false;
+
+	for (int i = 0; i < query_count; i += RAY_PACKET_SIZE)
+	{
+		int	lane_count = imin(RAY_PACKET_SIZE, query_count - i);
+
+		float	t[4];
+		for (int lane = 0; lane < lane_count; lane++)
+		{
+			t[lane] = hits[i + lane].m_t;
+		}
+
+		mask4	active = setup_ray_packet(&pk, m_verts, lane_count, queries + i, t);
+		ray_packet_node(&pk, float4(0.0f), float4(1.0f), active, m_packed_tree);
+
+		int	bits = pk.m_hit.bits();
+		if (bits == 0)
+		{
+			continue;
+		}
+
+		float	new_t[4];
+		pk.m_t.store(new_t);
+		for (int lane = 0; lane < lane_count; lane++)
+		{
+			if (bits & (1 << lane))
+			{
+				ray_hit*	hit = &hits[i + lane];
+				hit->m_t = new_t[lane];
+				hit->m_face_index = m_face_indices[pk.m_face_number[lane]];
+				hit->m_normal = pk.m_normal[lane];
+				hit->m_normal.normalize();
+			}
+		}
+	}
+#else
+	for (int i = 0; i < query_count; i++)
+	{
+		ray_closest_hit(queries[i], &hits[i]);
+	}
+#endif
+}
+
+
 
 // Local Variables:
 // mode: C++
@@ -19,21 +19,69 @@
 class tu_file;
 struct kd_tree_dynamic;
 struct kd_node;
+namespace tu_thread { struct pool; }
 
 
 struct kd_tree_packed
 {
 	~kd_tree_packed();
 
-	void	read(tu_file* in);
-	void	write(tu_file* out);
-
 	static kd_tree_packed*	build(const kd_tree_dynamic* source_tree);
 
+	// The file format is a header followed by the verts, the
+	// packed tree and the face indices, each aligned, all
+	// addressed by offsets from the start of the file.  So the
+	// whole image can be used in place: map() points a tree
+	// straight at a memory-mapped file, with no copying, and the
+	// OS pages it in as it's touched.  Many trees can be mapped
+	// at once this way.
+	//
+	// The data is in the writing machine's byte order; read() and
+	// map() return NULL for a file of the wrong byte order or
+	// version, or one that's truncated.
+	void	write(tu_file* out) const;
+	static kd_tree_packed*	read(tu_file* in);
+	static kd_tree_packed*	map(const char* path);
+
 	// Return true if the ray query hits any of our faces.
 	bool	ray_test(const ray_query& query);
 
-	// void	lss_test(....);
+	// Find the nearest face the ray query hits, closer than
+	// hit->m_t.  Returns false, leaving *hit alone, if there isn't
+	// one.  To query several trees, pass the same hit to each.
+	bool	ray_closest_hit(const ray_query& query, ray_hit* hit);
+
+	// Many rays at once.  The rays are traversed together in
+	// packets of RAY_PACKET_SIZE, which pays off when neighboring
+	// queries are coherent (nearby starts, similar directions),
+	// as in a batch of line-of-sight checks.
+	//
+	// ray_test_packet() sets results[i] for each ray that hits
+	// something; rays whose result is already true aren't tested.
+	// ray_closest_hit_packet() is ray_closest_hit() on each ray.
+	enum { RAY_PACKET_SIZE = 4 };
+	void	ray_test_packet(int query_count, const ray_query queries[], bool results[]);
+	void	ray_closest_hit_packet(int query_count, const ray_query queries[], ray_hit hits[]);
+
+	// Capsule (line-swept sphere) and sphere-overlap queries; see
+	// lss_query.  lss_test() returns true if the query touches any
+	// face.  lss_closest_hit() finds the first contact, if it's
+	// earlier than hit->m_t; pass the same hit to each tree to
+	// query several.  These don't touch the statistics below, so
+	// any number of threads can run them on the same trees.
+	bool	lss_test(const lss_query& query);
+	bool	lss_closest_hit(const lss_query& query, lss_hit* hit);
+
+	// lss_closest_hit() of each query (say one per agent) against
+	// all the given trees, with the queries spread over the pool's
+	// threads.  pool may be NULL to do it all on this thread.
+	static void	lss_closest_hit_batch(
+		tu_thread::pool* pool,
+		int tree_count,
+		kd_tree_packed* const trees[],
+		int query_count,
+		const lss_query queries[],
+		lss_hit hits[]);
 
 	const axial_box&	get_bound() const { return m_bound; }
 
@@ -45,6 +93,8 @@ struct kd_tree_packed
 private:
 	kd_tree_packed();
 
+	bool	set_image(void* image, int image_size);
+
 	//struct node_chunk;
 
 	axial_box	m_bound;
@@ -53,6 +103,17 @@ private:
 
 	int	m_packed_tree_size;
 	kd_node*	m_packed_tree;
+
+	// Source mesh index of each face, in the order they appear
+	// in the leaves.
+	int	m_face_count;
+	int*	m_face_indices;
+
+	// If we came from a file, our data points into this image,
+	// which is either a mapped file or a tu_malloc'd copy of one.
+	void*	m_image;
+	int	m_image_size;
+	bool	m_image_is_mapped;
 };
 
 
@@ -1,102 +1,1012 @@
-// spatial_container.h	-- by Thatcher Ulrich <tu@tulrich.com>
+// loose_octree.cpp	-- by Thatcher Ulrich <tu@tulrich.com>
 
 // This source code has been donated to the Public Domain.  Do
 // whatever you want with it.
 
-// bounding-volume hierarchy for doing spatial queries on objects.
+// Loose octree of spheres; see loose_octree.h.
 
 
-#ifndef SPATIAL_CONTAINER_H
-#define SPATIAL_CONTAINER_H
+#include "geometry/loose_octree.h"
+#include "geometry/axial_box.h"
+#include "geometry/cull.h"
+#include "base/tu_thread.h"
+#include "base/utility.h"
 
 
-#include "geometry/geometry.h"
+static const int	MAX_DEPTH = 15;	// cell coords get 20 bits each in the key
+static const int	QUERY_BATCH_TASK_SIZE = 16;
 
 
-// sp_tag is used as a link node for the spatial_container.
-// 
-// @@ questions: best to keep this separate from the actual object
-// storage?  Or is there an advantage to allowing contained objects to
-// derive from this tag type (probably not -- prevents putting objects
-// in multiple containers, and isn't too intuitive).
-// 
+static uint64	make_key(int depth, int ix, int iy, int iz)
+{
+	return (uint64(depth) << 60) | (uint64(ix) << 40) | (uint64(iy) << 20) | uint64(iz);
+}
 
 
+size_t	loose_octree::key_hash::operator()(const uint64& key) const
+// The key's bits are very regular, and the hash table uses the low
+// bits of this, so mix them up.
+{
+	uint32	h = uint32(key) * 0x9E3779B1 ^ uint32(key >> 32) * 0x85EBCA77;
+	h ^= h >> 15;
+	h *= 0xC2B2AE3D;
+	h ^= h >> 13;
+	return h;
+}
 
-struct sp_tag {
-	vec3	center;
-	float	extent;	// half-size of an edge for cubes, radius for spheres.
-	void*	payload;
 
-	sp_tag	*next;
-	sp_tag	*previous;
-};
+loose_octree::loose_octree(const vec3& center, float half_size, int max_depth)
+	:
+	m_min(center - vec3(half_size, half_size, half_size)),
+	m_half_size(half_size),
+	m_max_depth(iclamp(max_depth, 0, MAX_DEPTH)),
+	m_slack(half_size / (1 << 20)),
+	m_node_count(0),
+	m_first_free_object(-1),
+	m_object_count(0)
+{
+	assert(half_size > 0);
 
+	// ROOT and OUTSIDE.
+	for (int i = 0; i < 2; i++)
+	{
+		node*	n = new node;
+		n->m_center = center;
+		n->m_half_size = half_size;
+		n->m_key = make_key(0, 0, 0, 0);
+		n->m_parent = -1;
+		n->m_slot = -1;
+		for (int j = 0; j < 8; j++) n->m_child[j] = -1;
+		n->m_child_count = 0;
+		n->m_max_radius = 0;
+		m_nodes.push_back(n);
+	}
+	m_node_index.add(m_nodes[ROOT]->m_key, ROOT);
+	m_node_count = 1;
+}
 
-struct spatial_container_result_callback {
-	virtual void	result_callback( const sp_tag& result );
-};
 
+loose_octree::~loose_octree()
+{
+	for (int i = 0; i < m_nodes.size(); i++)
+	{
+		delete m_nodes[i];
+	}
+}
+
+
+int	loose_octree::find_node(const vec3& center, float radius)
+// Return the index of the node that should hold the given sphere,
+// creating it if necessary.
+{
+	float	root_size = m_half_size * 2;
+	vec3	p = center - m_min;
+	if (radius > m_half_size
+	    || p.x < 0 || p.x >= root_size
+	    || p.y < 0 || p.y >= root_size
+	    || p.z < 0 || p.z >= root_size)
+	{
+		// Won't fit in the root's bound.
+		return OUTSIDE;
+	}
+
+	// Deepest level whose cells are at least 2 * radius across.
+	int	depth = 0;
+	float	half_size = m_half_size;
+	while (depth < m_max_depth && radius <= half_size * 0.5f)
+	{
+		depth++;
+		half_size *= 0.5f;
+	}
+
+	int	max_coord = (1 << depth) - 1;
+	float	scale = 0.5f / half_size;
+	return get_node(depth,
+			iclamp(int(p.x * scale), 0, max_coord),
+			iclamp(int(p.y * scale), 0, max_coord),
+			iclamp(int(p.z * scale), 0, max_coord));
+}
+
+
+int	loose_octree::get_node(int depth, int ix, int iy, int iz)
+// Return the index of the node for the given cell, creating it and
+// any missing ancestors.
+{
+	uint64	key = make_key(depth, ix, iy, iz);
+	int	index;
+	if (m_node_index.get(key, &index))
+	{
+		return index;
+	}
+
+	assert(depth > 0);	// root always exists
+	int	parent_index = get_node(depth - 1, ix >> 1, iy >> 1, iz >> 1);
+
+	node*	n = new node;
+	float	half_size = m_half_size / float(1 << depth);
+	n->m_center = m_min + vec3((ix * 2 + 1) * half_size, (iy * 2 + 1) * half_size, (iz * 2 + 1) * half_size);
+	n->m_half_size = half_size;
+	n->m_key = key;
+	n->m_parent = parent_index;
+	n->m_slot = (ix & 1) | ((iy & 1) << 1) | ((iz & 1) << 2);
+	for (int j = 0; j < 8; j++) n->m_child[j] = -1;
+	n->m_child_count = 0;
+	n->m_max_radius = 0;
+
+	if (m_free_nodes.size())
+	{
+		index = m_free_nodes.back();
+		m_free_nodes.pop_back();
+		m_nodes[index] = n;
+	}
+	else
+	{
+		index = m_nodes.size();
+		m_nodes.push_back(n);
+	}
+	m_node_index.add(key, index);
+	m_node_count++;
+
+	node*	parent = m_nodes[parent_index];
+	assert(parent->m_child[n->m_slot] == -1);
+	parent->m_child[n->m_slot] = index;
+	parent->m_child_radius[n->m_slot] = 0;
+	parent->m_child_count++;
 
-class spatial_container_void {
+	return index;
+}
 
-	spatial_container_void( base_cell_extent, max_depth );
 
-#if EXAMPLES
-	// with the iterator pattern, I think the result callback may be useless...
-	// you just do this sort of thing:
-	//
-	for ( spatial_container_void::iterator i( container, center, extent );
-		  ! i.is_finished();
-		  i.advance() )
+void	loose_octree::grow_radius(int node_index, float radius)
+// Make sure the node's and its ancestors' m_max_radius cover radius.
+{
+	while (node_index >= 0 && m_nodes[node_index]->m_max_radius < radius)
 	{
-		i.get_current()->payload...;
+		node*	n = m_nodes[node_index];
+		n->m_max_radius = radius;
+		if (n->m_parent >= 0)
+		{
+			m_nodes[n->m_parent]->m_child_radius[n->m_slot] = radius;
+		}
+		node_index = n->m_parent;
+	}
+}
+
+
+void	loose_octree::insert(int id, int node_index, const vec3& center, float radius)
+// Append the object to the node's entries.
+{
+	grow_radius(node_index, radius);
+
+	array<entry>&	entries = m_nodes[node_index]->m_entries;
+	entry	e;
+	e.m_center = center;
+	e.m_radius = radius;
+	e.m_id = id;
+	entries.push_back(e);
+
+	m_objects[id].m_node = node_index;
+	m_objects[id].m_slot = entries.size() - 1;
+}
+
+
+void	loose_octree::take_out(int id)
+// Remove the object's entry from its node, by moving the node's last
+// entry into its slot.
+{
+	object&	o = m_objects[id];
+	array<entry>&	entries = m_nodes[o.m_node]->m_entries;
+	int	last = entries.size() - 1;
+	if (o.m_slot != last)
+	{
+		entries[o.m_slot] = entries[last];
+		m_objects[entries[o.m_slot].m_id].m_slot = o.m_slot;
 	}
+	entries.pop_back();
+}
 
-	// define a spatial_query class, templated on type of container...?  dunno if that's possible.
 
-	foreach_spatial_in_cube( type, var, container, center, extent, hint ) {
-		if ( square_length( var->GetPosition(), center ) < extent * extent ) {
-			var->apply_effect();
+void	loose_octree::prune(int node_index)
+// Delete the node if it's empty and has no children, and then do the
+// same for its parent, etc.
+{
+	while (node_index != ROOT && node_index != OUTSIDE)
+	{
+		node*	n = m_nodes[node_index];
+		if (n == NULL	// already pruned
+		    || n->m_entries.size()
+		    || n->m_child_count)
+		{
+			return;
+		}
+
+		int	parent_index = n->m_parent;
+		node*	parent = m_nodes[parent_index];
+		for (int i = 0; i < 8; i++)
+		{
+			if (parent->m_child[i] == node_index)
+			{
+				parent->m_child[i] = -1;
+				parent->m_child_count--;
+				break;
+			}
+		}
+
+		m_node_index.erase(n->m_key);
+		delete n;
+		m_nodes[node_index] = NULL;
+		m_free_nodes.push_back(node_index);
+		m_node_count--;
+
+		node_index = parent_index;
+	}
+}
+
+
+int	loose_octree::add(const vec3& center, float radius, void* payload)
+{
+	int	id;
+	if (m_first_free_object >= 0)
+	{
+		id = m_first_free_object;
+		m_first_free_object = m_objects[id].m_slot;
+	}
+	else
+	{
+		id = m_objects.size();
+		m_objects.resize(id + 1);
+	}
+	m_objects[id].m_payload = payload;
+	insert(id, find_node(center, radius), center, radius);
+	m_object_count++;
+
+	return id;
+}
+
+
+void	loose_octree::remove(int id)
+{
+	assert(id >= 0 && id < m_objects.size() && m_objects[id].m_node >= 0);
+
+	int	old_node = m_objects[id].m_node;
+	take_out(id);
+	prune(old_node);
+
+	m_objects[id].m_node = -1;
+	m_objects[id].m_slot = m_first_free_object;
+	m_objects[id].m_payload = NULL;
+	m_first_free_object = id;
+	m_object_count--;
+}
+
+
+void	loose_octree::move(int id, const vec3& center, float radius)
+{
+	assert(id >= 0 && id < m_objects.size() && m_objects[id].m_node >= 0);
+
+	int	old_node = m_objects[id].m_node;
+	int	new_node = find_node(center, radius);
+	if (new_node == old_node)
+	{
+		entry&	e = m_nodes[new_node]->m_entries[m_objects[id].m_slot];
+		e.m_center = center;
+		e.m_radius = radius;
+		grow_radius(new_node, radius);
+		return;
+	}
+
+	take_out(id);
+	insert(id, new_node, center, radius);
+	prune(old_node);
+}
+
+
+void	loose_octree::move_batch(int count, const int ids[], const vec3 centers[], const float radii[])
+{
+	array<int>	vacated;
+	for (int i = 0; i < count; i++)
+	{
+		int	id = ids[i];
+		assert(id >= 0 && id < m_objects.size() && m_objects[id].m_node >= 0);
+
+		int	old_node = m_objects[id].m_node;
+		int	new_node = find_node(centers[i], radii[i]);
+		if (new_node == old_node)
+		{
+			entry&	e = m_nodes[new_node]->m_entries[m_objects[id].m_slot];
+			e.m_center = centers[i];
+			e.m_radius = radii[i];
+			grow_radius(new_node, radii[i]);
+		}
+		else
+		{
+			take_out(id);
+			insert(id, new_node, centers[i], radii[i]);
+			if (m_nodes[old_node]->m_entries.size() == 0)
+			{
+				vacated.push_back(old_node);
+			}
 		}
 	}
 
-	foreach_spatial_in_frustum( type /* from container? or useful for casting. */, var, container, frustum, hint ) {
-		var->Render();
+	// Nothing gets deleted above, so these are all still valid
+	// node indices; prune() skips ones that got refilled, or that
+	// were already deleted along with a child.
+	for (int i = 0; i < vacated.size(); i++)
+	{
+		prune(vacated[i]);
 	}
+}
+
+
+const vec3&	loose_octree::get_center(int id) const
+{
+	const object&	o = m_objects[id];
+	assert(o.m_node >= 0);
+	return m_nodes[o.m_node]->m_entries[o.m_slot].m_center;
+}
+
 
-	ray_test( &result, ray, );
+float	loose_octree::get_radius(int id) const
+{
+	const object&	o = m_objects[id];
+	assert(o.m_node >= 0);
+	return m_nodes[o.m_node]->m_entries[o.m_slot].m_radius;
+}
 
-#endif // EXAMPLES
 
+void*	loose_octree::get_payload(int id) const
+{
+	assert(m_objects[id].m_node >= 0);
+	return m_objects[id].m_payload;
+}
 
-	class cube_iterator {
-	public:
-		// void	advance();
-		// sp_tag*	get_current();
-		sp_tag*	get_next();	// return 0 when finished?
-		bool	is_finished();
 
-	private:
-		vec3	query_center;
-		float	query_extent;
-		// int	direction_hint;
-		// int	query_outcode;	// @@ figure this out.
+//
+// queries
+//
 
-		node*	current_node;
-		sp_tag*	current_tag;
-	};
+
+static float	box_sqr_distance(const vec3& p, const vec3& min, const vec3& max)
+// Squared distance from p to the box; 0 if it's inside.
+{
+	float	dist = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		float	d = 0;
+		if (p[i] < min[i]) d = min[i] - p[i];
+		else if (p[i] > max[i]) d = p[i] - max[i];
+		dist += d * d;
+	}
+	return dist;
+}
 
 
-//	class ray_iterator {
-//	};
+// A sphere or box query.  The box is the sphere's bound for sphere
+// queries.
+struct loose_octree::query
+{
+	array<int>*	m_results;
+	bool	m_sphere;
+	vec3	m_center;
+	float	m_radius;
+	vec3	m_min, m_max;
 
+	bool	touches(const entry& e) const
+	{
+		if (m_sphere)
+		{
+			float	r = m_radius + e.m_radius;
+			return (e.m_center - m_center).sqrmag() <= r * r;
+		}
+		return box_sqr_distance(e.m_center, m_min, m_max) <= e.m_radius * e.m_radius;
+	}
+
+	enum overlap { MISSES, TOUCHES, CONTAINS };
+
+	overlap	check(const vec3& center, float extent) const
+	// How the cube at center, with the given half-size, meets the
+	// query.  CONTAINS means it's entirely inside, so everything
+	// in it touches the query.
+	{
+		vec3	min = center - vec3(extent, extent, extent);
+		vec3	max = center + vec3(extent, extent, extent);
+		if (m_max.x < min.x || m_min.x > max.x
+		    || m_max.y < min.y || m_min.y > max.y
+		    || m_max.z < min.z || m_min.z > max.z)
+		{
+			return MISSES;
+		}
 
-//	class frustum_iterator {
-//	};
+		if (m_sphere)
+		{
+			float	r2 = m_radius * m_radius;
+			if (box_sqr_distance(m_center, min, max) > r2)
+			{
+				return MISSES;
+			}
+			if (extent > m_radius)
+			{
+				return TOUCHES;	// too big to fit
+			}
+			float	dist = 0;
+			for (int i = 0; i < 3; i++)
+			{
+				float	d = fmax(fabsf(min[i] - m_center[i]), fabsf(max[i] - m_center[i]));
+				dist += d * d;
+			}
+			return dist <= r2 ? CONTAINS : TOUCHES;
+		}
 
+		if (m_min.x <= min.x && max.x <= m_max.x
+		    && m_min.y <= min.y && max.y <= m_max.y
+		    && m_min.z <= min.z && max.z <= m_max.z)
+		{
+			return CONTAINS;
+		}
+		return TOUCHES;
+	}
 };
 
 
-#endif // SPATIAL_CONTAINER_H
+void	loose_octree::query_node(const query& q, int node_index) const
+// Add the objects in this node and its children that touch the query.
+// The caller has already found that the node's bound touches it.
+{
+	const node*	n = m_nodes[node_index];
+
+	for (int i = 0, count = n->m_entries.size(); i < count; i++)
+	{
+		const entry&	e = n->m_entries[i];
+		if (q.touches(e))
+		{
+			q.m_results->push_back(e.m_id);
+		}
+	}
+
+	if (n->m_child_count)
+	{
+		// Check the children's bounds from here, so the ones
+		// that miss never get loaded.
+		float	h = n->m_half_size * 0.5f;
+		for (int i = 0; i < 8; i++)
+		{
+			int	child = n->m_child[i];
+			if (child < 0)
+			{
+				continue;
+			}
+			vec3	center(n->m_center.x + ((i & 1) ? h : -h),
+				       n->m_center.y + ((i & 2) ? h : -h),
+				       n->m_center.z + ((i & 4) ? h : -h));
+			query::overlap	o = q.check(center, h + n->m_child_radius[i] + m_slack);
+			if (o == query::CONTAINS)
+			{
+				add_subtree(q.m_results, child);
+			}
+			else if (o == query::TOUCHES)
+			{
+				query_node(q, child);
+			}
+		}
+	}
+}
+
+
+void	loose_octree::query_tree(const query& q) const
+// Run the query on the root and everything outside it.
+{
+	const node*	root = m_nodes[ROOT];
+	query::overlap	o = q.check(root->m_center, root->m_half_size + root->m_max_radius + m_slack);
+	if (o == query::CONTAINS)
+	{
+		add_subtree(q.m_results, ROOT);
+	}
+	else if (o == query::TOUCHES)
+	{
+		query_node(q, ROOT);
+	}
+
+	// Nothing to check the bound of.
+	query_node(q, OUTSIDE);
+}
+
+
+void	loose_octree::query_sphere(array<int>* results, const vec3& center, float radius) const
+{
+	query	q;
+	q.m_results = results;
+	q.m_sphere = true;
+	q.m_center = center;
+	q.m_radius = radius;
+	q.m_min = center - vec3(radius, radius, radius);
+	q.m_max = center + vec3(radius, radius, radius);
+
+	query_tree(q);
+}
+
+
+void	loose_octree::query_box(array<int>* results, const axial_box& box) const
+{
+	query	q;
+	q.m_results = results;
+	q.m_sphere = false;
+	q.m_center = box.get_center();
+	q.m_radius = 0;
+	q.m_min = box.get_min();
+	q.m_max = box.get_max();
+
+	query_tree(q);
+}
+
+
+void	loose_octree::add_subtree(array<int>* results, int node_index) const
+// Add everything in this node and below.
+{
+	const node*	n = m_nodes[node_index];
+	for (int i = 0, count = n->m_entries.size(); i < count; i++)
+	{
+		results->push_back(n->m_entries[i].m_id);
+	}
+	if (n->m_child_count)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			if (n->m_child[i] >= 0)
+			{
+				add_subtree(results, n->m_child[i]);
+			}
+		}
+	}
+}
+
+
+void	loose_octree::query_frustum_node(array<int>* results, const plane_info frustum[6], int node_index, int active_planes) const
+// Add the objects in this node and its children that are inside the
+// frustum.  active_planes has a bit set for each plane that might
+// cull something in this node.
+{
+	const node*	n = m_nodes[node_index];
+
+	if (node_index != OUTSIDE)
+	{
+		float	extent = n->m_half_size + n->m_max_radius + m_slack;
+		cull::result_info	vis = cull::compute_box_visibility(
+			n->m_center, vec3(extent, extent, extent), frustum, cull::result_info(false, Uint8(active_planes)));
+		if (vis.culled)
+		{
+			return;
+		}
+		if (vis.active_planes == 0)
+		{
+			// Entirely inside; no more tests needed.
+			add_subtree(results, node_index);
+			return;
+		}
+		active_planes = vis.active_planes;
+	}
+
+	for (int i = 0, count = n->m_entries.size(); i < count; i++)
+	{
+		const entry&	e = n->m_entries[i];
+		bool	visible = true;
+		for (int j = 0; j < 6; j++)
+		{
+			if ((active_planes & (1 << j))
+			    && frustum[j].normal * e.m_center - frustum[j].d < -e.m_radius)
+			{
+				visible = false;
+				break;
+			}
+		}
+		if (visible)
+		{
+			results->push_back(e.m_id);
+		}
+	}
+
+	if (n->m_child_count)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			if (n->m_child[i] >= 0)
+			{
+				query_frustum_node(results, frustum, n->m_child[i], active_planes);
+			}
+		}
+	}
+}
+
+
+void	loose_octree::query_frustum(array<int>* results, const plane_info frustum[6]) const
+{
+	query_frustum_node(results, frustum, ROOT, 0x3F);
+	query_frustum_node(results, frustum, OUTSIDE, 0x3F);
+}
+
+
+struct octree_query_batch
+{
+	const loose_octree*	m_tree;
+	int	m_count;
+	const vec3*	m_centers;
+	const float*	m_radii;
+	array<int>*	m_results;
+};
+
+
+static void	query_batch_task(void* arg, int task_index)
+// Do one task's worth of a query_sphere_batch().
+{
+	const octree_query_batch*	b = (const octree_query_batch*) arg;
+	int	end = imin(b->m_count, (task_index + 1) * QUERY_BATCH_TASK_SIZE);
+	for (int i = task_index * QUERY_BATCH_TASK_SIZE; i < end; i++)
+	{
+		b->m_tree->query_sphere(&b->m_results[i], b->m_centers[i], b->m_radii[i]);
+	}
+}
+
+
+void	loose_octree::query_sphere_batch(
+	tu_thread::pool* pool,
+	int count,
+	const vec3 centers[],
+	const float radii[],
+	array<int> results[]) const
+{
+	octree_query_batch	b;
+	b.m_tree = this;
+	b.m_count = count;
+	b.m_centers = centers;
+	b.m_radii = radii;
+	b.m_results = results;
+
+	int	task_count = (count + QUERY_BATCH_TASK_SIZE - 1) / QUERY_BATCH_TASK_SIZE;
+	if (pool)
+	{
+		pool->run(query_batch_task, &b, task_count);
+	}
+	else
+	{
+		for (int i = 0; i < task_count; i++)
+		{
+			query_batch_task(&b, i);
+		}
+	}
+}
+
+
+#ifdef LOOSE_OCTREE_TEST
+
+
+// Checks loose_octree against brute force, and compares it with
+// grid_index_box on a world full of moving objects: the time to
+// update every object each frame, and to run a bunch of sphere
+// queries.  grid_index_box is 2D, so it indexes the objects'
+// footprints and the query results get filtered in 3D.
+//
+// g++ loose_octree.cpp axial_box.cpp cull.cpp geometry.cpp ../base/container.cpp ../base/membuf.cpp ../base/tu_file.cpp ../base/tu_random.cpp ../base/tu_thread.cpp ../base/tu_timer.cpp ../base/utf8.cpp -O2 -I.. -DLOOSE_OCTREE_TEST -DTU_CONFIG_LINK_TO_THREAD=2 -lpthread -o loose_octree_test
+
+
+#include "base/grid_index.h"
+#include "base/tu_random.h"
+#include "base/tu_timer.h"
+#include <stdio.h>
+
+
+typedef grid_index_box<float, int>	grid_t;
+typedef index_box<float>	grid_box_t;
+
+
+static const int	OBJECT_COUNT = 100000;
+static const float	WORLD_SIZE = 2000;
+static const float	WORLD_HEIGHT = 100;
+static const float	MAX_SPEED = 4;
+static const int	FRAME_COUNT = 20;
+static const int	QUERY_COUNT = 5000;	// per frame
+static const float	QUERY_RADIUS = 20;
+static const int	MAX_TREE_DEPTH = 5;	// 62-unit cells; a few dozen objects per node
+
+
+static float	random_float(float max)
+{
+	return (tu_random::next_random() & 0xFFFFFF) / float(0xFFFFFF) * max;
+}
+
+
+static vec3	random_point()
+{
+	return vec3(random_float(WORLD_SIZE), random_float(WORLD_SIZE), random_float(WORLD_HEIGHT));
+}
+
+
+static grid_box_t	footprint(const vec3& center, float radius)
+{
+	return grid_box_t(index_point<float>(center.x - radius, center.y - radius),
+			  index_point<float>(center.x + radius, center.y + radius));
+}
+
+
+static bool	spheres_touch(const vec3& a, float ar, const vec3& b, float br)
+{
+	return (a - b).sqrmag() <= (ar + br) * (ar + br);
+}
+
+
+// Order-independent summary of a result set.
+static double	checksum(const array<int>& ids)
+{
+	double	sum = 0;
+	for (int i = 0; i < ids.size(); i++)
+	{
+		sum += ids[i] + 1;
+	}
+	return sum;
+}
+
+
+static double	query_grid(grid_t* grid, const array<vec3>& centers, const array<float>& radii, const vec3& c, float r)
+{
+	double	sum = 0;
+	for (grid_t::iterator it = grid->begin(footprint(c, r)); ! it.at_end(); ++it)
+	{
+		int	id = it->value;
+		if (spheres_touch(centers[id], radii[id], c, r)) sum += id + 1;
+	}
+	return sum;
+}
+
+
+static double	query_brute_force(const array<vec3>& centers, const array<float>& radii, const array<bool>& live, const vec3& c, float r)
+{
+	double	sum = 0;
+	for (int i = 0; i < centers.size(); i++)
+	{
+		if (live[i] && spheres_touch(centers[i], radii[i], c, r)) sum += i + 1;
+	}
+	return sum;
+}
+
+
+static void	make_frustum(plane_info frustum[6], const vec3& eye, const vec3& dir, float near_dist, float far_dist)
+// 90-degree frustum with inward-facing planes, looking along dir
+// (horizontal).
+{
+	vec3	f = dir;
+	f.normalize();
+	vec3	up = vec3::z_axis;
+	vec3	right = f.cross(up);
+	right.normalize();
+	vec3	n[4] = { f + right, f - right, f + up, f - up };
+	for (int i = 0; i < 4; i++)
+	{
+		n[i].normalize();
+		frustum[i].set(n[i], n[i] * eye);
+	}
+	frustum[4].set(f, f * eye + near_dist);
+	frustum[5].set(-f, -(f * eye + far_dist));
+}
+
+
+int	main()
+{
+	tu_random::seed_random(1234);
+
+	// Objects: mostly small, some medium, a few big.
+	array<vec3>	centers;
+	array<float>	radii;
+	array<vec3>	velocities;
+	array<bool>	live;
+	for (int i = 0; i < OBJECT_COUNT; i++)
+	{
+		centers.push_back(random_point());
+		int	kind = tu_random::next_random() % 100;
+		radii.push_back(kind < 90 ? 0.25f + random_float(1) : kind < 99 ? 2 + random_float(6) : 20 + random_float(30));
+		velocities.push_back(vec3(random_float(2 * MAX_SPEED) - MAX_SPEED,
+					  random_float(2 * MAX_SPEED) - MAX_SPEED,
+					  random_float(MAX_SPEED) - MAX_SPEED / 2));
+		live.push_back(true);
+	}
+
+	loose_octree	tree(vec3(WORLD_SIZE / 2, WORLD_SIZE / 2, WORLD_SIZE / 2), WORLD_SIZE / 2, MAX_TREE_DEPTH);
+	grid_t	grid(GRID_INDEX_AUTOSIZE, grid_box_t(index_point<float>(0, 0), index_point<float>(WORLD_SIZE, WORLD_SIZE)), OBJECT_COUNT);
+	array<int>	ids;
+	for (int i = 0; i < OBJECT_COUNT; i++)
+	{
+		ids.push_back(tree.add(centers[i], radii[i], NULL));
+		assert(ids[i] == i);
+		grid.add(footprint(centers[i], radii[i]), i);
+	}
+
+	tu_thread::pool	pool1(1), pool4(4);
+
+	double	grid_update_seconds = 0, tree_update_seconds = 0;
+	double	grid_query_seconds = 0, tree_query_seconds = 0;
+	double	pool1_seconds = 0, pool4_seconds = 0;
+	int	error_count = 0;
+	int	result_count = 0;
+
+	array<vec3>	new_centers;
+	new_centers.resize(OBJECT_COUNT);
+	array<vec3>	query_centers;
+	array<float>	query_radii;
+	query_centers.resize(QUERY_COUNT);
+	query_radii.resize(QUERY_COUNT);
+	array<int>	batch_results[QUERY_COUNT];
+	array<int>	results;
+
+	for (int frame = 0; frame < FRAME_COUNT; frame++)
+	{
+		// Move everything, bouncing off the edges of the world.
+		for (int i = 0; i < OBJECT_COUNT; i++)
+		{
+			vec3	c = centers[i] + velocities[i];
+			vec3	limit(WORLD_SIZE, WORLD_SIZE, WORLD_HEIGHT);
+			for (int j = 0; j < 3; j++)
+			{
+				if (c[j] < 0 || c[j] >= limit[j])
+				{
+					velocities[i][j] = -velocities[i][j];
+					c[j] = centers[i][j];
+				}
+			}
+			new_centers[i] = c;
+		}
+
+		uint64	start_ticks = tu_timer::get_profile_ticks();
+		for (int i = 0; i < OBJECT_COUNT; i++)
+		{
+			grid_t::iterator	it = grid.find(footprint(centers[i], radii[i]), i);
+			assert(it.at_end() == false);
+			grid.remove(&*it);
+			grid.add(footprint(new_centers[i], radii[i]), i);
+		}
+		grid_update_seconds += tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+
+		start_ticks = tu_timer::get_profile_ticks();
+		tree.move_batch(OBJECT_COUNT, &ids[0], &new_centers[0], &radii[0]);
+		tree_update_seconds += tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+
+		for (int i = 0; i < OBJECT_COUNT; i++)
+		{
+			centers[i] = new_centers[i];
+		}
+
+		// Queries.
+		for (int i = 0; i < QUERY_COUNT; i++)
+		{
+			query_centers[i] = random_point();
+			query_radii[i] = random_float(QUERY_RADIUS);
+		}
+
+		double	grid_sum = 0;
+		start_ticks = tu_timer::get_profile_ticks();
+		for (int i = 0; i < QUERY_COUNT; i++)
+		{
+			grid_sum += query_grid(&grid, centers, radii, query_centers[i], query_radii[i]);
+		}
+		grid_query_seconds += tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+
+		double	tree_sum = 0;
+		start_ticks = tu_timer::get_profile_ticks();
+		for (int i = 0; i < QUERY_COUNT; i++)
+		{
+			results.resize(0);
+			tree.query_sphere(&results, query_centers[i], query_radii[i]);
+			result_count += results.size();
+			tree_sum += checksum(results);
+		}
+		tree_query_seconds += tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+
+		for (int p = 0; p < 2; p++)
+		{
+			for (int i = 0; i < QUERY_COUNT; i++)
+			{
+				batch_results[i].resize(0);
+			}
+			start_ticks = tu_timer::get_profile_ticks();
+			tree.query_sphere_batch(p ? &pool4 : &pool1, QUERY_COUNT, &query_centers[0], &query_radii[0], batch_results);
+			double	seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+			(p ? pool4_seconds : pool1_seconds) += seconds;
+
+			double	batch_sum = 0;
+			for (int i = 0; i < QUERY_COUNT; i++)
+			{
+				batch_sum += checksum(batch_results[i]);
+			}
+			if (batch_sum != tree_sum) error_count++;
+		}
+
+		if (grid_sum != tree_sum)
+		{
+			printf("frame %d: grid and octree results differ\n", frame);
+			error_count++;
+		}
+
+		// Spot check against brute force.
+		for (int i = 0; i < 50; i++)
+		{
+			results.resize(0);
+			tree.query_sphere(&results, query_centers[i], query_radii[i]);
+			if (checksum(results) != query_brute_force(centers, radii, live, query_centers[i], query_radii[i])) error_count++;
+		}
+	}
+
+	// Frustum and box queries, and removal.
+	for (int pass = 0; pass < 2; pass++)
+	{
+		if (pass == 1)
+		{
+			for (int i = 0; i < OBJECT_COUNT; i += 3)
+			{
+				tree.remove(ids[i]);
+				live[i] = false;
+			}
+		}
+
+		for (int i = 0; i < 20; i++)
+		{
+			plane_info	frustum[6];
+			vec3	dir(random_float(2) - 1, random_float(2) - 1, 0);
+			make_frustum(frustum, random_point(), dir, 1, 300);
+
+			double	expected = 0;
+			for (int j = 0; j < OBJECT_COUNT; j++)
+			{
+				if (live[j] == false) continue;
+				bool	visible = true;
+				for (int k = 0; k < 6; k++)
+				{
+					if (frustum[k].normal * centers[j] - frustum[k].d < -radii[j]) visible = false;
+				}
+				if (visible) expected += j + 1;
+			}
+			results.resize(0);
+			tree.query_frustum(&results, frustum);
+			if (checksum(results) != expected) error_count++;
+
+			vec3	corner = random_point();
+			axial_box	box(corner, corner);
+			box.set_enclosing(corner + vec3(random_float(100), random_float(100), random_float(50)));
+			expected = 0;
+			for (int j = 0; j < OBJECT_COUNT; j++)
+			{
+				if (live[j] && box_sqr_distance(centers[j], box.get_min(), box.get_max()) <= radii[j] * radii[j]) expected += j + 1;
+			}
+			results.resize(0);
+			tree.query_box(&results, box);
+			if (checksum(results) != expected) error_count++;
+		}
+	}
+
+	int	node_count = tree.get_node_count();
+
+	// Everything out; all the nodes but the root should go away.
+	for (int i = 0; i < OBJECT_COUNT; i++)
+	{
+		if (live[i]) tree.remove(ids[i]);
+	}
+	if (tree.get_object_count() != 0 || tree.get_node_count() != 1) error_count++;
+
+	printf("%d objects, %d frames, %d sphere queries per frame (%3.1f results each)\n",
+	       OBJECT_COUNT, FRAME_COUNT, QUERY_COUNT, result_count / double(FRAME_COUNT * QUERY_COUNT));
+	printf("%d results differ, %d octree nodes\n\n", error_count, node_count);
+	printf("ms/frame               update    queries\n");
+	printf("grid_index_box     %10.2f %10.2f\n", grid_update_seconds * 1000 / FRAME_COUNT, grid_query_seconds * 1000 / FRAME_COUNT);
+	printf("loose_octree       %10.2f %10.2f\n", tree_update_seconds * 1000 / FRAME_COUNT, tree_query_seconds * 1000 / FRAME_COUNT);
+	printf("  batch, 1 thread  %10s %10.2f\n", "", pool1_seconds * 1000 / FRAME_COUNT);
+	printf("  batch, 4 threads %10s %10.2f\n", "", pool4_seconds * 1000 / FRAME_COUNT);
+
+	return error_count ? 1 : 0;
+}
+
+
+#endif // LOOSE_OCTREE_TEST
+
 
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
@@ -0,0 +1,171 @@
+// loose_octree.h	-- loose octree of spheres
+
+// This source code has been donated to the Public Domain.  Do
+// whatever you want with it.
+
+// Loose octree of spheres, for doing spatial queries on lots of
+// moving objects.
+//
+// Each node's bound is its octree cell grown by half a cell on every
+// side.  So an object of radius r fits in the node, at the deepest
+// level whose cells are at least 2r across, whose cell contains the
+// object's center.  Finding that node is arithmetic plus a hash
+// lookup; there's no descent from the root.  An object that moves
+// without changing nodes is just updated in place; otherwise it's
+// removed from one node's array (by swapping in the last element) and
+// appended to another's.
+//
+// The loose bound is only the limit, though.  Each node also tracks
+// the largest radius in its subtree, and queries use the cell grown
+// by that, which for small objects is much tighter.  It only ever
+// grows, until the node is pruned, so it can be stale-large after
+// big objects leave.  A subtree whose bound is entirely inside the
+// query is added without testing anything in it.
+//
+// Against a 2D grid_index_box on a flat world, with small sphere
+// queries, the octree updates several times faster but queries
+// somewhat slower (see LOOSE_OCTREE_TEST): the grid's cells hug the
+// footprints, and the octree visits each layer of cells the world's
+// height spans.  So it's the better choice when lots of objects move
+// every frame; grid_index_box is still the better one for static or
+// query-heavy sets.
+//
+// The queries don't modify the tree, so any number of threads can
+// query at once, as long as nothing is being added, moved or removed.
+
+
+#ifndef LOOSE_OCTREE_H
+#define LOOSE_OCTREE_H
+
+
+#include "base/container.h"
+#include "geometry/geometry.h"
+
+
+struct axial_box;
+namespace tu_thread { struct pool; }
+
+
+struct loose_octree
+{
+	// The octree covers the cube at center, with the given
+	// half-size.  Objects outside it still work, but aren't
+	// culled.  max_depth limits how small the nodes get; at most
+	// 15.  Small objects all end up at max_depth, so pick it to
+	// leave some tens of objects per node there: a tree full of
+	// nodes holding a few objects each is slow to query.
+	loose_octree(const vec3& center, float half_size, int max_depth = 8);
+	~loose_octree();
+
+	// Objects are spheres.  add() returns the new object's id,
+	// which stays the same until the object is removed.  Ids of
+	// removed objects get reused.
+	int	add(const vec3& center, float radius, void* payload);
+	void	remove(int id);
+	void	move(int id, const vec3& center, float radius);
+
+	// move() for a frame's worth of objects.  Same result as
+	// calling move() on each, but nodes left empty are pruned
+	// once, at the end.
+	void	move_batch(int count, const int ids[], const vec3 centers[], const float radii[]);
+
+	const vec3&	get_center(int id) const;
+	float	get_radius(int id) const;
+	void*	get_payload(int id) const;
+
+	int	get_object_count() const { return m_object_count; }
+	int	get_node_count() const { return m_node_count; }
+
+	// Append the ids of objects that touch the query volume.
+	// Frustum planes are as for cull::compute_box_visibility():
+	// normals point inward.
+	void	query_sphere(array<int>* results, const vec3& center, float radius) const;
+	void	query_box(array<int>* results, const axial_box& box) const;
+	void	query_frustum(array<int>* results, const plane_info frustum[6]) const;
+
+	// query_sphere() for each of the spheres, spread over the
+	// pool's threads.  pool may be NULL to do it all on this
+	// thread.
+	void	query_sphere_batch(
+		tu_thread::pool* pool,
+		int count,
+		const vec3 centers[],
+		const float radii[],
+		array<int> results[]) const;
+
+private:
+	loose_octree(const loose_octree&);
+	void	operator=(const loose_octree&);
+
+	struct entry
+	{
+		vec3	m_center;
+		float	m_radius;
+		int	m_id;
+	};
+
+	struct node
+	{
+		vec3	m_center;	// of the cell
+		float	m_half_size;	// of the cell; the node's bound is twice this
+		uint64	m_key;
+		int	m_parent;
+		int	m_slot;	// in the parent's m_child[]
+		int	m_child[8];
+		int	m_child_count;
+		float	m_max_radius;	// >= the radius of everything in this subtree
+		float	m_child_radius[8];	// each child's m_max_radius
+		array<entry>	m_entries;
+	};
+
+	struct object
+	{
+		int	m_node;	// -1 if the id is free
+		int	m_slot;	// index in the node's m_entries, or next free id
+		void*	m_payload;
+	};
+
+	struct key_hash
+	{
+		size_t	operator()(const uint64& key) const;
+	};
+
+	int	find_node(const vec3& center, float radius);
+	int	get_node(int depth, int ix, int iy, int iz);
+	void	grow_radius(int node_index, float radius);
+	void	insert(int id, int node_index, const vec3& center, float radius);
+	void	take_out(int id);
+	void	prune(int node_index);
+
+	struct query;
+	void	query_tree(const query& q) const;
+	void	query_node(const query& q, int node_index) const;
+	void	query_frustum_node(array<int>* results, const plane_info frustum[6], int node_index, int active_planes) const;
+	void	add_subtree(array<int>* results, int node_index) const;
+
+	vec3	m_min;		// corner of the root cell
+	float	m_half_size;	// of the root cell
+	int	m_max_depth;
+	float	m_slack;	// added to node bounds, for rounding in find_node()
+
+	enum { ROOT = 0, OUTSIDE = 1 };	// OUTSIDE holds objects that aren't within the root cell
+	array<node*>	m_nodes;	// NULL for free slots
+	array<int>	m_free_nodes;
+	hash<uint64, int, key_hash>	m_node_index;
+	int	m_node_count;
+
+	array<object>	m_objects;
+	int	m_first_free_object;
+	int	m_object_count;
+};
+
+
+#endif // LOOSE_OCTREE_H
+
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 8
+// tab-width: 8
+// indent-tabs-mode: t
+// End:
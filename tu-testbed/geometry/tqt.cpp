@@ -8,22 +8,29 @@
 
 //#include "base/ogl.h"
 #include "geometry/tqt.h"
+#include "geometry/cull.h"
 #include "base/image.h"
 #include "base/tu_file.h"
+#include "base/tu_timer.h"
+#include "base/utility.h"
 
 
-static const int	TQT_VERSION = 1;
+// Version 1 files hold JPEG tiles.  Version 2 adds the tile format
+// to the header.
+static const int	TQT_VERSION = 2;
 
 
 struct tqt_header_info {
 	int	m_version;
 	int	m_tree_depth;
 	int	m_tile_size;
+	int	m_tile_format;
 
 	tqt_header_info()
 		: m_version(0),
 		  m_tree_depth(0),
-		  m_tile_size(0)
+		  m_tile_size(0),
+		  m_tile_format(tqt::JPEG_TILES)
 	{
 	}
 };
@@ -46,15 +53,490 @@ static tqt_header_info	read_tqt_header_info(tu_file* in)
 	info.m_version = in->read_le32();
 	info.m_tree_depth = in->read_le32();
 	info.m_tile_size = in->read_le32();
+	if (info.m_version >= 2) {
+		info.m_tile_format = in->read_le32();
+		if (info.m_tile_format != tqt::JPEG_TILES && info.m_tile_format != tqt::BC1_TILES) {
+			info.m_version = 0;
+		}
+	}
 
 	return info;
 }
 
 
+void	tqt_cache_stats::clear()
+{
+	m_lookups = 0;
+	m_hits = 0;
+	m_waits = 0;
+	m_prefetches = 0;
+	m_prefetch_hits = 0;
+	m_decodes = 0;
+	m_evictions = 0;
+	for (int i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		m_decode_latency[i] = 0;
+	}
+	m_decode_seconds = 0;
+	m_resident_tiles = 0;
+	m_resident_bytes = 0;
+	m_queued_tiles = 0;
+}
+
+
+struct tqt_tile
+// A tile in the cache: waiting for a loader thread, being decoded,
+// or decoded.  Only decoded tiles are in the LRU list.
+{
+	enum state { QUEUED, LOADING, READY };
+
+	int	m_index;
+	state	m_state;
+	bool	m_demanded;	// queued by get_cached_image(), not just a hint
+	bool	m_prefetched;	// decoded on a hint, and not used since
+	image::rgb*	m_image;	// if READY
+
+	tqt_tile*	m_prev;	// LRU list; most recently used first
+	tqt_tile*	m_next;
+
+	tqt_tile(int index, state s)
+		:
+		m_index(index),
+		m_state(s),
+		m_demanded(false),
+		m_prefetched(false),
+		m_image(NULL),
+		m_prev(NULL),
+		m_next(NULL)
+	{
+	}
+
+	~tqt_tile()
+	{
+		delete m_image;
+	}
+};
+
+
+static int	image_bytes(const image::rgb* im)
+{
+	return im->m_pitch * im->m_height;
+}
+
+
+static image::rgb*	copy_image(const image::rgb* im)
+{
+	image::rgb*	copy = image::create_rgb(im->m_width, im->m_height);
+	assert(copy->m_pitch == im->m_pitch);
+	memcpy(copy->m_data, im->m_data, image_bytes(im));
+	return copy;
+}
+
+
+struct tqt_cache
+// Decoded tiles of a tqt, up to a byte budget, and the threads that
+// decode them ahead of time.  Everything here is guarded by m_mutex;
+// tiles are decoded without it.
+{
+	// Only this many prefetch hints are kept; the oldest go.
+	enum { MAX_PREFETCH = 64 };
+
+	tqt_cache(const tqt* owner, int budget, int thread_count)
+		:
+		m_owner(owner),
+		m_budget(budget),
+		m_bytes(0),
+		m_lru(-1, tqt_tile::READY),
+		m_quit(false)
+	{
+		m_lru.m_prev = m_lru.m_next = &m_lru;
+		m_stats.clear();
+
+		for (int i = 0; i < thread_count; i++)
+		{
+			m_threads.push_back(new tu_thread::thread(thread_main, this));
+		}
+	}
+
+	~tqt_cache()
+	// Stop the threads, and throw away the tiles.
+	{
+		{
+			tu_thread::autolock	lock(&m_mutex);
+			m_quit = true;
+			m_work.broadcast();
+		}
+		for (int i = 0; i < m_threads.size(); i++)
+		{
+			delete m_threads[i];	// waits
+		}
+
+		for (hash<int, tqt_tile*>::iterator it = m_tiles.begin(); it != m_tiles.end(); ++it)
+		{
+			delete it->second;
+		}
+	}
+
+	image::rgb*	get(int index, bool wait);
+	void	prefetch(int index);
+	void	get_stats(tqt_cache_stats* stats);
+	void	clear_stats();
+
+private:
+	tqt_tile*	find(int index)
+	{
+		tqt_tile*	t = NULL;
+		m_tiles.get(index, &t);
+		return t;
+	}
+
+	tqt_tile*	add(int index, tqt_tile::state s)
+	{
+		tqt_tile*	t = new tqt_tile(index, s);
+		m_tiles.add(index, t);
+		if (s == tqt_tile::QUEUED)
+		{
+			m_stats.m_queued_tiles++;
+		}
+		return t;
+	}
+
+	void	remove(tqt_tile* t)
+	// Forget about t; it must not be in the LRU list.
+	{
+		if (t->m_state == tqt_tile::QUEUED)
+		{
+			m_stats.m_queued_tiles--;
+		}
+		m_tiles.erase(t->m_index);
+		delete t;
+	}
+
+	void	claim(tqt_tile* t)
+	// A thread is going to decode t.
+	{
+		assert(t->m_state == tqt_tile::QUEUED);
+		t->m_state = tqt_tile::LOADING;
+		m_stats.m_queued_tiles--;
+	}
+
+	void	link_front(tqt_tile* t)
+	{
+		t->m_prev = &m_lru;
+		t->m_next = m_lru.m_next;
+		t->m_next->m_prev = t;
+		m_lru.m_next = t;
+	}
+
+	void	unlink(tqt_tile* t)
+	{
+		t->m_prev->m_next = t->m_next;
+		t->m_next->m_prev = t->m_prev;
+		t->m_prev = t->m_next = NULL;
+	}
+
+	tqt_tile*	pop_work();
+	image::rgb*	use(tqt_tile* t);
+	void	finish_load(tqt_tile* t, image::rgb* im, uint64 start_ticks);
+	static void	thread_main(void* cache);
+
+	const tqt*	m_owner;
+	int	m_budget;
+	int	m_bytes;	// in decoded tiles
+
+	tu_thread::mutex	m_mutex;
+	tu_thread::condition	m_work;	// a tile was queued
+	tu_thread::condition	m_done;	// a tile was decoded
+	hash<int, tqt_tile*>	m_tiles;
+	tqt_tile	m_lru;	// sentinel
+
+	// Tile indices, newest last.  Entries may be stale: the
+	// tile may have been claimed, dropped or promoted since.
+	array<int>	m_demand;
+	array<int>	m_prefetch;
+
+	array<tu_thread::thread*>	m_threads;
+	bool	m_quit;
+
+	tqt_cache_stats	m_stats;
+};
+
+
+image::rgb*	tqt_cache::get(int index, bool wait)
+// Return a copy of the tile, decoding it if necessary.  If !wait and
+// there are loader threads, queue the tile for them instead, and
+// return NULL.
+{
+	m_mutex.lock();
+	m_stats.m_lookups++;
+
+	if (m_threads.size() == 0)
+	{
+		wait = true;
+	}
+
+	bool	waited = false;
+	tqt_tile*	t;
+	for (;;)
+	{
+		t = find(index);
+		if (t == NULL)
+		{
+			if (wait == false)
+			{
+				t = add(index, tqt_tile::QUEUED);
+				t->m_demanded = true;
+				m_demand.push_back(index);
+				m_work.signal();
+				m_mutex.unlock();
+				return NULL;
+			}
+
+			t = add(index, tqt_tile::LOADING);
+			break;
+		}
+
+		if (t->m_state == tqt_tile::READY)
+		{
+			if (waited == false)
+			{
+				m_stats.m_hits++;
+			}
+			image::rgb*	im = use(t);
+			m_mutex.unlock();
+			return im;
+		}
+
+		if (t->m_state == tqt_tile::QUEUED)
+		{
+			if (wait)
+			{
+				// Don't wait for a loader thread to
+				// get around to it.
+				claim(t);
+				break;
+			}
+			if (t->m_demanded == false)
+			{
+				// Promote the hint.
+				t->m_demanded = true;
+				m_demand.push_back(index);
+				m_work.signal();
+			}
+		}
+
+		if (wait == false)
+		{
+			m_mutex.unlock();
+			return NULL;
+		}
+
+		// Another thread is decoding it.
+		if (waited == false)
+		{
+			m_stats.m_waits++;
+			waited = true;
+		}
+		m_done.wait(&m_mutex);
+	}
+	m_mutex.unlock();
+
+	// t is LOADING, by us.
+	uint64	start_ticks = tu_timer::get_profile_ticks();
+	image::rgb*	im = m_owner->decode_image(index);
+	image::rgb*	copy = im ? copy_image(im) : NULL;
+	finish_load(t, im, start_ticks);
+
+	return copy;
+}
+
+
+image::rgb*	tqt_cache::use(tqt_tile* t)
+// Mark the decoded tile most recently used, and return a copy of its
+// image.
+{
+	assert(t->m_state == tqt_tile::READY);
+
+	if (t->m_prefetched)
+	{
+		m_stats.m_prefetch_hits++;
+		t->m_prefetched = false;
+	}
+	unlink(t);
+	link_front(t);
+
+	return copy_image(t->m_image);
+}
+
+
+void	tqt_cache::prefetch(int index)
+// Queue the tile for the loader threads, unless we already have it.
+{
+	if (m_threads.size() == 0)
+	{
+		return;
+	}
+
+	tu_thread::autolock	lock(&m_mutex);
+
+	if (find(index))
+	{
+		return;
+	}
+
+	tqt_tile*	t = add(index, tqt_tile::QUEUED);
+	t->m_prefetched = true;
+	m_prefetch.push_back(index);
+	m_stats.m_prefetches++;
+
+	if (m_prefetch.size() > MAX_PREFETCH)
+	{
+		// Drop the oldest hint.
+		tqt_tile*	old = find(m_prefetch[0]);
+		if (old && old->m_state == tqt_tile::QUEUED && old->m_demanded == false)
+		{
+			remove(old);
+		}
+		m_prefetch.remove(0);
+	}
+
+	m_work.signal();
+}
+
+
+tqt_tile*	tqt_cache::pop_work()
+// Claim the newest queued tile, demands before hints.  Return NULL if
+// there's nothing to do.
+{
+	array<int>*	queues[2] = { &m_demand, &m_prefetch };
+	for (int q = 0; q < 2; q++)
+	{
+		array<int>&	queue = *queues[q];
+		while (queue.size())
+		{
+			int	index = queue.back();
+			queue.pop_back();
+
+			tqt_tile*	t = find(index);
+			if (t && t->m_state == tqt_tile::QUEUED
+			    && (q == 0 || t->m_demanded == false))	// else it's in m_demand too
+			{
+				claim(t);
+				return t;
+			}
+		}
+	}
+	return NULL;
+}
+
+
+void	tqt_cache::finish_load(tqt_tile* t, image::rgb* im, uint64 start_ticks)
+// t is decoded, as im, which may be NULL if the data was bad.  Make
+// room for it, and wake anybody waiting for it.
+{
+	double	seconds = tu_timer::profile_ticks_to_seconds(tu_timer::get_profile_ticks() - start_ticks);
+
+	tu_thread::autolock	lock(&m_mutex);
+	assert(t->m_state == tqt_tile::LOADING);
+
+	double	ms = seconds * 1000;
+	int	bucket = 0;
+	for (double limit = 1; ms >= limit && bucket < tqt_cache_stats::LATENCY_BUCKETS - 1; limit *= 2)
+	{
+		bucket++;
+	}
+	m_stats.m_decode_latency[bucket]++;
+	m_stats.m_decode_seconds += seconds;
+	m_stats.m_decodes++;
+
+	if (im == NULL)
+	{
+		remove(t);
+	}
+	else
+	{
+		t->m_image = im;
+		t->m_state = tqt_tile::READY;
+		m_bytes += image_bytes(im);
+		link_front(t);
+
+		// Evict, least recently used first, but keep the
+		// newcomer.
+		while (m_bytes > m_budget && m_lru.m_prev != t)
+		{
+			tqt_tile*	victim = m_lru.m_prev;
+			m_bytes -= image_bytes(victim->m_image);
+			unlink(victim);
+			remove(victim);
+			m_stats.m_evictions++;
+		}
+	}
+
+	m_done.broadcast();
+}
+
+
+/*static*/ void	tqt_cache::thread_main(void* cache)
+// Loader thread.  Decode queued tiles until we're told to quit.
+{
+	tqt_cache*	c = (tqt_cache*) cache;
+
+	for (;;)
+	{
+		tqt_tile*	t = NULL;
+		{
+			tu_thread::autolock	lock(&c->m_mutex);
+			for (;;)
+			{
+				if (c->m_quit)
+				{
+					return;
+				}
+				t = c->pop_work();
+				if (t)
+				{
+					break;
+				}
+				c->m_work.wait(&c->m_mutex);
+			}
+		}
+
+		uint64	start_ticks = tu_timer::get_profile_ticks();
+		image::rgb*	im = c->m_owner->decode_image(t->m_index);
+		c->finish_load(t, im, start_ticks);
+	}
+}
+
+
+void	tqt_cache::get_stats(tqt_cache_stats* stats)
+{
+	tu_thread::autolock	lock(&m_mutex);
+
+	*stats = m_stats;
+	stats->m_resident_tiles = 0;
+	for (tqt_tile* t = m_lru.m_next; t != &m_lru; t = t->m_next)
+	{
+		stats->m_resident_tiles++;
+	}
+	stats->m_resident_bytes = m_bytes;
+}
+
+
+void	tqt_cache::clear_stats()
+{
+	tu_thread::autolock	lock(&m_mutex);
+
+	int	queued = m_stats.m_queued_tiles;
+	m_stats.clear();
+	m_stats.m_queued_tiles = queued;
+}
+
+
 tqt::tqt(const char* filename)
 // Constructor.  Open the file and read the table of contents.  Keep
 // the stream open in order to load textures on demand.
 {
+	m_cache = NULL;
 	m_source = new tu_file(filename, "rb");
 	if (m_source == NULL) {
 		throw "tqt::tqt() can't open file.";
@@ -62,7 +544,7 @@ tqt::tqt(const char* filename)
 
 	// Read header.
 	tqt_header_info	info = read_tqt_header_info(m_source);
-	if (info.m_version != TQT_VERSION) {
+	if (info.m_version < 1 || info.m_version > TQT_VERSION) {
 		m_source = NULL;
 		throw "tqt::tqt() incorrect file version.";
 		return; // Hm.
@@ -70,9 +552,10 @@ tqt::tqt(const char* filename)
 
 	m_depth = info.m_tree_depth;
 	m_tile_size = info.m_tile_size;
+	m_tile_format = (tile_format) info.m_tile_format;
 
 	// Read table of contents.  Each entry is the offset of the
-	// index'ed tile's JPEG data, relative to the start of the file.
+	// index'ed tile's data, relative to the start of the file.
 	m_toc.resize(node_count(m_depth));
 	for (int i = 0; i < node_count(m_depth); i++) {
 		m_toc[i] = m_source->read_le32();
@@ -83,6 +566,7 @@ tqt::tqt(const char* filename)
 tqt::~tqt()
 // Destructor.  Close input file and release resources.
 {
+	delete m_cache;	// waits for the loader threads
 	delete m_source;
 }
 
@@ -107,14 +591,234 @@ image::rgb*	tqt::load_image(int level, int col, int row) const
 	int	index = node_index(level, col, row);
 	assert(index < m_toc.size());
 
-	// Load the .jpg and make a texture from it.
+	if (m_cache)
+	{
+		return m_cache->get(index, true);
+	}
+	return decode_image(index);
+}
+
+
+image::compressed*	tqt::load_compressed(int level, int col, int row) const
+// Read the blocks of the specified BC1 tile.  Caller becomes the
+// owner of the returned object.
+{
+	if (is_valid() == false || m_tile_format != BC1_TILES) {
+		return NULL;
+	}
+	assert(level < m_depth);
+
+	int	index = node_index(level, col, row);
+	assert(index < m_toc.size());
+
+	if (m_source->has_read_at())
+	{
+		tu_file	view(tu_file::view, m_source, m_toc[index]);
+		return image::read_compressed(&view);
+	}
+
+	tu_thread::autolock	lock(&m_source_mutex);
 	m_source->set_position(m_toc[index]);
+	return image::read_compressed(m_source);
+}
+
+
+static image::rgb*	decode_bc1_tile(image::compressed* tile)
+// Expand a BC1 tile to the rgb image the callers expect.  Deletes
+// tile.
+{
+	if (tile == NULL) {
+		return NULL;
+	}
+
+	image::rgba*	decoded = image::decompress(tile);
+	delete tile;
+
+	image::rgb*	im = image::create_rgb(decoded->m_width, decoded->m_height);
+	for (int y = 0; y < im->m_height; y++) {
+		const Uint8*	in = image::scanline(decoded, y);
+		Uint8*	out = image::scanline(im, y);
+		for (int x = 0; x < im->m_width; x++, in += 4, out += 3) {
+			out[0] = in[0];
+			out[1] = in[1];
+			out[2] = in[2];
+		}
+	}
+	delete decoded;
+
+	return im;
+}
+
+
+image::rgb*	tqt::decode_image(int index) const
+// Read and decode the data of the index'ed tile.
+{
+	// Reading through a view leaves m_source alone, so other
+	// threads can load tiles at the same time.
+	if (m_source->has_read_at())
+	{
+		tu_file	view(tu_file::view, m_source, m_toc[index]);
+		if (m_tile_format == BC1_TILES) {
+			return decode_bc1_tile(image::read_compressed(&view));
+		}
+		return image::read_jpeg(&view);
+	}
+
+	tu_thread::autolock	lock(&m_source_mutex);
+	m_source->set_position(m_toc[index]);
+	if (m_tile_format == BC1_TILES) {
+		return decode_bc1_tile(image::read_compressed(m_source));
+	}
 	image::rgb*	im = image::read_jpeg(m_source);
 
 	return im;
 }
 
 
+image::rgb*	tqt::get_cached_image(int level, int col, int row) const
+{
+	if (is_valid() == false) {
+		return NULL;
+	}
+	assert(level < m_depth);
+
+	int	index = node_index(level, col, row);
+	if (m_cache)
+	{
+		return m_cache->get(index, false);
+	}
+	return decode_image(index);
+}
+
+
+void	tqt::prefetch(int level, int col, int row) const
+{
+	if (m_cache == NULL) {
+		return;
+	}
+	assert(level < m_depth);
+
+	m_cache->prefetch(node_index(level, col, row));
+}
+
+
+void	tqt::prefetch_neighbors(int level, int col, int row, int radius) const
+{
+	if (m_cache == NULL) {
+		return;
+	}
+
+	// Children first: the queue is served newest first, and
+	// the neighbors are likelier to be wanted soon.
+	if (level + 1 < m_depth) {
+		for (int j = 0; j < 2; j++) {
+			for (int i = 0; i < 2; i++) {
+				prefetch(level + 1, col * 2 + i, row * 2 + j);
+			}
+		}
+	}
+
+	int	size = 1 << level;
+	for (int z = imax(0, row - radius); z <= imin(size - 1, row + radius); z++) {
+		for (int x = imax(0, col - radius); x <= imin(size - 1, col + radius); x++) {
+			if (x != col || z != row) {
+				prefetch(level, x, z);
+			}
+		}
+	}
+}
+
+
+void	tqt::prefetch_frustum(const plane_info frustum[6], const vec3& box_min, const vec3& box_max, int level) const
+{
+	if (m_cache == NULL) {
+		return;
+	}
+	assert(level < m_depth);
+
+	prefetch_frustum_node(frustum, box_min, box_max, level, 0, 0, 0, 0x3F);
+}
+
+
+void	tqt::prefetch_frustum_node(const plane_info frustum[6], const vec3& box_min, const vec3& box_max,
+				   int target_level, int level, int col, int row, Uint8 active_planes) const
+// Cull the node's part of the box, and prefetch the visible tiles
+// under it on the target level.
+{
+	float	size = float(1 << level);
+	vec3	node_min(box_min.get_x() + (box_max.get_x() - box_min.get_x()) * col / size,
+			 box_min.get_y(),
+			 box_min.get_z() + (box_max.get_z() - box_min.get_z()) * row / size);
+	vec3	node_max(box_min.get_x() + (box_max.get_x() - box_min.get_x()) * (col + 1) / size,
+			 box_max.get_y(),
+			 box_min.get_z() + (box_max.get_z() - box_min.get_z()) * (row + 1) / size);
+
+	cull::result_info	vis = cull::compute_box_visibility((node_min + node_max) * 0.5f, (node_max - node_min) * 0.5f,
+								   frustum, cull::result_info(false, active_planes));
+	if (vis.culled) {
+		return;
+	}
+
+	if (level == target_level) {
+		prefetch(level, col, row);
+		return;
+	}
+
+	for (int j = 0; j < 2; j++) {
+		for (int i = 0; i < 2; i++) {
+			prefetch_frustum_node(frustum, box_min, box_max, target_level,
+					      level + 1, col * 2 + i, row * 2 + j, vis.active_planes);
+		}
+	}
+}
+
+
+void	tqt::set_cache(int budget_bytes, int loader_threads)
+// Not safe while other threads are loading tiles.
+{
+	delete m_cache;
+	m_cache = NULL;
+
+	if (budget_bytes > 0 && is_valid())
+	{
+		if (loader_threads <= 0)
+		{
+			// I/O and decode, so use at least two threads
+			// even on one processor.
+			loader_threads = iclamp(tu_thread::get_processor_count(), 2, 8);
+		}
+#if TU_CONFIG_LINK_TO_THREAD == 0
+		// No real threads; a loader would never return.
+		loader_threads = 0;
+#endif
+		m_cache = new tqt_cache(this, budget_bytes, loader_threads);
+	}
+}
+
+
+void	tqt::get_cache_stats(tqt_cache_stats* stats) const
+{
+	assert(stats);
+	if (m_cache)
+	{
+		m_cache->get_stats(stats);
+	}
+	else
+	{
+		stats->clear();
+	}
+}
+
+
+void	tqt::clear_cache_stats()
+{
+	if (m_cache)
+	{
+		m_cache->clear_stats();
+	}
+}
+
+
 /*static*/ int tqt::node_count(int depth)
 // Return the number of nodes in a fully populated quadtree of the specified depth.
 {
@@ -146,7 +850,7 @@ image::rgb*	tqt::load_image(int level, int col, int row) const
 	// Read header.
 	tqt_header_info	info = read_tqt_header_info(&in);
 
-	if (info.m_version != TQT_VERSION)
+	if (info.m_version < 1 || info.m_version > TQT_VERSION)
 	{
 		return false;
 	}
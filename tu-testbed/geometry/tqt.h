@@ -11,22 +11,104 @@
 
 #include "base/container.h"
 #include "base/image.h"
+#include "base/tu_thread.h"
+#include "geometry/geometry.h"
 class tu_file;
+struct tqt_cache;
+
+
+struct tqt_cache_stats
+// Tile cache counters, since the last clear_cache_stats().  Decode
+// latency is the time to read and decode one tile; bucket 0 counts
+// decodes that took under 1 ms, bucket i those that took
+// [2^(i-1), 2^i) ms, and the last bucket everything longer.
+{
+	enum { LATENCY_BUCKETS = 16 };
+
+	int	m_lookups;	// load_image() and get_cached_image() calls
+	int	m_hits;		// ... that found the tile decoded
+	int	m_waits;	// ... that waited for a loader thread to finish it
+	int	m_prefetches;	// tiles queued by prefetch hints
+	int	m_prefetch_hits;	// prefetched tiles that got used
+	int	m_decodes;
+	int	m_evictions;
+	int	m_decode_latency[LATENCY_BUCKETS];
+	double	m_decode_seconds;	// total
+
+	// Not counters; the state of the cache now.
+	int	m_resident_tiles;
+	int	m_resident_bytes;
+	int	m_queued_tiles;
+
+	float	get_hit_rate() const { return m_lookups ? float(m_hits) / m_lookups : 0.0f; }
+	void	clear();
+};
 
 
 class tqt
 // Manages a disk-based texture quadtree.
 {
 public:
+	// How the tiles are stored.  BC1 tiles are block-compressed
+	// (see image::compressed), and can be uploaded as they are.
+	enum tile_format
+	{
+		JPEG_TILES = 0,
+		BC1_TILES = 1
+	};
+
 	tqt(const char* filename);
 	~tqt();
 	bool	is_valid() const { return m_source != NULL; }
 	int	get_depth() const { return m_depth; }
 	int	get_tile_size() const { return m_tile_size; }
+	tile_format	get_tile_format() const { return m_tile_format; }
 
 	unsigned int	get_texture_id(int level, int col, int row) const;
+
+	// Safe to call from several threads at once.  The caller
+	// owns the returned image.
 	image::rgb*	load_image(int level, int col, int row) const;
 
+	// The tile's blocks as stored, for BC1_TILES files; NULL
+	// otherwise.  Bypasses the cache.  The caller owns the
+	// returned image.
+	image::compressed*	load_compressed(int level, int col, int row) const;
+
+	// Tile cache.  Off until given a budget.  With the cache on,
+	// load_image() copies tiles out of the cache instead of
+	// decoding them again, and loader threads decode tiles in the
+	// background, for get_cached_image() and the prefetch hints.
+	// When the decoded tiles take more than budget_bytes, the
+	// least recently used ones go.  loader_threads == 0 means pick
+	// a number based on the processor count.  A budget of 0 turns
+	// the cache off.
+	void	set_cache(int budget_bytes, int loader_threads = 0);
+
+	// Doesn't block: returns a copy of the tile if it's decoded,
+	// otherwise queues it for the loader threads and returns
+	// NULL.  Newer requests are served first.  Without the cache
+	// (or without threads), this is the same as load_image().
+	image::rgb*	get_cached_image(int level, int col, int row) const;
+
+	// Hints that tiles will be wanted soon.  They're decoded when
+	// the loader threads have nothing better to do; only the
+	// most recent hints are kept.  No-ops without the cache.
+	void	prefetch(int level, int col, int row) const;
+
+	// The tiles within 'radius' of the given one on its level, and
+	// its children.
+	void	prefetch_neighbors(int level, int col, int row, int radius = 1) const;
+
+	// The tiles on the given level that touch the frustum, when
+	// the whole texture covers the x/z extent of the box from
+	// box_min to box_max (column 0 at min x, row 0 at min z).
+	// Frustum planes are as for cull::compute_box_visibility().
+	void	prefetch_frustum(const plane_info frustum[6], const vec3& box_min, const vec3& box_max, int level) const;
+
+	void	get_cache_stats(tqt_cache_stats* stats) const;
+	void	clear_cache_stats();
+
 	// Static utility functions.
 	static bool	is_tqt_file(const char* filename);
 	static int	node_count(int depth);
@@ -36,7 +118,15 @@ private:
 	array<unsigned int>	m_toc;
 	int	m_depth;
 	int	m_tile_size;
+	tile_format	m_tile_format;
 	tu_file*	m_source;
+	mutable tu_thread::mutex	m_source_mutex;	// if m_source can't read_at()
+	tqt_cache*	m_cache;	// NULL unless set_cache()
+
+	friend struct tqt_cache;
+	image::rgb*	decode_image(int index) const;
+	void	prefetch_frustum_node(const plane_info frustum[6], const vec3& box_min, const vec3& box_max,
+				      int target_level, int level, int col, int row, Uint8 active_planes) const;
 };
 
 
@@ -16,6 +16,7 @@
 #include "net/http_server.h"
 #include "net/net_interface.h"
 #include "base/tu_timer.h"
+#include "base/tu_profile.h"
 #include "base/logger.h"
 
 
@@ -114,6 +115,8 @@ bool http_server::add_handler(const char* path, http_handler* handler)
 void http_server::update()
 // Call this periodically to serve pending requests.
 {
+	TU_PROFILE_ZONE("http_server::update");
+
 	// if (active sockets < 10 or so)
 	// Check for new connections.
 	net_socket* sock = m_net->accept();